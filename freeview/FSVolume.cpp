@@ -44,6 +44,7 @@
 #include <QDir>
 #include <QDebug>
 #include "ProgressCallback.h"
+#include "VolumeBrickCache.h"
 #ifdef HAVE_OPENMP
 #include <omp.h>
 #endif
@@ -84,7 +85,11 @@ FSVolume::FSVolume( FSVolume* ref, QObject* parent ) : QObject( parent ),
   m_bValidHistogram(false),
   m_bSharedMRI(false),
   m_lta(NULL),
-  m_bIgnoreHeader(false)
+  m_bIgnoreHeader(false),
+  m_bOutOfCore(false),
+  m_bOutOfCoreNearest(false),
+  m_brickCache(NULL),
+  m_nOutOfCoreProxyLevel(0)
 {
   m_imageData = NULL;
   if ( ref )
@@ -161,7 +166,10 @@ bool FSVolume::LoadMRI( const QString& filename, const QString& reg_filename )
   MRI* tempMRI = m_MRI;
   try
   {
-    m_MRI = ::MRIread( filename.toLatin1().data() );      // could be long process
+    if ( m_bOutOfCore )
+      m_MRI = LoadOutOfCoreMRI( filename );
+    else
+      m_MRI = ::MRIread( filename.toLatin1().data() );      // could be long process
   }
   catch (int ret)
   {
@@ -242,6 +250,248 @@ bool FSVolume::LoadMRI( const QString& filename, const QString& reg_filename )
   return true;
 }
 
+// Builds (or reuses) the brick pyramid of the file and returns a coarse
+// level of it, small enough to keep in memory, as the volume
+MRI* FSVolume::LoadOutOfCoreMRI( const QString& filename )
+{
+  if ( m_brickCache )
+  {
+    delete m_brickCache;
+  }
+  m_brickCache = new VolumeBrickCache( this );
+  if ( !m_brickCache->Open( filename, m_bOutOfCoreNearest ) )
+  {
+    delete m_brickCache;
+    m_brickCache = NULL;
+    return NULL;
+  }
+
+  m_nOutOfCoreProxyLevel = m_brickCache->GetLevelForVoxelCount( 256*256*256 );
+  int dim[3];
+  m_brickCache->GetDimensions( m_nOutOfCoreProxyLevel, dim );
+  cout << "Out-of-core: showing level " << m_nOutOfCoreProxyLevel << " (" << dim[0] << "x" << dim[1] << "x" << dim[2]
+       << ") of " << qPrintable(filename) << " until zoomed in\n";
+  return m_brickCache->CreateLevelMRI( m_nOutOfCoreProxyLevel );
+}
+
+bool FSVolume::MapOutOfCoreAxes( const double* pos, int* axis, double* idx, double* step )
+{
+  if ( !m_brickCache || !m_imageData )
+  {
+    return false;
+  }
+
+  // level-0 pyramid voxel of pos, and of one target voxel further along each axis
+  double vs[3];
+  m_imageData->GetSpacing( vs );
+  double s = 1 << m_nOutOfCoreProxyLevel;
+  double offset = m_brickCache->GetLevelOffset( m_nOutOfCoreProxyLevel );
+  double p[4][3];
+  for ( int n = 0; n < 4; n++ )
+  {
+    double t[3] = { pos[0], pos[1], pos[2] }, ras[3];
+    if ( n < 3 )
+    {
+      t[n] += vs[n];
+    }
+    TargetToRAS( t, ras );
+    float fidx[3];
+    RASToOriginalIndex( ras[0], ras[1], ras[2], fidx[0], fidx[1], fidx[2] );
+    for ( int k = 0; k < 3; k++ )
+    {
+      p[n][k] = fidx[k]*s + offset;
+    }
+  }
+
+  // each target axis has to run along a single pyramid axis
+  bool used[3] = { false, false, false };
+  for ( int a = 0; a < 3; a++ )
+  {
+    double d[3];
+    int k0 = 0;
+    for ( int k = 0; k < 3; k++ )
+    {
+      d[k] = p[a][k] - p[3][k];
+      if ( fabs( d[k] ) > fabs( d[k0] ) )
+      {
+        k0 = k;
+      }
+    }
+    for ( int k = 0; k < 3; k++ )
+    {
+      if ( k != k0 && fabs( d[k] ) > 0.01*fabs( d[k0] ) )
+      {
+        return false;
+      }
+    }
+    if ( used[k0] || d[k0] == 0 )
+    {
+      return false;
+    }
+    used[k0] = true;
+    axis[a] = k0;
+    step[a] = d[k0];
+  }
+  for ( int k = 0; k < 3; k++ )
+  {
+    idx[k] = p[3][k];
+  }
+  return true;
+}
+
+bool FSVolume::GetOutOfCoreVoxelScale( double* scale )
+{
+  int axis[3];
+  double idx[3], step[3];
+  if ( !m_imageData || !MapOutOfCoreAxes( m_imageData->GetOrigin(), axis, idx, step ) )
+  {
+    return false;
+  }
+  for ( int i = 0; i < 3; i++ )
+  {
+    scale[i] = fabs( step[i] );
+  }
+  return true;
+}
+
+// The pyramid axis and level-0 slice of the plane through pos, and the
+// voxels of a level inside bounds (the part of the plane in view) along
+// the two other pyramid axes, lower axis first
+bool FSVolume::GetOutOfCoreRegion( int nPlane, const double* pos, int nLevel, const double* bounds,
+                                   int* axis, double* idx, double* step, int* nSlice, int* range )
+{
+  if ( !MapOutOfCoreAxes( pos, axis, idx, step ) )
+  {
+    return false;
+  }
+
+  int kn = axis[nPlane];
+  int dim0[3], dim[3];
+  m_brickCache->GetDimensions( 0, dim0 );
+  m_brickCache->GetDimensions( nLevel, dim );
+  *nSlice = (int)floor( idx[kn] + 0.5 );
+  if ( *nSlice < 0 || *nSlice >= dim0[kn] )
+  {
+    return false;
+  }
+
+  double vs[3];
+  m_imageData->GetSpacing( vs );
+  double s = 1 << nLevel, offset = m_brickCache->GetLevelOffset( nLevel );
+  for ( int a = 0; a < 3; a++ )
+  {
+    if ( a == nPlane )
+    {
+      continue;
+    }
+    // level voxels at the two edges of the view, and one more on either
+    // side for the interpolation
+    int k = axis[a];
+    int i = ( k == ( kn == 0 ? 1 : 0 ) ? 0 : 2 );
+    double j0 = ( idx[k] + ( bounds[2*a] - pos[a] )/vs[a]*step[a] - offset )/s;
+    double j1 = ( idx[k] + ( bounds[2*a+1] - pos[a] )/vs[a]*step[a] - offset )/s;
+    range[i] = qMax( 0, (int)floor( qMin( j0, j1 ) ) - 1 );
+    range[i+1] = qMin( dim[k]-1, (int)ceil( qMax( j0, j1 ) ) + 1 );
+    if ( range[i+1] < range[i] )
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+vtkImageData* FSVolume::CreateOutOfCoreSlice( int nPlane, const double* pos, int nLevel, const double* bounds )
+{
+  int axis[3], nSlice, range[4];
+  double idx[3], step[3];
+  if ( !GetOutOfCoreRegion( nPlane, pos, nLevel, bounds, axis, idx, step, &nSlice, range ) )
+  {
+    return NULL;
+  }
+
+  // the region comes back over the other two pyramid axes, lower one fastest
+  int kn = axis[nPlane];
+  int k1 = ( kn == 0 ? 1 : 0 );
+  int n1 = range[1]-range[0]+1, n2 = range[3]-range[2]+1;
+  std::vector<float> buffer( (size_t)n1*n2 );
+  if ( !m_brickCache->GetSlice( kn, nSlice, nLevel, range, &buffer[0], true ) )
+  {
+    return NULL;
+  }
+
+  double vs[3];
+  m_imageData->GetSpacing( vs );
+  double s = 1 << nLevel, offset = m_brickCache->GetLevelOffset( nLevel );
+  int image_dim[3], lo[3], hi[3];
+  double origin[3], spacing[3];
+  for ( int a = 0; a < 3; a++ )
+  {
+    if ( a == nPlane )
+    {
+      image_dim[a] = 1;
+      origin[a] = pos[a];
+      spacing[a] = vs[a];
+      continue;
+    }
+    // image voxel 0 is the first or the last level voxel of the region,
+    // whichever has the lower target coordinate
+    int k = axis[a];
+    lo[a] = range[k == k1 ? 0 : 2];
+    hi[a] = range[k == k1 ? 1 : 3];
+    double c = ( step[a] > 0 ? lo[a] : hi[a] )*s + offset;
+    image_dim[a] = hi[a]-lo[a]+1;
+    spacing[a] = s*vs[a]/fabs( step[a] );
+    origin[a] = pos[a] + ( c - idx[k] )/step[a]*vs[a];
+  }
+
+  vtkImageData* image = vtkImageData::New();
+  image->SetDimensions( image_dim );
+  image->SetOrigin( origin );
+  image->SetSpacing( spacing );
+#if VTK_MAJOR_VERSION > 5
+  image->AllocateScalars( VTK_FLOAT, 1 );
+#else
+  image->SetNumberOfScalarComponents( 1 );
+  image->SetScalarTypeToFloat();
+  image->AllocateScalars();
+#endif
+  float* ptr = (float*)image->GetScalarPointer();
+  if ( !ptr )
+  {
+    image->Delete();
+    return NULL;
+  }
+  int m[3], j[3] = { 0, 0, 0 };
+  for ( m[2] = 0; m[2] < image_dim[2]; m[2]++ )
+  {
+    for ( m[1] = 0; m[1] < image_dim[1]; m[1]++ )
+    {
+      for ( m[0] = 0; m[0] < image_dim[0]; m[0]++ )
+      {
+        for ( int a = 0; a < 3; a++ )
+        {
+          if ( a != nPlane )
+          {
+            j[axis[a]] = ( step[a] > 0 ? lo[a] + m[a] : hi[a] - m[a] );
+          }
+        }
+        *ptr++ = buffer[(size_t)( j[kn == 2 ? 1 : 2] - range[2] )*n1 + j[k1] - range[0]];
+      }
+    }
+  }
+  return image;
+}
+
+void FSVolume::RequestOutOfCoreSlice( int nPlane, const double* pos, int nLevel, const double* bounds )
+{
+  int axis[3], nSlice, range[4];
+  double idx[3], step[3];
+  if ( GetOutOfCoreRegion( nPlane, pos, nLevel, bounds, axis, idx, step, &nSlice, range ) )
+  {
+    m_brickCache->Request( axis[nPlane], nSlice, nLevel, range );
+  }
+}
+
 bool FSVolume::MRIRead( const QString& filename, const QString& reg_filename )
 {
 #ifdef HAVE_OPENMP
@@ -37,6 +37,7 @@
 
 
 class vtkTransform;
+class VolumeBrickCache;
 
 class FSVolume : public QObject
 {
@@ -225,6 +226,37 @@ public:
     m_bIgnoreHeader = b;
   }
 
+  // keep the voxels on disk: load a coarse level of the brick pyramid as
+  // the volume and fetch finer slices on demand (see VolumeBrickCache)
+  void SetOutOfCore(bool bOutOfCore, bool bNearest = false)
+  {
+    m_bOutOfCore = bOutOfCore;
+    m_bOutOfCoreNearest = bNearest;
+  }
+
+  VolumeBrickCache* GetBrickCache()
+  {
+    return m_brickCache;
+  }
+
+  int GetOutOfCoreProxyLevel()
+  {
+    return m_nOutOfCoreProxyLevel;
+  }
+
+  // level-0 voxels of the brick pyramid per target voxel along each axis,
+  // or false if the volume is oblique to the target
+  bool GetOutOfCoreVoxelScale(double* scale);
+
+  // the part inside bounds (target coordinates) of the slice through pos in
+  // the given plane at a brick pyramid level, in target coordinates, or NULL
+  // if its bricks are not all in memory yet. caller owns the returned image
+  vtkImageData* CreateOutOfCoreSlice(int nPlane, const double* pos, int nLevel, const double* bounds);
+
+  // loads the bricks of that slice in the background (see
+  // VolumeBrickCache::BricksLoaded)
+  void RequestOutOfCoreSlice(int nPlane, const double* pos, int nLevel, const double* bounds);
+
 Q_SIGNALS:
   void ProgressChanged( int n );
 
@@ -236,6 +268,10 @@ public slots:
 
 protected:
   bool LoadMRI( const QString& filename, const QString& reg_filename );
+  MRI* LoadOutOfCoreMRI( const QString& filename );
+  bool MapOutOfCoreAxes( const double* pos, int* axis, double* idx, double* step );
+  bool GetOutOfCoreRegion( int nPlane, const double* pos, int nLevel, const double* bounds,
+                           int* axis, double* idx, double* step, int* nSlice, int* range );
   void UpdateHistoCDF(int frame = 0, float threshold = -1, bool bHighThreshold = false);
   void CopyMRIDataToImage( MRI* mri, vtkImageData* image );
   void CopyMatricesFromMRI();
@@ -290,6 +326,11 @@ protected:
   bool      m_bCropToOriginal;
 
   bool      m_bSharedMRI;
+
+  bool      m_bOutOfCore;
+  bool      m_bOutOfCoreNearest;
+  VolumeBrickCache* m_brickCache;
+  int       m_nOutOfCoreProxyLevel;
 };
 
 #endif
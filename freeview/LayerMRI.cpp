@@ -104,7 +104,9 @@ LayerMRI::LayerMRI( LayerMRI* ref, QObject* parent ) : LayerVolumeBase( parent )
   m_nGotoLabelOrientation(-1),
   m_layerMask(NULL),
   m_correlationSurface(NULL),
-  m_bIgnoreHeader(false)
+  m_bIgnoreHeader(false),
+  m_bOutOfCore(false),
+  m_bOutOfCoreNearest(false)
 {
   m_strTypeNames.push_back( "Supplement" );
   m_strTypeNames.push_back( "MRI" );
@@ -116,6 +118,11 @@ LayerMRI::LayerMRI( LayerMRI* ref, QObject* parent ) : LayerVolumeBase( parent )
 #endif
   for ( int i = 0; i < 3; i++ )
   {
+    m_nOutOfCoreLevel[i] = m_nOutOfCoreShownLevel[i] = 0;
+    for ( int j = 0; j < 6; j++ )
+    {
+      m_dOutOfCoreView[i][j] = 0;
+    }
     // m_nSliceNumber[i] = 0;
     m_sliceActor2D[i] = vtkImageActor::New();
     m_sliceActor3D[i] = vtkImageActor::New();
@@ -348,6 +355,7 @@ bool LayerMRI::LoadVolumeFromFile()
   m_volumeSource->SetConform( m_bConform );
   m_volumeSource->SetInterpolationMethod( m_nSampleMethod );
   m_volumeSource->SetIgnoreHeader(m_bIgnoreHeader);
+  m_volumeSource->SetOutOfCore(m_bOutOfCore, m_bOutOfCoreNearest);
   
   if ( !m_volumeSource->MRIRead( m_sFilename.toLatin1().data(),
                                  m_sRegFilename.size() > 0 ? m_sRegFilename.toLatin1().data() : NULL ) )
@@ -358,6 +366,20 @@ bool LayerMRI::LoadVolumeFromFile()
   ParseSubjectName(m_sFilename);
   InitializeVolume();
   InitializeActors();
+
+  if ( m_bOutOfCore )
+  {
+    // only a coarse copy of the voxels is in memory, so it cannot be edited
+    // or saved. finer levels are shown once a view zooms in
+    SetEditable( false );
+    for ( int i = 0; i < 3; i++ )
+    {
+      m_nOutOfCoreLevel[i] = m_nOutOfCoreShownLevel[i] = m_volumeSource->GetOutOfCoreProxyLevel();
+    }
+    // this runs in the io thread and the bricks arrive from the prefetch thread
+    connect( m_volumeSource->GetBrickCache(), SIGNAL(BricksLoaded()), this, SLOT(OnOutOfCoreBricksLoaded()),
+             Qt::QueuedConnection );
+  }
   
   GetProperty()->SetVolumeSource( m_volumeSource );
   GetProperty()->RestoreSettings( m_sFilename );
@@ -577,6 +599,12 @@ bool LayerMRI::SaveVolume()
   {
     return false;
   }
+
+  if ( m_bOutOfCore )
+  {
+    cerr << "Volumes loaded out-of-core cannot be saved.\n";
+    return false;
+  }
   
   ::SetProgressCallback(ProgressCallback, 0, 60);
   if ( !m_volumeSource->UpdateMRIFromImage( m_imageData, !m_bReorient ) )
@@ -1271,6 +1299,10 @@ void LayerMRI::OnSlicePositionChanged( int nPlane )
     mReslice[2]->Modified();
     break;
   }
+  if ( m_bOutOfCore )
+  {
+    UpdateOutOfCoreSlice( nPlane );
+  }
   // display 4D data as vector
   if ( GetProperty()->GetDisplayVector() )
   {
@@ -1286,6 +1318,97 @@ void LayerMRI::OnSlicePositionChanged( int nPlane )
   }
 }
 
+void LayerMRI::SetOutOfCoreView( int nPlane, double dWorldPerPixel, const double* bounds )
+{
+  double scale[3];
+  if ( !m_bOutOfCore || !m_volumeSource || !m_volumeSource->GetOutOfCoreVoxelScale( scale ) )
+  {
+    return;
+  }
+
+  // full resolution voxels covered by one screen pixel, along the finer in-plane axis
+  double vs[3];
+  m_imageData->GetSpacing( vs );
+  double dVoxelsPerPixel = 1e10;
+  for ( int i = 0; i < 3; i++ )
+  {
+    if ( i != nPlane )
+    {
+      dVoxelsPerPixel = qMin( dVoxelsPerPixel, dWorldPerPixel/vs[i]*scale[i] );
+    }
+  }
+  int nLevel = qMin( m_volumeSource->GetBrickCache()->GetLevelForVoxelsPerPixel( dVoxelsPerPixel ),
+                     m_volumeSource->GetOutOfCoreProxyLevel() );
+  bool bChanged = ( nLevel != m_nOutOfCoreLevel[nPlane] );
+  for ( int i = 0; i < 6; i++ )
+  {
+    // the slice position itself is handled by OnSlicePositionChanged
+    if ( i/2 != nPlane && bounds[i] != m_dOutOfCoreView[nPlane][i] )
+    {
+      bChanged = true;
+    }
+    m_dOutOfCoreView[nPlane][i] = bounds[i];
+  }
+  if ( bChanged )
+  {
+    m_nOutOfCoreLevel[nPlane] = nLevel;
+    UpdateOutOfCoreSlice( nPlane );
+    emit ActorUpdated();
+  }
+}
+
+// Feeds the 2D slice pipeline of a plane the part in view of the slice at
+// the current level, if its bricks are in memory. Until the prefetch thread
+// has loaded them, the finest coarser level that is in memory is shown,
+// down to the in-memory (coarse) volume
+void LayerMRI::UpdateOutOfCoreSlice( int nPlane )
+{
+  vtkSmartPointer<vtkImageData> image;
+  int nProxyLevel = m_volumeSource->GetOutOfCoreProxyLevel();
+  int nLevel = m_nOutOfCoreLevel[nPlane];
+  for ( ; nLevel < nProxyLevel && !image.GetPointer(); nLevel++ )
+  {
+    image.TakeReference( m_volumeSource->CreateOutOfCoreSlice( nPlane, m_dSlicePosition, nLevel,
+                                                               m_dOutOfCoreView[nPlane] ) );
+  }
+  if ( image.GetPointer() )
+  {
+    nLevel--;
+  }
+  if ( m_nOutOfCoreLevel[nPlane] < nProxyLevel )
+  {
+    // also prefetches the layers around it if it is already in memory
+    m_volumeSource->RequestOutOfCoreSlice( nPlane, m_dSlicePosition, m_nOutOfCoreLevel[nPlane],
+                                           m_dOutOfCoreView[nPlane] );
+  }
+  m_nOutOfCoreShownLevel[nPlane] = nLevel;
+  m_imageOutOfCore[nPlane] = image;
+  vtkImageData* input = ( image.GetPointer() ? image.GetPointer() : m_imageData.GetPointer() );
+#if VTK_MAJOR_VERSION > 5
+  mReslice[nPlane]->SetInputData( input );
+#else
+  mReslice[nPlane]->SetInput( input );
+#endif
+  mReslice[nPlane]->Modified();
+}
+
+void LayerMRI::OnOutOfCoreBricksLoaded()
+{
+  bool bUpdated = false;
+  for ( int i = 0; i < 3; i++ )
+  {
+    if ( m_nOutOfCoreShownLevel[i] != m_nOutOfCoreLevel[i] )
+    {
+      UpdateOutOfCoreSlice( i );
+      bUpdated = true;
+    }
+  }
+  if ( bUpdated )
+  {
+    emit ActorUpdated();
+  }
+}
+
 void LayerMRI::UpdateDisplayMode()
 {
   for ( int i = 0; i < 3; i++ )
@@ -329,6 +329,22 @@ public:
     m_bIgnoreHeader = b;
   }
 
+  // read the volume through a brick pyramid on disk instead of into memory
+  void SetOutOfCore(bool bOutOfCore, bool bNearest = false)
+  {
+    m_bOutOfCore = bOutOfCore;
+    m_bOutOfCoreNearest = bNearest;
+  }
+
+  bool IsOutOfCore()
+  {
+    return m_bOutOfCore;
+  }
+
+  // picks the pyramid level shown in a 2D view from its zoom, and the part
+  // of the slice to read from the bounds (target coordinates) of the view
+  void SetOutOfCoreView(int nPlane, double dWorldPerPixel, const double* bounds);
+
   QVector<double> GetVoxelList(int nVal);
 
   QVariantMap GetTimeSeriesInfo();
@@ -365,6 +381,7 @@ Q_SIGNALS:
 
 protected slots:
   void UpdateDisplayMode();
+  void OnOutOfCoreBricksLoaded();
   virtual void UpdateOpacity();
   void UpdateTextureSmoothing();
   void UpdateContour( int nSegIndex = -1 );
@@ -412,6 +429,7 @@ protected:
   void UpdateTensorActor( int nPlane, vtkImageData* imagedata = NULL );
   void GetColorWheelColor(double* v, int plane, unsigned char* c_out);
   void UpdateNiftiHeader();
+  void UpdateOutOfCoreSlice( int nPlane );
 
   std::vector<int> GetVoxelIndicesBetweenPoints( int* n0, int* n1 );
   void BuildTensorGlyph( vtkImageData* imagedata,
@@ -440,6 +458,12 @@ protected:
   bool    m_bConform;
   bool    m_bWriteResampled;
   bool    m_bIgnoreHeader;
+  bool    m_bOutOfCore;
+  bool    m_bOutOfCoreNearest;
+  int     m_nOutOfCoreLevel[3];        // level each view wants
+  int     m_nOutOfCoreShownLevel[3];   // level each view shows
+  double  m_dOutOfCoreView[3][6];
+  vtkSmartPointer<vtkImageData> m_imageOutOfCore[3];
 
   vtkImageActor*  m_sliceActor2D[3];
   vtkImageActor*  m_sliceActor3D[3];
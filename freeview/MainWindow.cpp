@@ -2449,6 +2449,10 @@ void MainWindow::CommandLoadVolume( const QStringList& sa )
       {
         sup_data["IgnoreHeader"] = true;
       }
+      else if (subOption == "out_of_core")
+      {
+        sup_data["OutOfCore"] = (subArgu == "1" || subArgu.toLower() == "true");
+      }
       else if (subOption == "binary_color")
       {
         QColor color = ParseColorInput( subArgu );
@@ -2532,6 +2536,9 @@ void MainWindow::CommandLoadVolume( const QStringList& sa )
     orientation = 0;
   }
 
+  // label volumes are subsampled rather than averaged for the coarser levels
+  if (sup_data.value("OutOfCore").toBool())
+    sup_data["OutOfCoreNearest"] = (colormap == "lut");
 
   LoadVolumeFile( fn, reg_fn, bResample, nSampleMethod, bConform, orientation, gotoLabelName, sup_data );
 }
@@ -5446,6 +5453,8 @@ void MainWindow::LoadVolumeFile( const QString& filename,
 
   if (sup_data.value("IgnoreHeader").toBool())
     layer->SetIgnoreHeader(true);
+  if (sup_data.value("OutOfCore").toBool())
+    layer->SetOutOfCore(true, sup_data.value("OutOfCoreNearest").toBool());
 
   m_threadIOWorker->LoadVolume( layer );
 }
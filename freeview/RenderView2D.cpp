@@ -279,6 +279,27 @@ void RenderView2D::Update2DOverlay()
   double slicePos[3];
   MainWindow::GetMainWindow()->GetLayerCollection( "MRI" )->GetSlicePosition( slicePos );
   m_contour2D->UpdateSliceLocation( slicePos[m_nViewPlane] );
+
+  // out-of-core volumes show the pyramid level that matches the zoom, and
+  // only read the part of the slice that is in view
+  double dWorldPerPixel = 2*m_renderer->GetActiveCamera()->GetParallelScale()/qMax( 1, rect().height() );
+  double p0[3], p1[3], bounds[6];
+  MousePositionToRAS( 0, 0, p0 );
+  MousePositionToRAS( rect().width(), rect().height(), p1 );
+  for ( int i = 0; i < 3; i++ )
+  {
+    bounds[2*i] = qMin( p0[i], p1[i] );
+    bounds[2*i+1] = qMax( p0[i], p1[i] );
+  }
+  QList<Layer*> layers = MainWindow::GetMainWindow()->GetLayers( "MRI" );
+  foreach ( Layer* layer, layers )
+  {
+    LayerMRI* mri = qobject_cast<LayerMRI*>( layer );
+    if ( mri && mri->IsOutOfCore() )
+    {
+      mri->SetOutOfCoreView( m_nViewPlane, dWorldPerPixel, bounds );
+    }
+  }
 }
 
 void RenderView2D::OnSlicePositionChanged(bool bCenter)
@@ -0,0 +1,693 @@
+/**
+ * @brief Out-of-core, multiresolution brick store for very large volumes.
+ *
+ */
+/*
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include "VolumeBrickCache.h"
+#include "VolumeBrickPrefetchThread.h"
+#include <QFileInfo>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QCryptographicHash>
+#include <QCoreApplication>
+#include <QMutexLocker>
+#include <vector>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "bfileio.h"
+#include "znzlib.h"
+#include "utils.h"
+
+using namespace std;
+
+// fixed size of the .mgh header in front of the voxel data
+#define MGH_HEADER_SIZE 284
+
+#define BRICK_FILE_MAGIC    0x46565042    // "FVPB"
+#define BRICK_FILE_VERSION  1
+#define BRICK_HEADER_SIZE   64
+
+struct BrickFileHeader
+{
+  int magic;
+  int version;
+  int type;
+  int level;
+  int dim[3];
+  int brick;
+  int nearest;
+  int unused;
+  qint64 source_size;
+  qint64 source_time;
+};
+
+template <class T> static void ConvertToFloat(const char* in, float* out, size_t n)
+{
+  const T* p = (const T*)in;
+  for (size_t i = 0; i < n; i++)
+    out[i] = (float)p[i];
+}
+
+template <class T> static void ConvertFromFloat(const float* in, char* out, size_t n, bool bRound)
+{
+  T* p = (T*)out;
+  for (size_t i = 0; i < n; i++)
+    p[i] = (T)(bRound ? nint(in[i]) : in[i]);
+}
+
+static void VoxelsToFloat(int type, const char* in, float* out, size_t n)
+{
+  switch (type)
+  {
+  case MRI_UCHAR: ConvertToFloat<unsigned char>(in, out, n); break;
+  case MRI_SHORT: ConvertToFloat<short>(in, out, n); break;
+  case MRI_INT:   ConvertToFloat<int>(in, out, n); break;
+  default:        memcpy(out, in, n*sizeof(float)); break;
+  }
+}
+
+static void FloatToVoxels(int type, const float* in, char* out, size_t n)
+{
+  switch (type)
+  {
+  case MRI_UCHAR: ConvertFromFloat<unsigned char>(in, out, n, true); break;
+  case MRI_SHORT: ConvertFromFloat<short>(in, out, n, true); break;
+  case MRI_INT:   ConvertFromFloat<int>(in, out, n, true); break;
+  default:        memcpy(out, in, n*sizeof(float)); break;
+  }
+}
+
+static bool ReadAt(int fd, void* buf, size_t nbytes, qint64 offset)
+{
+  char* p = (char*)buf;
+  while (nbytes > 0)
+  {
+    ssize_t n = pread(fd, p, nbytes, (off_t)offset);
+    if (n <= 0)
+      return false;
+    p += n;
+    offset += n;
+    nbytes -= n;
+  }
+  return true;
+}
+
+VolumeBrickCache::VolumeBrickCache( QObject* parent ) : QObject( parent ),
+  m_mriHeader( NULL ),
+  m_bNearest( false ),
+  m_nType( MRI_FLOAT ),
+  m_nBytesPerVoxel( sizeof(float) ),
+  m_nSourceSize( 0 ),
+  m_nSourceTime( 0 ),
+  m_nCacheBytes( 0 ),
+  m_nMaxCacheBytes( (qint64)1024*1024*1024 )
+{
+  char* env = getenv("FS_FREEVIEW_BRICK_CACHE_MB");
+  if (env && atoi(env) > 0)
+    SetCacheSize(atoi(env));
+  m_prefetch = new VolumeBrickPrefetchThread(this);
+  // emitted from the prefetch thread, so receivers get it queued
+  connect(m_prefetch, SIGNAL(BricksLoaded()), this, SIGNAL(BricksLoaded()), Qt::DirectConnection);
+}
+
+VolumeBrickCache::~VolumeBrickCache()
+{
+  Close();
+}
+
+void VolumeBrickCache::Close()
+{
+  // the prefetch thread reads the levels and the cache
+  m_prefetch->Stop();
+
+  for (int i = 0; i < m_levels.size(); i++)
+  {
+    if (m_levels[i].fd >= 0)
+      ::close(m_levels[i].fd);
+  }
+  m_levels.clear();
+
+  QMutexLocker locker(&m_mutex);
+  m_bricks.clear();
+  m_lru.clear();
+  m_nCacheBytes = 0;
+  if (m_mriHeader)
+    ::MRIfree(&m_mriHeader);
+}
+
+void VolumeBrickCache::SetCacheSize(int nMB)
+{
+  QMutexLocker locker(&m_mutex);
+  m_nMaxCacheBytes = (qint64)nMB*1024*1024;
+}
+
+bool VolumeBrickCache::Open( const QString& filename, bool bNearest )
+{
+  Close();
+
+  QString fn = filename.toLower();
+  if (!fn.endsWith(".mgh") && !fn.endsWith(".mgz") && !fn.endsWith(".mgh.gz"))
+  {
+    cerr << "Out-of-core display needs an .mgh or .mgz volume: " << qPrintable(filename) << "\n";
+    return false;
+  }
+
+  m_mriHeader = ::MRIreadHeader( qPrintable(filename), MRI_VOLUME_TYPE_UNKNOWN );
+  if (!m_mriHeader)
+  {
+    cerr << "Could not read header of " << qPrintable(filename) << "\n";
+    return false;
+  }
+  m_nType = m_mriHeader->type;
+  switch (m_nType)
+  {
+  case MRI_UCHAR: m_nBytesPerVoxel = sizeof(unsigned char); break;
+  case MRI_SHORT: m_nBytesPerVoxel = sizeof(short); break;
+  case MRI_INT:   m_nBytesPerVoxel = sizeof(int); break;
+  case MRI_FLOAT: m_nBytesPerVoxel = sizeof(float); break;
+  default:
+    cerr << "Out-of-core display does not support data type " << m_nType << "\n";
+    Close();
+    return false;
+  }
+  if (m_mriHeader->nframes > 1)
+    cout << "Out-of-core display only shows the first frame of " << qPrintable(filename) << "\n";
+
+  QFileInfo fi(filename);
+  m_strFilename = fi.absoluteFilePath();
+  m_nSourceSize = fi.size();
+  m_nSourceTime = fi.lastModified().toMSecsSinceEpoch();
+  m_bNearest = bNearest;
+
+  // halve until the whole level fits in one brick
+  Level lv;
+  lv.dim[0] = m_mriHeader->width;
+  lv.dim[1] = m_mriHeader->height;
+  lv.dim[2] = m_mriHeader->depth;
+  lv.fd = -1;
+  while (true)
+  {
+    for (int i = 0; i < 3; i++)
+      lv.nBricks[i] = (lv.dim[i] + BrickSize - 1) / BrickSize;
+    m_levels << lv;
+    if (lv.nBricks[0] == 1 && lv.nBricks[1] == 1 && lv.nBricks[2] == 1)
+      break;
+    for (int i = 0; i < 3; i++)
+      lv.dim[i] = (lv.dim[i] + 1) / 2;
+  }
+
+  if (!BuildPyramid(GetPyramidDir(false)) && !BuildPyramid(GetPyramidDir(true)))
+  {
+    cerr << "Could not create the brick pyramid for " << qPrintable(filename) << "\n";
+    Close();
+    return false;
+  }
+  return true;
+}
+
+QString VolumeBrickCache::GetPyramidDir(bool bFallback)
+{
+  if (!bFallback)
+    return m_strFilename + ".pyramid";
+
+  QString hash = QCryptographicHash::hash(m_strFilename.toUtf8(), QCryptographicHash::Md5).toHex();
+  return QDir::temp().filePath("freeview-pyramid-" + hash);
+}
+
+void VolumeBrickCache::GetDimensions( int nLevel, int* dim )
+{
+  for (int i = 0; i < 3; i++)
+    dim[i] = m_levels[nLevel].dim[i];
+}
+
+double VolumeBrickCache::GetLevelOffset( int nLevel )
+{
+  // averaged voxels sit at the center of the block they cover
+  return m_bNearest ? 0 : ((1 << nLevel) - 1) / 2.0;
+}
+
+int VolumeBrickCache::GetLevelForVoxelsPerPixel( double dVoxelsPerPixel )
+{
+  int nLevel = 0;
+  while (nLevel+1 < m_levels.size() && (1 << (nLevel+1)) <= dVoxelsPerPixel)
+    nLevel++;
+  return nLevel;
+}
+
+int VolumeBrickCache::GetLevelForVoxelCount( qint64 nMaxVoxels )
+{
+  for (int i = 0; i < m_levels.size(); i++)
+  {
+    const int* dim = m_levels[i].dim;
+    if ((qint64)dim[0]*dim[1]*dim[2] <= nMaxVoxels)
+      return i;
+  }
+  return m_levels.size()-1;
+}
+
+bool VolumeBrickCache::CheckLevelFile( const QString& fn, int nLevel )
+{
+  const Level& lv = m_levels[nLevel];
+  qint64 nbytes = (qint64)lv.nBricks[0]*lv.nBricks[1]*lv.nBricks[2]*BrickSize*BrickSize*BrickSize*m_nBytesPerVoxel;
+  if (QFileInfo(fn).size() != BRICK_HEADER_SIZE + nbytes)
+    return false;
+
+  FILE* fp = fopen(qPrintable(fn), "rb");
+  if (!fp)
+    return false;
+  BrickFileHeader h;
+  bool bOK = (fread(&h, sizeof(h), 1, fp) == 1);
+  fclose(fp);
+  return bOK && h.magic == BRICK_FILE_MAGIC && h.version == BRICK_FILE_VERSION &&
+      h.type == m_nType && h.level == nLevel && h.dim[0] == lv.dim[0] && h.dim[1] == lv.dim[1] &&
+      h.dim[2] == lv.dim[2] && h.brick == BrickSize && h.nearest == (nLevel > 0 && m_bNearest) &&
+      h.source_size == m_nSourceSize && h.source_time == m_nSourceTime;
+}
+
+void VolumeBrickCache::WriteLevelHeader( FILE* fp, int nLevel )
+{
+  char buf[BRICK_HEADER_SIZE];
+  BrickFileHeader h;
+  memset(&h, 0, sizeof(h));
+  h.magic = BRICK_FILE_MAGIC;
+  h.version = BRICK_FILE_VERSION;
+  h.type = m_nType;
+  h.level = nLevel;
+  for (int i = 0; i < 3; i++)
+    h.dim[i] = m_levels[nLevel].dim[i];
+  h.brick = BrickSize;
+  h.nearest = (nLevel > 0 && m_bNearest);
+  h.source_size = m_nSourceSize;
+  h.source_time = m_nSourceTime;
+  memset(buf, 0, sizeof(buf));
+  memcpy(buf, &h, sizeof(h));
+  fwrite(buf, sizeof(buf), 1, fp);
+}
+
+bool VolumeBrickCache::BuildPyramid( const QString& dir )
+{
+  if (!QDir().mkpath(dir))
+    return false;
+
+  for (int i = 0; i < m_levels.size(); i++)
+  {
+    if (m_levels[i].fd >= 0)
+    {
+      ::close(m_levels[i].fd);
+      m_levels[i].fd = -1;
+    }
+  }
+
+  for (int i = 0; i < m_levels.size(); i++)
+  {
+    // level 0 is the same for both modes
+    QString fn = QDir(dir).filePath(i == 0 ? QString("level0.brk") :
+                                             QString("level%1-%2.brk").arg(i).arg(m_bNearest ? "nearest" : "average"));
+    if (!CheckLevelFile(fn, i))
+    {
+      cout << "Building level " << i << " of the brick pyramid in " << qPrintable(dir) << "\n";
+      QString tmp = fn + QString(".tmp%1").arg(QCoreApplication::applicationPid());
+      bool bOK = (i == 0 ? BuildLevelZero(tmp) : BuildLevel(i, tmp));
+      QFile::remove(fn);
+      if (!bOK || !QFile::rename(tmp, fn))
+      {
+        QFile::remove(tmp);
+        return false;
+      }
+    }
+    m_levels[i].fd = ::open(qPrintable(fn), O_RDONLY);
+    if (m_levels[i].fd < 0)
+      return false;
+  }
+  return true;
+}
+
+// writes the bricks of one layer (up to BrickSize slices of the level, in
+// the level's data type) in (y, x) brick order, zero padded at the edges
+bool VolumeBrickCache::WriteBrickLayer( FILE* fp, int nLevel, const float* layer, int nSlices )
+{
+  const Level& lv = m_levels[nLevel];
+  const int B = BrickSize;
+  vector<float> brick(B*B*B);
+  vector<char> out(brick.size()*m_nBytesPerVoxel);
+  for (int by = 0; by < lv.nBricks[1]; by++)
+  {
+    for (int bx = 0; bx < lv.nBricks[0]; bx++)
+    {
+      int nx = qMin(B, lv.dim[0] - bx*B), ny = qMin(B, lv.dim[1] - by*B);
+      std::fill(brick.begin(), brick.end(), 0);
+      for (int z = 0; z < nSlices; z++)
+      {
+        for (int y = 0; y < ny; y++)
+          memcpy(&brick[(z*B + y)*B], &layer[((size_t)z*lv.dim[1] + by*B + y)*lv.dim[0] + bx*B], nx*sizeof(float));
+      }
+      FloatToVoxels(m_nType, &brick[0], &out[0], brick.size());
+      if (fwrite(&out[0], out.size(), 1, fp) != 1)
+        return false;
+    }
+  }
+  return true;
+}
+
+bool VolumeBrickCache::BuildLevelZero( const QString& fn )
+{
+  QString lower = m_strFilename.toLower();
+  znzFile src = znzopen(qPrintable(m_strFilename), "rb", !lower.endsWith(".mgh"));
+  if (znz_isnull(src))
+    return false;
+  FILE* fp = fopen(qPrintable(fn), "wb");
+  if (!fp)
+  {
+    znzclose(src);
+    return false;
+  }
+
+  const Level& lv = m_levels[0];
+  size_t nSliceVoxels = (size_t)lv.dim[0]*lv.dim[1];
+  vector<char> raw(nSliceVoxels*m_nBytesPerVoxel);
+  vector<float> layer(nSliceVoxels*BrickSize);
+  bool bOK = (znzseek(src, MGH_HEADER_SIZE, SEEK_SET) >= 0);
+  WriteLevelHeader(fp, 0);
+  for (int bz = 0; bOK && bz < lv.nBricks[2]; bz++)
+  {
+    int nSlices = qMin(BrickSize, lv.dim[2] - bz*BrickSize);
+    for (int z = 0; bOK && z < nSlices; z++)
+    {
+      bOK = (znzread(&raw[0], 1, raw.size(), src) == raw.size());
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+      if (m_nBytesPerVoxel == 2)
+        byteswapbufshort(&raw[0], raw.size());
+      else if (m_nBytesPerVoxel == 4)
+        byteswapbuffloat(&raw[0], raw.size());
+#endif
+      VoxelsToFloat(m_nType, &raw[0], &layer[z*nSliceVoxels], nSliceVoxels);
+    }
+    if (bOK)
+      bOK = WriteBrickLayer(fp, 0, &layer[0], nSlices);
+  }
+  znzclose(src);
+  if (fclose(fp) != 0)
+    bOK = false;
+  return bOK;
+}
+
+bool VolumeBrickCache::ReadLevelSlice( int nLevel, int z, float* slice )
+{
+  const Level& lv = m_levels[nLevel];
+  const int B = BrickSize;
+  size_t nBrickBytes = (size_t)B*B*B*m_nBytesPerVoxel;
+  vector<char> raw((size_t)B*B*m_nBytesPerVoxel);
+  vector<float> plane(B*B);
+  int bz = z / B;
+  for (int by = 0; by < lv.nBricks[1]; by++)
+  {
+    for (int bx = 0; bx < lv.nBricks[0]; bx++)
+    {
+      qint64 nIndex = ((qint64)bz*lv.nBricks[1] + by)*lv.nBricks[0] + bx;
+      qint64 offset = BRICK_HEADER_SIZE + nIndex*nBrickBytes + (qint64)(z % B)*raw.size();
+      if (!ReadAt(lv.fd, &raw[0], raw.size(), offset))
+        return false;
+      VoxelsToFloat(m_nType, &raw[0], &plane[0], plane.size());
+      int nx = qMin(B, lv.dim[0] - bx*B), ny = qMin(B, lv.dim[1] - by*B);
+      for (int y = 0; y < ny; y++)
+        memcpy(&slice[((size_t)by*B + y)*lv.dim[0] + bx*B], &plane[y*B], nx*sizeof(float));
+    }
+  }
+  return true;
+}
+
+bool VolumeBrickCache::BuildLevel( int nLevel, const QString& fn )
+{
+  FILE* fp = fopen(qPrintable(fn), "wb");
+  if (!fp)
+    return false;
+
+  const Level& src = m_levels[nLevel-1];
+  const Level& lv = m_levels[nLevel];
+  size_t nSrcVoxels = (size_t)src.dim[0]*src.dim[1];
+  size_t nSliceVoxels = (size_t)lv.dim[0]*lv.dim[1];
+  vector<float> s0(nSrcVoxels), s1(nSrcVoxels), layer(nSliceVoxels*BrickSize);
+  bool bOK = true;
+  WriteLevelHeader(fp, nLevel);
+  for (int bz = 0; bOK && bz < lv.nBricks[2]; bz++)
+  {
+    int nSlices = qMin(BrickSize, lv.dim[2] - bz*BrickSize);
+    for (int z = 0; bOK && z < nSlices; z++)
+    {
+      int zs = 2*(bz*BrickSize + z);
+      bool bTwo = (!m_bNearest && zs+1 < src.dim[2]);
+      bOK = ReadLevelSlice(nLevel-1, zs, &s0[0]) && (!bTwo || ReadLevelSlice(nLevel-1, zs+1, &s1[0]));
+      float* out = &layer[z*nSliceVoxels];
+      for (int y = 0; bOK && y < lv.dim[1]; y++)
+      {
+        int ys = 2*y, ny = (ys+1 < src.dim[1] ? 2 : 1);
+        for (int x = 0; x < lv.dim[0]; x++)
+        {
+          int xs = 2*x, nx = (xs+1 < src.dim[0] ? 2 : 1);
+          if (m_bNearest)
+          {
+            out[(size_t)y*lv.dim[0] + x] = s0[(size_t)ys*src.dim[0] + xs];
+            continue;
+          }
+          double sum = 0;
+          for (int j = 0; j < ny; j++)
+          {
+            for (int i = 0; i < nx; i++)
+            {
+              size_t n = (size_t)(ys+j)*src.dim[0] + xs+i;
+              sum += s0[n] + (bTwo ? s1[n] : 0);
+            }
+          }
+          out[(size_t)y*lv.dim[0] + x] = sum / (nx*ny*(bTwo ? 2 : 1));
+        }
+      }
+    }
+    if (bOK)
+      bOK = WriteBrickLayer(fp, nLevel, &layer[0], nSlices);
+  }
+  if (fclose(fp) != 0)
+    bOK = false;
+  return bOK;
+}
+
+VolumeBrick VolumeBrickCache::ReadBrick( int nLevel, int bx, int by, int bz )
+{
+  const Level& lv = m_levels[nLevel];
+  const int B = BrickSize;
+  vector<char> raw((size_t)B*B*B*m_nBytesPerVoxel);
+  qint64 nIndex = ((qint64)bz*lv.nBricks[1] + by)*lv.nBricks[0] + bx;
+  if (!ReadAt(lv.fd, &raw[0], raw.size(), BRICK_HEADER_SIZE + nIndex*(qint64)raw.size()))
+    return VolumeBrick();
+
+  VolumeBrick brick(new QVector<float>(B*B*B));
+  VoxelsToFloat(m_nType, &raw[0], brick->data(), brick->size());
+  return brick;
+}
+
+VolumeBrick VolumeBrickCache::GetBrick( int nLevel, int bx, int by, int bz, bool bCachedOnly )
+{
+  quint64 key = BrickKey(nLevel, bx, by, bz);
+  {
+    QMutexLocker locker(&m_mutex);
+    QHash<quint64, CacheEntry>::iterator it = m_bricks.find(key);
+    if (it != m_bricks.end())
+    {
+      m_lru.splice(m_lru.begin(), m_lru, it->lru);
+      return it->data;
+    }
+  }
+  if (bCachedOnly)
+    return VolumeBrick();
+
+  // read without holding the lock, so the prefetch thread and the
+  // display do not wait on each other's I/O
+  VolumeBrick brick = ReadBrick(nLevel, bx, by, bz);
+  if (brick.isNull())
+    return brick;
+
+  QMutexLocker locker(&m_mutex);
+  QHash<quint64, CacheEntry>::iterator it = m_bricks.find(key);
+  if (it != m_bricks.end())
+  {
+    m_lru.splice(m_lru.begin(), m_lru, it->lru);
+    return it->data;
+  }
+  m_lru.push_front(key);
+  CacheEntry entry;
+  entry.data = brick;
+  entry.lru = m_lru.begin();
+  m_bricks.insert(key, entry);
+  m_nCacheBytes += brick->size()*sizeof(float);
+  while (m_nCacheBytes > m_nMaxCacheBytes && m_lru.size() > 1)
+  {
+    // bricks still in use elsewhere stay alive through their shared pointers
+    m_nCacheBytes -= m_bricks[m_lru.back()].data->size()*sizeof(float);
+    m_bricks.remove(m_lru.back());
+    m_lru.pop_back();
+  }
+  return brick;
+}
+
+// first and last brick along the two axes other than nAxis (lower one
+// first) that cover a voxel range of the level, clamped to the level
+void VolumeBrickCache::GetBrickRange( int nAxis, int nLevel, const int* range, int* brange )
+{
+  const Level& lv = m_levels[nLevel];
+  int a[2] = { (nAxis == 0 ? 1 : 0), (nAxis == 2 ? 1 : 2) };
+  for (int i = 0; i < 2; i++)
+  {
+    int v0 = 0, v1 = lv.dim[a[i]]-1;
+    if (range)
+    {
+      v0 = qMax(v0, range[2*i]);
+      v1 = qMin(v1, range[2*i+1]);
+    }
+    brange[2*i] = v0 / BrickSize;
+    brange[2*i+1] = (v1 < v0 ? brange[2*i]-1 : v1 / BrickSize);
+  }
+}
+
+bool VolumeBrickCache::GetSlice( int nAxis, int nSlice, int nLevel, const int* range, float* buffer,
+                                 bool bCachedOnly )
+{
+  if (nLevel < 0 || nLevel >= m_levels.size() || nAxis < 0 || nAxis > 2 || nSlice < 0)
+    return false;
+
+  const Level& lv = m_levels[nLevel];
+  const int B = BrickSize;
+  int j = qMin(nSlice >> nLevel, lv.dim[nAxis]-1);
+  int a1 = (nAxis == 0 ? 1 : 0), a2 = (nAxis == 2 ? 1 : 2);
+  int r[4] = { 0, lv.dim[a1]-1, 0, lv.dim[a2]-1 };
+  if (range)
+  {
+    for (int i = 0; i < 4; i++)
+      r[i] = qMax(0, qMin(range[i], lv.dim[i < 2 ? a1 : a2]-1));
+  }
+  if (r[1] < r[0] || r[3] < r[2])
+    return false;
+  int brange[4];
+  GetBrickRange(nAxis, nLevel, r, brange);
+  size_t nRow = r[1]-r[0]+1;
+  int b[3], v[3];
+  b[nAxis] = j / B;
+  v[nAxis] = j % B;
+  for (b[a2] = brange[2]; b[a2] <= brange[3]; b[a2]++)
+  {
+    for (b[a1] = brange[0]; b[a1] <= brange[1]; b[a1]++)
+    {
+      VolumeBrick brick = GetBrick(nLevel, b[0], b[1], b[2], bCachedOnly);
+      if (brick.isNull())
+        return false;
+      const float* p = brick->constData();
+      // the part of the brick inside the range
+      int v1min = qMax(0, r[0] - b[a1]*B), v1max = qMin(B-1, r[1] - b[a1]*B);
+      int v2min = qMax(0, r[2] - b[a2]*B), v2max = qMin(B-1, r[3] - b[a2]*B);
+      for (v[a2] = v2min; v[a2] <= v2max; v[a2]++)
+      {
+        float* out = &buffer[((size_t)b[a2]*B + v[a2] - r[2])*nRow + b[a1]*B - r[0]];
+        for (v[a1] = v1min; v[a1] <= v1max; v[a1]++)
+          out[v[a1]] = p[(v[2]*B + v[1])*B + v[0]];
+      }
+    }
+  }
+  return true;
+}
+
+void VolumeBrickCache::Request( int nAxis, int nSlice, int nLevel, const int* range )
+{
+  if (nLevel < 0 || nLevel >= m_levels.size() || nAxis < 0 || nAxis > 2 || nSlice < 0)
+    return;
+
+  int full[4] = { 0, INT_MAX, 0, INT_MAX };
+  int nLayer = qMin(nSlice >> nLevel, m_levels[nLevel].dim[nAxis]-1) / BrickSize;
+  m_prefetch->Request(nAxis, nLayer, nLevel, range ? range : full);
+}
+
+bool VolumeBrickCache::LoadBricks( int nAxis, int nLayer, int nLevel, const int* range, volatile bool* bAbort )
+{
+  const Level& lv = m_levels[nLevel];
+  if (nLayer < 0 || nLayer >= lv.nBricks[nAxis])
+    return true;
+
+  int a1 = (nAxis == 0 ? 1 : 0), a2 = (nAxis == 2 ? 1 : 2);
+  int b[3], brange[4];
+  GetBrickRange(nAxis, nLevel, range, brange);
+  b[nAxis] = nLayer;
+  for (b[a2] = brange[2]; b[a2] <= brange[3]; b[a2]++)
+  {
+    for (b[a1] = brange[0]; b[a1] <= brange[1]; b[a1]++)
+    {
+      if (*bAbort || GetBrick(nLevel, b[0], b[1], b[2]).isNull())
+        return false;
+    }
+  }
+  return true;
+}
+
+bool VolumeBrickCache::CanPrefetch( int nAxis, int nLevel, const int* range )
+{
+  int brange[4];
+  GetBrickRange(nAxis, nLevel, range, brange);
+  qint64 nBricks = (qint64)qMax(0, brange[1]-brange[0]+1)*qMax(0, brange[3]-brange[2]+1);
+  QMutexLocker locker(&m_mutex);
+  return 9*nBricks*BrickSize*BrickSize*BrickSize*(qint64)sizeof(float) <= m_nMaxCacheBytes;
+}
+
+MRI* VolumeBrickCache::CreateLevelMRI( int nLevel )
+{
+  const Level& lv = m_levels[nLevel];
+  MRI* mri = ::MRIallocSequence(lv.dim[0], lv.dim[1], lv.dim[2], MRI_FLOAT, 1);
+  if (!mri)
+    return NULL;
+  ::MRIcopyHeader(m_mriHeader, mri);
+
+  // level voxel j sits at level-0 voxel j*s + offset
+  double s = 1 << nLevel, offset = GetLevelOffset(nLevel);
+  MATRIX* v2r = ::MRIxfmCRS2XYZ(m_mriHeader, 0);
+  MATRIX* scale = ::MatrixIdentity(4, NULL);
+  for (int i = 1; i <= 3; i++)
+  {
+    *MATRIX_RELT(scale, i, i) = s;
+    *MATRIX_RELT(scale, i, 4) = offset;
+  }
+  MATRIX* level_v2r = ::MatrixMultiply(v2r, scale, NULL);
+  mri->xsize = m_mriHeader->xsize*s;
+  mri->ysize = m_mriHeader->ysize*s;
+  mri->zsize = m_mriHeader->zsize*s;
+  ::MRIsetVox2RASFromMatrix(mri, level_v2r);
+  ::MRIreInitCache(mri);
+  ::MatrixFree(&v2r);
+  ::MatrixFree(&scale);
+  ::MatrixFree(&level_v2r);
+
+  vector<float> slice((size_t)lv.dim[0]*lv.dim[1]);
+  for (int z = 0; z < lv.dim[2]; z++)
+  {
+    if (!GetSlice(2, z << nLevel, nLevel, NULL, &slice[0]))
+    {
+      ::MRIfree(&mri);
+      return NULL;
+    }
+    for (int y = 0; y < lv.dim[1]; y++)
+      memcpy(&MRIFvox(mri, 0, y, z), &slice[(size_t)y*lv.dim[0]], lv.dim[0]*sizeof(float));
+  }
+  return mri;
+}
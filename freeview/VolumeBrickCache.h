@@ -0,0 +1,147 @@
+/**
+ * @brief Out-of-core, multiresolution brick store for very large volumes.
+ *
+ * The volume is re-tiled once into a pyramid of brick files (a sidecar
+ * directory next to the volume, or the temp directory). Bricks are then
+ * loaded on demand into a bounded LRU cache, and the bricks around the
+ * displayed slice are prefetched in the background.
+ */
+/*
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#ifndef VolumeBrickCache_h
+#define VolumeBrickCache_h
+
+#include <QObject>
+#include <QString>
+#include <QVector>
+#include <QHash>
+#include <QMutex>
+#include <QSharedPointer>
+#include <list>
+
+#include "mri.h"
+
+class VolumeBrickPrefetchThread;
+
+typedef QSharedPointer< QVector<float> > VolumeBrick;
+
+class VolumeBrickCache : public QObject
+{
+  Q_OBJECT
+public:
+  VolumeBrickCache( QObject* parent = NULL );
+  virtual ~VolumeBrickCache();
+
+  // bNearest subsamples instead of averaging the coarser levels (for label volumes)
+  bool Open( const QString& filename, bool bNearest );
+  void Close();
+
+  int GetNumberOfLevels()
+  {
+    return m_levels.size();
+  }
+
+  void GetDimensions( int nLevel, int* dim );
+
+  // level-0 voxel coordinate of the center of voxel 0 of a level
+  double GetLevelOffset( int nLevel );
+
+  // finest level that still has at least one voxel per screen pixel
+  int GetLevelForVoxelsPerPixel( double dVoxelsPerPixel );
+
+  // coarsest level with no more than nMaxVoxels voxels
+  int GetLevelForVoxelCount( qint64 nMaxVoxels );
+
+  // whole level as a float MRI, with its vox2ras scaled to match
+  MRI* CreateLevelMRI( int nLevel );
+
+  // nSlice is in level-0 voxels along nAxis (0 = column, 1 = row, 2 = slice).
+  // range is the first and last voxel of the level to get along the lower
+  // and then the higher of the two other axes, or NULL for all of them.
+  // buffer gets that region, lower axis fastest. With bCachedOnly it
+  // fails instead of reading bricks that are not in the cache.
+  bool GetSlice( int nAxis, int nSlice, int nLevel, const int* range, float* buffer,
+                 bool bCachedOnly = false );
+
+  // loads the bricks of a slice region in the background, then the brick
+  // layers on either side of it. BricksLoaded() is emitted (from the
+  // prefetch thread) once the region itself is in the cache
+  void Request( int nAxis, int nSlice, int nLevel, const int* range );
+
+  void SetCacheSize( int nMB );
+
+  // used by the prefetch thread. a layer outside the level has nothing to load
+  bool LoadBricks( int nAxis, int nLayer, int nLevel, const int* range, volatile bool* bAbort );
+
+  // whether the two layers around a region fit in the cache next to what
+  // the three views show
+  bool CanPrefetch( int nAxis, int nLevel, const int* range );
+
+  static const int BrickSize = 32;
+
+signals:
+  void BricksLoaded();
+
+protected:
+  struct Level
+  {
+    int dim[3];
+    int nBricks[3];
+    int fd;
+  };
+
+  struct CacheEntry
+  {
+    VolumeBrick data;
+    std::list<quint64>::iterator lru;
+  };
+
+  bool BuildPyramid( const QString& dir );
+  bool BuildLevelZero( const QString& fn );
+  bool BuildLevel( int nLevel, const QString& fn );
+  bool ReadLevelSlice( int nLevel, int z, float* slice );
+  bool WriteBrickLayer( FILE* fp, int nLevel, const float* layer, int nSlices );
+  bool CheckLevelFile( const QString& fn, int nLevel );
+  void WriteLevelHeader( FILE* fp, int nLevel );
+  QString GetPyramidDir( bool bFallback );
+
+  VolumeBrick GetBrick( int nLevel, int bx, int by, int bz, bool bCachedOnly = false );
+  void GetBrickRange( int nAxis, int nLevel, const int* range, int* brange );
+  VolumeBrick ReadBrick( int nLevel, int bx, int by, int bz );
+
+  quint64 BrickKey( int nLevel, int bx, int by, int bz )
+  {
+    return ( (quint64)nLevel << 60 ) | ( (quint64)bz << 40 ) | ( (quint64)by << 20 ) | (quint64)bx;
+  }
+
+  QString   m_strFilename;
+  MRI*      m_mriHeader;
+  bool      m_bNearest;
+  int       m_nType;
+  int       m_nBytesPerVoxel;
+  qint64    m_nSourceSize;
+  qint64    m_nSourceTime;
+
+  QVector<Level> m_levels;
+
+  QMutex    m_mutex;
+  QHash<quint64, CacheEntry> m_bricks;
+  std::list<quint64> m_lru;   // most recently used first
+  qint64    m_nCacheBytes;
+  qint64    m_nMaxCacheBytes;
+
+  VolumeBrickPrefetchThread* m_prefetch;
+};
+
+#endif
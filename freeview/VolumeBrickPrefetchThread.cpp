@@ -0,0 +1,125 @@
+/**
+ * @brief Background loading of the bricks of an out-of-core volume.
+ *
+ */
+/*
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include "VolumeBrickPrefetchThread.h"
+#include "VolumeBrickCache.h"
+#include <QMutexLocker>
+
+VolumeBrickPrefetchThread::VolumeBrickPrefetchThread(VolumeBrickCache *cache) :
+  QThread(cache), m_cache(cache), m_bAbort(false), m_bNewRequest(false)
+{
+  for (int i = 0; i < 3; i++)
+  {
+    m_bReplaced[i] = false;
+    m_requests[i].bShow = m_requests[i].bPrefetch = false;
+  }
+}
+
+void VolumeBrickPrefetchThread::Request(int nAxis, int nLayer, int nLevel, const int* range)
+{
+  QMutexLocker locker(&mutex);
+  BrickRequest& r = m_requests[nAxis];
+  r.nLayer = nLayer;
+  r.nLevel = nLevel;
+  for (int i = 0; i < 4; i++)
+    r.range[i] = range[i];
+  r.bShow = r.bPrefetch = true;
+  m_bReplaced[nAxis] = true;
+  m_bNewRequest = true;
+  m_cond.wakeAll();
+  if (!isRunning() && !m_bAbort)
+    start(QThread::LowPriority);
+}
+
+void VolumeBrickPrefetchThread::Abort()
+{
+  QMutexLocker locker(&mutex);
+  m_bAbort = true;
+  m_bNewRequest = true;   // stops the bricks being loaded
+  for (int i = 0; i < 3; i++)
+    m_bReplaced[i] = true;
+  m_cond.wakeAll();
+}
+
+void VolumeBrickPrefetchThread::Stop()
+{
+  Abort();
+  wait();
+  QMutexLocker locker(&mutex);
+  m_bAbort = false;
+  for (int i = 0; i < 3; i++)
+    m_requests[i].bShow = m_requests[i].bPrefetch = false;
+}
+
+void VolumeBrickPrefetchThread::run()
+{
+  while (true)
+  {
+    int nAxis = -1;
+    bool bShow = false;
+    BrickRequest r;
+    {
+      QMutexLocker locker(&mutex);
+      while (!m_bAbort)
+      {
+        // what is on display comes before the neighboring layers of any view
+        for (int i = 0; i < 3 && nAxis < 0; i++)
+        {
+          if (m_requests[i].bShow)
+            nAxis = i;
+        }
+        bShow = (nAxis >= 0);
+        for (int i = 0; i < 3 && nAxis < 0; i++)
+        {
+          if (m_requests[i].bPrefetch)
+            nAxis = i;
+        }
+        if (nAxis >= 0)
+          break;
+        m_cond.wait(&mutex);
+      }
+      if (m_bAbort)
+        return;
+      r = m_requests[nAxis];
+      if (bShow)
+        m_requests[nAxis].bShow = false;
+      else
+        m_requests[nAxis].bPrefetch = false;
+      m_bReplaced[nAxis] = false;
+      m_bNewRequest = false;
+    }
+
+    if (bShow)
+    {
+      // only a newer request for the same view abandons these
+      if (m_cache->LoadBricks(nAxis, r.nLayer, r.nLevel, r.range, &m_bReplaced[nAxis]))
+        emit BricksLoaded();
+    }
+    else if (m_cache->CanPrefetch(nAxis, r.nLevel, r.range))
+    {
+      // the brick layers on either side of the one on display, put back
+      // (or replaced) if any view wants something else in the meantime
+      if (!m_cache->LoadBricks(nAxis, r.nLayer+1, r.nLevel, r.range, &m_bNewRequest) ||
+          !m_cache->LoadBricks(nAxis, r.nLayer-1, r.nLevel, r.range, &m_bNewRequest))
+      {
+        QMutexLocker locker(&mutex);
+        if (m_bNewRequest)
+          m_requests[nAxis].bPrefetch = true;
+      }
+    }
+  }
+}
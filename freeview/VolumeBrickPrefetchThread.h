@@ -0,0 +1,70 @@
+/**
+ * @brief Background loading of the bricks of an out-of-core volume.
+ *
+ */
+/*
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#ifndef VOLUMEBRICKPREFETCHTHREAD_H
+#define VOLUMEBRICKPREFETCHTHREAD_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+
+class VolumeBrickCache;
+
+class VolumeBrickPrefetchThread : public QThread
+{
+  Q_OBJECT
+public:
+  explicit VolumeBrickPrefetchThread(VolumeBrickCache *cache);
+
+  // the bricks of a slice region (see VolumeBrickCache::GetSlice) to load,
+  // followed by the brick layers on either side of it. replaces the request
+  // of the same axis if that has not been finished yet
+  void Request(int nAxis, int nLayer, int nLevel, const int* range);
+
+  // aborts and waits for the thread, dropping any requests. the thread
+  // starts again on the next request
+  void Stop();
+
+signals:
+  // the bricks of a displayed region are all in the cache now
+  void BricksLoaded();
+
+public slots:
+  void Abort();
+
+protected:
+  void run();
+
+  struct BrickRequest
+  {
+    int  nLayer;
+    int  nLevel;
+    int  range[4];
+    bool bShow;
+    bool bPrefetch;
+  };
+
+  VolumeBrickCache* m_cache;
+  volatile bool m_bAbort;
+  volatile bool m_bReplaced[3];   // a newer request for the axis came in
+  volatile bool m_bNewRequest;    // any newer request came in
+  BrickRequest m_requests[3];     // one per axis
+  QMutex  mutex;
+  QWaitCondition m_cond;
+};
+
+#endif // VOLUMEBRICKPREFETCHTHREAD_H
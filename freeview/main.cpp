@@ -165,6 +165,7 @@ int main(int argc, char *argv[])
     "':structure=name_or_value' Move the slice in the main viewport to where it has the most of the given structure.\n\n"
     "':ignore_header=flag' Ignore header information. Use the existing volume's header info. Flag can be '1' or '0' or 'true' or 'false'.\n\n"
     "':frame=number' Set active frame (0 based).\n\n"
+    "':out_of_core=flag' Keep the voxels on disk for volumes larger than memory (.mgh or .mgz only). A brick pyramid is built once next to the volume (or in the temp directory), a coarse level is loaded, and finer bricks are read as 2D views zoom in. The volume cannot be edited or saved. Flag can be '1' or '0' or 'true' or 'false'.\n\n"
     "':select_label=label_index' When colormap is set as look up table, select and show only the given labels. Multiple labels can be given separated by comma, such as, '5,10,20'.\n\n"
     "Example:\nfreeview -v T1.mgz:colormap=heatscale:heatscale=10,100,200\n", 1, 1000 ),
     CmdLineEntry( CMD_LINE_SWITCH, "r", "resample", "", "Resample oblique data to standard RAS." ),
@@ -0,0 +1,162 @@
+#include <boost/test/unit_test.hpp>
+
+#include "kvlAtlasMeshToIntensityImageCostAndGradientCalculator.h"
+
+#include "testfileloader.hpp"
+
+// -----------------------------------------
+
+namespace {
+
+// Rasterizes all the tetrahedra as a single chunk, in cell order. This adds
+// up the cost and gradient in the same order as the calculator did with one
+// thread before the tetrahedra were cut into chunks
+class UnchunkedCalculator : public kvl::AtlasMeshToIntensityImageCostAndGradientCalculator
+{
+public:
+  typedef UnchunkedCalculator  Self;
+  typedef kvl::AtlasMeshToIntensityImageCostAndGradientCalculator  Superclass;
+  typedef itk::SmartPointer< Self >  Pointer;
+  typedef itk::SmartPointer< const Self >  ConstPointer;
+
+  itkNewMacro( Self );
+
+protected:
+  UnchunkedCalculator() {}
+
+  bool RasterizeTetrahedra( const kvl::AtlasMesh* mesh,
+                            const kvl::AtlasMesh::CellIdentifier* tetrahedronIds,
+                            int numberOfTetrahedra,
+                            int chunkNumber,
+                            int threadNumber )
+  {
+    if ( chunkNumber != 0 ) {
+      // Leave the other chunks empty
+      return Superclass::RasterizeTetrahedra( mesh, tetrahedronIds, 0, chunkNumber, threadNumber );
+    }
+
+    std::vector< kvl::AtlasMesh::CellIdentifier >  allTetrahedronIds;
+    for ( kvl::AtlasMesh::CellsContainer::ConstIterator  cellIt = mesh->GetCells()->Begin();
+          cellIt != mesh->GetCells()->End(); ++cellIt ) {
+      if ( cellIt.Value()->GetType() == kvl::AtlasMesh::CellType::TETRAHEDRON_CELL ) {
+        allTetrahedronIds.push_back( cellIt.Index() );
+      }
+    }
+    return Superclass::RasterizeTetrahedra( mesh, &( allTetrahedronIds[ 0 ] ), allTetrahedronIds.size(),
+                                            0, threadNumber );
+  }
+
+private:
+  UnchunkedCalculator(const Self&); //purposely not implemented
+  void operator=(const Self&); //purposely not implemented
+};
+
+
+// Same model as the DeformationGradients test of AtlasMeshRasterizorBasic
+void SetTestParameters( kvl::AtlasMeshToIntensityImageCostAndGradientCalculator* calculator,
+                        const TestFileLoader::ImageType* image )
+{
+  const double  means[] = { 2.5429e3, 3.2005e3, 3.9733e3, 4.6842e3, 4.7763e3, 4.2508e3,
+                            4.4670e3, 4.5531e3, 3.8819e3, 4.0985e3, 4.3246e3, 4.6027e3,
+                            4.6872e3, 4.5976e3, 4.6632e3, 4.7341e3, 4.7243e3 };
+  const double  precisions[] = { 0.000001230847303, 0.000001179516824, 0.000008872600132,
+                                 0.000252957561955, 0.001088434034911, 0.000029275401400,
+                                 0.000081278899442, 0.000144651419610, 0.000008551322644,
+                                 0.000016721659636, 0.000056766547482, 0.000253226418815,
+                                 0.000644518692120, 0.000322204283476, 0.000672630053763,
+                                 0.000145138180789, 0.000731213454142 };
+  const int  numberOfClasses = sizeof( means ) / sizeof( means[ 0 ] );
+
+  std::vector< vnl_vector< double > >  means_( numberOfClasses, vnl_vector< double >( 1, 0.0 ) );
+  std::vector< vnl_matrix< double > >  variances( numberOfClasses, vnl_matrix< double >( 1, 1, 0.0 ) );
+  std::vector< double >  mixtureWeights( numberOfClasses, 1.0 );
+  std::vector< int >  numberOfGaussiansPerClass( numberOfClasses, 1 );
+  for ( int classNumber = 0; classNumber < numberOfClasses; classNumber++ ) {
+    means_[ classNumber ][ 0 ] = means[ classNumber ];
+    variances[ classNumber ][ 0 ][ 0 ] = 1 / precisions[ classNumber ];
+  }
+
+  calculator->SetImages( std::vector< TestFileLoader::ImageType::ConstPointer >( 1, image ) );
+  calculator->SetParameters( means_, variances, mixtureWeights, numberOfGaussiansPerClass );
+}
+
+
+// Largest difference between two gradients, and the largest entry of the second
+void CompareGradients( const kvl::AtlasPositionGradientContainerType* gradient,
+                       const kvl::AtlasPositionGradientContainerType* referenceGradient,
+                       double& maximumError, double& maximumEntry )
+{
+  maximumError = 0.0;
+  maximumEntry = 0.0;
+  BOOST_REQUIRE_EQUAL( gradient->Size(), referenceGradient->Size() );
+  kvl::AtlasPositionGradientContainerType::ConstIterator  gradIt = gradient->Begin();
+  kvl::AtlasPositionGradientContainerType::ConstIterator  refGradIt = referenceGradient->Begin();
+  for ( ; gradIt != gradient->End(); ++gradIt, ++refGradIt ) {
+    BOOST_REQUIRE_EQUAL( gradIt.Index(), refGradIt.Index() );
+    for ( int i = 0; i < 3; i++ ) {
+      maximumError = std::max( maximumError, std::abs( gradIt.Value()[ i ] - refGradIt.Value()[ i ] ) );
+      maximumEntry = std::max( maximumEntry, std::abs( refGradIt.Value()[ i ] ) );
+    }
+  }
+}
+
+}
+
+// -----------------------------------------
+
+BOOST_FIXTURE_TEST_SUITE( AtlasMeshChunkedGradient, TestFileLoader )
+
+BOOST_AUTO_TEST_CASE( SameForAnyNumberOfThreads )
+{
+  kvl::AtlasMeshToIntensityImageCostAndGradientCalculator::Pointer
+      referenceCalculator = kvl::AtlasMeshToIntensityImageCostAndGradientCalculator::New();
+  SetTestParameters( referenceCalculator, image );
+  referenceCalculator->SetNumberOfThreads( 1 );
+  referenceCalculator->Rasterize( mesh );
+  const double  referenceCost = referenceCalculator->GetMinLogLikelihoodTimesPrior();
+
+  // The same calculator is used for every thread count, so the later calls
+  // also run off the tetrahedron order worked out by the first one
+  kvl::AtlasMeshToIntensityImageCostAndGradientCalculator::Pointer
+      calculator = kvl::AtlasMeshToIntensityImageCostAndGradientCalculator::New();
+  SetTestParameters( calculator, image );
+  const int  numbersOfThreads[] = { 1, 2, 3, 8 };
+  for ( int i = 0; i < 4; i++ ) {
+    BOOST_TEST_CONTEXT( "Number of threads: " << numbersOfThreads[ i ] ) {
+      calculator->SetNumberOfThreads( numbersOfThreads[ i ] );
+      calculator->Rasterize( mesh );
+      BOOST_CHECK_EQUAL( calculator->GetMinLogLikelihoodTimesPrior(), referenceCost );
+
+      double  maximumError, maximumEntry;
+      CompareGradients( calculator->GetPositionGradient(), referenceCalculator->GetPositionGradient(),
+                        maximumError, maximumEntry );
+      BOOST_CHECK_EQUAL( maximumError, 0 );
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE( MatchesUnchunked )
+{
+  kvl::AtlasMeshToIntensityImageCostAndGradientCalculator::Pointer
+      calculator = kvl::AtlasMeshToIntensityImageCostAndGradientCalculator::New();
+  SetTestParameters( calculator, image );
+  calculator->Rasterize( mesh );
+
+  UnchunkedCalculator::Pointer  unchunkedCalculator = UnchunkedCalculator::New();
+  SetTestParameters( unchunkedCalculator, image );
+  unchunkedCalculator->SetNumberOfThreads( 1 );
+  unchunkedCalculator->Rasterize( mesh );
+
+  // Only the order in which the contributions are added up differs
+  const double  cost = calculator->GetMinLogLikelihoodTimesPrior();
+  const double  unchunkedCost = unchunkedCalculator->GetMinLogLikelihoodTimesPrior();
+  BOOST_CHECK_LE( std::abs( cost - unchunkedCost ), 1e-10 * std::abs( unchunkedCost ) );
+
+  double  maximumError, maximumEntry;
+  CompareGradients( calculator->GetPositionGradient(), unchunkedCalculator->GetPositionGradient(),
+                    maximumError, maximumEntry );
+  BOOST_CHECK_GT( maximumEntry, 0 );
+  BOOST_CHECK_LE( maximumError, 1e-8 * maximumEntry );
+}
+
+BOOST_AUTO_TEST_SUITE_END();
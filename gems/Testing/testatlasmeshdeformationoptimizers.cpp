@@ -0,0 +1,244 @@
+#include <boost/test/unit_test.hpp>
+
+#include "kvlAtlasMeshCollection.h"
+#include "kvlAtlasMeshArrays.h"
+#include "kvlAtlasMeshToPointSetCostAndGradientCalculator.h"
+#include "kvlAtlasMeshDeformationFixedStepGradientDescentOptimizer.h"
+#include "kvlAtlasMeshDeformationGradientDescentOptimizer.h"
+#include "kvlAtlasMeshDeformationConjugateGradientOptimizer.h"
+#include "kvlAtlasMeshDeformationLBFGSOptimizer.h"
+
+// -----------------------------------------
+
+namespace {
+
+// A small regular mesh of 5 x 5 x 5 points over a 20^3 domain
+kvl::AtlasMeshCollection::Pointer  ConstructMeshCollection()
+{
+  const unsigned int  meshSize[] = { 5, 5, 5 };
+  const unsigned int  domainSize[] = { 20, 20, 20 };
+  kvl::AtlasMeshCollection::Pointer  collection = kvl::AtlasMeshCollection::New();
+  collection->Construct( meshSize, domainSize, 1.0, 3, 1 );
+  return collection;
+}
+
+
+// Mesh with its own copy of the points and point data, and the same cells
+kvl::AtlasMesh::Pointer  CopyMesh( const kvl::AtlasMesh* mesh )
+{
+  kvl::AtlasMesh::PointsContainer::Pointer  points = kvl::AtlasMesh::PointsContainer::New();
+  for ( kvl::AtlasMesh::PointsContainer::ConstIterator  it = mesh->GetPoints()->Begin();
+        it != mesh->GetPoints()->End(); ++it ) {
+    points->InsertElement( it.Index(), it.Value() );
+  }
+  kvl::AtlasMesh::PointDataContainer::Pointer  pointData = kvl::AtlasMesh::PointDataContainer::New();
+  for ( kvl::AtlasMesh::PointDataContainer::ConstIterator  it = mesh->GetPointData()->Begin();
+        it != mesh->GetPointData()->End(); ++it ) {
+    pointData->InsertElement( it.Index(), it.Value() );
+  }
+
+  kvl::AtlasMesh::Pointer  copy = kvl::AtlasMesh::New();
+  copy->SetPoints( points );
+  copy->SetCells( const_cast< kvl::AtlasMesh::CellsContainer* >( mesh->GetCells() ) );
+  copy->SetPointData( pointData );
+  copy->SetCellData( const_cast< kvl::AtlasMesh::CellDataContainer* >( mesh->GetCellData() ) );
+  return copy;
+}
+
+
+// Smoothly displaced copy of the points, away from zero (which the point
+// set calculator takes as a missing target)
+kvl::AtlasMesh::PointsContainer::Pointer  MakeTargetPoints( const kvl::AtlasMesh* mesh )
+{
+  kvl::AtlasMesh::PointsContainer::Pointer  targets = kvl::AtlasMesh::PointsContainer::New();
+  for ( kvl::AtlasMesh::PointsContainer::ConstIterator  it = mesh->GetPoints()->Begin();
+        it != mesh->GetPoints()->End(); ++it ) {
+    kvl::AtlasMesh::PointType  target = it.Value();
+    target[ 0 ] += 1.5 + 0.8 * sin( it.Value()[ 1 ] / 3.0 );
+    target[ 1 ] += 1.2 + 0.6 * cos( it.Value()[ 2 ] / 4.0 );
+    target[ 2 ] += 1.0 + 0.5 * sin( it.Value()[ 0 ] / 5.0 );
+    targets->InsertElement( it.Index(), target );
+  }
+  return targets;
+}
+
+
+kvl::AtlasMeshToPointSetCostAndGradientCalculator::Pointer
+MakeCalculator( const kvl::AtlasMesh::PointsContainer* targets )
+{
+  kvl::AtlasMeshToPointSetCostAndGradientCalculator::Pointer
+      calculator = kvl::AtlasMeshToPointSetCostAndGradientCalculator::New();
+  calculator->SetTargetPoints( targets );
+  return calculator;
+}
+
+
+double  MaximumPositionDifference( const kvl::AtlasMesh* mesh, const kvl::AtlasMesh::PointsContainer* points )
+{
+  double  maximumDifference = 0.0;
+  BOOST_REQUIRE_EQUAL( mesh->GetPoints()->Size(), points->Size() );
+  kvl::AtlasMesh::PointsContainer::ConstIterator  it = mesh->GetPoints()->Begin();
+  kvl::AtlasMesh::PointsContainer::ConstIterator  refIt = points->Begin();
+  for ( ; it != mesh->GetPoints()->End(); ++it, ++refIt ) {
+    BOOST_REQUIRE_EQUAL( it.Index(), refIt.Index() );
+    for ( int i = 0; i < 3; i++ ) {
+      maximumDifference = std::max( maximumDifference, std::abs( it.Value()[ i ] - refIt.Value()[ i ] ) );
+    }
+  }
+  return maximumDifference;
+}
+
+}
+
+// -----------------------------------------
+
+BOOST_AUTO_TEST_SUITE( AtlasMeshDeformationOptimizers )
+
+BOOST_AUTO_TEST_CASE( MeshArraysMatchMesh )
+{
+  kvl::AtlasMeshCollection::Pointer  collection = ConstructMeshCollection();
+  kvl::AtlasMesh::Pointer  mesh = CopyMesh( collection->GetReferenceMesh() );
+  const int  numberOfClasses = collection->GetNumberOfAlphas();
+
+  kvl::AtlasMeshArrays::Pointer  arrays = kvl::AtlasMeshArrays::New();
+  arrays->Update( mesh );
+  BOOST_REQUIRE_EQUAL( arrays->GetNumberOfPoints(), mesh->GetPoints()->Size() );
+  BOOST_REQUIRE_EQUAL( arrays->GetNumberOfClasses(), numberOfClasses );
+
+  int  pointIndex = 0;
+  for ( kvl::AtlasMesh::PointsContainer::ConstIterator  it = mesh->GetPoints()->Begin();
+        it != mesh->GetPoints()->End(); ++it, ++pointIndex ) {
+    BOOST_CHECK_EQUAL( arrays->GetPointId( pointIndex ), it.Index() );
+    BOOST_CHECK_EQUAL( arrays->GetPointIndex( it.Index() ), pointIndex );
+    for ( int i = 0; i < 3; i++ ) {
+      BOOST_CHECK_EQUAL( arrays->GetPosition( pointIndex )[ i ], it.Value()[ i ] );
+      BOOST_CHECK_EQUAL( arrays->GetPositionData()[ 3 * pointIndex + i ], it.Value()[ i ] );
+    }
+    const kvl::AtlasAlphasType&  alphas = mesh->GetPointData()->ElementAt( it.Index() ).m_Alphas;
+    for ( int classNumber = 0; classNumber < numberOfClasses; classNumber++ ) {
+      BOOST_CHECK_EQUAL( arrays->GetAlphas( pointIndex )[ classNumber ], alphas[ classNumber ] );
+      BOOST_CHECK_EQUAL( arrays->GetAlphaData()[ pointIndex * numberOfClasses + classNumber ], alphas[ classNumber ] );
+    }
+  }
+
+  int  numberOfTetrahedra = 0;
+  for ( kvl::AtlasMesh::CellsContainer::ConstIterator  cellIt = mesh->GetCells()->Begin();
+        cellIt != mesh->GetCells()->End(); ++cellIt ) {
+    if ( cellIt.Value()->GetType() != kvl::AtlasMesh::CellType::TETRAHEDRON_CELL ) {
+      continue;
+    }
+    const int  tetrahedronIndex = arrays->GetTetrahedronIndex( cellIt.Index() );
+    BOOST_CHECK_EQUAL( tetrahedronIndex, numberOfTetrahedra );
+    BOOST_CHECK_EQUAL( arrays->GetTetrahedronId( tetrahedronIndex ), cellIt.Index() );
+    int  vertexNumber = 0;
+    for ( kvl::AtlasMesh::CellType::PointIdConstIterator  pit = cellIt.Value()->PointIdsBegin();
+          pit != cellIt.Value()->PointIdsEnd(); ++pit, ++vertexNumber ) {
+      BOOST_CHECK_EQUAL( arrays->GetTetrahedron( tetrahedronIndex )[ vertexNumber ], arrays->GetPointIndex( *pit ) );
+    }
+    numberOfTetrahedra++;
+  }
+  BOOST_CHECK_EQUAL( arrays->GetNumberOfTetrahedra(), numberOfTetrahedra );
+
+  // Moved points are always picked up; alphas changed in place once the
+  // point data container is marked as modified
+  const kvl::AtlasMesh::PointIdentifier  pointId = mesh->GetPoints()->Begin().Index();
+  mesh->GetPoints()->ElementAt( pointId )[ 0 ] += 0.25;
+  mesh->GetPointData()->ElementAt( pointId ).m_Alphas[ 0 ] = 0.125;
+  mesh->GetPointData()->Modified();
+  arrays->Update( mesh );
+  pointIndex = arrays->GetPointIndex( pointId );
+  BOOST_CHECK_EQUAL( arrays->GetPosition( pointIndex )[ 0 ], mesh->GetPoints()->ElementAt( pointId )[ 0 ] );
+  BOOST_CHECK_EQUAL( arrays->GetAlphas( pointIndex )[ 0 ], 0.125f );
+}
+
+BOOST_AUTO_TEST_CASE( FixedStepMatchesContainerStep )
+{
+  kvl::AtlasMeshCollection::Pointer  collection = ConstructMeshCollection();
+  kvl::AtlasMesh::PointsContainer::Pointer  targets = MakeTargetPoints( collection->GetReferenceMesh() );
+  const double  stepSize = 0.5;
+
+  // One step as the optimizer took it before positions and gradients were
+  // flat vectors: the gradient container, scaled so that its largest entry
+  // moves stepSize, added to the points container one point at a time
+  kvl::AtlasMesh::Pointer  referenceMesh = CopyMesh( collection->GetReferenceMesh() );
+  kvl::AtlasMeshToPointSetCostAndGradientCalculator::Pointer  referenceCalculator = MakeCalculator( targets );
+  referenceCalculator->Rasterize( referenceMesh );
+  const double  startCost = referenceCalculator->GetMinLogLikelihoodTimesPrior();
+  kvl::AtlasPositionGradientContainerType::ConstPointer  gradient = referenceCalculator->GetPositionGradient();
+  double  maximumGradientMagnitude = 0.0;
+  for ( kvl::AtlasPositionGradientContainerType::ConstIterator  it = gradient->Begin();
+        it != gradient->End(); ++it ) {
+    maximumGradientMagnitude = std::max( maximumGradientMagnitude, it.Value().GetNorm() );
+  }
+  BOOST_REQUIRE_GT( maximumGradientMagnitude, 0 );
+  const double  alpha = -( stepSize / maximumGradientMagnitude );
+  kvl::AtlasMesh::PointsContainer::Pointer  referencePosition = kvl::AtlasMesh::PointsContainer::New();
+  kvl::AtlasMesh::PointsContainer::ConstIterator  posIt = referenceMesh->GetPoints()->Begin();
+  kvl::AtlasPositionGradientContainerType::ConstIterator  defIt = gradient->Begin();
+  for ( ; posIt != referenceMesh->GetPoints()->End(); ++posIt, ++defIt ) {
+    const kvl::AtlasPositionGradientType  newStep = alpha * defIt.Value();
+    referencePosition->InsertElement( posIt.Index(), posIt.Value() + newStep );
+  }
+  referenceMesh->SetPoints( referencePosition );
+  referenceCalculator->Rasterize( referenceMesh );
+  const double  referenceCost = referenceCalculator->GetMinLogLikelihoodTimesPrior();
+  BOOST_REQUIRE_LT( referenceCost, startCost );
+
+  // The same step by the optimizer
+  kvl::AtlasMesh::Pointer  mesh = CopyMesh( collection->GetReferenceMesh() );
+  kvl::AtlasMeshDeformationFixedStepGradientDescentOptimizer::Pointer
+      optimizer = kvl::AtlasMeshDeformationFixedStepGradientDescentOptimizer::New();
+  optimizer->SetMesh( mesh );
+  optimizer->SetCostAndGradientCalculator( MakeCalculator( targets ) );
+  optimizer->SetStepSize( stepSize );
+  const double  maximalDeformation = optimizer->Step();
+  BOOST_CHECK_CLOSE( maximalDeformation, stepSize, 1e-10 );
+  BOOST_CHECK_EQUAL( optimizer->GetMinLogLikelihoodTimesPrior(), referenceCost );
+  BOOST_CHECK_EQUAL( MaximumPositionDifference( mesh, referencePosition ), 0 );
+}
+
+BOOST_AUTO_TEST_CASE( LineSearchOptimizersAgree )
+{
+  kvl::AtlasMeshCollection::Pointer  collection = ConstructMeshCollection();
+  kvl::AtlasMesh::PointsContainer::Pointer  targets = MakeTargetPoints( collection->GetReferenceMesh() );
+
+  kvl::AtlasMeshToPointSetCostAndGradientCalculator::Pointer  calculator = MakeCalculator( targets );
+  calculator->Rasterize( collection->GetReferenceMesh() );
+  const double  startCost = calculator->GetMinLogLikelihoodTimesPrior();
+
+  // Every optimizer must lower the cost on every step, and end up in the
+  // same minimum
+  std::vector< kvl::AtlasMeshDeformationOptimizer::Pointer >  optimizers;
+  optimizers.push_back( kvl::AtlasMeshDeformationGradientDescentOptimizer::New().GetPointer() );
+  optimizers.push_back( kvl::AtlasMeshDeformationConjugateGradientOptimizer::New().GetPointer() );
+  optimizers.push_back( kvl::AtlasMeshDeformationLBFGSOptimizer::New().GetPointer() );
+  std::vector< double >  finalCosts;
+  std::vector< kvl::AtlasMesh::Pointer >  finalMeshes;
+  for ( size_t optimizerNumber = 0; optimizerNumber < optimizers.size(); optimizerNumber++ ) {
+    BOOST_TEST_CONTEXT( "Optimizer: " << optimizers[ optimizerNumber ]->GetNameOfClass() ) {
+      kvl::AtlasMesh::Pointer  mesh = CopyMesh( collection->GetReferenceMesh() );
+      kvl::AtlasMeshDeformationOptimizer::Pointer  optimizer = optimizers[ optimizerNumber ];
+      optimizer->SetMesh( mesh );
+      optimizer->SetCostAndGradientCalculator( MakeCalculator( targets ) );
+      optimizer->SetMaximumNumberOfIterations( 200 );
+      optimizer->SetMaximalDeformationStopCriterion( 1e-4 );
+      double  previousCost = startCost;
+      while ( optimizer->Step() > 0 ) {
+        BOOST_CHECK_LE( optimizer->GetMinLogLikelihoodTimesPrior(), previousCost );
+        previousCost = optimizer->GetMinLogLikelihoodTimesPrior();
+      }
+      BOOST_CHECK_LT( optimizer->GetMinLogLikelihoodTimesPrior(), startCost );
+      finalCosts.push_back( optimizer->GetMinLogLikelihoodTimesPrior() );
+      finalMeshes.push_back( mesh );
+    }
+  }
+
+  for ( size_t optimizerNumber = 1; optimizerNumber < optimizers.size(); optimizerNumber++ ) {
+    BOOST_TEST_CONTEXT( "Optimizer: " << optimizers[ optimizerNumber ]->GetNameOfClass() ) {
+      BOOST_CHECK_CLOSE( finalCosts[ optimizerNumber ], finalCosts[ 0 ], 0.1 );
+      BOOST_CHECK_LE( MaximumPositionDifference( finalMeshes[ optimizerNumber ], finalMeshes[ 0 ]->GetPoints() ), 0.1 );
+    }
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END();
@@ -0,0 +1,140 @@
+#include "kvlAtlasMeshArrays.h"
+
+#include <algorithm>
+
+
+namespace kvl
+{
+
+
+//
+//
+//
+AtlasMeshArrays
+::AtlasMeshArrays()
+{
+  m_NumberOfClasses = 0;
+  m_CellsMTime = 0;
+  m_PointDataMTime = 0;
+}
+
+
+
+//
+//
+//
+AtlasMeshArrays
+::~AtlasMeshArrays()
+{
+}
+
+
+
+//
+//
+//
+void
+AtlasMeshArrays
+::Update( const AtlasMesh* mesh )
+{
+
+  // Positions, which change on every call. The point identifiers are checked
+  // on the way, so a mesh with other points is picked up as well
+  const int  numberOfPoints = mesh->GetPoints()->Size();
+  bool  pointsChanged = ( numberOfPoints != static_cast< int >( m_PointIds.size() ) );
+  m_PointIds.resize( numberOfPoints );
+  m_Positions.resize( numberOfPoints );
+  AtlasMesh::PointIdentifier  maximumPointId = 0;
+  int  pointIndex = 0;
+  for ( AtlasMesh::PointsContainer::ConstIterator  pointIt = mesh->GetPoints()->Begin();
+        pointIt != mesh->GetPoints()->End(); ++pointIt, ++pointIndex )
+    {
+    if ( m_PointIds[ pointIndex ] != pointIt.Index() )
+      {
+      m_PointIds[ pointIndex ] = pointIt.Index();
+      pointsChanged = true;
+      }
+    m_Positions[ pointIndex ] = pointIt.Value();
+    maximumPointId = std::max( maximumPointId, pointIt.Index() );
+    }
+    
+  // Identifiers are small integers in practice (0...N-1 for the static 
+  // meshes), so a plain lookup table maps them back
+  if ( pointsChanged )
+    {
+    m_PointIndices.assign( numberOfPoints ? maximumPointId + 1 : 0, -1 );
+    for ( pointIndex = 0; pointIndex < numberOfPoints; pointIndex++ )
+      {
+      m_PointIndices[ m_PointIds[ pointIndex ] ] = pointIndex;
+      }
+    }
+
+
+  // Tetrahedra
+  const AtlasMesh::CellsContainer*  cells = mesh->GetCells();
+  if ( pointsChanged || ( cells != m_Cells.GetPointer() ) || ( cells->GetMTime() != m_CellsMTime ) )
+    {
+    m_TetrahedronIds.clear();
+    m_Tetrahedra.clear();
+    AtlasMesh::CellIdentifier  maximumTetrahedronId = 0;
+    for ( AtlasMesh::CellsContainer::ConstIterator  cellIt = cells->Begin();
+          cellIt != cells->End(); ++cellIt )
+      {
+      if ( cellIt.Value()->GetType() != AtlasMesh::CellType::TETRAHEDRON_CELL )
+        {
+        continue;
+        }
+
+      m_TetrahedronIds.push_back( cellIt.Index() );
+      maximumTetrahedronId = std::max( maximumTetrahedronId, cellIt.Index() );
+      for ( AtlasMesh::CellType::PointIdConstIterator  pit = cellIt.Value()->PointIdsBegin();
+            pit != cellIt.Value()->PointIdsEnd(); ++pit )
+        {
+        m_Tetrahedra.push_back( m_PointIndices[ *pit ] );
+        }
+      }
+    m_TetrahedronIndices.assign( m_TetrahedronIds.empty() ? 0 : maximumTetrahedronId + 1, -1 );
+    for ( size_t tetrahedronIndex = 0; tetrahedronIndex < m_TetrahedronIds.size(); tetrahedronIndex++ )
+      {
+      m_TetrahedronIndices[ m_TetrahedronIds[ tetrahedronIndex ] ] = tetrahedronIndex;
+      }
+      
+    m_Cells = cells;
+    m_CellsMTime = cells->GetMTime();
+    }
+
+
+  // Alphas, one row per point
+  const AtlasMesh::PointDataContainer*  pointData = mesh->GetPointData();
+  if ( pointsChanged || ( pointData != m_PointData.GetPointer() ) || 
+       ( pointData && ( pointData->GetMTime() != m_PointDataMTime ) ) )
+    {
+    m_NumberOfClasses = 0;
+    if ( pointData && ( pointData->Size() > 0 ) )
+      {
+      m_NumberOfClasses = pointData->Begin().Value().m_Alphas.Size();
+      }
+    m_Alphas.resize( static_cast< size_t >( numberOfPoints ) * m_NumberOfClasses );
+    m_AlphaViews.resize( numberOfPoints );
+    if ( m_NumberOfClasses > 0 )
+      {
+      for ( pointIndex = 0; pointIndex < numberOfPoints; pointIndex++ )
+        {
+        const AtlasAlphasType&  alphas = pointData->ElementAt( m_PointIds[ pointIndex ] ).m_Alphas;
+        float*  row = &( m_Alphas[ static_cast< size_t >( pointIndex ) * m_NumberOfClasses ] );
+        std::copy( alphas.data_block(), alphas.data_block() + m_NumberOfClasses, row );
+
+        // Point into the matrix without taking ownership
+        m_AlphaViews[ pointIndex ].SetData( row, m_NumberOfClasses, false );
+        }
+      }
+      
+    m_PointData = pointData;
+    m_PointDataMTime = pointData ? pointData->GetMTime() : 0;
+    }
+
+}
+
+
+
+} // end namespace kvl
@@ -0,0 +1,131 @@
+#ifndef __kvlAtlasMeshArrays_h
+#define __kvlAtlasMeshArrays_h
+
+#include "kvlAtlasMesh.h"
+
+
+namespace kvl
+{
+
+
+/**
+ *
+ * Contiguous copy of an atlas mesh, for the loops that visit every point or
+ * tetrahedron: positions as one [ N x 3 ] array, alphas as one [ N x L ]
+ * matrix, and tetrahedra as [ T x 4 ] point indices. Points are numbered
+ * 0...N-1 in the order of the mesh's point container, so the same index
+ * also addresses gradients and deformations laid out the same way.
+ *
+ * The alphas of each point are also available as an AtlasAlphasType that
+ * points into the matrix rather than owning a copy, so code written against
+ * the mesh API can take them unchanged.
+ *
+ * Update() is meant to be called on every rasterization of a mesh whose 
+ * points move. It always refreshes the positions, but only rebuilds the 
+ * tetrahedra and recopies the alphas when the point identifiers, or the 
+ * cells or point data container (or its modification time), have changed. 
+ * Code that changes alphas in place must therefore call Modified() on the 
+ * point data container.
+ *
+ */
+class AtlasMeshArrays: public itk::Object
+{
+public :
+
+  /** Standard class typedefs */
+  typedef AtlasMeshArrays  Self;
+  typedef itk::Object  Superclass;
+  typedef itk::SmartPointer< Self >  Pointer;
+  typedef itk::SmartPointer< const Self >  ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro( Self );
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro( AtlasMeshArrays, itk::Object );
+
+  // Copy the positions from the mesh, and the rest only if it has changed. 
+  // Memory is kept from one call to the next
+  void  Update( const AtlasMesh* mesh );
+
+  //
+  int  GetNumberOfPoints() const
+    { return m_PointIds.size(); }
+
+  //
+  int  GetNumberOfTetrahedra() const
+    { return m_TetrahedronIds.size(); }
+
+  //
+  int  GetNumberOfClasses() const
+    { return m_NumberOfClasses; }
+
+  //
+  AtlasMesh::PointIdentifier  GetPointId( int pointIndex ) const
+    { return m_PointIds[ pointIndex ]; }
+
+  //
+  int  GetPointIndex( AtlasMesh::PointIdentifier pointId ) const
+    { return m_PointIndices[ pointId ]; }
+
+  //
+  AtlasMesh::CellIdentifier  GetTetrahedronId( int tetrahedronIndex ) const
+    { return m_TetrahedronIds[ tetrahedronIndex ]; }
+
+  //
+  int  GetTetrahedronIndex( AtlasMesh::CellIdentifier tetrahedronId ) const
+    { return m_TetrahedronIndices[ tetrahedronId ]; }
+
+  // The four point indices of a tetrahedron
+  const int*  GetTetrahedron( int tetrahedronIndex ) const
+    { return &( m_Tetrahedra[ 4 * tetrahedronIndex ] ); }
+
+  //
+  const AtlasMesh::PointType&  GetPosition( int pointIndex ) const
+    { return m_Positions[ pointIndex ]; }
+
+  // [ N x 3 ]
+  const double*  GetPositionData() const
+    { return m_Positions.empty() ? 0 : m_Positions[ 0 ].GetDataPointer(); }
+
+  // View into the alpha matrix
+  const AtlasAlphasType&  GetAlphas( int pointIndex ) const
+    { return m_AlphaViews[ pointIndex ]; }
+
+  // [ N x L ]
+  const float*  GetAlphaData() const
+    { return m_Alphas.empty() ? 0 : &( m_Alphas[ 0 ] ); }
+
+protected:
+  AtlasMeshArrays();
+  virtual ~AtlasMeshArrays();
+
+private:
+  AtlasMeshArrays(const Self&); //purposely not implemented
+  void operator=(const Self&); //purposely not implemented
+
+  //
+  std::vector< AtlasMesh::PointIdentifier >  m_PointIds;
+  std::vector< int >  m_PointIndices;
+  std::vector< AtlasMesh::CellIdentifier >  m_TetrahedronIds;
+  std::vector< int >  m_TetrahedronIndices;
+  std::vector< int >  m_Tetrahedra;
+  std::vector< AtlasMesh::PointType >  m_Positions;
+  int  m_NumberOfClasses;
+  std::vector< float >  m_Alphas;
+  std::vector< AtlasAlphasType >  m_AlphaViews;
+
+  // What the tetrahedra and alphas were copied from. Holding on to the
+  // containers also keeps their addresses from being reused
+  AtlasMesh::CellsContainer::ConstPointer  m_Cells;
+  itk::ModifiedTimeType  m_CellsMTime;
+  AtlasMesh::PointDataContainer::ConstPointer  m_PointData;
+  itk::ModifiedTimeType  m_PointDataMTime;
+
+};
+
+
+
+} // end namespace kvl
+
+#endif
@@ -3632,6 +3632,7 @@ AtlasMeshCollection
       }
 
     }
+  m_PointParameters->Modified(); // the alphas were changed in place
 }
 
 /*!
@@ -13,8 +13,8 @@ AtlasMeshDeformationConjugateGradientOptimizer
 {
 
   m_OldCost = 0;
-  m_OldGradient = 0;
-  m_OldSearchDirection = 0;
+  m_OldGradient.clear();
+  m_OldSearchDirection.clear();
   m_AlphaUsedLastTime = 0.0;
   
   m_StartDistance = 1.0; // Measured in voxels
@@ -40,8 +40,8 @@ void AtlasMeshDeformationConjugateGradientOptimizer
 {
 
   m_OldCost = 0;
-  m_OldGradient = 0;
-  m_OldSearchDirection = 0;
+  m_OldGradient.clear();
+  m_OldSearchDirection.clear();
   
   Superclass::Initialize();
   
@@ -60,7 +60,7 @@ AtlasMeshDeformationConjugateGradientOptimizer
   // 
   // Part I: Decide on a new search direction
   //
-  AtlasPositionGradientContainerType::Pointer  searchDirection = 0;
+  DeformationType  searchDirection;
   bool  startingOrRestarting = false;
   if ( this->GetIterationNumber() == 0 )
     {
@@ -102,9 +102,8 @@ AtlasMeshDeformationConjugateGradientOptimizer
       {
       // Hestenes-Stiefel
       // beta = gradient' * ( gradient - gradientOld ) / ( ( gradient - gradientOld )' * pOld ); 
-      AtlasPositionGradientContainerType::Pointer  tmp =  
-              this->LinearlyCombineDeformations( m_Gradient, 1.0, 
-                                                 m_OldGradient, -1.0 );
+      const DeformationType  tmp = this->LinearlyCombineDeformations( m_Gradient, 1.0, 
+                                                                     m_OldGradient, -1.0 );
       beta = this->ComputeInnerProduct( m_Gradient, tmp ) / 
              this->ComputeInnerProduct( tmp, m_OldSearchDirection );       
       }
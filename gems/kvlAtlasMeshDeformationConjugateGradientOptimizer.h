@@ -38,8 +38,8 @@ private:
   void operator=(const Self&); //purposely not implemented
   
   double  m_OldCost;
-  AtlasPositionGradientContainerType::Pointer  m_OldGradient;
-  AtlasPositionGradientContainerType::Pointer  m_OldSearchDirection;
+  DeformationType  m_OldGradient;
+  DeformationType  m_OldSearchDirection;
   double  m_AlphaUsedLastTime;
   
   double  m_StartDistance;
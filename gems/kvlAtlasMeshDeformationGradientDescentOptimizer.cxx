@@ -13,8 +13,8 @@ AtlasMeshDeformationGradientDescentOptimizer
 {
 
   m_OldCost = 0;
-  m_OldGradient = 0;
-  m_OldSearchDirection = 0;
+  m_OldGradient.clear();
+  m_OldSearchDirection.clear();
   m_AlphaUsedLastTime = 0.0;
   
   m_StartDistance = 1.0; // Measured in voxels
@@ -40,8 +40,8 @@ void AtlasMeshDeformationGradientDescentOptimizer
 {
 
   m_OldCost = 0;
-  m_OldGradient = 0;
-  m_OldSearchDirection = 0;
+  m_OldGradient.clear();
+  m_OldSearchDirection.clear();
   
   Superclass::Initialize();
   
@@ -60,8 +60,7 @@ AtlasMeshDeformationGradientDescentOptimizer
   // 
   // Part I: Decide on a new search direction
   //
-  AtlasPositionGradientContainerType::Pointer  searchDirection 
-              = this->ScaleDeformation( m_Gradient, -1.0 );   // p = -gradient;
+  const DeformationType  searchDirection = this->ScaleDeformation( m_Gradient, -1.0 );   // p = -gradient;
 
 
   //
@@ -13,8 +13,8 @@ AtlasMeshDeformationLBFGSOptimizer
 {
 
   m_OldCost = 0;
-  m_OldGradient = 0;
-  m_OldSearchDirection = 0;
+  m_OldGradient.clear();
+  m_OldSearchDirection.clear();
   m_AlphaUsedLastTime = 0.0;
   
   m_StartDistance = 1.0; // Measured in voxels
@@ -41,8 +41,8 @@ void AtlasMeshDeformationLBFGSOptimizer
 {
 
   m_OldCost = 0;
-  m_OldGradient = 0;
-  m_OldSearchDirection = 0;
+  m_OldGradient.clear();
+  m_OldSearchDirection.clear();
   
   m_Ss.clear();
   m_Ys.clear();
@@ -82,12 +82,10 @@ AtlasMeshDeformationLBFGSOptimizer
     {
     // Update S and Y in L-BFGS
     // s = x - xOld; % Equivalent to alphaUsed * pOld;
-    AtlasPositionGradientContainerType::ConstPointer  s  
-                     = this->ScaleDeformation( m_OldSearchDirection, m_AlphaUsedLastTime ).GetPointer();
+    const DeformationType  s = this->ScaleDeformation( m_OldSearchDirection, m_AlphaUsedLastTime );
       
     // y = gradient - gradientOld;
-    AtlasPositionGradientContainerType::ConstPointer  y 
-                     =  this->LinearlyCombineDeformations( m_Gradient, 1.0, m_OldGradient, -1.0 ).GetPointer();
+    const DeformationType  y = this->LinearlyCombineDeformations( m_Gradient, 1.0, m_OldGradient, -1.0 );
                      
     // inverseRho = ( s' * y );
     const double  inverseRho = this->ComputeInnerProduct( s, y );
@@ -123,15 +121,15 @@ AtlasMeshDeformationLBFGSOptimizer
     
   
   // q = gradient;
-  AtlasPositionGradientContainerType::Pointer  q = this->ScaleDeformation( m_Gradient, 1.0 );
+  DeformationType  q = m_Gradient;
   const int  memoryLength = m_Ss.size();
   //std::cout << "memoryLength: " << memoryLength << std::endl;
   
   std::vector< double >  alps( memoryLength, 0.0 );
   for ( int i = 0; i < memoryLength; i++ )
     {
-    AtlasPositionGradientContainerType::ConstPointer  s = m_Ss[ i ];
-    AtlasPositionGradientContainerType::ConstPointer  y = m_Ys[ i ];
+    const DeformationType&  s = m_Ss[ i ];
+    const DeformationType&  y = m_Ys[ i ];
     const double  inverseRho = m_InverseRhos[ i ];
   
     // alp = ( s' * q ) / inverseRho;
@@ -144,11 +142,11 @@ AtlasMeshDeformationLBFGSOptimizer
     }
     
   // r = gamma * q;
-  AtlasPositionGradientContainerType::Pointer  r = this->ScaleDeformation( q, gamma );
+  DeformationType  r = this->ScaleDeformation( q, gamma );
   for ( int i = ( memoryLength-1 );  i >=0; i-- )
     {
-    AtlasPositionGradientContainerType::ConstPointer  s = m_Ss[ i ];
-    AtlasPositionGradientContainerType::ConstPointer  y = m_Ys[ i ];
+    const DeformationType&  s = m_Ss[ i ];
+    const DeformationType&  y = m_Ys[ i ];
     const double  inverseRho = m_InverseRhos[ i ];
     const double  alp = alps[ i ];
   
@@ -160,8 +158,7 @@ AtlasMeshDeformationLBFGSOptimizer
     }
   
   // Direction is -r: p = -r;
-  AtlasPositionGradientContainerType::Pointer  searchDirection 
-                                                      = this->ScaleDeformation( r, -1.0 );
+  const DeformationType  searchDirection = this->ScaleDeformation( r, -1.0 );
 
                                                       
   //
@@ -50,12 +50,12 @@ private:
   void operator=(const Self&); //purposely not implemented
   
   double  m_OldCost;
-  AtlasPositionGradientContainerType::Pointer  m_OldGradient;
-  AtlasPositionGradientContainerType::Pointer  m_OldSearchDirection;
+  DeformationType  m_OldGradient;
+  DeformationType  m_OldSearchDirection;
   double  m_AlphaUsedLastTime;
   
-  std::vector< AtlasPositionGradientContainerType::ConstPointer >  m_Ss; 
-  std::vector< AtlasPositionGradientContainerType::ConstPointer >  m_Ys;
+  std::vector< DeformationType >  m_Ss; 
+  std::vector< DeformationType >  m_Ys;
   std::vector< double >  m_InverseRhos;
   
   double  m_StartDistance;
@@ -21,8 +21,8 @@ AtlasMeshDeformationOptimizer
   m_MaximalDeformationStopCriterion = 0.05;
   
   m_Cost = 0;
-  m_Position = 0;
-  m_Gradient = 0;
+  m_TrialMesh = 0;
+  m_TrialPosition = 0;
   
   m_LineSearchMaximalDeformationLimit = 50.0; // Measured in voxels
   m_LineSearchMaximalDeformationIntervalStopCriterion = 0.05; // Measured in voxels
@@ -44,24 +44,77 @@ AtlasMeshDeformationOptimizer
 //
 void
 AtlasMeshDeformationOptimizer
-::GetCostAndGradient( const AtlasMesh::PointsContainer* position, 
+::CopyPositions( const DeformationType& position, AtlasMesh::PointsContainer* container ) const
+{
+  const double*  source = position.data_block();
+  for ( AtlasMesh::PointsContainer::Iterator  pointIt = container->Begin();
+        pointIt != container->End(); ++pointIt, source += 3 )
+    {
+    for ( int i = 0; i < 3; i++ )
+      {
+      pointIt.Value()[ i ] = source[ i ];
+      }
+    }
+    
+}
+
+
+
+//
+//
+//
+void
+AtlasMeshDeformationOptimizer
+::GetCostAndGradient( const DeformationType& position, 
                       double& cost, 
-                      AtlasPositionGradientContainerType::Pointer& gradient )
+                      DeformationType& gradient )
 {
   
-  // Set up a mesh
-  AtlasMesh::Pointer  mesh = AtlasMesh::New();
-  mesh->SetPoints( const_cast< AtlasMesh::PointsContainer* >( position ) );
-  mesh->SetCells( m_Mesh->GetCells() );
-  mesh->SetPointData( m_Mesh->GetPointData() );
-  mesh->SetCellData( m_Mesh->GetCellData() );
+  // Move the points of the trial mesh (which shares everything else with 
+  // the mesh being optimized)
+  this->CopyPositions( position, m_TrialPosition );
+  m_TrialPosition->Modified();
     
   // Rasterize mesh
-  m_Calculator->Rasterize( mesh );
+  m_Calculator->Rasterize( m_TrialMesh );
   
   // Retrieve results
   cost = m_Calculator->GetMinLogLikelihoodTimesPrior();
-  gradient = m_Calculator->GetPositionGradient();
+  // The flat gradient must be laid out like the positions, ie, in the order
+  // of the points container. Calculators fill the gradient in that order, 
+  // but look the points up by identifier if one does not
+  const AtlasPositionGradientContainerType*  gradientContainer = m_Calculator->GetPositionGradient();
+  if ( gradientContainer->Size() != m_TrialPosition->Size() )
+    {
+    itkExceptionMacro( << "Gradient has " << gradientContainer->Size() 
+                       << " points but the mesh has " << m_TrialPosition->Size() );
+    }
+  gradient.set_size( 3 * m_TrialPosition->Size() );
+  double*  target = gradient.data_block();
+  AtlasPositionGradientContainerType::ConstIterator  it = gradientContainer->Begin();
+  for ( AtlasMesh::PointsContainer::ConstIterator  pointIt = m_TrialPosition->Begin();
+        pointIt != m_TrialPosition->End(); ++pointIt, target += 3 )
+    {
+    AtlasPositionGradientType  entry;
+    if ( ( it != gradientContainer->End() ) && ( it.Index() == pointIt.Index() ) )
+      {
+      entry = it.Value();
+      ++it;
+      }
+    else if ( gradientContainer->IndexExists( pointIt.Index() ) )
+      {
+      entry = gradientContainer->ElementAt( pointIt.Index() );
+      it = gradientContainer->End();
+      }
+    else
+      {
+      itkExceptionMacro( << "Gradient is missing point " << pointIt.Index() );
+      }
+    for ( int i = 0; i < 3; i++ )
+      {
+      target[ i ] = entry[ i ];
+      }
+    }
 
   
 }
@@ -130,7 +183,15 @@ AtlasMeshDeformationOptimizer
     return 0.0;  
     }
     
-  m_Mesh->SetPoints( m_Position );
+  // The mesh gets a container of its own, as its old one may be shared 
+  AtlasMesh::PointsContainer::Pointer  position = AtlasMesh::PointsContainer::New();
+  const double*  source = m_Position.data_block();
+  for ( AtlasMesh::PointsContainer::ConstIterator  pointIt = m_TrialPosition->Begin();
+        pointIt != m_TrialPosition->End(); ++pointIt, source += 3 )
+    {
+    position->InsertElement( pointIt.Index(), AtlasMesh::PointType( source ) );
+    }
+  m_Mesh->SetPoints( position );
   if ( !( m_IterationNumber % m_IterationEventResolution ) )
     {
     this->InvokeEvent( DeformationIterationEvent() );
@@ -164,22 +225,23 @@ AtlasMeshDeformationOptimizer
 //
 double
 AtlasMeshDeformationOptimizer
-::ComputeMaximalDeformation( const AtlasPositionGradientContainerType* deformation ) const
+::ComputeMaximalDeformation( const DeformationType& deformation ) const
 {
   
   // Compute the largest deformation magnitude in any point
-  double  maximalDeformation = 0.0;
-  for ( AtlasPositionGradientContainerType::ConstIterator  it = deformation->Begin();
-        it != deformation->End(); ++it )
+  double  maximalSquaredDeformation = 0.0;
+  const double*  d = deformation.data_block();
+  const int  numberOfPoints = deformation.size() / 3;
+  for ( int pointNumber = 0; pointNumber < numberOfPoints; pointNumber++, d += 3 )
     {     
-    const double  magnitude = it.Value().GetNorm(); 
-    if ( magnitude > maximalDeformation )
+    const double  squaredMagnitude = d[ 0 ] * d[ 0 ] + d[ 1 ] * d[ 1 ] + d[ 2 ] * d[ 2 ];
+    if ( squaredMagnitude > maximalSquaredDeformation )
       {
-      maximalDeformation = magnitude;
+      maximalSquaredDeformation = squaredMagnitude;
       }
     }
 
-  return maximalDeformation;
+  return sqrt( maximalSquaredDeformation );
 }
   
   
@@ -189,27 +251,25 @@ AtlasMeshDeformationOptimizer
 //
 void
 AtlasMeshDeformationOptimizer
-::AddDeformation( const AtlasMesh::PointsContainer* position, 
+::AddDeformation( const DeformationType& position, 
                   double alpha,
-                  const AtlasPositionGradientContainerType* deformationDirection,                    
-                  AtlasMesh::PointsContainer::Pointer&  newPosition,
+                  const DeformationType& deformationDirection,                    
+                  DeformationType&  newPosition,
                   double&  maximalDeformation ) const
 {
-  maximalDeformation = 0.0;
-  newPosition = AtlasMesh::PointsContainer::New();
-  AtlasMesh::PointsContainer::ConstIterator  posIt = position->Begin();
-  AtlasPositionGradientContainerType::ConstIterator  defIt = deformationDirection->Begin();
-  for ( ; posIt != position->End(); ++posIt, ++defIt )
+  // newPosition may be the same vector as position, so only ever read an 
+  // element before writing it
+  const int  numberOfElements = position.size();
+  newPosition.set_size( numberOfElements );
+  const double*  x = position.data_block();
+  const double*  p = deformationDirection.data_block();
+  double*  y = newPosition.data_block();
+  for ( int i = 0; i < numberOfElements; i++ )
     {
-    const AtlasPositionGradientType  newStep  = alpha * defIt.Value();
-
-    if ( newStep.GetNorm() > maximalDeformation )
-      {
-      maximalDeformation = newStep.GetNorm();
-      }
-
-    newPosition->InsertElement( posIt.Index(), posIt.Value() + newStep );
+    y[ i ] = x[ i ] + alpha * p[ i ];
     }
+    
+  maximalDeformation = fabs( alpha ) * this->ComputeMaximalDeformation( deformationDirection );
   
 }                  
   
@@ -220,42 +280,33 @@ AtlasMeshDeformationOptimizer
 //
 double
 AtlasMeshDeformationOptimizer
-::ComputeInnerProduct( const AtlasPositionGradientContainerType* deformation1,
-                       const AtlasPositionGradientContainerType* deformation2 ) const
+::ComputeInnerProduct( const DeformationType& deformation1,
+                       const DeformationType& deformation2 ) const
 {
   
-  double innerProduct = 0.0;
-  AtlasPositionGradientContainerType::ConstIterator  defIt1 = deformation1->Begin();
-  AtlasPositionGradientContainerType::ConstIterator  defIt2 = deformation2->Begin();
-  for ( ; defIt1 != deformation1->End(); ++defIt1, ++defIt2 )
-    {
-    for ( int i = 0; i < 3; i++ )
-      {
-      innerProduct += defIt1.Value()[i] * defIt2.Value()[i];
-      }
-    }  
-  
-  return innerProduct;
+  return dot_product( deformation1, deformation2 );
 }                       
   
   
 //
 //
 //
-AtlasPositionGradientContainerType::Pointer  
+AtlasMeshDeformationOptimizer::DeformationType
 AtlasMeshDeformationOptimizer
-::LinearlyCombineDeformations( const AtlasPositionGradientContainerType* deformation1,
+::LinearlyCombineDeformations( const DeformationType& deformation1,
                                double beta1,
-                               const AtlasPositionGradientContainerType* deformation2,
+                               const DeformationType& deformation2,
                                double beta2 ) const
 {
   
-  AtlasPositionGradientContainerType::Pointer  newDeformation = AtlasPositionGradientContainerType::New();
-  AtlasPositionGradientContainerType::ConstIterator  defIt1 = deformation1->Begin();
-  AtlasPositionGradientContainerType::ConstIterator  defIt2 = deformation2->Begin();
-  for ( ; defIt1 != deformation1->End(); ++defIt1, ++defIt2 )
+  const int  numberOfElements = deformation1.size();
+  DeformationType  newDeformation( numberOfElements );
+  const double*  d1 = deformation1.data_block();
+  const double*  d2 = deformation2.data_block();
+  double*  d = newDeformation.data_block();
+  for ( int i = 0; i < numberOfElements; i++ )
     {
-    newDeformation->InsertElement( defIt1.Index(), beta1 * defIt1.Value() + beta2 * defIt2.Value() );
+    d[ i ] = beta1 * d1[ i ] + beta2 * d2[ i ];
     }
   
   return newDeformation;
@@ -266,20 +317,13 @@ AtlasMeshDeformationOptimizer
 //
 //
 //
-AtlasPositionGradientContainerType::Pointer  
+AtlasMeshDeformationOptimizer::DeformationType
 AtlasMeshDeformationOptimizer
-::ScaleDeformation( const AtlasPositionGradientContainerType* deformation,
+::ScaleDeformation( const DeformationType& deformation,
                     double beta ) const
 {
   
-  AtlasPositionGradientContainerType::Pointer  newDeformation = AtlasPositionGradientContainerType::New();
-  AtlasPositionGradientContainerType::ConstIterator  defIt = deformation->Begin();
-  for ( ; defIt != deformation->End(); ++defIt )
-    {
-    newDeformation->InsertElement( defIt.Index(), beta * defIt.Value() );
-    }
-  
-  return newDeformation;
+  return deformation * beta;
   
 }                    
 
@@ -297,8 +341,26 @@ AtlasMeshDeformationOptimizer
     itkExceptionMacro( << "Cost and gradient calculator missing!" );
     }
 
-  //
-  m_Position = m_Mesh->GetPoints();
+  // Flatten the starting positions, and set up a mesh to try out new ones 
+  // on that shares everything else with the mesh being optimized
+  m_Position.set_size( 3 * m_Mesh->GetPoints()->Size() );
+  double*  target = m_Position.data_block();
+  m_TrialPosition = AtlasMesh::PointsContainer::New();
+  for ( AtlasMesh::PointsContainer::ConstIterator  pointIt = m_Mesh->GetPoints()->Begin();
+        pointIt != m_Mesh->GetPoints()->End(); ++pointIt, target += 3 )
+    {
+    m_TrialPosition->InsertElement( pointIt.Index(), pointIt.Value() );
+    for ( int i = 0; i < 3; i++ )
+      {
+      target[ i ] = pointIt.Value()[ i ];
+      }
+    }
+  m_TrialMesh = AtlasMesh::New();
+  m_TrialMesh->SetPoints( m_TrialPosition );
+  m_TrialMesh->SetCells( m_Mesh->GetCells() );
+  m_TrialMesh->SetPointData( m_Mesh->GetPointData() );
+  m_TrialMesh->SetCellData( m_Mesh->GetCellData() );
+  
   this->GetCostAndGradient( m_Position, m_Cost, m_Gradient );
   
   this->InvokeEvent( DeformationStartEvent() );
@@ -313,16 +375,16 @@ AtlasMeshDeformationOptimizer
 //
 void 
 AtlasMeshDeformationOptimizer
-::DoLineSearch( const AtlasMesh::PointsContainer*  startPosition, 
+::DoLineSearch( const DeformationType&  startPosition, 
                 double  startCost,
-                const AtlasPositionGradientContainerType*  startGradient,                    
-                const AtlasPositionGradientContainerType*  searchDirection,                    
+                const DeformationType&  startGradient,                    
+                const DeformationType&  searchDirection,                    
                 double  startAlpha,
                 double  c1,
                 double  c2,
-                AtlasMesh::PointsContainer::Pointer&  newPosition,
+                DeformationType&  newPosition,
                 double&  newCost,
-                AtlasPositionGradientContainerType::Pointer& newGradient,
+                DeformationType& newGradient,
                 double&  alphaUsed )
 {
   
@@ -331,7 +393,7 @@ AtlasMeshDeformationOptimizer
   //
   const double  initialAlpha = 0.0;
   const double  initialCost = startCost;
-  AtlasPositionGradientContainerType::ConstPointer  initialGradient = startGradient;
+  const DeformationType  initialGradient = startGradient;
   const double  initialDirectionalDerivative = 
     this->ComputeInnerProduct( startGradient, searchDirection ); // gradient' * p;
   if ( initialDirectionalDerivative >= 0 )
@@ -343,7 +405,7 @@ AtlasMeshDeformationOptimizer
   //
   double  previousAlpha = initialAlpha;
   double  previousCost = initialCost;
-  AtlasPositionGradientContainerType::ConstPointer  previousGradient = initialGradient;
+  DeformationType  previousGradient = initialGradient;
   double  previousDirectionalDerivative = initialDirectionalDerivative;
 
   //
@@ -359,11 +421,11 @@ AtlasMeshDeformationOptimizer
   const int  maximumOfBracketingIterations = 10;
   double  lowAlpha = 0.0;
   double  lowCost = 0.0;
-  AtlasPositionGradientContainerType::ConstPointer  lowGradient = 0;
+  DeformationType  lowGradient;
   double  lowDirectionalDerivative = 0.0;
   double  highAlpha = 0.0;
   double  highCost = 0.0;
-  AtlasPositionGradientContainerType::ConstPointer  highGradient = 0;
+  DeformationType  highGradient;
   double  highDirectionalDerivative = 0.0;
       
   for ( int bracketingIterationNumber = 0; 
@@ -371,12 +433,12 @@ AtlasMeshDeformationOptimizer
         bracketingIterationNumber++ )
     {     
     // Evaluate current alpha: [ cost gradient ] = tryFunction( x + alpha * p );
-    AtlasMesh::PointsContainer::Pointer  position = 0;
+    DeformationType  position;
     double  maximalDeformation = 0.0;
     this->AddDeformation( startPosition, alpha, searchDirection, 
                           position, maximalDeformation );
     double  cost;
-    AtlasPositionGradientContainerType::Pointer  gradient = 0;
+    DeformationType  gradient;
     this->GetCostAndGradient( position, cost, gradient );
     const double  directionalDerivative = this->ComputeInnerProduct( gradient, searchDirection ); // gradient' * p
 
@@ -557,7 +619,7 @@ AtlasMeshDeformationOptimizer
     this->AddDeformation( startPosition, previousAlpha, searchDirection, 
                           newPosition, dummy ); // xStar = x + previousAlpha * p;
     newCost = previousCost;
-    newGradient = const_cast< AtlasPositionGradientContainerType* >( previousGradient.GetPointer() );
+    newGradient = previousGradient;
     alphaUsed = previousAlpha;
     if ( m_Verbose )
       {
@@ -704,12 +766,12 @@ AtlasMeshDeformationOptimizer
 #endif
     
     // Evaluate cost function: [ cost gradient ] = tryFunction( x + alpha * p );
-    AtlasMesh::PointsContainer::Pointer  position = 0;
+    DeformationType  position;
     double  maximalDeformation = 0.0;
     this->AddDeformation( startPosition, alpha, searchDirection, 
                           position, maximalDeformation );
     double  cost;
-    AtlasPositionGradientContainerType::Pointer  gradient = 0;
+    DeformationType  gradient;
     this->GetCostAndGradient( position, cost, gradient );
     const double  directionalDerivative = this->ComputeInnerProduct( gradient, searchDirection ); // gradient' * p
 
@@ -762,7 +824,7 @@ AtlasMeshDeformationOptimizer
       this->AddDeformation( startPosition, lowAlpha, searchDirection, 
                             newPosition, dummy ); // xStar = x + lowAlpha * p;
       newCost = lowCost;
-      newGradient = const_cast< AtlasPositionGradientContainerType* >( lowGradient.GetPointer() );
+      newGradient = lowGradient;
       alphaUsed = lowAlpha;
       if ( m_Verbose )
         {
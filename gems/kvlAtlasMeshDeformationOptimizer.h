@@ -3,6 +3,7 @@
 
 #include "kvlAtlasMesh.h"
 #include "kvlAtlasMeshPositionCostAndGradientCalculator.h"
+#include "vnl/vnl_vector.h"
 
 
 namespace kvl
@@ -40,6 +41,12 @@ public :
   /** Run-time type information (and related methods). */
   itkTypeMacro( AtlasMeshDeformationOptimizer, itk::Object );
 
+  /** Positions, gradients and search directions are handled internally as 
+   * flat [ 3N ] vectors, in the order of the mesh's point container, so that
+   * the algebra of the line search and the search direction updates are
+   * plain array loops instead of container insertions */
+  typedef vnl_vector< double >  DeformationType;
+
   /** */
   void  SetMesh( AtlasMesh* mesh )
     {
@@ -136,54 +143,52 @@ protected:
   virtual void Initialize();
 
   //
-  virtual void  GetCostAndGradient( const AtlasMesh::PointsContainer* position, 
+  virtual void  GetCostAndGradient( const DeformationType& position, 
                                     double& cost, 
-                                    AtlasPositionGradientContainerType::Pointer& gradient );
+                                    DeformationType& gradient );
   
   //
-  double  ComputeMaximalDeformation( const AtlasPositionGradientContainerType* deformation ) const;
+  double  ComputeMaximalDeformation( const DeformationType& deformation ) const;
   
   // Compute position + alpha * deformationDirection
-  void  AddDeformation( const AtlasMesh::PointsContainer* position, 
+  void  AddDeformation( const DeformationType& position, 
                         double alpha,
-                        const AtlasPositionGradientContainerType* deformationDirection,                    
-                        AtlasMesh::PointsContainer::Pointer&  newPosition,
+                        const DeformationType& deformationDirection,                    
+                        DeformationType&  newPosition,
                         double&  maximalDeformation ) const;
   
   // Compute inner product deformation1' * deformation2
-  double  ComputeInnerProduct(  const AtlasPositionGradientContainerType* deformation1,
-                                const AtlasPositionGradientContainerType* deformation2 ) const;
+  double  ComputeInnerProduct(  const DeformationType& deformation1,
+                                const DeformationType& deformation2 ) const;
   
   // Compute beta1 * deformation1 + beta2 * deformation2
-  AtlasPositionGradientContainerType::Pointer  
-     LinearlyCombineDeformations( const AtlasPositionGradientContainerType* deformation1,
-                                  double beta1,
-                                  const AtlasPositionGradientContainerType* deformation2,
-                                  double beta2 ) const;
+  DeformationType  LinearlyCombineDeformations( const DeformationType& deformation1,
+                                                double beta1,
+                                                const DeformationType& deformation2,
+                                                double beta2 ) const;
 
   // Compute beta * deformation 
-  AtlasPositionGradientContainerType::Pointer  
-     ScaleDeformation( const AtlasPositionGradientContainerType* deformation,
-                       double beta ) const;
+  DeformationType  ScaleDeformation( const DeformationType& deformation,
+                                     double beta ) const;
 
   //
-  void  DoLineSearch( const AtlasMesh::PointsContainer*  startPosition, 
+  void  DoLineSearch( const DeformationType&  startPosition, 
                       double  startCost,
-                      const AtlasPositionGradientContainerType*  startGradient,                    
-                      const AtlasPositionGradientContainerType*  searchDirection,                    
+                      const DeformationType&  startGradient,                    
+                      const DeformationType&  searchDirection,                    
                       double  startAlpha,
                       double  c1,
                       double  c2,
-                      AtlasMesh::PointsContainer::Pointer&  newPosition,
+                      DeformationType&  newPosition,
                       double&  newCost,
-                      AtlasPositionGradientContainerType::Pointer& newGradient,
+                      DeformationType& newGradient,
                       double&  alphaUsed );                  
                        
   //
   bool  m_Verbose;
   double  m_Cost;
-  AtlasMesh::PointsContainer::Pointer  m_Position;
-  AtlasPositionGradientContainerType::Pointer  m_Gradient;
+  DeformationType  m_Position;
+  DeformationType  m_Gradient;
 
 private:
   AtlasMeshDeformationOptimizer(const Self&); //purposely not implemented
@@ -196,8 +201,15 @@ private:
   int  m_IterationEventResolution;
 
 
+  // Copy flat positions into a points container with the mesh's point ids
+  void  CopyPositions( const DeformationType& position, AtlasMesh::PointsContainer* container ) const;
+
   AtlasMesh::Pointer  m_Mesh;
   AtlasMeshPositionCostAndGradientCalculator::Pointer  m_Calculator;
+  
+  // Reused for every trial position of the line search
+  AtlasMesh::Pointer  m_TrialMesh;
+  AtlasMesh::PointsContainer::Pointer  m_TrialPosition;
   double  m_MaximalDeformationStopCriterion;
   
   double  m_LineSearchMaximalDeformationLimit;
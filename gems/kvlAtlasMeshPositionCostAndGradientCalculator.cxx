@@ -1,6 +1,7 @@
 #include "kvlAtlasMeshPositionCostAndGradientCalculator.h"
 
 #include <itkMath.h>
+#include <algorithm>
 #include "vnl/vnl_matrix_fixed.h"
 #include "vnl/vnl_inverse.h"
 
@@ -21,6 +22,7 @@ AtlasMeshPositionCostAndGradientCalculator
   m_PositionGradient = 0;
   m_Abort = false;
   m_BoundaryCondition = SLIDING;
+  m_MeshArrays = AtlasMeshArrays::New();
 
   this->SetMeshToImageTransform( TransformType::New() );
   
@@ -50,32 +52,22 @@ AtlasMeshPositionCostAndGradientCalculator
   m_Abort = false;
   m_PositionGradient = 0;
   m_MinLogLikelihoodTimesPrior = 0;
-  m_ThreadSpecificPositionGradients.clear();
-  m_ThreadSpecificMinLogLikelihoodTimesPriors.clear();
 
 #if KVL_ENABLE_TIME_PROBE  
   itk::TimeProbe clock;
   clock.Start();
 #endif
   
-  // For each thread, create an empty gradient and cost so that
-  // different threads never interfere with one another
-  for ( int threadNumber = 0; threadNumber < this->GetNumberOfThreads(); threadNumber++ )
-    {
-    // Initialize cost to zero for this thread
-    m_ThreadSpecificMinLogLikelihoodTimesPriors.push_back( 0.0 );  
-      
-    // Create a container to hold the position gradient of this thread, and initialize to zero
-    AtlasPositionGradientContainerType::Pointer  positionGradient = AtlasPositionGradientContainerType::New();
-    AtlasPositionGradientType  zeroEntry( 0.0f );
-    for ( AtlasMesh::PointsContainer::ConstIterator pointIt = mesh->GetPoints()->Begin();
-          pointIt != mesh->GetPoints()->End(); ++pointIt )
-      {
-      positionGradient->InsertElement( pointIt.Index(), zeroEntry );
-      }
-    m_ThreadSpecificPositionGradients.push_back( positionGradient );
-    
-    } // End loop over threads
+  // Flat copy of the mesh for the per-tetrahedron work
+  m_MeshArrays->Update( mesh );
+  
+  // Order the tetrahedra spatially and cut them into chunks. Each chunk gets
+  // its own cost and a gradient covering only the vertices it touches, so
+  // memory no longer grows with the number of threads. The buffers are
+  // filled in by whichever thread picks up the chunk
+  const int  numberOfChunks = this->ScheduleTetrahedra( mesh );
+  m_ChunkCostsAndGradients.resize( numberOfChunks );
+  m_ThreadSpecificChunks.assign( this->GetNumberOfThreads(), 0 );
     
 #if KVL_ENABLE_TIME_PROBE      
   clock.Stop();
@@ -90,7 +82,8 @@ AtlasMeshPositionCostAndGradientCalculator
   m_ThreadSpecificPriorTermRasterizationTimers = std::vector< itk::TimeProbe >( this->GetNumberOfThreads() );
   m_ThreadSpecificOtherRasterizationTimers = std::vector< itk::TimeProbe >( this->GetNumberOfThreads() );
 #endif  
-  Superclass::Rasterize( mesh );
+  this->RasterizeScheduledTetrahedra( mesh );
+  m_ThreadSpecificChunks.clear();
 #if KVL_ENABLE_TIME_PROBE  
   clock.Stop();
   std::cout << "Time taken by actual rasterization: " << clock.GetMean() << std::endl;
@@ -111,51 +104,49 @@ AtlasMeshPositionCostAndGradientCalculator
   clock.Start();
 #endif  
   
-  // Initialize gradient-to-return to zero
+  // Collect the results of all the chunks, always in the same order, into
+  // a gradient indexed like the points of the mesh
+  const int  numberOfPoints = m_MeshArrays->GetNumberOfPoints();
+  m_Gradients.assign( numberOfPoints, AtlasPositionGradientType( 0.0 ) );
+  bool  isValid = !m_Abort;
+  for ( std::vector< ChunkCostAndGradient >::const_iterator  it = m_ChunkCostsAndGradients.begin();
+        isValid && ( it != m_ChunkCostsAndGradients.end() ); ++it )
+    {
+    if ( std::isnan( it->m_MinLogLikelihoodTimesPrior ) || std::isinf( it->m_MinLogLikelihoodTimesPrior ) )
+      {
+      isValid = false;
+      break;
+      }
+      
+    m_MinLogLikelihoodTimesPrior += it->m_MinLogLikelihoodTimesPrior;
+    
+    for ( size_t i = 0; i < it->m_PointIndices.size(); i++ )
+      {
+      m_Gradients[ it->m_PointIndices[ i ] ] += it->m_Gradients[ i ];
+      }
+      
+    } // End loop over all chunks
+  if ( !isValid )
+    {
+    m_Gradients.assign( numberOfPoints, AtlasPositionGradientType( 0.0 ) );
+    }
+  
+  // Hand the gradient out in the container type of the mesh API, filled in 
+  // one go in point order
   m_PositionGradient = AtlasPositionGradientContainerType::New();
-  AtlasPositionGradientType  zeroEntry( 0.0f );
-  for ( AtlasMesh::PointsContainer::ConstIterator pointIt = mesh->GetPoints()->Begin();
-        pointIt != mesh->GetPoints()->End(); ++pointIt )
+  for ( int pointIndex = 0; pointIndex < numberOfPoints; pointIndex++ )
     {
-    m_PositionGradient->InsertElement( pointIt.Index(), zeroEntry );
+    m_PositionGradient->InsertElement( m_MeshArrays->GetPointId( pointIndex ), m_Gradients[ pointIndex ] );
     }
-    
 
   // Make sure everything has gone smoothly
-  if ( m_Abort )
+  if ( !isValid )
     {
     // Something has gone wrong
     m_MinLogLikelihoodTimesPrior = itk::NumericTraits< double >::max();
     return;
     }
     
-  // Collect the results of all the threads
-  for ( std::vector< double >::const_iterator  it = m_ThreadSpecificMinLogLikelihoodTimesPriors.begin();
-        it != m_ThreadSpecificMinLogLikelihoodTimesPriors.end(); ++it )
-    {
-    if ( std::isnan( *it ) || std::isinf( *it ) )
-      {
-      // Something has gone wrong
-      m_MinLogLikelihoodTimesPrior = itk::NumericTraits< double >::max();
-      return;
-      }
-      
-    m_MinLogLikelihoodTimesPrior += *it;
-    }  
-  
-  for ( std::vector< AtlasPositionGradientContainerType::Pointer >::const_iterator  
-             it = m_ThreadSpecificPositionGradients.begin();
-        it != m_ThreadSpecificPositionGradients.end(); ++it )
-    {
-    AtlasPositionGradientContainerType::Iterator  sourceIt = ( *it )->Begin(); 
-    AtlasPositionGradientContainerType::Iterator  targetIt = m_PositionGradient->Begin(); 
-    for ( ; targetIt != m_PositionGradient->End(); ++sourceIt, ++targetIt )
-      {
-      targetIt.Value() += sourceIt.Value();
-      } 
-      
-    } // End loop over all threads  
-    
 #if KVL_ENABLE_TIME_PROBE  
   clock.Stop();
   std::cout << "Time taken by result collection: " << clock.GetMean() << std::endl;
@@ -280,6 +271,47 @@ AtlasMeshPositionCostAndGradientCalculator
 
 
 
+//
+//
+//
+bool
+AtlasMeshPositionCostAndGradientCalculator
+::RasterizeTetrahedra( const AtlasMesh* mesh,
+                       const AtlasMesh::CellIdentifier* tetrahedronIds,
+                       int numberOfTetrahedra,
+                       int chunkNumber,
+                       int threadNumber )
+{
+  
+  // The chunk buffers are only set up by Rasterize(); chunks rasterized any
+  // other way go straight to the tetrahedra
+  if ( m_ThreadSpecificChunks.empty() )
+    {
+    return Superclass::RasterizeTetrahedra( mesh, tetrahedronIds, numberOfTetrahedra, chunkNumber, threadNumber );
+    }
+  
+  // Collect the vertices this chunk touches, and start them off at zero
+  ChunkCostAndGradient&  chunk = m_ChunkCostsAndGradients[ chunkNumber ];
+  chunk.m_PointIndices.clear();
+  for ( int tetrahedronNumber = 0; tetrahedronNumber < numberOfTetrahedra; tetrahedronNumber++ )
+    {
+    const int*  tetrahedron 
+        = m_MeshArrays->GetTetrahedron( m_MeshArrays->GetTetrahedronIndex( tetrahedronIds[ tetrahedronNumber ] ) );
+    chunk.m_PointIndices.insert( chunk.m_PointIndices.end(), tetrahedron, tetrahedron + 4 );
+    }
+  std::sort( chunk.m_PointIndices.begin(), chunk.m_PointIndices.end() );
+  chunk.m_PointIndices.erase( std::unique( chunk.m_PointIndices.begin(), chunk.m_PointIndices.end() ), 
+                              chunk.m_PointIndices.end() );
+  chunk.m_Gradients.assign( chunk.m_PointIndices.size(), AtlasPositionGradientType( 0.0 ) );
+  chunk.m_MinLogLikelihoodTimesPrior = 0.0;
+  
+  m_ThreadSpecificChunks[ threadNumber ] = &chunk;
+  return Superclass::RasterizeTetrahedra( mesh, tetrahedronIds, numberOfTetrahedra, chunkNumber, threadNumber );
+  
+}
+
+
+
 //
 //
 //
@@ -345,44 +377,34 @@ AtlasMeshPositionCostAndGradientCalculator
   // More efficient is ReferenceTetrahedronInfo&  info = mesh->GetCellData()->ElementAt(ElementIdentifier) 
   const ReferenceTetrahedronInfo&  info = mesh->GetCellData()->ElementAt( tetrahedronId );
  
-  //AtlasMesh::CellAutoPointer  cell;
-  //mesh->GetCell( tetrahedronId, cell );
-  //AtlasMesh::CellType::PointIdIterator  pit = cell->PointIdsBegin();
-  // Implements internally: 
-  //      CellType* cellptr = 0;
-  //      this->GetCells()->GetElementIfIndexExists(cellId, &cellptr);
-  //      cellPointer.TakeNoOwnership(cellptr);
-  AtlasMesh::CellType::PointIdIterator  pit = mesh->GetCells()->ElementAt( tetrahedronId )->PointIdsBegin();
-  const AtlasMesh::PointIdentifier  id0 = *pit;
-  ++pit;
-  const AtlasMesh::PointIdentifier  id1 = *pit;
-  ++pit;
-  const AtlasMesh::PointIdentifier  id2 = *pit;
-  ++pit;
-  const AtlasMesh::PointIdentifier  id3 = *pit;
+  // Vertices, positions and alphas come from the flat copy of the mesh rather 
+  // than from the mesh's own containers
+  const int*  tetrahedron = m_MeshArrays->GetTetrahedron( m_MeshArrays->GetTetrahedronIndex( tetrahedronId ) );
+  const int  index0 = tetrahedron[ 0 ];
+  const int  index1 = tetrahedron[ 1 ];
+  const int  index2 = tetrahedron[ 2 ];
+  const int  index3 = tetrahedron[ 3 ];
+  
+  const AtlasMesh::PointType&  p0 = m_MeshArrays->GetPosition( index0 );
+  const AtlasMesh::PointType&  p1 = m_MeshArrays->GetPosition( index1 );
+  const AtlasMesh::PointType&  p2 = m_MeshArrays->GetPosition( index2 );
+  const AtlasMesh::PointType&  p3 = m_MeshArrays->GetPosition( index3 );
   
-  //AtlasMesh::PointType p0;
-  //AtlasMesh::PointType p1;
-  //AtlasMesh::PointType p2;
-  //AtlasMesh::PointType p3;
-  //mesh->GetPoint( id0, &p0 );
-  //mesh->GetPoint( id1, &p1 );
-  //mesh->GetPoint( id2, &p2 );
-  //mesh->GetPoint( id3, &p3 );
-  // Implements internally mesh->GetPoints()->GetElementIfIndexExists(ptId, point);
-  // More efficient is AtlasMesh::PointType&  p0 = mesh->GetPoints()->ElementAt( id0 );
-  const AtlasMesh::PointType&  p0 = mesh->GetPoints()->ElementAt( id0 );
-  const AtlasMesh::PointType&  p1 = mesh->GetPoints()->ElementAt( id1 );
-  const AtlasMesh::PointType&  p2 = mesh->GetPoints()->ElementAt( id2 );
-  const AtlasMesh::PointType&  p3 = mesh->GetPoints()->ElementAt( id3 );
   
+  // Accumulate into the chunk this thread is working on
+  ChunkCostAndGradient&  chunk = *( m_ThreadSpecificChunks[ threadNumber ] );
+  const std::vector< int >&  chunkIndices = chunk.m_PointIndices;
   
-  double&  priorPlusDataCost = m_ThreadSpecificMinLogLikelihoodTimesPriors[ threadNumber ];
+  double&  priorPlusDataCost = chunk.m_MinLogLikelihoodTimesPrior;
 
-  AtlasPositionGradientType&  gradientInVertex0 = m_ThreadSpecificPositionGradients[ threadNumber ]->ElementAt( id0 );
-  AtlasPositionGradientType&  gradientInVertex1 = m_ThreadSpecificPositionGradients[ threadNumber ]->ElementAt( id1 );
-  AtlasPositionGradientType&  gradientInVertex2 = m_ThreadSpecificPositionGradients[ threadNumber ]->ElementAt( id2 );
-  AtlasPositionGradientType&  gradientInVertex3 = m_ThreadSpecificPositionGradients[ threadNumber ]->ElementAt( id3 );
+  AtlasPositionGradientType&  gradientInVertex0 
+     = chunk.m_Gradients[ std::lower_bound( chunkIndices.begin(), chunkIndices.end(), index0 ) - chunkIndices.begin() ];
+  AtlasPositionGradientType&  gradientInVertex1 
+     = chunk.m_Gradients[ std::lower_bound( chunkIndices.begin(), chunkIndices.end(), index1 ) - chunkIndices.begin() ];
+  AtlasPositionGradientType&  gradientInVertex2 
+     = chunk.m_Gradients[ std::lower_bound( chunkIndices.begin(), chunkIndices.end(), index2 ) - chunkIndices.begin() ];
+  AtlasPositionGradientType&  gradientInVertex3 
+     = chunk.m_Gradients[ std::lower_bound( chunkIndices.begin(), chunkIndices.end(), index3 ) - chunkIndices.begin() ];
 
   
 #endif  
@@ -426,10 +448,10 @@ AtlasMeshPositionCostAndGradientCalculator
     m_ThreadSpecificDataTermRasterizationTimers[ threadNumber ].Start();
 #endif
     
-    const AtlasAlphasType&  alphasInVertex0 = mesh->GetPointData()->ElementAt( id0 ).m_Alphas;
-    const AtlasAlphasType&  alphasInVertex1 = mesh->GetPointData()->ElementAt( id1 ).m_Alphas;
-    const AtlasAlphasType&  alphasInVertex2 = mesh->GetPointData()->ElementAt( id2 ).m_Alphas;
-    const AtlasAlphasType&  alphasInVertex3 = mesh->GetPointData()->ElementAt( id3 ).m_Alphas;
+    const AtlasAlphasType&  alphasInVertex0 = m_MeshArrays->GetAlphas( index0 );
+    const AtlasAlphasType&  alphasInVertex1 = m_MeshArrays->GetAlphas( index1 );
+    const AtlasAlphasType&  alphasInVertex2 = m_MeshArrays->GetAlphas( index2 );
+    const AtlasAlphasType&  alphasInVertex3 = m_MeshArrays->GetAlphas( index3 );
   
     this->AddDataContributionOfTetrahedron( p0, p1, p2, p3,
                                             alphasInVertex0, 
@@ -2,6 +2,7 @@
 #define __kvlAtlasMeshPositionCostAndGradientCalculator_h
 
 #include "kvlAtlasMeshRasterizor.h"
+#include "kvlAtlasMeshArrays.h"
 #include "itkAffineTransform.h"
 
 #define KVL_ENABLE_TIME_PROBE 0
@@ -93,6 +94,13 @@ protected:
   bool RasterizeTetrahedron( const AtlasMesh* mesh, 
                              AtlasMesh::CellIdentifier tetrahedronId,
                              int threadNumber );
+
+  //
+  bool RasterizeTetrahedra( const AtlasMesh* mesh,
+                            const AtlasMesh::CellIdentifier* tetrahedronIds,
+                            int numberOfTetrahedra,
+                            int chunkNumber,
+                            int threadNumber );
   
   virtual void AddDataContributionOfTetrahedron( const AtlasMesh::PointType& p0,
                                                  const AtlasMesh::PointType& p1,
@@ -158,8 +166,21 @@ private:
   SlidingBoundaryCorrectionMatrixType  m_SlidingBoundaryCorrectionMatrices[ 8 ]; 
   
   //
-  std::vector< AtlasPositionGradientContainerType::Pointer >  m_ThreadSpecificPositionGradients;
-  std::vector< double >  m_ThreadSpecificMinLogLikelihoodTimesPriors;
+  AtlasMeshArrays::Pointer  m_MeshArrays;
+  std::vector< AtlasPositionGradientType >  m_Gradients;
+  
+  // Cost and gradient of one chunk of tetrahedra, for only the vertices
+  // the chunk touches (sorted, so a vertex is found by binary search).
+  // Chunks are added up in chunk order, so the result does not depend on
+  // the number of threads or on which thread rasterized which chunk
+  struct ChunkCostAndGradient
+    {
+    std::vector< int >  m_PointIndices;
+    std::vector< AtlasPositionGradientType >  m_Gradients;
+    double  m_MinLogLikelihoodTimesPrior;
+    };
+  std::vector< ChunkCostAndGradient >  m_ChunkCostsAndGradients;
+  std::vector< ChunkCostAndGradient* >  m_ThreadSpecificChunks;
 
 #if KVL_ENABLE_TIME_PROBE  
   //
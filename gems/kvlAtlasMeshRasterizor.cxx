@@ -1,6 +1,6 @@
 #include "kvlAtlasMeshRasterizor.h"
 
-static itk::SimpleFastMutexLock rasterizorMutex;
+#include <algorithm>
 
 
 
@@ -15,6 +15,7 @@ AtlasMeshRasterizor
 ::AtlasMeshRasterizor()
 {
   m_NumberOfThreads = itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+  m_ScheduledCellsMTime = 0;
 }
 
 
@@ -28,18 +29,22 @@ AtlasMeshRasterizor
 {
 
   // Fill in the data structure to pass on to the threads
-  ThreadStruct  str;
-  str.m_Rasterizor = this;
-  str.m_Mesh = mesh;
+  std::vector< AtlasMesh::CellIdentifier >  tetrahedronIds;
   for ( AtlasMesh::CellsContainer::ConstIterator  cellIt = mesh->GetCells()->Begin();
         cellIt != mesh->GetCells()->End(); ++cellIt )
     {
     if ( cellIt.Value()->GetType() == AtlasMesh::CellType::TETRAHEDRON_CELL )
       {
-      str.m_TetrahedronIds.push_back( cellIt.Index() );
-      //str.m_TetrahedronIds.insert( cellIt.Index() );
+      tetrahedronIds.push_back( cellIt.Index() );
       }
     }
+  ThreadStruct  str;
+  str.m_Rasterizor = this;
+  str.m_Mesh = mesh;
+  str.m_TetrahedronIds = &tetrahedronIds;
+  str.m_Chunked = false;
+  str.m_NextChunkNumber = 0;
+  str.m_Abort = false;
 
   // Set up the multithreader
   itk::MultiThreader::Pointer  threader = itk::MultiThreader::New();
@@ -49,117 +54,219 @@ AtlasMeshRasterizor
 
   // Let the beast go
   threader->SingleMethodExecute();
-
   
 }
 
 
 
-
 //
 //
 //
-ITK_THREAD_RETURN_TYPE
+int
 AtlasMeshRasterizor
-::ThreaderCallback( void *arg )
+::ScheduleTetrahedra( const AtlasMesh* mesh )
 {
 
-  // Retrieve the input arguments
-  const int  threadNumber = ((itk::MultiThreader::ThreadInfoStruct *)(arg))->ThreadID;
-  const int  numberOfThreads = ((itk::MultiThreader::ThreadInfoStruct *)(arg))->NumberOfThreads;
-  ThreadStruct*  str = (ThreadStruct *)(((itk::MultiThreader::ThreadInfoStruct *)(arg))->UserData);
-
+  // The connectivity doesn't change while the points move, so the order
+  // found for the first positions is kept
+  const AtlasMesh::CellsContainer*  cells = mesh->GetCells();
+  if ( ( cells == m_ScheduledCells.GetPointer() ) && ( cells->GetMTime() == m_ScheduledCellsMTime ) )
+    {
+    return this->GetNumberOfChunks();
+    }
   
-#if 1  
-  // Compute up-front which tetrahedra this thread should be responsible for. This isn't a 
-  // particularly good way of load-balancing, but it does allow us to get the exact same
-  // round-off errors (by adding many floating-point contributions) every single time we
-  // repeat the same computation on the same computer with the same number of threads.
-  const int  numberOfTetrahedra = str->m_TetrahedronIds.size();
-#if 0  
-  const int  numberOfTetrahedraPerThread = 
-          itk::Math::Ceil< int >( static_cast< double >( numberOfTetrahedra ) / numberOfThreads );
-  const int  thisThreadStartNumber =  threadNumber * numberOfTetrahedraPerThread;
-  int  thisThreadEndNumber =  thisThreadStartNumber + numberOfTetrahedraPerThread - 1;
-  if ( thisThreadEndNumber > (numberOfTetrahedra-1) )
+  // Bounding box of the mesh
+  double  minimum[ 3 ];
+  double  maximum[ 3 ];
+  for ( int i = 0; i < 3; i++ )
     {
-    thisThreadEndNumber = (numberOfTetrahedra-1);
+    minimum[ i ] = itk::NumericTraits< double >::max();
+    maximum[ i ] = itk::NumericTraits< double >::NonpositiveMin();
     }
-    
-  // Rasterize all tetrahedra assigned to this thread  
-  for ( int tetrahedronNumber = thisThreadStartNumber; 
-        tetrahedronNumber <= thisThreadEndNumber; 
-        tetrahedronNumber++ )
-#else
-  // Rasterize all tetrahedra assigned to this thread  
-  for ( int tetrahedronNumber = threadNumber; 
-        tetrahedronNumber < numberOfTetrahedra; 
-        tetrahedronNumber += numberOfThreads )
-#endif
+  for ( AtlasMesh::PointsContainer::ConstIterator  pointIt = mesh->GetPoints()->Begin();
+        pointIt != mesh->GetPoints()->End(); ++pointIt )
     {
-    if ( !str->m_Rasterizor->RasterizeTetrahedron( str->m_Mesh, 
-                                                   str->m_TetrahedronIds[ tetrahedronNumber ],
-                                                   threadNumber ) )
+    for ( int i = 0; i < 3; i++ )
       {
-      // Something wrong with this tetrahedron; abort at least this thread
-      break;
-      }  
-      
+      minimum[ i ] = std::min( minimum[ i ], static_cast< double >( pointIt.Value()[ i ] ) );
+      maximum[ i ] = std::max( maximum[ i ], static_cast< double >( pointIt.Value()[ i ] ) );
+      }
     }
-#else
 
-  while ( true )
-    { 
-    rasterizorMutex.Lock();
-
-    // Check if there is anything left to do
-    if ( str->m_TetrahedronIds.size() == 0 )
+  // Quantize the centroid of each tetrahedron to 10 bits per axis, and
+  // interleave the bits into a Morton code
+  std::vector< std::pair< unsigned int, AtlasMesh::CellIdentifier > >  codes;
+  codes.reserve( mesh->GetNumberOfCells() );
+  for ( AtlasMesh::CellsContainer::ConstIterator  cellIt = mesh->GetCells()->Begin();
+        cellIt != mesh->GetCells()->End(); ++cellIt )
+    {
+    if ( cellIt.Value()->GetType() != AtlasMesh::CellType::TETRAHEDRON_CELL )
       {
-      rasterizorMutex.Unlock();
-      return ITK_THREAD_RETURN_VALUE;
+      continue;
       }
-
-    // Let's define how many tetrahedra this thread is going to take on 
-    const int  numberOfTetrahedra = 100;
-
-    // Pop the first numberOfTetrahedra tetrahedra on the list
-    std::vector< AtlasMesh::CellIdentifier >  thisThreadTetrahedronIds;
-    for ( int i = 0; i < numberOfTetrahedra; i++ )
+      
+    double  centroid[ 3 ] = { 0.0, 0.0, 0.0 };
+    for ( AtlasMesh::CellType::PointIdConstIterator  pit = cellIt.Value()->PointIdsBegin();
+          pit != cellIt.Value()->PointIdsEnd(); ++pit )
       {
-      const AtlasMesh::CellIdentifier  tetrahedronId = *( str->m_TetrahedronIds.begin() );
-      str->m_TetrahedronIds.erase( tetrahedronId );
-      thisThreadTetrahedronIds.push_back( tetrahedronId );
-      if ( str->m_TetrahedronIds.size() == 0 )
+      const AtlasMesh::PointType&  p = mesh->GetPoints()->ElementAt( *pit );
+      for ( int i = 0; i < 3; i++ )
         {
-        break;
+        centroid[ i ] += p[ i ] / 4.0;
+        }
+      }
+      
+    unsigned int  code = 0;
+    for ( int i = 0; i < 3; i++ )
+      {
+      const double  extent = maximum[ i ] - minimum[ i ];
+      unsigned int  q = 0;
+      if ( extent > 0 )
+        {
+        q = static_cast< unsigned int >( ( centroid[ i ] - minimum[ i ] ) / extent * 1023.0 + 0.5 );
+        q = std::min( q, 1023u );
+        }
+      for ( int bit = 0; bit < 10; bit++ )
+        {
+        code |= ( ( q >> bit ) & 1u ) << ( 3 * bit + i );
         }
       }
+    codes.push_back( std::make_pair( code, cellIt.Index() ) );
+    }
+  
+  // Ties are broken by cell id, so the schedule is the same every time
+  std::sort( codes.begin(), codes.end() );
+  m_ScheduledTetrahedronIds.resize( codes.size() );
+  for ( size_t i = 0; i < codes.size(); i++ )
+    {
+    m_ScheduledTetrahedronIds[ i ] = codes[ i ].second;
+    }
+  m_ScheduledCells = cells;
+  m_ScheduledCellsMTime = cells->GetMTime();
+  
+  return this->GetNumberOfChunks();
+}
 
-    rasterizorMutex.Unlock();
 
 
+//
+//
+//
+void
+AtlasMeshRasterizor
+::RasterizeScheduledTetrahedra( const AtlasMesh* mesh )
+{
+
+  // Fill in the data structure to pass on to the threads
+  ThreadStruct  str;
+  str.m_Rasterizor = this;
+  str.m_Mesh = mesh;
+  str.m_TetrahedronIds = &m_ScheduledTetrahedronIds;
+  str.m_Chunked = true;
+  str.m_NextChunkNumber = 0;
+  str.m_Abort = false;
+
+  // Set up the multithreader
+  itk::MultiThreader::Pointer  threader = itk::MultiThreader::New();
+  threader->SetNumberOfThreads( this->GetNumberOfThreads() );
+  threader->SetSingleMethod( this->ThreaderCallback, &str );
+
+  // Let the beast go
+  threader->SingleMethodExecute();
+
+}
+
+
+
+//
+//
+//
+bool
+AtlasMeshRasterizor
+::RasterizeTetrahedra( const AtlasMesh* mesh,
+                       const AtlasMesh::CellIdentifier* tetrahedronIds,
+                       int numberOfTetrahedra,
+                       int chunkNumber,
+                       int threadNumber )
+{
+  for ( int tetrahedronNumber = 0; tetrahedronNumber < numberOfTetrahedra; tetrahedronNumber++ )
+    {
+    if ( !this->RasterizeTetrahedron( mesh, tetrahedronIds[ tetrahedronNumber ], threadNumber ) )
+      {
+      return false;
+      }
+    }
     
-    for ( std::vector< AtlasMesh::CellIdentifier >::const_iterator  it = thisThreadTetrahedronIds.begin();
-          it != thisThreadTetrahedronIds.end(); ++it )
+  return true;
+}
+
+
+
+
+//
+//
+//
+ITK_THREAD_RETURN_TYPE
+AtlasMeshRasterizor
+::ThreaderCallback( void *arg )
+{
+
+  // Retrieve the input arguments
+  const int  threadNumber = ((itk::MultiThreader::ThreadInfoStruct *)(arg))->ThreadID;
+  const int  numberOfThreads = ((itk::MultiThreader::ThreadInfoStruct *)(arg))->NumberOfThreads;
+  ThreadStruct*  str = (ThreadStruct *)(((itk::MultiThreader::ThreadInfoStruct *)(arg))->UserData);
+
+  Self*  rasterizor = str->m_Rasterizor;
+  const std::vector< AtlasMesh::CellIdentifier >&  tetrahedronIds = *( str->m_TetrahedronIds );
+  const int  numberOfTetrahedra = tetrahedronIds.size();
+
+  if ( !str->m_Chunked )
+    {
+    // Compute up-front which tetrahedra this thread should be responsible for. This isn't a 
+    // particularly good way of load-balancing, but it does allow us to get the exact same
+    // round-off errors (by adding many floating-point contributions) every single time we
+    // repeat the same computation on the same computer with the same number of threads.
+    for ( int tetrahedronNumber = threadNumber; 
+          tetrahedronNumber < numberOfTetrahedra; 
+          tetrahedronNumber += numberOfThreads )
       {
-      // 
-      if ( !str->m_Rasterizor->RasterizeTetrahedron( str->m_Mesh, *it ) )
+      if ( !rasterizor->RasterizeTetrahedron( str->m_Mesh, tetrahedronIds[ tetrahedronNumber ], threadNumber ) )
         {
-        // Something wrong with this tetrahedron; abort this thread and 
-        // make sure other threads also stop ASAP
-        rasterizorMutex.Lock();
-        str->m_TetrahedronIds.clear();
-        rasterizorMutex.Unlock();
-          
-        return ITK_THREAD_RETURN_VALUE;
-        }
-        
-      }  
-
-    } // End infinite loop   
-      
-#endif
+        // Something wrong with this tetrahedron; abort at least this thread
+        break;
+        }  
+      }
+    
+    return ITK_THREAD_RETURN_VALUE;
+    }
+  
+  // Chunks are runs of tetrahedra that are close together in space. Threads take 
+  // the next free one as they finish
+  const int  numberOfChunks = ( numberOfTetrahedra + TetrahedraPerChunk - 1 ) / TetrahedraPerChunk;
+  while ( !str->m_Abort )
+    {
+    str->m_Mutex.Lock();
+    const int  chunkNumber = str->m_NextChunkNumber++;
+    str->m_Mutex.Unlock();
+    if ( chunkNumber >= numberOfChunks )
+      {
+      break;
+      }
     
+    const int  firstTetrahedronNumber = chunkNumber * TetrahedraPerChunk;
+    const int  numberOfTetrahedraInChunk = std::min( TetrahedraPerChunk, 
+                                                     numberOfTetrahedra - firstTetrahedronNumber );
+    if ( !rasterizor->RasterizeTetrahedra( str->m_Mesh, 
+                                           &( tetrahedronIds[ firstTetrahedronNumber ] ),
+                                           numberOfTetrahedraInChunk,
+                                           chunkNumber,
+                                           threadNumber ) )
+      {
+      // Something wrong with one of the tetrahedra; make sure other threads also stop ASAP
+      str->m_Abort = true;
+      break;
+      }  
+    }
   
   return ITK_THREAD_RETURN_VALUE;
 }
@@ -2,6 +2,8 @@
 #define __kvlAtlasMeshRasterizor_h
 
 #include "kvlAtlasMesh.h"
+#include "itkSimpleFastMutexLock.h"
+#include <atomic>
 
 
 
@@ -48,6 +50,38 @@ protected:
   virtual bool RasterizeTetrahedron( const AtlasMesh* mesh, 
                                      AtlasMesh::CellIdentifier tetrahedronId,
                                      int threadNumber=0 ) = 0;
+
+  /** Rasterize one chunk of spatially consecutive tetrahedra. Subclasses that
+   * accumulate per chunk rather than per thread can set up their buffers here
+   * before calling this implementation */
+  virtual bool RasterizeTetrahedra( const AtlasMesh* mesh,
+                                    const AtlasMesh::CellIdentifier* tetrahedronIds,
+                                    int numberOfTetrahedra,
+                                    int chunkNumber,
+                                    int threadNumber );
+
+  /** Orders the tetrahedra of the mesh along a Z-order (Morton) curve through
+   * their centroids, so that consecutive tetrahedra touch nearby voxels and
+   * share vertices, and cuts them into chunks of TetrahedraPerChunk. The
+   * order is only recomputed when the cells container (or its modification
+   * time) changes, not when the points move. Returns the number of chunks */
+  int ScheduleTetrahedra( const AtlasMesh* mesh );
+
+  /** Rasterize the scheduled chunks, with threads taking the next free chunk
+   * as they finish. Subclasses using this must add up their results per
+   * chunk, in chunk order, for them not to depend on the number of threads.
+   * Rasterize() itself doesn't use the schedule: it deals the tetrahedra to 
+   * the threads one by one in cell order, as it always has */
+  void RasterizeScheduledTetrahedra( const AtlasMesh* mesh );
+
+  /** */
+  int GetNumberOfChunks() const
+    {
+    return ( m_ScheduledTetrahedronIds.size() + TetrahedraPerChunk - 1 ) / TetrahedraPerChunk;
+    }
+
+  // Fixed, so that per-chunk results do not depend on the number of threads
+  static const int  TetrahedraPerChunk = 256;
                                      
   /** Static function used as a "callback" by the MultiThreader.  The threading
    * library will call this routine for each thread, which will delegate the
@@ -59,10 +93,19 @@ protected:
     {
     Pointer  m_Rasterizor;
     AtlasMesh::ConstPointer  m_Mesh;
-    std::vector< AtlasMesh::CellIdentifier >  m_TetrahedronIds;
-    //std::set< AtlasMesh::CellIdentifier >  m_TetrahedronIds;
+    const std::vector< AtlasMesh::CellIdentifier >*  m_TetrahedronIds;
+    bool  m_Chunked;
+    int  m_NextChunkNumber;
+    std::atomic< bool >  m_Abort;
+    itk::SimpleFastMutexLock  m_Mutex;
     };
 
+  // Tetrahedra in rasterization order, and the cells they were ordered from. 
+  // Holding on to the container also keeps its address from being reused
+  std::vector< AtlasMesh::CellIdentifier >  m_ScheduledTetrahedronIds;
+  AtlasMesh::CellsContainer::ConstPointer  m_ScheduledCells;
+  itk::ModifiedTimeType  m_ScheduledCellsMTime;
+
                                      
 
 private:
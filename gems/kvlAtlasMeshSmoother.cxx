@@ -222,6 +222,7 @@ AtlasMeshSmoother
           }
           
         }
+      smoothedParameters->Modified(); // the alphas were changed in place
     
       } // End loop over EM iteration numbers
     
@@ -263,6 +263,7 @@ AtlasParameterEstimator
       pooledIt++;
       pointParamIt++;
       }
+    m_MeshCollection->GetPointParameters()->Modified(); // the alphas were changed in place
 
      
     // Prepare for next iteration
@@ -58,6 +58,7 @@ typedef unsigned short int BOOL;
 #ifdef _DICOMRead_SRC
 char *SDCMStatusFile = 0;
 char *SDCMListFile = 0;
+char *SDCMIndexFile = 0; // persistent index of the files in the dicom dir, see sdcmIndexFiles()
 int  UseDICOMRead2 = 1; // use new dicom reader by default
 /* These variables allow the user to change the first tag checked to
    get the slice thickness.  This is needed with siemens mag res
@@ -68,6 +69,7 @@ int AutoSliceResElTag = 0; // automatically determine which tag to use based on
 #else
 extern char *SDCMStatusFile;
 extern char *SDCMListFile;
+extern char *SDCMIndexFile;
 extern int  UseDICOMRead2;
 extern long SliceResElTag1;
 extern long SliceResElTag2;
@@ -311,6 +313,8 @@ int DumpSDCMFileInfo(FILE *fp, SDCMFILEINFO *sdcmfi);
 int FreeSDCMFileInfo(SDCMFILEINFO **ppsdcmfi);
 SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile);
 SDCMFILEINFO **ScanSiemensDCMDir(const char *PathName, int *NSDCMFiles);
+int sdcmIndexFiles(char **FileList, int nFiles, const char *IndexFile,
+                   int UpdateIndex, SDCMFILEINFO **sdfi_list);
 int CompareSDCMFileInfo(const void *a, const void *b);
 int SortSDCMFileInfo(SDCMFILEINFO **sdcmfi_list, int nlist);
 
@@ -29,3 +29,15 @@ void MRISrigidBodyAlignGlobal_findMinSSE(
     float               max_radians,
     double              ext_sse,
     int                 nangles);
+
+// Same outputs, but the coarse search is a spherical harmonic correlation over all rotations,
+// followed by the grid search over a small window around the best of its peaks
+//
+void MRISrigidBodyAlignGlobal_findMinSSE_SH(
+    double* mina, double* new_minb, double* new_ming, double* new_sse,  // outputs
+    MRI_SURFACE*        mris,
+    INTEGRATION_PARMS*  parms,
+    float               min_radians,
+    float               max_radians,
+    double              ext_sse,
+    int                 nangles);
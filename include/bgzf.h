@@ -0,0 +1,60 @@
+/**
+ * @brief block-compressed gzip (BGZF-style) streams with a frame index
+ *
+ * A blocked file is an ordinary multi-member gzip file: every member holds
+ * at most BGZF_BLOCK_SIZE uncompressed bytes, so gunzip (and gzread) can
+ * still decompress it end to end. Each member carries the standard "BC"
+ * extra subfield with its compressed size. After the data, the writer
+ * appends empty members whose "FI" subfields list the compressed offset
+ * of every block, and a fixed-size "FT" tail member that points at them.
+ * Since all blocks except the last hold exactly block_size bytes, any
+ * uncompressed offset maps directly to a block, which lets readers jump
+ * to a frame and decompress blocks in parallel.
+ */
+/*
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#ifndef BGZF_H
+#define BGZF_H
+
+#include "znzlib.h"
+
+// uncompressed bytes per block (same as bgzip, so that a stored block fits in 64k)
+#define BGZF_BLOCK_SIZE 0xff00
+
+typedef struct
+{
+  int block_size;      // uncompressed bytes in every block but the last
+  long nblocks;        // number of data blocks
+  long long usize;     // total uncompressed size
+  long long *coffset;  // compressed offset of each block, nblocks+1 entries (last = end of data)
+} BGZF_INDEX;
+
+typedef struct BGZF_WRITER BGZF_WRITER;
+
+/* reading */
+BGZF_INDEX *BGZFreadIndex(const char *fname);
+void BGZFfreeIndex(BGZF_INDEX **pidx);
+int BGZFreadRange(const char *fname, const BGZF_INDEX *idx, long long uoffset, long long nbytes, void *buf);
+znzFile BGZFopenAt(const char *fname, const BGZF_INDEX *idx, long long uoffset);
+
+/* writing */
+BGZF_WRITER *BGZFwriterOpen(const char *fname, int level);
+int BGZFwrite(BGZF_WRITER *bw, const void *buf, size_t nbytes);
+int BGZFwriterClose(BGZF_WRITER **pbw);
+
+/* an uncompressed znzFile that writes into a malloc'ed buffer; the buffer
+   and its length are valid once the file has been closed with znzclose() */
+znzFile znzmemopen(char **pbuf, size_t *plen);
+
+#endif
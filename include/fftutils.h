@@ -35,4 +35,26 @@ void FFTmodarg_to_reim(float *** re_mod, float *** im_arg, int l);
 float ***FFTinv_quarter(float *** vect, int dimension);
 void FFTreim_to_modarg (float *** re_mod, float *** im_arg, int l);
 
+/*-----------------------------------------------------
+  Mixed-radix FFT of any length (fastest when the length
+  only has the factors 2, 3 and 5, see FFTgoodSize()).
+  Plans are built on first use and cached for the life
+  of the process, so they can be looked up freely,
+  including from several threads.
+  -----------------------------------------------------*/
+struct FFT_PLAN1D;
+
+typedef struct
+{
+  int nx, ny, nz;   // size of the real volume, x fastest
+  int nxc;          // complex values along x in the spectrum (nx/2+1)
+  const struct FFT_PLAN1D *px, *py, *pz;
+}
+FFT3D_PLAN;
+
+int FFTgoodSize(int n, int even);
+const FFT3D_PLAN *FFT3Dplan(int nx, int ny, int nz);
+void FFT3Dforward(const FFT3D_PLAN *plan, const float *vol, float *spec);
+void FFT3Dbackward(const FFT3D_PLAN *plan, float *spec, float *vol);
+
 #endif
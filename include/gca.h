@@ -222,6 +222,7 @@ typedef struct
   int          total_training ;
   int          max_label ;
   COLOR_TABLE  *ct ;
+  void         *mapped ;   // non-NULL if the label/class tables point into a read-only mapped .gcx file
 }
 GAUSSIAN_CLASSIFIER_ARRAY, GCA ;
 
@@ -277,6 +278,10 @@ int  GCAtrain(GCA *gca, MRI *mri_inputs, MRI *mri_labels, TRANSFORM *transform,
 int  GCAtrainCovariances(GCA *gca, MRI *mri_inputs, MRI *mri_labels, TRANSFORM *transform) ;
 int  GCAwrite(GCA *gca,const char *fname) ;
 GCA  *GCAread(const char *fname) ;
+int  GCAwriteMapped(GCA *gca, const char *fname) ;
+GCA  *GCAreadMapped(const char *fname) ;
+int  GCAisMapped(const char *fname) ;
+int  GCAunmap(GCA *gca) ;
 int  GCAcompleteMeanTraining(GCA *gca) ;
 int  GCAcompleteCovarianceTraining(GCA *gca) ;
 MRI  *GCAlabel(MRI *mri_src, GCA *gca, MRI *mri_dst, TRANSFORM *transform) ;
@@ -302,6 +307,11 @@ float GCAcomputeNumberOfGoodFittingSamples(GCA *gca, GCA_SAMPLE *gcas,
 float  GCAcomputeLogSampleProbability(GCA *gca, GCA_SAMPLE *gcas,
                                       MRI *mri_inputs,
                                       TRANSFORM *transform,int nsamples, double clamp);
+double GCAcomputeLinearLogSampleProbabilitySum(GCA *gca, GCA_SAMPLE *gcas,
+                                               MRI *mri_inputs, MATRIX *m_L,
+                                               int first, int stride, int nsamples,
+                                               double clamp);
+double GCAsampleMaxLogProbability(GCA *gca, GCA_SAMPLE *gcas, double clamp);
 float  GCAcomputeLabelIntensityVariance(GCA *gca, GCA_SAMPLE *gcas,
 					MRI *mri_inputs,
 					TRANSFORM *transform,int nsamples);
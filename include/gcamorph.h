@@ -134,17 +134,20 @@ typedef struct
 }
 GCA_MORPH_NODE, GMN ;
 
+struct GCAM_SOA ;     // flat copies of the hot node fields, see gcamorph.cpp
+
 typedef struct
 {
   int  width, height ,depth ;
   GCA  *gca ;          // using a separate GCA data (not saved)
-  GMN  ***nodes ;
+  GMN  ***nodes ;      // one block of width*height*depth nodes, see GCAMalloc
   int  neg ;
   double exp_k ;
   int  spacing ;
   MRI  *mri_xind ;    /* MRI ->gcam transform */
   MRI  *mri_yind ;
   MRI  *mri_zind ;
+  unsigned int inverse_hash ; // hash of the node positions mri_[xyz]ind were computed from
   VOL_GEOM   image;             /* image that the transforms maps to  */
   VOL_GEOM   atlas ;            /* atlas for the transform       */
   int        ninputs ;
@@ -153,6 +156,7 @@ typedef struct
   MATRIX   *m_affine ;         // affine transform to initialize with
   double   det ;               // determinant of affine transform
   void    *vgcam_ms ; // Not saved.
+  struct GCAM_SOA *soa ; // Not saved.
 }
 GCA_MORPH, GCAM ;
 
@@ -378,6 +382,7 @@ MRI       *GCAMbuildMostLikelyVolume(GCA_MORPH *gcam, MRI *mri) ;
 MRI       *GCAMbuildLabelVolume(GCA_MORPH *gcam, MRI *mri) ;
 MRI       *GCAMbuildVolume(GCA_MORPH *gcam, MRI *mri) ;
 int       GCAMinvert(GCA_MORPH *gcam, MRI *mri) ;
+int       GCAMinvertFixedPoint(GCA_MORPH *gcam, MRI *mri, int max_iter, double tol, double *prms) ;
 GCA_MORPH* GCAMfillInverse(GCA_MORPH* gcam);
 int       GCAMfreeInverse(GCA_MORPH *gcam) ;
 int       GCAMcomputeMaxPriorLabels(GCA_MORPH *gcam) ;
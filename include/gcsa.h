@@ -28,6 +28,7 @@
 #include "colortab.h"
 
 #define GCSA_MAGIC 0xababcdcd
+#define GCSA_VMAP_MAGIC 0xababcdce
 
 
 #define GCSA_INPUT_CURVATURE         0
@@ -102,6 +103,9 @@ typedef struct
   GCSA_INPUT       inputs[GCSA_MAX_INPUTS] ;
   char             *ptable_fname ;   /* name of color lookup table */
   COLOR_TABLE      *ct ;
+  MRI_SURFACE      *vmap_mris ;      /* surface the vertex maps were built for */
+  int              *vmap_priors ;    /* its vertex -> prior vertex */
+  int              *vmap_classifiers ; /* its vertex -> classifier vertex */
 }
 GAUSSIAN_CLASSIFIER_SURFACE_ARRAY, GCSA ;
 
@@ -125,6 +129,12 @@ VERTEX *GCSAsourceToPriorVertex     (GCSA *gcsa, VERTEX const *v);
 int     GCSAsourceToPriorVertexNo   (GCSA *gcsa, VERTEX const *v);
 VERTEX *GCSAsourceToClassifierVertex(GCSA *gcsa, VERTEX const *v);
 
+/* cached source-to-atlas vertex maps, see GCSAcomputeVertexMap */
+int   GCSAcomputeVertexMap(GCSA *gcsa, MRI_SURFACE *mris) ;
+int   GCSAreadVertexMap(GCSA *gcsa, MRI_SURFACE *mris, const char *fname) ;
+int   GCSAwriteVertexMap(GCSA *gcsa, const char *fname) ;
+int   GCSAfreeVertexMap(GCSA *gcsa) ;
+
 int dump_gcsan(GCSA_NODE *gcsan, CP_NODE *cpn, FILE *fp, int verbose) ;
 int GCSAbuildMostLikelyLabels(GCSA *gcsa, MRI_SURFACE *mris) ;
 int GCSArelabelWithAseg(GCSA *gcsa, MRI_SURFACE *mris, MRI *mri_aseg) ;
@@ -30,6 +30,23 @@
 #undef X
 #endif
 
+/*!
+  \brief Sparse GTM design matrix in compressed sparse column (CSC)
+  form. A column (seg) only has entries inside the padded bounding box
+  of the seg, so storage is proportional to the sum of the bounding box
+  sizes instead of nmask*nsegs. Row indices are 0-based mask voxels in
+  the order used by GTMvol2mat() and are sorted within each column.
+*/
+typedef struct
+{
+  int rows, cols;
+  long nnz;
+  long *colptr;          // cols+1, start of each column in rowind and val
+  int *rowind;           // 0-based row of each entry
+  float *val;            // value of each entry
+  int *rowmin, *rowmax;  // range of rows in each column (rowmin > rowmax if empty)
+} GTMSPX;
+
 typedef struct
 {
   char *subject;
@@ -116,6 +133,8 @@ typedef struct
 
   // GLM stuff for GTM
   MATRIX *X,*X0;
+  int UseSparseX; // build Xs and X0s instead of X and X0 (default)
+  GTMSPX *Xs,*X0s;
   MATRIX *y, *XtX, *iXtX, *Xty, *beta, *res, *yhat,*betavar;
   MATRIX *rvar,*rvargm,*rvarbrain,*rvarUnscaled; // residual variance, all vox and only GM
   MATRIX *som; // spillover matrix
@@ -192,6 +211,18 @@ int GTMpsfStd(GTM *gtm);
 int GTMsegidlist(GTM *gtm);
 int GTMnPad(GTM *gtm);
 int GTMbuildX(GTM *gtm);
+GTMSPX *GTMSPXalloc(int rows, int cols, long nnz);
+int GTMSPXfree(GTMSPX **pX);
+MATRIX *GTMSPXtoMatrix(GTMSPX *X, MATRIX *M);
+MATRIX *GTMSPXmultiply(GTMSPX *X, MATRIX *B, MATRIX *out);
+MATRIX *GTMSPXtB(GTMSPX *X, MATRIX *B, MATRIX *out);
+MATRIX *GTMSPXtSPX(GTMSPX *A, GTMSPX *B, MATRIX *out);
+int GTMhaveX(GTM *gtm, int UseX0);
+int GTMfreeX(GTM *gtm, int UseX0);
+MATRIX *GTMxMultiply(GTM *gtm, int UseX0, MATRIX *B, MATRIX *out);
+MATRIX *GTMxtx(GTM *gtm, int UseX0a, int UseX0b, MATRIX *out);
+MATRIX *GTMxDense(GTM *gtm, int UseX0);
+int *GTMrowNthSeg(GTM *gtm);
 int GTMsolve(GTM *gtm);
 int GTMsegrvar(GTM *gtm);
 int GTMsynth(GTM *gtm, int NoiseSeed, int nReps);
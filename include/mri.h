@@ -1339,6 +1339,7 @@ float MRIvolumeDeterminant(MRI *mri);
 
 int mriio_command_line(int argc, char *argv[]);
 void mriio_set_gdf_crop_flag(int new_gdf_crop_flag);
+void mriio_set_mgz_blocked(int new_mgz_blocked_flag);
 int MRIgetVolumeName(const char *string, char *name_only);
 MRI *MRIread(const char *fname);
 MRI *MRIreadEx(const char *fname, int nthframe);
@@ -1349,6 +1350,12 @@ int GetSPMStartFrame(void);
 int MRIwrite(MRI *mri,const  char *fname);
 int MRIwriteFrame(MRI *mri,const  char *fname, int frame) ;
 int MRIwriteType(MRI *mri,const  char *fname, int type);
+
+// writes an mgh/mgz one frame at a time (see mriio.cpp)
+typedef struct MRI_FRAME_WRITER MRI_FRAME_WRITER;
+MRI_FRAME_WRITER *MRIframeWriterOpen(const MRI *tmpl, const char *fname, int nframes);
+int MRIframeWriterAppend(MRI_FRAME_WRITER *fw, MRI *mri, int frame);
+int MRIframeWriterClose(MRI_FRAME_WRITER **pfw);
 MRI *MRIreadRaw(FILE *fp, int width, int height, int depth, int type);
 int MRIreorderVox2RAS(MRI *mri_src, MRI *mri_dst, int xdim, int ydim, int zdim);
 MRI *MRIreorder(MRI *mri_src, MRI *mri_dst, int xdim, int ydim, int zdim);
@@ -1499,6 +1506,10 @@ MRI *MRIconformSliceOrder(MRI *mri);
     Please use MRIextractDistanceMap in fastmarching.h instead */
 MRI *MRIdistanceTransform(MRI *mri_src, MRI *mri_dist,
                           int label, float max_dist, int mode, MRI *mri_mask);
+/** Exact euclidean distance (in mm, see mriedt.cpp). Unlike fast marching,
+    mri_mask only limits the output and is not a barrier to the distance */
+MRI *MRIexactDistanceTransform(MRI *mri_src, MRI *mri_dist, int label, float max_dist,
+                               int mode, MRI *mri_mask, MRI **pmri_nearest);
 int MRIaddCommandLine(MRI *mri, const std::string& cmdline);
 MRI *MRInonMaxSuppress(MRI *mri_src, MRI *mri_sup,
                        float thresh, int thresh_dir) ;
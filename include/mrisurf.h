@@ -1585,6 +1585,15 @@ MRI *MRISsmoothMRIFastD(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *IncMask,  M
 int MRISsmoothMRIFastCheck(int nSmoothSteps);
 int MRISsmoothMRIFastFrame(MRIS *Surf, MRI *Src, int frame, int nSmoothSteps, MRI *IncMask);
 
+// Linear surface smoothers as sparse operators over the vertices, applied
+// to all the frames of an overlay at once.  MRISsmoothOpGaussian reuses
+// operators saved under $FS_SURF_SMOOTH_CACHE if that is set.
+typedef struct MRIS_SMOOTH_OP MRIS_SMOOTH_OP;
+MRIS_SMOOTH_OP *MRISsmoothOpNearestNeighbor(MRIS *Surf, MRI *IncMask);
+MRIS_SMOOTH_OP *MRISsmoothOpGaussian(MRIS *Surf, double GStd, double TruncFactor);
+MRI *MRISsmoothOpApply(MRIS_SMOOTH_OP const *op, MRI *Src, int niters, MRI *Targ);
+void MRISsmoothOpFree(MRIS_SMOOTH_OP **pop);
+
 
 int  MRISclearFlags(MRI_SURFACE *mris, int flags) ;
 int  MRISsetCurvature(MRI_SURFACE *mris, float val) ;
@@ -2269,6 +2278,15 @@ void mrisCompleteTopology(MRIS *mris);
     // However lots of existing code just adds a misc set of edges and faces by mechanisms
     // then they call this function to add any missing edges and to calculate the mris->avg_nbrs
 
+void mrisCompleteTopologyUsingCache(MRIS *mris);
+    //
+    // Used by MRISread.  When FS_SURF_TOPO_CACHE is set, the completed topology and the
+    // 2- and 3-ring neighbourhoods are kept in a <surface>.topo sidecar validated by a hash
+    // of the face list, so they need not be rebuilt every time the surface is read.
+    //
+bool mrisNeighborhoodsFromTopologyCache  (MRIS *mris, int nsize);
+void mrisSaveNeighborhoodsToTopologyCache(MRIS const *mris, int nsize);
+
 
 // Vertices and Faces can have their ripflag set
 //
@@ -34,6 +34,9 @@
   float OpenGammaIncomplete(float a, float x);
 
   float OpenRan1( long *seed );
+  void *OpenRan1SaveState( void );
+  void  OpenRan1RestoreState( void const *state );
+  void  OpenRan1FreeState( void **state );
 
   // this is only called from the matrix class
   int OpenSvdcmp( MATRIX *a, VECTOR *w, MATRIX *v );
@@ -86,5 +86,7 @@ int sclustAnnot(MRIS *surf, int NClusters);
 int sclustGrowByDist(MRIS *surf, int seedvtxno, double dthresh, 
 		     int shape, int vtxno, int *vtxlist);
 int sclustSaveAsPointSet(char *fname, SCS *scslist, int NClusters, MRIS *surf);
+MRI *MRIStfce(MRI_SURFACE *Surf, MRI *sig, int frame, MRI *mask,
+               int thsign, double E, double H, MRI *tfce);
 
 #endif
@@ -32,6 +32,7 @@
 #define TAG_GCAMORPH_GEOM           10
 #define TAG_GCAMORPH_TYPE           11
 #define TAG_GCAMORPH_LABELS         12
+#define TAG_GCAMORPH_INVERSE        13
 
 #define TAG_OLD_SURF_GEOM           20
 #define TAG_SURF_GEOM               21
@@ -36,6 +36,11 @@ int    setRandomSeed(long seed) ;
 long getRandomSeed(void);
 long getRandomCalls(void);
 
+typedef struct RANDOM_STATE RANDOM_STATE;
+RANDOM_STATE *getRandomState(void);
+void setRandomState(RANDOM_STATE const *state);
+void freeRandomState(RANDOM_STATE **pstate);
+
 double normAngle(double angle) ;
 float  deltaAngle(float angle1, float angle2) ;
 double calcDeltaPhi(double phi1, double phi2) ;
@@ -104,9 +104,54 @@ VOLCLUSTER **clustGetClusters(MRI *vol, int frame,
                               int threshsign, float minclustsizemm3,
                               MRI *binmask, int *nClusters,
                               MATRIX *XFM);
+VOLCLUSTER **clustGetComponents(MRI *vol, int frame,
+                                float thmin, float thmax, int thsign,
+                                MRI *binmask, int maskframe, int AllowDiag,
+                                int *nhits, int *nClusters);
 int clustMaxClusterCount(VOLCLUSTER **VolClustList, int nClusters);
 int clustDumpSummary(FILE *fp,VOLCLUSTER **VolClustList, int nClusters);
 
+/*----------------------------------------------------------
+  Connected components found with union-find. This is shared by
+  the volume clustering (elements are the voxels of a grid, index
+  col + width*(row + height*slc)) and the surface clustering
+  (elements are vertices with an adjacency list). Clusters are
+  numbered 1..nclusters in the order of their first element.
+  The per-cluster arrays are indexed by clusterno-1.
+  ----------------------------------------------------------*/
+typedef struct
+{
+  int nelements;
+  int *parent;        // union-find forest; the root is the smallest element
+  int *clusterno;     // 1..nclusters, or 0 if the element is not a hit
+  int nclusters;
+  int nalloc;         // allocated length of the per-cluster arrays
+  int *nmembers;
+  double *size;       // sum of element sizes (mm3 or mm2), or count
+  double *weight;     // sum of values
+  double *weightsize; // sum of value*size
+  float *maxval;      // value with the largest magnitude (first one on ties)
+  int *maxelement;    // element where maxval is found
+}
+CLUSTER_COMPONENTS, CCOMP;
+
+CCOMP *CCOMPalloc(int nelements);
+int CCOMPfree(CCOMP **pcc);
+int CCOMPlabelGrid(CCOMP *cc, const unsigned char *hit,
+                   int width, int height, int depth, int AllowDiag);
+int CCOMPlabelGraph(CCOMP *cc, const unsigned char *hit,
+                    const int *nnbrs, const int *const *nbrs);
+int CCOMPsummarize(CCOMP *cc, const float *val, const float *size);
+
+int TFCEgrid(const float *val, const float *size,
+             int width, int height, int depth, int AllowDiag,
+             double E, double H, int thsign, float *tfce);
+int TFCEgraph(const float *val, const float *size, int nelements,
+              const int *nnbrs, const int *const *nbrs,
+              double E, double H, int thsign, float *tfce);
+MRI *MRItfce(MRI *vol, int frame, MRI *mask, int thsign,
+             double E, double H, MRI *tfce);
+
 /*----------------------------------------------------------*/
 typedef struct
 {
@@ -129,6 +174,9 @@ typedef struct
   double *MaxClusterWeightArea;
   double *MaxSig;
   double *MaxStat;
+  double *MaxTFCE;    // kept in a separate file, see CSDtfceFileName()
+  int tfce;           // 1 if the simulation also recorded the max TFCE
+  double tfceE, tfceH;// TFCE extent and height exponents
   int mergedflag;     // Flag to indicate that two or more merged
   HISTOGRAM *mcs_pdf, *mcs_cdf; // max cluster size
   HISTOGRAM *ms_pdf, *ms_cdf;   // max sig
@@ -147,8 +195,13 @@ CSD *CSDreadMerge(char *csdfile, CSD *csd);
 int CSDprintHeader(FILE *fp, CLUSTER_SIM_DATA *csd);
 int CSDprint(FILE *fp, CSD *csd);
 int CSDprintWeight(FILE *fp, CLUSTER_SIM_DATA *csd);
+int CSDtfceFileName(const char *csdfile, char *fname);
+int CSDwriteTFCE(const char *fname, CSD *csd);
+int CSDreadTFCE(const char *fname, CSD *csd);
 double CSDpvalMaxSig(double val, CSD *csd);
 MRI *CSDpvalMaxSigMap(MRI *sig, CSD *csd, MRI *mask, MRI *vwsig, double *maxmaxsig, int Bonf);
+double CSDpvalMaxTFCE(double val, CSD *csd);
+MRI *CSDpvalMaxTFCEMap(MRI *tfce, CSD *csd, MRI *mask, MRI *vwsig, double *maxmaxsig, int Bonf);
 double CSDpvalClustSize(CLUSTER_SIM_DATA *csd, double ClusterSize,
                         double ciPct, double *pvalLow, double *pvalHi);
 
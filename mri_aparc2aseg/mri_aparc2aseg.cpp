@@ -510,6 +510,7 @@ int main(int argc, char **argv)
       int        x, y, z, n ;
       GCA_PRIOR *gcap ;
 
+      GCAunmap(gca) ;
       for (x = 0 ; x < mri_norm->width ; x++)
 	for (y = 0 ; y < mri_norm->height ; y++)
 	  for (z = 0 ; z < mri_norm->depth ; z++)
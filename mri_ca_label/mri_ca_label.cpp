@@ -228,6 +228,7 @@ MRI *insert_wm_segmentation( MRI *mri_labeled, MRI *mri_wm,
 int MRItoUCHAR(MRI **pmri);
 extern char *gca_write_fname ;
 extern int gca_write_iterations ;
+extern int gca_gibbs_checkerboard ;
 
 //static int expand_flag = TRUE ;
 static int expand_flag = FALSE ;
@@ -1472,6 +1473,11 @@ get_option(int argc, char *argv[])
     #endif
     nargs = 1 ;
   }
+  else if (!stricmp(option, "GIBBS_CHECKERBOARD"))
+  {
+    gca_gibbs_checkerboard = 1 ;
+    printf("relabeling with parallel red-black gibbs sweeps\n") ;
+  }
   else if (!stricmp(option, "PREGIBBS"))
   {
     PreGibbsFile = argv[2];
@@ -4334,6 +4340,7 @@ GCAremoveWMSA( GCA *gca )
   GCA_NODE   *gcan ;
   double     ptotal ;
 
+  GCAunmap(gca) ;
   for (x = 0 ; x < gca->prior_width ; x++)
   {
     for (y = 0 ; y < gca->prior_height ; y++)
@@ -10,3 +10,25 @@ test_command mri_ca_label -relabel_unlikely 9 .3 -prior 0.5 -align norm.mgz tala
     ${FREESURFER_HOME}/average/RB_all_2016-05-10.vc700.gca aseg.auto_noCCseg.out.mgz
 
 compare_vol aseg.auto_noCCseg.out.mgz aseg.auto_noCCseg.mgz
+
+# the same labeling from a memory-mapped copy of the atlas
+mri_gca_convert=$(find_path $FSTEST_CWD mri_gca_convert/mri_gca_convert)
+test_command $mri_gca_convert ${FREESURFER_HOME}/average/RB_all_2016-05-10.vc700.gca RB_all.gcx
+test_command mri_ca_label -relabel_unlikely 9 .3 -prior 0.5 -align norm.mgz talairach.m3z \
+    RB_all.gcx aseg.auto_noCCseg.gcx.mgz
+
+compare_vol aseg.auto_noCCseg.gcx.mgz aseg.auto_noCCseg.mgz
+
+# parallel red-black gibbs sweeps: the labeling must not depend on the thread count, and it
+# should stay close to the sequential sweep
+test_command OMP_NUM_THREADS=1 mri_ca_label -gibbs_checkerboard -relabel_unlikely 9 .3 -prior 0.5 -align \
+    norm.mgz talairach.m3z ${FREESURFER_HOME}/average/RB_all_2016-05-10.vc700.gca aseg.checkerboard.thr1.mgz
+FSTEST_NO_DATA_RESET=1 test_command mri_ca_label -gibbs_checkerboard -relabel_unlikely 9 .3 -prior 0.5 -align \
+    norm.mgz talairach.m3z ${FREESURFER_HOME}/average/RB_all_2016-05-10.vc700.gca aseg.checkerboard.mgz
+
+compare_vol aseg.checkerboard.mgz aseg.checkerboard.thr1.mgz
+
+mri_compute_seg_overlap=$(find_path $FSTEST_CWD mri_compute_seg_overlap/mri_compute_seg_overlap)
+FSTEST_NO_DATA_RESET=1 test_command $mri_compute_seg_overlap -olog checkerboard.dice \
+    aseg.checkerboard.mgz aseg.auto_noCCseg.mgz
+awk '{ if ($1 < 0.98) { print "checkerboard vs sequential dice " $1 " is below 0.98"; exit 1 } }' checkerboard.dice
@@ -45,6 +45,7 @@
 #include "version.h"
 #include "mri_identify.h"
 #include "cmdargs.h"
+#include "romp_support.h"
 
 static int  parse_commandline(int argc, char **argv);
 static void check_options(void);
@@ -54,6 +55,7 @@ static void print_help(void) ;
 static void print_version(void) ;
 static void argnerr(char *option, int n);
 static void dump_options(FILE *fp);
+static int  StreamConcat(int nframestot, int nc, int nr, int ns, int datatype);
 //static int  singledash(char *flag);
 
 int main(int argc, char *argv[]) ;
@@ -128,6 +130,10 @@ int DoCumSum = 0;
 int DoFNorm = 0;
 char *rusage_file=NULL;
 
+int DoStream = 0; // reduce/write frame by frame instead of building the 4D volume
+double StreamMemMB = 1024; // memory budget for --stream
+double StreamInputBytes = 0; // bytes per voxel of the largest input, for --stream
+
 /*--------------------------------------------------*/
 int main(int argc, char **argv)
 {
@@ -205,6 +211,7 @@ int main(int argc, char **argv)
 
       nframestot += mritmp->nframes;
       inputDatatype = mritmp->type; // used by DoKeepDatatype option
+      StreamInputBytes = MAX(StreamInputBytes, (double)mritmp->nframes*MRIsizeof(mritmp->type));
       MRIfree(&mritmp);
     }
   }
@@ -221,6 +228,7 @@ int main(int argc, char **argv)
     nc = mritmp->width;
     nr = mritmp->height;
     ns = mritmp->depth;
+    StreamInputBytes = (double)mritmp->nframes*MRIsizeof(mritmp->type);
     MRIfree(&mritmp);
   }
 
@@ -275,13 +283,23 @@ int main(int argc, char **argv)
     }
   }
 
-  printf("Allocing output\n");
-  fflush(stdout);
   int datatype=MRI_FLOAT;
   if (DoKeepDatatype)
   {
     datatype = inputDatatype;
   }
+
+  if(DoStream)
+  {
+    err = StreamConcat(nframestot, nc, nr, ns, datatype);
+    if(err) exit(err);
+    if(debug) PrintRUsage(RUSAGE_SELF, "mri_concat ", stdout);
+    if(rusage_file) WriteRUsage(RUSAGE_SELF, "", rusage_file);
+    return(0);
+  }
+
+  printf("Allocing output\n");
+  fflush(stdout);
   if (DoRMS)
   {
     // RMS always has single frame output
@@ -748,6 +766,280 @@ int main(int argc, char **argv)
 /*-----------------------------------------------------------------*/
 /*-----------------------------------------------------------------*/
 
+/*-----------------------------------------------------------------
+  StreamConcat() - implements --stream. Inputs are read a batch at a
+  time (one file after another, since MRIread() is not thread-safe
+  for every format), and then each frame is
+  either folded into per-voxel accumulators (Welford mean and sum of
+  squared deviations, running max/min and the frame of the max) or
+  written directly to the output file. The concatenated volume is
+  never held in memory. The batch size is chosen so that the batch
+  plus the accumulators fit in --stream-mem. The frame order, and so
+  the result, does not depend on the batch size or number of threads.
+  -----------------------------------------------------------------*/
+static int StreamConcat(int nframestot, int nc, int nr, int ns, int datatype)
+{
+  int nthin, n0, nbatch, k, f, c, r, s, nthreads=1;
+  int nframesout, nframesin, nraw, DoReduce;
+  long nvox, vox;
+  double bytesfixed, bytesin, v;
+  MRI **batch, *hdr=NULL, *outbuf=NULL, *mrired;
+  MRI_FRAME_WRITER *fw=NULL;
+  double *mean=NULL, *m2=NULL, *ext=NULL, *pairfirst=NULL;
+  int *index=NULL;
+  unsigned char *nonzero=NULL, *allnonzero=NULL;
+
+  #ifdef HAVE_OPENMP
+  nthreads = omp_get_max_threads();
+  #endif
+
+  DoReduce = DoMean + DoMeanDivN + DoSum + DoStd + DoVar + DoMax + DoMaxIndex + DoMin;
+  nframesout = nframestot;
+  if(DoPaired) nframesout = nframestot/2;
+  if(DoBonfCor)
+  {
+    DoAdd = 1;
+    AddVal = -log10(nframesout);
+  }
+  if((DoStd || DoVar) && nframesout < 2)
+  {
+    printf("ERROR: cannot compute std from one frame\n");
+    return(1);
+  }
+  if(!DoReduce && !(mri_identify(out) == MRI_MGH_FILE))
+  {
+    printf("ERROR: --stream without a reduction needs an mgh or mgz output\n");
+    return(1);
+  }
+
+  nvox = (long)nc*nr*ns;
+  if(DoReduce) mean = (double *) calloc(nvox,sizeof(double));
+  if(DoStd || DoVar) m2 = (double *) calloc(nvox,sizeof(double));
+  if(DoMax || DoMin || DoMaxIndex) ext = (double *) calloc(nvox,sizeof(double));
+  if(DoMaxIndex) index = (int *) calloc(nvox,sizeof(int));
+  if(DoMaxIndexPrune) nonzero = (unsigned char *) calloc(nvox,sizeof(unsigned char));
+  if(DoPrune)
+  {
+    allnonzero = (unsigned char *) calloc(nvox,sizeof(unsigned char));
+    memset(allnonzero,1,nvox);
+  }
+  if(DoPaired) pairfirst = (double *) calloc(nvox,sizeof(double));
+
+  // Memory for everything but the batch of inputs
+  bytesfixed = (double)nvox*sizeof(double)*((mean!=NULL) + (m2!=NULL) + (ext!=NULL) + (pairfirst!=NULL));
+  bytesfixed += (double)nvox*(sizeof(int)*(index!=NULL) + (nonzero!=NULL) + (allnonzero!=NULL));
+  bytesfixed += (double)nvox*MRIsizeof(DoReduce ? MRI_FLOAT : datatype);
+  // Each input is assumed to be as large as the largest one checked
+  // (only the first without --no-check).
+  bytesin = (double)nvox*StreamInputBytes;
+  if(bytesin <= 0) bytesin = (double)nvox*sizeof(float);
+  nbatch = (int)floor((StreamMemMB*1024*1024 - bytesfixed)/bytesin);
+  if(nbatch < 1)
+  {
+    printf("WARNING: --stream-mem %g MB is too small to hold one input, reading one at a time\n",
+           StreamMemMB);
+    nbatch = 1;
+  }
+  if(nbatch > ninputs) nbatch = ninputs;
+  printf("Streaming %d inputs, %d at a time, reducing with %d threads (%g MB budget)\n",
+         ninputs,nbatch,nthreads,StreamMemMB);
+  fflush(stdout);
+  batch = (MRI **) calloc(nbatch,sizeof(MRI *));
+
+  nraw = 0;          // input frames seen so far
+  nframesin = 0;     // frames (after pairing) reduced or written so far
+  for(n0 = 0; n0 < ninputs; n0 += nbatch)
+  {
+    int nthisbatch = MIN(nbatch, ninputs-n0);
+    if(Gdiag_no > 0 || debug)
+    {
+      printf("Loading inputs %d to %d\n",n0+1,n0+nthisbatch);
+      fflush(stdout);
+    }
+    for(k = 0; k < nthisbatch; k++) batch[k] = MRIread(inlist[n0+k]);
+
+    for(k = 0; k < nthisbatch; k++)
+    {
+      nthin = n0+k;
+      if(batch[k] == NULL)
+      {
+        printf("ERROR: loading %s\n",inlist[nthin]);
+        return(1);
+      }
+      if(batch[k]->width != nc || batch[k]->height != nr || batch[k]->depth != ns)
+      {
+        printf("ERROR: dimension mismatch between %s and %s\n",inlist[0],inlist[nthin]);
+        return(1);
+      }
+      if(nthin == 0)
+      {
+        // Output header comes from the first input
+        hdr = MRIallocHeader(nc,nr,ns,DoReduce ? MRI_FLOAT : datatype,1);
+        MRIcopyHeader(batch[k],hdr);
+        if(!DoReduce)
+        {
+          outbuf = MRIallocSequence(nc,nr,ns,datatype,1);
+          if(outbuf == NULL) return(1);
+          MRIcopyHeader(batch[k],outbuf);
+          fw = MRIframeWriterOpen(hdr, out, nframesout);
+          if(fw == NULL) return(1);
+        }
+      }
+    }
+
+    // Frames in input order; voxels in parallel
+    for(k = 0; k < nthisbatch; k++)
+    {
+      for(f = 0; f < batch[k]->nframes; f++)
+      {
+        int second = (nraw%2 == 1); // second frame of a --paired-xxx pair
+        long n = nframesin+1; // frames reduced, including this one
+        ROMP_PF_begin
+        #ifdef HAVE_OPENMP
+        #pragma omp parallel for if_ROMP(assume_reproducible) private(r,c,vox,v)
+        #endif
+        for(s = 0; s < ns; s++)
+        {
+          ROMP_PFLB_begin
+          double v1, v2, vavg, delta;
+          for(r = 0; r < nr; r++)
+          {
+            for(c = 0; c < nc; c++)
+            {
+              vox = c + (long)nc*(r + (long)nr*s);
+              v = MRIgetVoxVal(batch[k],c,r,s,f);
+              if(DoAbs) v = fabs(v);
+              if(DoPos && v < 0) v = 0;
+              if(DoNeg && v > 0) v = 0;
+              if(allnonzero && fabs(v) <= FLT_MIN) allnonzero[vox] = 0;
+              if(DoPaired)
+              {
+                if(!second)
+                {
+                  pairfirst[vox] = v;
+                  continue;
+                }
+                v1 = pairfirst[vox];
+                v2 = v;
+                v = 0;
+                if(DoPairedAvg) v = (v1+v2)/2.0;
+                if(DoPairedSum) v = (v1+v2);
+                if(DoPairedDiff) v = v1-v2;
+                if(DoPairedDiffNorm)
+                {
+                  vavg = (v1+v2)/2.0;
+                  if(vavg != 0.0) v = v/vavg;
+                  else            v = 0;
+                }
+                if(DoPairedDiffNorm1)
+                {
+                  if(v1 != 0.0) v = v/v1;
+                  else          v = 0;
+                }
+                if(DoPairedDiffNorm2)
+                {
+                  if(v2 != 0.0) v = v/v2;
+                  else          v = 0;
+                }
+              }
+              if(!DoReduce)
+              {
+                if(DoMultiply) v *= MultiplyVal;
+                if(DoAdd) v += AddVal;
+                MRIsetVoxVal(outbuf,c,r,s,0,v);
+                continue;
+              }
+              // Welford's running mean and sum of squared deviations
+              delta = v - mean[vox];
+              mean[vox] += delta/n;
+              if(m2) m2[vox] += delta*(v - mean[vox]);
+              if(DoMax || DoMaxIndex)
+              {
+                if(n == 1 || ext[vox] < v)
+                {
+                  ext[vox] = v;
+                  if(index) index[vox] = n-1;
+                }
+              }
+              if(DoMin && (n == 1 || ext[vox] > v)) ext[vox] = v;
+              if(nonzero && fabs(v) > 0) nonzero[vox] = 1;
+            }
+          }
+          ROMP_PFLB_end
+        }
+        ROMP_PF_end
+        nraw++;
+        if(DoPaired && !second) continue;
+        nframesin++;
+        if(fw && MRIframeWriterAppend(fw, outbuf, 0) != NO_ERROR) return(1);
+      }
+      MRIfree(&batch[k]);
+    }
+  }
+  free(batch);
+
+  if(nraw != nframestot)
+  {
+    printf("ERROR: expected %d frames, found %d\n",nframestot,nraw);
+    return(1);
+  }
+
+  if(fw)
+  {
+    printf("Finished writing %s\n",out);
+    MRIfree(&outbuf);
+    MRIfree(&hdr);
+    return(MRIframeWriterClose(&fw));
+  }
+
+  if(DoMaxIndex) mrired = MRIallocSequence(nc,nr,ns,MRI_INT,1);
+  else if(DoMax || DoMin) mrired = MRIallocSequence(nc,nr,ns,datatype,1);
+  else mrired = MRIallocSequence(nc,nr,ns,MRI_FLOAT,1);
+  if(mrired == NULL) return(1);
+  MRIcopyHeader(hdr,mrired);
+  MRIfree(&hdr);
+
+  printf("Computing output from %d frames\n",nframesin);
+  for(s = 0; s < ns; s++)
+  {
+    for(r = 0; r < nr; r++)
+    {
+      for(c = 0; c < nc; c++)
+      {
+        vox = c + (long)nc*(r + (long)nr*s);
+        v = mean[vox];
+        if(DoSum) v = mean[vox]*nframesin;
+        if(DoMeanDivN) v = mean[vox]/nframesin;
+        if(DoVar) v = m2[vox]/(nframesin-1);
+        if(DoStd) v = sqrt(m2[vox]/(nframesin-1));
+        if(DoMax || DoMin) v = ext[vox];
+        if(DoMaxIndex)
+        {
+          v = index[vox] + 1;
+          if(nonzero && !nonzero[vox]) v = 0;
+          if(DoMaxIndexAdd && v != 0) v += MaxIndexAdd;
+        }
+        if(DoMultiply) v *= MultiplyVal;
+        if(DoAdd) v += AddVal;
+        if(allnonzero && !allnonzero[vox]) v = 0;
+        MRIsetVoxVal(mrired,c,r,s,0,v);
+      }
+    }
+  }
+  free(mean);
+  if(m2) free(m2);
+  if(ext) free(ext);
+  if(index) free(index);
+  if(nonzero) free(nonzero);
+  if(allnonzero) free(allnonzero);
+  if(pairfirst) free(pairfirst);
+
+  printf("Writing to %s\n",out);
+  int err = MRIwrite(mrired,out);
+  MRIfree(&mrired);
+  return(err);
+}
+
 /* --------------------------------------------- */
 static int parse_commandline(int argc, char **argv)
 {
@@ -950,6 +1242,24 @@ static int parse_commandline(int argc, char **argv)
     {
       DoPCA = 1;
     }
+    else if (!strcasecmp(option, "--stream")) DoStream = 1;
+    else if (!strcasecmp(option, "--stream-mem"))
+    {
+      if (nargc < 1) argnerr(option,1);
+      sscanf(pargv[0],"%lf",&StreamMemMB);
+      DoStream = 1;
+      nargsused = 1;
+    }
+    else if (!strcasecmp(option, "--threads"))
+    {
+      if (nargc < 1) argnerr(option,1);
+      int nthreads;
+      sscanf(pargv[0],"%d",&nthreads);
+      #ifdef HAVE_OPENMP
+      omp_set_num_threads(nthreads);
+      #endif
+      nargsused = 1;
+    }
     else if (!strcasecmp(option, "--chunk")) setenv("FS_USE_MRI_CHUNK","1",1);
     else if (!strcasecmp(option, "--no-chunk") ) unsetenv("FS_USE_MRI_CHUNK");
       
@@ -1177,6 +1487,13 @@ static void print_usage(void)
   printf("   --rms : root mean square (eg. combine memprage)\n");
   printf("           (square, sum, div-by-nframes, square root)\n");
   printf("   --no-check : do not check inputs (faster)\n");
+  printf("\n");
+  printf("   --stream : do not hold the concatenated volume in memory; reduce\n");
+  printf("              frames as they are read (--mean, --sum, --mean-div-n, --std,\n");
+  printf("              --var, --max, --max-index, --min) or write them straight\n");
+  printf("              to the output (mgh/mgz only)\n");
+  printf("   --stream-mem MB : memory budget for --stream (default %g, implies --stream)\n",StreamMemMB);
+  printf("   --threads N : number of threads used to reduce with --stream\n");
   printf("   --help      print out information on how to use this program\n");
   printf("   --version   print out version and exit\n");
   printf("\n");
@@ -1281,6 +1598,44 @@ static void check_options(void)
     printf("ERROR: do not use more than one of --abs, --pos, --neg\n");
     exit(1);
   }
+  if(DoStream)
+  {
+    // These need all the frames of a voxel (or all the voxels) at once
+    const char *flag = NULL;
+    if(DoMedian) flag = "--median";
+    if(DoCombine) flag = "--combine";
+    if(DoNormMean) flag = "--norm-mean";
+    if(DoNorm1) flag = "--norm1";
+    if(DoASL) flag = "--asl";
+    if(M != NULL || ngroups != 0) flag = "--mtx/--gmean";
+    if(DoFNorm) flag = "--fnorm";
+    if(DoTAR1) flag = "--tar1";
+    if(DoConjunction) flag = "--conjunct";
+    if(DoSort) flag = "--sort";
+    if(DoVote) flag = "--vote";
+    if(DoCumSum) flag = "--cumsum";
+    if(DoSCM) flag = "--scm";
+    if(DoPCA) flag = "--pca";
+    if(NReplications > 0) flag = "--rep";
+    if(DoRMS) flag = "--rms";
+    if(flag)
+    {
+      printf("ERROR: %s cannot be used with --stream\n",flag);
+      exit(1);
+    }
+    int nreduce = DoMean + DoMeanDivN + DoSum + DoStd + DoVar + DoMax + DoMaxIndex + DoMin;
+    if(nreduce > 1)
+    {
+      printf("ERROR: only one of --mean, --mean-div-n, --sum, --std, --var, --max, "
+             "--max-index, --min can be used with --stream\n");
+      exit(1);
+    }
+    if(nreduce == 0 && DoPrune)
+    {
+      printf("ERROR: --prune needs a reduction (eg, --mean) when used with --stream\n");
+      exit(1);
+    }
+  }
 
 
   return;
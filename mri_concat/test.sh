@@ -3,3 +3,16 @@ source "$(dirname $0)/../test.sh"
 
 test_command mri_concat std.rh.*.mgh --o rhout.mgh
 compare_vol rhout.mgh rhout.ref.mgh
+
+# streaming must give the same results as building the 4D volume;
+# a small --stream-mem forces the inputs to be read in several batches
+test_command mri_concat std.rh.*.mgh --o rhout.stream.mgh --stream-mem 1
+compare_vol rhout.stream.mgh rhout.ref.mgh
+
+test_command mri_concat std.rh.*.mgh --mean --o rhmean.mgh
+FSTEST_NO_DATA_RESET=1 test_command mri_concat std.rh.*.mgh --mean --o rhmean.stream.mgh --stream-mem 1
+compare_vol rhmean.stream.mgh rhmean.mgh --thresh 0.00001
+
+test_command mri_concat std.rh.*.mgh --std --o rhstd.mgh
+FSTEST_NO_DATA_RESET=1 test_command mri_concat std.rh.*.mgh --std --o rhstd.stream.mgh --stream-mem 1
+compare_vol rhstd.stream.mgh rhstd.mgh --thresh 0.00001
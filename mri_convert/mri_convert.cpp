@@ -362,6 +362,7 @@ int main(int argc, char *argv[])
       printf("setting outside val to %d\n", outside_val) ;
     }
     else if(strcmp(argv[i], "--no-dwi") == 0)  setenv("FS_LOAD_DWI","0",1);
+    else if(strcmp(argv[i], "--mgz-blocked") == 0)  mriio_set_mgz_blocked(1);
     else if(strcmp(argv[i], "--debug") == 0)
     {
       debug = 1;
@@ -5,6 +5,10 @@ source "$(dirname $0)/../test.sh"
 test_command mri_convert rawavg.mgz orig.mgz --conform
 compare_vol orig.mgz orig.ref.mgz
 
+# block-compressed mgz output
+test_command mri_convert --mgz-blocked rawavg.mgz orig.blocked.mgz --conform
+compare_vol orig.blocked.mgz orig.ref.mgz
+
 # dicom
 test_command mri_convert dcm/261000-10-60.dcm dicom.mgz
 compare_vol dicom.mgz freesurfer.mgz
@@ -30,10 +34,18 @@ compare_vol morphed.mgz odd.ref.mgz
 test_command mri_convert ep2d.mosaic.dcm ep2d.mosaic.mgz
 compare_vol ep2d.mosaic.mgz ep2d.mosaic.ref.mgz
 
+# same, looking up the ASCII header tags with the old slow reader
+USE_SIEMENSASCIITAG=1 test_command mri_convert ep2d.mosaic.dcm ep2d.mosaic.asciitag.mgz
+compare_vol ep2d.mosaic.asciitag.mgz ep2d.mosaic.ref.mgz
+
 # non-mosaic DICOM with incomplete ASCII header
 test_command mri_convert vnav.non-mosaic.dcm vnav.non-mosaic.mgz
 compare_vol vnav.non-mosaic.mgz vnav.non-mosaic.ref.mgz
 
+# same, looking up the ASCII header tags with the old slow reader
+USE_SIEMENSASCIITAG=1 test_command mri_convert vnav.non-mosaic.dcm vnav.non-mosaic.asciitag.mgz
+compare_vol vnav.non-mosaic.asciitag.mgz vnav.non-mosaic.ref.mgz
+
 # DICOM with identical geometry - but mosaic'd
 test_command mri_convert --mosaic-fix-noascii vnav.mosaic.dcm vnav.mosaic.mgz
 compare_vol vnav.mosaic.mgz vnav.mosaic.ref.mgz
@@ -56,6 +56,8 @@ static float binarize = 0.0 ;
 static int percent = 0;
 
 static int ndilations = 0 ;
+static int exact = 0 ;
+static char *nearest_name = NULL ;
 MRI *MRIthresholdPosterior(MRI *mri_src, MRI *mri_dst, float posterior_dist) ;
 MRI *MRIthresholdAnterior(MRI *mri_src, MRI *mri_dst, float anterior_dist) ;
 MRI *MRIscaleDistanceTransformToPercentMax(MRI *mri_in, MRI *mri_out);
@@ -81,6 +83,8 @@ int main(int argc, char *argv[]) {
 
   fprintf(stderr,"mri_distance_transform <input volume> <label> <max_distance> <mode[=1]> <output volume>\n");
   fprintf(stderr,"mode : 1 = outside , mode : 2 = inside , mode : 3 = both, mode : 4 = both unsigned \n");
+  fprintf(stderr,"-exact : use the exact euclidean distance transform instead of fast marching\n");
+  fprintf(stderr,"-nearest vol : with -exact, write the col, row, slice of the nearest boundary voxel to vol\n");
 
   if (argc < 5)
     exit(0) ;
@@ -197,7 +201,36 @@ int main(int argc, char *argv[]) {
         MRIwrite(mri_aseg, "a.mgz") ;
     }
 
-  mri_distance=MRIextractDistanceMap(mri,mri_distance,label, max_distance, mode, mri_white);
+  if (exact)
+    {
+      MRI *mri_nearest = NULL ;
+      int dtmode ;
+
+      // the exact transform has no geodesic mask, so it cannot be used with the white matter options
+      if (mri_white)
+        ErrorExit(ERROR_BADPARM, "%s: -exact cannot be used with -wm or -wsurf", Progname) ;
+      switch (mode)
+        {
+        case 1:  dtmode = DTRANS_MODE_OUTSIDE ; break ;
+        case 2:  dtmode = DTRANS_MODE_INSIDE ; break ;
+        case 3:  dtmode = DTRANS_MODE_SIGNED ; break ;
+        case 4:  dtmode = DTRANS_MODE_UNSIGNED ; break ;
+        default:
+          ErrorExit(ERROR_BADPARM, "%s: unknown mode %d", Progname, mode) ;
+        }
+      MRIexactDistanceTransform(mri, mri_distance, label, max_distance, dtmode, NULL,
+                                nearest_name ? &mri_nearest : NULL) ;
+      // same units and sign convention as fast marching: voxels, negative inside
+      MRIscalarMul(mri_distance, mri_distance, (mode == 2 ? -1.0 : 1.0)/mri->xsize) ;
+      if (mri_nearest)
+        {
+          printf("writing nearest boundary voxels to %s\n", nearest_name) ;
+          MRIwrite(mri_nearest, nearest_name) ;
+          MRIfree(&mri_nearest) ;
+        }
+    }
+  else
+    mri_distance=MRIextractDistanceMap(mri,mri_distance,label, max_distance, mode, mri_white);
 
   if (mri_aseg)
     {
@@ -381,6 +414,17 @@ get_option(int argc, char *argv[]) {
       percent=1;
       printf("scaling distances to be percent of max\n");
     }
+  else if (!stricmp(option, "exact"))
+    {
+      exact = 1 ;
+      printf("using exact euclidean distance transform\n") ;
+    }
+  else if (!stricmp(option, "nearest"))
+    {
+      nearest_name = argv[2] ;
+      nargs = 1 ;
+      printf("writing nearest boundary voxels to %s\n", nearest_name) ;
+    }
   return(nargs) ;
 }
 
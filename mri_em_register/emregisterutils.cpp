@@ -18,13 +18,18 @@
  *
  */
 
+#include <algorithm>
 #include <iostream>
+#include <utility>
+#include <vector>
 
 #include "macros.h"
 #include "diag.h"
 #include "cma.h"
 #include "error.h"
 
+#include "romp_support.h"
+
 #include "emregisterutils.h"
 
 extern int use_variance ;
@@ -209,3 +214,165 @@ int compute_tissue_modes( MRI *mri_inputs,
 
   return(NO_ERROR) ;
 }
+
+// ===========================================
+
+/*
+  Find the candidate transform with the largest sample likelihood.
+  get_xform(which, parms, m_dst) must fill m_dst with candidate 'which'
+  (0 <= which < ncandidates) and be safe to call from several threads.
+
+  The plain log-likelihood is evaluated in parallel over the candidates
+  with GCAcomputeLinearLogSampleProbabilitySum, which writes nothing
+  shared. If prune_stride > 1 every candidate is first scored on every
+  prune_stride'th sample only; adding the largest value each remaining
+  sample could contribute gives an upper bound on its full score, and
+  candidates are then fully evaluated in order of decreasing bound until
+  the bound falls below the best full score found. The pruning only drops
+  candidates that cannot win, so the result is the same as without it.
+
+  The exvivo, robust and variance scores go through
+  local_GCAcomputeLogSampleProbability one candidate at a time.
+
+  Returns the first candidate (in index order) whose score is strictly
+  larger than that of m_L, or -1 if there is none. *pmax_log_p is set to
+  the best score.
+*/
+#define PRUNE_BLOCK_SIZE 64
+
+int local_GCAfindMaxLogSampleProbability( GCA *gca,
+    GCA_SAMPLE *gcas,
+    MRI *mri,
+    MATRIX *m_L,
+    int nsamples,
+    double clamp,
+    EM_XFORM_FUNC get_xform,
+    void *parms,
+    int ncandidates,
+    int prune_stride,
+    double *pmax_log_p)
+{
+  double max_log_p, *log_ps, *bounds, rest_max, tol ;
+  int    best, *order, n, i, nleft, nfull ;
+  MATRIX *m_tmp ;
+
+  if (exvivo || robust || use_variance)
+  {
+    max_log_p = local_GCAcomputeLogSampleProbability(gca, gcas, mri, m_L, nsamples, exvivo, clamp) ;
+    m_tmp = MatrixAlloc(4, 4, MATRIX_REAL) ;
+    for (best = -1, n = 0 ; n < ncandidates ; n++)
+    {
+      double log_p ;
+
+      get_xform(n, parms, m_tmp) ;
+      log_p = local_GCAcomputeLogSampleProbability(gca, gcas, mri, m_tmp, nsamples, exvivo, clamp) ;
+      if (log_p > max_log_p)
+      {
+        if (exvivo)
+          printf("current estimates G=%d, W=%d, F=%d\n",
+                 (int)G_gm_mean, (int)G_wm_mean, (int)G_fluid_mean) ;
+        max_log_p = log_p ;
+        best = n ;
+      }
+    }
+    MatrixFree(&m_tmp) ;
+    *pmax_log_p = max_log_p ;
+    return(best) ;
+  }
+
+  max_log_p = GCAcomputeLinearLogSampleProbabilitySum(gca, gcas, mri, m_L, 0, 1, nsamples, clamp) / nsamples ;
+  log_ps = (double *)calloc(ncandidates, sizeof(double)) ;
+  order = (int *)calloc(ncandidates, sizeof(int)) ;
+  if (!log_ps || !order)
+    ErrorExit(ERROR_NOMEMORY, "local_GCAfindMaxLogSampleProbability: could not allocate %d candidates", ncandidates) ;
+
+  bounds = NULL ;
+  if (prune_stride > 1 && nsamples > prune_stride)
+  {
+    bounds = (double *)calloc(ncandidates, sizeof(double)) ;
+    if (!bounds)
+      ErrorExit(ERROR_NOMEMORY, "local_GCAfindMaxLogSampleProbability: could not allocate %d candidates", ncandidates) ;
+    for (rest_max = 0.0, i = 0 ; i < nsamples ; i++)
+      if (i % prune_stride)
+        rest_max += GCAsampleMaxLogProbability(gca, &gcas[i], clamp) ;
+
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 16)
+#endif
+    for (n = 0 ; n < ncandidates ; n++)
+    {
+      ROMP_PFLB_begin
+      MATRIX *m_cand = get_xform(n, parms, MatrixAlloc(4, 4, MATRIX_REAL)) ;
+      bounds[n] = (GCAcomputeLinearLogSampleProbabilitySum(gca, gcas, mri, m_cand, 0, prune_stride, nsamples, clamp) + rest_max) / nsamples ;
+      MatrixFree(&m_cand) ;
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+
+    // decreasing bound, lowest index first on ties
+    std::vector<std::pair<double, int> > sorted(ncandidates) ;
+    for (n = 0 ; n < ncandidates ; n++)
+      sorted[n] = std::make_pair(bounds[n], n) ;
+    std::sort(sorted.begin(), sorted.end(),
+              [](const std::pair<double, int> &a, const std::pair<double, int> &b) {
+                return(a.first > b.first || (a.first == b.first && a.second < b.second)) ;
+              }) ;
+    for (n = 0 ; n < ncandidates ; n++)
+      order[n] = sorted[n].second ;
+  }
+  else
+    for (n = 0 ; n < ncandidates ; n++)
+      order[n] = n ;
+
+  // the bound and the full score are summed in different orders
+  tol = 1e-6 * (1 + fabs(max_log_p)) ;
+  for (best = -1, nfull = 0, i = 0 ; i < ncandidates ; i += nleft)
+  {
+    if (bounds && bounds[order[i]] + tol < max_log_p)
+      break ;
+    nleft = bounds ? MIN(PRUNE_BLOCK_SIZE, ncandidates - i) : ncandidates ;
+
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 16)
+#endif
+    for (n = i ; n < i + nleft ; n++)
+    {
+      ROMP_PFLB_begin
+      int    const which = order[n] ;
+      if (bounds && bounds[which] + tol < max_log_p)
+        log_ps[which] = -1e30 ;
+      else
+      {
+        MATRIX *m_cand = get_xform(which, parms, MatrixAlloc(4, 4, MATRIX_REAL)) ;
+        log_ps[which] = GCAcomputeLinearLogSampleProbabilitySum(gca, gcas, mri, m_cand, 0, 1, nsamples, clamp) / nsamples ;
+        MatrixFree(&m_cand) ;
+      }
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+
+    // serial, so ties go to the lowest index whatever the thread count
+    for (n = i ; n < i + nleft ; n++)
+    {
+      int which = order[n] ;
+      if (log_ps[which] > max_log_p || (best >= 0 && log_ps[which] == max_log_p && which < best))
+      {
+        max_log_p = log_ps[which] ;
+        best = which ;
+      }
+    }
+    nfull += nleft ;
+  }
+
+  if (bounds && (Gdiag & DIAG_SHOW))
+    printf("  %d of %d candidates fully evaluated\n", nfull, ncandidates) ;
+
+  if (bounds)
+    free(bounds) ;
+  free(order) ;
+  free(log_ps) ;
+  *pmax_log_p = max_log_p ;
+  return(best) ;
+}
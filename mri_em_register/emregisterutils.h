@@ -36,6 +36,20 @@ double local_GCAcomputeLogSampleProbability( GCA *gca,
                                              int nsamples,
                                              int exvivo, double clamp );
 
+typedef MATRIX *(*EM_XFORM_FUNC)(int which, void *parms, MATRIX *m_dst);
+
+int local_GCAfindMaxLogSampleProbability( GCA *gca,
+                                          GCA_SAMPLE *gcas,
+                                          MRI *mri,
+                                          MATRIX *m_L,
+                                          int nsamples,
+                                          double clamp,
+                                          EM_XFORM_FUNC get_xform,
+                                          void *parms,
+                                          int ncandidates,
+                                          int prune_stride,
+                                          double *pmax_log_p );
+
 int compute_tissue_modes( MRI *mri_inputs,
                           GCA *gca,
                           GCA_SAMPLE *gcas,
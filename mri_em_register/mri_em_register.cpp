@@ -71,6 +71,8 @@ GCA_SAMPLE *Ggcas ;
 #define MAX_SCALE_PCT 0.15
 static float max_scale_pct = MAX_SCALE_PCT ;
 static int Gscale_samples = 0 ;
+/* score linear search candidates on every Nth sample first, to skip the ones that cannot win (0 = off) */
+static int search_prune_stride = 8 ;
 int robust = 0 ;
 /*
   allowable distance from an unknown sample to one in brain. Default
@@ -1968,6 +1970,15 @@ get_option(int argc, char *argv[])
     nargs = 1 ;
     printf("finding optimal linear transform over %d scales...\n", MIN_SCALES);
   }
+  else if (!stricmp(option, "SEARCH_PRUNE"))
+  {
+    search_prune_stride = atoi(argv[2]) ;
+    nargs = 1 ;
+    if (search_prune_stride > 1)
+      printf("bounding linear search candidates using every %dth sample\n", search_prune_stride) ;
+    else
+      printf("fully evaluating every linear search candidate\n") ;
+  }
   else if (!stricmp(option, "NSCALES"))
   {
     Gscale_samples = atoi(argv[2]) ;
@@ -2216,6 +2227,57 @@ get_option(int argc, char *argv[])
 
 
 
+/*
+  The 9-parameter search grid of find_optimal_linear_xform. The scalings
+  (nscale^3) and rotations (nangle^3) about the origin are built once, up
+  front, rather than every combination of the two, which would be
+  nscale^3*nangle^3 matrices. Each candidate is then
+  trans * ((scale * rot) * m_L), multiplied in the same order as before.
+*/
+typedef struct
+{
+  int     nscale, nangle, ntrans ;
+  double  *scales, *angles, *trans ;
+  MATRIX  **m_scale, **m_rot, *m_L ;
+} LINEAR_XFORM_GRID ;
+
+/* values min_val, min_val+delta, ... <= max_val, accumulated as the search loops always did */
+static int
+grid_values(double min_val, double max_val, double delta, double **pvals)
+{
+  double val ;
+  int    n ;
+
+  for (n = 0, val = min_val ; val <= max_val ; val += delta)
+    n++ ;
+  *pvals = (double *)calloc(MAX(n,1), sizeof(double)) ;
+  for (n = 0, val = min_val ; val <= max_val ; val += delta)
+    (*pvals)[n++] = val ;
+  return(n) ;
+}
+
+static MATRIX *
+get_grid_xform(int which, void *parms, MATRIX *m_dst)
+{
+  LINEAR_XFORM_GRID *grid = (LINEAR_XFORM_GRID *)parms ;
+  int const ntrans = grid->ntrans, nrot = grid->nangle*grid->nangle*grid->nangle ;
+  int const it = which % (ntrans*ntrans*ntrans) ;
+  int const outer = which / (ntrans*ntrans*ntrans) ;
+  MATRIX *m_trans, *m_tmp, *m_outer ;
+
+  m_tmp = MatrixMultiply(grid->m_scale[outer / nrot], grid->m_rot[outer % nrot], NULL) ;
+  m_outer = MatrixMultiply(m_tmp, grid->m_L, NULL) ;
+  m_trans = MatrixIdentity(4, NULL) ;
+  *MATRIX_RELT(m_trans, 1, 4) = grid->trans[it / (ntrans*ntrans)] ;
+  *MATRIX_RELT(m_trans, 2, 4) = grid->trans[(it / ntrans) % ntrans] ;
+  *MATRIX_RELT(m_trans, 3, 4) = grid->trans[it % ntrans] ;
+  MatrixMultiply(m_trans, m_outer, m_dst) ;
+  MatrixFree(&m_trans) ;
+  MatrixFree(&m_outer) ;
+  MatrixFree(&m_tmp) ;
+  return(m_dst) ;
+}
+
 /*/////////////////////////////////////////////////////////////
   search 9-dimensional parameter space
 */
@@ -2240,11 +2302,8 @@ find_optimal_linear_xform
   double delta_scale, delta_trans;
   double max_log_p, mean_angle;
   double mean_scale, x_max_trans, y_max_trans, z_max_trans, mean_trans ;
-  double x_trans, y_trans, z_trans;
-  double x_scale, y_scale, z_scale;
-  double x_angle, y_angle, z_angle;
-  double log_p;
-  int i;
+  LINEAR_XFORM_GRID grid ;
+  int i, n, nouter, nscale, nrot, best, isx, isy, isz, iax, iay, iaz ;
 
   if (rigid)
   {
@@ -2294,115 +2353,86 @@ find_optimal_linear_xform
       fflush(stdout) ;
     }
 
-    // scale /////////////////////////////////////////////////////////////
-    for (x_scale = min_scale ; x_scale <= max_scale ; x_scale += delta_scale)
+    // candidate grid, in the order the 9 parameters used to be scanned:
+    // scale x/y/z, rotation x/y/z, translation x/y/z
+    grid.nscale = grid_values(min_scale, max_scale, delta_scale, &grid.scales) ;
+    grid.nangle = grid_values(min_angle, max_angle, delta_rot, &grid.angles) ;
+    grid.ntrans = grid_values(min_trans, max_trans, delta_trans, &grid.trans) ;
+    nscale = grid.nscale*grid.nscale*grid.nscale ;
+    nrot = grid.nangle*grid.nangle*grid.nangle ;
+    nouter = nscale*nrot ;
+    grid.m_L = m_L ;
+    grid.m_scale = (MATRIX **)calloc(nscale, sizeof(MATRIX *)) ;
+    grid.m_rot = (MATRIX **)calloc(nrot, sizeof(MATRIX *)) ;
+    if (!grid.m_scale || !grid.m_rot)
+      ErrorExit(ERROR_NOMEMORY, "%s: could not allocate %d transforms",
+                Progname, nscale+nrot) ;
+    for (n = 0, isx = 0 ; isx < grid.nscale ; isx++)
+      for (isy = 0 ; isy < grid.nscale ; isy++)
+        for (isz = 0 ; isz < grid.nscale ; isz++, n++)
+        {
+          MatrixIdentity(4, m_scale) ;
+          *MATRIX_RELT(m_scale, 1, 1) = grid.scales[isx] ;
+          *MATRIX_RELT(m_scale, 2, 2) = grid.scales[isy] ;
+          *MATRIX_RELT(m_scale, 3, 3) = grid.scales[isz] ;
+          m_tmp = MatrixMultiply(m_scale, m_origin_inv, m_tmp) ;
+          grid.m_scale[n] = MatrixMultiply(m_origin, m_tmp, NULL) ;
+        }
+    for (n = 0, iax = 0 ; iax < grid.nangle ; iax++)
     {
-      /*      printf("x_scale = %2.3f\n", x_scale) ;*/
-      *MATRIX_RELT(m_scale, 1, 1) = x_scale ;
-      for (y_scale = min_scale ;
-           y_scale <= max_scale ;
-           y_scale += delta_scale)
+      m_x_rot = MatrixReallocRotation
+                (4, grid.angles[iax], X_ROTATION, m_x_rot) ;
+      for (iay = 0 ; iay < grid.nangle ; iay++)
       {
-        *MATRIX_RELT(m_scale, 2, 2) = y_scale ;
-        for (z_scale= min_scale ;
-             z_scale <= max_scale;
-             z_scale += delta_scale)
+        m_y_rot = MatrixReallocRotation
+                  (4, grid.angles[iay], Y_ROTATION, m_y_rot);
+        m_tmp = MatrixMultiply(m_y_rot, m_x_rot, m_tmp) ;
+        for (iaz = 0 ; iaz < grid.nangle ; iaz++, n++)
         {
-          *MATRIX_RELT(m_scale, 3, 3) = z_scale ;
-
-          /* reset translation values */
-          *MATRIX_RELT(m_scale, 1, 4) =
-            *MATRIX_RELT(m_scale, 2, 4) =
-              *MATRIX_RELT(m_scale, 3, 4) = 0.0f ;
-          m_tmp = MatrixMultiply(m_scale, m_origin_inv, m_tmp) ;
-          MatrixMultiply(m_origin, m_tmp, m_scale) ;
-
-          // angle //////////////////////////////
-          for (x_angle = min_angle ;
-               x_angle <= max_angle ;
-               x_angle += delta_rot)
-          {
-            m_x_rot = MatrixReallocRotation
-                      (4, x_angle, X_ROTATION, m_x_rot) ;
-            for (y_angle = min_angle ;
-                 y_angle <= max_angle ;
-                 y_angle += delta_rot)
-            {
-              m_y_rot = MatrixReallocRotation
-                        (4, y_angle, Y_ROTATION, m_y_rot);
-              m_tmp = MatrixMultiply(m_y_rot, m_x_rot, m_tmp) ;
-              for (z_angle= min_angle;
-                   z_angle <= max_angle;
-                   z_angle += delta_rot)
-              {
-                m_z_rot = MatrixReallocRotation
-                          (4, z_angle,Z_ROTATION,m_z_rot);
-                m_rot = MatrixMultiply(m_z_rot, m_tmp, m_rot) ;
-                m_tmp2 = MatrixMultiply
-                         (m_rot, m_origin_inv, m_tmp2) ;
-                MatrixMultiply(m_origin, m_tmp2, m_rot) ;
-
-                m_tmp2 = MatrixMultiply(m_scale, m_rot, m_tmp2) ;
-                m_tmp3 = MatrixMultiply(m_tmp2, m_L, m_tmp3) ;
-
-                // translation //////////
-                for (x_trans = min_trans ;
-                     x_trans <= max_trans ;
-                     x_trans += delta_trans)
-                {
-                  *MATRIX_RELT(m_trans, 1, 4) = x_trans ;
-                  for (y_trans = min_trans ;
-                       y_trans <= max_trans ;
-                       y_trans += delta_trans)
-                  {
-                    *MATRIX_RELT(m_trans, 2, 4) = y_trans ;
-                    for (z_trans= min_trans ;
-                         z_trans <= max_trans ;
-                         z_trans += delta_trans)
-                    {
-                      *MATRIX_RELT(m_trans, 3, 4) =
-                        z_trans ;
-
-                      m_L_tmp = MatrixMultiply
-                                (m_trans, m_tmp3, m_L_tmp) ;
-
-                      log_p = local_GCAcomputeLogSampleProbability(gca, gcas, mri, m_L_tmp, nsamples, exvivo, Gclamp);
-                      if (log_p > max_log_p)
-                      {
-                        if (exvivo)
-                          printf("current estimates G=%d, W=%d, F=%d\n",
-                                 (int)G_gm_mean, (int)G_wm_mean, (int)G_fluid_mean) ;
-                        max_log_p = log_p ;
-                        x_max_scale = x_scale ;
-                        y_max_scale = y_scale ;
-                        z_max_scale = z_scale ;
-                        x_max_rot = x_angle ;
-                        y_max_rot = y_angle ;
-                        z_max_rot = z_angle ;
-                        x_max_trans = x_trans ;
-                        y_max_trans = y_trans ;
-                        z_max_trans = z_trans ;
-                      }
-#if 0
-                      printf( "%s: log_p = %f\n", __FUNCTION__, log_p );
-                      printf( "%s: Translation (%4.2f, %4.2f, %4.2f)\n",
-                              __FUNCTION__, x_trans, y_trans, z_trans );
-                      printf( "%s: Rotation (%4.2f, %4.2f, %4.2f)\n",
-                              __FUNCTION__, x_angle, y_angle, z_angle );
-                      printf( "%s: Scale (%4.2f, %4.2f, %4.2f)\n",
-                              __FUNCTION__, x_scale, y_scale, z_scale );
-                      exit( 0 );
-#endif
-                    }
-                  }
-                }
-              }
-            }
-          }
+          m_z_rot = MatrixReallocRotation
+                    (4, grid.angles[iaz], Z_ROTATION, m_z_rot);
+          m_rot = MatrixMultiply(m_z_rot, m_tmp, m_rot) ;
+          m_tmp2 = MatrixMultiply(m_rot, m_origin_inv, m_tmp2) ;
+          grid.m_rot[n] = MatrixMultiply(m_origin, m_tmp2, NULL) ;
         }
       }
     }
 
+    best = local_GCAfindMaxLogSampleProbability
+           (gca, gcas, mri, m_L, nsamples, Gclamp,
+            get_grid_xform, &grid,
+            nouter*grid.ntrans*grid.ntrans*grid.ntrans,
+            search_prune_stride, &max_log_p) ;
+    if (best >= 0)
+    {
+      n = best / (grid.ntrans*grid.ntrans*grid.ntrans) ;
+      best %= grid.ntrans*grid.ntrans*grid.ntrans ;
+      x_max_trans = grid.trans[best / (grid.ntrans*grid.ntrans)] ;
+      y_max_trans = grid.trans[(best / grid.ntrans) % grid.ntrans] ;
+      z_max_trans = grid.trans[best % grid.ntrans] ;
+      z_max_rot = grid.angles[n % grid.nangle] ;
+      n /= grid.nangle ;
+      y_max_rot = grid.angles[n % grid.nangle] ;
+      n /= grid.nangle ;
+      x_max_rot = grid.angles[n % grid.nangle] ;
+      n /= grid.nangle ;
+      z_max_scale = grid.scales[n % grid.nscale] ;
+      n /= grid.nscale ;
+      y_max_scale = grid.scales[n % grid.nscale] ;
+      n /= grid.nscale ;
+      x_max_scale = grid.scales[n] ;
+    }
+
+    for (n = 0 ; n < nscale ; n++)
+      MatrixFree(&grid.m_scale[n]) ;
+    for (n = 0 ; n < nrot ; n++)
+      MatrixFree(&grid.m_rot[n]) ;
+    free(grid.m_scale) ;
+    free(grid.m_rot) ;
+    free(grid.scales) ;
+    free(grid.angles) ;
+    free(grid.trans) ;
+
     if (Gdiag & DIAG_SHOW)
     {
       printf("  max log p = %2.3f @ R=(%2.3f,%2.3f,%2.3f),"
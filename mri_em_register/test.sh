@@ -8,3 +8,9 @@ fi
 
 test_command mri_em_register -uns 3 -mask brainmask.mgz nu.mgz ${FREESURFER_HOME}/average/RB_all_2016-05-10.vc700.gca talairach.lta
 compare_lta talairach.lta talairach.ref.lta
+
+# the pruned linear search only skips candidates that cannot win, so it must find the same
+# transform as the exhaustive one
+FSTEST_NO_DATA_RESET=1 test_command mri_em_register -uns 3 -search_prune 0 -mask brainmask.mgz nu.mgz \
+    ${FREESURFER_HOME}/average/RB_all_2016-05-10.vc700.gca talairach.noprune.lta
+compare_lta talairach.lta talairach.noprune.lta
@@ -664,6 +664,7 @@ GCAscale(GCA *gca, double min_val, double max_val) {
   GCA_PRIOR  *gcap  ;
   GC1D       *gc ;
 
+  GCAunmap(gca) ;
   for (xp = 0  ; xp  < gca->prior_width ; xp++) {
     for  (yp  = 0 ;  yp < gca->prior_height ; yp++) {
       for (zp = 0 ;  zp  < gca->prior_depth  ; zp++) {
@@ -0,0 +1,157 @@
+/**
+ * @brief converts a GCA atlas between the .gca/.gcz and mapped .gcx formats
+ *
+ * Reads an atlas in any format understood by GCAread and writes it in the
+ * format implied by the output name. A .gcx output can be memory-mapped by
+ * mri_ca_register, mri_ca_label, mri_ca_normalize etc, so that concurrent
+ * jobs share one page-cached copy and load it almost instantly.
+ */
+/*
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "const.h"
+#include "utils.h"
+#include "gca.h"
+#include "error.h"
+#include "diag.h"
+#include "version.h"
+#include "macros.h"
+#include "timer.h"
+
+static void print_usage(void) ;
+static void usage_exit(void);
+static void print_help(void) ;
+static void print_version(void) ;
+
+static int get_option(int argc, char *argv[]) ;
+
+const char *Progname ;
+
+
+/***-------------------------------------------------------****/
+int main(int argc, char *argv[])
+{
+  int  nargs ;
+  GCA  *gca ;
+  Timer start ;
+
+  nargs = handleVersionOption(argc, argv, "mri_gca_convert");
+  if (nargs && argc - nargs == 1)
+    exit (0);
+  Progname = argv[0] ;
+  argc -= nargs;
+  for ( ; argc > 1 && ISOPTION(*argv[1]) ; argc--, argv++)
+  {
+    nargs = get_option(argc, argv) ;
+    argc -= nargs ;
+    argv += nargs ;
+  }
+
+  if (argc != 3)
+    usage_exit() ;
+
+  ErrorInit(NULL, NULL, NULL) ;
+  DiagInit(NULL, NULL, NULL) ;
+
+  printf("reading atlas from %s...\n", argv[1]) ;
+  gca = GCAread(argv[1]) ;
+  if (gca == NULL)
+    ErrorExit(ERROR_NOFILE, "%s: could not read atlas from %s", Progname, argv[1]) ;
+  printf("atlas read in %2.2f sec\n", start.seconds()) ;
+
+  printf("writing atlas to %s\n", argv[2]) ;
+  if (GCAwrite(gca, argv[2]) != NO_ERROR)
+    ErrorExit(ERROR_BADFILE, "%s: could not write atlas to %s", Progname, argv[2]) ;
+
+  GCAfree(&gca) ;
+  exit(0);
+
+} /* end main() */
+
+
+/*----------------------------------------------------------------------
+            Parameters:
+
+           Description:
+----------------------------------------------------------------------*/
+static int
+get_option(int argc, char *argv[])
+{
+  int  nargs = 0 ;
+  char *option ;
+
+  option = argv[1] + 1 ;            /* past '-' */
+  if (!stricmp(option, "-help"))
+  {
+    print_help() ;
+  }
+  else switch (toupper(*option))
+    {
+    case '?':
+    case 'U':
+      nargs = 0 ;
+      print_usage() ;
+      exit(1) ;
+      break ;
+    case 'V':
+      print_version() ;
+      break ;
+    default:
+      fprintf(stderr, "unknown option %s\n", argv[1]) ;
+      exit(1) ;
+      break ;
+    }
+
+  return(nargs) ;
+}
+
+/* --------------------------------------------- */
+static void print_usage(void)
+{
+  printf("USAGE: %s  <options> input.gca output.gcx\n",Progname) ;
+  printf("\n");
+}
+
+/* --------------------------------------------- */
+static void print_help(void)
+{
+  print_usage() ;
+  printf(
+    "\n"
+    "Converts a GCA atlas to the format given by the output file name:\n"
+    "  .gca  uncompressed (original) format\n"
+    "  .gcz  gzipped format\n"
+    "  .gcx  memory-mapped format, loaded by mmap in all tools that read atlases.\n"
+    "        It is written in native byte order and must be regenerated\n"
+    "        for machines with a different byte order.\n"
+  );
+  exit(1) ;
+}
+
+/* --------------------------------------------- */
+static void print_version(void)
+{
+  std::cout << getVersion() << std::endl;
+  exit(1) ;
+}
+
+/* ------------------------------------------------------ */
+static void usage_exit(void)
+{
+  print_usage() ;
+  exit(1) ;
+}
@@ -83,6 +83,12 @@ USAGE: ./mri_glmfit
 
    --sim nulltype nsim thresh csdbasename : simulation perm, mc-full, mc-z
    --sim-sign signstring : abs, pos, or neg. Default is abs.
+   --sim-resume : continue a simulation from its CSD files (same --seed)
+   --sim-serial : run iterations one after another with a single random stream
+   --sim-checkpoint sec : min time between CSD rewrites (default 60)
+   --tfce : compute threshold-free cluster enhancement (tfce), max TFCE saved with the CSD (perm only)
+   --tfce-params E H : TFCE extent and height exponents (default E=1 surf, 0.5 vol; H=2)
+   --threads nthreads : number of threads for the fit and the simulation
    --uniform min max : use uniform distribution instead of gaussian
 
    --pca : perform pca/svd analysis on residual
@@ -494,6 +500,18 @@ only have one row.
 For mc-full, synthesize input as a uniform distribution between min
 and max. 
 
+The simulation iterations are independent, so they are run in
+parallel (see --threads). Each iteration draws from its own random
+stream derived from the seed, so the CSD is the same regardless of
+the number of threads. The CSD files are rewritten with the completed
+iterations at most every --sim-checkpoint seconds (and at the end).
+If a run is interrupted, rerun the same command with the same --seed
+and --sim-resume to continue where it left off. --sim-serial gives
+the older behavior where all iterations share one random stream
+and the CSD is written after every iteration. Variance smoothing,
+weights, per-voxel regressors, frame masks, --perm-nonstatcor, and
+--diag-cluster always run serially (and cannot be resumed).
+
 ENDHELP --------------------------------------------------------------
 
 */
@@ -548,6 +566,7 @@ double round(double x);
 #include "dti.h"
 #include "image.h"
 #include "stats.h"
+#include "romp_support.h"
 
 int MRISmaskByLabel(MRI *y, MRIS *surf, LABEL *lb, int invflag);
 
@@ -559,6 +578,22 @@ static void print_help(void) ;
 static void print_version(void) ;
 static void dump_options(FILE *fp);
 static int SmoothSurfOrVol(MRIS *surf, MRI *mri, MRI *mask, double SmthLevel);
+static MRI *TFCESurfOrVol(MRIS *surf, MRI *sig, MRI *mask, int thsign, MRI *tfce);
+
+typedef struct {
+  MRIGLM *mriglm;  // private glm; shares y and mask with the main one unless synthesized
+  MRIS *surf;      // private copy of the surface for smoothing and clustering
+  RFS *rfs;        // random stream, reseeded at each iteration
+  MRI *z, *zabs, *p, *sig, *tfce, *tfcesig;
+} SIMWORKER;
+static int SimCSDFileName(CSD *csd, int n, char *fname);
+static int SimWriteCSD(CSD *csd, int n, double runtime_min);
+static int SimSchedulerOK(void);
+static unsigned long SimIterSeed(long seed, int nthsim);
+static SIMWORKER *SimWorkerAlloc(void);
+static int SimWorkerFree(SIMWORKER **pw);
+static int SimIteration(SIMWORKER *w, int nthsim);
+static int SimScheduler(void);
 
 int main(int argc, char *argv[]) ;
 
@@ -636,6 +671,9 @@ int DontSave = 0;
 int DontSaveWn = 0;
 
 int DoSim=0;
+int DoTFCE=0;
+double TFCE_E=-1, TFCE_H=2;
+MRI *tfcemap=NULL, *tfcesig=NULL;
 int synth = 0;
 int PermForce = 0;
 int UseUniform = 0;
@@ -708,6 +746,9 @@ int  UseCortexLabel = 1;
 
 char *SimDoneFile = NULL;
 int tSimSign = 0;
+int SimSerial = 0;  // run the simulation with the single-stream serial loop
+int SimResume = 0;  // continue from the iterations already in the CSD files
+double SimCheckpointSec = 60; // min time between CSD rewrites in SimScheduler()
 int FWHMSet = 0;
 int DoKurtosis = 0;
 int DoSkew = 0;
@@ -762,7 +803,6 @@ int main(int argc, char **argv) {
   MATRIX *Ct, *CCt;
   FILE *fp;
   double Ccond, dtmp, threshadj, eff;
-  const char *tmpstr2=NULL;
 
   eresfwhm = -1;
   csd = CSDalloc();
@@ -1665,6 +1705,9 @@ int main(int argc, char **argv) {
     else  strcpy(csd->anattype,"volume");
     csd->searchspace = searchspace;
     csd->nreps = nsim;
+    csd->tfce = DoTFCE;
+    csd->tfceE = TFCE_E;
+    csd->tfceH = TFCE_H;
     CSDallocData(csd);
     if (!strcmp(csd->simtype,"mc-z")) {
       rfs = RFspecInit(SynthSeed,NULL);
@@ -1707,7 +1750,15 @@ int main(int argc, char **argv) {
 
     printf("\n\nStarting simulation sim over %d trials\n",nsim);
     mytimer.reset() ;
-    for (nthsim=0; nthsim < nsim; nthsim++) {
+    // Iterations are run in parallel by SimScheduler() when possible; the
+    // serial loop below then has nothing left to do.
+    nthsim = 0;
+    if(SimSchedulerOK()) nthsim = SimScheduler();
+    else if(SimResume){
+      printf("ERROR: --sim-resume cannot be used with this simulation (see --sim-serial)\n");
+      exit(1);
+    }
+    for (; nthsim < nsim; nthsim++) {
       msecFitTime = mytimer.milliseconds();
       if(debug) printf("%d/%d t=%g ---------------------------------\n",
              nthsim+1,nsim,msecFitTime/(1000*60.0));
@@ -1855,47 +1906,35 @@ int main(int argc, char **argv) {
 	    }
 	    if(debug) printf("%s %d nc=%d  maxcsize=%g  sigmax=%g  Fmax=%g\n",
 			     mriglm->glm->Cname[n],nthsim,nClusters,csize,sigmax,Fmax);
+	    // The TFCE does not depend on the threshold, only on the sign,
+	    // so it is only computed for the first threshold. As for
+	    // tfce.mgh, it is of the signed sig even when the clustering
+	    // is abs, so that the tails are not merged
+	    if(DoTFCE){
+	      if(nthThresh == 0){
+		MRI *tfcein = sig;
+		if(csd->threshsign == 0 && mriglm->glm->C[n]->rows == 1){
+		  tfcesig = MRIcopy(sig,tfcesig);
+		  MRIsetSign(tfcesig,mriglm->gamma[n],0); // perm only
+		  tfcein = tfcesig;
+		}
+		tfcemap = TFCESurfOrVol(surf, tfcein, mriglm->mask, csd->threshsign, tfcemap);
+		csd->MaxTFCE[nthsim] = MRIframeMax(tfcemap,0,mriglm->mask,csd->threshsign,
+						   &cmax,&rmax,&smax);
+	      }
+	      else csd->MaxTFCE[nthsim] = csdList[0][nthSign][n]->MaxTFCE[nthsim];
+	    }
 
 	    // Re-write the full CSD file each time. Should not take that
 	    // long and assures output can be used immediately regardless
 	    // of whether the job terminated properly or not
 	    strcpy(csd->contrast,mriglm->glm->Cname[n]);
-	    if(DoSimThreshLoop && (nThreshList > 1 || nSignList > 1) ){
-	      if(round(csd->threshsign) ==  0) tmpstr2 = "abs"; 
-	      if(round(csd->threshsign) == +1) tmpstr2 = "pos"; 
-	      if(round(csd->threshsign) == -1) tmpstr2 = "neg"; 
-	      //sprintf(tmpstr,"%s-%s.th%04d.%s.csd",simbase,mriglm->glm->Cname[n],
-	      //      (int)round(csd->thresh*100),tmpstr2);
-	      sprintf(tmpstr,"%s.th%02d.%s.j001-%s.csd",simbase,
-		      (int)round(csd->thresh*10),tmpstr2,mriglm->glm->Cname[n]);
-	    }
-	    else
-	      sprintf(tmpstr,"%s-%s.csd",simbase,mriglm->glm->Cname[n]);
-	    if(debug) printf("csd %s \n",tmpstr);
-	    fflush(stdout);
-	    fp = fopen(tmpstr,"w");
-	    if (fp == NULL) {
-	      printf("ERROR: opening %s\n",tmpstr);
-	      exit(1);
-	    }
-	    fprintf(fp,"# ClusterSimulationData 2\n");
-	    fprintf(fp,"# mri_glmfit simulation sim\n");
-	    fprintf(fp,"# hostname %s\n",uts.nodename);
-	    fprintf(fp,"# machine  %s\n",uts.machine);
-	    fprintf(fp,"# runtime_min %g\n",msecFitTime/(1000*60.0));
-	    fprintf(fp,"# FixVertexAreaFlag %d\n",MRISgetFixVertexAreaValue());
-	    if (mriglm->mask) fprintf(fp,"# masking 1\n");
-	    else             fprintf(fp,"# masking 0\n");
-	    fprintf(fp,"# num_dof %d\n",mriglm->glm->C[n]->rows);
-	    fprintf(fp,"# den_dof %g\n",mriglm->glm->dof);
-	    fprintf(fp,"# SmoothLevel %g\n",SmoothLevel);
 	    csd->nreps = nthsim+1;
 	    csd->nClusters[nthsim] = nClusters;
 	    csd->MaxClusterSize[nthsim] = csize;
 	    csd->MaxSig[nthsim] = sigmax;
 	    csd->MaxStat[nthsim] = Fmax;
-	    CSDprint(fp, csd);
-	    fclose(fp);
+	    SimWriteCSD(csd, n, msecFitTime/(1000*60.0));
 	    if(debug) CSDprint(stdout, csd);
 
 	    if(DiagCluster) {
@@ -2106,6 +2145,15 @@ int main(int argc, char **argv) {
     sprintf(tmpstr,"%s/%s/sig.%s",GLMDir,mriglm->glm->Cname[n],format);
     MRIwrite(sig,tmpstr);
 
+    // Threshold-free cluster enhancement of the sig
+    if(DoTFCE){
+      tfcemap = TFCESurfOrVol(surf, sig, mriglm->mask, 0, NULL);
+      sprintf(tmpstr,"%s/%s/tfce.%s",GLMDir,mriglm->glm->Cname[n],format);
+      MRIwrite(tfcemap,tmpstr);
+      printf("    max tfce = %g\n",MRIframeMax(tfcemap,0,mriglm->mask,0,&cmax,&rmax,&smax));
+      MRIfree(&tfcemap);
+    }
+
     // Write out the z
     sprintf(tmpstr,"%s/%s/z.%s",GLMDir,mriglm->glm->Cname[n],format);
     MRIwrite(mriglm->z[n],tmpstr);
@@ -2535,6 +2583,30 @@ static int parse_commandline(int argc, char **argv) {
       nargsused = 4;
     } 
     else if(!strcasecmp(option, "--sim-thresh-loop")) DoSimThreshLoop = 1;
+    else if(!strcasecmp(option, "--tfce")) DoTFCE = 1;
+    else if(!strcasecmp(option, "--tfce-params")) {
+      if(nargc < 2) CMDargNErr(option,2);
+      sscanf(pargv[0],"%lf",&TFCE_E);
+      sscanf(pargv[1],"%lf",&TFCE_H);
+      DoTFCE = 1;
+      nargsused = 2;
+    }
+    else if(!strcasecmp(option, "--sim-serial")) SimSerial = 1;
+    else if(!strcasecmp(option, "--sim-resume")) SimResume = 1;
+    else if(!strcasecmp(option, "--sim-checkpoint")) {
+      if(nargc < 1) CMDargNErr(option,1);
+      sscanf(pargv[0],"%lf",&SimCheckpointSec);
+      nargsused = 1;
+    }
+    else if(!strcasecmp(option, "--threads") || !strcasecmp(option, "--nthreads") ){
+      if(nargc < 1) CMDargNErr(option,1);
+      int nthreads;
+      sscanf(pargv[0],"%d",&nthreads);
+      #ifdef HAVE_OPENMP
+      omp_set_num_threads(nthreads);
+      #endif
+      nargsused = 1;
+    }
     else if(!strcasecmp(option, "--sim-thresh-loop-pos")){
       DoSimThreshLoop = 1;
       nSignList = 1;
@@ -3048,6 +3120,8 @@ printf("   --kurtosis : compute kurtosis and p-value for kurtosis\n");
 printf("\n");
 printf("   --sim nulltype nsim thresh csdbasename : simulation perm, mc-full, mc-z\n");
 printf("   --sim-sign signstring : abs, pos, or neg. Default is abs.\n");
+printf("   --tfce : compute threshold-free cluster enhancement (tfce), max TFCE saved with the CSD (perm only)\n");
+printf("   --tfce-params E H : TFCE extent and height exponents (default E=1 surf, 0.5 vol; H=2)\n");
 printf("   --uniform min max : use uniform distribution instead of gaussian\n");
 printf("\n");
 printf("   --pca : perform pca/svd analysis on residual\n");
@@ -3459,6 +3533,22 @@ printf("sign is either abs (default), pos, or neg. pos/neg tell mri_glmfit to\n"
 printf("perform a one-tailed test. In this case, the contrast matrix can\n");
 printf("only have one row.\n");
 printf("\n");
+printf("--tfce\n");
+printf("--tfce-params E H\n");
+printf("\n");
+printf("Threshold-free cluster enhancement (TFCE, Smith and Nichols, 2009).\n");
+printf("The TFCE of a voxel or vertex is the integral over heights h up to\n");
+printf("its sig of extent(h)^E * h^H dh, where extent(h) is the size of the\n");
+printf("cluster (area on the surface, number of voxels in the volume) it\n");
+printf("belongs to when the sig is thresholded at h. Positive and negative\n");
+printf("sigs are enhanced separately. Without --sim, the TFCE of each contrast\n");
+printf("is saved as tfce.mgh in the contrast directory. With --sim perm, the\n");
+printf("max TFCE of each permutation is saved in a file next to each CSD\n");
+printf("file, with .csd replaced by .maxtfce.dat. The sig is signed before\n");
+printf("the TFCE as for tfce.mgh, so with --sim-sign abs the two tails are\n");
+printf("still enhanced separately. The default E is 1 for surfaces and 0.5\n");
+printf("for volumes, H is 2.\n");
+printf("\n");
 printf("--uniform min max\n");
 printf("\n");
 printf("For mc-full, synthesize input as a uniform distribution between min\n");
@@ -3604,6 +3694,20 @@ static void check_options(void) {
       exit(1);
     }
   }
+  if(DoTFCE){
+    if(DoSim && strcmp(csd->simtype,"perm") != 0){
+      printf("ERROR: --tfce can only be used with perm simulation\n");
+      exit(1);
+    }
+    if(TFCE_E < 0){
+      if(surf) TFCE_E = 1.0;
+      else     TFCE_E = 0.5;
+    }
+    if(TFCE_E <= 0 || TFCE_H <= 0){
+      printf("ERROR: TFCE parameters must be > 0 (E=%g, H=%g)\n",TFCE_E,TFCE_H);
+      exit(1);
+    }
+  }
   if(DoSim && FWHMSet == 0){
     printf("ERROR: you must supply --fwhm with --sim, even if it is 0\n");
     exit(1);
@@ -3697,6 +3801,8 @@ static void dump_options(FILE *fp) {
   }
   if(UseUniform)
     fprintf(fp,"Uniform %lf %lf\n",UniformMin,UniformMax);
+  if(DoTFCE)
+    fprintf(fp,"TFCE E=%lf H=%lf\n",TFCE_E,TFCE_H);
 
   return;
 }
@@ -3735,6 +3841,16 @@ static int SmoothSurfOrVol(MRIS *surf, MRI *mri, MRI *mask, double SmthLevel) {
   return(0);
 }
 
+/*--------------------------------------------------------------------
+  TFCESurfOrVol() - threshold-free cluster enhancement of sig with the
+  --tfce-params, using vertex areas on the surface and face-connected
+  voxel counts in the volume.
+  --------------------------------------------------------------------*/
+static MRI *TFCESurfOrVol(MRIS *surf, MRI *sig, MRI *mask, int thsign, MRI *tfce) {
+  if (surf == NULL) return(MRItfce(sig, 0, mask, thsign, TFCE_E, TFCE_H, tfce));
+  return(MRIStfce(surf, sig, 0, mask, thsign, TFCE_E, TFCE_H, tfce));
+}
+
 
 /*--------------------------------------------------------------------*/
 int MRISmaskByLabel(MRI *y, MRIS *surf, LABEL *lb, int invflag) {
@@ -4120,6 +4236,465 @@ int MRIloganize(MATRIX **X, MRI **Ct, MRI **intCt, const MATRIX *t, const double
   return(0);
 }
 
+/*--------------------------------------------------------------------
+  SimCSDFileName() - name of the CSD file for the given csd and
+  contrast. Same naming as the serial simulation loop.
+  --------------------------------------------------------------------*/
+static int SimCSDFileName(CSD *csd, int n, char *fname) {
+  const char *signstr = "abs";
+  if(DoSimThreshLoop && (nThreshList > 1 || nSignList > 1) ){
+    if(round(csd->threshsign) == +1) signstr = "pos";
+    if(round(csd->threshsign) == -1) signstr = "neg";
+    sprintf(fname,"%s.th%02d.%s.j001-%s.csd",simbase,
+            (int)round(csd->thresh*10),signstr,mriglm->glm->Cname[n]);
+  }
+  else
+    sprintf(fname,"%s-%s.csd",simbase,mriglm->glm->Cname[n]);
+  return(0);
+}
 
+/*--------------------------------------------------------------------
+  SimWriteCSD() - (re)writes the full CSD file for contrast n with
+  the first csd->nreps iterations.
+  --------------------------------------------------------------------*/
+static int SimWriteCSD(CSD *csd, int n, double runtime_min) {
+  char fname[2000], tfcefname[2000];
+  FILE *fp;
 
+  SimCSDFileName(csd, n, fname);
+  if(debug) printf("csd %s \n",fname);
+  fflush(stdout);
+  fp = fopen(fname,"w");
+  if (fp == NULL) {
+    printf("ERROR: opening %s\n",fname);
+    exit(1);
+  }
+  fprintf(fp,"# ClusterSimulationData 2\n");
+  fprintf(fp,"# mri_glmfit simulation sim\n");
+  fprintf(fp,"# hostname %s\n",uts.nodename);
+  fprintf(fp,"# machine  %s\n",uts.machine);
+  fprintf(fp,"# runtime_min %g\n",runtime_min);
+  fprintf(fp,"# FixVertexAreaFlag %d\n",MRISgetFixVertexAreaValue());
+  if (mriglm->mask) fprintf(fp,"# masking 1\n");
+  else             fprintf(fp,"# masking 0\n");
+  fprintf(fp,"# num_dof %d\n",mriglm->glm->C[n]->rows);
+  fprintf(fp,"# den_dof %g\n",mriglm->glm->dof);
+  fprintf(fp,"# SmoothLevel %g\n",SmoothLevel);
+  CSDprint(fp, csd);
+  fclose(fp);
+  if(csd->tfce){
+    CSDtfceFileName(fname, tfcefname);
+    if(CSDwriteTFCE(tfcefname, csd)) exit(1);
+  }
+  return(0);
+}
+
+/*--------------------------------------------------------------------
+  SimSchedulerOK() - returns 1 if the simulation can be run by
+  SimScheduler(). Variance smoothing, per-voxel designs (weights,
+  pvrs, frame masks, ffx), non-stationarity correction, and
+  --diag-cluster still go through the serial loop.
+  --------------------------------------------------------------------*/
+static int SimSchedulerOK(void) {
+  if(SimSerial || DiagCluster || PermNonStatCor) return(0);
+  if(!strcmp(csd->simtype,"perm") || !strcmp(csd->simtype,"mc-full")){
+    if(VarFWHM > 0) return(0);
+    if(mriglm->w != NULL || mriglm->npvr != 0) return(0);
+    if(mriglm->FrameMask != NULL || mriglm->yffxvar != NULL) return(0);
+    if(MRIglmTileSize() == 0) return(0);
+  }
+  return(1);
+}
 
+/*--------------------------------------------------------------------
+  SimIterSeed() - seed of the random number stream for the given
+  simulation iteration (splitmix64 of the global seed and the
+  iteration number). Every iteration draws from its own stream, so
+  the CSD does not depend on the number of threads, on the order in
+  which iterations finish, or on whether the run was resumed.
+  --------------------------------------------------------------------*/
+static unsigned long SimIterSeed(long seed, int nthsim) {
+  unsigned long long x;
+  x = ((unsigned long long)seed << 32) ^ (unsigned long long)(nthsim+1);
+  x += 0x9E3779B97F4A7C15ULL;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  x ^= x >> 31;
+  // keep it positive and non-zero (RFspecSetSeed() treats 0 as time-of-day)
+  x &= 0x7fffffff;
+  if(x == 0) x = 1;
+  return((unsigned long)x);
+}
+
+/*--------------------------------------------------------------------
+  SimWorkerAlloc() - allocates the per-thread state for SimScheduler():
+  a private MRIGLM (sharing y and the mask with the main one unless
+  the input is synthesized), a private copy of the surface for
+  clustering, and a random field generator.
+  --------------------------------------------------------------------*/
+static SIMWORKER *SimWorkerAlloc(void) {
+  SIMWORKER *w;
+  GLMMAT *glm;
+  int n;
+
+  w = (SIMWORKER *) calloc(sizeof(SIMWORKER),1);
+  w->mriglm = (MRIGLM *) calloc(sizeof(MRIGLM),1);
+  w->mriglm->glm = glm = GLMalloc();
+  w->mriglm->mask = mriglm->mask;
+  w->mriglm->Xg = MatrixCopy(mriglm->Xg,NULL);
+  if (!strcmp(csd->simtype,"mc-full")) {
+    w->mriglm->y = MRIallocSequence(mriglm->y->width,mriglm->y->height,mriglm->y->depth,
+                                    MRI_FLOAT,mriglm->y->nframes);
+    MRIcopyHeader(mriglm->y,w->mriglm->y);
+  }
+  else w->mriglm->y = mriglm->y;
+
+  glm->ncontrasts = mriglm->glm->ncontrasts;
+  glm->ReScaleX = mriglm->glm->ReScaleX;
+  glm->AllowZeroDOF = mriglm->glm->AllowZeroDOF;
+  glm->DoPCC = 0;
+  for (n=0; n < glm->ncontrasts; n++) {
+    glm->C[n] = MatrixCopy(mriglm->glm->C[n],NULL);
+    glm->Cname[n] = mriglm->glm->Cname[n];
+    glm->UseGamma0[n] = mriglm->glm->UseGamma0[n];
+    if(glm->UseGamma0[n]) glm->gamma0[n] = MatrixCopy(mriglm->glm->gamma0[n],NULL);
+  }
+  GLMallocX(glm,mriglm->y->nframes,mriglm->nregtot);
+  GLMallocY(glm);
+
+  if(surf){
+    w->surf = MRISclone(surf);
+    w->surf->group_avg_surface_area   = surf->group_avg_surface_area;
+    w->surf->group_avg_vtxarea_loaded = surf->group_avg_vtxarea_loaded;
+  }
+
+  w->rfs = RFspecInit(1,NULL);
+  if (!strcmp(csd->simtype,"mc-z") || (!strcmp(csd->simtype,"mc-full") && !UseUniform)) {
+    w->rfs->name = strcpyalloc("gaussian");
+    w->rfs->params[0] = 0;
+    w->rfs->params[1] = 1;
+  }
+  else if (!strcmp(csd->simtype,"mc-t")) {
+    w->rfs->name = strcpyalloc("t");
+    w->rfs->params[0] = mriglm->glm->dof;
+  }
+  else {
+    // perm draws from [0,1), mc-full --uniform from [min,max)
+    w->rfs->name = strcpyalloc("uniform");
+    w->rfs->params[0] = 0;
+    w->rfs->params[1] = 1;
+    if (!strcmp(csd->simtype,"mc-full")) {
+      w->rfs->params[0] = UniformMin;
+      w->rfs->params[1] = UniformMax;
+    }
+  }
+  if (!strcmp(csd->simtype,"mc-z") || !strcmp(csd->simtype,"mc-t")) {
+    w->z = MRIcloneBySpace(mriglm->y,MRI_FLOAT,1);
+    w->zabs = MRIcloneBySpace(mriglm->y,MRI_FLOAT,1);
+  }
+  return(w);
+}
+
+/*--------------------------------------------------------------------
+  SimWorkerFree() - frees everything SimWorkerAlloc() and SimIteration()
+  allocated for the worker. The mask, the contrast names, and y (unless
+  synthesized) belong to the main MRIGLM and are left alone.
+  --------------------------------------------------------------------*/
+static int SimWorkerFree(SIMWORKER **pw) {
+  SIMWORKER *w = *pw;
+  MRIGLM *wglm = w->mriglm;
+  int n;
+
+  for (n=0; n < wglm->glm->ncontrasts; n++) {
+    if(wglm->gamma[n])    MRIfree(&wglm->gamma[n]);
+    if(wglm->gammaVar[n]) MRIfree(&wglm->gammaVar[n]);
+    if(wglm->F[n])        MRIfree(&wglm->F[n]);
+    if(wglm->p[n])        MRIfree(&wglm->p[n]);
+    if(wglm->z[n])        MRIfree(&wglm->z[n]);
+    if(wglm->pcc[n])      MRIfree(&wglm->pcc[n]);
+    if(wglm->ypmf[n])     MRIfree(&wglm->ypmf[n]);
+    wglm->glm->Cname[n] = NULL;
+  }
+  if(wglm->beta) MRIfree(&wglm->beta);
+  if(wglm->eres) MRIfree(&wglm->eres);
+  if(wglm->rvar) MRIfree(&wglm->rvar);
+  if(wglm->yhat) MRIfree(&wglm->yhat);
+  if(wglm->cond) MRIfree(&wglm->cond);
+  if(wglm->y != mriglm->y) MRIfree(&wglm->y);
+  MatrixFree(&wglm->Xg);
+  GLMfree(&wglm->glm);
+  free(wglm);
+
+  if(w->surf) MRISfree(&w->surf);
+  RFspecFree(&w->rfs);
+  if(w->z)       MRIfree(&w->z);
+  if(w->zabs)    MRIfree(&w->zabs);
+  if(w->p)       MRIfree(&w->p);
+  if(w->sig)     MRIfree(&w->sig);
+  if(w->tfce)    MRIfree(&w->tfce);
+  if(w->tfcesig) MRIfree(&w->tfcesig);
+  free(w);
+  *pw = NULL;
+  return(0);
+}
+
+/*--------------------------------------------------------------------
+  SimIteration() - runs one simulation iteration with the worker's
+  private state and stores the max cluster size, max sig, and max
+  stat of every thresh/sign/contrast in the nthsim'th slot of the
+  corresponding csdList entry. Does the same computations as one
+  pass of the serial simulation loop in main().
+  --------------------------------------------------------------------*/
+static int SimIteration(SIMWORKER *w, int nthsim) {
+  MRIGLM *wglm = w->mriglm;
+  int n, f, k, j, tt, ts, tSign, tnClusters, tcmax, trmax, tsmax;
+  double tsigmax, tFmax, tcsize, tthreshadj;
+  CSD *tcsd;
+  MRI *tfcein;
+  SURFCLUSTERSUM *tSurfClustList;
+  VOLCLUSTER **tVolClustList;
+  int *order;
+
+  RFspecSetSeed(w->rfs,SimIterSeed(csd->seed,nthsim));
+
+  if (!strcmp(csd->simtype,"mc-full")) {
+    RFsynth(wglm->y,w->rfs,NULL);
+    if(logflag) MRIlog(wglm->y,wglm->mask,-1,1,wglm->y);
+    if(FWHM > 0) SmoothSurfOrVol(w->surf, wglm->y, wglm->mask, SmoothLevel);
+  }
+  if (!strcmp(csd->simtype,"perm")) {
+    if (!OneSamplePerm) {
+      // Fisher-Yates shuffle of the rows of the original design
+      order = (int *) calloc(mriglm->Xg->rows,sizeof(int));
+      for (k=0; k < mriglm->Xg->rows; k++) order[k] = k;
+      for (k=mriglm->Xg->rows-1; k > 0; k--) {
+        j = (int)floor(RFdrawVal(w->rfs)*(k+1));
+        if (j > k) j = k;
+        f = order[k]; order[k] = order[j]; order[j] = f;
+      }
+      for (k=0; k < mriglm->Xg->rows; k++)
+        for (j=0; j < mriglm->Xg->cols; j++)
+          wglm->Xg->rptr[k+1][j+1] = mriglm->Xg->rptr[order[k]+1][j+1];
+      free(order);
+    }
+    else {
+      for (f=0; f < wglm->y->nframes; f++) {
+        if (RFdrawVal(w->rfs) > 0.5) wglm->Xg->rptr[f+1][1] = +1;
+        else                         wglm->Xg->rptr[f+1][1] = -1;
+      }
+    }
+  }
+  if (!strcmp(csd->simtype,"mc-full") || !strcmp(csd->simtype,"perm"))
+    MRIglmFitAndTest(wglm);
+
+  for (n=0; n < mriglm->glm->ncontrasts; n++) {
+    if (!strcmp(csd->simtype,"mc-z") || !strcmp(csd->simtype,"mc-t")) {
+      // One z (or t) field per contrast, used for all thresholds and signs
+      RFsynth(w->z,w->rfs,wglm->mask);
+      if (SmoothLevel > 0) {
+        SmoothSurfOrVol(w->surf, w->z, wglm->mask, SmoothLevel);
+        RFrescale(w->z,w->rfs,wglm->mask,w->z);
+      }
+      w->zabs = MRIabs(w->z,w->zabs);
+      w->p = RFstat2P(w->zabs,w->rfs,wglm->mask,0,w->p);
+      MRIscalarMul(w->p,w->p,2);
+    }
+    for(tt = 0; tt < nThreshList; tt++){
+      for(ts = 0; ts < nSignList; ts++){
+        tcsd = csdList[tt][ts][n];
+        tSign = (int)round(tcsd->threshsign);
+        if(tSign == 0) tthreshadj = tcsd->thresh;
+        else           tthreshadj = tcsd->thresh - log10(2.0); // one-sided test
+
+        if (!strcmp(csd->simtype,"mc-full") || !strcmp(csd->simtype,"perm")) {
+          w->sig = MRIlog10(wglm->p[n],NULL,w->sig,1);
+          if(tSign != 0) MRIsetSign(w->sig,wglm->gamma[n],0);
+          tsigmax = MRIframeMax(w->sig,0,wglm->mask,tSign,&tcmax,&trmax,&tsmax);
+          tFmax = MRIgetVoxVal(wglm->F[n],tcmax,trmax,tsmax,0);
+          if(tSign != 0) tFmax = tFmax*SIGN(tsigmax);
+        }
+        else {
+          w->sig = MRIlog10(w->p,NULL,w->sig,1);
+          if(tSign != 0) MRIsetSign(w->sig,w->z,0);
+          tsigmax = MRIframeMax(w->sig,0,wglm->mask,tSign,&tcmax,&trmax,&tsmax);
+          tFmax = MRIgetVoxVal(w->z,tcmax,trmax,tsmax,0);
+          if(tSign == 0) tFmax = fabs(tFmax);
+        }
+        if(wglm->mask) MRImask(w->sig,wglm->mask,w->sig,0.0,0.0);
+
+        if(w->surf) {
+          MRIScopyMRI(w->surf, w->sig, 0, "val");
+          tSurfClustList = sclustMapSurfClusters(w->surf,tthreshadj,-1,tSign,
+                                                 0,&tnClusters,NULL,NULL);
+          tcsize = sclustMaxClusterArea(tSurfClustList, tnClusters);
+          free(tSurfClustList);
+        }
+        else {
+          tVolClustList = clustGetClusters(w->sig, 0, tthreshadj,-1,tSign,0,
+                                           wglm->mask, &tnClusters, NULL);
+          tcsize = voxelsize*clustMaxClusterCount(tVolClustList,tnClusters);
+          clustFreeClusterList(&tVolClustList,tnClusters);
+        }
+        if(debug) printf("%s %d nc=%d  maxcsize=%g  sigmax=%g  Fmax=%g\n",
+                         mriglm->glm->Cname[n],nthsim,tnClusters,tcsize,tsigmax,tFmax);
+
+        // The TFCE does not depend on the threshold, only on the sign.
+        // As for tfce.mgh, it is of the signed sig even when the
+        // clustering is abs, so that the tails are not merged.
+        if(DoTFCE){
+          if(tt == 0){
+            tfcein = w->sig;
+            if(tSign == 0 && mriglm->glm->C[n]->rows == 1){
+              w->tfcesig = MRIcopy(w->sig,w->tfcesig);
+              MRIsetSign(w->tfcesig,wglm->gamma[n],0); // perm only
+              tfcein = w->tfcesig;
+            }
+            w->tfce = TFCESurfOrVol(w->surf, tfcein, wglm->mask, tSign, w->tfce);
+            tcsd->MaxTFCE[nthsim] = MRIframeMax(w->tfce,0,wglm->mask,tSign,&tcmax,&trmax,&tsmax);
+          }
+          else tcsd->MaxTFCE[nthsim] = csdList[0][ts][n]->MaxTFCE[nthsim];
+        }
+
+        tcsd->nClusters[nthsim] = tnClusters;
+        tcsd->MaxClusterSize[nthsim] = tcsize;
+        tcsd->MaxSig[nthsim] = tsigmax;
+        tcsd->MaxStat[nthsim] = tFmax;
+      }
+    }
+  }
+  return(0);
+}
+
+/*--------------------------------------------------------------------
+  SimScheduler() - runs the simulation iterations in parallel, one
+  iteration per thread at a time, each thread with its own SIMWORKER.
+  Iteration i always uses the random stream SimIterSeed(seed,i) and
+  stores its results in slot i of each CSD, so the output is the same
+  for any number of threads. Completed iterations are committed in
+  order; whenever the completed prefix grows (at most every
+  SimCheckpointSec seconds, and at the end) all CSD files are
+  rewritten with that prefix, so an interrupted run leaves valid
+  CSD files behind. With --sim-resume, the iterations already in the
+  CSD files are loaded and the simulation starts after the shortest
+  of them. Returns the number of iterations done.
+  --------------------------------------------------------------------*/
+static int SimScheduler(void) {
+  int n, tt, ts, nthreads, nstart, ncommitted, nwritten, *done;
+  char fname[2000], tfcefname[2000];
+  double lastwrite;
+  CSD *tcsd, *csdr;
+  SIMWORKER **workers;
+
+  // Sign and name of each CSD (F-tests are always abs)
+  for(tt = 0; tt < nThreshList; tt++){
+    for(ts = 0; ts < nSignList; ts++){
+      for (n=0; n < mriglm->glm->ncontrasts; n++) {
+        tcsd = csdList[tt][ts][n];
+        tcsd->threshsign = SignList[ts];
+        if(mriglm->glm->C[n]->rows > 1) tcsd->threshsign = 0;
+        strcpy(tcsd->contrast,mriglm->glm->Cname[n]);
+      }
+    }
+  }
+
+  // Resume from the CSD files of a previous run with the same seed
+  nstart = 0;
+  if(SimResume){
+    nstart = nsim;
+    for(tt = 0; tt < nThreshList; tt++){
+      for(ts = 0; ts < nSignList; ts++){
+        for (n=0; n < mriglm->glm->ncontrasts; n++) {
+          tcsd = csdList[tt][ts][n];
+          SimCSDFileName(tcsd, n, fname);
+          if(!fio_FileExistsReadable(fname)) {nstart = 0; continue;}
+          if(tcsd->tfce){
+            CSDtfceFileName(fname, tfcefname);
+            if(!fio_FileExistsReadable(tfcefname)) {nstart = 0; continue;}
+          }
+          csdr = CSDread(fname);
+          if(csdr == NULL) exit(1);
+          if(csdr->seed != tcsd->seed || strcmp(csdr->simtype,tcsd->simtype) ||
+             fabs(csdr->thresh - tcsd->thresh) > 1e-4 || csdr->threshsign != tcsd->threshsign ||
+             csdr->tfce != tcsd->tfce){
+            printf("ERROR: cannot resume from %s, it was created with a different\n",fname);
+            printf("  seed (%ld), simulation type, threshold, sign, or tfce setting\n",csdr->seed);
+            exit(1);
+          }
+          nstart = MIN(nstart,MIN(csdr->nreps,nsim));
+          for(int k=0; k < MIN(csdr->nreps,nsim); k++){
+            tcsd->nClusters[k] = csdr->nClusters[k];
+            tcsd->MaxClusterSize[k] = csdr->MaxClusterSize[k];
+            tcsd->MaxSig[k] = csdr->MaxSig[k];
+            tcsd->MaxStat[k] = csdr->MaxStat[k];
+            tcsd->MaxTFCE[k] = csdr->MaxTFCE[k];
+          }
+          CSDfreeData(csdr);
+          free(csdr);
+        }
+      }
+    }
+    printf("Resuming simulation at iteration %d\n",nstart);
+  }
+
+  nthreads = omp_get_max_threads();
+  printf("Running %d simulation iterations with %d threads\n",nsim-nstart,nthreads);
+  workers = (SIMWORKER **) calloc(nthreads,sizeof(SIMWORKER *));
+  for(n=0; n < nthreads; n++) workers[n] = SimWorkerAlloc();
+
+  done = (int *) calloc(nsim+1,sizeof(int));
+  for(n=0; n < nstart; n++) done[n] = 1;
+  ncommitted = nstart;
+  nwritten = -1;
+  lastwrite = mytimer.seconds();
+
+  int nthsim;
+  ROMP_PF_begin
+  #ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic,1)
+  #endif
+  for(nthsim = nstart; nthsim < nsim; nthsim++){
+    ROMP_PFLB_begin
+    SimIteration(workers[omp_get_thread_num()], nthsim);
+
+    #ifdef HAVE_OPENMP
+    #pragma omp critical(sim_commit)
+    #endif
+    {
+      done[nthsim] = 1;
+      while(ncommitted < nsim && done[ncommitted]) ncommitted++;
+      if(debug || Gdiag_no > 0)
+        printf("%d/%d done, %d committed t=%g\n",nthsim+1,nsim,ncommitted,mytimer.minutes());
+      if(ncommitted > nwritten && ncommitted < nsim &&
+         mytimer.seconds() - lastwrite > SimCheckpointSec){
+        for(int t = 0; t < nThreshList; t++){
+          for(int s = 0; s < nSignList; s++){
+            for (int c=0; c < mriglm->glm->ncontrasts; c++) {
+              csdList[t][s][c]->nreps = ncommitted;
+              SimWriteCSD(csdList[t][s][c], c, mytimer.minutes());
+              csdList[t][s][c]->nreps = nsim;
+            }
+          }
+        }
+        nwritten = ncommitted;
+        lastwrite = mytimer.seconds();
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  // Final write of all the iterations
+  for(tt = 0; tt < nThreshList; tt++){
+    for(ts = 0; ts < nSignList; ts++){
+      for (n=0; n < mriglm->glm->ncontrasts; n++) {
+        tcsd = csdList[tt][ts][n];
+        tcsd->nreps = nsim;
+        SimWriteCSD(tcsd, n, mytimer.minutes());
+      }
+    }
+  }
+  for(n=0; n < nthreads; n++) SimWorkerFree(&workers[n]);
+  free(workers);
+  free(done);
+  return(nsim);
+}
@@ -23,3 +23,86 @@ done
 for f in F.mgh gamma.mgh sig.mgh; do
     compare_vol ${actual}/age/${f} ${expected}/age/${f} --thresh 0.008
 done
+
+# the per-voxel fitting path (no tiling) must give the same results
+FS_GLM_TILE=0 test_command mri_glmfit \
+    --seed 1234 \
+    --y lh.gender_age.thickness.10.mgh \
+    --fsgd gender_age.txt doss \
+    --no-cortex \
+    --glmdir lh.gender_age.glmdir \
+    --surf average lh \
+    --C age.mat
+
+for f in beta.mgh rstd.mgh rvar.mgh; do
+    compare_vol ${actual}/${f} ${expected}/${f} --thresh 0.00007
+done
+
+for f in F.mgh gamma.mgh sig.mgh; do
+    compare_vol ${actual}/age/${f} ${expected}/age/${f} --thresh 0.008
+done
+
+# a small permutation simulation with tfce; resuming the finished
+# simulation must read back the same max tfce and rewrite it unchanged
+test_command mri_glmfit \
+    --seed 1234 \
+    --y lh.gender_age.thickness.10.mgh \
+    --fsgd gender_age.txt doss \
+    --no-cortex \
+    --glmdir lh.gender_age.glmdir \
+    --surf average lh \
+    --C age.mat \
+    --sim perm 5 2 tfce.sim \
+    --sim-sign abs \
+    --tfce
+
+cp tfce.sim-age.csd tfce.sim-age.ref.csd
+cp tfce.sim-age.maxtfce.dat tfce.sim-age.maxtfce.ref.dat
+
+FSTEST_NO_DATA_RESET=1 test_command mri_glmfit \
+    --seed 1234 \
+    --y lh.gender_age.thickness.10.mgh \
+    --fsgd gender_age.txt doss \
+    --no-cortex \
+    --glmdir lh.gender_age.glmdir \
+    --surf average lh \
+    --C age.mat \
+    --sim perm 5 2 tfce.sim \
+    --sim-sign abs \
+    --sim-resume \
+    --tfce
+
+compare_file tfce.sim-age.maxtfce.dat tfce.sim-age.maxtfce.ref.dat
+compare_file tfce.sim-age.csd tfce.sim-age.ref.csd -I runtime_min -I hostname -I machine
+
+# the threaded simulation gives every iteration its own random stream,
+# so a fixed-seed simulation must write the same CSD for any number of
+# threads
+test_command mri_glmfit \
+    --seed 1234 \
+    --y lh.gender_age.thickness.10.mgh \
+    --fsgd gender_age.txt doss \
+    --no-cortex \
+    --glmdir lh.gender_age.glmdir \
+    --surf average lh \
+    --C age.mat \
+    --sim perm 10 2 thr1.sim \
+    --sim-sign abs \
+    --tfce \
+    --threads 1
+
+FSTEST_NO_DATA_RESET=1 test_command mri_glmfit \
+    --seed 1234 \
+    --y lh.gender_age.thickness.10.mgh \
+    --fsgd gender_age.txt doss \
+    --no-cortex \
+    --glmdir lh.gender_age.glmdir \
+    --surf average lh \
+    --C age.mat \
+    --sim perm 10 2 thr4.sim \
+    --sim-sign abs \
+    --tfce \
+    --threads 4
+
+compare_file thr4.sim-age.maxtfce.dat thr1.sim-age.maxtfce.dat
+compare_file thr4.sim-age.csd thr1.sim-age.csd -I runtime_min -I hostname -I machine
@@ -604,8 +604,7 @@ int main(int argc, char *argv[])
   if(Gdiag_no > 0) PrintMemUsage(stdout);
   PrintMemUsage(logfp);
   mytimer.reset();
-  GTMbuildX(gtm);
-  if(gtm->X==NULL) exit(1);
+  if(GTMbuildX(gtm)) exit(1);
   printf(" gtm build time %4.1f sec\n",mytimer.seconds());fflush(stdout);
   fprintf(logfp,"GTM-Build-time %4.1f sec\n",mytimer.seconds());fflush(logfp);
   if(Gdiag_no > 0) PrintMemUsage(stdout);
@@ -728,10 +727,9 @@ int main(int argc, char *argv[])
       if(Gdiag_no > 0) PrintMemUsage(stdout);
       PrintMemUsage(logfp);
       mytimer.reset();
-      MatrixFree(&gtm->X);
-      MatrixFree(&gtm->X0);
-      GTMbuildX(gtm);
-      if(gtm->X==NULL) exit(1);
+      GTMfreeX(gtm,0);
+      GTMfreeX(gtm,1);
+      if(GTMbuildX(gtm)) exit(1);
       printf(" gtm build time %4.1f sec\n", mytimer.seconds()); fflush(stdout);
       fprintf(logfp,"GTM-rebuild-time %4.1f sec\n", mytimer.seconds()); fflush(logfp);
       if(Gdiag_no > 0) PrintMemUsage(stdout);
@@ -747,12 +745,16 @@ int main(int argc, char *argv[])
   //printf("Freeing segpvf\n"); fflush(stdout);
   //MRIfree(&gtm->segpvf);
   if(SaveX0) {
-    printf("Writing X0 to %s\n",Xfile);
-    MatlabWrite(gtm->X0, X0file,"X0");
+    MATRIX *Xdense = GTMxDense(gtm,1);
+    printf("Writing X0 to %s\n",X0file);
+    MatlabWrite(Xdense, X0file,"X0");
+    MatrixFree(&Xdense);
   }
   if(SaveX) {
+    MATRIX *Xdense = GTMxDense(gtm,0);
     printf("Writing X to %s\n",Xfile);
-    MatlabWrite(gtm->X, Xfile,"X");
+    MatlabWrite(Xdense, Xfile,"X");
+    MatrixFree(&Xdense);
   }
 
   printf("Solving ...\n");
@@ -767,14 +769,13 @@ int main(int argc, char *argv[])
   if(Gdiag_no > 0) PrintMemUsage(stdout);
   PrintMemUsage(logfp);
 
-  if(gtm->X0 && DoGTMMat){
-    MATRIX *X0tX0, *X0t,*X0tX,*iX0tX0,*gtmmat;
+  if(GTMhaveX(gtm,1) && DoGTMMat){
+    MATRIX *X0tX0,*X0tX,*iX0tX0,*gtmmat;
     printf("Computing actual GTM Matrix\n"); fflush(stdout);
-    X0tX0 = MatrixMtM(gtm->X0,NULL);
+    X0tX0 = GTMxtx(gtm,1,1,NULL);
     iX0tX0 = MatrixInverse(X0tX0,NULL);
 
-    X0t = MatrixTranspose(gtm->X0,NULL);
-    X0tX = MatrixMultiplyD(X0t,gtm->X,NULL);
+    X0tX = GTMxtx(gtm,1,0,NULL);
     gtmmat = MatrixMultiplyD(iX0tX0,X0tX,NULL);
     sprintf(tmpstr,"%s/gtm.mat",AuxDir);
     MatrixWriteTxt(tmpstr,gtmmat);
@@ -782,7 +783,6 @@ int main(int argc, char *argv[])
     sprintf(tmpstr,"%s/gtm.inv.mat",AuxDir);
     MatrixWriteTxt(tmpstr,gtmmat);
     printf("done computing gtm matrix\n"); fflush(stdout);
-    MatrixFree(&X0t);
     MatrixFree(&X0tX0);
     MatrixFree(&X0tX);
     MatrixFree(&gtmmat);
@@ -909,7 +909,7 @@ int main(int argc, char *argv[])
   MRIfree(&mritmp);
 
   printf("Freeing X\n");
-  MatrixFree(&gtm->X);
+  GTMfreeX(gtm,0);
 
   nopvc = GTMnoPVC(gtm);
   sprintf(tmpstr,"%s/nopvc.nii.gz",OutDir);
@@ -991,7 +991,7 @@ int main(int argc, char *argv[])
   if(yhat0File) MRIwrite(gtm->ysynth,yhat0File);
   
   printf("Freeing X0\n");
-  MatrixFree(&gtm->X0);
+  GTMfreeX(gtm,1);
 
 
   if(yhatFile|| yhatFullFoVFile){
@@ -1212,6 +1212,8 @@ static int parse_commandline(int argc, char **argv) {
     else if(!strcasecmp(option, "--nocheckopts")) checkoptsonly = 0;
     else if(!strcasecmp(option, "--gtmmat")) DoGTMMat = 1;
     else if(!strcasecmp(option, "--no-gtmmat")) DoGTMMat = 0;
+    else if(!strcasecmp(option, "--dense-x")) gtm->UseSparseX = 0;
+    else if(!strcasecmp(option, "--sparse-x")) gtm->UseSparseX = 1;
     else if(!strcasecmp(option, "--no-tfe"))      gtm->DoVoxFracCor=0;
     else if(!strcasecmp(option, "--no-vfc"))      gtm->DoVoxFracCor=0;
     else if(!strcasecmp(option, "--no-vox-frac")) gtm->DoVoxFracCor=0;
@@ -1710,6 +1712,7 @@ static void print_usage(void) {
   printf("   --ss bpc scale dcf : steady-state analysis spec blood plasma concentration, unit scale\n");
   printf("     and decay correction factor. You must also spec --km-ref. Turns off rescaling\n");
   printf("\n");
+  printf("   --dense-x : store the GTM design matrix as a full matrix instead of a sparse one (uses more memory)\n");
   printf("   --X : save X matrix in matlab4 format as X.mat (it will be big)\n");
   printf("   --y : save y matrix in matlab4 format as y.mat\n");
   printf("   --beta : save beta matrix in matlab4 format as beta.mat\n");
@@ -2078,8 +2081,7 @@ double GTMcostPSF(GTM *gtm)
 
   GTMpsfStd(gtm);
 
-  GTMbuildX(gtm);
-  if(gtm->X==NULL) exit(1);
+  if(GTMbuildX(gtm)) exit(1);
 
   err=GTMsolve(gtm); 
   GTMrvarGM(gtm);
@@ -2403,6 +2405,21 @@ int GTMsom(GTM *gtm)
   gtm->som = MatrixAlloc(gtm->nsegs,gtm->nsegs,MATRIX_REAL);
 
   f = 0; // only one frame with the matrix
+  if(gtm->Xs){
+    // Only the non-zero entries of each column of X contribute
+    int *rownthseg = GTMrowNthSeg(gtm);
+    long n;
+    for(cthseg=0; cthseg < gtm->nsegs; cthseg++){
+      cbeta = gtm->beta->rptr[cthseg+1][f+1];
+      for(n=gtm->Xs->colptr[cthseg]; n < gtm->Xs->colptr[cthseg+1]; n++){
+	rthseg = rownthseg[gtm->Xs->rowind[n]];
+	if(rthseg < 0) continue;
+	gtm->som->rptr[rthseg+1][cthseg+1] += cbeta*gtm->Xs->val[n];
+      }
+    }
+    free(rownthseg);
+  }
+  else
   for(cthseg=0; cthseg < gtm->nsegs; cthseg++){
     k = 0;
     cbeta = gtm->beta->rptr[cthseg+1][f+1];
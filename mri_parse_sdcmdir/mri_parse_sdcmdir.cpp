@@ -281,6 +281,10 @@ static int parse_commandline(int argc, char **argv) {
       fprintf(fptmp,"0\n");
       fclose(fptmp);
       nargsused = 1;
+    } else if (!strcmp(option, "--index")) {
+      if (nargc < 1) argnerr(option,1);
+      SDCMIndexFile = strcpyalloc(pargv[0]);
+      nargsused = 1;
     } else if (!strcmp(option, "--sortbyrun")) {
       sortbyrun = 1;
     } else {
@@ -308,6 +312,7 @@ static void print_usage(void) {
   fprintf(stdout, "   --sortbyrun    : assign run numbers\n");
   fprintf(stdout, "   --summarize    : only print out info for run leaders\n");
   fprintf(stdout, "   --dwi          : try to read dwi params. Generally no need to.\n");
+  fprintf(stdout, "   --index file   : keep an index of the dicom headers in file\n");
   fprintf(stdout, "   --help         : how to use this program \n");
   fprintf(stdout, "\n");
 }
@@ -358,6 +363,12 @@ static void print_help(void) {
   printf("  --summarize : forces print out of information for the first file in the run.\n");
   printf("\n");
 
+  printf("  --index file : keep the header info of each file in the given index file.\n");
+  printf("      Files that have not changed since the index was written are not read\n");
+  printf("      again. Setting FS_SDCM_INDEX=1 in the environment keeps the index in\n");
+  printf("      sdicomdir/.sdcmindex instead.\n");
+  printf("\n");
+
   printf(
     "BUGS:\n"
     "Prior to 5/25/05, the protocol name was stripped of anything that\n"
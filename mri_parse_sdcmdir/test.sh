@@ -3,3 +3,16 @@ source "$(dirname $0)/../test.sh"
 
 test_command mri_parse_sdcmdir --sortbyrun --d . --o dicomdir.sumfile
 compare_file dicomdir.sumfile dicomdir.ref.sumfile
+
+# with the header index: the first run scans the directory and writes .sdcmindex,
+# the second one takes every entry from the index, and both must match the fresh scan
+FS_SDCM_INDEX=1 test_command mri_parse_sdcmdir --sortbyrun --d . --o dicomdir.sumfile
+test -s .sdcmindex
+compare_file dicomdir.sumfile dicomdir.ref.sumfile
+FS_SDCM_INDEX=1 FSTEST_NO_DATA_RESET=1 test_command mri_parse_sdcmdir --sortbyrun --d . --o dicomdir.sumfile
+compare_file dicomdir.sumfile dicomdir.ref.sumfile
+
+# a file that changed since the index was written is parsed again
+touch -d "2 days ago" $(grep -v "^sdcmindex" .sdcmindex | awk -F'\t' '$4 == 1 {print $1; exit}')
+FS_SDCM_INDEX=1 FSTEST_NO_DATA_RESET=1 test_command mri_parse_sdcmdir --sortbyrun --d . --o dicomdir.sumfile
+compare_file dicomdir.sumfile dicomdir.ref.sumfile
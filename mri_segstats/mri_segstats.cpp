@@ -89,6 +89,8 @@ static void print_version(void) ;
 static void argnerr(char *option, int n);
 static void dump_options(FILE *fp);
 static int  singledash(char *flag);
+static int  CompareSegIdIndex(const void *a, const void *b);
+static void SegSurfaceArea(MRIS *mris, MRI *seg, int nsegid, const int *segidarray, float *segarea);
 
 
 int MRIsegCount(MRI *seg, int id, int frame);
@@ -793,6 +795,28 @@ int main(int argc, char **argv)
   printf("Computing statistics for each segmentation\n");
   fflush(stdout);
 
+  // Count and compute the stats of all the segmentations in one pass
+  // over the volumes rather than one pass per segmentation
+  int *segidarray = (int *) calloc(sizeof(int),nsegid);
+  int *segnhits = (int *) calloc(sizeof(int),nsegid);
+  float *segmin = (float *) calloc(sizeof(float),nsegid);
+  float *segmax = (float *) calloc(sizeof(float),nsegid);
+  float *segrange = (float *) calloc(sizeof(float),nsegid);
+  float *segmean = (float *) calloc(sizeof(float),nsegid);
+  float *segstd = (float *) calloc(sizeof(float),nsegid);
+  for (n=0; n < nsegid; n++) segidarray[n] = StatSumTable[n].id;
+  float *segarea = NULL;
+  if (!dontrun)
+  {
+    MRIsegStatsMulti(seg, nsegid, segidarray, (InVolFile != NULL) ? invol : NULL, frame,
+                     UseRobust, RobustPct, segnhits, segmin, segmax, segrange, segmean, segstd);
+    if (mris)
+    {
+      segarea = (float *) calloc(sizeof(float),nsegid);
+      SegSurfaceArea(mris, seg, nsegid, segidarray, segarea);
+    }
+  }
+
   DoContinue=0;nx=0;skip=0;n0=0;vol=0;nhits=0;c=0;min=0.0;max=0.0;range=0.0;mean=0.0;std=0.0;snr=0.0;
 
   ROMP_PF_begin
@@ -837,36 +861,20 @@ int main(int argc, char **argv)
       {
         if (pvvol == NULL)
         {
-          nhits = MRIsegCount(seg, StatSumTable[n].id, 0);
+          nhits = segnhits[n];
           vol = nhits*voxelvolume;
         }
         else
         {
           vol = MRIvoxelsInLabelWithPartialVolumeEffects(seg, pvvol, StatSumTable[n].id, NULL, NULL);
-          nhits = MRIsegCount(seg, StatSumTable[n].id, 0);
+          nhits = segnhits[n];
 //          nhits = nint(vol/voxelvolume);
         }
       }
       else
       {
-        // Compute area here
-        nhits = 0;
-        vol = 0;
-        for (c=0; c < mris->nvertices; c++)
-        {
-          if (MRIgetVoxVal(seg,c,0,0,0)==StatSumTable[n].id)
-          {
-            nhits++;
-            if (mris->group_avg_vtxarea_loaded)
-            {
-              vol += mris->vertices[c].group_avg_area;
-            }
-            else
-            {
-              vol += mris->vertices[c].area;
-            }
-          }
-        }
+        nhits = segnhits[n];
+        vol = segarea[n];
       }
     }
     else
@@ -880,13 +888,11 @@ int main(int argc, char **argv)
     {
       if (nhits > 0)
       {
-        if(UseRobust == 0)
-          MRIsegStats(seg, StatSumTable[n].id, invol, frame,
-            &min, &max, &range, &mean, &std);
-        else
-          MRIsegStatsRobust(seg, StatSumTable[n].id, invol, frame,
-            &min, &max, &range, &mean, &std, RobustPct);
-
+        min   = segmin[n];
+        max   = segmax[n];
+        range = segrange[n];
+        mean  = segmean[n];
+        std   = segstd[n];
         snr = mean/std;
       }
       else
@@ -909,6 +915,15 @@ int main(int argc, char **argv)
     ROMP_PFLB_end
   }
   ROMP_PF_end
+
+  free(segidarray);
+  free(segnhits);
+  free(segmin);
+  free(segmax);
+  free(segrange);
+  free(segmean);
+  free(segstd);
+  if (segarea) free(segarea);
   
   /* print results ordered */
   for (n=0; n < nsegid; n++)
@@ -1396,11 +1411,12 @@ int main(int argc, char **argv)
     for (n=0; n < nsegid; n++)
       favg[n] = (double *) calloc(sizeof(double),invol->nframes);
     favgmn = (double *) calloc(sizeof(double *),nsegid);
+    int *segidarray = (int *) calloc(sizeof(int),nsegid);
+    int *segnvox = (int *) calloc(sizeof(int),nsegid);
+    for (n=0; n < nsegid; n++) segidarray[n] = StatSumTable[n].id;
+    MRIsegFrameAvgMulti(seg, nsegid, segidarray, invol, segnvox, favg);
     for (n=0; n < nsegid; n++) {
-      printf("%3d",n);
-      if (n%20 == 19) printf("\n");
-      fflush(stdout);
-      nvox = MRIsegFrameAvg(seg, StatSumTable[n].id, invol, favg[n]);
+      nvox = segnvox[n];
       favgmn[n] = 0.0;
       for(f=0; f < invol->nframes; f++) {
 	if(DoFrameSum) favg[n][f] *= nvox; // Undo spatial average
@@ -1409,7 +1425,8 @@ int main(int argc, char **argv)
       favgmn[n] /= invol->nframes;
       if(RmFrameAvgMn) for(f=0; f < invol->nframes; f++) favg[n][f] -= favgmn[n];
     }
-    printf("\n");
+    free(segidarray);
+    free(segnvox);
 
     // Save mean over space and frames in simple text file
     // Each seg on a separate line
@@ -2163,6 +2180,42 @@ static void dump_options(FILE *fp)
   return;
 }
 /*---------------------------------------------------------------*/
+static int CompareSegIdIndex(const void *a, const void *b)
+{
+  const int *ia = (const int *) a, *ib = (const int *) b;
+  if (ia[0] < ib[0]) return(-1);
+  if (ia[0] > ib[0]) return(+1);
+  return(0);
+}
+/*---------------------------------------------------------------*/
+/* Sums the (group average) vertex area of every segmentation in one
+   pass over the vertices. Each sum is accumulated in vertex order, as
+   the per-segmentation loop did */
+static void SegSurfaceArea(MRIS *mris, MRI *seg, int nsegid, const int *segidarray, float *segarea)
+{
+  int n, c, key[2], *hit;
+  int *idindex = (int *) calloc(sizeof(int),2*nsegid);
+
+  for (n=0; n < nsegid; n++)
+  {
+    idindex[2*n]   = segidarray[n];
+    idindex[2*n+1] = n;
+    segarea[n] = 0;
+  }
+  qsort(idindex, nsegid, 2*sizeof(int), CompareSegIdIndex);
+  for (c=0; c < mris->nvertices; c++)
+  {
+    key[0] = nint(MRIgetVoxVal(seg,c,0,0,0));
+    hit = (int *) bsearch(key, idindex, nsegid, 2*sizeof(int), CompareSegIdIndex);
+    if (hit == NULL) continue;
+    if (mris->group_avg_vtxarea_loaded)
+      segarea[hit[1]] += mris->vertices[c].group_avg_area;
+    else
+      segarea[hit[1]] += mris->vertices[c].area;
+  }
+  free(idindex);
+}
+/*---------------------------------------------------------------*/
 static int singledash(char *flag)
 {
   int len;
@@ -154,6 +154,7 @@ int AdjustThreshWhenOneTail=1;
 char *voxwisesigfile=NULL;
 MRI  *voxwisesig;
 char *maxvoxwisesigfile=NULL;
+char *tfcesigfile=NULL;
 int ReallyUseAverage7 = 0;
 double fwhm = -1;
 double fdr = -1;
@@ -394,6 +395,24 @@ int main(int argc, char **argv) {
     }
   }
 
+  if(tfcesigfile) {
+    // TFCE of the masked input with the exponents of the simulation,
+    // corrected with the max TFCE of each permutation
+    double maxmaxsig;
+    int tfcesign = 0;
+    MRI *tfce;
+    if(csd->threshsign > +0.5) tfcesign = +1;
+    if(csd->threshsign < -0.5) tfcesign = -1;
+    printf("Computing TFCE vertex-wise significance\n");
+    srcval = MRIcopyMRIS(NULL,srcsurf,0,"val");
+    tfce = MRIStfce(srcsurf, srcval, 0, NULL, tfcesign, csd->tfceE, csd->tfceH, NULL);
+    voxwisesig = CSDpvalMaxTFCEMap(tfce, csd, NULL, NULL, &maxmaxsig, Bonferroni);
+    MRIwrite(voxwisesig,tfcesigfile);
+    MRIfree(&tfce);
+    MRIfree(&srcval);
+    MRIfree(&voxwisesig);
+  }
+
   if(fdr > 0){
     printf("Setting voxel-wise threshold with FDR = %lf\n",fdr);
     printf("Assuming input map is -log10(p)\n");
@@ -949,6 +968,11 @@ static int parse_commandline(int argc, char **argv) {
       maxvoxwisesigfile = pargv[0];
       nargsused = 1;
     } 
+    else if (!strcmp(option, "--tfce-vwsig")) {
+      if(nargc < 1) argnerr(option,1);
+      tfcesigfile = pargv[0];
+      nargsused = 1;
+    } 
     else if (!strcmp(option, "--olab")) {
       if (nargc < 1) argnerr(option,1);
       outlabelbase = pargv[0];
@@ -1030,6 +1054,7 @@ static void print_usage(void) {
   printf("\n");
   printf("   --csd csdfile <--csd csdfile ...>\n");
   printf("   --vwsig vwsig : map of corrected voxel-wise significances\n");
+  printf("   --tfce-vwsig vwsig : map of TFCE-corrected voxel-wise significances\n");
   printf("   --cwsig cwsig : map of cluster-wise significances\n");
   printf("   --bonferroni N : addition correction across N (eg, spaces)\n");
   printf("   --sig2p-max : convert max from sig to p\n");
@@ -1166,7 +1191,9 @@ static void print_help(void) {
     "to which the vertex belongs (the cluster-wise significance). The user can also\n"
     "specify that the vertex-wise significance be computed and saved  with --vwsig.\n"
     "The significance is based on the distribution of the maximum significances \n"
-    "found during the CSD simulation.\n"
+    "found during the CSD simulation. If the CSD was made by mri_glmfit with\n"
+    "--tfce, --tfce-vwsig saves the vertex-wise significance of the TFCE of the\n"
+    "input, based on the distribution of the maximum TFCE.\n"
     "\n"
     "--csdpdf csdpdfile\n"
     "\n"
@@ -1357,6 +1384,10 @@ static void check_options(void) {
     printf("ERROR: need csd with --vwsig\n");
     exit(1);
   }
+  if (tfcesigfile != NULL && (csd == NULL || !csd->tfce)) {
+    printf("ERROR: need csd simulated with --tfce with --tfce-vwsig\n");
+    exit(1);
+  }
 
   if(thsign == NULL) thsign = "abs";
   if(stringmatch(thsign,"pos")) thsignid = +1;
@@ -135,7 +135,7 @@ float distthresh =   0.0;
 int   allowdiag  = 0;
 int sig2pmax = 0; // convert max value from -log10(p) to p
 
-MRI *vol, *HitMap, *outvol, *maskvol, *binmask;
+MRI *vol, *outvol, *maskvol, *binmask;
 VOLCLUSTER **ClusterList, **ClusterList2;
 MATRIX *CRS2MNI, *CRS2FSA, *FSA2Func;
 LABEL *label;
@@ -158,6 +158,7 @@ int csdpdfonly = 0;
 
 char *voxwisesigfile=NULL;
 char *maxvoxwisesigfile=NULL;
+char *tfcesigfile=NULL;
 MRI  *voxwisesig, *clustwisesig;
 char *clustwisesigfile=NULL;
 
@@ -190,9 +191,9 @@ char *pointset = NULL;
 /*--------------------- MAIN -----------------------------------*/
 /*--------------------------------------------------------------*/
 int main(int argc, char **argv) {
-  int nhits, *hitcol, *hitrow, *hitslc,nargs;
+  int nhits, nargs;
   int col, row, slc;
-  int nthhit, n, m, nclusters, nprunedclusters;
+  int n, m, nclusters, nprunedclusters;
   float x,y,z,val,pval;
   char *stem;
   COLOR_TABLE *ct;
@@ -356,15 +357,29 @@ int main(int argc, char **argv) {
     }
   }
 
+  if(tfcesigfile) {
+    // TFCE of the input with the exponents of the simulation,
+    // corrected with the max TFCE of each permutation
+    double maxmaxsig;
+    int tfcesign = 0;
+    MRI *tfce;
+    if(csd->threshsign > +0.5) tfcesign = +1;
+    if(csd->threshsign < -0.5) tfcesign = -1;
+    printf("Computing TFCE voxel-wise significance\n");
+    tfce = MRItfce(vol, frame, binmask, tfcesign, csd->tfceE, csd->tfceH, NULL);
+    voxwisesig = CSDpvalMaxTFCEMap(tfce, csd, binmask, NULL, &maxmaxsig, Bonferroni);
+    MRIwrite(voxwisesig,tfcesigfile);
+    MRIfree(&tfce);
+    MRIfree(&voxwisesig);
+  }
+
 
-  /* Initialize the hit map - this is a map of voxels that have been
-     accounted for as either outside of a the threshold range or
-     belonging to a cluster. The initialization is for thresholding */
-  HitMap = clustInitHitMap(vol, frame, threshminadj, threshmaxadj, threshsign,
-                           &nhits, &hitcol, &hitrow, &hitslc,
-                           binmask, maskframe);
-  if (HitMap == NULL) {
-    printf("ERROR: initializing hit map\n");
+  /* Find the clusters of voxels that meet the threshold criteria */
+  ClusterList = clustGetComponents(vol, frame, threshminadj, threshmaxadj,
+                                   threshsign, binmask, maskframe, allowdiag,
+                                   &nhits, &nclusters);
+  if (ClusterList == NULL) {
+    printf("ERROR: finding clusters\n");
     if(nhits == 0){
       printf("  No voxels were found that met the threshold criteria");      
       if(binmask) printf(" within the mask");      
@@ -372,40 +387,12 @@ int main(int argc, char **argv) {
     }
     exit(1);
   }
-  //MRIwriteType(HitMap,"hitmap",BSHORT_FILE);
 
   printf("INFO: Found %d voxels in threhold range\n",nhits);
 
-  /* Allocate an array of clusters equal to the number of hits -- this
-     is the maximum number of clusters possible */
-  ClusterList = clustAllocClusterList(nhits);
-  if (ClusterList == NULL) {
-    fprintf(stderr,"ERROR: could not alloc %d clusters\n",nhits);
-    exit(1);
-  }
-
-  nclusters = 0;
-  for (nthhit = 0; nthhit < nhits; nthhit ++) {
-
-    /* Determine whether this hit is still valid. It may
-       not be if it was assigned to the cluster of a
-       previous hit */
-    col = hitcol[nthhit];
-    row = hitrow[nthhit];
-    slc = hitslc[nthhit];
-    if (MRIgetVoxVal(HitMap,col,row,slc,0)) continue;
-
-    /* Grow cluster using this hit as a seed */
-    ClusterList[nclusters] = clustGrow(col,row,slc,HitMap,allowdiag);
-
-    /* Determine the member with the maximum value */
-    clustMaxMember(ClusterList[nclusters], vol, frame, threshsign);
-
-    //clustComputeXYZ(ClusterList[nclusters],CRS2FSA); /* for FSA coords */
-    clustComputeTal(ClusterList[nclusters],CRS2MNI); /*"true" Tal coords */
-
-    /* increment the number of clusters */
-    nclusters ++;
+  for (n = 0; n < nclusters; n++) {
+    //clustComputeXYZ(ClusterList[n],CRS2FSA); /* for FSA coords */
+    clustComputeTal(ClusterList[n],CRS2MNI); /*"true" Tal coords */
   }
 
   printf("INFO: Found %d clusters that meet threshold criteria\n",
@@ -902,6 +889,11 @@ static int parse_commandline(int argc, char **argv) {
       maxvoxwisesigfile = pargv[0];
       nargsused = 1;
     } 
+    else if (!strcmp(option, "--tfce-vwsig")) {
+      if(nargc < 1) argnerr(option,1);
+      tfcesigfile = pargv[0];
+      nargsused = 1;
+    } 
     else if (!strcmp(option, "--sum")) {
       if (nargc < 1) argnerr(option,1);
       sumfile = pargv[0];
@@ -1111,6 +1103,7 @@ static void print_usage(void) {
   printf("   --csd csdfile <--csd csdfile ...>\n");
   printf("   --cwsig cwsig : map of corrected cluster-wise significances\n");
   printf("   --vwsig vwsig : map of corrected voxel-wise significances\n");
+  printf("   --tfce-vwsig vwsig : map of TFCE-corrected voxel-wise significances (csd from --tfce)\n");
   printf("   --csdpdf csdpdffile : PDF/CDF of cluster and max sig\n");
   printf("   --csdpdf-only : write csd pdf file and exit.\n");
   printf("\n");
@@ -1405,6 +1398,10 @@ static void check_options(void) {
     printf("ERROR: need csd with --vwsig\n");
     exit(1);
   }
+  if(tfcesigfile != NULL && (csd == NULL || !csd->tfce)) {
+    printf("ERROR: need csd simulated with --tfce with --tfce-vwsig\n");
+    exit(1);
+  }
   if (clustwisesigfile != NULL && csd == NULL && fwhm < 0) {
     printf("ERROR: need csd with --cwsig\n");
     exit(1);
@@ -36,6 +36,7 @@
 
 #include "error.h"
 #include "diag.h"
+#include "fio.h"
 #include "proto.h"
 #include "utils.h"
 #include "timer.h"
@@ -45,6 +46,7 @@
 #include "icosahedron.h"
 #include "version.h"
 #include "cma.h"
+#include "romp_support.h"
 
 
 int main(int argc, char *argv[]) ;
@@ -77,6 +79,8 @@ static const char *sulc_name = "sulc" ;
 static char subjects_dir[STRLEN] ;
 extern char *gcsa_write_fname ;
 extern int gcsa_write_iterations ;
+extern int gcsa_parallel_gibbs ;
+static char *vmap_fname = NULL ;
 
 static int novar = 0 ;
 static int refine = 0;
@@ -251,6 +255,23 @@ main(int argc, char *argv[])
   MRISprojectOntoSphere(mris, mris, DEFAULT_RADIUS) ;
   MRISsaveVertexPositions(mris, CANONICAL_VERTICES) ;
 
+  // sphere -> atlas vertex lookups, done once; the map is the same for
+  // every atlas with these ico orders, so it can be kept for the next one
+  if (vmap_fname && fio_FileExistsReadable(vmap_fname) &&
+      GCSAreadVertexMap(gcsa, mris, vmap_fname) == NO_ERROR)
+  {
+    printf("read atlas vertex map from %s\n", vmap_fname) ;
+  }
+  else
+  {
+    GCSAcomputeVertexMap(gcsa, mris) ;
+    if (vmap_fname)
+    {
+      printf("writing atlas vertex map to %s\n", vmap_fname) ;
+      GCSAwriteVertexMap(gcsa, vmap_fname) ;
+    }
+  }
+
   if (!read_fname)
   {
     printf("labeling surface...\n") ;
@@ -462,6 +483,28 @@ get_option(int argc, char *argv[])
     refine = 1 ;
     printf("will refine the initial labeling read-in from -R \n") ;
   }
+  else if (!stricmp(option, "vertexmap"))
+  {
+    vmap_fname = argv[2] ;
+    nargs = 1 ;
+    printf("using atlas vertex map %s (created if missing)\n", vmap_fname) ;
+  }
+  else if (!stricmp(option, "parallel_gibbs"))
+  {
+    gcsa_parallel_gibbs = 1 ;
+    printf("relabeling independent vertex sets in parallel\n") ;
+  }
+  else if (!stricmp(option, "threads"))
+  {
+    int nthreads = atoi(argv[2]) ;
+    nargs = 1 ;
+#ifdef HAVE_OPENMP
+    omp_set_num_threads(nthreads) ;
+    printf("Setting threads to %d\n", nthreads) ;
+#else
+    printf("dont have openmp \n") ;
+#endif
+  }
   else if (!stricmp(option, "NOVAR"))
   {
     novar = 1 ;
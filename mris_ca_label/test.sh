@@ -28,3 +28,28 @@ test_command mris_ca_label \
 
 $mris_diff --maxerrs 1000 --s1 bert --s2 bert --hemi lh \
     --aparc aparc.a2009s --aparc2 aparc.a2009s.reference
+
+# desikan parcellation through a cached atlas vertex map: the first run computes and
+# writes the map, the second one reads it back
+test_command mris_ca_label \
+    -l bert/label/lh.cortex.label \
+    -aseg bert/mri/aseg.mgz \
+    -seed 1234 \
+    -vertexmap lh.sphere.reg.vmap \
+    bert lh bert/surf/lh.sphere.reg \
+    ${FREESURFER_HOME}/average/lh.curvature.buckner40.filled.desikan_killiany.2010-03-25.gcs \
+    bert/label/lh.aparc.vmap.annot
+
+FSTEST_NO_DATA_RESET=1 test_command mris_ca_label \
+    -l bert/label/lh.cortex.label \
+    -aseg bert/mri/aseg.mgz \
+    -seed 1234 \
+    -vertexmap lh.sphere.reg.vmap \
+    bert lh bert/surf/lh.sphere.reg \
+    ${FREESURFER_HOME}/average/lh.curvature.buckner40.filled.desikan_killiany.2010-03-25.gcs \
+    bert/label/lh.aparc.vmapread.annot
+
+$mris_diff --maxerrs 1000 --s1 bert --s2 bert --hemi lh \
+    --aparc aparc.vmap --aparc2 aparc.reference
+$mris_diff --maxerrs 1000 --s1 bert --s2 bert --hemi lh \
+    --aparc aparc.vmapread --aparc2 aparc.reference
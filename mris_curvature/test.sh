@@ -10,3 +10,22 @@ test_command mris_curvature -seed 1234 -thresh .999 -n -a 5 -w -distances 10 10
 
 compare_vol lh.inflated.H lh.inflated.ref.H
 compare_vol lh.inflated.K lh.inflated.ref.K
+
+# the same run with the surface topology cache: the first run writes lh.inflated.topo,
+# the second one reads the rings back from it
+FS_SURF_TOPO_CACHE=1 test_command mris_curvature -seed 1234 -thresh .999 -n -a 5 -w -distances 10 10 lh.inflated
+test -e lh.inflated.topo
+FS_SURF_TOPO_CACHE=1 FSTEST_NO_DATA_RESET=1 test_command mris_curvature -seed 1234 -thresh .999 -n -a 5 -w \
+    -distances 10 10 lh.inflated
+
+compare_vol lh.inflated.H lh.inflated.ref.H
+compare_vol lh.inflated.K lh.inflated.ref.K
+
+# a cache written with the other mrisCompleteTopology build must not be used
+FS_SURF_TOPO_CACHE=1 mrisCompleteTopology_new=1 FSTEST_NO_DATA_RESET=1 test_command mris_curvature -seed 1234 \
+    -thresh .999 -n -a 5 -w -distances 10 10 lh.inflated
+FS_SURF_TOPO_CACHE=1 FSTEST_NO_DATA_RESET=1 test_command mris_curvature -seed 1234 -thresh .999 -n -a 5 -w \
+    -distances 10 10 lh.inflated
+
+compare_vol lh.inflated.H lh.inflated.ref.H
+compare_vol lh.inflated.K lh.inflated.ref.K
@@ -9,3 +9,9 @@ fi
 # modified (shortened) usage in recon-all
 test_command mris_register -curv -rusage rusage.mris_register.lh.dat lh.sphere lh.folding.atlas.acfb40.noaparc.i12.2016-08-02.tif lh.sphere.reg
 compare_surf lh.sphere.reg ref_lh.sphere.reg
+
+# the same registration with the spherical harmonic rotational search in place of the
+# euler grid search for the initial rigid alignment
+FREESURFER_MRISrigidBodyAlignGlobal_useSH=1 test_command mris_register -curv -rusage rusage.mris_register.sh.lh.dat \
+    lh.sphere lh.folding.atlas.acfb40.noaparc.i12.2016-08-02.tif lh.sphere.sh.reg
+compare_surf lh.sphere.sh.reg ref_lh.sphere.reg
@@ -557,6 +557,7 @@ py::array_t<double> KvlMesh::FitAlphas( const py::array_t< uint16_t,
         }
         
       }
+    privateParameters->Modified(); // the alphas were changed in place
   
     } // End loop over EM iteration numbers
    
@@ -669,5 +670,6 @@ void CopyNumpyToPointDataSet(PointDataPointer destinationAlphas, const py::array
         }
         alphasIterator.Value().m_Alphas = alphas;
     }
+    destinationAlphas->Modified(); // the alphas were changed in place
 }
 
@@ -20,6 +20,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/file.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/timeb.h>
 #include <sys/types.h>
@@ -34,6 +35,9 @@ void *malloc(size_t size);
 
 #include <math.h>
 
+#include <map>
+#include <string>
+
 #include "mri.h"
 
 #include "diag.h"
@@ -43,6 +47,7 @@ void *malloc(size_t size);
 #include "macros.h"  // DEGREES
 #include "mosaic.h"
 #include "mri_identify.h"
+#include "romp_support.h"
 
 // #include "affine.h"
 
@@ -53,6 +58,38 @@ void *malloc(size_t size);
 static int DCMPrintCond(CONDITION cond);
 void *ReadDICOMImage2(int nfiles, DICOMInfo **aDicomInfo, int startIndex);
 
+/* Lines of the Siemens ASCII header (ASCCONV blocks) of one file */
+typedef struct
+{
+  char *text;    // the blocks, with each newline replaced by a null
+  int nlines;
+  char **lines;  // pointers into text
+  char *fname;   // set when USE_SIEMENSASCIITAG defers to SiemensAsciiTag()
+} SDCMASCII;
+
+// Most bytes searched for the ASCII header when the offset of the
+// pixel data is not known
+#define SDCM_ASCII_MAXBYTES (16 * 1024 * 1024)
+
+static long sdcmAsciiLimit(DCM_OBJECT **object, const char *dcmfile);
+static SDCMASCII *sdcmAsciiLoad(const char *dcmfile, long maxbytes);
+static char *sdcmAsciiValue(const SDCMASCII *ascii, const char *TagString);
+static void sdcmAsciiFree(SDCMASCII **pascii);
+static DCM_ELEMENT *GetElementFromObject(DCM_OBJECT **object, long grpid, long elid);
+static int dcmGetVolResObject(DCM_OBJECT **object, float *ColRes, float *RowRes, float *SliceRes);
+static int dcmGetNRowsObject(DCM_OBJECT **object);
+static int dcmGetNColsObject(DCM_OBJECT **object);
+static int dcmImageDirCosFloat(
+    DCM_OBJECT **object, float *Vcx, float *Vcy, float *Vcz, float *Vrx, float *Vry, float *Vrz);
+static int dcmImagePositionObject(DCM_OBJECT **object, float *x, float *y, float *z);
+static int sdcmSliceDirCosAscii(const SDCMASCII *ascii, float *Vsx, float *Vsy, float *Vsz);
+static int sdcmIsMosaicObject(
+    DCM_OBJECT **object, const SDCMASCII *ascii, int *pNcols, int *pNrows, int *pNslices, int *pNframes);
+static SDCMFILEINFO *sdcmFileInfoFromObject(const char *dcmfile,
+                                            DCM_OBJECT **pobject,
+                                            const SDCMASCII *ascii,
+                                            int *pSliceDirCosPresent);
+
 static BOOL IsTagPresent[NUMBEROFTAGS];
 static int sliceDirCosPresent;
 static const char *jpegCompressed_UID = "1.2.840.10008.1.2.4";
@@ -1164,13 +1201,12 @@ MATRIX *sdcmAutoAlignMatrix(const char *dcmfile)
 }
 
 /*---------------------------------------------------------------
-  GetElementFromFile() - gets an element from a DICOM file. Returns
-  a pointer to the object (or NULL upon failure).
-  Author: Douglas Greve 9/6/2001
+  GetElementFromObject() - gets an element from an open DICOM object.
+  Returns a pointer to the element (or NULL upon failure). The data
+  portion is allocated with AllocElementData().
   ---------------------------------------------------------------*/
-DCM_ELEMENT *GetElementFromFile(const char *dicomfile, long grpid, long elid)
+static DCM_ELEMENT *GetElementFromObject(DCM_OBJECT **object, long grpid, long elid)
 {
-  DCM_OBJECT *object = 0;
   CONDITION cond;
   DCM_ELEMENT *element;
   DCM_TAG tag;
@@ -1179,28 +1215,42 @@ DCM_ELEMENT *GetElementFromFile(const char *dicomfile, long grpid, long elid)
 
   element = (DCM_ELEMENT *)calloc(1, sizeof(DCM_ELEMENT));
 
-  object = GetObjectFromFile(dicomfile, 0);
-  if (object == NULL) {
-    exit(1);
-  }
-
   tag = DCM_MAKETAG(grpid, elid);
-  cond = DCM_GetElement(&object, tag, element);
+  cond = DCM_GetElement(object, tag, element);
   if (cond != DCM_NORMAL) {
-    DCM_CloseObject(&object);
     free(element);
     return (NULL);
   }
   AllocElementData(element);
-  cond = DCM_GetElementValue(&object, element, &rtnLength, &Ctx);
+  cond = DCM_GetElementValue(object, element, &rtnLength, &Ctx);
   /* Does Ctx have to be freed? */
   if (cond != DCM_NORMAL) {
-    DCM_CloseObject(&object);
     FreeElementData(element);
     free(element);
     return (NULL);
   }
+  return (element);
+}
+/*---------------------------------------------------------------
+  GetElementFromFile() - gets an element from a DICOM file. Returns
+  a pointer to the object (or NULL upon failure).
+  Author: Douglas Greve 9/6/2001
+  ---------------------------------------------------------------*/
+DCM_ELEMENT *GetElementFromFile(const char *dicomfile, long grpid, long elid)
+{
+  DCM_OBJECT *object = 0;
+  DCM_ELEMENT *element;
+
+  object = GetObjectFromFile(dicomfile, 0);
+  if (object == NULL) {
+    exit(1);
+  }
+
+  element = GetElementFromObject(&object, grpid, elid);
   DCM_CloseObject(&object);
+  if (element == NULL) {
+    return (NULL);
+  }
 
   COND_PopCondition(1); /********************************/
 
@@ -1817,6 +1867,175 @@ char *SiemensAsciiTag(const char *dcmfile, const char *TagString, int flag)
 
   return (VariableValue);
 }
+/*-----------------------------------------------------------------
+  sdcmAsciiLimit() - returns the number of leading bytes of a file
+  that sdcmAsciiLoad() needs to search for the ASCII header, ie, the
+  offset of the pixel data (7fe0,0010) computed from the file size
+  and the length of the pixel data element. If the length is not
+  known (eg, encapsulated pixel data) or there is no object, returns
+  SDCM_ASCII_MAXBYTES.
+  -----------------------------------------------------------------*/
+static long sdcmAsciiLimit(DCM_OBJECT **object, const char *dcmfile)
+{
+  struct stat st;
+  U32 len = 0;
+  CONDITION cond;
+
+  if (object == NULL || *object == NULL || stat(dcmfile, &st) != 0) {
+    return (SDCM_ASCII_MAXBYTES);
+  }
+  cond = DCM_GetElementSize(object, DCM_PXLPIXELDATA, &len);
+  if (cond != DCM_NORMAL) {
+    COND_PopCondition(1);
+    return (SDCM_ASCII_MAXBYTES);
+  }
+  if (len == 0 || len == 0xffffffff || (long)len >= (long)st.st_size) {
+    return (SDCM_ASCII_MAXBYTES);
+  }
+  return ((long)st.st_size - (long)len);
+}
+/*-----------------------------------------------------------------
+  sdcmAsciiLoad() - reads the Siemens ASCII header blocks of a file
+  into memory so that any number of tags can be looked up with
+  sdcmAsciiValue() without going back to the file. Only the first
+  maxbytes of the file are searched (see sdcmAsciiLimit()), so the
+  pixel data are never read. As with SiemensAsciiTagEx(), the lines
+  of every "### ASCCONV BEGIN" to "### ASCCONV END ###" block are
+  kept (a block without an END runs up to maxbytes), and the last
+  match wins in sdcmAsciiValue(). This keeps no static state and does
+  not fork, so it can be used from several threads at once. If
+  USE_SIEMENSASCIITAG is set, nothing is read here and lookups go to
+  SiemensAsciiTag() instead. Only call this on Siemens files. Returns
+  NULL if the file cannot be opened. If there is no ASCII block, the
+  header has no lines.
+  -----------------------------------------------------------------*/
+static SDCMASCII *sdcmAsciiLoad(const char *dcmfile, long maxbytes)
+{
+  const char *BeginStr = "### ASCCONV BEGIN";
+  const char *EndStr = "### ASCCONV END ###";
+  size_t len, nkeep = 0;
+  char *buf, *p, *q, *end;
+  FILE *fp;
+  SDCMASCII *ascii;
+  int n;
+
+  if (getenv("USE_SIEMENSASCIITAG")) {
+    ascii = (SDCMASCII *)calloc(1, sizeof(SDCMASCII));
+    ascii->fname = strcpyalloc(dcmfile);
+    return (ascii);
+  }
+
+  fp = fopen(dcmfile, "rb");
+  if (fp == NULL) {
+    return (NULL);
+  }
+  if (maxbytes <= 0) {
+    maxbytes = SDCM_ASCII_MAXBYTES;
+  }
+  if (fseek(fp, 0, SEEK_END) == 0 && ftell(fp) >= 0 && ftell(fp) < maxbytes) {
+    maxbytes = ftell(fp);
+  }
+  rewind(fp);
+  buf = (char *)calloc(maxbytes + 1, sizeof(char));
+  len = fread(buf, sizeof(char), maxbytes, fp);
+  fclose(fp);
+
+  // collect the blocks, one after the other, into the start of buf
+  p = buf;
+  while (p < buf + len) {
+    p = (char *)memmem(p, buf + len - p, BeginStr, strlen(BeginStr));
+    if (p == NULL) {
+      break;
+    }
+    end = (char *)memmem(p, buf + len - p, EndStr, strlen(EndStr));
+    if (end == NULL) {
+      end = buf + len;
+    }
+    if (nkeep > 0) {
+      buf[nkeep++] = '\n';
+    }
+    memmove(buf + nkeep, p, end - p);
+    nkeep += end - p;
+    p = end;
+  }
+
+  ascii = (SDCMASCII *)calloc(1, sizeof(SDCMASCII));
+  if (nkeep == 0) {
+    free(buf);
+    return (ascii);
+  }
+
+  // keep only the blocks, one line per entry
+  ascii->text = (char *)calloc(nkeep + 1, sizeof(char));
+  memmove(ascii->text, buf, nkeep);
+  free(buf);
+
+  for (p = ascii->text; *p; p++) {
+    if (*p == '\n') {
+      ascii->nlines++;
+    }
+  }
+  ascii->nlines++;
+  ascii->lines = (char **)calloc(ascii->nlines, sizeof(char *));
+  n = 0;
+  for (p = ascii->text; p != NULL; p = q) {
+    q = strchr(p, '\n');
+    if (q != NULL) {
+      *q = '\0';
+      q++;
+    }
+    ascii->lines[n++] = p;
+  }
+  ascii->nlines = n;
+
+  return (ascii);
+}
+/*-----------------------------------------------------------------
+  sdcmAsciiValue() - returns the value of TagString in an ASCII header
+  loaded with sdcmAsciiLoad(), or NULL if there is no match. As with
+  SiemensAsciiTagEx(), the last match wins. Free the result.
+  -----------------------------------------------------------------*/
+static char *sdcmAsciiValue(const SDCMASCII *ascii, const char *TagString)
+{
+  char VariableName[512], tmpstr2[512];
+  char *VariableValue;
+  int n;
+
+  if (ascii == NULL) {
+    return (NULL);
+  }
+  if (ascii->fname != NULL) {
+    return (SiemensAsciiTag(ascii->fname, TagString, 0));
+  }
+
+  for (n = ascii->nlines - 1; n >= 0; n--) {
+    VariableName[0] = 0;
+    sscanf(ascii->lines[n], "%511s", VariableName);
+    if (strcmp(VariableName, TagString) != 0) {
+      continue;
+    }
+    tmpstr2[0] = 0;
+    sscanf(ascii->lines[n], "%*s %*s %511s", tmpstr2);
+    VariableValue = (char *)calloc(strlen(tmpstr2) + 17, sizeof(char));
+    memmove(VariableValue, tmpstr2, strlen(tmpstr2));
+    return (VariableValue);
+  }
+  return (NULL);
+}
+/*-----------------------------------------------------------------*/
+static void sdcmAsciiFree(SDCMASCII **pascii)
+{
+  SDCMASCII *ascii = *pascii;
+
+  if (ascii == NULL) {
+    return;
+  }
+  free(ascii->lines);
+  free(ascii->text);
+  free(ascii->fname);
+  free(ascii);
+  *pascii = NULL;
+}
 /*-----------------------------------------------------------------------
   dcmGetVolRes - Gets the volume resolution (mm) from a DICOM File. The
   column and row resolution is obtained from tag (28,30). This tag is stored
@@ -1826,6 +2045,23 @@ char *SiemensAsciiTag(const char *dcmfile, const char *TagString, int flag)
   Author: Douglas N. Greve, 9/6/2001
   -----------------------------------------------------------------------*/
 int dcmGetVolRes(const char *dcmfile, float *ColRes, float *RowRes, float *SliceRes)
+{
+  DCM_OBJECT *object;
+  int err;
+
+  object = GetObjectFromFile(dcmfile, 0);
+  if (object == NULL) {
+    exit(1);
+  }
+  err = dcmGetVolResObject(&object, ColRes, RowRes, SliceRes);
+  DCM_CloseObject(&object);
+  COND_PopCondition(1);
+  return (err);
+}
+/*-----------------------------------------------------------------------
+  dcmGetVolResObject - same as dcmGetVolRes() but from an open object.
+  -----------------------------------------------------------------------*/
+static int dcmGetVolResObject(DCM_OBJECT **object, float *ColRes, float *RowRes, float *SliceRes)
 {
   DCM_ELEMENT *e;
   char *s;
@@ -1835,7 +2071,7 @@ int dcmGetVolRes(const char *dcmfile, float *ColRes, float *RowRes, float *Slice
 
   /* Load the Pixel Spacing - this is a string of the form:
      ColRes\RowRes   */
-  e = GetElementFromFile(dcmfile, 0x28, 0x30);
+  e = GetElementFromObject(object, 0x28, 0x30);
   if (e == NULL) {
     return (1);
   }
@@ -1854,6 +2090,8 @@ int dcmGetVolRes(const char *dcmfile, float *ColRes, float *RowRes, float *Slice
     }
   }
   if (slash_not_found) {
+    FreeElementData(e);
+    free(e);
     return (1);
   }
 
@@ -1862,25 +2100,16 @@ int dcmGetVolRes(const char *dcmfile, float *ColRes, float *RowRes, float *Slice
   FreeElementData(e);
   free(e);
 
-  /*E* // Load the Spacing Between Slices
-    e = GetElementFromFile(dcmfile, 0x18, 0x88);
-    if(e == NULL){
-    // If 18,88 does not exist, load the slice thickness
-    e = GetElementFromFile(dcmfile, 0x18, 0x50);
-    if(e == NULL) return(1);
-    }
-    sscanf(e->d.string,"%f",SliceRes);
-    FreeElementData(e); free(e);
-  */
-
   if (AutoSliceResElTag) {
     printf("Automatically determining SliceResElTag\n");
-    e = GetElementFromFile(dcmfile, 0x18, 0x23);
+    e = GetElementFromObject(object, 0x18, 0x23);
     if (e != NULL) {
       if (strcmp(e->d.string, "3D") == 0)
         SliceResElTag1 = 0x50;
       else
         SliceResElTag1 = 0x88;
+      FreeElementData(e);
+      free(e);
     }
     else
       printf("Tag 18,23 is null, cannot automatically determine SliceResElTag\n");
@@ -1889,27 +2118,23 @@ int dcmGetVolRes(const char *dcmfile, float *ColRes, float *RowRes, float *Slice
   /* By default, the slice resolution is determined from 18,88. If
      that does not exist, then 18,50 is used. For siemens mag res
      angiogram (MRAs), 18,50 must be used first */
-  e = GetElementFromFile(dcmfile, 0x18, SliceResElTag1);
+  e = GetElementFromObject(object, 0x18, SliceResElTag1);
   if (e == NULL)
     tag_not_found = 1;
   else {
     sscanf(e->d.string, "%f", SliceRes);
-    if (*SliceRes == 0) {
-      tag_not_found = 1;  // tag found but was zero
-      FreeElementData(e);
-      free(e);
-    }
+    if (*SliceRes == 0) tag_not_found = 1;  // tag found but was zero
+    FreeElementData(e);
+    free(e);
   }
   if (tag_not_found) {  // so either no tag or tag was zero
-    e = GetElementFromFile(dcmfile, 0x18, SliceResElTag2);
+    e = GetElementFromObject(object, 0x18, SliceResElTag2);
     if (e == NULL) return (1);  // no tag
     sscanf(e->d.string, "%f", SliceRes);
     FreeElementData(e);
     free(e);
     if (*SliceRes == 0) return (1);  // tag exists but zero
   }
-  // fprintf(stderr, "SliceRes=%f\n",*SliceRes);
-  // FreeElementData(e); free(e);
 
   return (0);
 }
@@ -1943,11 +2168,26 @@ int dcmGetSeriesNo(const char *dcmfile)
   Author: Douglas N. Greve, 9/6/2001
   -----------------------------------------------------------------------*/
 int dcmGetNRows(const char *dcmfile)
+{
+  DCM_OBJECT *object;
+  int NRows;
+
+  object = GetObjectFromFile(dcmfile, 0);
+  if (object == NULL) {
+    exit(1);
+  }
+  NRows = dcmGetNRowsObject(&object);
+  DCM_CloseObject(&object);
+  COND_PopCondition(1);
+  return (NRows);
+}
+/*-----------------------------------------------------------------------*/
+static int dcmGetNRowsObject(DCM_OBJECT **object)
 {
   DCM_ELEMENT *e;
   int NRows;
 
-  e = GetElementFromFile(dcmfile, 0x28, 0x10);
+  e = GetElementFromObject(object, 0x28, 0x10);
   if (e == NULL) {
     return (-1);
   }
@@ -1955,7 +2195,7 @@ int dcmGetNRows(const char *dcmfile)
   NRows = *(e->d.us);
 
   if (e->representation != DCM_US) {
-    printf("bad element for %s\n", dcmfile);
+    printf("bad element for rows (28,10)\n");
   }
 
   FreeElementData(e);
@@ -1971,11 +2211,26 @@ int dcmGetNRows(const char *dcmfile)
   Author: Douglas N. Greve, 9/6/2001
   -----------------------------------------------------------------------*/
 int dcmGetNCols(const char *dcmfile)
+{
+  DCM_OBJECT *object;
+  int NCols;
+
+  object = GetObjectFromFile(dcmfile, 0);
+  if (object == NULL) {
+    exit(1);
+  }
+  NCols = dcmGetNColsObject(&object);
+  DCM_CloseObject(&object);
+  COND_PopCondition(1);
+  return (NCols);
+}
+/*-----------------------------------------------------------------------*/
+static int dcmGetNColsObject(DCM_OBJECT **object)
 {
   DCM_ELEMENT *e;
   int NCols;
 
-  e = GetElementFromFile(dcmfile, 0x28, 0x11);
+  e = GetElementFromObject(object, 0x28, 0x11);
   if (e == NULL) {
     return (-1);
   }
@@ -1997,6 +2252,24 @@ int dcmGetNCols(const char *dcmfile)
   Author: Douglas N. Greve, 9/10/2001
   -----------------------------------------------------------------------*/
 int dcmImageDirCos(const char *dcmfile, float *Vcx, float *Vcy, float *Vcz, float *Vrx, float *Vry, float *Vrz)
+{
+  DCM_OBJECT *object;
+  int err;
+
+  object = GetObjectFromFile(dcmfile, 0);
+  if (object == NULL) {
+    exit(1);
+  }
+  err = dcmImageDirCosFloat(&object, Vcx, Vcy, Vcz, Vrx, Vry, Vrz);
+  DCM_CloseObject(&object);
+  COND_PopCondition(1);
+  return (err);
+}
+/*-----------------------------------------------------------------------
+  dcmImageDirCosFloat - same as dcmImageDirCos() but from an open object.
+  See also dcmImageDirCosObject(), which works in double.
+  -----------------------------------------------------------------------*/
+static int dcmImageDirCosFloat(DCM_OBJECT **object, float *Vcx, float *Vcy, float *Vcz, float *Vrx, float *Vry, float *Vrz)
 {
   DCM_ELEMENT *e;
   char *s;
@@ -2006,7 +2279,7 @@ int dcmImageDirCos(const char *dcmfile, float *Vcx, float *Vcy, float *Vcz, floa
 
   /* Load the direction cosines - this is a string of the form:
      Vcx\Vcy\Vcz\Vrx\Vry\Vrz */
-  e = GetElementFromFile(dcmfile, 0x20, 0x37);
+  e = GetElementFromObject(object, 0x20, 0x37);
   if (e == NULL) {
     return (1);
   }
@@ -2022,6 +2295,8 @@ int dcmImageDirCos(const char *dcmfile, float *Vcx, float *Vcy, float *Vcz, floa
   }
 
   if (nbs != 5) {
+    FreeElementData(e);
+    free(e);
     return (1);
   }
 
@@ -2042,15 +2317,6 @@ int dcmImageDirCos(const char *dcmfile, float *Vcx, float *Vcy, float *Vcz, floa
   FreeElementData(e);
   free(e);
 
-  // Not sure why I had this here to begin with.
-  // This tag should indicate HFS (for example).
-  // 0020 0020 CS REL Patient Orientation
-  // e = GetElementFromFile(dcmfile, 0x20, 0x20);
-  // if (e==NULL) return (1);
-  // s = e->d.string;
-  // FreeElementData(e);
-  // free(e);
-
   return (0);
 }
 /*-----------------------------------------------------------------------
@@ -2061,6 +2327,21 @@ int dcmImageDirCos(const char *dcmfile, float *Vcx, float *Vcy, float *Vcz, floa
   Author: Douglas N. Greve, 9/10/2001
   -----------------------------------------------------------------------*/
 int dcmImagePosition(const char *dcmfile, float *x, float *y, float *z)
+{
+  DCM_OBJECT *object;
+  int err;
+
+  object = GetObjectFromFile(dcmfile, 0);
+  if (object == NULL) {
+    exit(1);
+  }
+  err = dcmImagePositionObject(&object, x, y, z);
+  DCM_CloseObject(&object);
+  COND_PopCondition(1);
+  return (err);
+}
+/*-----------------------------------------------------------------------*/
+static int dcmImagePositionObject(DCM_OBJECT **object, float *x, float *y, float *z)
 {
   DCM_ELEMENT *e;
   char *s;
@@ -2069,7 +2350,7 @@ int dcmImagePosition(const char *dcmfile, float *x, float *y, float *z)
 
   /* Load the Image Position: this is a string of the form:
      x\y\z  */
-  e = GetElementFromFile(dcmfile, 0x20, 0x32);
+  e = GetElementFromObject(object, 0x20, 0x32);
   if (e == NULL) {
     return (1);
   }
@@ -2085,6 +2366,8 @@ int dcmImagePosition(const char *dcmfile, float *x, float *y, float *z)
   }
 
   if (nbs != 2) {
+    FreeElementData(e);
+    free(e);
     return (1);
   }
 
@@ -2116,33 +2399,48 @@ int dcmImagePosition(const char *dcmfile, float *x, float *y, float *z)
   -----------------------------------------------------------------------*/
 int sdcmSliceDirCos(const char *dcmfile, float *Vsx, float *Vsy, float *Vsz)
 {
-  char *tmpstr;
-  float rms;
+  SDCMASCII *ascii;
+  int err;
 
   if (!IsSiemensDICOM(dcmfile)) {
     return (1);
   }
 
-  tmpstr = SiemensAsciiTagEx(dcmfile, "sSliceArray.asSlice[0].sNormal.dSag", 0);
+  ascii = sdcmAsciiLoad(dcmfile, SDCM_ASCII_MAXBYTES);
+  err = sdcmSliceDirCosAscii(ascii, Vsx, Vsy, Vsz);
+  sdcmAsciiFree(&ascii);
+
+  sliceDirCosPresent = !err;
+  return (err);
+}
+/*-----------------------------------------------------------------------
+  sdcmSliceDirCosAscii - same as sdcmSliceDirCos() but from an ASCII
+  header loaded with sdcmAsciiLoad(). Does not set sliceDirCosPresent.
+  -----------------------------------------------------------------------*/
+static int sdcmSliceDirCosAscii(const SDCMASCII *ascii, float *Vsx, float *Vsy, float *Vsz)
+{
+  char *tmpstr;
+  float rms;
+
+  tmpstr = sdcmAsciiValue(ascii, "sSliceArray.asSlice[0].sNormal.dSag");
   if (tmpstr != NULL) {
     sscanf(tmpstr, "%f", Vsx);
     free(tmpstr);
   }
 
-  tmpstr = SiemensAsciiTagEx(dcmfile, "sSliceArray.asSlice[0].sNormal.dCor", 0);
+  tmpstr = sdcmAsciiValue(ascii, "sSliceArray.asSlice[0].sNormal.dCor");
   if (tmpstr != NULL) {
     sscanf(tmpstr, "%f", Vsy);
     free(tmpstr);
   }
 
-  tmpstr = SiemensAsciiTagEx(dcmfile, "sSliceArray.asSlice[0].sNormal.dTra", 0);
+  tmpstr = sdcmAsciiValue(ascii, "sSliceArray.asSlice[0].sNormal.dTra");
   if (tmpstr != NULL) {
     sscanf(tmpstr, "%f", Vsz);
     free(tmpstr);
   }
 
   if (*Vsx == 0 && *Vsy == 0 && *Vsz == 0) {
-    sliceDirCosPresent = 0;
     return (1);
   }
 
@@ -2157,8 +2455,6 @@ int sdcmSliceDirCos(const char *dcmfile, float *Vsx, float *Vsy, float *Vsz)
   (*Vsy) /= rms;
   (*Vsz) /= rms;
 
-  sliceDirCosPresent = 1;
-
   return (0);
 }
 
@@ -2176,6 +2472,33 @@ int sdcmSliceDirCos(const char *dcmfile, float *Vsx, float *Vsy, float *Vsz)
   Author: Douglas N. Greve, 9/6/2001
   -----------------------------------------------------------------------*/
 int sdcmIsMosaic(const char *dcmfile, int *pNcols, int *pNrows, int *pNslices, int *pNframes)
+{
+  DCM_OBJECT *object;
+  SDCMASCII *ascii;
+  int IsMosaic;
+
+  if (!IsSiemensDICOM(dcmfile)) {
+    return (0);
+  }
+
+  object = GetObjectFromFile(dcmfile, 0);
+  if (object == NULL) {
+    exit(1);
+  }
+  ascii = sdcmAsciiLoad(dcmfile, sdcmAsciiLimit(&object, dcmfile));
+  IsMosaic = sdcmIsMosaicObject(&object, ascii, pNcols, pNrows, pNslices, pNframes);
+  sdcmAsciiFree(&ascii);
+  DCM_CloseObject(&object);
+  COND_PopCondition(1);
+
+  return (IsMosaic);
+}
+/*-----------------------------------------------------------------------
+  sdcmIsMosaicObject() - same as sdcmIsMosaic() but from an open object
+  and an ASCII header loaded with sdcmAsciiLoad().
+  -----------------------------------------------------------------------*/
+static int sdcmIsMosaicObject(
+    DCM_OBJECT **object, const SDCMASCII *ascii, int *pNcols, int *pNrows, int *pNslices, int *pNframes)
 {
   DCM_ELEMENT *e;
   char *PhEncDir;
@@ -2187,10 +2510,6 @@ int sdcmIsMosaic(const char *dcmfile, int *pNcols, int *pNrows, int *pNslices, i
   int err, IsMosaic;
   char *tmpstr;
 
-  if (!IsSiemensDICOM(dcmfile)) {
-    return (0);
-  }
-
   tmpstr = getenv("SDCM_ISMOSAIC_OVERRIDE");
   if (tmpstr != NULL) {
     sscanf(tmpstr, "%d", &IsMosaic);
@@ -2202,7 +2521,7 @@ int sdcmIsMosaic(const char *dcmfile, int *pNcols, int *pNrows, int *pNslices, i
 
   /* Get the phase encode direction: should be COL or ROW */
   /* COL means that each row is a different phase encode (??)*/
-  e = GetElementFromFile(dcmfile, 0x18, 0x1312);
+  e = GetElementFromObject(object, 0x18, 0x1312);
   if (e == NULL) {
     return (0);
   }
@@ -2210,13 +2529,15 @@ int sdcmIsMosaic(const char *dcmfile, int *pNcols, int *pNrows, int *pNslices, i
   FreeElementData(e);
   free(e);
 
-  Nrows = dcmGetNRows(dcmfile);
+  Nrows = dcmGetNRowsObject(object);
   if (Nrows == -1) {
+    free(PhEncDir);
     return (0);
   }
 
-  Ncols = dcmGetNCols(dcmfile);
+  Ncols = dcmGetNColsObject(object);
   if (Ncols == -1) {
+    free(PhEncDir);
     return (0);
   }
 
@@ -2224,7 +2545,7 @@ int sdcmIsMosaic(const char *dcmfile, int *pNcols, int *pNrows, int *pNslices, i
    * NumberOfImagesInMosaic field first, which represents the number of slices
    * in the run. Note that mosaics are always square, i.e. filled with empty
    * slices at the end. */
-  e = GetElementFromFile(dcmfile, 0x19, 0x100a);
+  e = GetElementFromObject(object, 0x19, 0x100a);
   NimagesMosaic = 0;
   if (e != NULL) {
     IsMosaic = 1;
@@ -2232,24 +2553,29 @@ int sdcmIsMosaic(const char *dcmfile, int *pNcols, int *pNrows, int *pNslices, i
     NmosaicSideLen = ceil(sqrt(NimagesMosaic));
     NrowsExp = Nrows / NmosaicSideLen;
     NcolsExp = Ncols / NmosaicSideLen;
+    FreeElementData(e);
+    free(e);
   }
   else {
-    tmpstr = SiemensAsciiTagEx(dcmfile, "sSliceArray.asSlice[0].dPhaseFOV", 0);
+    tmpstr = sdcmAsciiValue(ascii, "sSliceArray.asSlice[0].dPhaseFOV");
     if (tmpstr == NULL) {
+      free(PhEncDir);
       return (0);
     }
     sscanf(tmpstr, "%f", &PhEncFOV);
     free(tmpstr);
 
-    tmpstr = SiemensAsciiTagEx(dcmfile, "sSliceArray.asSlice[0].dReadoutFOV", 0);
+    tmpstr = sdcmAsciiValue(ascii, "sSliceArray.asSlice[0].dReadoutFOV");
     if (tmpstr == NULL) {
+      free(PhEncDir);
       return (0);
     }
     sscanf(tmpstr, "%f", &ReadOutFOV);
     free(tmpstr);
 
-    err = dcmGetVolRes(dcmfile, &ColRes, &RowRes, &SliceRes);
+    err = dcmGetVolResObject(object, &ColRes, &RowRes, &SliceRes);
     if (err) {
+      free(PhEncDir);
       return (-1);
     }
 
@@ -2264,6 +2590,7 @@ int sdcmIsMosaic(const char *dcmfile, int *pNcols, int *pNrows, int *pNslices, i
       NcolsExp = (int)(rint(PhEncFOV / ColRes));
     }
   }
+  free(PhEncDir);
 
   if (NrowsExp != Nrows || NcolsExp != Ncols) {
     IsMosaic = 1;
@@ -2293,7 +2620,7 @@ int sdcmIsMosaic(const char *dcmfile, int *pNcols, int *pNrows, int *pNslices, i
         *pNslices = NimagesMosaic;
       }
       else if (tmpstr == NULL) {
-        tmpstr = SiemensAsciiTagEx(dcmfile, "sSliceArray.lSize", 0);
+        tmpstr = sdcmAsciiValue(ascii, "sSliceArray.lSize");
         if (tmpstr == NULL) {
           return (0);
         }
@@ -2306,7 +2633,7 @@ int sdcmIsMosaic(const char *dcmfile, int *pNcols, int *pNrows, int *pNslices, i
       }
     }
     if (pNframes != NULL) {
-      tmpstr = SiemensAsciiTagEx(dcmfile, "lRepetitions", 0);
+      tmpstr = sdcmAsciiValue(ascii, "lRepetitions");
       if (tmpstr == NULL) {
         return (0);
       }
@@ -2315,7 +2642,6 @@ int sdcmIsMosaic(const char *dcmfile, int *pNcols, int *pNrows, int *pNslices, i
       free(tmpstr);
     }
   }
-  free(PhEncDir);
 
   return (IsMosaic);
 }
@@ -2328,24 +2654,13 @@ int sdcmIsMosaic(const char *dcmfile, int *pNcols, int *pNrows, int *pNslices, i
 SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile)
 {
   DCM_OBJECT *object = 0;
+  SDCMASCII *ascii;
   SDCMFILEINFO *sdcmfi;
-  CONDITION cond;
-  DCM_TAG tag;
-  DCM_ELEMENT *e;
-  int l;
-  unsigned short ustmp = 0;
-  double dtmp = 0;
-  char *strtmp, *strtmp2, *pc;
-  int retval, nDiffDirections, nB0;
-  double xr, xa, xs, yr, ya, ys, zr, za, zs;
-  int DoDWI;
 
   if (!IsSiemensDICOM(dcmfile)) {
     return (NULL);
   }
 
-  sdcmfi = (SDCMFILEINFO *)calloc(1, sizeof(SDCMFILEINFO));
-
   fflush(stdout);
   fflush(stderr);
   object = GetObjectFromFile(dcmfile, 0);
@@ -2354,6 +2669,45 @@ SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile)
   if (object == NULL) {
     exit(1);
   }
+  ascii = sdcmAsciiLoad(dcmfile, sdcmAsciiLimit(&object, dcmfile));
+
+  sdcmfi = sdcmFileInfoFromObject(dcmfile, &object, ascii, &sliceDirCosPresent);
+
+  sdcmAsciiFree(&ascii);
+  DCM_CloseObject(&object);
+
+  /* Clear the condition stack to prevent overflow */
+  COND_PopCondition(1);
+
+  return (sdcmfi);
+}
+/*----------------------------------------------------------------
+  sdcmFileInfoFromObject() - does the work of GetSDCMFileInfo() from
+  an open DICOM object and the Siemens ASCII header loaded with
+  sdcmAsciiLoad(), so that each file is only parsed once. Whether
+  the slice direction cosines were found in the ASCII header is
+  returned in *pSliceDirCosPresent rather than set globally. Does
+  not close the object.
+  ----------------------------------------------------------------*/
+static SDCMFILEINFO *sdcmFileInfoFromObject(const char *dcmfile,
+                                            DCM_OBJECT **pobject,
+                                            const SDCMASCII *ascii,
+                                            int *pSliceDirCosPresent)
+{
+  DCM_OBJECT *object = *pobject;
+  SDCMFILEINFO *sdcmfi;
+  CONDITION cond;
+  DCM_TAG tag;
+  DCM_ELEMENT *e;
+  int l;
+  unsigned short ustmp = 0;
+  double dtmp = 0;
+  char *strtmp, *strtmp2, *pc;
+  int retval, nDiffDirections, nB0;
+  double xr, xa, xs, yr, ya, ys, zr, za, zs;
+  int DoDWI;
+
+  sdcmfi = (SDCMFILEINFO *)calloc(1, sizeof(SDCMFILEINFO));
 
   l = strlen(dcmfile);
   sdcmfi->FileName = (char *)calloc(l + 1, sizeof(char));
@@ -2478,9 +2832,12 @@ SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile)
   else
     sdcmfi->InversionTime = -1;
 
-  e = GetElementFromFile(dcmfile, 0x28, 0x107);
-  if (e)
+  e = GetElementFromObject(&object, 0x28, 0x107);
+  if (e) {
     sdcmfi->LargestValue = (float)*(e->d.us);
+    FreeElementData(e);
+    free(e);
+  }
   else
     sdcmfi->LargestValue = 0;
 
@@ -2496,15 +2853,15 @@ SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile)
   cond = GetDoubleFromString(&object, tag, &dtmp);
   sdcmfi->RepetitionTime = (float)dtmp;
 
-  strtmp = SiemensAsciiTagEx(dcmfile, "lRepetitions", 0);
+  strtmp = sdcmAsciiValue(ascii, "lRepetitions");
   if (strtmp != NULL) {
     // This can cause problems with DTI scans if lRepetitions is actually set
     sscanf(strtmp, "%d", &(sdcmfi->lRepetitions));
     free(strtmp);
   }
   else {
-    strtmp = SiemensAsciiTag(dcmfile, "sDiffusion.lDiffDirections", 0);
-    strtmp2 = SiemensAsciiTag(dcmfile, "sWiPMemBlock.alFree[8]", 0);
+    strtmp = sdcmAsciiValue(ascii, "sDiffusion.lDiffDirections");
+    strtmp2 = sdcmAsciiValue(ascii, "sWiPMemBlock.alFree[8]");
     if (strtmp != NULL && strtmp2 != NULL) {
       sscanf(strtmp, "%d", &nDiffDirections);
       sscanf(strtmp, "%d", &nB0);
@@ -2527,7 +2884,7 @@ SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile)
   sdcmfi->NFrames = sdcmfi->lRepetitions + 1;
   /* This is not the last word on NFrames. See sdfiAssignRunNo().*/
 
-  strtmp = SiemensAsciiTagEx(dcmfile, "sSliceArray.lSize", 0);
+  strtmp = sdcmAsciiValue(ascii, "sSliceArray.lSize");
   if (strtmp != NULL) {
     sscanf(strtmp, "%d", &(sdcmfi->SliceArraylSize));
     free(strtmp);
@@ -2536,7 +2893,7 @@ SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile)
     sdcmfi->SliceArraylSize = 0;
   }
 
-  strtmp = SiemensAsciiTagEx(dcmfile, "sSliceArray.asSlice[0].dPhaseFOV", 0);
+  strtmp = sdcmAsciiValue(ascii, "sSliceArray.asSlice[0].dPhaseFOV");
   if (strtmp != NULL) {
     sscanf(strtmp, "%f", &(sdcmfi->PhEncFOV));
     free(strtmp);
@@ -2545,7 +2902,7 @@ SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile)
     sdcmfi->PhEncFOV = 0;
   }
 
-  strtmp = SiemensAsciiTagEx(dcmfile, "sSliceArray.asSlice[0].dReadoutFOV", 0);
+  strtmp = sdcmAsciiValue(ascii, "sSliceArray.asSlice[0].dReadoutFOV");
   if (strtmp != NULL) {
     sscanf(strtmp, "%f", &(sdcmfi->ReadoutFOV));
     free(strtmp);
@@ -2554,34 +2911,35 @@ SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile)
     sdcmfi->ReadoutFOV = 0;
   }
 
-  sdcmfi->NImageRows = dcmGetNRows(dcmfile);
+  sdcmfi->NImageRows = dcmGetNRowsObject(&object);
   if (sdcmfi->NImageRows < 0) {
     printf("WARNING: Could not determine number of image rows in %s\n", sdcmfi->FileName);
     sdcmfi->ErrorFlag = 1;
   }
-  sdcmfi->NImageCols = dcmGetNCols(dcmfile);
+  sdcmfi->NImageCols = dcmGetNColsObject(&object);
   if (sdcmfi->NImageCols < 0) {
     printf("WARNING: Could not determine number of image cols in %s\n", sdcmfi->FileName);
     sdcmfi->ErrorFlag = 1;
   }
 
-  dcmImagePosition(dcmfile, &(sdcmfi->ImgPos[0]), &(sdcmfi->ImgPos[1]), &(sdcmfi->ImgPos[2]));
+  dcmImagePositionObject(&object, &(sdcmfi->ImgPos[0]), &(sdcmfi->ImgPos[1]), &(sdcmfi->ImgPos[2]));
 
-  dcmImageDirCos(dcmfile,
-                 &(sdcmfi->Vc[0]),
-                 &(sdcmfi->Vc[1]),
-                 &(sdcmfi->Vc[2]),
-                 &(sdcmfi->Vr[0]),
-                 &(sdcmfi->Vr[1]),
-                 &(sdcmfi->Vr[2]));
+  dcmImageDirCosFloat(&object,
+                      &(sdcmfi->Vc[0]),
+                      &(sdcmfi->Vc[1]),
+                      &(sdcmfi->Vc[2]),
+                      &(sdcmfi->Vr[0]),
+                      &(sdcmfi->Vr[1]),
+                      &(sdcmfi->Vr[2]));
 
   /* The following may return 1 (Vs[i] = 0 for all i) when there is no
      ASCII header (anonymization?). This is a show-stopper for mosaics.
      For non-mosaics, it is recoverable because we can sort the files
      and compute the slice dir cos from the image position.*/
-  retval = sdcmSliceDirCos(dcmfile, &(sdcmfi->Vs[0]), &(sdcmfi->Vs[1]), &(sdcmfi->Vs[2]));
+  retval = sdcmSliceDirCosAscii(ascii, &(sdcmfi->Vs[0]), &(sdcmfi->Vs[1]), &(sdcmfi->Vs[2]));
+  *pSliceDirCosPresent = (retval == 0);
 
-  sdcmfi->IsMosaic = sdcmIsMosaic(dcmfile, NULL, NULL, NULL, NULL);
+  sdcmfi->IsMosaic = sdcmIsMosaicObject(&object, ascii, NULL, NULL, NULL, NULL);
 
   /* If could not get sliceDirCos, then we calculate an initial value.
      This might not be used at all. If it is used, then it is only
@@ -2616,10 +2974,10 @@ SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile)
     /* Confirm sign by two files later  */
   }
 
-  dcmGetVolRes(dcmfile, &(sdcmfi->VolRes[0]), &(sdcmfi->VolRes[1]), &(sdcmfi->VolRes[2]));
+  dcmGetVolResObject(&object, &(sdcmfi->VolRes[0]), &(sdcmfi->VolRes[1]), &(sdcmfi->VolRes[2]));
 
   if (sdcmfi->IsMosaic) {
-    sdcmIsMosaic(dcmfile, &(sdcmfi->VolDim[0]), &(sdcmfi->VolDim[1]), &(sdcmfi->VolDim[2]), &(sdcmfi->NFrames));
+    sdcmIsMosaicObject(&object, ascii, &(sdcmfi->VolDim[0]), &(sdcmfi->VolDim[1]), &(sdcmfi->VolDim[2]), &(sdcmfi->NFrames));
   }
   else {
     sdcmfi->VolDim[0] = sdcmfi->NImageCols;
@@ -2641,6 +2999,7 @@ SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile)
       printf("ERROR: GetSDCMFileInfo(): dcmGetDWIParams() %d\n", err);
       printf("DICOM File: %s\n", dcmfile);
       printf("break %s:%d\n", __FILE__, __LINE__);
+      FreeSDCMFileInfo(&sdcmfi);
       return (NULL);
     }
     if (Gdiag_no > 0)
@@ -2657,14 +3016,6 @@ SDCMFILEINFO *GetSDCMFileInfo(const char *dcmfile)
     sdcmfi->bvecz = 0;
   }
 
-  // cleanup Ascii storage
-  SiemensAsciiTagEx(dcmfile, (char *)0, 1);
-
-  cond = DCM_CloseObject(&object);
-
-  /* Clear the condition stack to prevent overflow */
-  COND_PopCondition(1);
-
   return (sdcmfi);
 }
 /*----------------------------------------------------------*/
@@ -2756,6 +3107,12 @@ int FreeSDCMFileInfo(SDCMFILEINFO **ppsdcmfi)
   if (p->PhEncDir != NULL) {
     free(p->PhEncDir);
   }
+  if (p->NumarisVer != NULL) {
+    free(p->NumarisVer);
+  }
+  if (p->ScannerModel != NULL) {
+    free(p->ScannerModel);
+  }
 
   free(*ppsdcmfi);
   return (0);
@@ -2833,10 +3190,485 @@ char *sdcmExtractNumarisVer(const char *e_18_1020, int *Maj, int *Min, int *MinM
 
   return (ver);
 }
+/*--------------------------------------------------------------------
+  Index of the header info of the files in a Siemens DICOM directory.
+  Each entry holds the SDCMFILEINFO of one file along with the size
+  and modification time of the file so that a stale entry can be
+  detected. Files that are not Siemens DICOM files are kept too (with
+  a NULL sdfi) so that they are not parsed again.
+  *------------------------------------------------------------------*/
+typedef struct
+{
+  char *FileName;
+  long long size;
+  long long mtime;
+  int status;              // -1 = not a file, 0 = not siemens, 1 = siemens, 2 = error
+  int SliceDirCosPresent;  // see sdcmSliceDirCos()
+  SDCMFILEINFO *sdfi;
+} SDCMINDEXENTRY;
+
+#define SDCMINDEX_VERSION 1
+#define SDCMINDEX_NSTR 11
+#define SDCMINDEX_NINT 16
+#define SDCMINDEX_NFLT 26
+#define SDCMINDEX_NDBL 8
+
+/* Lists the fields of an SDCMFILEINFO (other than the file name) in
+   the order they are stored in the index file */
+static void sdcmIndexFields(SDCMFILEINFO *sdfi, char **str[], int *ival[], float *fval[], double *dval[])
+{
+  int n, k;
+
+  n = 0;
+  str[n++] = &sdfi->PatientName;
+  str[n++] = &sdfi->StudyDate;
+  str[n++] = &sdfi->StudyTime;
+  str[n++] = &sdfi->SeriesTime;
+  str[n++] = &sdfi->AcquisitionTime;
+  str[n++] = &sdfi->PulseSequence;
+  str[n++] = &sdfi->ProtocolName;
+  str[n++] = &sdfi->PhEncDir;
+  str[n++] = &sdfi->NumarisVer;
+  str[n++] = &sdfi->ScannerModel;
+  str[n++] = &sdfi->TransferSyntaxUID;
+
+  n = 0;
+  ival[n++] = &sdfi->EchoNo;
+  ival[n++] = &sdfi->SeriesNo;
+  ival[n++] = &sdfi->ImageNo;
+  ival[n++] = &sdfi->NImageRows;
+  ival[n++] = &sdfi->NImageCols;
+  ival[n++] = &sdfi->lRepetitions;
+  ival[n++] = &sdfi->SliceArraylSize;
+  ival[n++] = &sdfi->RunNo;
+  ival[n++] = &sdfi->IsMosaic;
+  for (k = 0; k < 3; k++) ival[n++] = &sdfi->VolDim[k];
+  ival[n++] = &sdfi->NFrames;
+  ival[n++] = &sdfi->nthDirection;
+  ival[n++] = &sdfi->UseSliceScaleFactor;
+  ival[n++] = &sdfi->ErrorFlag;
+
+  n = 0;
+  fval[n++] = &sdfi->FlipAngle;
+  fval[n++] = &sdfi->EchoTime;
+  fval[n++] = &sdfi->RepetitionTime;
+  fval[n++] = &sdfi->InversionTime;
+  fval[n++] = &sdfi->FieldStrength;
+  fval[n++] = &sdfi->PhEncFOV;
+  fval[n++] = &sdfi->ReadoutFOV;
+  for (k = 0; k < 3; k++) fval[n++] = &sdfi->ImgPos[k];
+  for (k = 0; k < 3; k++) fval[n++] = &sdfi->Vc[k];
+  for (k = 0; k < 3; k++) fval[n++] = &sdfi->Vr[k];
+  for (k = 0; k < 3; k++) fval[n++] = &sdfi->Vs[k];
+  for (k = 0; k < 3; k++) fval[n++] = &sdfi->VolRes[k];
+  for (k = 0; k < 3; k++) fval[n++] = &sdfi->VolCenter[k];
+  fval[n++] = &sdfi->LargestValue;
+
+  n = 0;
+  dval[n++] = &sdfi->bValue;
+  dval[n++] = &sdfi->SliceScaleFactor;
+  dval[n++] = &sdfi->bval;
+  dval[n++] = &sdfi->bvecx;
+  dval[n++] = &sdfi->bvecy;
+  dval[n++] = &sdfi->bvecz;
+  dval[n++] = &sdfi->RescaleIntercept;
+  dval[n++] = &sdfi->RescaleSlope;
+}
+
+/* Writes a string to the index, replacing the field and
+   record separators with spaces */
+static void sdcmIndexPutString(FILE *fp, const char *s)
+{
+  fputc('\t', fp);
+  if (s == NULL) {
+    return;
+  }
+  for (; *s; s++) {
+    fputc((*s == '\t' || *s == '\n' || *s == '\r') ? ' ' : *s, fp);
+  }
+}
+
+/*--------------------------------------------------------------------
+  sdcmWriteIndex() - writes the index entries to IndexFile as text,
+  one tab-separated line per file. The file is written under a
+  temporary name and then renamed, so readers never see a partial
+  index. Returns 0 on success.
+  *------------------------------------------------------------------*/
+static int sdcmWriteIndex(const char *IndexFile, SDCMINDEXENTRY *entries, int nentries)
+{
+  char **pstr[SDCMINDEX_NSTR];
+  int *pival[SDCMINDEX_NINT];
+  float *pfval[SDCMINDEX_NFLT];
+  double *pdval[SDCMINDEX_NDBL];
+  std::string tmpfile;
+  FILE *fp;
+  int n, k;
+
+  tmpfile = std::string(IndexFile) + ".tmp";
+  fp = fopen(tmpfile.c_str(), "w");
+  if (fp == NULL) {
+    printf("WARNING: could not open %s for writing, DICOM index not saved\n", tmpfile.c_str());
+    return (1);
+  }
+
+  fprintf(fp, "sdcmindex %d %d\n", SDCMINDEX_VERSION, nentries);
+  for (n = 0; n < nentries; n++) {
+    if (entries[n].status != 0 && entries[n].status != 1) {
+      continue;
+    }
+    fprintf(fp, "%s\t%lld\t%lld\t%d\t%d", entries[n].FileName, entries[n].size, entries[n].mtime,
+            entries[n].status, entries[n].SliceDirCosPresent);
+    if (entries[n].status == 1) {
+      sdcmIndexFields(entries[n].sdfi, pstr, pival, pfval, pdval);
+      for (k = 0; k < SDCMINDEX_NSTR; k++) sdcmIndexPutString(fp, *pstr[k]);
+      for (k = 0; k < SDCMINDEX_NINT; k++) fprintf(fp, "\t%d", *pival[k]);
+      for (k = 0; k < SDCMINDEX_NFLT; k++) fprintf(fp, "\t%.9g", *pfval[k]);
+      for (k = 0; k < SDCMINDEX_NDBL; k++) fprintf(fp, "\t%.17g", *pdval[k]);
+    }
+    fprintf(fp, "\n");
+  }
+
+  if (fclose(fp) != 0 || rename(tmpfile.c_str(), IndexFile) != 0) {
+    printf("WARNING: could not write DICOM index %s\n", IndexFile);
+    unlink(tmpfile.c_str());
+    return (1);
+  }
+  return (0);
+}
+
+/*--------------------------------------------------------------------
+  sdcmReadIndex() - reads an index written by sdcmWriteIndex(). Returns
+  NULL if the file does not exist or is not a valid index.
+  *------------------------------------------------------------------*/
+static SDCMINDEXENTRY *sdcmReadIndex(const char *IndexFile, int *nentries)
+{
+  const int ntokmax = 5 + SDCMINDEX_NSTR + SDCMINDEX_NINT + SDCMINDEX_NFLT + SDCMINDEX_NDBL;
+  char *tok[ntokmax + 1];
+  char **pstr[SDCMINDEX_NSTR];
+  int *pival[SDCMINDEX_NINT];
+  float *pfval[SDCMINDEX_NFLT];
+  double *pdval[SDCMINDEX_NDBL];
+  SDCMINDEXENTRY *entries, *entry;
+  char *line = NULL, *p;
+  size_t linecap = 0;
+  ssize_t linelen;
+  int version, nmax, ntok, k, m;
+  FILE *fp;
+
+  *nentries = 0;
+  fp = fopen(IndexFile, "r");
+  if (fp == NULL) {
+    return (NULL);
+  }
+  if (fscanf(fp, "sdcmindex %d %d\n", &version, &nmax) != 2 || version != SDCMINDEX_VERSION || nmax < 0) {
+    printf("WARNING: %s is not a DICOM index, ignoring\n", IndexFile);
+    fclose(fp);
+    return (NULL);
+  }
+
+  entries = (SDCMINDEXENTRY *)calloc(nmax + 1, sizeof(SDCMINDEXENTRY));
+  while (*nentries < nmax && (linelen = getline(&line, &linecap, fp)) > 0) {
+    if (line[linelen - 1] == '\n') {
+      line[linelen - 1] = '\0';
+    }
+    ntok = 0;
+    p = line;
+    while (p != NULL && ntok <= ntokmax) {
+      tok[ntok++] = strsep(&p, "\t");
+    }
+
+    entry = &entries[*nentries];
+    if (ntok < 5) {
+      continue;
+    }
+    entry->status = atoi(tok[3]);
+    if (!(entry->status == 0 && ntok == 5) && !(entry->status == 1 && ntok == ntokmax)) {
+      continue;  // malformed, the file will just be parsed again
+    }
+    entry->FileName = strcpyalloc(tok[0]);
+    entry->size = atoll(tok[1]);
+    entry->mtime = atoll(tok[2]);
+    entry->SliceDirCosPresent = atoi(tok[4]);
+    if (entry->status == 1) {
+      entry->sdfi = (SDCMFILEINFO *)calloc(1, sizeof(SDCMFILEINFO));
+      entry->sdfi->FileName = strcpyalloc(tok[0]);
+      sdcmIndexFields(entry->sdfi, pstr, pival, pfval, pdval);
+      m = 5;
+      for (k = 0; k < SDCMINDEX_NSTR; k++) *pstr[k] = strcpyalloc(tok[m++]);
+      for (k = 0; k < SDCMINDEX_NINT; k++) *pival[k] = atoi(tok[m++]);
+      for (k = 0; k < SDCMINDEX_NFLT; k++) *pfval[k] = atof(tok[m++]);
+      for (k = 0; k < SDCMINDEX_NDBL; k++) *pdval[k] = atof(tok[m++]);
+    }
+    (*nentries)++;
+  }
+  free(line);
+  fclose(fp);
+
+  return (entries);
+}
+
+/*--------------------------------------------------------------------
+  sdcmOpenObject() - opens a DICOM file trying each of the encodings
+  that IsDICOM() and GetObjectFromFile() try, but without the separate
+  IsDICOM() pass and without dumping the condition stack on failure.
+  Returns NULL if the file cannot be read as DICOM. The pixel data are
+  not read.
+  *------------------------------------------------------------------*/
+static DCM_OBJECT *sdcmOpenObject(const char *fname)
+{
+  CONDITION cond;
+  DCM_OBJECT *object = 0;
+  unsigned long options = DCM_ACCEPTVRMISMATCH;
+
+  cond = DCM_OpenFile(fname, DCM_PART10FILE | options, &object);
+  if (cond != DCM_NORMAL) {
+    DCM_CloseObject(&object);
+    cond = DCM_OpenFile(fname, DCM_ORDERLITTLEENDIAN | options, &object);
+  }
+  if (cond != DCM_NORMAL) {
+    DCM_CloseObject(&object);
+    cond = DCM_OpenFile(fname, DCM_ORDERBIGENDIAN | options, &object);
+  }
+  if (cond != DCM_NORMAL) {
+    DCM_CloseObject(&object);
+    cond = DCM_OpenFile(fname, DCM_FORMATCONVERSION | options, &object);
+  }
+  if (cond != DCM_NORMAL) {
+    DCM_CloseObject(&object);
+    COND_PopCondition(1);
+    return (NULL);
+  }
+  return (object);
+}
+
+/* Same test as IsSiemensDICOM() on an open object */
+static int sdcmIsSiemensObject(DCM_OBJECT **object, const char *dcmfile)
+{
+  DCM_ELEMENT *e;
+  int IsSiemens;
+
+  e = GetElementFromObject(object, 0x8, 0x70);
+  if (e == NULL) {
+    printf(
+        "WARNING: searching dicom file %s for "
+        "Manufacturer tag 0x8, 0x70\n",
+        dcmfile);
+    printf("WARNING: the result could be a mess.\n");
+    return (0);
+  }
+  /* Siemens appears to add a space onto the end of their
+     Manufacturer string*/
+  IsSiemens = (strcmp(e->d.string, "SIEMENS") == 0 || strcmp(e->d.string, "SIEMENS ") == 0);
+  FreeElementData(e);
+  free(e);
+  return (IsSiemens);
+}
+
+/*--------------------------------------------------------------------
+  sdcmIndexFileName() - returns the name of the index file to use for
+  the Siemens DICOM files in dirname, or NULL if no index is to be
+  used. This is SDCMIndexFile if it has been set. Otherwise, if the
+  FS_SDCM_INDEX environment variable is set (to anything but 0), the
+  index is kept next to the series as dirname/.sdcmindex. Free the
+  result.
+  *------------------------------------------------------------------*/
+static char *sdcmIndexFileName(const char *dirname)
+{
+  char *pc;
+  std::string fname;
+
+  if (SDCMIndexFile != NULL) {
+    return (strcpyalloc(SDCMIndexFile));
+  }
+  pc = getenv("FS_SDCM_INDEX");
+  if (pc == NULL || strcmp(pc, "0") == 0) {
+    return (NULL);
+  }
+  fname = std::string(dirname) + "/.sdcmindex";
+  return (strcpyalloc(fname.c_str()));
+}
+
+/*--------------------------------------------------------------------
+  sdcmIndexFiles() - loads the header info of each of the nFiles files
+  in FileList into sdfi_list[n] (NULL if the file is not a Siemens
+  DICOM file). This gives the same result as calling GetSDCMFileInfo()
+  on each file, but each file is only read once (up to the pixel data)
+  and the files are spread over threads. The ASCII header is read in
+  parallel, which also pulls the DICOM header into the page cache. The
+  DICOM parse itself is serialized because the CTN library keeps its
+  condition stack in globals, but by then it no longer has to wait on
+  the disk.
+
+  If IndexFile is non-NULL and exists, entries for files whose size and
+  modification time have not changed are taken from it instead of being
+  parsed. If UpdateIndex is set, IndexFile is then rewritten with the
+  entries of all the files in the list.
+
+  Progress is reported with exec_progress_callback() and written to
+  SDCMStatusFile (if set). Returns 0 if all the Siemens files could be
+  loaded, 1 otherwise.
+  *------------------------------------------------------------------*/
+int sdcmIndexFiles(char **FileList, int nFiles, const char *IndexFile, int UpdateIndex, SDCMFILEINFO **sdfi_list)
+{
+  SDCMINDEXENTRY *entries, *cache = NULL;
+  std::map<std::string, int> cachemap;
+  std::map<std::string, int>::iterator it;
+  int ncache = 0, nparse, nfromcache, ndone, sumpct, n, err;
+  struct stat st;
+
+  entries = (SDCMINDEXENTRY *)calloc(nFiles, sizeof(SDCMINDEXENTRY));
+  for (n = 0; n < nFiles; n++) {
+    entries[n].FileName = FileList[n];
+    entries[n].status = -1;
+    sdfi_list[n] = NULL;
+  }
+
+  if (IndexFile != NULL) {
+    cache = sdcmReadIndex(IndexFile, &ncache);
+    for (n = 0; n < ncache; n++) {
+      cachemap[std::string(cache[n].FileName)] = n;
+    }
+  }
+
+  /* Take what can be taken from the index. This is done serially so
+     that an entry is only handed out once. */
+  nparse = 0;
+  nfromcache = 0;
+  for (n = 0; n < nFiles; n++) {
+    if (stat(FileList[n], &st) != 0 || !S_ISREG(st.st_mode)) {
+      continue;
+    }
+    if (IndexFile != NULL && strcmp(FileList[n], IndexFile) == 0) {
+      continue;
+    }
+    entries[n].size = st.st_size;
+    entries[n].mtime = st.st_mtime;
+    it = cachemap.find(std::string(FileList[n]));
+    if (it != cachemap.end()) {
+      SDCMINDEXENTRY *c = &cache[it->second];
+      if (c->FileName != NULL && c->size == entries[n].size && c->mtime == entries[n].mtime) {
+        entries[n].status = c->status;
+        entries[n].SliceDirCosPresent = c->SliceDirCosPresent;
+        entries[n].sdfi = c->sdfi;
+        c->sdfi = NULL;
+        free(c->FileName);
+        c->FileName = NULL;
+        nfromcache++;
+        continue;
+      }
+    }
+    entries[n].status = 0;
+    nparse++;
+  }
+  if (IndexFile != NULL) {
+    printf("INFO: %d of %d files found in DICOM index %s\n", nfromcache, nFiles, IndexFile);
+  }
+  for (n = 0; n < ncache; n++) {
+    if (cache[n].sdfi) FreeSDCMFileInfo(&cache[n].sdfi);
+    if (cache[n].FileName) free(cache[n].FileName);
+  }
+  if (cache) free(cache);
+
+  fprintf(stderr, "%2d ", 0);
+  ndone = 0;
+  sumpct = 0;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 1)
+#endif
+  for (n = 0; n < nFiles; n++) {
+    ROMP_PFLB_begin
+    SDCMINDEXENTRY *entry = &entries[n];
+    SDCMASCII *ascii = NULL;
+    DCM_OBJECT *object;
+    int pct;
+
+    if (entry->status == 0 && entry->sdfi == NULL) {
+      // Check the manufacturer first so that the ASCII header is only
+      // searched for in Siemens files, and only up to the pixel data.
+      long limit = 0;
+#ifdef HAVE_OPENMP
+      #pragma omp critical(sdcm_ctn)
+#endif
+      {
+        object = sdcmOpenObject(entry->FileName);
+        if (object != NULL) {
+          if (sdcmIsSiemensObject(&object, entry->FileName)) {
+            limit = sdcmAsciiLimit(&object, entry->FileName);
+          }
+          else {
+            DCM_CloseObject(&object);
+            COND_PopCondition(1);
+          }
+        }
+      }
+      if (object != NULL) {
+        ascii = sdcmAsciiLoad(entry->FileName, limit);
+#ifdef HAVE_OPENMP
+        #pragma omp critical(sdcm_ctn)
+#endif
+        {
+          entry->sdfi = sdcmFileInfoFromObject(entry->FileName, &object, ascii, &entry->SliceDirCosPresent);
+          entry->status = (entry->sdfi != NULL) ? 1 : 2;
+          DCM_CloseObject(&object);
+          COND_PopCondition(1);
+        }
+        sdcmAsciiFree(&ascii);
+      }
+    }
+
+#ifdef HAVE_OPENMP
+    #pragma omp critical(sdcm_progress)
+#endif
+    {
+      ndone++;
+      exec_progress_callback(ndone - 1, nFiles, 0, 1);
+      pct = rint(100 * ndone / nFiles) - sumpct;
+      if (pct >= 2) {
+        sumpct += pct;
+        fprintf(stderr, "%3d ", sumpct);
+        fflush(stderr);
+        if (SDCMStatusFile != NULL) {
+          FILE *fp = fopen(SDCMStatusFile, "w");
+          if (fp != NULL) {
+            fprintf(fp, "%3d\n", sumpct);
+            fclose(fp);
+          }
+        }
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+  fprintf(stderr, "\n");
+
+  err = 0;
+  for (n = 0; n < nFiles; n++) {
+    if (entries[n].status == 1) {
+      sdfi_list[n] = entries[n].sdfi;
+      // same as if the files had been loaded one after the other
+      sliceDirCosPresent = entries[n].SliceDirCosPresent;
+    }
+    if (entries[n].status == 2) {
+      err = 1;
+    }
+  }
+
+  if (IndexFile != NULL && UpdateIndex && !err && nparse > 0) {
+    if (sdcmWriteIndex(IndexFile, entries, nFiles) == 0) {
+      printf("INFO: wrote DICOM index %s\n", IndexFile);
+    }
+  }
+
+  free(entries);
+  return (err);
+}
 /*--------------------------------------------------------------------
   ScanSiemensDCMDir() - similar to ScanDir but returns only files that
   are Siemens DICOM Files. It also returns a pointer to an array of
-  SDCMFILEINFO structures.
+  SDCMFILEINFO structures. The files are loaded with sdcmIndexFiles();
+  see sdcmIndexFileName() for when the index is kept on disk.
 
   Author: Douglas Greve.
   Date: 09/10/2001
@@ -2847,9 +3679,9 @@ SDCMFILEINFO **ScanSiemensDCMDir(const char *PathName, int *NSDCMFiles)
   int i, pathlength;
   int NFiles;
   char tmpstr[1000];
+  char **FileList, *IndexFile;
   SDCMFILEINFO **sdcmfi_list;
-  int pct, sumpct;
-  FILE *fp;
+  int err;
 
   char *pname = (char *)calloc(strlen(PathName) + 1, sizeof(char));
   strcpy(pname, PathName);
@@ -2876,62 +3708,45 @@ SDCMFILEINFO **ScanSiemensDCMDir(const char *PathName, int *NSDCMFiles)
   }
   fprintf(stderr, "INFO: Found %d files in %s\n", NFiles, pname);
 
-  /* Count the number of Siemens DICOM Files */
-  fprintf(stderr, "INFO: counting Siemens Files\n");
-  (*NSDCMFiles) = 0;
+  FileList = (char **)calloc(NFiles, sizeof(char *));
   for (i = 0; i < NFiles; i++) {
     sprintf(tmpstr, "%s/%s", pname, NameList[i]->d_name);
-    if (IsSiemensDICOM(tmpstr)) {
-      (*NSDCMFiles)++;
-    }
+    FileList[i] = strcpyalloc(tmpstr);
   }
 
-  fprintf(stderr, "INFO: found %d Siemens Files\n", *NSDCMFiles);
-
-  if (*NSDCMFiles == 0) {
-    free(pname);
-    return (NULL);
-  }
-
-  sdcmfi_list = (SDCMFILEINFO **)calloc(*NSDCMFiles, sizeof(SDCMFILEINFO *));
-
   fprintf(stderr, "INFO: scanning info from Siemens Files\n");
 
   if (SDCMStatusFile != NULL) {
     fprintf(stderr, "INFO: status file is %s\n", SDCMStatusFile);
   }
 
-  fprintf(stderr, "%2d ", 0);
-  sumpct = 0;
+  IndexFile = sdcmIndexFileName(pname);
+  sdcmfi_list = (SDCMFILEINFO **)calloc(NFiles, sizeof(SDCMFILEINFO *));
+  err = sdcmIndexFiles(FileList, NFiles, IndexFile, 1, sdcmfi_list);
+
+  /* Keep only the Siemens DICOM Files */
   (*NSDCMFiles) = 0;
   for (i = 0; i < NFiles; i++) {
-    // fprintf(stderr,"%4d ",i);
-    pct = rint(100 * (i + 1) / NFiles) - sumpct;
-    if (pct >= 2) {
-      sumpct += pct;
-      fprintf(stderr, "%3d ", sumpct);
-      fflush(stderr);
-      if (SDCMStatusFile != NULL) {
-        fp = fopen(SDCMStatusFile, "w");
-        if (fp != NULL) {
-          fprintf(fp, "%3d\n", sumpct);
-          fclose(fp);
-        }
-      }
+    if (sdcmfi_list[i] == NULL) {
+      continue;
     }
-
-    sprintf(tmpstr, "%s/%s", pname, NameList[i]->d_name);
-    if (IsSiemensDICOM(tmpstr)) {
-      sdcmfi_list[*NSDCMFiles] = GetSDCMFileInfo(tmpstr);
-      if (sdcmfi_list[*NSDCMFiles] == NULL) {
-        return (NULL);
-      }
-      (*NSDCMFiles)++;
+    if (err) {
+      FreeSDCMFileInfo(&sdcmfi_list[i]);
+      continue;
     }
+    sdcmfi_list[*NSDCMFiles] = sdcmfi_list[i];
+    (*NSDCMFiles)++;
   }
-  fprintf(stderr, "\n");
+  fprintf(stderr, "INFO: found %d Siemens Files\n", *NSDCMFiles);
 
   // free memory
+  for (i = 0; i < NFiles; i++) {
+    free(FileList[i]);
+  }
+  free(FileList);
+  if (IndexFile) {
+    free(IndexFile);
+  }
   while (NFiles--) {
     free(NameList[NFiles]);
   }
@@ -2939,49 +3754,64 @@ SDCMFILEINFO **ScanSiemensDCMDir(const char *PathName, int *NSDCMFiles)
 
   free(pname);
 
+  if (err || *NSDCMFiles == 0) {
+    free(sdcmfi_list);
+    return (NULL);
+  }
+
   return (sdcmfi_list);
 }
 /*--------------------------------------------------------------------
   LoadSiemensSeriesInfo() - loads header info from each of the nList
   files listed in SeriesList. This list is obtained from either
-  ReadSiemensSeries() or ScanSiemensSeries().
+  ReadSiemensSeries() or ScanSiemensSeries(). The files are loaded
+  with sdcmIndexFiles(), using the index of the directory if there is
+  one (but without updating it, since this is only part of the
+  directory).
   Author: Douglas Greve.
   Date: 09/10/2001
   *------------------------------------------------------------------*/
 SDCMFILEINFO **LoadSiemensSeriesInfo(char **SeriesList, int nList)
 {
   SDCMFILEINFO **sdfi_list;
-  int n;
+  char *dirname, *IndexFile;
+  int n, err;
 
   // printf("LoadSiemensSeriesInfo()\n");
 
+  if (SeriesList == NULL || nList <= 0) {
+    fprintf(stderr, "ERROR: LoadSiemensSeriesInfo(): no files in series\n");
+    return (NULL);
+  }
+
   sdfi_list = (SDCMFILEINFO **)calloc(nList, sizeof(SDCMFILEINFO *));
 
-  for (n = 0; n < nList; n++) {
-    fflush(stdout);
-    fflush(stderr);
+  dirname = fio_dirname(SeriesList[0]);
+  IndexFile = sdcmIndexFileName(dirname);
+  free(dirname);
+
+  err = sdcmIndexFiles(SeriesList, nList, IndexFile, 0, sdfi_list);
+  if (IndexFile) {
+    free(IndexFile);
+  }
 
-    // printf("%3d %s ---------------\n",n,SeriesList[n]);
-    if (!IsSiemensDICOM(SeriesList[n])) {
+  for (n = 0; n < nList; n++) {
+    if (sdfi_list[n] == NULL && !err) {
       fprintf(stderr, "ERROR: %s is not a Siemens DICOM File\n", SeriesList[n]);
-      fflush(stderr);
-      free(sdfi_list);
-      return (NULL);
+      err = 1;
     }
-
-    // printf("Getting file info %s ---------------\n",SeriesList[n]);
-    fflush(stdout);
-    fflush(stderr);
-    sdfi_list[n] = GetSDCMFileInfo(SeriesList[n]);
-    if (sdfi_list[n] == NULL) {
-      fprintf(stderr, "ERROR: reading %s \n", SeriesList[n]);
-      fflush(stderr);
-      free(sdfi_list);
-      return (NULL);
+  }
+  if (err) {
+    fprintf(stderr, "ERROR: reading Siemens DICOM series\n");
+    for (n = 0; n < nList; n++) {
+      if (sdfi_list[n]) {
+        FreeSDCMFileInfo(&sdfi_list[n]);
+      }
     }
-    exec_progress_callback(n, nList, 0, 1);
+    fflush(stderr);
+    free(sdfi_list);
+    return (NULL);
   }
-  fprintf(stderr, "\n");
   fflush(stdout);
   fflush(stderr);
 
@@ -20,6 +20,10 @@
 #include "romp_support.h"
 #include "vertexRotator.h"
 
+#include <algorithm>
+#include <complex>
+#include <vector>
+
 static float* getFloats(size_t capacity) {
   void* ptr = NULL;
   int status = posix_memalign(&ptr, 64, capacity*sizeof(float));
@@ -32,14 +36,20 @@ static float* getFloats(size_t capacity) {
   return (float*)ptr;
 }
 
-void MRISrigidBodyAlignGlobal_findMinSSE(
+// The search is done relative to the vertices first being rotated by (pre_alpha, pre_beta, pre_gamma),
+// which lets the spherical harmonic search below refine around its candidates
+//
+static void findMinSSE_wkr(
   double* new_mina, double* new_minb, double* new_ming, double* new_sse,  // outputs
   MRI_SURFACE*       mris,
   INTEGRATION_PARMS* parms,
   float              min_radians,
   float              max_radians,
   double             ext_sse,
-  int                nangles) {
+  int                nangles,
+  float              pre_alpha,
+  float              pre_beta,
+  float              pre_gamma) {
 
   bool const tracing     = false;
   bool const spreadsheet = false;
@@ -87,6 +97,10 @@ void MRISrigidBodyAlignGlobal_findMinSSE(
     }
   }
 
+  if (pre_alpha != 0.0f || pre_beta != 0.0f || pre_gamma != 0.0f) {
+    rotateVertices(xv, yv, zv, xv, yv, zv, verticesSize, pre_alpha, pre_beta, pre_gamma);
+  }
+
   // TODO sort on z
   // to maximize cache hit rate in the MRISPfunctionVal_radiusR function
   
@@ -494,3 +508,452 @@ void MRISrigidBodyAlignGlobal_findMinSSE(
 }
 
 
+
+void MRISrigidBodyAlignGlobal_findMinSSE(
+  double* new_mina, double* new_minb, double* new_ming, double* new_sse,  // outputs
+  MRI_SURFACE*       mris,
+  INTEGRATION_PARMS* parms,
+  float              min_radians,
+  float              max_radians,
+  double             ext_sse,
+  int                nangles) {
+
+  findMinSSE_wkr(new_mina, new_minb, new_ming, new_sse, 
+    mris, parms, min_radians, max_radians, ext_sse, nangles, 
+    0.0f, 0.0f, 0.0f);
+}
+
+
+// Spherical harmonic search
+//
+// The source curvature f and the std-normalized template h are expanded in spherical harmonics
+// up to degree shLmax.  The correlation  C(M) = sum_v f(p_v) h(M p_v)  between the source and the
+// rotated template is then
+//
+//      C(R) = sum_l sum_m' sum_m  conj(f_lm') D^l_m'm(R) h_lm          R = inverse(M)
+//
+// and with R written as the zyz Euler rotation Rz(a) Ry(b) Rz(g), D^l_m'm(R) = exp(-i m' a) d^l_m'm(b) exp(-i m g).
+// So for each b the correlation over all the (a, g) pairs is a 2D Fourier sum, which gives C for the whole grid
+// of rotations at roughly the cost of a few SSE evaluations.  The best peaks inside the angular window of the
+// grid search are then scored with the true SSE, and the best one is refined by the grid search over a small window.
+//
+typedef std::complex<double> SHcomplex;
+
+static int const shLmax         = 16;       // highest degree
+static int const shNangles      = 128;      // samples of a and g over [0,2pi), b uses half as many over [0,pi]
+static int const shNcandidates  = 8;        // peaks whose true SSE is computed
+
+static int shIndex(int l, int m) { return l*(l+1)/2 + m; }      // 0 <= m <= l
+static int const shSize = (shLmax+1)*(shLmax+2)/2;
+
+// Orthonormal associated Legendre functions, with the Condon-Shortley phase, for all 0 <= m <= l <= shLmax
+//
+static void shLegendre(double* p, double x) {
+  double const s = sqrt(std::max(0.0, 1.0 - x*x));
+  double pmm = sqrt(1.0/(4.0*M_PI));
+  int m;
+  for (m = 0; m <= shLmax; m++) {
+    if (m > 0) pmm *= -sqrt((2.0*m + 1.0)/(2.0*m)) * s;
+    p[shIndex(m,m)] = pmm;
+    if (m == shLmax) break;
+    double pl2 = pmm;
+    double pl1 = x * sqrt(2.0*m + 3.0) * pmm;
+    p[shIndex(m+1,m)] = pl1;
+    int l;
+    for (l = m+2; l <= shLmax; l++) {
+      double const a  = sqrt((4.0*l*l - 1.0)/(double(l)*l - double(m)*m));
+      double const b  = sqrt((double(l-1)*(l-1) - double(m)*m)/(4.0*(l-1)*(l-1) - 1.0));
+      double const pl = a*(x*pl1 - b*pl2);
+      p[shIndex(l,m)] = pl;
+      pl2 = pl1; pl1 = pl;
+    }
+  }
+}
+
+// Adds w*value*conj(Y_lm(x,y,z)) into coefs, for a point on the unit sphere
+//
+static void shAccumulate(SHcomplex* coefs, double w, double x, double y, double z) {
+  double p[shSize];
+  shLegendre(p, z);
+  double const phi = atan2(y, x);
+  SHcomplex const step(cos(phi), -sin(phi));
+  SHcomplex e(w, 0.0);
+  int m;
+  for (m = 0; m <= shLmax; m++) {
+    int l;
+    for (l = m; l <= shLmax; l++) coefs[shIndex(l,m)] += p[shIndex(l,m)] * e;
+    e *= step;
+  }
+}
+
+// The coefficient for negative m of a real function
+//
+static SHcomplex shCoef(SHcomplex const* coefs, int l, int m) {
+  if (m >= 0) return coefs[shIndex(l,m)];
+  SHcomplex const c = std::conj(coefs[shIndex(l,-m)]);
+  return (m & 1) ? -c : c;
+}
+
+// Wigner small d^l_m'm(b) for all l <= shLmax, stored at d[l][m'+shLmax][m+shLmax]
+// The explicit sum is accurate enough in long double at these degrees
+//
+typedef double SHwignerD[shLmax+1][2*shLmax+1][2*shLmax+1];
+
+static void shWignerD(SHwignerD d, double b) {
+  long double fact[2*shLmax+2];
+  fact[0] = 1.0L;
+  int i;
+  for (i = 1; i < 2*shLmax+2; i++) fact[i] = fact[i-1]*i;
+
+  long double const c = cosl(b/2.0L), s = sinl(b/2.0L);
+  long double cp[2*shLmax+1], sp[2*shLmax+1];
+  cp[0] = sp[0] = 1.0L;
+  for (i = 1; i <= 2*shLmax; i++) { cp[i] = cp[i-1]*c; sp[i] = sp[i-1]*s; }
+
+  int l;
+  for (l = 0; l <= shLmax; l++) {
+    int mp;
+    for (mp = -l; mp <= l; mp++) {
+      int m;
+      for (m = -l; m <= l; m++) {
+        long double sum = 0.0L;
+        int k;
+        for (k = std::max(0, m - mp); k <= std::min(l + m, l - mp); k++) {
+          long double const t = cp[2*l + m - mp - 2*k] * sp[mp - m + 2*k] 
+                              / (fact[l + m - k] * fact[k] * fact[mp - m + k] * fact[l - mp - k]);
+          sum += ((mp - m + k) & 1) ? -t : t;
+        }
+        d[l][mp+shLmax][m+shLmax] = (double)(sqrtl(fact[l+mp]*fact[l-mp]*fact[l+m]*fact[l-m]) * sum);
+      }
+    }
+  }
+}
+
+// The matrix of the rotation done by rotateVertices and MRISrotate, and its inverse
+//
+static void rbaMatrix(double M[3][3], float alpha, float beta, float gamma) {
+  int j;
+  for (j = 0; j < 3; j++) {
+    float xi = (j == 0), yi = (j == 1), zi = (j == 2), xo, yo, zo;
+    rotateVertices(&xo, &yo, &zo, &xi, &yi, &zi, 1, alpha, beta, gamma);
+    M[0][j] = xo; M[1][j] = yo; M[2][j] = zo;
+  }
+}
+
+static void rbaAngles(double M[3][3], double* alpha, double* beta, double* gamma) {
+  *beta  = asin(std::max(-1.0, std::min(1.0, M[2][0])));
+  *gamma = atan2( M[2][1], M[2][2]);
+  *alpha = atan2(-M[1][0], M[0][0]);
+}
+
+// The SSE for a single rotation, computed exactly as findMinSSE_wkr does
+//
+static double rbaSSE(
+  MRI_SURFACE* mris, INTEGRATION_PARMS* parms,
+  float const* curv, float const* xv, float const* yv, float const* zv, size_t verticesSize,
+  float* rx, float* ry, float* rz,
+  float alpha, float beta, float gamma) {
+
+  rotateVertices(rx, ry, rz, xv, yv, zv, verticesSize, 0.0, beta, gamma);
+
+  int    const numberOfVerticesPartitions = 16;
+  int    const verticesPerPartition = (verticesSize + numberOfVerticesPartitions - 1)/numberOfVerticesPartitions;
+  double ssesForPartitions[numberOfVerticesPartitions];
+
+  ROMP_PF_begin
+  int partition;
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+  for (partition = 0; partition < numberOfVerticesPartitions; partition++) {
+    ROMP_PFLB_begin
+    int const viLo = partition*verticesPerPartition;
+    int const viHi = MIN(verticesSize, (unsigned)viLo + verticesPerPartition);
+    double sse = 0.0;
+    int vi;
+    for (vi = viLo; vi < viHi; vi++) {
+      MRISPfunctionValResultForAlpha fv;
+      MRISPfunctionVal_radiusR(parms->mrisp_template, &fv, mris->radius, rx[vi], ry[vi], rz[vi],
+        parms->frame_no, true, &alpha, 1, false);
+      double sqrt_std = sqrt(fv.next);
+      if (FZERO(sqrt_std)) sqrt_std = DEFAULT_STD;
+      double const delta = (curv[vi] - fv.curr) / sqrt_std;
+      sse += parms->abs_norm ? fabs(delta) : delta*delta;
+    }
+    ssesForPartitions[partition] = sse;
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  double sse = 0.0;
+  int p;
+  for (p = 0; p < numberOfVerticesPartitions; p++) sse += ssesForPartitions[p];
+  return sse;
+}
+
+
+void MRISrigidBodyAlignGlobal_findMinSSE_SH(
+  double* new_mina, double* new_minb, double* new_ming, double* new_sse,  // outputs
+  MRI_SURFACE*       mris,
+  INTEGRATION_PARMS* parms,
+  float              min_radians,
+  float              max_radians,
+  double             ext_sse,
+  int                nangles) {
+
+  // Get the non-ripped vertices, projected onto the sphere of radius mris->radius
+  //
+  size_t const verticesCapacity = mris->nvertices;
+  float* const curv = getFloats(verticesCapacity);
+  float* const area = getFloats(verticesCapacity);
+  float* const xv   = getFloats(verticesCapacity);
+  float* const yv   = getFloats(verticesCapacity);
+  float* const zv   = getFloats(verticesCapacity);
+  float* const rx   = getFloats(verticesCapacity);
+  float* const ry   = getFloats(verticesCapacity);
+  float* const rz   = getFloats(verticesCapacity);
+
+  size_t verticesSize = 0;
+  double totalArea = 0.0;
+  int vno;
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX const * v = &mris->vertices[vno];
+    if (v->ripflag) continue;
+    float const invLength = mris->radius/sqrtf(squaref(v->x)+squaref(v->y)+squaref(v->z));
+    xv[verticesSize] = v->x * invLength;
+    yv[verticesSize] = v->y * invLength;
+    zv[verticesSize] = v->z * invLength;
+    curv[verticesSize] = v->curv;
+    area[verticesSize] = v->area;
+    totalArea += v->area;
+    verticesSize++;
+  }
+  bool const useArea = totalArea > 0.0;
+
+  // The coefficients of the source, partitioned so the sums are reproducible
+  //
+  int const numberOfVerticesPartitions = 16;
+  int const verticesPerPartition = (verticesSize + numberOfVerticesPartitions - 1)/numberOfVerticesPartitions;
+  std::vector<SHcomplex> fPartitions(numberOfVerticesPartitions*shSize, SHcomplex(0.0, 0.0));
+
+  ROMP_PF_begin
+  int partition;
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+  for (partition = 0; partition < numberOfVerticesPartitions; partition++) {
+    ROMP_PFLB_begin
+    SHcomplex* const coefs = &fPartitions[partition*shSize];
+    int const viLo = partition*verticesPerPartition;
+    int const viHi = MIN(verticesSize, (unsigned)viLo + verticesPerPartition);
+    int vi;
+    for (vi = viLo; vi < viHi; vi++) {
+      double const w = useArea ? 4.0*M_PI*area[vi]/totalArea : 4.0*M_PI/verticesSize;
+      shAccumulate(coefs, w*curv[vi], xv[vi]/mris->radius, yv[vi]/mris->radius, zv[vi]/mris->radius);
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  std::vector<SHcomplex> f(shSize, SHcomplex(0.0, 0.0));
+  int p;
+  for (p = 0; p < numberOfVerticesPartitions; p++) {
+    int i;
+    for (i = 0; i < shSize; i++) f[i] += fPartitions[p*shSize + i];
+  }
+
+  // The coefficients of the template, sampled on an equiangular grid
+  //
+  int const nTheta = 4*shLmax, nPhi = 8*shLmax;
+  std::vector<SHcomplex> hRows(nTheta*shSize, SHcomplex(0.0, 0.0));
+
+  ROMP_PF_begin
+  int it;
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+  for (it = 0; it < nTheta; it++) {
+    ROMP_PFLB_begin
+    double const theta = (it + 0.5)*M_PI/nTheta;
+    double const w = sin(theta)*(M_PI/nTheta)*(2.0*M_PI/nPhi);
+    SHcomplex* const coefs = &hRows[it*shSize];
+    int ip;
+    for (ip = 0; ip < nPhi; ip++) {
+      double const phi = ip*2.0*M_PI/nPhi;
+      double const x = sin(theta)*cos(phi), y = sin(theta)*sin(phi), z = cos(theta);
+      float const noAlpha = 0.0f;
+      MRISPfunctionValResultForAlpha fv;
+      MRISPfunctionVal_radiusR(parms->mrisp_template, &fv, mris->radius, 
+        mris->radius*x, mris->radius*y, mris->radius*z, parms->frame_no, true, &noAlpha, 1, false);
+      double sqrt_std = sqrt(fv.next);
+      if (FZERO(sqrt_std)) sqrt_std = DEFAULT_STD;
+      shAccumulate(coefs, w*fv.curr/sqrt_std, x, y, z);
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  std::vector<SHcomplex> h(shSize, SHcomplex(0.0, 0.0));
+  int row;
+  for (row = 0; row < nTheta; row++) {
+    int i;
+    for (i = 0; i < shSize; i++) h[i] += hRows[row*shSize + i];
+  }
+
+  // The means do not affect where the peaks are
+  //
+  f[shIndex(0,0)] = h[shIndex(0,0)] = SHcomplex(0.0, 0.0);
+
+  // The correlation for every (a, b, g) on the grid
+  //
+  int const nA = shNangles, nB = shNangles/2;
+  int const nM = 2*shLmax + 1;
+  std::vector<float> correlation((size_t)nB*nA*nA);
+
+  ROMP_PF_begin
+  int ib;
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+  for (ib = 0; ib < nB; ib++) {
+    ROMP_PFLB_begin
+    double const b = (ib + 0.5)*M_PI/nB;
+    SHwignerD* const d = (SHwignerD*)malloc(sizeof(SHwignerD));
+    shWignerD(*d, b);
+
+    // A[m'][m] = sum_l conj(f_lm') d^l_m'm(b) h_lm
+    //
+    std::vector<SHcomplex> A(nM*nM, SHcomplex(0.0, 0.0));
+    int l;
+    for (l = 1; l <= shLmax; l++) {
+      int mp;
+      for (mp = -l; mp <= l; mp++) {
+        SHcomplex const fc = std::conj(shCoef(f.data(), l, mp));
+        int m;
+        for (m = -l; m <= l; m++) {
+          A[(mp+shLmax)*nM + m+shLmax] += fc * (*d)[l][mp+shLmax][m+shLmax] * shCoef(h.data(), l, m);
+        }
+      }
+    }
+    free(d);
+
+    // B[m'][g] = sum_m A[m'][m] exp(-i m g)      then      C[a][g] = Re sum_m' B[m'][g] exp(-i m' a)
+    //
+    std::vector<SHcomplex> B(nM*nA);
+    int mp;
+    for (mp = 0; mp < nM; mp++) {
+      int ig;
+      for (ig = 0; ig < nA; ig++) {
+        double const g = ig*2.0*M_PI/nA;
+        SHcomplex sum(0.0, 0.0);
+        int m;
+        for (m = 0; m < nM; m++) sum += A[mp*nM + m] * std::polar(1.0, -(m - shLmax)*g);
+        B[mp*nA + ig] = sum;
+      }
+    }
+    int ia;
+    for (ia = 0; ia < nA; ia++) {
+      double const a = ia*2.0*M_PI/nA;
+      SHcomplex e[2*shLmax+1];
+      for (mp = 0; mp < nM; mp++) e[mp] = std::polar(1.0, -(mp - shLmax)*a);
+      int ig;
+      for (ig = 0; ig < nA; ig++) {
+        double sum = 0.0;
+        for (mp = 0; mp < nM; mp++) sum += (B[mp*nA + ig] * e[mp]).real();
+        correlation[((size_t)ib*nA + ia)*nA + ig] = sum;
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  // Convert each grid rotation R to the MRISrotate angles of M = inverse(R),
+  // keeping those inside the window that findMinSSE would have searched
+  //
+  struct Candidate { float corr; float alpha, beta, gamma; double M[3][3]; };
+  std::vector<Candidate> inWindow;
+  float const halfWindow = max_radians/2;
+  for (int ib = 0; ib < nB; ib++) {
+    double const b = (ib + 0.5)*M_PI/nB;
+    int ia;
+    for (ia = 0; ia < nA; ia++) {
+      double const a = ia*2.0*M_PI/nA;
+      int ig;
+      for (ig = 0; ig < nA; ig++) {
+        double const g = ig*2.0*M_PI/nA;
+        double const ca = cos(a), sa = sin(a), cb = cos(b), sb = sin(b), cg = cos(g), sg = sin(g);
+        double const R[3][3] = {
+          { ca*cb*cg - sa*sg, -ca*cb*sg - sa*cg, ca*sb },
+          { sa*cb*cg + ca*sg, -sa*cb*sg + ca*cg, sa*sb },
+          {           -sb*cg,             sb*sg,    cb } };
+        Candidate c;
+        int i, j;
+        for (i = 0; i < 3; i++) for (j = 0; j < 3; j++) c.M[i][j] = R[j][i];
+        double alpha, beta, gamma;
+        rbaAngles(c.M, &alpha, &beta, &gamma);
+        if (fabs(alpha) > halfWindow || fabs(beta) > halfWindow || fabs(gamma) > halfWindow) continue;
+        c.corr  = correlation[((size_t)ib*nA + ia)*nA + ig];
+        c.alpha = alpha; c.beta = beta; c.gamma = gamma;
+        inWindow.push_back(c);
+      }
+    }
+  }
+  std::sort(inWindow.begin(), inWindow.end(), [](Candidate const & lhs, Candidate const & rhs) { return lhs.corr > rhs.corr; });
+
+  // Choose well separated peaks, plus no rotation at all, and compute their true SSE
+  //
+  double const gridRadians = 2.0*M_PI/nA;
+  std::vector<Candidate> candidates;
+  { Candidate c;
+    c.corr = 0; c.alpha = c.beta = c.gamma = 0;
+    rbaMatrix(c.M, 0, 0, 0);
+    candidates.push_back(c);
+  }
+  for (auto const & c : inWindow) {
+    if ((int)candidates.size() > shNcandidates) break;
+    bool separated = true;
+    for (auto const & o : candidates) {
+      double trace = 0;
+      int i, j;
+      for (i = 0; i < 3; i++) for (j = 0; j < 3; j++) trace += c.M[i][j]*o.M[i][j];
+      if (acos(std::max(-1.0, std::min(1.0, (trace - 1.0)/2.0))) < 2*gridRadians) { separated = false; break; }
+    }
+    if (separated) candidates.push_back(c);
+  }
+
+  int best = 0;
+  double bestSse = 0;
+  unsigned int ci;
+  for (ci = 0; ci < candidates.size(); ci++) {
+    Candidate const & c = candidates[ci];
+    double const sse = rbaSSE(mris, parms, curv, xv, yv, zv, verticesSize, rx, ry, rz, c.alpha, c.beta, c.gamma);
+    if (ci == 0 || sse < bestSse) { best = ci; bestSse = sse; }
+  }
+
+  free(rz); free(ry); free(rx);
+  free(zv); free(yv); free(xv);
+  free(area); free(curv);
+
+  // Refine around the best by searching a few grid cells around it,
+  // with a window that keeps the grid search's step at min_radians
+  //
+  float refine_radians = min_radians;
+  while (refine_radians < 4*gridRadians && refine_radians < max_radians) refine_radians *= 2;
+  refine_radians = std::min(refine_radians, max_radians);
+
+  Candidate const & c = candidates[best];
+  double refine_a, refine_b, refine_g, refine_sse;
+  findMinSSE_wkr(&refine_a, &refine_b, &refine_g, &refine_sse, 
+    mris, parms, min_radians, refine_radians, ext_sse, std::min(nangles, 4), 
+    c.alpha, c.beta, c.gamma);
+
+  double Mrefine[3][3], M[3][3];
+  rbaMatrix(Mrefine, refine_a, refine_b, refine_g);
+  int i, j, k;
+  for (i = 0; i < 3; i++) for (j = 0; j < 3; j++) {
+    M[i][j] = 0;
+    for (k = 0; k < 3; k++) M[i][j] += Mrefine[i][k]*c.M[k][j];
+  }
+  rbaAngles(M, new_mina, new_minb, new_ming);
+  *new_sse = refine_sse;
+}
@@ -0,0 +1,538 @@
+/**
+ * @brief block-compressed gzip (BGZF-style) streams with a frame index
+ *
+ */
+/*
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <vector>
+
+#include "zlib.h"
+
+#include "bgzf.h"
+#include "const.h"
+#include "diag.h"
+#include "error.h"
+#include "romp_support.h"
+
+#define BGZF_MAX_BLOCK 0x10000   // max compressed member size (BSIZE is 16 bits)
+#define BGZF_HEADER_SIZE 18      // gzip header + XLEN + BC subfield
+#define BGZF_FOOTER_SIZE 8       // CRC32 + ISIZE
+#define BGZF_TAIL_PAYLOAD 32
+#define BGZF_TAIL_SIZE (BGZF_HEADER_SIZE + 4 + BGZF_TAIL_PAYLOAD + 2 + BGZF_FOOTER_SIZE)
+#define BGZF_INDEX_PER_MEMBER 8000  // 64000 bytes, keeps XLEN under 64k
+#define BGZF_TAIL_VERSION 1
+
+// number of blocks compressed per parallel batch (per thread)
+#define BGZF_BLOCKS_PER_THREAD 4
+
+/* everything on disk is little endian, independent of the host */
+static void put16(unsigned char *p, unsigned int v)
+{
+  p[0] = v & 0xff;
+  p[1] = (v >> 8) & 0xff;
+}
+static void put32(unsigned char *p, unsigned int v)
+{
+  put16(p, v & 0xffff);
+  put16(p + 2, (v >> 16) & 0xffff);
+}
+static void put64(unsigned char *p, unsigned long long v)
+{
+  put32(p, (unsigned int)(v & 0xffffffff));
+  put32(p + 4, (unsigned int)(v >> 32));
+}
+static unsigned int get16(const unsigned char *p) { return p[0] | (p[1] << 8); }
+static unsigned int get32(const unsigned char *p) { return get16(p) | ((unsigned int)get16(p + 2) << 16); }
+static unsigned long long get64(const unsigned char *p)
+{
+  return get32(p) | ((unsigned long long)get32(p + 4) << 32);
+}
+
+/*!
+  \fn static int bgzfPutHeader(unsigned char *p, int xlen_extra, int bsize)
+  \brief Writes the gzip member header with a BC subfield. xlen_extra is the
+  number of bytes of additional subfields that will follow the BC subfield.
+  Returns the number of bytes written (always BGZF_HEADER_SIZE).
+*/
+static int bgzfPutHeader(unsigned char *p, int xlen_extra, int bsize)
+{
+  p[0] = 0x1f;
+  p[1] = 0x8b;
+  p[2] = 8;  // deflate
+  p[3] = 4;  // FEXTRA
+  put32(p + 4, 0);
+  p[8] = 0;
+  p[9] = 0xff;
+  put16(p + 10, 6 + xlen_extra);
+  p[12] = 'B';
+  p[13] = 'C';
+  put16(p + 14, 2);
+  put16(p + 16, bsize - 1);
+  return (BGZF_HEADER_SIZE);
+}
+
+/*!
+  \fn static std::vector<unsigned char> bgzfEmptyMember(char si2, const unsigned char *payload, int len)
+  \brief Builds an empty-content gzip member carrying an extra 'F'si2 subfield.
+  gunzip produces no output for it.
+*/
+static std::vector<unsigned char> bgzfEmptyMember(char si2, const unsigned char *payload, int len)
+{
+  int bsize = BGZF_HEADER_SIZE + 4 + len + 2 + BGZF_FOOTER_SIZE;
+  std::vector<unsigned char> m(bsize, 0);
+  unsigned char *p = &m[0];
+
+  p += bgzfPutHeader(p, 4 + len, bsize);
+  p[0] = 'F';
+  p[1] = si2;
+  put16(p + 2, len);
+  p += 4;
+  memcpy(p, payload, len);
+  p += len;
+  p[0] = 3;  // empty final fixed-huffman deflate block
+  p[1] = 0;
+  // CRC32 and ISIZE of empty content are zero
+  return (m);
+}
+
+/*!
+  \fn static int bgzfCompressBlock(const unsigned char *src, int len, int level, unsigned char *dst)
+  \brief Compresses one block into a complete gzip member. dst must hold BGZF_MAX_BLOCK bytes.
+  Returns the member size or -1 on error.
+*/
+static int bgzfCompressBlock(const unsigned char *src, int len, int level, unsigned char *dst)
+{
+  z_stream zs;
+  int ret, bsize;
+
+  while (1) {
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) return (-1);
+    zs.next_in = (Bytef *)src;
+    zs.avail_in = len;
+    zs.next_out = dst + BGZF_HEADER_SIZE;
+    zs.avail_out = BGZF_MAX_BLOCK - BGZF_HEADER_SIZE - BGZF_FOOTER_SIZE;
+    ret = deflate(&zs, Z_FINISH);
+    deflateEnd(&zs);
+    if (ret == Z_STREAM_END) break;
+    // incompressible data: store it instead (always fits for BGZF_BLOCK_SIZE)
+    if (level == 0) return (-1);
+    level = 0;
+  }
+  bsize = BGZF_HEADER_SIZE + zs.total_out + BGZF_FOOTER_SIZE;
+  bgzfPutHeader(dst, 0, bsize);
+  put32(dst + bsize - 8, crc32(crc32(0L, Z_NULL, 0), src, len));
+  put32(dst + bsize - 4, len);
+  return (bsize);
+}
+
+/*!
+  \fn static int bgzfInflateBlock(const unsigned char *src, int csize, unsigned char *dst, int dstlen)
+  \brief Decompresses one member. Returns the number of uncompressed bytes or -1.
+*/
+static int bgzfInflateBlock(const unsigned char *src, int csize, unsigned char *dst, int dstlen)
+{
+  z_stream zs;
+  int ret, hsize;
+
+  if (csize < BGZF_HEADER_SIZE || src[0] != 0x1f || src[1] != 0x8b || !(src[3] & 4)) return (-1);
+  hsize = 12 + get16(src + 10);
+
+  memset(&zs, 0, sizeof(zs));
+  if (inflateInit2(&zs, -15) != Z_OK) return (-1);
+  zs.next_in = (Bytef *)(src + hsize);
+  zs.avail_in = csize - hsize - BGZF_FOOTER_SIZE;
+  zs.next_out = dst;
+  zs.avail_out = dstlen;
+  ret = inflate(&zs, Z_FINISH);
+  inflateEnd(&zs);
+  if (ret != Z_STREAM_END) return (-1);
+  if (get32(src + csize - 4) != zs.total_out) return (-1);
+  return (zs.total_out);
+}
+
+/*----------------------------------------------------------------*/
+
+struct BGZF_WRITER
+{
+  FILE *fp;
+  int level;
+  long long coffset;               // compressed bytes written so far
+  long long usize;                 // uncompressed bytes accepted so far
+  std::vector<long long> offsets;  // compressed offset of each block
+  std::vector<unsigned char> buf;  // pending uncompressed data
+  size_t nbuf;                     // bytes used in buf
+  std::vector<unsigned char> out;  // per-block compressed scratch
+};
+
+/*!
+  \fn BGZF_WRITER *BGZFwriterOpen(const char *fname, int level)
+  \brief Opens fname for block-compressed writing. level is the zlib level
+  (-1 for the default).
+*/
+BGZF_WRITER *BGZFwriterOpen(const char *fname, int level)
+{
+  BGZF_WRITER *bw;
+  FILE *fp;
+  int nbatch;
+
+  fp = fopen(fname, "wb");
+  if (fp == NULL) {
+    ErrorReturn(NULL, (ERROR_NOFILE, "BGZFwriterOpen(%s): could not open file", fname));
+  }
+  nbatch = BGZF_BLOCKS_PER_THREAD * omp_get_max_threads();
+
+  bw = new BGZF_WRITER;
+  bw->fp = fp;
+  bw->level = level;
+  bw->coffset = 0;
+  bw->usize = 0;
+  bw->buf.resize((size_t)nbatch * BGZF_BLOCK_SIZE);
+  bw->nbuf = 0;
+  bw->out.resize((size_t)nbatch * BGZF_MAX_BLOCK);
+  return (bw);
+}
+
+/*!
+  \fn static int bgzfFlush(BGZF_WRITER *bw)
+  \brief Compresses all pending blocks in parallel and appends them to the file
+  in order. A trailing partial block is only written when the writer is closed.
+*/
+static int bgzfFlush(BGZF_WRITER *bw)
+{
+  int nblocks, b, err = 0;
+  std::vector<int> csize;
+
+  nblocks = (bw->nbuf + BGZF_BLOCK_SIZE - 1) / BGZF_BLOCK_SIZE;
+  if (nblocks == 0) return (NO_ERROR);
+  csize.resize(nblocks);
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) reduction(+ : err)
+#endif
+  for (b = 0; b < nblocks; b++) {
+    ROMP_PFLB_begin
+    size_t start = (size_t)b * BGZF_BLOCK_SIZE;
+    size_t len = bw->nbuf - start;
+    if (len > BGZF_BLOCK_SIZE) len = BGZF_BLOCK_SIZE;
+    csize[b] = bgzfCompressBlock(&bw->buf[start], len, bw->level, &bw->out[(size_t)b * BGZF_MAX_BLOCK]);
+    if (csize[b] < 0) err++;
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  if (err) ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "BGZFwrite: compression failed"));
+
+  for (b = 0; b < nblocks; b++) {
+    if (fwrite(&bw->out[(size_t)b * BGZF_MAX_BLOCK], 1, csize[b], bw->fp) != (size_t)csize[b])
+      ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "BGZFwrite: write failed"));
+    bw->offsets.push_back(bw->coffset);
+    bw->coffset += csize[b];
+  }
+  bw->nbuf = 0;
+  return (NO_ERROR);
+}
+
+/*!
+  \fn int BGZFwrite(BGZF_WRITER *bw, const void *buf, size_t nbytes)
+  \brief Appends nbytes of uncompressed data to the stream.
+*/
+int BGZFwrite(BGZF_WRITER *bw, const void *buf, size_t nbytes)
+{
+  const unsigned char *src = (const unsigned char *)buf;
+
+  while (nbytes > 0) {
+    size_t n = bw->buf.size() - bw->nbuf;
+    if (n > nbytes) n = nbytes;
+    memcpy(&bw->buf[bw->nbuf], src, n);
+    bw->nbuf += n;
+    bw->usize += n;
+    src += n;
+    nbytes -= n;
+    if (bw->nbuf == bw->buf.size() && bgzfFlush(bw) != NO_ERROR) return (ERROR_BADFILE);
+  }
+  return (NO_ERROR);
+}
+
+/*!
+  \fn int BGZFwriterClose(BGZF_WRITER **pbw)
+  \brief Flushes the remaining data, appends the block index and tail, and
+  closes the file.
+*/
+int BGZFwriterClose(BGZF_WRITER **pbw)
+{
+  BGZF_WRITER *bw = *pbw;
+  long long index_offset;
+  long nblocks, b, n;
+  unsigned char tail[BGZF_TAIL_PAYLOAD];
+  std::vector<unsigned char> m;
+  int err = NO_ERROR;
+
+  *pbw = NULL;
+  if (bgzfFlush(bw) != NO_ERROR) err = ERROR_BADFILE;
+
+  index_offset = bw->coffset;
+  nblocks = bw->offsets.size();
+  for (b = 0; b < nblocks && err == NO_ERROR; b += n) {
+    n = nblocks - b;
+    if (n > BGZF_INDEX_PER_MEMBER) n = BGZF_INDEX_PER_MEMBER;
+    std::vector<unsigned char> payload(8 * n);
+    for (long i = 0; i < n; i++) put64(&payload[8 * i], bw->offsets[b + i]);
+    m = bgzfEmptyMember('I', &payload[0], payload.size());
+    if (fwrite(&m[0], 1, m.size(), bw->fp) != m.size()) err = ERROR_BADFILE;
+  }
+
+  put32(tail, BGZF_TAIL_VERSION);
+  put32(tail + 4, BGZF_BLOCK_SIZE);
+  put64(tail + 8, nblocks);
+  put64(tail + 16, bw->usize);
+  put64(tail + 24, index_offset);
+  m = bgzfEmptyMember('T', tail, BGZF_TAIL_PAYLOAD);
+  if (err == NO_ERROR && fwrite(&m[0], 1, m.size(), bw->fp) != m.size()) err = ERROR_BADFILE;
+
+  if (fclose(bw->fp) != 0) err = ERROR_BADFILE;
+  delete bw;
+  if (err != NO_ERROR) ErrorReturn(err, (err, "BGZFwriterClose: write failed"));
+  return (NO_ERROR);
+}
+
+/*----------------------------------------------------------------*/
+
+/*!
+  \fn static int bgzfReadMember(int fd, long long offset, std::vector<unsigned char> &m)
+  \brief Reads the complete member starting at offset into m using pread(),
+  so it can be called concurrently on the same descriptor.
+*/
+static int bgzfReadMember(int fd, long long offset, std::vector<unsigned char> &m)
+{
+  unsigned char hdr[BGZF_HEADER_SIZE];
+  int bsize;
+
+  if (pread(fd, hdr, BGZF_HEADER_SIZE, offset) != BGZF_HEADER_SIZE) return (-1);
+  if (hdr[0] != 0x1f || hdr[1] != 0x8b || hdr[12] != 'B' || hdr[13] != 'C') return (-1);
+  bsize = get16(hdr + 16) + 1;
+  m.resize(bsize);
+  if (pread(fd, &m[0], bsize, offset) != bsize) return (-1);
+  return (bsize);
+}
+
+/*!
+  \fn BGZF_INDEX *BGZFreadIndex(const char *fname)
+  \brief Loads the block index of a blocked gzip file. Returns NULL (without
+  an error message) if the file is an ordinary gzip file. A tail or index
+  that does not agree with itself or the file length is an error.
+*/
+BGZF_INDEX *BGZFreadIndex(const char *fname)
+{
+  BGZF_INDEX *idx;
+  struct stat st;
+  unsigned char tail[BGZF_TAIL_SIZE];
+  const unsigned char *p;
+  long long offset, index_offset, block_size, nblocks, usize;
+  long b, n;
+  int fd;
+  std::vector<unsigned char> m;
+
+  fd = open(fname, O_RDONLY);
+  if (fd < 0) return (NULL);
+  if (fstat(fd, &st) != 0 || st.st_size < BGZF_TAIL_SIZE ||
+      pread(fd, tail, BGZF_TAIL_SIZE, st.st_size - BGZF_TAIL_SIZE) != BGZF_TAIL_SIZE) {
+    close(fd);
+    return (NULL);
+  }
+  p = tail + BGZF_HEADER_SIZE;
+  if (tail[0] != 0x1f || tail[1] != 0x8b || tail[12] != 'B' || tail[13] != 'C' || p[0] != 'F' || p[1] != 'T' ||
+      get16(p + 2) != BGZF_TAIL_PAYLOAD || get32(p + 4) != BGZF_TAIL_VERSION) {
+    close(fd);
+    return (NULL);
+  }
+  p += 4;
+
+  block_size = get32(p + 4);
+  nblocks = get64(p + 8);
+  usize = get64(p + 16);
+  index_offset = get64(p + 24);
+
+  // the blocks must cover usize exactly, and the index (8 bytes per block)
+  // must fit between the data and the tail
+  if (block_size <= 0 || block_size > BGZF_BLOCK_SIZE || nblocks < 0 || nblocks > (long long)st.st_size / 8 ||
+      usize < 0 || usize > nblocks * block_size || usize <= (nblocks - 1) * block_size || index_offset < 0 ||
+      index_offset + 8 * nblocks > (long long)st.st_size - BGZF_TAIL_SIZE) {
+    close(fd);
+    ErrorReturn(NULL,
+                (ERROR_BADFILE,
+                 "BGZFreadIndex(%s): inconsistent tail (block size %lld, %lld blocks, %lld bytes, index at %lld)",
+                 fname, block_size, nblocks, usize, index_offset));
+  }
+
+  idx = (BGZF_INDEX *)calloc(1, sizeof(BGZF_INDEX));
+  idx->block_size = block_size;
+  idx->nblocks = nblocks;
+  idx->usize = usize;
+  idx->coffset = (long long *)calloc(idx->nblocks + 1, sizeof(long long));
+  idx->coffset[idx->nblocks] = index_offset;
+
+  offset = index_offset;
+  for (b = 0; b < idx->nblocks; b += n) {
+    int bsize = bgzfReadMember(fd, offset, m);
+    n = 0;
+    if (bsize >= BGZF_HEADER_SIZE + 4 && m[BGZF_HEADER_SIZE] == 'F' && m[BGZF_HEADER_SIZE + 1] == 'I')
+      n = get16(&m[BGZF_HEADER_SIZE + 2]) / 8;
+    if (n <= 0 || BGZF_HEADER_SIZE + 4 + 8 * n > bsize) {
+      close(fd);
+      BGZFfreeIndex(&idx);
+      ErrorReturn(NULL, (ERROR_BADFILE, "BGZFreadIndex(%s): corrupt block index", fname));
+    }
+    if (b + n > idx->nblocks) n = idx->nblocks - b;
+    for (long i = 0; i < n; i++) idx->coffset[b + i] = get64(&m[BGZF_HEADER_SIZE + 4 + 8 * i]);
+    offset += bsize;
+  }
+  close(fd);
+
+  // blocks are stored in order, before the index
+  for (b = 0; b < idx->nblocks; b++) {
+    if (idx->coffset[b] < 0 || idx->coffset[b] >= idx->coffset[b + 1]) {
+      BGZFfreeIndex(&idx);
+      ErrorReturn(NULL, (ERROR_BADFILE, "BGZFreadIndex(%s): block %ld offset out of order", fname, b));
+    }
+  }
+
+  if (Gdiag & DIAG_VERBOSE_ON)
+    printf("BGZFreadIndex(%s): %ld blocks, %lld bytes\n", fname, idx->nblocks, idx->usize);
+  return (idx);
+}
+
+void BGZFfreeIndex(BGZF_INDEX **pidx)
+{
+  BGZF_INDEX *idx = *pidx;
+  if (idx == NULL) return;
+  free(idx->coffset);
+  free(idx);
+  *pidx = NULL;
+}
+
+/*!
+  \fn int BGZFreadRange(const char *fname, const BGZF_INDEX *idx, long long uoffset, long long nbytes, void *buf)
+  \brief Decompresses nbytes starting at uncompressed offset uoffset into buf.
+  Only the blocks that overlap the range are read, and they are inflated in
+  parallel.
+*/
+int BGZFreadRange(const char *fname, const BGZF_INDEX *idx, long long uoffset, long long nbytes, void *buf)
+{
+  long b0, b1, b;
+  int fd, err = 0;
+
+  if (nbytes <= 0) return (NO_ERROR);
+  if (uoffset < 0 || uoffset + nbytes > idx->usize)
+    ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "BGZFreadRange(%s): range beyond end of file", fname));
+
+  fd = open(fname, O_RDONLY);
+  if (fd < 0) ErrorReturn(ERROR_NOFILE, (ERROR_NOFILE, "BGZFreadRange(%s): could not open file", fname));
+
+  b0 = uoffset / idx->block_size;
+  b1 = (uoffset + nbytes - 1) / idx->block_size;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) reduction(+ : err) schedule(dynamic, 1)
+#endif
+  for (b = b0; b <= b1; b++) {
+    ROMP_PFLB_begin
+    std::vector<unsigned char> m, u(idx->block_size);
+    long long bstart = (long long)b * idx->block_size, start, end;
+    int ulen;
+
+    ulen = -1;
+    if (bgzfReadMember(fd, idx->coffset[b], m) > 0) ulen = bgzfInflateBlock(&m[0], m.size(), &u[0], u.size());
+    if (ulen < 0) {
+      err++;
+      ROMP_PFLB_continue;
+    }
+    start = uoffset > bstart ? uoffset : bstart;
+    end = uoffset + nbytes < bstart + ulen ? uoffset + nbytes : bstart + ulen;
+    if (end > start) memcpy((char *)buf + (start - uoffset), &u[start - bstart], end - start);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  close(fd);
+  if (err) ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "BGZFreadRange(%s): %d corrupt blocks", fname, err));
+  return (NO_ERROR);
+}
+
+/*!
+  \fn znzFile BGZFopenAt(const char *fname, const BGZF_INDEX *idx, long long uoffset)
+  \brief Opens a gzip read stream positioned at uncompressed offset uoffset.
+  The stream starts at the member holding uoffset, so at most one block
+  is decompressed to get there.
+*/
+znzFile BGZFopenAt(const char *fname, const BGZF_INDEX *idx, long long uoffset)
+{
+  znzFile fp;
+  long b;
+  long long skip;
+  int fd;
+  char buf[STRLEN];
+
+  b = uoffset / idx->block_size;
+  if (b > idx->nblocks) b = idx->nblocks;
+  skip = uoffset - (long long)b * idx->block_size;
+
+  fd = open(fname, O_RDONLY);
+  if (fd < 0) return (NULL);
+  if (lseek(fd, idx->coffset[b], SEEK_SET) < 0) {
+    close(fd);
+    return (NULL);
+  }
+  fp = znzdopen(fd, "rb", 1);
+  if (znz_isnull(fp)) {
+    close(fd);
+    return (NULL);
+  }
+  while (skip > 0) {
+    size_t n = skip > STRLEN ? STRLEN : skip;
+    if (znzread(buf, 1, n, fp) != n) {
+      znzclose(fp);
+      return (NULL);
+    }
+    skip -= n;
+  }
+  return (fp);
+}
+
+/*----------------------------------------------------------------*/
+
+znzFile znzmemopen(char **pbuf, size_t *plen)
+{
+  znzFile fp;
+  FILE *mfp;
+
+  *pbuf = NULL;
+  *plen = 0;
+  mfp = open_memstream(pbuf, plen);
+  if (mfp == NULL) return (NULL);
+  fp = (znzFile)calloc(1, sizeof(struct znzptr));
+  fp->withz = 0;
+  fp->nzfptr = mfp;
+  return (fp);
+}
@@ -26,6 +26,10 @@ We have first some basic functions used in the FFT Filter.
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include "fftutils.h"
+#include "romp_support.h"
 
 #define FourierForward 1
 #define FourierBackward -1
@@ -614,3 +618,474 @@ float FFTdist(int x, int y, int z, int len)
   return ((x - (float)len / 2) * (x - (float)len / 2) + (y - (float)len / 2) * (y - (float)len / 2) +
           (z - (float)len / 2) * (z - (float)len / 2));
 }
+
+/*-----------------------------------------------------
+                Mixed-radix FFT
+
+A self-sorting (Stockham) FFT for any length. The length
+is split into factors 4, 2, 3 and then any other primes,
+and each pass does n/r butterflies of radix r, so the cost
+is O(n*sum(r)): lengths with a large prime factor are right
+but slow, pad to FFTgoodSize() when the length is free.
+Real lines of even length are transformed as complex lines
+of half the length. Lines are transformed in double, one
+at a time, with the plan giving the factors and the
+twiddles; the 3D transforms run the lines of each pass in
+parallel.
+-----------------------------------------------------*/
+#define FFT_MAX_FACTORS 32
+
+struct FFT_PLAN1D
+{
+  int n;
+  int nfactors;
+  int factors[FFT_MAX_FACTORS];
+  double *w;                      // exp(-2*pi*i*t/n), t = 0..n-1, as re,im pairs
+  const struct FFT_PLAN1D *half;  // plan for n/2, for real lines of even length
+  struct FFT_PLAN1D *next;
+};
+
+static struct FFT_PLAN1D *fftPlans = NULL;
+static FFT3D_PLAN **fft3Dplans = NULL;
+static int nfft3Dplans = 0;
+
+/*-----------------------------------------------------
+ FFTgoodSize returns the smallest length >= n that has
+ no prime factors other than 2, 3 and 5 (and is even if
+ even is set), ie, a fast length to zero-pad to.
+------------------------------------------------------*/
+int FFTgoodSize(int n, int even)
+{
+  int m, k;
+
+  if (n < 1) n = 1;
+  for (m = n;; m++) {
+    if (even && (m & 1)) continue;
+    k = m;
+    while (k % 2 == 0) k /= 2;
+    while (k % 3 == 0) k /= 3;
+    while (k % 5 == 0) k /= 5;
+    if (k == 1) return (m);
+  }
+}
+
+static const struct FFT_PLAN1D *fftPlan1D(int n);
+
+static struct FFT_PLAN1D *fftPlanBuild(int n)
+{
+  struct FFT_PLAN1D *plan;
+  int k, r, t;
+
+  plan = (struct FFT_PLAN1D *)calloc(1, sizeof(struct FFT_PLAN1D));
+  if (plan) plan->w = (double *)malloc(2 * n * sizeof(double));
+  if (plan == NULL || plan->w == NULL) FFTerror("fftPlanBuild : could not alloc");
+  plan->n = n;
+
+  k = n;
+  while (k % 4 == 0) {
+    plan->factors[plan->nfactors++] = 4;
+    k /= 4;
+  }
+  if (k % 2 == 0) {
+    plan->factors[plan->nfactors++] = 2;
+    k /= 2;
+  }
+  for (r = 3; k > 1; r += 2) {
+    while (k % r == 0) {
+      plan->factors[plan->nfactors++] = r;
+      k /= r;
+    }
+  }
+
+  for (t = 0; t < n; t++) {
+    plan->w[2 * t] = cos(2 * M_PI * t / n);
+    plan->w[2 * t + 1] = -sin(2 * M_PI * t / n);
+  }
+  if (n % 2 == 0) plan->half = fftPlan1D(n / 2);
+  return (plan);
+}
+
+/*-----------------------------------------------------
+ fftPlan1D returns the cached plan for length n, building
+ it on first use. The list is only touched inside the
+ critical section; the plan itself is built outside it
+ since building an even length also looks up n/2.
+------------------------------------------------------*/
+static const struct FFT_PLAN1D *fftPlan1D(int n)
+{
+  struct FFT_PLAN1D *plan, *p;
+
+  FFTdebugAssert(n > 0, "fftPlan1D : length <= 0");
+#ifdef HAVE_OPENMP
+  #pragma omp critical(fft_plan)
+#endif
+  {
+    for (plan = fftPlans; plan && plan->n != n; plan = plan->next)
+      ;
+  }
+  if (plan) return (plan);
+
+  plan = fftPlanBuild(n);
+#ifdef HAVE_OPENMP
+  #pragma omp critical(fft_plan)
+#endif
+  {
+    for (p = fftPlans; p && p->n != n; p = p->next)
+      ;
+    if (p == NULL) {
+      plan->next = fftPlans;
+      fftPlans = plan;
+      p = plan;
+    }
+  }
+  if (p != plan) {
+    // another thread got there first
+    free(plan->w);
+    free(plan);
+  }
+  return (p);
+}
+
+/*-----------------------------------------------------
+ fftComplexLine transforms the n complex values in x (re,im
+ pairs) in place, using y (2n doubles) as the other buffer.
+ Forward is exp(-i), backward is exp(+i), neither is scaled.
+------------------------------------------------------*/
+static void fftComplexLine(const struct FFT_PLAN1D *plan, double *x, double *y, int direction)
+{
+  const int n = plan->n;
+  const double *w = plan->w;
+  double *x0 = x, *tmp;
+  int s, ns, f, r, m, p, q, j, k, sa;
+
+  // backward(x) = conj(forward(conj(x)))
+  if (direction != FourierForward)
+    for (j = 0; j < n; j++) x[2 * j + 1] = -x[2 * j + 1];
+
+  s = 1;
+  ns = n;
+  for (f = 0; f < plan->nfactors; f++) {
+    r = plan->factors[f];
+    m = ns / r;
+    sa = 2 * s * m;  // distance between the inputs of a butterfly
+    for (p = 0; p < m; p++) {
+      const double *w1 = &w[2 * (p * s)];
+      const double *w2 = &w[2 * ((2 * p * s) % n)];
+      const double *w3 = &w[2 * ((3 * p * s) % n)];
+      for (q = 0; q < s; q++) {
+        const double *a = x + 2 * (q + s * p);
+        double *b = y + 2 * (q + s * r * p);
+        double ar, ai, br, bi;
+        if (r == 4) {
+          double t0r = a[0] + a[2 * sa], t0i = a[1] + a[2 * sa + 1];
+          double t1r = a[0] - a[2 * sa], t1i = a[1] - a[2 * sa + 1];
+          double t2r = a[sa] + a[3 * sa], t2i = a[sa + 1] + a[3 * sa + 1];
+          double t3r = a[sa] - a[3 * sa], t3i = a[sa + 1] - a[3 * sa + 1];
+          b[0] = t0r + t2r;
+          b[1] = t0i + t2i;
+          br = t1r + t3i;  // t1 - i*t3
+          bi = t1i - t3r;
+          b[2 * s] = br * w1[0] - bi * w1[1];
+          b[2 * s + 1] = br * w1[1] + bi * w1[0];
+          br = t0r - t2r;
+          bi = t0i - t2i;
+          b[4 * s] = br * w2[0] - bi * w2[1];
+          b[4 * s + 1] = br * w2[1] + bi * w2[0];
+          br = t1r - t3i;  // t1 + i*t3
+          bi = t1i + t3r;
+          b[6 * s] = br * w3[0] - bi * w3[1];
+          b[6 * s + 1] = br * w3[1] + bi * w3[0];
+        }
+        else if (r == 2) {
+          b[0] = a[0] + a[sa];
+          b[1] = a[1] + a[sa + 1];
+          br = a[0] - a[sa];
+          bi = a[1] - a[sa + 1];
+          b[2 * s] = br * w1[0] - bi * w1[1];
+          b[2 * s + 1] = br * w1[1] + bi * w1[0];
+        }
+        else if (r == 3) {
+          const double s3 = 0.86602540378443864676;  // sin(2*pi/3)
+          double sr = a[sa] + a[2 * sa], si = a[sa + 1] + a[2 * sa + 1];
+          double dr = s3 * (a[sa] - a[2 * sa]), di = s3 * (a[sa + 1] - a[2 * sa + 1]);
+          double tr = a[0] - 0.5 * sr, ti = a[1] - 0.5 * si;
+          b[0] = a[0] + sr;
+          b[1] = a[1] + si;
+          br = tr + di;  // t - i*s3*(a1-a2)
+          bi = ti - dr;
+          b[2 * s] = br * w1[0] - bi * w1[1];
+          b[2 * s + 1] = br * w1[1] + bi * w1[0];
+          br = tr - di;  // t + i*s3*(a1-a2)
+          bi = ti + dr;
+          b[4 * s] = br * w2[0] - bi * w2[1];
+          b[4 * s + 1] = br * w2[1] + bi * w2[0];
+        }
+        else {
+          // any other radix, as a plain DFT of length r
+          for (k = 0; k < r; k++) {
+            br = bi = 0;
+            for (j = 0; j < r; j++) {
+              const double *wr = &w[2 * (((j * k) % r) * (n / r))];
+              ar = a[j * sa];
+              ai = a[j * sa + 1];
+              br += ar * wr[0] - ai * wr[1];
+              bi += ar * wr[1] + ai * wr[0];
+            }
+            const double *wk = &w[2 * ((k * p * s) % n)];
+            b[2 * s * k] = br * wk[0] - bi * wk[1];
+            b[2 * s * k + 1] = br * wk[1] + bi * wk[0];
+          }
+        }
+      }
+    }
+    tmp = x;
+    x = y;
+    y = tmp;
+    s *= r;
+    ns = m;
+  }
+  if (x != x0) memcpy(x0, x, 2 * n * sizeof(double));
+
+  if (direction != FourierForward)
+    for (j = 0; j < n; j++) x0[2 * j + 1] = -x0[2 * j + 1];
+}
+
+/*-----------------------------------------------------
+ fftRealLine transforms a real line of length n. Forward
+ takes the n values at the start of x and leaves the
+ n/2+1 complex values of the half spectrum (re,im pairs)
+ in x; backward goes the other way. x must hold 2n+2 and
+ y 2n doubles. Neither direction is scaled.
+------------------------------------------------------*/
+static void fftRealLine(const struct FFT_PLAN1D *plan, double *x, double *y, int direction)
+{
+  const int n = plan->n, h = n / 2;
+  const double *w = plan->w;
+  int j, k, m;
+
+  if (n % 2) {
+    // odd: as a complex line
+    if (direction == FourierForward) {
+      for (j = n - 1; j >= 0; j--) {
+        x[2 * j] = x[j];
+        x[2 * j + 1] = 0;
+      }
+      fftComplexLine(plan, x, y, FourierForward);
+    }
+    else {
+      for (k = 1; k <= h; k++) {
+        x[2 * (n - k)] = x[2 * k];
+        x[2 * (n - k) + 1] = -x[2 * k + 1];
+      }
+      fftComplexLine(plan, x, y, FourierBackward);
+      for (j = 0; j < n; j++) x[j] = x[2 * j];
+    }
+    return;
+  }
+
+  // even: x[2k] + i*x[2k+1] as a complex line of length h, then
+  // split into the transforms of the even and odd samples
+  if (direction == FourierForward) {
+    fftComplexLine(plan->half, x, y, FourierForward);
+    double z0r = x[0], z0i = x[1];
+    x[0] = z0r + z0i;
+    x[1] = 0;
+    x[2 * h] = z0r - z0i;
+    x[2 * h + 1] = 0;
+    for (k = 1; k <= h / 2; k++) {
+      m = h - k;
+      double zkr = x[2 * k], zki = x[2 * k + 1], zmr = x[2 * m], zmi = x[2 * m + 1];
+      double er = 0.5 * (zkr + zmr), ei = 0.5 * (zki - zmi);    // (Zk + conj(Zm))/2
+      double dr = 0.5 * (zki + zmi), di = -0.5 * (zkr - zmr);   // (Zk - conj(Zm))/2i
+      double orr = dr * w[2 * k] - di * w[2 * k + 1];           // times exp(-2*pi*i*k/n)
+      double oi = dr * w[2 * k + 1] + di * w[2 * k];
+      x[2 * k] = er + orr;
+      x[2 * k + 1] = ei + oi;
+      x[2 * m] = er - orr;
+      x[2 * m + 1] = -(ei - oi);
+    }
+  }
+  else {
+    double x0r = x[0], x0i = x[1], xhr = x[2 * h], xhi = x[2 * h + 1];
+    x[0] = (x0r + xhr) - (x0i + xhi);
+    x[1] = (x0i - xhi) + (x0r - xhr);
+    for (k = 1; k <= h / 2; k++) {
+      m = h - k;
+      double xkr = x[2 * k], xki = x[2 * k + 1], xmr = x[2 * m], xmi = x[2 * m + 1];
+      // E = Xk + conj(Xm), O = (Xk - conj(Xm))*exp(+2*pi*i*k/n), Zk = E + i*O
+      double er = xkr + xmr, ei = xki - xmi;
+      double dr = xkr - xmr, di = xki + xmi;
+      double orr = dr * w[2 * k] + di * w[2 * k + 1];
+      double oi = di * w[2 * k] - dr * w[2 * k + 1];
+      x[2 * k] = er - oi;
+      x[2 * k + 1] = ei + orr;
+      // Zm = conj(E) + i*conj(O)
+      x[2 * m] = er + oi;
+      x[2 * m + 1] = -ei + orr;
+    }
+    fftComplexLine(plan->half, x, y, FourierBackward);
+  }
+}
+
+/*-----------------------------------------------------
+ FFT3Dplan returns the cached plan for a real volume of
+ nx*ny*nz (x fastest). The spectrum is nxc*ny*nz complex
+ values (re,im pairs, kx fastest) with nxc = nx/2+1; the
+ other half follows from the symmetry of a real transform.
+------------------------------------------------------*/
+const FFT3D_PLAN *FFT3Dplan(int nx, int ny, int nz)
+{
+  FFT3D_PLAN *plan = NULL, *p = NULL;
+  int k;
+
+#ifdef HAVE_OPENMP
+  #pragma omp critical(fft_plan)
+#endif
+  {
+    for (k = 0; k < nfft3Dplans; k++)
+      if (fft3Dplans[k]->nx == nx && fft3Dplans[k]->ny == ny && fft3Dplans[k]->nz == nz) plan = fft3Dplans[k];
+  }
+  if (plan) return (plan);
+
+  plan = (FFT3D_PLAN *)calloc(1, sizeof(FFT3D_PLAN));
+  if (plan == NULL) FFTerror("FFT3Dplan : could not alloc");
+  plan->nx = nx;
+  plan->ny = ny;
+  plan->nz = nz;
+  plan->nxc = nx / 2 + 1;
+  plan->px = fftPlan1D(nx);
+  plan->py = fftPlan1D(ny);
+  plan->pz = fftPlan1D(nz);
+#ifdef HAVE_OPENMP
+  #pragma omp critical(fft_plan)
+#endif
+  {
+    for (k = 0; k < nfft3Dplans; k++)
+      if (fft3Dplans[k]->nx == nx && fft3Dplans[k]->ny == ny && fft3Dplans[k]->nz == nz) p = fft3Dplans[k];
+    if (p == NULL) {
+      FFT3D_PLAN **plans = (FFT3D_PLAN **)realloc(fft3Dplans, (nfft3Dplans + 1) * sizeof(FFT3D_PLAN *));
+      if (plans) {
+        fft3Dplans = plans;
+        fft3Dplans[nfft3Dplans++] = plan;
+      }
+      p = plan;
+    }
+  }
+  if (p != plan) {
+    // another thread got there first (the 1D plans are shared)
+    free(plan);
+  }
+  return (p);
+}
+
+/*-----------------------------------------------------
+ fft3Dlines transforms the complex lines of the spectrum
+ along y (axis=1) or z (axis=2).
+------------------------------------------------------*/
+static void fft3Dlines(const FFT3D_PLAN *plan, float *spec, int axis, int direction)
+{
+  const struct FFT_PLAN1D *p = (axis == 1) ? plan->py : plan->pz;
+  const int n = p->n, nxc = plan->nxc, nouter = (axis == 1) ? plan->nz : plan->ny;
+  const size_t stride = (axis == 1) ? (size_t)nxc : (size_t)nxc * plan->ny;
+  int outer;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+  for (outer = 0; outer < nouter; outer++) {
+    ROMP_PFLB_begin
+    double *x = (double *)malloc(2 * n * sizeof(double));
+    double *y = (double *)malloc(2 * n * sizeof(double));
+    size_t base = (axis == 1) ? (size_t)outer * nxc * plan->ny : (size_t)outer * nxc;
+    int kx, j;
+    for (kx = 0; kx < nxc; kx++) {
+      float *line = spec + 2 * (base + kx);
+      for (j = 0; j < n; j++) {
+        x[2 * j] = line[2 * j * stride];
+        x[2 * j + 1] = line[2 * j * stride + 1];
+      }
+      fftComplexLine(p, x, y, direction);
+      for (j = 0; j < n; j++) {
+        line[2 * j * stride] = x[2 * j];
+        line[2 * j * stride + 1] = x[2 * j + 1];
+      }
+    }
+    free(x);
+    free(y);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
+
+/*-----------------------------------------------------
+ FFT3Dforward computes the half spectrum of the real
+ volume vol (not scaled).
+------------------------------------------------------*/
+void FFT3Dforward(const FFT3D_PLAN *plan, const float *vol, float *spec)
+{
+  const int nx = plan->nx, ny = plan->ny, nxc = plan->nxc;
+  int z;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+  for (z = 0; z < plan->nz; z++) {
+    ROMP_PFLB_begin
+    double *x = (double *)malloc((2 * nx + 2) * sizeof(double));
+    double *y = (double *)malloc(2 * nx * sizeof(double));
+    int yy, j;
+    for (yy = 0; yy < ny; yy++) {
+      const float *in = vol + (size_t)nx * (yy + (size_t)ny * z);
+      float *out = spec + 2 * (size_t)nxc * (yy + (size_t)ny * z);
+      for (j = 0; j < nx; j++) x[j] = in[j];
+      fftRealLine(plan->px, x, y, FourierForward);
+      for (j = 0; j < 2 * nxc; j++) out[j] = x[j];
+    }
+    free(x);
+    free(y);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  fft3Dlines(plan, spec, 1, FourierForward);
+  fft3Dlines(plan, spec, 2, FourierForward);
+}
+
+/*-----------------------------------------------------
+ FFT3Dbackward computes the real volume from its half
+ spectrum, scaled by 1/(nx*ny*nz) so that it undoes
+ FFT3Dforward. spec is overwritten.
+------------------------------------------------------*/
+void FFT3Dbackward(const FFT3D_PLAN *plan, float *spec, float *vol)
+{
+  const int nx = plan->nx, ny = plan->ny, nxc = plan->nxc;
+  const double scale = 1.0 / ((double)nx * ny * plan->nz);
+  int z;
+
+  fft3Dlines(plan, spec, 2, FourierBackward);
+  fft3Dlines(plan, spec, 1, FourierBackward);
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+  for (z = 0; z < plan->nz; z++) {
+    ROMP_PFLB_begin
+    double *x = (double *)malloc((2 * nx + 2) * sizeof(double));
+    double *y = (double *)malloc(2 * nx * sizeof(double));
+    int yy, j;
+    for (yy = 0; yy < ny; yy++) {
+      const float *in = spec + 2 * (size_t)nxc * (yy + (size_t)ny * z);
+      float *out = vol + (size_t)nx * (yy + (size_t)ny * z);
+      for (j = 0; j < 2 * nxc; j++) x[j] = in[j];
+      fftRealLine(plan->px, x, y, FourierBackward);
+      for (j = 0; j < nx; j++) out[j] = x[j] * scale;
+    }
+    free(x);
+    free(y);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
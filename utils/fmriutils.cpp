@@ -889,6 +889,319 @@ MRI *MRInormWeights(MRI *w, int sqrtFlag, int invFlag, MRI *mask, MRI *wn)
   return (wn);
 }
 
+/*---------------------------------------------------------------------
+  MRIglmSetTileSize() - sets the number of voxels that MRIglmFitAndTest()
+  processes per tile when the design matrix is the same at all voxels.
+  0 turns tiling off (one GLMMAT fit per voxel). If never set, the
+  FS_GLM_TILE environment variable is used, otherwise 2048.
+  --------------------------------------------------------------------*/
+static int glm_tile_size = -1;
+void MRIglmSetTileSize(int ntile) { glm_tile_size = ntile; }
+int MRIglmTileSize(void)
+{
+  char *s;
+  if (glm_tile_size >= 0) return (glm_tile_size);
+  s = getenv("FS_GLM_TILE");
+  if (s != NULL) return (MAX(atoi(s), 0));
+  return (2048);
+}
+
+/*---------------------------------------------------------------------
+  MRIglmFitAndTestTiled() - fits and tests the glm over the mask when
+  X is the same at every voxel (no weights, pvrs, frame mask, or ffx).
+  glm->X and all the intermediate matrices from GLMcMatrices() and
+  GLMxMatrices() must already be computed. Everything that depends
+  only on X and C (pinv(X), inv(C*inv(X'X)*C'), the pcc projections)
+  is computed once, then the voxels are processed ntile at a time as
+  dense matrix-matrix products, one tile per thread, each thread with
+  its own scratch. Each voxel gets the same values that GLMfit() and
+  GLMtest() would give it.
+  --------------------------------------------------------------------*/
+static int MRIglmFitAndTestTiled(MRIGLM *mriglm, int ntile)
+{
+  GLMMAT *glm = mriglm->glm;
+  MRI *y = mriglm->y;
+  int nc, nr, ns, nf, nb, ncon, n, i, j, k, f, ntiles, nthreads, J, Jmax;
+  long nvox;
+  int *vc, *vr, *vs;
+  double *X, *P, dof, Xcond = 0;
+  double *C[GLMMAT_NCONTRASTS_MAX], *icvm[GLMMAT_NCONTRASTS_MAX], cvm11[GLMMAT_NCONTRASTS_MAX];
+  double *g0[GLMMAT_NCONTRASTS_MAX], *Mpmf[GLMMAT_NCONTRASTS_MAX];
+  double *RD[GLMMAT_NCONTRASTS_MAX], *wXcd[GLMMAT_NCONTRASTS_MAX];
+  double sumXcd[GLMMAT_NCONTRASTS_MAX], sumXcd2[GLMMAT_NCONTRASTS_MAX];
+  double **scratch;
+  size_t nscratch;
+  MATRIX *Pm, *mtmp;
+
+  nc = y->width;
+  nr = y->height;
+  ns = y->depth;
+  nf = y->nframes;
+  nb = glm->X->cols;
+  ncon = glm->ncontrasts;
+  dof = glm->dof;
+
+  // List of voxels in the mask, in the same order as the voxel loop
+  nvox = 0;
+  for (i = 0; i < nc; i++)
+    for (j = 0; j < nr; j++)
+      for (k = 0; k < ns; k++)
+        if (mriglm->mask == NULL || MRIgetVoxVal(mriglm->mask, i, j, k, 0) >= 0.5) nvox++;
+  vc = (int *)calloc(nvox + 1, sizeof(int));
+  vr = (int *)calloc(nvox + 1, sizeof(int));
+  vs = (int *)calloc(nvox + 1, sizeof(int));
+  nvox = 0;
+  for (i = 0; i < nc; i++) {
+    for (j = 0; j < nr; j++) {
+      for (k = 0; k < ns; k++) {
+        if (mriglm->mask != NULL && MRIgetVoxVal(mriglm->mask, i, j, k, 0) < 0.5) continue;
+        vc[nvox] = i;
+        vr[nvox] = j;
+        vs[nvox] = k;
+        nvox++;
+      }
+    }
+  }
+
+  // X and pinv(X) = inv(X'*X)*X'
+  Pm = MatrixMultiplyD(glm->iXtX, glm->Xt, NULL);
+  X = (double *)calloc(nf * nb, sizeof(double));
+  P = (double *)calloc(nb * nf, sizeof(double));
+  for (f = 0; f < nf; f++)
+    for (k = 0; k < nb; k++) X[f * nb + k] = glm->X->rptr[f + 1][k + 1];
+  for (k = 0; k < nb; k++)
+    for (f = 0; f < nf; f++) P[k * nf + f] = Pm->rptr[k + 1][f + 1];
+  MatrixFree(&Pm);
+  if (mriglm->condsave) Xcond = MatrixConditionNumber(glm->XtX);
+
+  // Per-contrast matrices
+  for (n = 0; n < ncon; n++) {
+    J = glm->C[n]->rows;
+    C[n] = (double *)calloc(J * nb, sizeof(double));
+    for (i = 0; i < J; i++)
+      for (k = 0; k < nb; k++) C[n][i * nb + k] = glm->C[n]->rptr[i + 1][k + 1];
+    cvm11[n] = glm->CiXtXCt[n]->rptr[1][1];
+    icvm[n] = NULL;
+    mtmp = MatrixInverse(glm->CiXtXCt[n], NULL);
+    if (mtmp != NULL) {
+      icvm[n] = (double *)calloc(J * J, sizeof(double));
+      for (i = 0; i < J; i++)
+        for (j = 0; j < J; j++) icvm[n][i * J + j] = mtmp->rptr[i + 1][j + 1];
+      MatrixFree(&mtmp);
+    }
+    g0[n] = NULL;
+    if (glm->UseGamma0[n]) {
+      g0[n] = (double *)calloc(J, sizeof(double));
+      for (i = 0; i < J; i++) g0[n][i] = glm->gamma0[n]->rptr[i + 1][1];
+    }
+    Mpmf[n] = NULL;
+    if (glm->ypmfflag[n]) {
+      // Mpmf = C'*inv(C*C')*C, so ypmf = Mpmf*beta is nb-by-1
+      Mpmf[n] = (double *)calloc(nb * nb, sizeof(double));
+      for (i = 0; i < nb; i++)
+        for (k = 0; k < nb; k++) Mpmf[n][i * nb + k] = glm->Mpmf[n]->rptr[i + 1][k + 1];
+    }
+    // pcc: yhatd = RD*yhat, Xcd'*yhatd = (Xcd'*RD)*yhat
+    RD[n] = wXcd[n] = NULL;
+    if (glm->Dt[n] != NULL) {
+      RD[n] = (double *)calloc(nf * nf, sizeof(double));
+      wXcd[n] = (double *)calloc(nf, sizeof(double));
+      for (i = 0; i < nf; i++)
+        for (j = 0; j < nf; j++) RD[n][i * nf + j] = glm->RD[n]->rptr[i + 1][j + 1];
+      for (j = 0; j < nf; j++)
+        for (i = 0; i < nf; i++) wXcd[n][j] += glm->Xcdt[n]->rptr[1][i + 1] * RD[n][i * nf + j];
+      sumXcd[n] = glm->sumXcd[n]->rptr[1][1];
+      sumXcd2[n] = glm->sumXcd2[n]->rptr[1][1];
+    }
+  }
+
+  // Per-thread scratch: Y, yhat, and yhatd (nf x ntile each), beta
+  // (nb x ntile), gamma (J x ntile), rvar (ntile)
+  Jmax = 1;
+  for (n = 0; n < ncon; n++) Jmax = MAX(Jmax, glm->C[n]->rows);
+  // only as many threads as there are tiles, and just one when already
+  // inside a parallel region (eg, mri_glmfit simulations)
+  nscratch = (size_t)ntile * (3 * nf + nb + Jmax + 1);
+  ntiles = (nvox + ntile - 1) / ntile;
+  nthreads = 1;
+#ifdef HAVE_OPENMP
+  if (!omp_in_parallel()) nthreads = omp_get_max_threads();
+#endif
+  if (nthreads > ntiles) nthreads = ntiles;
+  if (nthreads < 1) nthreads = 1;
+  scratch = (double **)calloc(nthreads, sizeof(double *));
+  for (i = 0; i < nthreads; i++) scratch[i] = (double *)calloc(nscratch, sizeof(double));
+
+  if (Gdiag_no > 0) printf("GLM: %ld voxels in %d tiles of %d, %d threads\n", nvox, ntiles, ntile, nthreads);
+
+  int t;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) num_threads(nthreads) schedule(dynamic)
+#endif
+  for (t = 0; t < ntiles; t++) {
+    ROMP_PFLB_begin
+    int n, a, b, f, k, nt, J;
+    long v0, v;
+    double *Y, *Yhat, *D, *B, *G, *rvar, val, dtmp, F, p, z, pcc, sd, sd2, xd, *gam, *rhs;
+
+    v0 = (long)t * ntile;
+    nt = MIN((long)ntile, nvox - v0);
+    Y = scratch[omp_get_thread_num()];
+    Yhat = Y + (size_t)nf * ntile;
+    D = Yhat + (size_t)nf * ntile;
+    B = D + (size_t)nf * ntile;
+    G = B + (size_t)nb * ntile;
+    rvar = G + (size_t)Jmax * ntile;
+
+    // Load the tile, one row per frame
+    for (f = 0; f < nf; f++)
+      for (v = 0; v < nt; v++) Y[f * ntile + v] = MRIgetVoxVal(y, vc[v0 + v], vr[v0 + v], vs[v0 + v], f);
+
+    // beta = pinv(X)*Y
+    for (k = 0; k < nb; k++) {
+      double *Bk = &B[k * ntile];
+      for (v = 0; v < nt; v++) Bk[v] = 0;
+      for (f = 0; f < nf; f++) {
+        double pkf = P[k * nf + f], *Yf = &Y[f * ntile];
+        for (v = 0; v < nt; v++) Bk[v] += pkf * Yf[v];
+      }
+    }
+    // yhat = X*beta, eres = Y - yhat (in place in Y), rvar = sum(eres.^2)/dof
+    for (v = 0; v < nt; v++) rvar[v] = 0;
+    for (f = 0; f < nf; f++) {
+      double *Hf = &Yhat[f * ntile], *Yf = &Y[f * ntile];
+      for (v = 0; v < nt; v++) Hf[v] = 0;
+      for (k = 0; k < nb; k++) {
+        double xfk = X[f * nb + k], *Bk = &B[k * ntile];
+        for (v = 0; v < nt; v++) Hf[v] += xfk * Bk[v];
+      }
+      for (v = 0; v < nt; v++) {
+        Yf[v] -= Hf[v];
+        rvar[v] += Yf[v] * Yf[v];
+      }
+    }
+    for (v = 0; v < nt; v++) {
+      rvar[v] /= dof;
+      if (rvar[v] < FLT_MIN) rvar[v] = FLT_MIN;
+    }
+
+    // Pack the fit back into MRI
+    for (v = 0; v < nt; v++) {
+      int c = vc[v0 + v], r = vr[v0 + v], s = vs[v0 + v];
+      MRIsetVoxVal(mriglm->rvar, c, r, s, 0, rvar[v]);
+      for (k = 0; k < nb; k++) MRIsetVoxVal(mriglm->beta, c, r, s, k, B[k * ntile + v]);
+      for (f = 0; f < nf; f++) MRIsetVoxVal(mriglm->eres, c, r, s, f, Y[f * ntile + v]);
+      if (mriglm->yhatsave)
+        for (f = 0; f < nf; f++) MRIsetVoxVal(mriglm->yhat, c, r, s, f, Yhat[f * ntile + v]);
+      if (mriglm->condsave) MRIsetVoxVal(mriglm->cond, c, r, s, 0, Xcond);
+    }
+
+    for (n = 0; n < ncon; n++) {
+      J = glm->C[n]->rows;
+      // gamma = C*beta - gamma0
+      for (a = 0; a < J; a++) {
+        double *Ga = &G[a * ntile];
+        for (v = 0; v < nt; v++) Ga[v] = (g0[n] != NULL) ? -g0[n][a] : 0;
+        for (k = 0; k < nb; k++) {
+          double cak = C[n][a * nb + k], *Bk = &B[k * ntile];
+          if (cak == 0) continue;
+          for (v = 0; v < nt; v++) Ga[v] += cak * Bk[v];
+        }
+      }
+      // yhatd = RD*yhat, only needed for the pcc
+      if (RD[n] != NULL) {
+        for (a = 0; a < nf; a++) {
+          double *Da = &D[a * ntile];
+          for (v = 0; v < nt; v++) Da[v] = 0;
+          for (b = 0; b < nf; b++) {
+            double rab = RD[n][a * nf + b], *Hb = &Yhat[b * ntile];
+            for (v = 0; v < nt; v++) Da[v] += rab * Hb[v];
+          }
+        }
+      }
+      for (v = 0; v < nt; v++) {
+        int c = vc[v0 + v], r = vr[v0 + v], s = vs[v0 + v];
+        // Error trap for when rvar==0
+        if (rvar[v] < 2 * FLT_MIN)
+          dtmp = 1e10 * J;
+        else
+          dtmp = rvar[v] * J;
+        F = 0;
+        p = 1;
+        z = 0;
+        pcc = 0;
+        if (icvm[n] != NULL && rvar[v] > FLT_MIN) {
+          // F = gamma' * inv(C*inv(X'*X)*C') * gamma / (rvar*J)
+          F = 0;
+          for (a = 0; a < J; a++) {
+            gam = &G[a * ntile + v];
+            rhs = &icvm[n][a * J];
+            val = 0;
+            for (b = 0; b < J; b++) val += rhs[b] * G[b * ntile + v];
+            F += (*gam) * val;
+          }
+          F /= dtmp;
+          if (F >= 0) {
+            p = sc_cdf_fdist_Q(F, J, dof);
+            z = sc_cdf_gaussian_Qinv(p / 2.0, 1);  // same as RFp2StatVal() for "z"
+          }
+          else {
+            // Neg F can happen when the design matrix is ill-cond (see GLMtest())
+            F = 0;
+            p = 1;
+            z = 0;
+          }
+          if (J == 1 && G[v] < 0) z *= -1;
+          if (RD[n] != NULL) {
+            xd = 0;
+            sd = 0;
+            sd2 = dof * rvar[v];
+            for (f = 0; f < nf; f++) {
+              xd += wXcd[n][f] * Yhat[f * ntile + v];
+              sd += D[f * ntile + v];
+              sd2 += D[f * ntile + v] * D[f * ntile + v];
+            }
+            pcc = (xd - sumXcd[n] * sd) / sqrt((sumXcd2[n] - sumXcd[n] * sumXcd[n]) * (sd2 - sd * sd));
+          }
+        }
+        for (a = 0; a < J; a++) MRIsetVoxVal(mriglm->gamma[n], c, r, s, a, G[a * ntile + v]);
+        if (J == 1) MRIsetVoxVal(mriglm->gammaVar[n], c, r, s, 0, cvm11[n] * dtmp);
+        MRIsetVoxVal(mriglm->F[n], c, r, s, 0, F);
+        MRIsetVoxVal(mriglm->p[n], c, r, s, 0, p);
+        MRIsetVoxVal(mriglm->z[n], c, r, s, 0, z);
+        if (J == 1 && glm->DoPCC) MRIsetVoxVal(mriglm->pcc[n], c, r, s, 0, pcc);
+        if (Mpmf[n] != NULL) {
+          for (f = 0; f < nb; f++) {
+            val = 0;
+            for (k = 0; k < nb; k++) val += Mpmf[n][f * nb + k] * B[k * ntile + v];
+            MRIsetVoxVal(mriglm->ypmf[n], c, r, s, f, val);
+          }
+        }
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  for (i = 0; i < nthreads; i++) free(scratch[i]);
+  free(scratch);
+  for (n = 0; n < ncon; n++) {
+    free(C[n]);
+    if (icvm[n]) free(icvm[n]);
+    if (g0[n]) free(g0[n]);
+    if (Mpmf[n]) free(Mpmf[n]);
+    if (RD[n]) free(RD[n]);
+    if (wXcd[n]) free(wXcd[n]);
+  }
+  free(X);
+  free(P);
+  free(vc);
+  free(vr);
+  free(vs);
+  return (0);
+}
+
 /*---------------------------------------------------------------------
   MRIglmFitAndTest() - fits and tests glm on a voxel-by-voxel basis.
   There are also two other related functions, MRIglmFit() and
@@ -898,10 +1211,12 @@ MRI *MRInormWeights(MRI *w, int sqrtFlag, int invFlag, MRI *mask, MRI *wn)
   next voxel. MRIglmFitAndTest() will be computationally more
   efficient.  So why have MRIglmFit() and MRIglmTest()? So that the
   variance can be smoothed between the two if desired.
+  When X is the same at every voxel, the voxels are fit and tested
+  in tiles by MRIglmFitAndTestTiled() (see MRIglmSetTileSize()).
   --------------------------------------------------------------------*/
 int MRIglmFitAndTest(MRIGLM *mriglm)
 {
-  int c, nc, nr, ns, nf, n;
+  int c, nc, nr, ns, nf, n, ntile;
   long nvoxtot;
   //int c, r, s, n, nc, nr, ns, nf, pctdone;
   //float m, Xcond;
@@ -979,6 +1294,10 @@ int MRIglmFitAndTest(MRIGLM *mriglm)
   mriglm->n_ill_cond = 0;
   long n_ill_cond = 0;
 
+  ntile = MRIglmTileSize();
+  if (ntile > 0 && !mriglm->pervoxflag && mriglm->yffxvar == NULL && !glm->ill_cond_flag)
+    return (MRIglmFitAndTestTiled(mriglm, ntile));
+
   // Parallel does not work yet because need separate glm for each thread
   //#ifdef HAVE_OPENMP
   //#pragma omp parallel for if_ROMP(assume_reproducible) reduction(+ : n_ill_cond)
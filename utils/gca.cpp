@@ -28,9 +28,14 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
 
 #include "faster_variants.h"
 #include "romp_support.h"
@@ -141,6 +146,8 @@ static GC1D *findGCInWindow(GCA *gca, int x, int y, int z, int label, int wsize)
 
 
 static int gcaCheck(GCA *gca);
+static void gcaComputeNodeTraining(GCA *gca);
+static void gcaFreeMapped(GCA *gca);
 double gcaVoxelLogPosterior(GCA *gca, MRI *mri_labels, MRI *mri_inputs, int x, int y, int z, TRANSFORM *transform);
 static double gcaGibbsImpossibleConfiguration(GCA *gca, MRI *mri_labels, int x, int y, int z, TRANSFORM *transform);
 static GCA_SAMPLE *gcaExtractLabelAsSamples(
@@ -1609,6 +1616,11 @@ int GCAfree(GCA **pgca)
   gca = *pgca;
   *pgca = NULL;
 
+  if (gca->mapped) {
+    gcaFreeMapped(gca);
+    return (NO_ERROR);
+  }
+
   for (x = 0; x < gca->node_width; x++) {
     for (y = 0; y < gca->node_height; y++) {
       for (z = 0; z < gca->node_depth; z++) {
@@ -1703,6 +1715,7 @@ int GCAtrainCovariances(GCA *gca, MRI *mri_inputs, MRI *mri_labels, TRANSFORM *t
   int xp, yp, zp, holes_filled = 0;
   MRI *mri_mapped;
 
+  GCAunmap(gca);
   /* convert transform to voxel coordinates */
 
   /* go through each voxel in the input volume and find the canonical
@@ -1847,6 +1860,7 @@ int GCAtrain(GCA *gca, MRI *mri_inputs, MRI *mri_labels, TRANSFORM *transform, G
   GCA_NODE *gcan;
   MRI *mri_mapped;
 
+  GCAunmap(gca);
   gca->total_training++;
   mri_mapped = MRIalloc(gca->prior_width, gca->prior_height, gca->prior_depth, MRI_UCHAR);
   if (first_time) {
@@ -2076,6 +2090,9 @@ int GCAwrite(GCA *gca, const char *fname)
   GC1D *gc;
   int gzipped = 0;
 
+  if (strstr(fname, ".gcx")) {
+    return (GCAwriteMapped(gca, fname));
+  }
   if (strstr(fname, ".gcz")) {
     gzipped = 1;
   }
@@ -2230,6 +2247,9 @@ GCA *GCAread(const char *fname)
   int gzipped = 0;
   int tempZNZ;
 
+  if (GCAisMapped(fname)) {
+    return (GCAreadMapped(fname));
+  }
   if (strstr(fname, ".gcz")) {
     gzipped = 1;
   }
@@ -2535,28 +2555,7 @@ GCA *GCAread(const char *fname)
     }
   }
 
-  for (x = 0; x < gca->node_width; x++) {
-    for (y = 0; y < gca->node_height; y++) {
-      for (z = 0; z < gca->node_depth; z++) {
-        int xp, yp, zp;
-
-        if (x == Ggca_x && y == Ggca_y && z == Ggca_z) {
-          DiagBreak();
-        }
-        gcan = &gca->nodes[x][y][z];
-        if (gcaNodeToPrior(gca, x, y, z, &xp, &yp, &zp) == NO_ERROR) {
-          gcap = &gca->priors[xp][yp][zp];
-          if (gcap == NULL) {
-            continue;
-          }
-          for (n = 0; n < gcan->nlabels; n++) {
-            gc = &gcan->gcs[n];
-            gc->ntraining = gcan->total_training * getPrior(gcap, gcan->labels[n]);
-          }
-        }
-      }
-    }
-  }
+  gcaComputeNodeTraining(gca);
 
   while (znzreadIntEx(&tag, file)) {
     int n, nparms;
@@ -2654,6 +2653,592 @@ GCA *GCAread(const char *fname)
   return (gca);
 }
 
+/*
+  compute the (non-stored) per-class training counts from the node and prior totals
+*/
+static void gcaComputeNodeTraining(GCA *gca)
+{
+  int x, y, z, n;
+  GCA_NODE *gcan;
+  GCA_PRIOR *gcap;
+  GC1D *gc;
+
+  for (x = 0; x < gca->node_width; x++) {
+    for (y = 0; y < gca->node_height; y++) {
+      for (z = 0; z < gca->node_depth; z++) {
+        int xp, yp, zp;
+
+        if (x == Ggca_x && y == Ggca_y && z == Ggca_z) {
+          DiagBreak();
+        }
+        gcan = &gca->nodes[x][y][z];
+        if (gcaNodeToPrior(gca, x, y, z, &xp, &yp, &zp) == NO_ERROR) {
+          gcap = &gca->priors[xp][yp][zp];
+          if (gcap == NULL) {
+            continue;
+          }
+          for (n = 0; n < gcan->nlabels; n++) {
+            gc = &gcan->gcs[n];
+            gc->ntraining = gcan->total_training * getPrior(gcap, gcan->labels[n]);
+          }
+        }
+      }
+    }
+  }
+}
+
+/*
+  The mapped (.gcx) format stores the atlas as a handful of flat arrays in
+  native byte order, so that GCAreadMapped() can mmap the file and point
+  the GCA_NODE/GCA_PRIOR/GC1D structures straight into it. Only the small
+  per-node and per-class structs are allocated; means, covariances, labels
+  and Gibbs tables stay in the (shared, page-cached) mapping, which is
+  read-only. Anything that changes atlas values or reallocates the label
+  lists (training, renormalization, relabeling) calls GCAunmap() first,
+  which copies the tables out of the mapping and leaves an ordinary GCA.
+*/
+#define GCA_MAPPED_MAGIC "GCAMAP01"
+#define GCA_MAPPED_BYTEORDER 0x01020304
+#define GCA_MAPPED_ALIGN 64
+
+typedef struct
+{
+  char magic[8];
+  int byteorder;
+  int ninputs, flags, type;
+  float prior_spacing, node_spacing;
+  int prior_width, prior_height, prior_depth;
+  int node_width, node_height, node_depth;
+  int width, height, depth;
+  float xsize, ysize, zsize;
+  float x_r, x_a, x_s, y_r, y_a, y_s, z_r, z_a, z_s, c_r, c_a, c_s;
+  double TRs[MAX_GCA_INPUTS], FAs[MAX_GCA_INPUTS], TEs[MAX_GCA_INPUTS];
+  long long ngcs, ngibbs, nprior_labels;
+  // byte offsets of the arrays within the file
+  long long node_nlabels, node_total_training;   // int[nnodes]
+  long long gc_labels;                           // unsigned short[ngcs]
+  long long gc_means, gc_covars;                 // float[ngcs*ninputs], float[ngcs*ncovars]
+  long long gibbs_nlabels;                       // short[ngcs*GIBBS_NEIGHBORS]
+  long long gibbs_labels, gibbs_priors;          // unsigned short[ngibbs], float[ngibbs]
+  long long prior_nlabels, prior_total_training; // int[npriors]
+  long long prior_labels, prior_priors;          // unsigned short[nprior_labels], float[nprior_labels]
+  long long ctab;                                // 0 if there is no color table
+} GCA_MAPPED_HEADER;
+
+typedef struct
+{
+  void *base;
+  size_t size;
+  unsigned short **gibbs_labels;  // the per-class Gibbs pointer arrays, GIBBS_NEIGHBORS per class
+  float **gibbs_priors;
+} GCA_MAPPING;
+
+static long long gcaWriteMappedArray(znzFile file, const void *data, size_t nbytes)
+{
+  char pad[GCA_MAPPED_ALIGN] = {0};
+  long long offset;
+
+  offset = znztell(file);
+  if (offset % GCA_MAPPED_ALIGN) {
+    znzwrite(pad, 1, GCA_MAPPED_ALIGN - offset % GCA_MAPPED_ALIGN, file);
+    offset = znztell(file);
+  }
+  if (nbytes > 0) znzwrite((void *)data, 1, nbytes, file);
+  return (offset);
+}
+
+/*!
+  \fn int GCAwriteMapped(GCA *gca, const char *fname)
+  \brief Writes the atlas in the mmap-able .gcx layout (see GCAreadMapped).
+  GCAwrite() calls this for any file name containing .gcx
+*/
+int GCAwriteMapped(GCA *gca, const char *fname)
+{
+  GCA_MAPPED_HEADER hdr;
+  znzFile file;
+  int x, y, z, n, i, ncovars;
+  GCA_NODE *gcan;
+  GCA_PRIOR *gcap;
+  GC1D *gc;
+  std::vector<int> node_nlabels, node_total_training, prior_nlabels, prior_total_training;
+  std::vector<unsigned short> gc_labels, gibbs_labels, prior_labels;
+  std::vector<float> gc_means, gc_covars, gibbs_priors, prior_priors;
+  std::vector<short> gibbs_nlabels;
+
+  ncovars = (gca->ninputs * (gca->ninputs + 1)) / 2;
+  for (x = 0; x < gca->node_width; x++) {
+    for (y = 0; y < gca->node_height; y++) {
+      for (z = 0; z < gca->node_depth; z++) {
+        gcan = &gca->nodes[x][y][z];
+        node_nlabels.push_back(gcan->nlabels);
+        node_total_training.push_back(gcan->total_training);
+        for (n = 0; n < gcan->nlabels; n++) {
+          gc = &gcan->gcs[n];
+          gc_labels.push_back(gcan->labels[n]);
+          gc_means.insert(gc_means.end(), gc->means, gc->means + gca->ninputs);
+          gc_covars.insert(gc_covars.end(), gc->covars, gc->covars + ncovars);
+          if (gca->flags & GCA_NO_MRF) {
+            continue;
+          }
+          for (i = 0; i < GIBBS_NEIGHBORS; i++) {
+            gibbs_nlabels.push_back(gc->nlabels[i]);
+            gibbs_labels.insert(gibbs_labels.end(), gc->labels[i], gc->labels[i] + gc->nlabels[i]);
+            gibbs_priors.insert(gibbs_priors.end(), gc->label_priors[i], gc->label_priors[i] + gc->nlabels[i]);
+          }
+        }
+      }
+    }
+  }
+  for (x = 0; x < gca->prior_width; x++) {
+    for (y = 0; y < gca->prior_height; y++) {
+      for (z = 0; z < gca->prior_depth; z++) {
+        gcap = &gca->priors[x][y][z];
+        prior_nlabels.push_back(gcap->nlabels);
+        prior_total_training.push_back(gcap->total_training);
+        prior_labels.insert(prior_labels.end(), gcap->labels, gcap->labels + gcap->nlabels);
+        prior_priors.insert(prior_priors.end(), gcap->priors, gcap->priors + gcap->nlabels);
+      }
+    }
+  }
+
+  file = znzopen(fname, "wb", 0);
+  if (znz_isnull(file)) {
+    errno = 0;
+    ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "GCAwriteMapped(%s): could not open file", fname));
+  }
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, GCA_MAPPED_MAGIC, sizeof(hdr.magic));
+  hdr.byteorder = GCA_MAPPED_BYTEORDER;
+  hdr.ninputs = gca->ninputs;
+  hdr.flags = gca->flags;
+  hdr.type = gca->type;
+  hdr.prior_spacing = gca->prior_spacing;
+  hdr.node_spacing = gca->node_spacing;
+  hdr.prior_width = gca->prior_width;
+  hdr.prior_height = gca->prior_height;
+  hdr.prior_depth = gca->prior_depth;
+  hdr.node_width = gca->node_width;
+  hdr.node_height = gca->node_height;
+  hdr.node_depth = gca->node_depth;
+  hdr.width = gca->width;
+  hdr.height = gca->height;
+  hdr.depth = gca->depth;
+  hdr.xsize = gca->xsize;
+  hdr.ysize = gca->ysize;
+  hdr.zsize = gca->zsize;
+  hdr.x_r = gca->x_r;
+  hdr.x_a = gca->x_a;
+  hdr.x_s = gca->x_s;
+  hdr.y_r = gca->y_r;
+  hdr.y_a = gca->y_a;
+  hdr.y_s = gca->y_s;
+  hdr.z_r = gca->z_r;
+  hdr.z_a = gca->z_a;
+  hdr.z_s = gca->z_s;
+  hdr.c_r = gca->c_r;
+  hdr.c_a = gca->c_a;
+  hdr.c_s = gca->c_s;
+  for (n = 0; n < MAX_GCA_INPUTS; n++) {
+    hdr.TRs[n] = gca->TRs[n];
+    hdr.FAs[n] = gca->FAs[n];
+    hdr.TEs[n] = gca->TEs[n];
+  }
+  hdr.ngcs = gc_labels.size();
+  hdr.ngibbs = gibbs_labels.size();
+  hdr.nprior_labels = prior_labels.size();
+
+  // header first (rewritten once the offsets are known)
+  znzwrite(&hdr, sizeof(hdr), 1, file);
+  hdr.node_nlabels = gcaWriteMappedArray(file, node_nlabels.data(), node_nlabels.size() * sizeof(int));
+  hdr.node_total_training =
+      gcaWriteMappedArray(file, node_total_training.data(), node_total_training.size() * sizeof(int));
+  hdr.gc_labels = gcaWriteMappedArray(file, gc_labels.data(), gc_labels.size() * sizeof(unsigned short));
+  hdr.gc_means = gcaWriteMappedArray(file, gc_means.data(), gc_means.size() * sizeof(float));
+  hdr.gc_covars = gcaWriteMappedArray(file, gc_covars.data(), gc_covars.size() * sizeof(float));
+  hdr.gibbs_nlabels = gcaWriteMappedArray(file, gibbs_nlabels.data(), gibbs_nlabels.size() * sizeof(short));
+  hdr.gibbs_labels = gcaWriteMappedArray(file, gibbs_labels.data(), gibbs_labels.size() * sizeof(unsigned short));
+  hdr.gibbs_priors = gcaWriteMappedArray(file, gibbs_priors.data(), gibbs_priors.size() * sizeof(float));
+  hdr.prior_nlabels = gcaWriteMappedArray(file, prior_nlabels.data(), prior_nlabels.size() * sizeof(int));
+  hdr.prior_total_training =
+      gcaWriteMappedArray(file, prior_total_training.data(), prior_total_training.size() * sizeof(int));
+  hdr.prior_labels = gcaWriteMappedArray(file, prior_labels.data(), prior_labels.size() * sizeof(unsigned short));
+  hdr.prior_priors = gcaWriteMappedArray(file, prior_priors.data(), prior_priors.size() * sizeof(float));
+  if (gca->ct) {
+    hdr.ctab = gcaWriteMappedArray(file, NULL, 0);
+    znzCTABwriteIntoBinary(gca->ct, file);
+  }
+
+  znzseek(file, 0, SEEK_SET);
+  if (znzwrite(&hdr, sizeof(hdr), 1, file) != 1) {
+    znzclose(file);
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "GCAwriteMapped(%s): write failed", fname));
+  }
+  znzclose(file);
+
+  return (NO_ERROR);
+}
+
+/*!
+  \fn int GCAisMapped(const char *fname)
+  \brief Returns 1 if fname is an atlas in the mapped (.gcx) layout
+*/
+int GCAisMapped(const char *fname)
+{
+  FILE *fp;
+  char magic[sizeof(GCA_MAPPED_MAGIC)];
+  int is_mapped;
+
+  fp = fopen(fname, "rb");
+  if (fp == NULL) {
+    return (0);
+  }
+  is_mapped = (fread(magic, 1, 8, fp) == 8 && !strncmp(magic, GCA_MAPPED_MAGIC, 8));
+  fclose(fp);
+  return (is_mapped);
+}
+
+/* count elements of elsize bytes at offset lie after the header and
+   within a file of size bytes */
+static bool gcaMappedArrayFits(long long offset, long long count, long long elsize, long long size)
+{
+  return (offset >= (long long)sizeof(GCA_MAPPED_HEADER) && offset <= size && count >= 0 &&
+          count <= (size - offset) / elsize);
+}
+
+/*!
+  \fn GCA *GCAreadMapped(const char *fname)
+  \brief Maps a .gcx atlas into memory. GCAread() calls this automatically
+  when it sees the .gcx magic number. Concurrent jobs reading the same file
+  share its pages, and nothing but the small node/prior/class structs is
+  allocated or parsed.
+*/
+GCA *GCAreadMapped(const char *fname)
+{
+  GCA *gca;
+  GCA_MAPPED_HEADER *hdr;
+  GCA_MAPPING *m;
+  GCA_NODE *gcan;
+  GCA_PRIOR *gcap;
+  GC1D *gc;
+  struct stat st;
+  char *base;
+  int fd, x, y, z, n, i, ncovars, *nl, *tt;
+  long long nnodes, npriors, g, k, j;
+  short *gibbs_nlabels;
+  unsigned short *gc_labels, *gibbs_labels, *prior_labels;
+  float *gc_means, *gc_covars, *gibbs_priors, *prior_priors;
+
+  fd = open(fname, O_RDONLY);
+  if (fd < 0) {
+    ErrorReturn(NULL, (ERROR_NOFILE, "GCAreadMapped(%s): could not open file", fname));
+  }
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(GCA_MAPPED_HEADER)) {
+    close(fd);
+    ErrorReturn(NULL, (ERROR_BADFILE, "GCAreadMapped(%s): file too small", fname));
+  }
+  base = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    ErrorReturn(NULL, (ERROR_NOMEMORY, "GCAreadMapped(%s): mmap failed (%s)", fname, strerror(errno)));
+  }
+
+  hdr = (GCA_MAPPED_HEADER *)base;
+  if (strncmp(hdr->magic, GCA_MAPPED_MAGIC, 8) || hdr->byteorder != GCA_MAPPED_BYTEORDER) {
+    munmap(base, st.st_size);
+    ErrorReturn(NULL,
+                (ERROR_BADFILE,
+                 "GCAreadMapped(%s): not a mapped atlas, or written on a machine "
+                 "with different byte order (regenerate it from the .gca)",
+                 fname));
+  }
+  if (hdr->ninputs < 1 || hdr->ninputs > MAX_GCA_INPUTS || hdr->node_width <= 0 || hdr->node_height <= 0 ||
+      hdr->node_depth <= 0 || hdr->prior_width <= 0 || hdr->prior_height <= 0 || hdr->prior_depth <= 0 ||
+      !(hdr->node_spacing > 0) || !(hdr->prior_spacing > 0) ||
+      (double)hdr->node_width * hdr->node_height * hdr->node_depth * sizeof(int) > st.st_size ||
+      (double)hdr->prior_width * hdr->prior_height * hdr->prior_depth * sizeof(int) > st.st_size) {
+    munmap(base, st.st_size);
+    ErrorReturn(NULL, (ERROR_BADFILE, "GCAreadMapped(%s): corrupt header", fname));
+  }
+  nnodes = (long long)hdr->node_width * hdr->node_height * hdr->node_depth;
+  npriors = (long long)hdr->prior_width * hdr->prior_height * hdr->prior_depth;
+  ncovars = (hdr->ninputs * (hdr->ninputs + 1)) / 2;
+  // every table must lie within the file before anything points into it
+  if (!gcaMappedArrayFits(hdr->node_nlabels, nnodes, sizeof(int), st.st_size) ||
+      !gcaMappedArrayFits(hdr->node_total_training, nnodes, sizeof(int), st.st_size) ||
+      !gcaMappedArrayFits(hdr->gc_labels, hdr->ngcs, sizeof(unsigned short), st.st_size) ||
+      !gcaMappedArrayFits(hdr->gc_means, hdr->ngcs * hdr->ninputs, sizeof(float), st.st_size) ||
+      !gcaMappedArrayFits(hdr->gc_covars, hdr->ngcs * ncovars, sizeof(float), st.st_size) ||
+      !gcaMappedArrayFits(
+          hdr->gibbs_nlabels, (hdr->flags & GCA_NO_MRF) ? 0 : hdr->ngcs * GIBBS_NEIGHBORS, sizeof(short), st.st_size) ||
+      !gcaMappedArrayFits(hdr->gibbs_labels, hdr->ngibbs, sizeof(unsigned short), st.st_size) ||
+      !gcaMappedArrayFits(hdr->gibbs_priors, hdr->ngibbs, sizeof(float), st.st_size) ||
+      !gcaMappedArrayFits(hdr->prior_nlabels, npriors, sizeof(int), st.st_size) ||
+      !gcaMappedArrayFits(hdr->prior_total_training, npriors, sizeof(int), st.st_size) ||
+      !gcaMappedArrayFits(hdr->prior_labels, hdr->nprior_labels, sizeof(unsigned short), st.st_size) ||
+      !gcaMappedArrayFits(hdr->prior_priors, hdr->nprior_labels, sizeof(float), st.st_size) || hdr->ctab < 0 ||
+      hdr->ctab >= st.st_size) {
+    munmap(base, st.st_size);
+    ErrorReturn(NULL, (ERROR_BADFILE, "GCAreadMapped(%s): truncated file", fname));
+  }
+
+  gca = gcaAllocMax(hdr->ninputs,
+                    hdr->prior_spacing,
+                    hdr->node_spacing,
+                    hdr->node_spacing * hdr->node_width,
+                    hdr->node_spacing * hdr->node_height,
+                    hdr->node_spacing * hdr->node_depth,
+                    0,
+                    hdr->flags);
+  if (gca->prior_width != hdr->prior_width || gca->prior_height != hdr->prior_height ||
+      gca->prior_depth != hdr->prior_depth || gca->node_width != hdr->node_width ||
+      gca->node_height != hdr->node_height || gca->node_depth != hdr->node_depth) {
+    munmap(base, st.st_size);
+    GCAfree(&gca);
+    ErrorReturn(NULL, (ERROR_BADFILE, "GCAreadMapped(%s): inconsistent dimensions", fname));
+  }
+  gca->type = hdr->type;
+  for (n = 0; n < MAX_GCA_INPUTS; n++) {
+    gca->TRs[n] = hdr->TRs[n];
+    gca->FAs[n] = hdr->FAs[n];
+    gca->TEs[n] = hdr->TEs[n];
+  }
+  gca->x_r = hdr->x_r;
+  gca->x_a = hdr->x_a;
+  gca->x_s = hdr->x_s;
+  gca->y_r = hdr->y_r;
+  gca->y_a = hdr->y_a;
+  gca->y_s = hdr->y_s;
+  gca->z_r = hdr->z_r;
+  gca->z_a = hdr->z_a;
+  gca->z_s = hdr->z_s;
+  gca->c_r = hdr->c_r;
+  gca->c_a = hdr->c_a;
+  gca->c_s = hdr->c_s;
+  gca->width = hdr->width;
+  gca->height = hdr->height;
+  gca->depth = hdr->depth;
+  gca->xsize = hdr->xsize;
+  gca->ysize = hdr->ysize;
+  gca->zsize = hdr->zsize;
+
+  // the node and prior rows come from gcaAllocMax() as for a .gca, so they stay put if the atlas is unmapped
+  m = (GCA_MAPPING *)calloc(1, sizeof(GCA_MAPPING));
+  if (!m) ErrorExit(ERROR_NOMEMORY, "GCAreadMapped(%s): could not allocate mapping", fname);
+  m->base = base;
+  m->size = st.st_size;
+  if (!(gca->flags & GCA_NO_MRF)) {
+    m->gibbs_labels = (unsigned short **)calloc(hdr->ngcs * GIBBS_NEIGHBORS, sizeof(unsigned short *));
+    m->gibbs_priors = (float **)calloc(hdr->ngcs * GIBBS_NEIGHBORS, sizeof(float *));
+    if (hdr->ngcs && (!m->gibbs_labels || !m->gibbs_priors))
+      ErrorExit(ERROR_NOMEMORY, "GCAreadMapped(%s): could not allocate Gibbs tables", fname);
+  }
+  gca->mapped = m;
+
+  nl = (int *)(base + hdr->node_nlabels);
+  tt = (int *)(base + hdr->node_total_training);
+  gc_labels = (unsigned short *)(base + hdr->gc_labels);
+  gc_means = (float *)(base + hdr->gc_means);
+  gc_covars = (float *)(base + hdr->gc_covars);
+  gibbs_nlabels = (short *)(base + hdr->gibbs_nlabels);
+  gibbs_labels = (unsigned short *)(base + hdr->gibbs_labels);
+  gibbs_priors = (float *)(base + hdr->gibbs_priors);
+  for (g = k = j = 0, x = 0; x < gca->node_width; x++) {
+    for (y = 0; y < gca->node_height; y++) {
+      for (z = 0; z < gca->node_depth; z++, j++) {
+        gcan = &gca->nodes[x][y][z];
+        gcan->nlabels = gcan->max_labels = nl[j];
+        gcan->total_training = tt[j];
+        if (gcan->nlabels <= 0) {
+          continue;
+        }
+        if (g + gcan->nlabels > hdr->ngcs) {
+          GCAfree(&gca);
+          ErrorReturn(NULL, (ERROR_BADFILE, "GCAreadMapped(%s): corrupt node table", fname));
+        }
+        gcan->labels = &gc_labels[g];
+        gcan->gcs = (GC1D *)calloc(gcan->nlabels, sizeof(GC1D));
+        if (!gcan->gcs) ErrorExit(ERROR_NOMEMORY, "GCAreadMapped(%s): could not allocate classes", fname);
+        for (n = 0; n < gcan->nlabels; n++, g++) {
+          gc = &gcan->gcs[n];
+          gc->means = &gc_means[g * gca->ninputs];
+          gc->covars = &gc_covars[g * ncovars];
+          if (gcan->labels[n] > gca->max_label) gca->max_label = gcan->labels[n];
+          if (gca->flags & GCA_NO_MRF) {
+            continue;
+          }
+          gc->nlabels = &gibbs_nlabels[g * GIBBS_NEIGHBORS];
+          gc->labels = &m->gibbs_labels[g * GIBBS_NEIGHBORS];
+          gc->label_priors = &m->gibbs_priors[g * GIBBS_NEIGHBORS];
+          for (i = 0; i < GIBBS_NEIGHBORS; i++) {
+            if (gc->nlabels[i] < 0 || k + gc->nlabels[i] > hdr->ngibbs) {
+              GCAfree(&gca);
+              ErrorReturn(NULL, (ERROR_BADFILE, "GCAreadMapped(%s): corrupt Gibbs table", fname));
+            }
+            gc->labels[i] = &gibbs_labels[k];
+            gc->label_priors[i] = &gibbs_priors[k];
+            k += gc->nlabels[i];
+          }
+        }
+      }
+    }
+  }
+
+  nl = (int *)(base + hdr->prior_nlabels);
+  tt = (int *)(base + hdr->prior_total_training);
+  prior_labels = (unsigned short *)(base + hdr->prior_labels);
+  prior_priors = (float *)(base + hdr->prior_priors);
+  for (k = j = 0, x = 0; x < gca->prior_width; x++) {
+    for (y = 0; y < gca->prior_height; y++) {
+      for (z = 0; z < gca->prior_depth; z++, j++) {
+        gcap = &gca->priors[x][y][z];
+        gcap->nlabels = gcap->max_labels = nl[j];
+        gcap->total_training = tt[j];
+        if (gcap->nlabels <= 0) {
+          continue;
+        }
+        if (k + gcap->nlabels > hdr->nprior_labels) {
+          GCAfree(&gca);
+          ErrorReturn(NULL, (ERROR_BADFILE, "GCAreadMapped(%s): corrupt prior table", fname));
+        }
+        gcap->labels = &prior_labels[k];
+        gcap->priors = &prior_priors[k];
+        for (n = 0; n < gcap->nlabels; n++)
+          if (gcap->labels[n] > gca->max_label) gca->max_label = gcap->labels[n];
+        k += gcap->nlabels;
+      }
+    }
+  }
+
+  if (hdr->ctab > 0) {
+    znzFile file = znzopen(fname, "rb", 0);
+    if (!znz_isnull(file)) {
+      znzseek(file, hdr->ctab, SEEK_SET);
+      gca->ct = znzCTABreadFromBinary(file);
+      znzclose(file);
+    }
+  }
+
+  gcaComputeNodeTraining(gca);
+  GCAsetup(gca);
+
+  if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON)
+    printf("GCAreadMapped(%s): %lld classes, %lld Gibbs entries, %lld prior labels\n",
+           fname,
+           hdr->ngcs,
+           hdr->ngibbs,
+           hdr->nprior_labels);
+  return (gca);
+}
+
+/* frees a GCA whose tables are still in the mapping: the tables belong to
+   the mapping, only the structs pointing into it are freed */
+static void gcaFreeMapped(GCA *gca)
+{
+  GCA_MAPPING *m = (GCA_MAPPING *)gca->mapped;
+  int x, y, z;
+
+  for (x = 0; x < gca->node_width; x++) {
+    for (y = 0; y < gca->node_height; y++) {
+      for (z = 0; z < gca->node_depth; z++) free(gca->nodes[x][y][z].gcs);
+      free(gca->nodes[x][y]);
+    }
+    free(gca->nodes[x]);
+  }
+  free(gca->nodes);
+  for (x = 0; x < gca->prior_width; x++) {
+    for (y = 0; y < gca->prior_height; y++) free(gca->priors[x][y]);
+    free(gca->priors[x]);
+  }
+  free(gca->priors);
+  free(m->gibbs_labels);
+  free(m->gibbs_priors);
+  munmap(m->base, m->size);
+  free(m);
+  GCAcleanup(gca);
+  free(gca);
+}
+
+static void *gcaCopyOutOfMapping(const void *src, int n, size_t size)
+{
+  void *dst = calloc(n > 0 ? n : 1, size);
+  if (!dst) ErrorExit(ERROR_NOMEMORY, "GCAunmap: could not allocate %d entries", n);
+  if (n > 0) memmove(dst, src, n * size);
+  return (dst);
+}
+
+/*!
+  \fn int GCAunmap(GCA *gca)
+  \brief Turns a mapped (.gcx) atlas into an ordinary one by copying the
+  labels, means, covariances, Gibbs tables and priors out of the read-only
+  mapping, then unmaps the file. Does nothing if the atlas is not mapped.
+  The node, prior and class structs are not moved, so pointers to them
+  (e.g. gcamn->gc) stay valid. Anything that writes to the atlas tables or
+  reallocates its label lists must call this first.
+*/
+int GCAunmap(GCA *gca)
+{
+  GCA_MAPPING *m = (GCA_MAPPING *)gca->mapped;
+  GCA_NODE *gcan;
+  GCA_PRIOR *gcap;
+  GC1D *gc;
+  int x, y, z, n, i, ncovars;
+
+  if (m == NULL) {
+    return (NO_ERROR);
+  }
+
+  ncovars = (gca->ninputs * (gca->ninputs + 1)) / 2;
+  for (x = 0; x < gca->node_width; x++) {
+    for (y = 0; y < gca->node_height; y++) {
+      for (z = 0; z < gca->node_depth; z++) {
+        gcan = &gca->nodes[x][y][z];
+        if (gcan->nlabels <= 0) {
+          continue;
+        }
+        gcan->labels = (unsigned short *)gcaCopyOutOfMapping(gcan->labels, gcan->nlabels, sizeof(unsigned short));
+        for (n = 0; n < gcan->nlabels; n++) {
+          gc = &gcan->gcs[n];
+          gc->means = (float *)gcaCopyOutOfMapping(gc->means, gca->ninputs, sizeof(float));
+          gc->covars = (float *)gcaCopyOutOfMapping(gc->covars, ncovars, sizeof(float));
+          if (gc->nlabels == NULL) { /* no Gibbs tables (GCA_NO_MRF) */
+            continue;
+          }
+          unsigned short **labels =
+              (unsigned short **)gcaCopyOutOfMapping(gc->labels, GIBBS_NEIGHBORHOOD, sizeof(unsigned short *));
+          float **label_priors = (float **)gcaCopyOutOfMapping(gc->label_priors, GIBBS_NEIGHBORHOOD, sizeof(float *));
+          for (i = 0; i < GIBBS_NEIGHBORHOOD; i++) {
+            labels[i] = (unsigned short *)gcaCopyOutOfMapping(gc->labels[i], gc->nlabels[i], sizeof(unsigned short));
+            label_priors[i] = (float *)gcaCopyOutOfMapping(gc->label_priors[i], gc->nlabels[i], sizeof(float));
+          }
+          gc->nlabels = (short *)gcaCopyOutOfMapping(gc->nlabels, GIBBS_NEIGHBORHOOD, sizeof(short));
+          gc->labels = labels;
+          gc->label_priors = label_priors;
+        }
+      }
+    }
+  }
+  for (x = 0; x < gca->prior_width; x++) {
+    for (y = 0; y < gca->prior_height; y++) {
+      for (z = 0; z < gca->prior_depth; z++) {
+        gcap = &gca->priors[x][y][z];
+        if (gcap->nlabels <= 0) {
+          continue;
+        }
+        gcap->labels = (unsigned short *)gcaCopyOutOfMapping(gcap->labels, gcap->nlabels, sizeof(unsigned short));
+        gcap->priors = (float *)gcaCopyOutOfMapping(gcap->priors, gcap->nlabels, sizeof(float));
+      }
+    }
+  }
+
+  free(m->gibbs_labels);
+  free(m->gibbs_priors);
+  munmap(m->base, m->size);
+  free(m);
+  gca->mapped = NULL;
+  return (NO_ERROR);
+}
+
 static int GCAupdatePrior(GCA *gca, MRI *mri, int xn, int yn, int zn, int label)
 {
   int n;
@@ -2889,6 +3474,7 @@ int GCAcompleteMeanTraining(GCA *gca)
   GCA_PRIOR *gcap;
   GC1D *gc;
 
+  GCAunmap(gca);
   total_nodes = gca->node_width * gca->node_height * gca->node_depth;
   total_brain_nodes = total_gcs = total_brain_gcs = 0;
   for (x = 0; x < gca->node_width; x++) {
@@ -3014,6 +3600,7 @@ int GCAcompleteCovarianceTraining(GCA *gca)
   GCA_NODE *gcan;
   GC1D *gc;
 
+  GCAunmap(gca);
   for (x = 0; x < gca->node_width; x++) {
     for (y = 0; y < gca->node_height; y++) {
       for (z = 0; z < gca->node_depth; z++) {
@@ -4164,6 +4751,95 @@ float GCAcomputeLogSampleProbability(
   return ((float)total_log_p / nsamples);
 }
 
+/*
+  Same sample terms as GCAcomputeLogSampleProbability for a linear
+  vox-to-vox transform m_L (input->gca template), but safe to call from
+  several threads at once: the transform is passed as a matrix rather than
+  inverted in place, nothing in gcas is written and the samples are visited
+  serially by the calling thread. Only samples first, first+stride, ... are
+  visited, and the sum of their log probabilities (not the mean) is
+  returned, so that a subset can be scored and later completed.
+*/
+double GCAcomputeLinearLogSampleProbabilitySum(GCA *gca,
+                                               GCA_SAMPLE *gcas,
+                                               MRI *mri_inputs,
+                                               MATRIX *m_L,
+                                               int first,
+                                               int stride,
+                                               int nsamples,
+                                               double clamp)
+{
+  MATRIX *m_inv, *m_prior2voxel, *m_prior2source_voxel;
+  VECTOR *v_src, *v_dst;
+  double total_log_p, log_p;
+  float vals[MAX_GCA_INPUTS];
+  int i, x, y, z;
+
+  if (stride < 1) stride = 1;
+  m_inv = MatrixInverse(m_L, NULL);
+  if (m_inv == NULL) ErrorExit(ERROR_BADPARM, "GCAcomputeLinearLogSampleProbabilitySum: singular transform");
+  m_prior2voxel = MatrixMultiply(gca->mri_tal__->r_to_i__, gca->prior_i_to_r__, NULL);
+  m_prior2source_voxel = MatrixMultiply(m_inv, m_prior2voxel, NULL);
+  MatrixFree(&m_prior2voxel);
+  MatrixFree(&m_inv);
+
+  v_src = VectorAlloc(4, MATRIX_REAL);
+  v_dst = VectorAlloc(4, MATRIX_REAL);
+  *MATRIX_RELT(v_src, 4, 1) = 1.0;
+  *MATRIX_RELT(v_dst, 4, 1) = 1.0;
+
+  for (total_log_p = 0.0, i = first; i < nsamples; i += stride) {
+    V3_X(v_src) = gcas[i].xp;
+    V3_Y(v_src) = gcas[i].yp;
+    V3_Z(v_src) = gcas[i].zp;
+    MatrixMultiply(m_prior2source_voxel, v_src, v_dst);
+    x = nint(V3_X(v_dst));
+    y = nint(V3_Y(v_dst));
+    z = nint(V3_Z(v_dst));
+    if (MRIindexNotInVolume(mri_inputs, x, y, z) == 0) {
+#ifdef FASTER_MRI_EM_REGISTER
+      if (gca->ninputs > 1)
+        load_vals_xyzInt(mri_inputs, x, y, z, vals, gca->ninputs);
+      else
+#endif
+        load_vals(mri_inputs, x, y, z, vals, gca->ninputs);
+
+#ifdef FASTER_MRI_EM_REGISTER
+      if (gca->ninputs == 1)
+        log_p = gcaComputeSampleLogDensity_1_input(&gcas[i], vals[0]);
+      else
+#endif
+        log_p = gcaComputeSampleLogDensity(&gcas[i], vals, gca->ninputs);
+      if (log_p < -clamp) log_p = -clamp;
+    }
+    else
+      log_p = -1000000;  // outside the volume, as in GCAcomputeLogSampleProbability
+    total_log_p += log_p;
+  }
+
+  VectorFree(&v_src);
+  VectorFree(&v_dst);
+  MatrixFree(&m_prior2source_voxel);
+  return (total_log_p);
+}
+
+/*
+  Largest value a single sample can contribute to
+  GCAcomputeLogSampleProbability, reached when the image intensity equals
+  the sample mean. Used to bound the part of a sample sum not yet computed.
+*/
+double GCAsampleMaxLogProbability(GCA *gca, GCA_SAMPLE *gcas, double clamp)
+{
+  float vals[MAX_GCA_INPUTS];
+  double log_p;
+  int n;
+
+  for (n = 0; n < gca->ninputs; n++) vals[n] = gcas->means[n];
+  log_p = gcaComputeSampleLogDensity(gcas, vals, gca->ninputs);
+  if (log_p < -clamp) log_p = -clamp;
+  return (log_p);
+}
+
 float GCAcomputeLogSampleProbabilityLongitudinal(
     GCA *gca, GCA_SAMPLE *gcas, MRI *mri_inputs, TRANSFORM *transform, int nsamples, double clamp)
 {
@@ -6164,6 +6840,178 @@ char *gca_write_fname = NULL;
 int gca_write_iterations = 0;
 
 
+int gca_gibbs_checkerboard = 0;
+
+/*!
+  \fn static int gcaGibbsRelabelVoxel(...)
+  \brief Gives voxel (x,y,z) of mri_dst the label with the largest
+  neighborhood Gibbs posterior and marks it in mri_changed. Only the
+  voxel itself is written, and only it and its 6 neighbors are read.
+  Returns 1 if the label changed.
+*/
+static int gcaGibbsRelabelVoxel(GCA *gca,
+                                MRI *mri_inputs,
+                                MRI *mri_dst,
+                                MRI *mri_changed,
+                                MRI *mri_probs,
+                                TRANSFORM *transform,
+                                double prior_factor,
+                                int x,
+                                int y,
+                                int z)
+{
+  int n, label, old_label;
+  GCA_PRIOR *gcap;
+  double new_posterior, max_posterior;
+  // float val;
+
+  if (x == Ggca_x && y == Ggca_y && z == Ggca_z) DiagBreak();
+
+  // get the grey value
+  // val =
+  MRIgetVoxVal(mri_inputs, x, y, z, 0);
+
+  /* find the node associated with this coordinate and classify */
+  gcap = getGCAP(gca, mri_inputs, transform, x, y, z);
+  // it is not in the right place
+  if (gcap == NULL) return (0);
+
+  // only one label associated, don't do anything
+  if (gcap->nlabels == 1) return (0);
+
+  // save the current label
+  label = old_label = nint(MRIgetVoxVal(mri_dst, x, y, z, 0));
+  // calculate neighborhood likelihood
+  max_posterior = GCAnbhdGibbsLogPosterior(gca, mri_dst, mri_inputs, x, y, z, transform, prior_factor);
+
+  // go through all labels at this point
+  for (n = 0; n < gcap->nlabels; n++) {
+    // skip the current label
+    if (gcap->labels[n] == old_label) continue;
+
+    // assign the new label
+    MRIsetVoxVal(mri_dst, x, y, z, 0, gcap->labels[n]);
+    // calculate neighborhood likelihood
+    new_posterior = GCAnbhdGibbsLogPosterior(gca, mri_dst, mri_inputs, x, y, z, transform, prior_factor);
+    // if it is bigger than the old one, then replace the label
+    // and change max_posterior
+    if (new_posterior > max_posterior) {
+      if (x == Ggca_x && y == Ggca_y && z == Ggca_z &&
+          (label == Ggca_label || old_label == Ggca_label || Ggca_label < 0))
+        fprintf(stdout,
+                "NbhdGibbsLogLikelihood at (%d, %d, %d):"
+                " old = %d (ll=%.2f) new = %d (ll=%.2f)\n",
+                x,
+                y,
+                z,
+                old_label,
+                max_posterior,
+                gcap->labels[n],
+                new_posterior);
+
+      max_posterior = new_posterior;
+      label = gcap->labels[n];
+    }
+  }
+
+  /*#ifndef __OPTIMIZE__*/
+  if (x == Ggca_x && y == Ggca_y && z == Ggca_z &&
+      (label == Ggca_label || old_label == Ggca_label || Ggca_label < 0)) {
+    int xn, yn, zn;
+    GCA_NODE *gcan;
+
+    if (!GCAsourceVoxelToNode(gca, mri_inputs, transform, x, y, z, &xn, &yn, &zn)) {
+      gcan = &gca->nodes[xn][yn][zn];
+      printf(
+          "(%d, %d, %d): old label %s (%d), "
+          "new label %s (%d) (log(p)=%2.3f)\n",
+          x,
+          y,
+          z,
+          cma_label_to_name(old_label),
+          old_label,
+          cma_label_to_name(label),
+          label,
+          max_posterior);
+      dump_gcan(gca, gcan, stdout, 0, gcap);
+      if (label == Right_Caudate) {
+        DiagBreak();
+      }
+    }
+  }
+  /*#endif*/
+
+  // if label changed
+  if (label != old_label) {
+    // mark it as changed
+    MRIsetVoxVal(mri_changed, x, y, z, 0, 1);
+  }
+  else {
+    MRIsetVoxVal(mri_changed, x, y, z, 0, 0);
+  }
+  // assign new label
+  MRIsetVoxVal(mri_dst, x, y, z, 0, label);
+  if (mri_probs) {
+    MRIsetVoxVal(mri_probs, x, y, z, 0, -max_posterior);
+  }
+
+  return (label != old_label);
+}
+
+/*!
+  \fn static int gcaGibbsActiveVoxels(...)
+  \brief Removes from the index lists the voxels that are fixed or were
+  not marked in mri_changed (ie, neither they nor a neighbor changed in
+  the last pass), keeping the order of the rest. Returns their number.
+*/
+static int gcaGibbsActiveVoxels(
+    MRI *mri_changed, MRI *mri_fixed, short *x_indices, short *y_indices, short *z_indices, int nindices)
+{
+  int index, nactive, x, y, z;
+
+  for (nactive = index = 0; index < nindices; index++) {
+    x = x_indices[index];
+    y = y_indices[index];
+    z = z_indices[index];
+    if (mri_fixed && MRIgetVoxVal(mri_fixed, x, y, z, 0)) continue;
+    if (MRIgetVoxVal(mri_changed, x, y, z, 0) == 0) continue;
+    x_indices[nactive] = x;
+    y_indices[nactive] = y;
+    z_indices[nactive] = z;
+    nactive++;
+  }
+  return (nactive);
+}
+
+/*!
+  \fn static int gcaGibbsCheckerboardVoxels(...)
+  \brief Like gcaGibbsActiveVoxels(), but fills the index lists in raster
+  order with the voxels with (x+y+z) even first and the odd ones after
+  them (starting at *pnfirst). No two voxels of the same parity are
+  6-neighbors, so each half can be relabeled in parallel.
+*/
+static int gcaGibbsCheckerboardVoxels(
+    MRI *mri_changed, MRI *mri_fixed, short *x_indices, short *y_indices, short *z_indices, int *pnfirst)
+{
+  int parity, nactive, x, y, z;
+
+  nactive = 0;
+  for (parity = 0; parity < 2; parity++) {
+    if (parity == 1) *pnfirst = nactive;
+    for (z = 0; z < mri_changed->depth; z++)
+      for (y = 0; y < mri_changed->height; y++)
+        for (x = (y + z + parity) % 2; x < mri_changed->width; x += 2) {
+          if (mri_fixed && MRIgetVoxVal(mri_fixed, x, y, z, 0)) continue;
+          if (MRIgetVoxVal(mri_changed, x, y, z, 0) == 0) continue;
+          x_indices[nactive] = x;
+          y_indices[nactive] = y;
+          z_indices[nactive] = z;
+          nactive++;
+        }
+  }
+  return (nactive);
+}
+
 MRI *GCAreclassifyUsingGibbsPriors(MRI *mri_inputs,
                                    GCA *gca,
                                    MRI *mri_dst,
@@ -6175,10 +7023,10 @@ MRI *GCAreclassifyUsingGibbsPriors(MRI *mri_inputs,
                                    double min_prior_factor,
                                    double max_prior_factor)
 {
-  int x, y, z, width, height, depth, iter, nchanged, min_changed, index, nindices, fixed;
+  int x, y, z, width, height, depth, iter, nchanged, min_changed, index, nindices, nactive, nfirst, fixed;
   short *x_indices, *y_indices, *z_indices;
   double prior_factor, old_posterior, lcma = 0.0;
-  MRI *mri_changed, *mri_probs /*, *mri_zero */;
+  MRI *mri_changed, *mri_probs = NULL /*, *mri_zero */;
 
   prior_factor = min_prior_factor;
   // fixed is the label fixed volume, e.g. wm
@@ -6275,13 +7123,15 @@ MRI *GCAreclassifyUsingGibbsPriors(MRI *mri_inputs,
         printf("writing snapshot to %s\n", fname);
         MRIwrite(mri_dst, fname);
       }
-      // probs has 0 to 255 values
-      mri_probs = GCAlabelProbabilities(mri_inputs, gca, NULL, transform);
-      // sorted according to ascending order of probs
-      MRIorderIndices(mri_probs, x_indices, y_indices, z_indices);
-      MRIfree(&mri_probs);
+      // probs has 0 to 255 values (the checkerboard order ignores them)
+      if (!gca_gibbs_checkerboard) {
+        mri_probs = GCAlabelProbabilities(mri_inputs, gca, NULL, transform);
+        // sorted according to ascending order of probs
+        MRIorderIndices(mri_probs, x_indices, y_indices, z_indices);
+        MRIfree(&mri_probs);
+      }
     }
-    else
+    else if (!gca_gibbs_checkerboard)
       // randomize the indices value ((0 -> width*height*depth)
       MRIcomputeVoxelPermutation(mri_inputs, x_indices, y_indices, z_indices);
 
@@ -6292,114 +7142,35 @@ MRI *GCAreclassifyUsingGibbsPriors(MRI *mri_inputs,
       MRIcopyHeader(mri_inputs, mri_probs);
     }
 
-    //#ifdef HAVE_OPENMP
-    // pragma omp parallel for if_ROMP(experimental) reduction(+: nchanged)
-    //#endif
-    for (index = 0; index < nindices; index++) {
-      int x, y, z, n, label, old_label;
-      GCA_PRIOR *gcap;
-      double new_posterior, max_posterior;
-      // float val;
-
-      x = x_indices[index];
-      y = y_indices[index];
-      z = z_indices[index];
-      if (x == Ggca_x && y == Ggca_y && z == Ggca_z) DiagBreak();
-
-      // if the label is fixed, don't do anything
-      if (mri_fixed && MRIgetVoxVal(mri_fixed, x, y, z, 0)) continue;
+    // Only visit the voxels that are not fixed and that changed or had a
+    // neighbor change in the last pass
+    if (gca_gibbs_checkerboard) {
+      int parity, start, end;
 
-      // if not marked, don't do anything
-      if (MRIgetVoxVal(mri_changed, x, y, z, 0) == 0) continue;
-
-      // get the grey value
-      // val =
-      MRIgetVoxVal(mri_inputs, x, y, z, 0);
-
-      /* find the node associated with this coordinate and classify */
-      gcap = getGCAP(gca, mri_inputs, transform, x, y, z);
-      // it is not in the right place
-      if (gcap == NULL) continue;
-
-      // only one label associated, don't do anything
-      if (gcap->nlabels == 1) continue;
-
-      // save the current label
-      label = old_label = nint(MRIgetVoxVal(mri_dst, x, y, z, 0));
-      // calculate neighborhood likelihood
-      max_posterior = GCAnbhdGibbsLogPosterior(gca, mri_dst, mri_inputs, x, y, z, transform, prior_factor);
-
-      // go through all labels at this point
-      for (n = 0; n < gcap->nlabels; n++) {
-        // skip the current label
-        if (gcap->labels[n] == old_label) continue;
-
-        // assign the new label
-        MRIsetVoxVal(mri_dst, x, y, z, 0, gcap->labels[n]);
-        // calculate neighborhood likelihood
-        new_posterior = GCAnbhdGibbsLogPosterior(gca, mri_dst, mri_inputs, x, y, z, transform, prior_factor);
-        // if it is bigger than the old one, then replace the label
-        // and change max_posterior
-        if (new_posterior > max_posterior) {
-          if (x == Ggca_x && y == Ggca_y && z == Ggca_z &&
-              (label == Ggca_label || old_label == Ggca_label || Ggca_label < 0))
-            fprintf(stdout,
-                    "NbhdGibbsLogLikelihood at (%d, %d, %d):"
-                    " old = %d (ll=%.2f) new = %d (ll=%.2f)\n",
-                    x,
-                    y,
-                    z,
-                    old_label,
-                    max_posterior,
-                    gcap->labels[n],
-                    new_posterior);
-
-          max_posterior = new_posterior;
-          label = gcap->labels[n];
-        }
-      }
-
-      /*#ifndef __OPTIMIZE__*/
-      if (x == Ggca_x && y == Ggca_y && z == Ggca_z &&
-          (label == Ggca_label || old_label == Ggca_label || Ggca_label < 0)) {
-        int xn, yn, zn;
-        GCA_NODE *gcan;
-
-        if (!GCAsourceVoxelToNode(gca, mri_inputs, transform, x, y, z, &xn, &yn, &zn)) {
-          gcan = &gca->nodes[xn][yn][zn];
-          printf(
-              "(%d, %d, %d): old label %s (%d), "
-              "new label %s (%d) (log(p)=%2.3f)\n",
-              x,
-              y,
-              z,
-              cma_label_to_name(old_label),
-              old_label,
-              cma_label_to_name(label),
-              label,
-              max_posterior);
-          dump_gcan(gca, gcan, stdout, 0, gcap);
-          if (label == Right_Caudate) {
-            DiagBreak();
-          }
+      // red-black ICM: each parity is a parallel half-sweep. The result
+      // does not depend on the number of threads.
+      nactive = gcaGibbsCheckerboardVoxels(mri_changed, mri_fixed, x_indices, y_indices, z_indices, &nfirst);
+      for (parity = 0; parity < 2; parity++) {
+        start = parity ? nfirst : 0;
+        end = parity ? nactive : nfirst;
+        ROMP_PF_begin
+#ifdef HAVE_OPENMP
+        #pragma omp parallel for if_ROMP(assume_reproducible) reduction(+ : nchanged) schedule(dynamic, 256)
+#endif
+        for (index = start; index < end; index++) {
+          ROMP_PFLB_begin
+          nchanged += gcaGibbsRelabelVoxel(gca, mri_inputs, mri_dst, mri_changed, mri_probs, transform, prior_factor,
+                                           x_indices[index], y_indices[index], z_indices[index]);
+          ROMP_PFLB_end
         }
+        ROMP_PF_end
       }
-      /*#endif*/
-
-      // if label changed
-      if (label != old_label) {
-        nchanged++;
-        // mark it as changed
-        MRIsetVoxVal(mri_changed, x, y, z, 0, 1);
-      }
-      else {
-        MRIsetVoxVal(mri_changed, x, y, z, 0, 0);
-      }
-      // assign new label
-      MRIsetVoxVal(mri_dst, x, y, z, 0, label);
-      if (mri_probs) {
-        MRIsetVoxVal(mri_probs, x, y, z, 0, -max_posterior);
-      }
+    }
+    else {
+      nactive = gcaGibbsActiveVoxels(mri_changed, mri_fixed, x_indices, y_indices, z_indices, nindices);
+      for (index = 0; index < nactive; index++)
+        nchanged += gcaGibbsRelabelVoxel(gca, mri_inputs, mri_dst, mri_changed, mri_probs, transform, prior_factor,
+                                         x_indices[index], y_indices[index], z_indices[index]);
     }
     if (mri_probs) {
       char fname[STRLEN];
@@ -10288,6 +11059,7 @@ int GCArenormalize(MRI *mri_in, MRI *mri_labeled, GCA *gca, TRANSFORM *transform
   GCA_SAMPLE *gcas;
   GC1D *gc;
 
+  GCAunmap(gca);
   if (gca->ninputs > 1) ErrorExit(ERROR_UNSUPPORTED, "GCArenormalize: can only renormalize scalars");
 
   /* first build a list of all labels that exist */
@@ -10440,6 +11212,7 @@ int GCArenormalizeAdaptive(MRI *mri_in, MRI *mri_labeled, GCA *gca, TRANSFORM *t
   float fmin, fmax;
   int nsamples = 0;
 
+  GCAunmap(gca);
   orig_wsize = wsize;
   MRIvalRange(mri_in, &fmin, &fmax);
   histo = HISTOalloc((int)(fmax - fmin + 1));
@@ -10523,6 +11296,7 @@ int GCArenormalizeLabels(MRI *mri_in, MRI *mri_labeled, GCA *gca, TRANSFORM *tra
   MRI *mri_means, *mri_control, *mri_tmp;
   char fname[STRLEN];
 
+  GCAunmap(gca);
   if (gca->ninputs > 1) ErrorExit(ERROR_UNSUPPORTED, "GCArenormalizeLabels: can only renormalize scalars");
 
   /* first build a list of all labels that exist */
@@ -10719,6 +11493,7 @@ int GCArenormalizeIntensities(GCA *gca, int *labels, float *intensities, int num
   GCA_NODE *gcan;
   GC1D *gc;
 
+  GCAunmap(gca);
   if (gca->ninputs > 1) ErrorExit(ERROR_UNSUPPORTED, "GCArenormalizeIntensities: can only renormalize scalars");
 
   scales = (float *)calloc(num, sizeof(float));
@@ -10790,6 +11565,7 @@ int GCAunifyVariance(GCA *gca)
   GCA_NODE *gcan;
   GC1D *gc;
 
+  GCAunmap(gca);
   for (zn = 0; zn < gca->node_depth; zn++) {
     for (yn = 0; yn < gca->node_height; yn++) {
       for (xn = 0; xn < gca->node_width; xn++) {
@@ -11093,6 +11869,7 @@ int GCAregularizeConditionalDensities(GCA *gca, float smooth)
   double **means, *wts;
   float prior;
 
+  GCAunmap(gca);
   means = (double **)calloc(gca->ninputs, sizeof(double *));
   wts = (double *)calloc(MAX_GCA_LABELS, sizeof(double));
   if (!means || !wts)
@@ -11208,6 +11985,7 @@ int GCAmeanFilterConditionalDensities(GCA *gca, float navgs)
   MRI *mri_means;
   float prior;
 
+  GCAunmap(gca);
   mri_means = MRIallocSequence(gca->node_width, gca->node_height, gca->node_depth, MRI_FLOAT, gca->ninputs);
 
   mri_means->xsize = gca->node_spacing;
@@ -11929,7 +12707,12 @@ GC1D *GCAfindClosestValidGC(GCA *gca, int x0, int y0, int z0, int label, int che
   int x, y, z, n, wsize;
   double dist, min_dist, det;
   GCA_NODE *gcan;
-  static MATRIX *m_cov_inv = NULL;
+  static MATRIX *m_cov_inv_tid[_MAX_FS_THREADS];
+#ifdef HAVE_OPENMP
+  MATRIX *&m_cov_inv = m_cov_inv_tid[omp_get_thread_num()];
+#else
+  MATRIX *&m_cov_inv = m_cov_inv_tid[0];
+#endif
 
   min_dist = gca->node_width + gca->node_height + gca->node_depth;
   wsize = 1;
@@ -12571,6 +13354,24 @@ int GCAfreeGibbs(GCA *gca)
     return (NO_ERROR); /* already done */
   }
 
+  if (gca->mapped) { /* tables live in the mapping, just drop the references */
+    for (x = 0; x < gca->node_width; x++) {
+      for (y = 0; y < gca->node_height; y++) {
+        for (z = 0; z < gca->node_depth; z++) {
+          gcan = &gca->nodes[x][y][z];
+          for (n = 0; n < gcan->nlabels; n++) {
+            gc = &gcan->gcs[n];
+            gc->nlabels = NULL;
+            gc->labels = NULL;
+            gc->label_priors = NULL;
+          }
+        }
+      }
+    }
+    gca->flags |= GCA_NO_MRF;
+    return (NO_ERROR);
+  }
+
   for (x = 0; x < gca->node_width; x++) {
     for (y = 0; y < gca->node_height; y++) {
       for (z = 0; z < gca->node_depth; z++) {
@@ -12659,6 +13460,7 @@ int GCArenormalizeFromAtlas(GCA *gca, GCA *gca_template)
   GCA_NODE *gcan;
   GC1D *gc, *gct;
 
+  GCAunmap(gca);
   scale = (float)gca_template->node_width / (float)gca->node_width;
 
   for (xs = 0; xs < gca->node_width; xs++) {
@@ -12712,9 +13514,9 @@ static void load_vals_xyzInt(const MRI *mri_inputs, int x, int y, int z, float *
 
 double GCAmahDist(const GC1D *gc, const float *vals, const int ninputs)
 {
-  static VECTOR *v_means = NULL, *v_vals = NULL;
-  static MATRIX *m_cov = NULL, *m_cov_inv;
-  int i;
+  static VECTOR *v_means_tid[_MAX_FS_THREADS], *v_vals_tid[_MAX_FS_THREADS];
+  static MATRIX *m_cov_tid[_MAX_FS_THREADS], *m_cov_inv_tid[_MAX_FS_THREADS];
+  int i, tid;
   double dsq;
 
   if (ninputs == 1) {
@@ -12723,6 +13525,13 @@ double GCAmahDist(const GC1D *gc, const float *vals, const int ninputs)
     dsq = v * v / gc->covars[0];
     return (dsq);
   }
+#ifdef HAVE_OPENMP
+  tid = omp_get_thread_num();
+#else
+  tid = 0;
+#endif
+  VECTOR *&v_means = v_means_tid[tid], *&v_vals = v_vals_tid[tid];
+  MATRIX *&m_cov = m_cov_tid[tid], *&m_cov_inv = m_cov_inv_tid[tid];
   // printf("In GCAMahDist...ninputs = %d\n", ninputs);
   if (v_vals && ninputs != v_vals->rows) {
     VectorFree(&v_vals);
@@ -12999,11 +13808,18 @@ static MATRIX *load_sample_covariance_matrix(GCA_SAMPLE *gcas, MATRIX *m_cov, in
 static double sample_covariance_determinant(GCA_SAMPLE *gcas, int ninputs)
 {
   double det;
-  static MATRIX *m_cov = NULL;
+  static MATRIX *m_cov_tid[_MAX_FS_THREADS];
+  int tid;
 
   if (ninputs == 1) {
     return (gcas->covars[0]);
   }
+#ifdef HAVE_OPENMP
+  tid = omp_get_thread_num();
+#else
+  tid = 0;
+#endif
+  MATRIX *&m_cov = m_cov_tid[tid];
   if (m_cov && (m_cov->rows != ninputs || m_cov->cols != ninputs)) {
     MatrixFree(&m_cov);
   }
@@ -13023,9 +13839,9 @@ static double GCAsampleMahDist_1_input(GCA_SAMPLE *gcas, float val)
 
 double GCAsampleMahDist(GCA_SAMPLE *gcas, float *vals, int ninputs)
 {
-  static VECTOR *v_means = NULL, *v_vals = NULL;
-  static MATRIX *m_cov = NULL, *m_cov_inv;
-  int i;
+  static VECTOR *v_means_tid[_MAX_FS_THREADS], *v_vals_tid[_MAX_FS_THREADS];
+  static MATRIX *m_cov_tid[_MAX_FS_THREADS], *m_cov_inv_tid[_MAX_FS_THREADS];
+  int i, tid;
   double dsq;
 
   if (ninputs == 1) {
@@ -13034,6 +13850,13 @@ double GCAsampleMahDist(GCA_SAMPLE *gcas, float *vals, int ninputs)
     dsq = v * v / gcas->covars[0];
     return (dsq);
   }
+#ifdef HAVE_OPENMP
+  tid = omp_get_thread_num();
+#else
+  tid = 0;
+#endif
+  VECTOR *&v_means = v_means_tid[tid], *&v_vals = v_vals_tid[tid];
+  MATRIX *&m_cov = m_cov_tid[tid], *&m_cov_inv = m_cov_inv_tid[tid];
 
   if (v_vals && ninputs != v_vals->rows) {
     VectorFree(&v_vals);
@@ -13576,6 +14399,7 @@ int GCAfixSingularCovarianceMatrices(GCA *gca)
   double det, vars[MAX_GCA_INPUTS], min_det;
   MATRIX *m_cov_inv, *m_cov = NULL;
 
+  GCAunmap(gca);
   nparams = (gca->ninputs * (gca->ninputs + 1)) / 2 + gca->ninputs;
   /* covariance matrix and means */
 
@@ -13762,6 +14586,7 @@ int GCAregularizeCovarianceMatrices(GCA *gca, double lambda)
   double det, vars[MAX_GCA_INPUTS], min_det;
   MATRIX *m_cov = NULL;
 
+  GCAunmap(gca);
   nparams = (gca->ninputs * (gca->ninputs + 1)) / 2 + gca->ninputs;
   /* covariance matrix and means */
 
@@ -14121,6 +14946,7 @@ int GCAnormalizeMeans(GCA *gca, float target)
   GCA_NODE *gcan;
   GC1D *gc;
 
+  GCAunmap(gca);
   for (x = 0; x < gca->node_width; x++) {
     for (y = 0; y < gca->node_height; y++) {
       for (z = 0; z < gca->node_depth; z++) {
@@ -14153,6 +14979,7 @@ int GCAregularizeCovariance(GCA *gca, float regularize)
   double det, vars[MAX_GCA_INPUTS];
   MATRIX *m_cov = NULL;
 
+  GCAunmap(gca);
   nparams = (gca->ninputs * (gca->ninputs + 1)) / 2 + gca->ninputs;
   /* covariance matrix and means */
   memset(vars, 0, sizeof(vars));
@@ -17045,6 +17872,7 @@ int GCAapplyRenormalization(GCA *gca, float *label_scales, float *label_offsets,
   GCA_NODE *gcan;
   GC1D *gc;
 
+  GCAunmap(gca);
   for (xn = 0; xn < gca->node_width; xn++) {
     double means_before[MAX_GCA_LABELS], means_after[MAX_GCA_LABELS];
     // double scales[MAX_GCA_LABELS];
@@ -17198,6 +18026,7 @@ int GCAmapRenormalize(GCA *gca, MRI *mri, TRANSFORM *transform)
   MATRIX *m_cov;
   MRI *mri_fsamples = NULL;  // diag volume
 
+  GCAunmap(gca);
 /* for each class, build a histogram of values
    (weighted by priors) to determine
    p(I|u,c) p(c).
@@ -17544,6 +18373,7 @@ int GCAmapRenormalizeByClass(GCA *gca, MRI *mri, TRANSFORM *transform)
   GC1D *gc;
   double p, max_p;
 
+  GCAunmap(gca);
   /* for each class, build a histogram of values
      (weighted by priors) to determine
      p(I|u,c) p(c).
@@ -18096,6 +18926,7 @@ int GCAreplaceLabels(GCA *gca, int in_label, int out_label)
   GCA_NODE *gcan;
   GCA_PRIOR *gcap;
 
+  GCAunmap(gca);
   for (x = 0; x < gca->node_width; x++) {
     for (y = 0; y < gca->node_height; y++) {
       for (z = 0; z < gca->node_depth; z++) {
@@ -20103,6 +20934,7 @@ int GCArenormalizeWithEntropyMinimization(GCA *gca, MRI *mri, TRANSFORM *transfo
   HISTOGRAM *h_gca;
   MRI *mri_aseg;
 
+  GCAunmap(gca);
   for (i = 0; i < NUM_ENTROPY_LABELS; i++) {
     scales[i] = 1.0;
     h_gca = gcaGetLabelHistogram(gca, entropy_labels[i], 0, 0);
@@ -20495,6 +21327,7 @@ int GCArenormalizeClass(GCA *gca, int classnum, float scale_to_wm)
   int x, y, z, n, same_class, r;
   GCA_NODE *gcan;
 
+  GCAunmap(gca);
   GCAclassMode(gca, WM_CLASS, &wm_mode);
   GCAclassMode(gca, classnum, &class_mode);
 
@@ -21821,6 +22654,7 @@ int GCAinsertLabels(GCA *gca,
   GCA_NODE *gcan;
   GCA_PRIOR *gcap;
 
+  GCAunmap(gca);
   for (l = 0; l < ninsertions; l++) {
     whalf = insert_whalf[l];
     label = insert_labels[l];
@@ -22048,6 +22882,7 @@ int GCAremoveHemi(GCA *gca, int lh)
   GCA_NODE *gcan;
   GCA_PRIOR *gcap;
 
+  GCAunmap(gca);
   for (x = 0; x < gca->node_width; x++) {
     for (y = 0; y < gca->node_height; y++) {
       for (z = 0; z < gca->node_depth; z++) {
@@ -22117,6 +22952,7 @@ int GCAupdateDistributions(GCA *gca, MRI *mri, TRANSFORM *transform)
   float vals[MAX_GCA_INPUTS], *all_vals, med;
   GCA_NODE *gcan;
 
+  GCAunmap(gca);
   all_vals = (float *)calloc(gca->node_width * gca->node_height * gca->node_depth, sizeof(float));
   for (label = 0; label <= MAX_CMA_LABEL; label++) {
     //    printf("updating means for label %s\n", cma_label_to_name(label)) ;
@@ -22166,6 +23002,7 @@ int GCAremoveLabel(GCA *gca, int label)
   GCA_NODE *gcan;
   GCA_PRIOR *gcap;
 
+  GCAunmap(gca);
   for (x = 0; x < gca->node_width; x++) {
     for (y = 0; y < gca->node_height; y++) {
       for (z = 0; z < gca->node_depth; z++) {
@@ -22784,6 +23621,7 @@ void GCAinitLabelsFromMRI(GCA *gca, MRI *mri_labels)
   GCA_PRIOR *gcap;
   GCA_NODE *gcan;
 
+  GCAunmap(gca);
   if (gca->width != mri_labels->width || gca->height != mri_labels->height || gca->depth != mri_labels->depth)
     ErrorExit(ERROR_BADPARM, "GCAinitLabelsFromMRI: GCA and MRI must have same dimensions");
 
@@ -180,6 +180,9 @@ void GCAlinearNode::Inhume(GCA *dst) const
 
   Timer tInhume;
 
+  // A mapped atlas has to own its tables before they can be freed
+  GCAunmap(dst);
+
   // Dispose of the old node data
   this->ScorchNodes(dst);
 
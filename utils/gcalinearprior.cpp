@@ -174,6 +174,9 @@ void GCAlinearPrior::Inhume(GCA *dst) const
 
   Timer tInhume;
 
+  // A mapped atlas has to own its tables before they can be freed
+  GCAunmap(dst);
+
   // Dump the old data
   this->ScorchPriors(dst);
 
@@ -90,6 +90,12 @@ int dtrans_label_to_frame(GCA_MORPH_PARMS *mp, int label);
 MRI *MRIcomposeWarps(MRI *mri_warp1, MRI *mri_warp2, MRI *mri_dst);
 int fix_borders(GCA_MORPH *gcam);
 
+static struct GCAM_SOA const *gcamSoaGather(GCA_MORPH *gcam);
+static void gcamFreeSoa(GCA_MORPH *gcam);
+static double gcamJacobianEnergyFromSoa(const GCA_MORPH *gcam, struct GCAM_SOA const *soa, MRI *mri);
+static double gcamSmoothnessEnergyFromSoa(const GCA_MORPH *gcam, struct GCAM_SOA const *soa, const MRI *mri);
+static int gcamInvertBySplatting(GCA_MORPH *gcam, MRI *mri);
+
 int gcam_write_grad = 0;
 int gcam_write_neg = 0;
 
@@ -333,6 +339,28 @@ void GCAMreadGeom(GCA_MORPH *gcam, znzFile file)
   znzread(gcam->atlas.fname, sizeof(char), 512, file);
 }
 
+/*
+  FNV-1a hash of the node positions, as written to the m3z, used to tell
+  whether the inverse index volumes still belong to the nodes.
+*/
+static unsigned int gcamNodePositionHash(const GCA_MORPH *gcam)
+{
+  unsigned int hash = 2166136261u;
+  int x, y, z, c;
+
+  for (x = 0; x < gcam->width; x++)
+    for (y = 0; y < gcam->height; y++)
+      for (z = 0; z < gcam->depth; z++) {
+        GCA_MORPH_NODE const *gcamn = &gcam->nodes[x][y][z];
+        float const pos[3] = {(float)gcamn->x, (float)gcamn->y, (float)gcamn->z};
+        unsigned char const *bytes = (unsigned char const *)pos;
+        for (c = 0; c < (int)sizeof(pos); c++) {
+          hash = (hash ^ bytes[c]) * 16777619u;
+        }
+      }
+  return (hash);
+}
+
 int GCAMwrite(const GCA_MORPH *gcam, const char *fname)
 {
   znzFile file;
@@ -408,6 +436,59 @@ int GCAMwrite(const GCA_MORPH *gcam, const char *fname)
     znzWriteMatrix(file, gcam->m_affine);
   }
 
+  // Optionally save the inverse so that later readers don't have to recompute it.
+  // It is written last, and only if it was computed from the nodes being written.
+  // The tag carries the length of what follows so that a reader can skip it.
+  if (getenv("FREESURFER_GCAMwrite_inverse")) {
+    unsigned int const hash = gcamNodePositionHash(gcam);
+    MRI *mri_ind[3] = {NULL, NULL, NULL};
+    int computed = 0;
+    if (gcam->mri_xind && gcam->mri_yind && gcam->mri_zind && gcam->inverse_hash == hash) {
+      mri_ind[0] = gcam->mri_xind;
+      mri_ind[1] = gcam->mri_yind;
+      mri_ind[2] = gcam->mri_zind;
+    }
+    else if (gcam->image.valid) {
+      // invert a shallow copy that shares the nodes, the gcam itself is left alone
+      GCA_MORPH inv = *gcam;
+      inv.mri_xind = inv.mri_yind = inv.mri_zind = NULL;
+      MRI *mri = MRIallocHeader(gcam->image.width, gcam->image.height, gcam->image.depth, MRI_FLOAT, 1);
+      useVolGeomToMRI(&gcam->image, mri);
+      GCAMinvert(&inv, mri);
+      MRIfree(&mri);
+      mri_ind[0] = inv.mri_xind;
+      mri_ind[1] = inv.mri_yind;
+      mri_ind[2] = inv.mri_zind;
+      computed = 1;
+    }
+    if (mri_ind[0] && mri_ind[1] && mri_ind[2]) {
+      long long here;
+      long long const len =
+          4 * sizeof(int) + 3LL * mri_ind[0]->width * mri_ind[0]->height * mri_ind[0]->depth * sizeof(float);
+      int n;
+      znzTAGwriteStart(file, TAG_GCAMORPH_INVERSE, &here, len);
+      znzwriteInt((int)hash, file);
+      znzwriteInt(mri_ind[0]->width, file);
+      znzwriteInt(mri_ind[0]->height, file);
+      znzwriteInt(mri_ind[0]->depth, file);
+      for (n = 0; n < 3; n++)
+        for (x = 0; x < mri_ind[n]->width; x++)
+          for (y = 0; y < mri_ind[n]->height; y++)
+            for (z = 0; z < mri_ind[n]->depth; z++) {
+              znzwriteFloat(MRIgetVoxVal(mri_ind[n], x, y, z, 0), file);
+            }
+      znzTAGwriteEnd(file, here);
+    }
+    else {
+      printf("GCAMwrite: no inverse of the current morph to save in %s\n", fname);
+    }
+    if (computed) {
+      MRIfree(&mri_ind[0]);
+      MRIfree(&mri_ind[1]);
+      MRIfree(&mri_ind[2]);
+    }
+  }
+
   znzclose(file);
 
   return (NO_ERROR);
@@ -543,6 +624,10 @@ GCA_MORPH *GCAMreadAndInvert(const char *gcamfname)
   if (gcam == NULL) {
     return (NULL);
   }
+  if (gcam->mri_xind) {
+    // inverse was saved in the morph
+    return (gcam);
+  }
 
   gcamdir = fio_dirname(gcamfname);
 
@@ -619,6 +704,10 @@ GCA_MORPH *GCAMreadAndInvertNonTal(const char *gcamfname)
   if (gcam == NULL) {
     return (NULL);
   }
+  if (gcam->mri_xind) {
+    // inverse was saved in the morph
+    return (gcam);
+  }
 
   gcamdir = fio_dirname(gcamfname);
 
@@ -1138,6 +1227,9 @@ GCA_MORPH *GCAMread(const char *fname)
   float version;
   int tag;
   int gzipped = 0;
+  MRI *mri_ind[3] = {NULL, NULL, NULL};
+  unsigned int inverse_hash = 0;
+  int badtag = 0;
 
   if (!fio_FileExistsReadable(fname)) {
     printf("ERROR: cannot find or read %s\n", fname);
@@ -1209,7 +1301,7 @@ GCA_MORPH *GCAMread(const char *fname)
   gcam->det = 1;
   gcam->image.valid = 0;  // make src invalid
   gcam->atlas.valid = 0;  // makd dst invalid
-  while (znzreadIntEx(&tag, file)) {
+  while (!badtag && znzreadIntEx(&tag, file)) {
     switch (tag) {
       case TAG_GCAMORPH_LABELS:
         if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON) {
@@ -1251,11 +1343,78 @@ GCA_MORPH *GCAMread(const char *fname)
         gcam->m_affine = znzReadMatrix(file);
         gcam->det = MatrixDeterminant(gcam->m_affine);
         break;
+      case TAG_GCAMORPH_INVERSE: {
+        int n, iwidth, iheight, idepth;
+        long long const len = znzreadLong(file);
+        inverse_hash = (unsigned int)znzreadInt(file);
+        iwidth = znzreadInt(file);
+        iheight = znzreadInt(file);
+        idepth = znzreadInt(file);
+        if (iwidth <= 0 || iheight <= 0 || idepth <= 0 ||
+            len != 4 * (long long)sizeof(int) + 3LL * iwidth * iheight * idepth * (long long)sizeof(float)) {
+          printf("GCAMread(%s): corrupt inverse tag, ignoring the rest of the file\n", fname);
+          badtag = 1;
+          break;
+        }
+        // the geometry is written before the inverse, so it can be checked before allocating
+        if (!gcam->image.valid || iwidth != gcam->image.width || iheight != gcam->image.height ||
+            idepth != gcam->image.depth) {
+          printf("GCAMread(%s): ignoring saved %dx%dx%d inverse, it does not match the image geometry\n",
+                 fname, iwidth, iheight, idepth);
+          znzTAGskip(file, tag, len - 4 * (long long)sizeof(int));
+          break;
+        }
+        if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON) {
+          printf("reading %dx%dx%d inverse out of gcam file...\n", iwidth, iheight, idepth);
+        }
+        for (n = 0; n < 3; n++) {
+          if (mri_ind[n]) MRIfree(&mri_ind[n]);
+          mri_ind[n] = MRIalloc(iwidth, iheight, idepth, MRI_FLOAT);
+          for (x = 0; x < iwidth; x++)
+            for (y = 0; y < iheight; y++)
+              for (z = 0; z < idepth; z++) {
+                MRIFvox(mri_ind[n], x, y, z) = znzreadFloat(file);
+              }
+        }
+        break;
+      }
+      default: {
+        // tags added later carry their length, so they can be skipped
+        long long const len = znzreadLong(file);
+        if (len < 0) {
+          printf("GCAMread(%s): unknown tag %d, ignoring the rest of the file\n", fname, tag);
+          badtag = 1;
+          break;
+        }
+        znzTAGskip(file, tag, len);
+        break;
+      }
     }
   }
 
   znzclose(file);
 
+  // only use a saved inverse if it matches the nodes and the image geometry
+  if (mri_ind[0]) {
+    if (inverse_hash == gcamNodePositionHash(gcam) && gcam->image.valid &&
+        mri_ind[0]->width == gcam->image.width && mri_ind[0]->height == gcam->image.height &&
+        mri_ind[0]->depth == gcam->image.depth) {
+      useVolGeomToMRI(&gcam->image, mri_ind[0]);
+      useVolGeomToMRI(&gcam->image, mri_ind[1]);
+      useVolGeomToMRI(&gcam->image, mri_ind[2]);
+      gcam->mri_xind = mri_ind[0];
+      gcam->mri_yind = mri_ind[1];
+      gcam->mri_zind = mri_ind[2];
+      gcam->inverse_hash = inverse_hash;
+    }
+    else {
+      printf("GCAMread(%s): ignoring saved inverse, it does not match the morph\n", fname);
+      MRIfree(&mri_ind[0]);
+      MRIfree(&mri_ind[1]);
+      MRIfree(&mri_ind[2]);
+    }
+  }
+
   if (gcam->det > 0)  // reset gcamn->orig_area fields to be those of linear transform
   {
     int x, y, z;
@@ -1291,40 +1450,30 @@ GCA_MORPH *GCAMalloc(const int width, const int height, const int depth)
   gcam->spacing = 1; // may be changed by the user later
   gcam->type = GCAM_VOX;
 
+  // all the nodes are in one block, in the x,y,z order the loops visit them in,
+  // with the row pointers into it so that gcam->nodes[x][y][z] still works
   gcam->nodes = (GCA_MORPH_NODE ***)calloc(width, sizeof(GCA_MORPH_NODE **));
   if (!gcam->nodes) {
     ErrorExit(ERROR_NOMEMORY, "GCAMalloc: could not allocate nodes");
   }
+  GCA_MORPH_NODE **rows = (GCA_MORPH_NODE **)calloc((size_t)width * height, sizeof(GCA_MORPH_NODE *));
+  if (!rows) {
+    ErrorExit(ERROR_NOMEMORY, "GCAMalloc: could not allocate %d rows", width * height);
+  }
+  GCA_MORPH_NODE *buf = (GCA_MORPH_NODE *)calloc((size_t)width * height * depth, sizeof(GCA_MORPH_NODE));
+  if (!buf) {
+    ErrorExit(ERROR_NOMEMORY,
+              "GCAMalloc(%d, %d, %d): could not allocate %ld bytes of nodes",
+              width,
+              height,
+              depth,
+              (long)((size_t)width * height * depth * sizeof(GCA_MORPH_NODE)));
+  }
 
   for (x = 0; x < gcam->width; x++) {
-    gcam->nodes[x] = (GCA_MORPH_NODE **)calloc(gcam->height, sizeof(GCA_MORPH_NODE *));
-    if (!gcam->nodes[x]) {
-      ErrorExit(ERROR_NOMEMORY, "GCAMalloc: could not allocate %dth **", x);
-    }
-
-#define ELECTRIC_FENCE 0
-#if ELECTRIC_FENCE
-    {
-      GCA_MORPH_NODE *buf;
-
-      buf = (GCA_MORPH_NODE *)calloc(gcam->depth * gcam->height, sizeof(GCA_MORPH_NODE));
-      if (buf == NULL)
-        ErrorExit(ERROR_NO_MEMORY,
-                  "GCAMalloc(%d, %d, %d): could not allocate "
-                  "%d bytes for %dth bslice\n",
-                  height,
-                  width,
-                  depth,
-                  (gcam->depth * gcam->height * sizeof(GCA_MORPH_NODE)),
-                  x);
-      for (y = 0; y < gcam->height; y++) {
-        gcam->nodes[x][y] = buf + (y * gcam->depth);
-      }
-    }
-#else
+    gcam->nodes[x] = rows + (size_t)x * height;
     for (y = 0; y < gcam->height; y++) {
-      gcam->nodes[x][y] = (GCA_MORPH_NODE *)calloc(gcam->depth, sizeof(GCA_MORPH_NODE));
-      if (!gcam->nodes[x][y]) ErrorExit(ERROR_NOMEMORY, "GCAMalloc: could not allocate %d,%dth *", x, y);
+      gcam->nodes[x][y] = buf + ((size_t)x * height + y) * depth;
       for (z = 0; z < gcam->depth; z++) {
         gcam->nodes[x][y][z].origx = x;
         gcam->nodes[x][y][z].origy = y;
@@ -1334,7 +1483,6 @@ GCA_MORPH *GCAMalloc(const int width, const int height, const int depth)
         gcam->nodes[x][y][z].z = z;
       }
     }
-#endif
   }
   initVolGeom(&gcam->image);
   initVolGeom(&gcam->atlas);
@@ -1675,11 +1823,16 @@ int GCAMfreeContents(GCA_MORPH *gcam)
           free_gcs(gcamn->gc, 1, gcam->ninputs);
         }
       }
-      free(gcam->nodes[x][y]);
     }
-    free(gcam->nodes[x]);
+  }
+  // see GCAMalloc
+  if (gcam->width > 0 && gcam->height > 0) {
+    free(gcam->nodes[0][0]);
+    free(gcam->nodes[0]);
   }
   free(gcam->nodes);
+  gcam->nodes = NULL;
+  gcamFreeSoa(gcam);
   return (NO_ERROR);
 }
 
@@ -3665,6 +3818,124 @@ int gcamComputeMetricProperties(GCA_MORPH *gcam)
   return (NO_ERROR);
 }
 
+/*
+  The smoothness and jacobian energies and the smoothness term are in the deepest loops of
+  mri_ca_register, but each reads only a few fields of the ~200 byte GCA_MORPH_NODE, so most
+  of every cache line they pull in is wasted.  gcamSoaGather copies those fields into flat
+  arrays, indexed (x*height + y)*depth + z like the nodes themselves, which the kernels then
+  stream through at 41 bytes a node.  gcamSoaGather keeps the arrays with the gcam so they
+  are only allocated once, and is called once per evaluation (gcamComputeSSE, which shares
+  one gather between both energies, and gcamSmoothnessTerm) by code that owns the gcam and
+  is about to read the nodes anyway.  The arrays are only valid until the nodes next change,
+  so they are never reused from an earlier call.  The const entry points do not touch
+  gcam->soa: the jacobian energy reads the nodes directly and the smoothness energy gathers
+  into arrays of its own, so they can be called on a gcam that is shared between threads.
+*/
+struct GCAM_SOA
+{
+  int    width, height, depth ;
+  double *vx, *vy, *vz ;              // x - origx, y - origy, z - origz
+  float  *area1, *area2 ;
+  float  *orig_area1, *orig_area2 ;
+  char   *invalid ;
+} ;
+
+static struct GCAM_SOA *gcamSoaAlloc(int width, int height, int depth)
+{
+  size_t const nnodes = (size_t)width * height * depth;
+  struct GCAM_SOA *soa = (struct GCAM_SOA *)calloc(1, sizeof(struct GCAM_SOA));
+  if (!soa) {
+    ErrorExit(ERROR_NOMEMORY, "gcamSoaAlloc: could not allocate arrays");
+  }
+  soa->width  = width;
+  soa->height = height;
+  soa->depth  = depth;
+  soa->vx = (double *)malloc(nnodes * sizeof(double));
+  soa->vy = (double *)malloc(nnodes * sizeof(double));
+  soa->vz = (double *)malloc(nnodes * sizeof(double));
+  soa->area1 = (float *)malloc(nnodes * sizeof(float));
+  soa->area2 = (float *)malloc(nnodes * sizeof(float));
+  soa->orig_area1 = (float *)malloc(nnodes * sizeof(float));
+  soa->orig_area2 = (float *)malloc(nnodes * sizeof(float));
+  soa->invalid = (char *)malloc(nnodes * sizeof(char));
+  if (!soa->vx || !soa->vy || !soa->vz || !soa->area1 || !soa->area2 || !soa->orig_area1 || !soa->orig_area2 ||
+      !soa->invalid) {
+    ErrorExit(ERROR_NOMEMORY, "gcamSoaAlloc: could not allocate arrays for %ld nodes", (long)nnodes);
+  }
+  return soa;
+}
+
+static void gcamSoaFree(struct GCAM_SOA **psoa)
+{
+  struct GCAM_SOA *soa = *psoa;
+  if (!soa) {
+    return;
+  }
+  free(soa->vx);
+  free(soa->vy);
+  free(soa->vz);
+  free(soa->area1);
+  free(soa->area2);
+  free(soa->orig_area1);
+  free(soa->orig_area2);
+  free(soa->invalid);
+  free(soa);
+  *psoa = NULL;
+}
+
+static void gcamFreeSoa(GCA_MORPH *gcam)
+{
+  gcamSoaFree(&gcam->soa);
+}
+
+static void gcamSoaFill(const GCA_MORPH *gcam, struct GCAM_SOA *soa)
+{
+  int const width  = soa->width;
+  int const height = soa->height;
+  int const depth  = soa->depth;
+
+  int x;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(static, 1)
+#endif
+  for (x = 0; x < width; x++) {
+    ROMP_PFLB_begin
+    int y, z;
+    for (y = 0; y < height; y++) {
+      GCA_MORPH_NODE const * const row = gcam->nodes[x][y];
+      size_t const base = ((size_t)x * height + y) * depth;
+      for (z = 0; z < depth; z++) {
+        GCA_MORPH_NODE const * const gcamn = &row[z];
+        soa->vx[base + z] = gcamn->x - gcamn->origx;
+        soa->vy[base + z] = gcamn->y - gcamn->origy;
+        soa->vz[base + z] = gcamn->z - gcamn->origz;
+        soa->area1[base + z] = gcamn->area1;
+        soa->area2[base + z] = gcamn->area2;
+        soa->orig_area1[base + z] = gcamn->orig_area1;
+        soa->orig_area2[base + z] = gcamn->orig_area2;
+        soa->invalid[base + z] = gcamn->invalid;
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
+
+static struct GCAM_SOA const *gcamSoaGather(GCA_MORPH *gcam)
+{
+  struct GCAM_SOA *soa = gcam->soa;
+  if (soa && (soa->width != gcam->width || soa->height != gcam->height || soa->depth != gcam->depth)) {
+    gcamFreeSoa(gcam);
+    soa = NULL;
+  }
+  if (!soa) {
+    soa = gcam->soa = gcamSoaAlloc(gcam->width, gcam->height, gcam->depth);
+  }
+  gcamSoaFill(gcam, soa);
+  return soa;
+}
+
 #define GCAM_JACOBENERGY_OUTPUT 0
 
 /*!
@@ -3675,6 +3946,13 @@ int gcamComputeMetricProperties(GCA_MORPH *gcam)
 #E#
  */
 double gcamJacobianEnergy(const GCA_MORPH * const gcam, MRI *mri)
+{
+  // a single pass over the nodes, so there is nothing to gain from gathering them first
+  return gcamJacobianEnergyFromSoa(gcam, NULL, mri);
+}
+
+// soa is the gathered node fields, or NULL to read the nodes directly
+static double gcamJacobianEnergyFromSoa(const GCA_MORPH *gcam, struct GCAM_SOA const *soa, MRI *mri)
 {
   double sse = 0;
   extern int gcamJacobianEnergy_nCalls;
@@ -3739,18 +4017,24 @@ double gcamJacobianEnergy(const GCA_MORPH * const gcam, MRI *mri)
     int j = 0, k = 0;
     
     for (j = 0; j < height; j++) {
+      size_t const base = ((size_t)i * height + j) * depth;
       for (k = 0; k < depth; k++) {
-        GCA_MORPH_NODE const * const gcamn = &gcam->nodes[i][j][k];
-
-        if (gcamn->invalid) {
+        size_t const n = base + k;
+        GCA_MORPH_NODE const * const gcamn = soa ? NULL : &gcam->nodes[i][j][k];
+        float const area1      = soa ? soa->area1[n]      : gcamn->area1;
+        float const area2      = soa ? soa->area2[n]      : gcamn->area2;
+        float const orig_area1 = soa ? soa->orig_area1[n] : gcamn->orig_area1;
+        float const orig_area2 = soa ? soa->orig_area2[n] : gcamn->orig_area2;
+
+        if (soa ? soa->invalid[n] : gcamn->invalid) {
           continue;
         }
 
         /* scale up the area coefficient if the area of the current node is
           close to 0 or already negative */
 
-        if (!FZERO(gcamn->orig_area1)) {
-          double const ratio = gcamn->area1 / gcamn->orig_area1;
+        if (!FZERO(orig_area1)) {
+          double const ratio = area1 / orig_area1;
           double const exponent = -gcam->exp_k * ratio;
 
           double delta;
@@ -3768,7 +4052,7 @@ double gcamJacobianEnergy(const GCA_MORPH * const gcam, MRI *mri)
           }
 
           if (i == Gx && j == Gy && k == Gz) {
-            printf("E_jaco: node(%d,%d,%d): area1=%2.4f, error=%2.3f\n", i, j, k, gcamn->area1, delta);
+            printf("E_jaco: node(%d,%d,%d): area1=%2.4f, error=%2.3f\n", i, j, k, area1, delta);
           }
 
           if (!FZERO(delta)) {
@@ -3776,8 +4060,8 @@ double gcamJacobianEnergy(const GCA_MORPH * const gcam, MRI *mri)
           }
         }
 
-        if (!FZERO(gcamn->orig_area2)) {
-          double const ratio = gcamn->area2 / gcamn->orig_area2;
+        if (!FZERO(orig_area2)) {
+          double const ratio = area2 / orig_area2;
           double const exponent = -gcam->exp_k * ratio;
 
           double delta;
@@ -3795,7 +4079,7 @@ double gcamJacobianEnergy(const GCA_MORPH * const gcam, MRI *mri)
           }
 
           if (i == Gx && j == Gy && k == Gz) {
-            printf("E_jaco: node(%d,%d,%d): area2=%2.4f, error=%2.3f\n", i, j, k, gcamn->area2, delta);
+            printf("E_jaco: node(%d,%d,%d): area2=%2.4f, error=%2.3f\n", i, j, k, area2, delta);
           }
 
           if (!FZERO(delta)) {
@@ -5538,6 +5822,7 @@ double gcamComputeSSE(GCA_MORPH *gcam, MRI *mri, GCA_MORPH_PARMS *parms)
   double ms_sse, l_sse, s_sse, ls_sse, j_sse, d_sse, a_sse;
   double nvox, label_sse, map_sse, dtrans_sse;
   double binary_sse, area_intensity_sse, spring_sse, exp_sse;
+  struct GCAM_SOA const *soa = NULL;
 
   if (!DZERO(parms->l_area_intensity)) {
     parms->nlt = gcamCreateNodeLookupTable(gcam, parms->mri, parms->nlt);
@@ -5577,8 +5862,12 @@ double gcamComputeSSE(GCA_MORPH *gcam, MRI *mri, GCA_MORPH_PARMS *parms)
   if (!DZERO(parms->l_distance)) {
     d_sse = parms->l_distance * gcamDistanceEnergy(gcam, mri);
   }
+  // the jacobian and smoothness energies share one gather of the node fields
+  if (!DZERO(parms->l_jacobian) || !DZERO(parms->l_smoothness)) {
+    soa = gcamSoaGather(gcam);
+  }
   if (!DZERO(parms->l_jacobian)) {
-    j_sse = parms->l_jacobian * gcamJacobianEnergy(gcam, mri);
+    j_sse = parms->l_jacobian * gcamJacobianEnergyFromSoa(gcam, soa, mri);
   }
   if (!DZERO(parms->l_area)) {
     a_sse = parms->l_area * gcamAreaEnergy(gcam);
@@ -5587,7 +5876,7 @@ double gcamComputeSSE(GCA_MORPH *gcam, MRI *mri, GCA_MORPH_PARMS *parms)
     a_sse = parms->l_area_smoothness * gcamAreaEnergy(gcam);
   }
   if (!DZERO(parms->l_smoothness)) {
-    s_sse = parms->l_smoothness * gcamSmoothnessEnergy(gcam, mri);
+    s_sse = parms->l_smoothness * gcamSmoothnessEnergyFromSoa(gcam, soa, mri);
   }
   if (!DZERO(parms->l_lsmoothness)) {
     ls_sse = parms->l_lsmoothness * gcamLSmoothnessEnergy(gcam, mri);
@@ -5899,11 +6188,8 @@ int gcamLimitGradientMagnitude(GCA_MORPH *gcam, GCA_MORPH_PARMS *parms, MRI *mri
  */
 int gcamSmoothnessTerm(GCA_MORPH *gcam, const MRI *mri, const double l_smoothness)
 {
-  double vx = 0.0, vy = 0.0, vz = 0.0, vnx = 0.0, vny = 0.0, vnz = 0.0;
-  double dx = 0.0, dy = 0.0, dz = 0.0;
-  int x = 0, y = 0, z = 0, xk = 0, yk = 0, zk = 0, xn = 0, yn = 0, zn = 0;
-  int width, height, depth, num = 0;
-  GCA_MORPH_NODE *gcamn = NULL, *gcamn_nbr = NULL;
+  int x = 0;
+  int width, height, depth;
   extern int gcamSmoothnessTerm_nCalls;
   extern double gcamSmoothnessTerm_tsec;
   Timer timer;
@@ -5917,62 +6203,67 @@ int gcamSmoothnessTerm(GCA_MORPH *gcam, const MRI *mri, const double l_smoothnes
   width = gcam->width;
   height = gcam->height;
   depth = gcam->depth;
+
+  struct GCAM_SOA const * const soa = gcamSoaGather(gcam);
+
   ROMP_PF_begin
 #ifdef HAVE_OPENMP
-  #pragma omp parallel for if_ROMP(assume_reproducible) firstprivate(                                                          \
-    y, z, gcamn, vx, vy, vz, dx, dy, dz, num, xk, xn, yk, yn, zk, zn, gcamn_nbr, vnx, vny, vnz) \
-    shared(gcam, Gx, Gy, Gz) schedule(static, 1)
+  #pragma omp parallel for if_ROMP(assume_reproducible) shared(gcam, Gx, Gy, Gz) schedule(static, 1)
 #endif
-  for (x = 0; x < gcam->width; x++) {
+  for (x = 0; x < width; x++) {
     ROMP_PFLB_begin
     
-    for (y = 0; y < gcam->height; y++) {
-      for (z = 0; z < gcam->depth; z++) {
+    int y, z;
+    for (y = 0; y < height; y++) {
+      for (z = 0; z < depth; z++) {
         if (x == Gx && y == Gy && z == Gz) {
           DiagBreak();
         }
-        gcamn = &gcam->nodes[x][y][z];
+        size_t const n = ((size_t)x * height + y) * depth + z;
 
-        if (gcamn->invalid == GCAM_POSITION_INVALID) {
+        if (soa->invalid[n] == GCAM_POSITION_INVALID) {
           continue;
         }
 
-        vx = gcamn->x - gcamn->origx;
-        vy = gcamn->y - gcamn->origy;
-        vz = gcamn->z - gcamn->origz;
-        dx = dy = dz = 0.0f;
+        double const vx = soa->vx[n];
+        double const vy = soa->vy[n];
+        double const vz = soa->vz[n];
+        double dx = 0.0, dy = 0.0, dz = 0.0;
         if (x == Gx && y == Gy && z == Gz)
           printf("l_smoo: node(%d,%d,%d): V=(%2.2f,%2.2f,%2.2f)\n", x, y, z, vx, vy, vz);
-        num = 0;
+        int num = 0;
 
+        int xk, yk, zk;
         for (xk = -1; xk <= 1; xk++) {
-          xn = x + xk;
+          int xn = x + xk;
           xn = MAX(0, xn);
           xn = MIN(width - 1, xn);
 
           for (yk = -1; yk <= 1; yk++) {
-            yn = y + yk;
+            int yn = y + yk;
             yn = MAX(0, yn);
             yn = MIN(height - 1, yn);
 
+            size_t const row = ((size_t)xn * height + yn) * depth;
+
             for (zk = -1; zk <= 1; zk++) {
               if (!zk && !yk && !xk) {
                 continue;
               }
 
-              zn = z + zk;
+              int zn = z + zk;
               zn = MAX(0, zn);
               zn = MIN(depth - 1, zn);
 
-              gcamn_nbr = &gcam->nodes[xn][yn][zn];
+              size_t const nbr = row + zn;
 
-              if (gcamn_nbr->invalid == GCAM_POSITION_INVALID) {
+              if (soa->invalid[nbr] == GCAM_POSITION_INVALID) {
                 continue;
               }
 
-              vnx = gcamn_nbr->x - gcamn_nbr->origx;
-              vny = gcamn_nbr->y - gcamn_nbr->origy;
-              vnz = gcamn_nbr->z - gcamn_nbr->origz;
+              double const vnx = soa->vx[nbr];
+              double const vny = soa->vy[nbr];
+              double const vnz = soa->vz[nbr];
 
               dx += (vnx - vx);
               dy += (vny - vy);
@@ -5998,6 +6289,7 @@ int gcamSmoothnessTerm(GCA_MORPH *gcam, const MRI *mri, const double l_smoothnes
           printf("l_smoo: node(%d,%d,%d): DX=(%2.2f,%2.2f,%2.2f)\n", x, y, z, dx, dy, dz);
         }
 
+        GCA_MORPH_NODE * const gcamn = &gcam->nodes[x][y][z];
         gcamn->dx += dx;
         gcamn->dy += dy;
         gcamn->dz += dz;
@@ -6116,7 +6408,7 @@ int gcamElasticTerm(const GCA_MORPH *gcam, GCA_MORPH_PARMS *parms)
 
 #ifdef FASTER_gcamSmoothnessEnergy
 static double gcamSmoothnessEnergy_old(const GCA_MORPH *gcam, const MRI *mri);
-static double gcamSmoothnessEnergy_new(const GCA_MORPH *gcam, const MRI *mri);
+static double gcamSmoothnessEnergy_new(struct GCAM_SOA const *soa);
 #endif
 
 /*!
@@ -6129,6 +6421,20 @@ static double gcamSmoothnessEnergy_new(const GCA_MORPH *gcam, const MRI *mri);
 #E#
  */
 double gcamSmoothnessEnergy(const GCA_MORPH *gcam, const MRI *mri) 
+{
+#ifdef FASTER_gcamSmoothnessEnergy
+  // gathered into arrays of our own, the gcam->soa cache belongs to whoever owns the gcam
+  struct GCAM_SOA *soa = gcamSoaAlloc(gcam->width, gcam->height, gcam->depth);
+  gcamSoaFill(gcam, soa);
+  double const sse = gcamSmoothnessEnergyFromSoa(gcam, soa, mri);
+  gcamSoaFree(&soa);
+  return sse;
+#else
+  return gcamSmoothnessEnergyFromSoa(gcam, NULL, mri);
+#endif
+}
+
+static double gcamSmoothnessEnergyFromSoa(const GCA_MORPH *gcam, struct GCAM_SOA const *soa, const MRI *mri)
 #ifdef FASTER_gcamSmoothnessEnergy
 {
     static bool const do_old = false;
@@ -6142,7 +6448,7 @@ double gcamSmoothnessEnergy(const GCA_MORPH *gcam, const MRI *mri)
     if (do_new && do_old) fprintf(stderr,"\n\n\n");
     if (do_new) {
         if (do_old) fprintf(stderr,"Doing new way\n");
-        new_result = gcamSmoothnessEnergy_new(gcam, mri);
+        new_result = gcamSmoothnessEnergy_new(soa);
     }
     if (do_old) {
         if (do_new) fprintf(stderr,"Doing old way\n");
@@ -6284,32 +6590,26 @@ static double gcamSmoothnessEnergy_old(const GCA_MORPH *gcam, const MRI *mri)
 }
 
 #ifdef FASTER_gcamSmoothnessEnergy
-static double gcamSmoothnessEnergy_new(const GCA_MORPH *gcam, const MRI *mri)
+static double gcamSmoothnessEnergy_new(struct GCAM_SOA const *soa)
 {
   /*!
-    Computes a load of derivatives (of some description).
-    I don't know the purpose of the MRI argument, since it's
-    not actually used by anything
+    Same sum as gcamSmoothnessEnergy_old, but reading the displacements
+    and invalid flags from the flat copies made by gcamSoaGather rather
+    than walking the nodes.  The displacements are rounded to float before
+    differencing, as the padded per-thread buffers this replaced did.
   */
-#if GCAM_SMOOTHNESS_OUTPUT
-  const unsigned int gcamSmoothnessOutputFreq = 10;
-  static unsigned int nCalls = 0;
-  if ((nCalls % gcamSmoothnessOutputFreq) == 0) {
-    char fname[STRLEN];
-    snprintf(fname, STRLEN - 1, "gcamSmoothInput%04u", nCalls / gcamSmoothnessOutputFreq);
-    fname[STRLEN - 1] = '\0';
-    WriteGCAMoneInput(gcam, fname);
-  }
-  nCalls++;
-#endif
-
 #if SHOW_EXEC_LOC
   printf("%s: CPU call\n", __FUNCTION__);
 #endif
 
-  int const width  = gcam->width;
-  int const height = gcam->height;
-  int const depth  = gcam->depth;
+  int const width  = soa->width;
+  int const height = soa->height;
+  int const depth  = soa->depth;
+
+  double const * const vecx    = soa->vx;
+  double const * const vecy    = soa->vy;
+  double const * const vecz    = soa->vz;
+  char   const * const invalid = soa->invalid;
 
   double sse = 0.0;
 
@@ -6320,24 +6620,8 @@ static double gcamSmoothnessEnergy_new(const GCA_MORPH *gcam, const MRI *mri)
     1;
 #endif
 
-  typedef float BufferElt;
-  struct buffer {
-    BufferElt* vec_vxyz;
-    char*   vec_valid;
-    int     validCount;
-  } * buffers = (struct buffer*)calloc(nt, sizeof(struct buffer));
-
   const int xStride = (width + nt-1) / nt;
 
-  if (width < 4) {
-      static bool reported = false;
-      if (!reported) {
-        reported = true;
-	fprintf(stderr,"%s:%d width:%d too small for parallelism\n", 
-	  __FILE__, __LINE__, width);
-      }
-  }
-
 #ifdef BEVIN_GCAMSMOOTHNESSENERGY_REPRODUCIBLE
 
   int const numberOfStrides = (width + xStride - 1) / xStride;
@@ -6365,7 +6649,7 @@ static double gcamSmoothnessEnergy_new(const GCA_MORPH *gcam, const MRI *mri)
 
   ROMP_PF_begin
 #ifdef HAVE_OPENMP  // Important during mri_ca_register
-  #pragma omp parallel for if_ROMP(fast) reduction(+:sse) shared(gcam,Gx,Gy,Gz) schedule(static,1)
+  #pragma omp parallel for if_ROMP(fast) reduction(+:sse) schedule(static,1)
 #endif
   for (xLo = 0; xLo < width; xLo += xStride) {
     ROMP_PFLB_begin
@@ -6373,157 +6657,48 @@ static double gcamSmoothnessEnergy_new(const GCA_MORPH *gcam, const MRI *mri)
 #endif
 
     int const xHi = MIN(xLo + xStride, width);
-   
-    // Compute all the (gcamn->x - gcamn->origx) for the valid nodes
-    // This avoids the recomputation and makes all the accessed reasonably dense.
-    // Add frontiers so we don't have to test for them.
-    //
-    int const paddedHeight = height + 2;
-    int const paddedDepth  = depth  + 2;
-    int const paddedArea   = paddedHeight * paddedDepth;
-    int const paddedVolume = (xStride+2)  * paddedArea;
-  
-    // To index [xStride+2, paddedHeight, paddedDepth]
-    // use        (x-least x) * paddedHeight * paddedDepth
-    //          + (y-least y) * paddedDepth
-    //          +  z-least z
-    //
-#define INDEX(XM,YM,ZM)             \
-    (  ((XM)-(xLo-1))*paddedArea  + \
-       ((YM)-(   -1))*paddedDepth + \
-     + ((ZM)+1)                     \
-    ) // end of macro
 
-    int const thread_num =
-#ifdef HAVE_OPENMP
-        omp_get_thread_num();
-#else
-        0;
-#endif
-    struct buffer* buf = &buffers[thread_num];
-    BufferElt* vec_vxyz  = buf->vec_vxyz;
-    char*      vec_valid = buf->vec_valid;
-      
-    // Make the vectors for this thread unless already made
-    //
-    if (!vec_vxyz) {
-  
-      vec_vxyz = buf->vec_vxyz = (BufferElt*)malloc(
-        paddedVolume *
-        3 *                     // xyz
-        sizeof(BufferElt));     // the stored data  
-  
-      vec_valid = buf->vec_valid = (char*)malloc(
-        paddedVolume *
-        sizeof(char));          // the stored       gcamn->invalid == GCAM_POSITION_INVALID
-    }
-
-    bzero(vec_valid, paddedVolume * sizeof(char));
-	
-    // Fill the entries in and decide
-    // how important it is to skip the invalid ones
-    //
-    {
-      int xm,ym,zm;
-      for (xm = xLo-1; xm < xHi+1; xm++) {
-        int xn = xm;
-        xn = MAX(0, xn);
-        xn = MIN(width - 1, xn);
-    
-        for (ym = -1; ym < height+1; ym++) {
-          int yn = ym;
-          yn = MAX(0, yn);
-          yn = MIN(height - 1, yn);
-    
-          GMN * gcam_nodes_xn_yn = gcam->nodes[xn][yn];
-    
-#define INNER_LOOP_BODY_1 \
-            const GCA_MORPH_NODE * const gcamn = &gcam_nodes_xn_yn[zn]; \
-            if (gcamn->invalid == GCAM_POSITION_INVALID) {  \
-              continue;                                     \
-            }                                               \
-            // end of macro
-              
-#define INNER_LOOP_BODY_2                                   \
-            int const index = INDEX(xm,ym,zm);              \
-            vec_valid[index] = 1;                           \
-            double const vx = gcamn->x - gcamn->origx;      \
-            double const vy = gcamn->y - gcamn->origy;      \
-            double const vz = gcamn->z - gcamn->origz;      \
-            vec_vxyz[index*3+0] = (BufferElt)vx;            \
-            vec_vxyz[index*3+1] = (BufferElt)vy;            \
-            vec_vxyz[index*3+2] = (BufferElt)vz;            \
-            // end of macro
-  
-          zm = -1; {
-            int zn = 0;
-            INNER_LOOP_BODY_1
-            INNER_LOOP_BODY_2
-          }
-  
-          for (zm = 0; zm < depth; zm++) {
-            int zn = zm;
-            INNER_LOOP_BODY_1
-            INNER_LOOP_BODY_2
-          }
-            
-          zm = depth; {
-            int zn = depth - 1;
-            INNER_LOOP_BODY_1
-            INNER_LOOP_BODY_2
-          }
-  
-#undef INNER_LOOP_BODY
-  
-        }
-      }
-    } // filling in the entries
-  
-    // Compute the contribution from the slices voxels
-    //
     int x;
     for (x = xLo; x < xHi; x++) {
       int y,z;    
       for (y = 0; y < height; y++) {
         for (z = 0; z < depth; z++) {
   
-          int const index_xyz = INDEX(x,y,z);
+          size_t const n = ((size_t)x * height + y) * depth + z;
                 
-          if (!vec_valid[index_xyz]) continue;
-	  buf->validCount++;
+          if (invalid[n] == GCAM_POSITION_INVALID) continue;
 	    
           // Get the differences from original
           //
-          BufferElt const vx = vec_vxyz[index_xyz*3+0];
-          BufferElt const vy = vec_vxyz[index_xyz*3+1];
-          BufferElt const vz = vec_vxyz[index_xyz*3+2];
+          float const vx = (float)vecx[n];
+          float const vy = (float)vecy[n];
+          float const vz = (float)vecz[n];
   
           int    num = -1;        // account for counting self below
           double node_sse = 0.0;
   
-          // Loop over 3^3 voxels centred on xyz
+          // Loop over 3^3 voxels centred on xyz, clamped at the borders
           // 
           int xm,ym,zm;
           for (xm = x-1; xm < x+2; xm++) {
+            int const xn = MIN(width - 1, MAX(0, xm));
             for (ym = y-1; ym < y+2; ym++) {
+              int const yn = MIN(height - 1, MAX(0, ym));
+              size_t const base = ((size_t)xn * height + yn) * depth;
               for (zm = z-1; zm < z+2; zm++) {
   
                 // Using self is ok, because 
                 // (a) dx, dy, and dz will be zero, and (b) num started at -1
   
-                int const index_xmymzm = INDEX(xm,ym,zm);
+                size_t const nn = base + MIN(depth - 1, MAX(0, zm));
                 
-                if (!vec_valid[index_xmymzm]) { // this test is almost always true
-                  continue;                     // if actually_valid is close to possibly_valid
+                if (invalid[nn] == GCAM_POSITION_INVALID) {
+                  continue;
                 }
   
-                BufferElt const vnx = vec_vxyz[index_xmymzm*3+0];
-                BufferElt const vny = vec_vxyz[index_xmymzm*3+1];
-                BufferElt const vnz = vec_vxyz[index_xmymzm*3+2];
-  
-                double const dx = (double)(vnx - vx);
-                double const dy = (double)(vny - vy);
-                double const dz = (double)(vnz - vz);
+                double const dx = (double)((float)vecx[nn] - vx);
+                double const dy = (double)((float)vecy[nn] - vy);
+                double const dz = (double)((float)vecz[nn] - vz);
   
                 double const error = dx*dx + dy*dy + dz*dz;
   
@@ -6558,38 +6733,6 @@ static double gcamSmoothnessEnergy_new(const GCA_MORPH *gcam, const MRI *mri)
 
 #endif
 
-  // Show the stats
-  // Free the buffers
-  // It may be better to reuse the buffer across calls...
-  //
-  if (0) {
-    static int count;
-    static int limit = 1;
-    int thread_num;
-    bool show = (++count >= limit);
-    if (show) { 
-      limit = (limit < 100) ? count+1 : limit+100; 
-      fprintf(stderr, "thread workload "); 
-    }
-    for (thread_num = 0; thread_num < nt; thread_num++) {
-      struct buffer* buf = &buffers[thread_num];
-      if (show) {
-    	fprintf(stderr, "%d:%d ", thread_num, buf->validCount);
-      }
-    }
-    if (show) fprintf(stderr, "freeing buffers for %d threads...\n",nt);
-  }
-
-  {
-    int thread_num;
-    for (thread_num = 0; thread_num < nt; thread_num++) {
-      struct buffer* buf = &buffers[thread_num];
-      free(buf->vec_vxyz);
-      free(buf->vec_valid);
-    }
-    free(buffers);
-  }
-
   return (sse);
 }
 #endif
@@ -7383,14 +7526,16 @@ MRI *GCAMbuildVolume(GCA_MORPH *gcam, MRI *mri)
   return (mri);
 }
 
+/*
+  Computes the inverse of the morph as the gcam node coordinates of every
+  voxel of mri (mri_xind, mri_yind, mri_zind).  By default every node is
+  splatted into the index volumes and the holes are filled with a soap
+  bubble.  Setting FREESURFER_GCAMinvert_fixedPoint solves for each voxel
+  with GCAMinvertFixedPoint instead, which runs in parallel and reports
+  the residual of the result.
+*/
 int GCAMinvert(GCA_MORPH *gcam, MRI *mri)
 {
-  int x, y, z, width, height, depth;
-  MRI *mri_ctrl, *mri_counts;
-  GCA_MORPH_NODE *gcamn;
-  double xf, yf, zf;
-  float num;
-
   if (gcam->mri_xind) /* already inverted */
   {
     return (NO_ERROR);
@@ -7408,6 +7553,22 @@ int GCAMinvert(GCA_MORPH *gcam, MRI *mri)
               gcam->image.height,
               gcam->image.depth);
 
+  if (getenv("FREESURFER_GCAMinvert_fixedPoint")) {
+    return (GCAMinvertFixedPoint(gcam, mri, 20, 0.01, NULL));
+  }
+  gcamInvertBySplatting(gcam, mri);
+  gcam->inverse_hash = gcamNodePositionHash(gcam);
+  return (NO_ERROR);
+}
+
+static int gcamInvertBySplatting(GCA_MORPH *gcam, MRI *mri)
+{
+  int x, y, z, width, height, depth;
+  MRI *mri_ctrl, *mri_counts;
+  GCA_MORPH_NODE *gcamn;
+  double xf, yf, zf;
+  float num;
+
   // use mri
   width = mri->width;
   height = mri->height;
@@ -7548,6 +7709,278 @@ int GCAMinvert(GCA_MORPH *gcam, MRI *mri)
   return (NO_ERROR);
 }
 
+/*
+  Position that the morph maps the (fractional) node coordinate p to,
+  trilinearly interpolated between the 8 surrounding nodes, and its
+  derivative with respect to p.  Returns 0 if any of those nodes is
+  invalid, in which case F and J are not set.
+*/
+static int gcamSampleNodePosition(const GCA_MORPH *gcam, const double p[3], double F[3], double J[3][3])
+{
+  int const lo[3] = {MAX(0, MIN(gcam->width - 2, (int)floor(p[0]))),
+                     MAX(0, MIN(gcam->height - 2, (int)floor(p[1]))),
+                     MAX(0, MIN(gcam->depth - 2, (int)floor(p[2])))};
+  double const f[3] = {p[0] - lo[0], p[1] - lo[1], p[2] - lo[2]};
+  int i, j, k, c;
+
+  for (c = 0; c < 3; c++) {
+    F[c] = J[c][0] = J[c][1] = J[c][2] = 0.0;
+  }
+  for (i = 0; i < 2; i++) {
+    double const wx = i ? f[0] : 1 - f[0], dwx = i ? 1 : -1;
+    for (j = 0; j < 2; j++) {
+      double const wy = j ? f[1] : 1 - f[1], dwy = j ? 1 : -1;
+      for (k = 0; k < 2; k++) {
+        double const wz = k ? f[2] : 1 - f[2], dwz = k ? 1 : -1;
+        GCA_MORPH_NODE const *gcamn = &gcam->nodes[lo[0] + i][lo[1] + j][lo[2] + k];
+        if (gcamn->invalid == GCAM_POSITION_INVALID) {
+          return (0);
+        }
+        double const pos[3] = {gcamn->x, gcamn->y, gcamn->z};
+        for (c = 0; c < 3; c++) {
+          F[c] += wx * wy * wz * pos[c];
+          J[c][0] += dwx * wy * wz * pos[c];
+          J[c][1] += wx * dwy * wz * pos[c];
+          J[c][2] += wx * wy * dwz * pos[c];
+        }
+      }
+    }
+  }
+  return (1);
+}
+
+/*
+  Newton iteration for the node coordinate p that the morph maps to the
+  voxel v, starting from p.  Returns 1 and leaves the solution in p if
+  the residual |F(p) - v| falls below tol within max_iter steps.
+*/
+static int gcamSolveNodeCoordinate(
+    const GCA_MORPH *gcam, const double v[3], double p[3], int max_iter, double tol, double *presidual)
+{
+  int const hi[3] = {gcam->width - 1, gcam->height - 1, gcam->depth - 1};
+  double F[3], J[3][3], r[3], dp[3];
+  int iter, c;
+
+  for (iter = 0; iter <= max_iter; iter++) {
+    if (!gcamSampleNodePosition(gcam, p, F, J)) {
+      return (0);
+    }
+    for (c = 0; c < 3; c++) {
+      r[c] = v[c] - F[c];
+    }
+    double const residual = sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2]);
+    if (residual < tol) {
+      *presidual = residual;
+      return (1);
+    }
+    if (iter == max_iter) {
+      break;
+    }
+
+    // solve J dp = r by Cramer's rule
+    double const det = J[0][0] * (J[1][1] * J[2][2] - J[1][2] * J[2][1]) -
+                       J[0][1] * (J[1][0] * J[2][2] - J[1][2] * J[2][0]) +
+                       J[0][2] * (J[1][0] * J[2][1] - J[1][1] * J[2][0]);
+    if (fabs(det) < 1e-10) {
+      return (0);
+    }
+    dp[0] = (r[0] * (J[1][1] * J[2][2] - J[1][2] * J[2][1]) - J[0][1] * (r[1] * J[2][2] - J[1][2] * r[2]) +
+             J[0][2] * (r[1] * J[2][1] - J[1][1] * r[2])) / det;
+    dp[1] = (J[0][0] * (r[1] * J[2][2] - J[1][2] * r[2]) - r[0] * (J[1][0] * J[2][2] - J[1][2] * J[2][0]) +
+             J[0][2] * (J[1][0] * r[2] - r[1] * J[2][0])) / det;
+    dp[2] = (J[0][0] * (J[1][1] * r[2] - r[1] * J[2][1]) - J[0][1] * (J[1][0] * r[2] - r[1] * J[2][0]) +
+             r[0] * (J[1][0] * J[2][1] - J[1][1] * J[2][0])) / det;
+
+    // don't let a step leave the neighborhood it was linearized in
+    double const len = sqrt(dp[0] * dp[0] + dp[1] * dp[1] + dp[2] * dp[2]);
+    double const scale = len > 2.0 ? 2.0 / len : 1.0;
+    for (c = 0; c < 3; c++) {
+      p[c] += scale * dp[c];
+      p[c] = MAX(0, MIN(hi[c], p[c]));
+    }
+  }
+  return (0);
+}
+
+/*
+  Inverts the morph by solving F(p) = v for the node coordinate p of every
+  voxel v of mri, where F interpolates the node positions trilinearly.
+  Each voxel starts from its neighbor along the row, or from a least
+  squares affine fit of the node coordinates to the node positions at the
+  start of a row, and is refined by Newton steps until its residual is
+  below tol voxels.  The slices are solved in parallel, and each voxel's
+  result does not depend on the number of threads.  Voxels that do not
+  converge (e.g. outside the region the valid nodes map to) are filled
+  from the nearest converged voxel.  The rms residual of the converged
+  voxels is printed and returned in *prms if prms is not NULL.  Any
+  existing inverse is replaced.
+*/
+int GCAMinvertFixedPoint(GCA_MORPH *gcam, MRI *mri, int max_iter, double tol, double *prms)
+{
+  int const width = mri->width, height = mri->height, depth = mri->depth;
+  double A[3][4];
+  int x, y, z, r, c;
+
+  if (gcam->width < 2 || gcam->height < 2 || gcam->depth < 2)
+    ErrorReturn(ERROR_BADPARM,
+                (ERROR_BADPARM, "GCAMinvertFixedPoint: %dx%dx%d morph is too small", gcam->width, gcam->height, gcam->depth));
+
+  GCAMfreeInverse(gcam);
+
+  // initial guess: node coordinate as an affine function of the position
+  {
+    MATRIX *m_XtX = MatrixAlloc(4, 4, MATRIX_REAL);
+    MATRIX *m_XtY = MatrixAlloc(4, 3, MATRIX_REAL);
+    MATRIX *m_inv, *m_beta;
+
+    for (x = 0; x < gcam->width; x++)
+      for (y = 0; y < gcam->height; y++)
+        for (z = 0; z < gcam->depth; z++) {
+          GCA_MORPH_NODE const *gcamn = &gcam->nodes[x][y][z];
+          if (gcamn->invalid == GCAM_POSITION_INVALID) {
+            continue;
+          }
+          double const xv[4] = {gcamn->x, gcamn->y, gcamn->z, 1.0};
+          double const yv[3] = {(double)x, (double)y, (double)z};
+          for (r = 0; r < 4; r++) {
+            for (c = 0; c < 4; c++) {
+              *MATRIX_RELT(m_XtX, r + 1, c + 1) += xv[r] * xv[c];
+            }
+            for (c = 0; c < 3; c++) {
+              *MATRIX_RELT(m_XtY, r + 1, c + 1) += xv[r] * yv[c];
+            }
+          }
+        }
+    m_inv = MatrixInverse(m_XtX, NULL);
+    if (m_inv) {
+      m_beta = MatrixMultiply(m_inv, m_XtY, NULL);
+      for (r = 0; r < 3; r++)
+        for (c = 0; c < 4; c++) {
+          A[r][c] = *MATRIX_RELT(m_beta, c + 1, r + 1);
+        }
+      MatrixFree(&m_beta);
+      MatrixFree(&m_inv);
+    }
+    else  // no usable nodes, assume the nodes sit on the voxel grid
+    {
+      memset(A, 0, sizeof(A));
+      for (r = 0; r < 3; r++) {
+        A[r][r] = 1.0 / gcam->spacing;
+      }
+    }
+    MatrixFree(&m_XtX);
+    MatrixFree(&m_XtY);
+  }
+
+  gcam->mri_xind = MRIalloc(width, height, depth, MRI_FLOAT);
+  MRIcopyHeader(mri, gcam->mri_xind);
+  gcam->mri_yind = MRIalloc(width, height, depth, MRI_FLOAT);
+  MRIcopyHeader(mri, gcam->mri_yind);
+  gcam->mri_zind = MRIalloc(width, height, depth, MRI_FLOAT);
+  MRIcopyHeader(mri, gcam->mri_zind);
+  MRI *mri_ctrl = MRIalloc(width, height, depth, MRI_UCHAR);
+  MRIcopyHeader(mri, mri_ctrl);
+  double *slice_sse = (double *)calloc(depth, sizeof(double));
+  double *slice_max = (double *)calloc(depth, sizeof(double));
+  int *slice_nconverged = (int *)calloc(depth, sizeof(int));
+  if (!gcam->mri_xind || !gcam->mri_yind || !gcam->mri_zind || !mri_ctrl || !slice_sse || !slice_max ||
+      !slice_nconverged)
+    ErrorExit(ERROR_NOMEMORY, "GCAMinvertFixedPoint: could not allocate %dx%dx%d index volumes", width, height, depth);
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 1)
+#endif
+  for (z = 0; z < depth; z++) {
+    ROMP_PFLB_begin
+    int x, y, c;
+    for (y = 0; y < height; y++) {
+      double p[3], p_prev[3];
+      int prev_converged = 0;
+      for (x = 0; x < width; x++) {
+        double const v[3] = {(double)x, (double)y, (double)z};
+        double p_affine[3], residual;
+        int converged;
+
+        for (c = 0; c < 3; c++) {
+          p_affine[c] = A[c][0] * v[0] + A[c][1] * v[1] + A[c][2] * v[2] + A[c][3];
+        }
+
+        // warm start from the previous voxel along the row, falling back to the affine guess
+        converged = 0;
+        if (prev_converged) {
+          for (c = 0; c < 3; c++) {
+            p[c] = p_prev[c] + A[c][0];
+          }
+          converged = gcamSolveNodeCoordinate(gcam, v, p, max_iter, tol, &residual);
+        }
+        if (!converged) {
+          for (c = 0; c < 3; c++) {
+            p[c] = p_affine[c];
+          }
+          converged = gcamSolveNodeCoordinate(gcam, v, p, max_iter, tol, &residual);
+        }
+
+        prev_converged = converged;
+        if (!converged) {
+          continue;
+        }
+        for (c = 0; c < 3; c++) {
+          p_prev[c] = p[c];
+        }
+        MRIFvox(gcam->mri_xind, x, y, z) = p[0];
+        MRIFvox(gcam->mri_yind, x, y, z) = p[1];
+        MRIFvox(gcam->mri_zind, x, y, z) = p[2];
+        MRIvox(mri_ctrl, x, y, z) = CONTROL_MARKED;
+        slice_sse[z] += residual * residual;
+        slice_max[z] = MAX(slice_max[z], residual);
+        slice_nconverged[z]++;
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  double sse = 0, max_residual = 0;
+  long nconverged = 0;
+  for (z = 0; z < depth; z++) {
+    sse += slice_sse[z];
+    max_residual = MAX(max_residual, slice_max[z]);
+    nconverged += slice_nconverged[z];
+  }
+  free(slice_sse);
+  free(slice_max);
+  free(slice_nconverged);
+
+  double const rms = nconverged > 0 ? sqrt(sse / nconverged) : 0.0;
+  printf("GCAMinvertFixedPoint: %ld of %ld voxels converged, rms residual %2.4f, max %2.4f voxels\n",
+         nconverged,
+         (long)width * height * depth,
+         rms,
+         max_residual);
+  if (prms) {
+    *prms = rms;
+  }
+
+  if (nconverged == 0) {
+    printf("GCAMinvertFixedPoint: no voxel converged, inverting by splatting instead\n");
+    MRIfree(&mri_ctrl);
+    GCAMfreeInverse(gcam);
+    gcamInvertBySplatting(gcam, mri);
+  }
+  else {
+    if (nconverged < (long)width * height * depth) {
+      MRIbuildVoronoiDiagram(gcam->mri_xind, mri_ctrl, gcam->mri_xind);
+      MRIbuildVoronoiDiagram(gcam->mri_yind, mri_ctrl, gcam->mri_yind);
+      MRIbuildVoronoiDiagram(gcam->mri_zind, mri_ctrl, gcam->mri_zind);
+    }
+    MRIfree(&mri_ctrl);
+  }
+  gcam->inverse_hash = gcamNodePositionHash(gcam);
+
+  return (NO_ERROR);
+}
+
 int GCAMfreeInverse(GCA_MORPH *gcam)
 {
   if (gcam->mri_xind) {
@@ -7618,6 +8051,7 @@ int gcamReadMRI(GCA_MORPH *gcam, MRI *mri, int which)
   if (Gdiag & DIAG_WRITE && DIAG_VERBOSE_ON) {
     MRIwrite(mri, "m.mgz");
   }
+  if (gcam->gca) GCAunmap(gcam->gca);  // gcamn->gc points into the atlas
   for (x = 0; x < gcam->width; x++)
     for (y = 0; y < gcam->height; y++)
       for (z = 0; z < gcam->depth; z++) {
@@ -11739,6 +12173,7 @@ int GCAMsetVariances(GCA_MORPH *gcam, float var)
   int x, y, z, r;
   GCA_MORPH_NODE *gcamn;
 
+  if (gcam->gca) GCAunmap(gcam->gca);
   for (x = 0; x < gcam->width; x++) {
     for (y = 0; y < gcam->height; y++) {
       for (z = 0; z < gcam->depth; z++) {
@@ -13437,6 +13872,7 @@ int GCAMnormalizeIntensities(GCA_MORPH *gcam, MRI *mri_target)
   GCA_MORPH_NODE *gcamn;
   HISTOGRAM *h;
 
+  if (gcam->gca) GCAunmap(gcam->gca);
   h = HISTOalloc(200);
   HISTOinit(h, 200, 0, 5);
 
@@ -13752,6 +14188,7 @@ int GCAMsetMeansForLabel(GCA_MORPH *gcam, MRI *mri_labels, MRI *mri_vals, int la
   int x, y, z, l, r, xv, yv, zv;
   GCA_MORPH_NODE *gcamn;
 
+  if (gcam->gca) GCAunmap(gcam->gca);
   for (x = 0; x < gcam->width; x++) {
     for (y = 0; y < gcam->height; y++) {
       for (z = 0; z < gcam->depth; z++) {
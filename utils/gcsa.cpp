@@ -38,6 +38,7 @@
 #include "macros.h"
 #include "mrishash.h"
 #include "proto.h"
+#include "romp_support.h"
 #include "tags.h"
 #include "transform.h"
 #include "utils.h"
@@ -68,6 +69,7 @@ static GCSA_NODE *findClosestNode(GCSA *gcsa, int vno, int label) ;
 /*static CP *getCP(CP_NODE *cpn, int label) ;*/
 static GCS *getGC(GCSA_NODE *gcsan, int label, int *pn);
 static int load_inputs(VERTEX *v, double *v_inputs, int ninputs);
+static void gcsaSourceToNodes(GCSA *gcsa, MRI_SURFACE *mris, int vno, int *pvno_prior, int *pvno_classifier);
 static int fill_cpn_holes(GCSA *gcsa);
 static int fill_gcsan_holes(GCSA *gcsa);
 
@@ -200,6 +202,7 @@ int GCSAfree(GCSA **pgcsa)
     free(gcsan->gcs);
   }
 
+  GCSAfreeVertexMap(gcsa);
   MRISfree(&gcsa->mris_classifiers);
   MRISfree(&gcsa->mris_priors);
   free(gcsa->cp_nodes);
@@ -333,6 +336,152 @@ int GCSAsourceToPriorVertexNo(GCSA *gcsa, VERTEX const *v)
 }
 
 
+/*
+  Cached source-to-atlas vertex maps. Labeling looks up the prior and
+  classifier vertex of a source vertex in the atlas hash tables every time
+  the vertex (or one of its neighbors) is visited. GCSAcomputeVertexMap
+  does each lookup once, in parallel, for the current (canonical)
+  positions of mris, and later calls with the same surface use the map
+  instead. The map does not follow the surface: recompute it (or free it)
+  if the vertices move. It depends only on the surface and the atlas
+  icosahedra, so it can be written once per subject and read back for
+  any atlas with the same ico orders.
+*/
+int GCSAcomputeVertexMap(GCSA *gcsa, MRI_SURFACE *mris)
+{
+  int vno;
+
+  GCSAfreeVertexMap(gcsa);
+  gcsa->vmap_priors = (int *)calloc(mris->nvertices, sizeof(int));
+  gcsa->vmap_classifiers = (int *)calloc(mris->nvertices, sizeof(int));
+  if (!gcsa->vmap_priors || !gcsa->vmap_classifiers)
+    ErrorExit(ERROR_NOMEMORY, "GCSAcomputeVertexMap: could not allocate %d-vertex map", mris->nvertices);
+
+  MHT_maybeParallel_begin();
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(static, 1024)
+#endif
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    ROMP_PFLB_begin
+    VERTEX const * const v_prior = GCSAsourceToPriorVertex(gcsa, &mris->vertices[vno]);
+    gcsa->vmap_priors[vno] = v_prior - gcsa->mris_priors->vertices;
+    gcsa->vmap_classifiers[vno] = GCSAsourceToClassifierVertex(gcsa, v_prior) - gcsa->mris_classifiers->vertices;
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+  MHT_maybeParallel_end();
+
+  gcsa->vmap_mris = mris;
+  return (NO_ERROR);
+}
+
+int GCSAfreeVertexMap(GCSA *gcsa)
+{
+  if (gcsa->vmap_priors) free(gcsa->vmap_priors);
+  if (gcsa->vmap_classifiers) free(gcsa->vmap_classifiers);
+  gcsa->vmap_priors = gcsa->vmap_classifiers = NULL;
+  gcsa->vmap_mris = NULL;
+  return (NO_ERROR);
+}
+
+/* cheap signature of the vertex positions a map was computed from */
+static double gcsaVertexMapChecksum(MRI_SURFACE *mris)
+{
+  double sum;
+  int vno;
+
+  for (sum = 0.0, vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX const * const v = &mris->vertices[vno];
+    sum += (1 + vno % 17) * (v->x + 2.0 * v->y + 3.0 * v->z);
+  }
+  return (sum / mris->nvertices);
+}
+
+int GCSAwriteVertexMap(GCSA *gcsa, const char *fname)
+{
+  FILE *fp;
+  int vno;
+
+  if (!gcsa->vmap_mris) ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "GCSAwriteVertexMap(%s): no map computed", fname));
+  fp = fopen(fname, "wb");
+  if (!fp) ErrorReturn(ERROR_NOFILE, (ERROR_NOFILE, "GCSAwriteVertexMap(%s): could not open file", fname));
+
+  fwriteInt(GCSA_VMAP_MAGIC, fp);
+  fwriteInt(gcsa->vmap_mris->nvertices, fp);
+  fwriteInt(gcsa->icno_priors, fp);
+  fwriteInt(gcsa->icno_classifiers, fp);
+  fwriteDouble(gcsaVertexMapChecksum(gcsa->vmap_mris), fp);
+  for (vno = 0; vno < gcsa->vmap_mris->nvertices; vno++) {
+    fwriteInt(gcsa->vmap_priors[vno], fp);
+    fwriteInt(gcsa->vmap_classifiers[vno], fp);
+  }
+  fclose(fp);
+  return (NO_ERROR);
+}
+
+/*
+  Read a map written by GCSAwriteVertexMap for use with mris. Fails
+  (leaving no map) if it was made for a different surface, different
+  vertex positions or atlas icosahedra of different orders.
+*/
+int GCSAreadVertexMap(GCSA *gcsa, MRI_SURFACE *mris, const char *fname)
+{
+  FILE *fp;
+  int vno, magic, nvertices, icno_priors, icno_classifiers;
+  double checksum, expected;
+
+  GCSAfreeVertexMap(gcsa);
+  fp = fopen(fname, "rb");
+  if (!fp) ErrorReturn(ERROR_NOFILE, (ERROR_NOFILE, "GCSAreadVertexMap(%s): could not open file", fname));
+
+  magic = freadInt(fp);
+  nvertices = freadInt(fp);
+  icno_priors = freadInt(fp);
+  icno_classifiers = freadInt(fp);
+  checksum = freadDouble(fp);
+  expected = gcsaVertexMapChecksum(mris);
+  if ((unsigned)magic != GCSA_VMAP_MAGIC || nvertices != mris->nvertices || icno_priors != gcsa->icno_priors ||
+      icno_classifiers != gcsa->icno_classifiers || fabs(checksum - expected) > 1e-6 * (1 + fabs(expected))) {
+    fclose(fp);
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "GCSAreadVertexMap(%s): map does not match surface and atlas", fname));
+  }
+
+  gcsa->vmap_priors = (int *)calloc(nvertices, sizeof(int));
+  gcsa->vmap_classifiers = (int *)calloc(nvertices, sizeof(int));
+  if (!gcsa->vmap_priors || !gcsa->vmap_classifiers)
+    ErrorExit(ERROR_NOMEMORY, "GCSAreadVertexMap: could not allocate %d-vertex map", nvertices);
+  for (vno = 0; vno < nvertices; vno++) {
+    gcsa->vmap_priors[vno] = freadInt(fp);
+    gcsa->vmap_classifiers[vno] = freadInt(fp);
+    if (gcsa->vmap_priors[vno] < 0 || gcsa->vmap_priors[vno] >= gcsa->mris_priors->nvertices ||
+        gcsa->vmap_classifiers[vno] < 0 || gcsa->vmap_classifiers[vno] >= gcsa->mris_classifiers->nvertices)
+      break;
+  }
+  fclose(fp);
+  if (vno < nvertices) {
+    GCSAfreeVertexMap(gcsa);
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "GCSAreadVertexMap(%s): truncated or corrupt map", fname));
+  }
+
+  gcsa->vmap_mris = mris;
+  return (NO_ERROR);
+}
+
+/* prior and classifier node of vertex vno of mris, from the map if there is one */
+static void gcsaSourceToNodes(GCSA *gcsa, MRI_SURFACE *mris, int vno, int *pvno_prior, int *pvno_classifier)
+{
+  if (gcsa->vmap_mris == mris) {
+    *pvno_prior = gcsa->vmap_priors[vno];
+    *pvno_classifier = gcsa->vmap_classifiers[vno];
+    return;
+  }
+
+  VERTEX const * const v_prior = GCSAsourceToPriorVertex(gcsa, &mris->vertices[vno]);
+  *pvno_prior = v_prior - gcsa->mris_priors->vertices;
+  *pvno_classifier = GCSAsourceToClassifierVertex(gcsa, v_prior) - gcsa->mris_classifiers->vertices;
+}
+
 static int GCSAupdateNodeMeans(GCSA_NODE *gcsan, int label, double *v_inputs, int ninputs)
 {
   int n, i;
@@ -783,23 +932,29 @@ int GCSAbuildMostLikelyLabels(GCSA *gcsa, MRI_SURFACE *mris)
 static int Gvno = -1;
 int GCSAlabel(GCSA *gcsa, MRI_SURFACE *mris)
 {
-  int vno, vno_classifier, label, vno_prior;
-  VERTEX *v, *v_classifier, *v_prior;
-  GCSA_NODE *gcsan;
-  CP_NODE *cpn;
-  double v_inputs[100], p;
+  int vno;
 
+  // each vertex is classified independently of the others
+  MHT_maybeParallel_begin();
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 256)
+#endif
   for (vno = 0; vno < mris->nvertices; vno++) {
+    ROMP_PFLB_begin
+    int vno_classifier, label, vno_prior;
+    VERTEX *v;
+    GCSA_NODE *gcsan;
+    CP_NODE *cpn;
+    double v_inputs[100], p;
+
     v = &mris->vertices[vno];
-    if (v->ripflag) continue;
+    if (v->ripflag) ROMP_PF_continue;
     if (vno == Gdiag_no) DiagBreak();
     load_inputs(v, v_inputs, gcsa->ninputs);
 
-    v_prior = GCSAsourceToPriorVertex(gcsa, v);
-    vno_prior = v_prior - gcsa->mris_priors->vertices;
+    gcsaSourceToNodes(gcsa, mris, vno, &vno_prior, &vno_classifier);
     if (vno_prior == Gdiag_no) DiagBreak();
-    v_classifier = GCSAsourceToClassifierVertex(gcsa, v_prior);
-    vno_classifier = v_classifier - gcsa->mris_classifiers->vertices;
     if (vno_classifier == Gdiag_no) DiagBreak();
     gcsan = &gcsa->gc_nodes[vno_classifier];
 
@@ -831,7 +986,10 @@ int GCSAlabel(GCSA *gcsa, MRI_SURFACE *mris)
         MatrixPrint(stdout, gcs->v_means);
       }
     }
+    ROMP_PFLB_end
   }
+  ROMP_PF_end
+  MHT_maybeParallel_end();
 
   return (NO_ERROR);
 }
@@ -843,8 +1001,15 @@ static int GCSANclassify(
   double p, ptotal, max_p, det;
   CP *cp;
   GCS *gcs;
-  static MATRIX *m_cov_inv = NULL;
-  static VECTOR *v_tmp = NULL, *v_x = NULL;
+  static MATRIX *m_cov_inv_tid[_MAX_FS_THREADS];
+  static VECTOR *v_tmp_tid[_MAX_FS_THREADS], *v_x_tid[_MAX_FS_THREADS];
+#ifdef HAVE_OPENMP
+  int const tid = omp_get_thread_num();
+#else
+  int const tid = 0;
+#endif
+  MATRIX *&m_cov_inv = m_cov_inv_tid[tid];
+  VECTOR *&v_tmp = v_tmp_tid[tid], *&v_x = v_x_tid[tid];
 
   if (v_x && ninputs != v_x->rows) {
     MatrixFree(&m_cov_inv);
@@ -1109,16 +1274,128 @@ static int edge_to_index(VERTEX const * const v, VERTEX const * const vn)
 int gcsa_write_iterations = 0;
 char *gcsa_write_fname = NULL;
 
-int GCSAreclassifyUsingGibbsPriors(GCSA *gcsa, MRI_SURFACE *mris)
+/*
+  If set, GCSAreclassifyUsingGibbsPriors visits the vertices to be
+  reexamined in distance-2 color classes instead of a random order, and
+  relabels each class in parallel. Vertices of one class are at least 3
+  edges apart, so none of them reads a label another one can change while
+  the class is updated, and the result does not depend on the number of
+  threads.
+*/
+int gcsa_parallel_gibbs = 0;
+
+/*
+  Relabel a single vertex with the label that maximizes the gibbs
+  likelihood of its neighborhood. Returns 1 if the label changed.
+*/
+static int gcsaGibbsRelabelVertex(GCSA *gcsa, MRI_SURFACE *mris, int vno)
 {
-  int *indices;
-  int n, vno, i, nchanged, label, best_label, old_label, vno_prior, vno_classifier, niter, examined;
+  int n, label, best_label, old_label, vno_prior, vno_classifier;
   double ll, max_ll;
-  // GCSA_NODE *gcsan;
   CP_NODE *cpn;
   double v_inputs[100];
+  VERTEX * const v = &mris->vertices[vno];
+
+  if (vno == Gdiag_no) DiagBreak();
+
+  load_inputs(v, v_inputs, gcsa->ninputs);
+
+  gcsaSourceToNodes(gcsa, mris, vno, &vno_prior, &vno_classifier);
+  if (vno_prior == Gdiag_no) DiagBreak();
+  cpn = &gcsa->cp_nodes[vno_prior];
+  if (cpn->nlabels <= 1) return (0);
+
+  if (vno_classifier == Gdiag_no) DiagBreak();
+
+  best_label = old_label = v->annotation;
+  if (vno == Gdiag_no) printf("reclassifying vertex %d...\n", vno);
+  max_ll = gcsaNbhdGibbsLogLikelihood(gcsa, mris, v_inputs, vno, 1.0, old_label);
+  for (n = 0; n < cpn->nlabels; n++) {
+    label = cpn->labels[n];
+    ll = gcsaNbhdGibbsLogLikelihood(gcsa, mris, v_inputs, vno, 1.0, label);
+    if (vno == Gdiag_no)
+      printf("\tlabel %s (%d, %d): ll=%2.3f\n",
+             annotation_to_name(label, NULL),
+             label,
+             annotation_to_index(label),
+             ll);
+    if (ll > max_ll) {
+      max_ll = ll;
+      best_label = label;
+      if (vno == Gdiag_no) printf("\tlabel %s NEW MAX\n", annotation_to_name(label, NULL));
+    }
+  }
+  if (best_label == old_label) return (0);
+
+  if (vno == Gdiag_no)
+    printf("v %d: label changed from %s (%d) to %s (%d)\n",
+           vno,
+           annotation_to_name(old_label, NULL),
+           old_label,
+           annotation_to_name(best_label, NULL),
+           best_label);
+  v->marked = 1;
+  v->annotation = best_label;
+  return (1);
+}
+
+/*
+  Greedy distance-2 coloring of the vertex graph. On return order[]
+  holds the vertices sorted by color, color c occupying
+  order[color_start[c]] ... order[color_start[c+1]-1]. color_start must
+  have room for mris->nvertices+1 entries. Returns the number of colors.
+*/
+static int gcsaColorVertices(MRI_SURFACE *mris, int *order, int *color_start)
+{
+  int vno, n, m, c, ncolors, max_vnum, max_colors, *colors, *used;
+
+  for (max_vnum = vno = 0; vno < mris->nvertices; vno++)
+    max_vnum = MAX(max_vnum, mris->vertices_topology[vno].vnum);
+  max_colors = 1 + max_vnum + max_vnum * max_vnum;
+
+  colors = (int *)calloc(mris->nvertices, sizeof(int));
+  used = (int *)calloc(max_colors, sizeof(int));
+  if (!colors || !used) ErrorExit(ERROR_NOMEMORY, "gcsaColorVertices: could not allocate %d colors", mris->nvertices);
+  for (c = 0; c < max_colors; c++) used[c] = -1;
+
+  for (ncolors = vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
+    for (n = 0; n < vt->vnum; n++) {
+      VERTEX_TOPOLOGY const * const vnt = &mris->vertices_topology[vt->v[n]];
+      if (vt->v[n] < vno) used[colors[vt->v[n]]] = vno;
+      for (m = 0; m < vnt->vnum; m++)
+        if (vnt->v[m] < vno) used[colors[vnt->v[m]]] = vno;
+    }
+    for (c = 0; used[c] == vno; c++)
+      ;
+    colors[vno] = c;
+    ncolors = MAX(ncolors, c + 1);
+  }
+
+  // counting sort by color, vertex order kept within a color
+  memset(color_start, 0, (ncolors + 1) * sizeof(int));
+  for (vno = 0; vno < mris->nvertices; vno++) color_start[colors[vno] + 1]++;
+  for (c = 0; c < ncolors; c++) color_start[c + 1] += color_start[c];
+  for (c = 0; c < ncolors; c++) used[c] = color_start[c];
+  for (vno = 0; vno < mris->nvertices; vno++) order[used[colors[vno]]++] = vno;
+
+  free(used);
+  free(colors);
+  return (ncolors);
+}
+
+int GCSAreclassifyUsingGibbsPriors(GCSA *gcsa, MRI_SURFACE *mris)
+{
+  int *indices, *color_start = NULL, *active = NULL;
+  int n, vno, i, nchanged, niter, examined, ncolors = 0;
 
   indices = (int *)calloc(mris->nvertices, sizeof(int));
+  if (gcsa_parallel_gibbs) {
+    color_start = (int *)calloc(mris->nvertices + 1, sizeof(int));
+    active = (int *)calloc(mris->nvertices, sizeof(int));
+    ncolors = gcsaColorVertices(mris, indices, color_start);
+    printf("relabeling %d vertex color classes in parallel\n", ncolors);
+  }
 
   niter = 0;
   if (gcsa_write_iterations != 0) {
@@ -1133,58 +1410,39 @@ int GCSAreclassifyUsingGibbsPriors(GCSA *gcsa, MRI_SURFACE *mris)
   do {
     nchanged = 0;
     examined = 0;
-    MRIScomputeVertexPermutation(mris, indices);
-    for (i = 0; i < mris->nvertices; i++) {
-      vno = indices[i];
-      VERTEX* const v = &mris->vertices[vno];
-      if (v->marked == 0) continue;
-      v->marked = 0;
-      examined++;
-
-      if (vno == Gdiag_no) DiagBreak();
-
-      load_inputs(v, v_inputs, gcsa->ninputs);
-
-      VERTEX const * const v_prior = GCSAsourceToPriorVertex(gcsa, v);
-      vno_prior = v_prior - gcsa->mris_priors->vertices;
-      if (vno_prior == Gdiag_no) DiagBreak();
-      cpn = &gcsa->cp_nodes[vno_prior];
-      if (cpn->nlabels <= 1) continue;
-
-      VERTEX const * const v_classifier = GCSAsourceToClassifierVertex(gcsa, v_prior);
-      vno_classifier = v_classifier - gcsa->mris_classifiers->vertices;
-      // gcsan = &gcsa->gc_nodes[vno_classifier];
-      if (vno_classifier == Gdiag_no) DiagBreak();
-
-      best_label = old_label = v->annotation;
-      if (vno == Gdiag_no) printf("reclassifying vertex %d...\n", vno);
-      max_ll = gcsaNbhdGibbsLogLikelihood(gcsa, mris, v_inputs, vno, 1.0, old_label);
-      for (n = 0; n < cpn->nlabels; n++) {
-        label = cpn->labels[n];
-        ll = gcsaNbhdGibbsLogLikelihood(gcsa, mris, v_inputs, vno, 1.0, label);
-        if (vno == Gdiag_no)
-          printf("\tlabel %s (%d, %d): ll=%2.3f\n",
-                 annotation_to_name(label, NULL),
-                 label,
-                 annotation_to_index(label),
-                 ll);
-        if (ll > max_ll) {
-          max_ll = ll;
-          best_label = label;
-          if (vno == Gdiag_no) printf("\tlabel %s NEW MAX\n", annotation_to_name(label, NULL));
+    if (gcsa_parallel_gibbs) {
+      int c, nactive;
+
+      MHT_maybeParallel_begin();
+      for (c = 0; c < ncolors; c++) {
+        // only the marked vertices of this class
+        for (nactive = 0, i = color_start[c]; i < color_start[c + 1]; i++)
+          if (mris->vertices[indices[i]].marked) active[nactive++] = indices[i];
+        examined += nactive;
+
+        ROMP_PF_begin
+#ifdef HAVE_OPENMP
+        #pragma omp parallel for if_ROMP(assume_reproducible) reduction(+ : nchanged) schedule(dynamic, 64)
+#endif
+        for (i = 0; i < nactive; i++) {
+          ROMP_PFLB_begin
+          mris->vertices[active[i]].marked = 0;
+          nchanged += gcsaGibbsRelabelVertex(gcsa, mris, active[i]);
+          ROMP_PFLB_end
         }
+        ROMP_PF_end
       }
-      if (best_label != old_label) {
-        if (vno == Gdiag_no)
-          printf("v %d: label changed from %s (%d) to %s (%d)\n",
-                 vno,
-                 annotation_to_name(old_label, NULL),
-                 old_label,
-                 annotation_to_name(best_label, NULL),
-                 best_label);
-        v->marked = 1;
-        nchanged++;
-        v->annotation = best_label;
+      MHT_maybeParallel_end();
+    }
+    else {
+      MRIScomputeVertexPermutation(mris, indices);
+      for (i = 0; i < mris->nvertices; i++) {
+        vno = indices[i];
+        VERTEX* const v = &mris->vertices[vno];
+        if (v->marked == 0) continue;
+        v->marked = 0;
+        examined++;
+        nchanged += gcsaGibbsRelabelVertex(gcsa, mris, vno);
       }
     }
     printf("%03d: %6d changed, %d examined...\n", niter, nchanged, examined);
@@ -1207,6 +1465,8 @@ int GCSAreclassifyUsingGibbsPriors(GCSA *gcsa, MRI_SURFACE *mris)
     }
   } while (nchanged > MIN_CHANGED);
 
+  if (active) free(active);
+  if (color_start) free(color_start);
   free(indices);
   return (NO_ERROR);
 }
@@ -1258,8 +1518,15 @@ static double gcsaVertexGibbsLogLikelihood(
     int            const vno, 
     double  	   const gibbs_coef)
 {
-  static MATRIX *m_cov_inv = NULL;
-  static VECTOR *v_tmp = NULL, *v_x = NULL;
+  static MATRIX *m_cov_inv_tid[_MAX_FS_THREADS];
+  static VECTOR *v_tmp_tid[_MAX_FS_THREADS], *v_x_tid[_MAX_FS_THREADS];
+#ifdef HAVE_OPENMP
+  int const tid = omp_get_thread_num();
+#else
+  int const tid = 0;
+#endif
+  MATRIX *&m_cov_inv = m_cov_inv_tid[tid];
+  VECTOR *&v_tmp = v_tmp_tid[tid], *&v_x = v_x_tid[tid];
 
   if (v_x && gcsa->ninputs != v_x->cols) {
     MatrixFree(&m_cov_inv);
@@ -1270,16 +1537,12 @@ static double gcsaVertexGibbsLogLikelihood(
   VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
   VERTEX          const * const v  = &mris->vertices         [vno];
 
-  VERTEX const * const v_prior = GCSAsourceToPriorVertex(gcsa, v);
-  int const vno_prior = v_prior - gcsa->mris_priors->vertices;
+  int vno_prior, vno_classifier;
+  gcsaSourceToNodes(gcsa, mris, vno, &vno_prior, &vno_classifier);
   if (vno_prior == Gdiag_no) DiagBreak();
 
   CP_NODE * const cpn = &gcsa->cp_nodes[vno_prior];
 
-  VERTEX const * const v_classifier = 
-    GCSAsourceToClassifierVertex(gcsa, v_prior);
-    
-  int const vno_classifier = v_classifier - gcsa->mris_classifiers->vertices;
   if (vno_classifier == Gdiag_no) DiagBreak();
 
   GCSA_NODE * const gcsan = &gcsa->gc_nodes[vno_classifier];
@@ -2057,7 +2320,7 @@ int gcsaFixSingularCovarianceMatrices(GCSA *gcsa)
 int GCSArelabelWithAseg(GCSA *gcsa, MRI_SURFACE *mris, MRI *mri_aseg)
 {
   int old_index, vno, vno_classifier, vno_prior, label, index, changed, cc_annotation;
-  VERTEX *v, *v_classifier, *v_prior;
+  VERTEX *v;
   GCSA_NODE *gcsan;
   CP_NODE *cpn;
   double v_inputs[100], p;
@@ -2071,11 +2334,8 @@ int GCSArelabelWithAseg(GCSA *gcsa, MRI_SURFACE *mris, MRI *mri_aseg)
     label = (int)MRIgetVoxVal(mri_aseg, nint(x), nint(y), nint(z), 0);
 
     load_inputs(v, v_inputs, gcsa->ninputs);
-    v_prior = GCSAsourceToPriorVertex(gcsa, v);
-    vno_prior = v_prior - gcsa->mris_priors->vertices;
+    gcsaSourceToNodes(gcsa, mris, vno, &vno_prior, &vno_classifier);
     if (vno_prior == Gdiag_no) DiagBreak();
-    v_classifier = GCSAsourceToClassifierVertex(gcsa, v_prior);
-    vno_classifier = v_classifier - gcsa->mris_classifiers->vertices;
     if (vno_classifier == Gdiag_no) DiagBreak();
     gcsan = &gcsa->gc_nodes[vno_classifier];
 
@@ -2114,7 +2374,7 @@ int GCSArelabelWithAseg(GCSA *gcsa, MRI_SURFACE *mris, MRI *mri_aseg)
 int GCSAreclassifyMarked(GCSA *gcsa, MRI_SURFACE *mris, int mark, int *exclude_list, int nexcluded)
 {
   int old_index, vno, vno_classifier, vno_prior, label, index, changed, num, n;
-  VERTEX *v, *v_classifier, *v_prior, *vn;
+  VERTEX *v, *vn;
   GCSA_NODE *gcsan;
   CP_NODE *cpn;
   double v_inputs[100], p;
@@ -2125,11 +2385,8 @@ int GCSAreclassifyMarked(GCSA *gcsa, MRI_SURFACE *mris, int mark, int *exclude_l
     if (vno == Gdiag_no) DiagBreak();
 
     load_inputs(v, v_inputs, gcsa->ninputs);
-    v_prior = GCSAsourceToPriorVertex(gcsa, v);
-    vno_prior = v_prior - gcsa->mris_priors->vertices;
+    gcsaSourceToNodes(gcsa, mris, vno, &vno_prior, &vno_classifier);
     if (vno_prior == Gdiag_no) DiagBreak();
-    v_classifier = GCSAsourceToClassifierVertex(gcsa, v_prior);
-    vno_classifier = v_classifier - gcsa->mris_classifiers->vertices;
     if (vno_classifier == Gdiag_no) DiagBreak();
     gcsan = &gcsa->gc_nodes[vno_classifier];
 
@@ -49,6 +49,8 @@
 
 #include "romp_support.h"
 
+static int GTMSPXsetRange(GTMSPX *X);
+
 
 /*------------------------------------------------------------------------------------*/
 int GTMSEGprint(GTMSEG *gtmseg, FILE *fp)
@@ -868,7 +870,8 @@ int GTMfree(GTM **pGTM)
   MRIfree(&gtm->yvol);
   // MRIfree(&gtm->gtmseg);
   MRIfree(&gtm->mask);
-  MatrixFree(&gtm->X);
+  GTMfreeX(gtm, 0);
+  GTMfreeX(gtm, 1);
   MatrixFree(&gtm->y);
   MatrixFree(&gtm->XtX);
   MatrixFree(&gtm->iXtX);
@@ -933,13 +936,14 @@ int GTMsegidlist(GTM *gtm)
 /*
   \fn GTM *GTMalloc()
   \brief Allocates the GTM structure but nothing in the structure.
-   sets PadThresh = .0001;
+   sets PadThresh = .0001 and UseSparseX = 1;
 */
 GTM *GTMalloc()
 {
   GTM *gtm;
   gtm = (GTM *)calloc(sizeof(GTM), 1);
   gtm->PadThresh = .0001;
+  gtm->UseSparseX = 1;
   return (gtm);
 }
 /*------------------------------------------------------------------*/
@@ -981,14 +985,17 @@ int GTMnPad(GTM *gtm)
   \brief Solves the GTM using a GLM. X must already have been created.
   Computes Xt, XtX, iXtX, beta, yhat, res, dof, rvar, kurtosis, and skew.
   Also will rescale if rescaling. Returns 1 and computes condition
-  number if matrix cannot be inverted. Otherwise returns 0.
+  number if matrix cannot be inverted. Otherwise returns 0. XtX is
+  only nsegs-by-nsegs, so it is inverted once and applied to all the
+  frames of y at the same time. If X is sparse, XtX, Xty, and yhat
+  only visit the non-zero entries of X.
 */
 int GTMsolve(GTM *gtm)
 {
   int n, f;
   double sum;
 
-  if (gtm->X == NULL) {
+  if (!GTMhaveX(gtm, 0)) {
     printf("ERROR: GTMsolve(): must build design matrix first\n");
     exit(1);
   }
@@ -996,7 +1003,7 @@ int GTMsolve(GTM *gtm)
   if (!gtm->Optimizing) printf("Computing  XtX ... ");
   fflush(stdout);
   Timer timer;
-  gtm->XtX = MatrixMtM(gtm->X, gtm->XtX);
+  gtm->XtX = GTMxtx(gtm, 0, 0, gtm->XtX);
   if (!gtm->Optimizing) printf(" %4.1f sec\n", timer.seconds());
   fflush(stdout);
 
@@ -1007,15 +1014,18 @@ int GTMsolve(GTM *gtm)
     printf("ERROR: matrix cannot be inverted, cond=%g\n", gtm->XtXcond);
     return (1);
   }
-  gtm->Xty = MatrixAtB(gtm->X, gtm->y, gtm->Xty);
+  if (gtm->Xs)
+    gtm->Xty = GTMSPXtB(gtm->Xs, gtm->y, gtm->Xty);
+  else
+    gtm->Xty = MatrixAtB(gtm->X, gtm->y, gtm->Xty);
   gtm->beta = MatrixMultiplyD(gtm->iXtX, gtm->Xty, gtm->beta);
   if (gtm->rescale) GTMrescale(gtm);
   GTMrefTAC(gtm);
   if (gtm->DoSteadyState) GTMsteadyState(gtm);
 
-  gtm->yhat = MatrixMultiplyD(gtm->X, gtm->beta, gtm->yhat);
+  gtm->yhat = GTMxMultiply(gtm, 0, gtm->beta, gtm->yhat);
   gtm->res = MatrixSubtract(gtm->y, gtm->yhat, gtm->res);
-  gtm->dof = gtm->X->rows - gtm->X->cols;
+  gtm->dof = gtm->nmask - gtm->nsegs;
   if (gtm->rvar == NULL) gtm->rvar = MatrixAlloc(1, gtm->res->cols, MATRIX_REAL);
   if (gtm->rvarUnscaled == NULL) gtm->rvarUnscaled = MatrixAlloc(1, gtm->res->cols, MATRIX_REAL);
   for (f = 0; f < gtm->res->cols; f++) {
@@ -1538,7 +1548,7 @@ int GTMrbv0(GTM *gtm)
 MRI *GTMmgxpvc(GTM *gtm, int Target)
 {
   int nthseg, segid, r, f, tt;
-  MATRIX *betaNotTarg, *yNotTarg, *ydiff;
+  MATRIX *betaNotTarg, *yNotTarg, *ydiff, *ind, *frac;
   double sum;
   MRI *mgx=NULL;
   COLOR_TABLE_ENTRY *cte;
@@ -1571,28 +1581,29 @@ MRI *GTMmgxpvc(GTM *gtm, int Target)
   }
 
   // Compute the estimate of the image without the target
-  yNotTarg = MatrixMultiplyD(gtm->X, betaNotTarg, NULL);
+  yNotTarg = GTMxMultiply(gtm, 0, betaNotTarg, NULL);
   // Subtract to resdiualize the PET wrt the non-target tissue
   ydiff = MatrixSubtract(gtm->y, yNotTarg, NULL);
 
-  // Scale by the fraction of target tissue type in voxel
-  for (r = 0; r < gtm->X->rows; r++) {
-    sum = 0;
-    for (nthseg = 0; nthseg < gtm->nsegs; nthseg++) {
-      segid = gtm->segidlist[nthseg];
-      tt = gtm->ctGTMSeg->entries[segid]->TissueType;
-      cte = gtm->ctGTMSeg->ctabTissueType->entries[tt];
-      if(Target == 1){ // asking for cortex
+  // Scale by the fraction of target tissue type in voxel, ie, the sum
+  // of X over the target segs, computed as X*ind where ind is 1 for
+  // target segs
+  ind = MatrixAlloc(gtm->nsegs, 1, MATRIX_REAL);
+  for (nthseg = 0; nthseg < gtm->nsegs; nthseg++) {
+    segid = gtm->segidlist[nthseg];
+    tt = gtm->ctGTMSeg->entries[segid]->TissueType;
+    cte = gtm->ctGTMSeg->ctabTissueType->entries[tt];
+    if(Target == 1){ // asking for cortex
 	if(strcmp("cortex",cte->name)!=0 &&
 	   strcmp("cortex-lh",cte->name)!=0 &&
 	   strcmp("cortex-rh",cte->name)!=0) continue; // but this is not cortex
-      }
-      if(Target == 2){ // asking for subcort
+    }
+    if(Target == 2){ // asking for subcort
 	if(strcmp("subcort_gm",cte->name)!=0 && 
 	   strcmp("subcort_gm-lh",cte->name)!=0 &&
 	   strcmp("subcort_gm-rh",cte->name)!=0) continue; // but this is not subcort
-      }
-      if(Target == 3){ // asking for any GM
+    }
+    if(Target == 3){ // asking for any GM
 	if(strcmp("cortex",cte->name)!=0 &&
 	   strcmp("cortex-lh",cte->name)!=0 &&
 	   strcmp("cortex-rh",cte->name)!=0 &&
@@ -1600,16 +1611,19 @@ MRI *GTMmgxpvc(GTM *gtm, int Target)
 	   strcmp("subcort_gm-lh",cte->name)!=0 &&
 	   strcmp("subcort_gm-rh",cte->name)!=0 &&
 	   strcmp("subcort_gm-mid",cte->name)!=0) continue; // but this is not GM
-      }
-      if(Target == 4 && strcmp("cortex-lh",cte->name)!=0) continue;
-      if(Target == 5 && strcmp("cortex-rh",cte->name)!=0) continue;
-      if(Target == 6 && strcmp("subcort_gm-lh",cte->name)!=0) continue;
-      if(Target == 7 && strcmp("subcort_gm-rh",cte->name)!=0) continue;
-      if(Target == 8 && strcmp("subcort_gm-mid",cte->name)!=0) continue;
-
-      // otherwise
-      sum += gtm->X->rptr[r+1][nthseg+1];
     }
+    if(Target == 4 && strcmp("cortex-lh",cte->name)!=0) continue;
+    if(Target == 5 && strcmp("cortex-rh",cte->name)!=0) continue;
+    if(Target == 6 && strcmp("subcort_gm-lh",cte->name)!=0) continue;
+    if(Target == 7 && strcmp("subcort_gm-rh",cte->name)!=0) continue;
+    if(Target == 8 && strcmp("subcort_gm-mid",cte->name)!=0) continue;
+
+    // otherwise
+    ind->rptr[nthseg+1][1] = 1;
+  }
+  frac = GTMxMultiply(gtm, 0, ind, NULL);
+  for (r = 0; r < gtm->nmask; r++) {
+    sum = frac->rptr[r + 1][1];
     if (sum < gtm->mgx_gmthresh)
       for (f = 0; f < gtm->nframes; f++) ydiff->rptr[r + 1][f + 1] = 0;
     else
@@ -1622,6 +1636,8 @@ MRI *GTMmgxpvc(GTM *gtm, int Target)
   MatrixFree(&betaNotTarg);
   MatrixFree(&yNotTarg);
   MatrixFree(&ydiff);
+  MatrixFree(&ind);
+  MatrixFree(&frac);
 
   return(mgx);
 }
@@ -1840,7 +1856,7 @@ int GTMsynth(GTM *gtm, int NoiseSeed, int nReps)
     MRIcopyHeader(gtm->yvol, gtm->ysynth);
     MRIcopyPulseParameters(gtm->yvol, gtm->ysynth);
   }
-  yhat = MatrixMultiply(gtm->X0, gtm->beta, NULL);
+  yhat = GTMxMultiply(gtm, 1, gtm->beta, NULL);
   GTMmat2vol(gtm, yhat, gtm->ysynth);
   MatrixFree(&yhat);
 
@@ -1918,30 +1934,67 @@ int GTMcheckX(MATRIX *X)
 /*
   \fn int GTMbuildX(GTM *gtm)
   \brief Builds the GTM design matrix both with (X) and without (X0) PSF.  If
-  gtm->DoVoxFracCor=1 then corrects for volume fraction effect.
+  gtm->DoVoxFracCor=1 then corrects for volume fraction effect. If
+  gtm->UseSparseX=1, then X and X0 are stored in sparse form in Xs and
+  X0s (see GTMSPX) and gtm->X and gtm->X0 are not allocated. Only the
+  voxels in the padded bounding box of a seg can be non-zero in its
+  column, so nothing outside of the box is ever stored or visited.
+  Returns 0 if no errors, non-zero otherwise.
 */
 int GTMbuildX(GTM *gtm)
 {
-  int nthseg, err;
-
-  if (gtm->X == NULL || gtm->X->rows != gtm->nmask || gtm->X->cols != gtm->nsegs) {
-    // Alloc or realloc X
-    if (gtm->X) MatrixFree(&gtm->X);
-    gtm->X = MatrixAlloc(gtm->nmask, gtm->nsegs, MATRIX_REAL);
-    if (gtm->X == NULL) {
-      printf("ERROR: GTMbuildX(): could not alloc X %d %d\n", gtm->nmask, gtm->nsegs);
-      return (1);
+  int nthseg, err, *rowmap = NULL, nvox, width, height, depth;
+  int **segrow = NULL, *segnnz = NULL;
+  float **segx = NULL, **segx0 = NULL;
+
+  width = gtm->yvol->width;
+  height = gtm->yvol->height;
+  depth = gtm->yvol->depth;
+
+  if (gtm->UseSparseX) {
+    // Map each voxel to its row in X (or -1 if not in the mask). This
+    // keeps the row order the same as GTMvol2mat().
+    int k, c, r, s;
+    GTMfreeX(gtm, 0);
+    GTMfreeX(gtm, 1);
+    nvox = width * height * depth;
+    rowmap = (int *)calloc(nvox, sizeof(int));
+    k = 0;
+    for (s = 0; s < depth; s++) {
+      for (c = 0; c < width; c++) {
+        for (r = 0; r < height; r++) {
+          if (gtm->mask && MRIgetVoxVal(gtm->mask, c, r, s, 0) < 0.5)
+            rowmap[(s * width + c) * height + r] = -1;
+          else
+            rowmap[(s * width + c) * height + r] = k++;
+        }
+      }
     }
-  }
-  if (gtm->X0 == NULL || gtm->X0->rows != gtm->nmask || gtm->X0->cols != gtm->nsegs) {
-    if (gtm->X0) MatrixFree(&gtm->X0);
-    gtm->X0 = MatrixAlloc(gtm->nmask, gtm->nsegs, MATRIX_REAL);
-    if (gtm->X0 == NULL) {
-      printf("ERROR: GTMbuildX(): could not alloc X0 %d %d\n", gtm->nmask, gtm->nsegs);
-      return (1);
+    segrow = (int **)calloc(gtm->nsegs, sizeof(int *));
+    segx = (float **)calloc(gtm->nsegs, sizeof(float *));
+    segx0 = (float **)calloc(gtm->nsegs, sizeof(float *));
+    segnnz = (int *)calloc(gtm->nsegs, sizeof(int));
+  }
+  else {
+    if (gtm->X == NULL || gtm->X->rows != gtm->nmask || gtm->X->cols != gtm->nsegs) {
+      // Alloc or realloc X
+      if (gtm->X) MatrixFree(&gtm->X);
+      gtm->X = MatrixAlloc(gtm->nmask, gtm->nsegs, MATRIX_REAL);
+      if (gtm->X == NULL) {
+        printf("ERROR: GTMbuildX(): could not alloc X %d %d\n", gtm->nmask, gtm->nsegs);
+        return (1);
+      }
+    }
+    if (gtm->X0 == NULL || gtm->X0->rows != gtm->nmask || gtm->X0->cols != gtm->nsegs) {
+      if (gtm->X0) MatrixFree(&gtm->X0);
+      gtm->X0 = MatrixAlloc(gtm->nmask, gtm->nsegs, MATRIX_REAL);
+      if (gtm->X0 == NULL) {
+        printf("ERROR: GTMbuildX(): could not alloc X0 %d %d\n", gtm->nmask, gtm->nsegs);
+        return (1);
+      }
     }
   }
-  gtm->dof = gtm->X->rows - gtm->X->cols;
+  gtm->dof = gtm->nmask - gtm->nsegs;
 
   Timer timer;
 
@@ -1953,7 +2006,7 @@ int GTMbuildX(GTM *gtm)
   for (nthseg = 0; nthseg < gtm->nsegs; nthseg++) {
     ROMP_PFLB_begin
     
-    int segid, k, c, r, s;
+    int segid, k, c, r, s, c1, c2, r1, r2, s1, s2, n, nmax;
     MRI *nthsegpvf = NULL, *nthsegpvfbb = NULL, *nthsegpvfbbsm = NULL, *nthsegpvfbbsmmb = NULL;
     MRI_REGION *region;
     MB2D *mb;
@@ -1972,7 +2025,8 @@ int GTMbuildX(GTM *gtm)
           "into the input space. \nCheck %s/aux/seg.nii.gz and the registration\n",
           gtm->OutDir);
       err++;
-      continue;
+      MRIfree(&nthsegpvf);
+      ROMP_PFLB_continue;
     }
     nthsegpvfbb = MRIextractRegion(nthsegpvf, NULL, region);  // extract BB
     if (nthsegpvfbb == NULL) {
@@ -1982,7 +2036,8 @@ int GTMbuildX(GTM *gtm)
           "into the input space. \nCheck %s/aux/seg.nii.gz and the registration\n",
           gtm->OutDir);
       err++;
-      continue;
+      MRIfree(&nthsegpvf);
+      ROMP_PFLB_continue;
     }
     nthsegpvfbbsm = MRIgaussianSmoothNI(nthsegpvfbb, gtm->cStd, gtm->rStd, gtm->sStd, NULL);
     if (gtm->UseMBrad) {
@@ -2005,22 +2060,53 @@ int GTMbuildX(GTM *gtm)
       nthsegpvfbbsm = nthsegpvfbbsmmb;
       MB2Dfree(&mb);
     }
-    // Fill X, creating X in this order makes it consistent with matlab
-    // Note: y must be ordered in the same way. See GTMvol2mat()
-    k = 0;
-    for (s = 0; s < gtm->yvol->depth; s++) {
-      for (c = 0; c < gtm->yvol->width; c++) {
-        for (r = 0; r < gtm->yvol->height; r++) {
-          if (gtm->mask && MRIgetVoxVal(gtm->mask, c, r, s, 0) < 0.5) continue;
-          k++;  // have to incr here in case continue below
-          if (c < region->x || c >= region->x + region->dx) continue;
-          if (r < region->y || r >= region->y + region->dy) continue;
-          if (s < region->z || s >= region->z + region->dz) continue;
-          // do not use k+1 here because it has already been incr above
-          if (!gtm->Optimizing)
-            gtm->X0->rptr[k][nthseg + 1] = MRIgetVoxVal(nthsegpvfbb, c - region->x, r - region->y, s - region->z, 0);
-
-          gtm->X->rptr[k][nthseg + 1] = MRIgetVoxVal(nthsegpvfbbsm, c - region->x, r - region->y, s - region->z, 0);
+    if (gtm->UseSparseX) {
+      // Only visit the bounding box. Going in s, c, r order keeps the
+      // rows of this column sorted.
+      c1 = MAX(region->x, 0);
+      c2 = MIN(region->x + region->dx, width);
+      r1 = MAX(region->y, 0);
+      r2 = MIN(region->y + region->dy, height);
+      s1 = MAX(region->z, 0);
+      s2 = MIN(region->z + region->dz, depth);
+      nmax = MAX(c2 - c1, 0) * MAX(r2 - r1, 0) * MAX(s2 - s1, 0);
+      segrow[nthseg] = (int *)calloc(MAX(nmax, 1), sizeof(int));
+      segx[nthseg] = (float *)calloc(MAX(nmax, 1), sizeof(float));
+      if (!gtm->Optimizing) segx0[nthseg] = (float *)calloc(MAX(nmax, 1), sizeof(float));
+      n = 0;
+      for (s = s1; s < s2; s++) {
+        for (c = c1; c < c2; c++) {
+          for (r = r1; r < r2; r++) {
+            k = rowmap[(s * width + c) * height + r];
+            if (k < 0) continue;
+            segrow[nthseg][n] = k;
+            segx[nthseg][n] = MRIgetVoxVal(nthsegpvfbbsm, c - region->x, r - region->y, s - region->z, 0);
+            if (!gtm->Optimizing)
+              segx0[nthseg][n] = MRIgetVoxVal(nthsegpvfbb, c - region->x, r - region->y, s - region->z, 0);
+            n++;
+          }
+        }
+      }
+      segnnz[nthseg] = n;
+    }
+    else {
+      // Fill X, creating X in this order makes it consistent with matlab
+      // Note: y must be ordered in the same way. See GTMvol2mat()
+      k = 0;
+      for (s = 0; s < depth; s++) {
+        for (c = 0; c < width; c++) {
+          for (r = 0; r < height; r++) {
+            if (gtm->mask && MRIgetVoxVal(gtm->mask, c, r, s, 0) < 0.5) continue;
+            k++;  // have to incr here in case continue below
+            if (c < region->x || c >= region->x + region->dx) continue;
+            if (r < region->y || r >= region->y + region->dy) continue;
+            if (s < region->z || s >= region->z + region->dz) continue;
+            // do not use k+1 here because it has already been incr above
+            if (!gtm->Optimizing)
+              gtm->X0->rptr[k][nthseg + 1] = MRIgetVoxVal(nthsegpvfbb, c - region->x, r - region->y, s - region->z, 0);
+
+            gtm->X->rptr[k][nthseg + 1] = MRIgetVoxVal(nthsegpvfbbsm, c - region->x, r - region->y, s - region->z, 0);
+          }
         }
       }
     }
@@ -2031,14 +2117,416 @@ int GTMbuildX(GTM *gtm)
     ROMP_PFLB_end
   }
   ROMP_PF_end
+
+  if (gtm->UseSparseX) {
+    // Pack the columns into CSC form
+    long nnz = 0, m;
+    int n;
+    if (!err) {
+      for (nthseg = 0; nthseg < gtm->nsegs; nthseg++) nnz += segnnz[nthseg];
+      gtm->Xs = GTMSPXalloc(gtm->nmask, gtm->nsegs, nnz);
+      if (!gtm->Optimizing) gtm->X0s = GTMSPXalloc(gtm->nmask, gtm->nsegs, nnz);
+      m = 0;
+      for (nthseg = 0; nthseg < gtm->nsegs; nthseg++) {
+        gtm->Xs->colptr[nthseg] = m;
+        for (n = 0; n < segnnz[nthseg]; n++) {
+          gtm->Xs->rowind[m + n] = segrow[nthseg][n];
+          gtm->Xs->val[m + n] = segx[nthseg][n];
+        }
+        if (!gtm->Optimizing) {
+          gtm->X0s->colptr[nthseg] = m;
+          memcpy(&gtm->X0s->rowind[m], segrow[nthseg], segnnz[nthseg] * sizeof(int));
+          memcpy(&gtm->X0s->val[m], segx0[nthseg], segnnz[nthseg] * sizeof(float));
+        }
+        m += segnnz[nthseg];
+      }
+      gtm->Xs->colptr[gtm->nsegs] = m;
+      if (!gtm->Optimizing) gtm->X0s->colptr[gtm->nsegs] = m;
+      GTMSPXsetRange(gtm->Xs);
+      if (!gtm->Optimizing) GTMSPXsetRange(gtm->X0s);
+      if (!gtm->Optimizing)
+        printf(" Sparse X nnz = %ld (%5.2f%% of %ldx%d)\n", nnz,
+               100.0 * nnz / ((double)gtm->nmask * gtm->nsegs), (long)gtm->nmask, gtm->nsegs);
+    }
+    for (nthseg = 0; nthseg < gtm->nsegs; nthseg++) {
+      free(segrow[nthseg]);
+      free(segx[nthseg]);
+      free(segx0[nthseg]);
+    }
+    free(segrow);
+    free(segx);
+    free(segx0);
+    free(segnnz);
+    free(rowmap);
+  }
   
   if (!gtm->Optimizing) printf(" Build time %6.4f, err = %d\n", timer.seconds(), err);
   fflush(stdout);
-  if (err) gtm->X = NULL;
+  if (err) {
+    if (gtm->UseSparseX) {
+      GTMfreeX(gtm, 0);
+      GTMfreeX(gtm, 1);
+    }
+    else
+      gtm->X = NULL;
+    return (err);
+  }
 
   return (0);
 }
 
+/*------------------------------------------------------------------------------*/
+/*
+  \fn GTMSPX *GTMSPXalloc(int rows, int cols, long nnz)
+  \brief Allocates a sparse GTM design matrix with room for nnz entries.
+*/
+GTMSPX *GTMSPXalloc(int rows, int cols, long nnz)
+{
+  GTMSPX *X;
+  X = (GTMSPX *)calloc(sizeof(GTMSPX), 1);
+  X->rows = rows;
+  X->cols = cols;
+  X->nnz = nnz;
+  X->colptr = (long *)calloc(cols + 1, sizeof(long));
+  X->rowind = (int *)calloc(MAX(nnz, 1), sizeof(int));
+  X->val = (float *)calloc(MAX(nnz, 1), sizeof(float));
+  X->rowmin = (int *)calloc(cols, sizeof(int));
+  X->rowmax = (int *)calloc(cols, sizeof(int));
+  if (X->colptr == NULL || X->rowind == NULL || X->val == NULL) {
+    printf("ERROR: GTMSPXalloc(): could not alloc %d %d %ld\n", rows, cols, nnz);
+    GTMSPXfree(&X);
+    return (NULL);
+  }
+  return (X);
+}
+/*------------------------------------------------------------------------------*/
+/*
+  \fn int GTMSPXfree(GTMSPX **pX)
+  \brief Frees a sparse GTM design matrix.
+*/
+int GTMSPXfree(GTMSPX **pX)
+{
+  GTMSPX *X = *pX;
+  if (X == NULL) return (0);
+  free(X->colptr);
+  free(X->rowind);
+  free(X->val);
+  free(X->rowmin);
+  free(X->rowmax);
+  free(X);
+  *pX = NULL;
+  return (0);
+}
+/*------------------------------------------------------------------------------*/
+/*
+  \fn static int GTMSPXsetRange(GTMSPX *X)
+  \brief Sets the first and last row of each column. Used by GTMSPXtSPX()
+  to skip pairs of columns whose bounding boxes do not overlap.
+*/
+static int GTMSPXsetRange(GTMSPX *X)
+{
+  int c;
+  for (c = 0; c < X->cols; c++) {
+    if (X->colptr[c + 1] > X->colptr[c]) {
+      X->rowmin[c] = X->rowind[X->colptr[c]];
+      X->rowmax[c] = X->rowind[X->colptr[c + 1] - 1];
+    }
+    else {
+      X->rowmin[c] = X->rows;
+      X->rowmax[c] = -1;
+    }
+  }
+  return (0);
+}
+/*------------------------------------------------------------------------------*/
+/*
+  \fn MATRIX *GTMSPXtoMatrix(GTMSPX *X, MATRIX *M)
+  \brief Expands a sparse GTM design matrix into a dense MATRIX (eg, for
+  saving to a file).
+*/
+MATRIX *GTMSPXtoMatrix(GTMSPX *X, MATRIX *M)
+{
+  int c;
+  long n;
+  if (M == NULL) {
+    M = MatrixAlloc(X->rows, X->cols, MATRIX_REAL);
+    if (M == NULL) {
+      printf("ERROR: GTMSPXtoMatrix(): could not alloc %d %d\n", X->rows, X->cols);
+      return (NULL);
+    }
+  }
+  else
+    MatrixZero(M->rows, M->cols, M);
+  for (c = 0; c < X->cols; c++)
+    for (n = X->colptr[c]; n < X->colptr[c + 1]; n++) M->rptr[X->rowind[n] + 1][c + 1] = X->val[n];
+  return (M);
+}
+/*------------------------------------------------------------------------------*/
+/*
+  \fn MATRIX *GTMSPXmultiply(GTMSPX *X, MATRIX *B, MATRIX *out)
+  \brief Computes out = X*B where B is dense (eg, beta). Accumulates in
+  double like MatrixMultiplyD().
+*/
+MATRIX *GTMSPXmultiply(GTMSPX *X, MATRIX *B, MATRIX *out)
+{
+  int c, f;
+  long n;
+  double *acc;
+
+  if (B->rows != X->cols) {
+    printf("ERROR: GTMSPXmultiply(): dim mismatch %d %d\n", X->cols, B->rows);
+    return (NULL);
+  }
+  if (out == NULL) {
+    out = MatrixAlloc(X->rows, B->cols, MATRIX_REAL);
+    if (out == NULL) {
+      printf("ERROR: GTMSPXmultiply(): could not alloc %d %d\n", X->rows, B->cols);
+      return (NULL);
+    }
+  }
+  // Columns of X scatter into the rows of out, so accumulate per frame
+  // into a double vector to keep the column order (and result) fixed.
+  acc = (double *)calloc(X->rows, sizeof(double));
+  for (f = 0; f < B->cols; f++) {
+    memset(acc, 0, X->rows * sizeof(double));
+    for (c = 0; c < X->cols; c++) {
+      double b = B->rptr[c + 1][f + 1];
+      if (b == 0) continue;
+      for (n = X->colptr[c]; n < X->colptr[c + 1]; n++) acc[X->rowind[n]] += X->val[n] * b;
+    }
+    for (c = 0; c < X->rows; c++) out->rptr[c + 1][f + 1] = acc[c];
+  }
+  free(acc);
+  return (out);
+}
+/*------------------------------------------------------------------------------*/
+/*
+  \fn MATRIX *GTMSPXtB(GTMSPX *X, MATRIX *B, MATRIX *out)
+  \brief Computes out = X'*B where B is dense (eg, y with one column per
+  frame). Each column of X only touches the rows in its bounding box.
+*/
+MATRIX *GTMSPXtB(GTMSPX *X, MATRIX *B, MATRIX *out)
+{
+  int c;
+
+  if (B->rows != X->rows) {
+    printf("ERROR: GTMSPXtB(): dim mismatch %d %d\n", X->rows, B->rows);
+    return (NULL);
+  }
+  if (out == NULL) {
+    out = MatrixAlloc(X->cols, B->cols, MATRIX_REAL);
+    if (out == NULL) {
+      printf("ERROR: GTMSPXtB(): could not alloc %d %d\n", X->cols, B->cols);
+      return (NULL);
+    }
+  }
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic,1)
+#endif
+  for (c = 0; c < X->cols; c++) {
+    ROMP_PFLB_begin
+    int f;
+    long n;
+    double sum;
+    for (f = 0; f < B->cols; f++) {
+      sum = 0;
+      for (n = X->colptr[c]; n < X->colptr[c + 1]; n++) sum += (double)X->val[n] * B->rptr[X->rowind[n] + 1][f + 1];
+      out->rptr[c + 1][f + 1] = sum;
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  return (out);
+}
+/*------------------------------------------------------------------------------*/
+/*
+  \fn MATRIX *GTMSPXtSPX(GTMSPX *A, GTMSPX *B, MATRIX *out)
+  \brief Computes out = A'*B for two sparse matrices with the same
+  rows (eg, X'X or X0'X). Columns whose row ranges do not overlap are
+  skipped, and the others are computed by merging the two sorted row
+  lists. If A==B, only the upper triangle is computed and then copied.
+*/
+MATRIX *GTMSPXtSPX(GTMSPX *A, GTMSPX *B, MATRIX *out)
+{
+  int ca, sym;
+
+  if (A->rows != B->rows) {
+    printf("ERROR: GTMSPXtSPX(): dim mismatch %d %d\n", A->rows, B->rows);
+    return (NULL);
+  }
+  if (out == NULL) {
+    out = MatrixAlloc(A->cols, B->cols, MATRIX_REAL);
+    if (out == NULL) {
+      printf("ERROR: GTMSPXtSPX(): could not alloc %d %d\n", A->cols, B->cols);
+      return (NULL);
+    }
+  }
+  sym = (A == B);
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic,1)
+#endif
+  for (ca = 0; ca < A->cols; ca++) {
+    ROMP_PFLB_begin
+    int cb, cbstart;
+    long na, nb, naend, nbend;
+    double sum;
+    cbstart = 0;
+    if (sym) cbstart = ca;
+    for (cb = cbstart; cb < B->cols; cb++) {
+      sum = 0;
+      if (A->rowmax[ca] >= B->rowmin[cb] && B->rowmax[cb] >= A->rowmin[ca]) {
+        na = A->colptr[ca];
+        naend = A->colptr[ca + 1];
+        nb = B->colptr[cb];
+        nbend = B->colptr[cb + 1];
+        while (na < naend && nb < nbend) {
+          if (A->rowind[na] < B->rowind[nb])
+            na++;
+          else if (A->rowind[na] > B->rowind[nb])
+            nb++;
+          else {
+            sum += (double)A->val[na] * B->val[nb];
+            na++;
+            nb++;
+          }
+        }
+      }
+      out->rptr[ca + 1][cb + 1] = sum;
+      if (sym) out->rptr[cb + 1][ca + 1] = sum;
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  return (out);
+}
+/*------------------------------------------------------------------------------*/
+/*
+  \fn int GTMhaveX(GTM *gtm, int UseX0)
+  \brief Returns 1 if X (or X0 if UseX0) has been built in either dense
+  or sparse form.
+*/
+int GTMhaveX(GTM *gtm, int UseX0)
+{
+  if (UseX0) return (gtm->X0 != NULL || gtm->X0s != NULL);
+  return (gtm->X != NULL || gtm->Xs != NULL);
+}
+/*------------------------------------------------------------------------------*/
+/*
+  \fn int GTMfreeX(GTM *gtm, int UseX0)
+  \brief Frees X (or X0 if UseX0), whether dense or sparse.
+*/
+int GTMfreeX(GTM *gtm, int UseX0)
+{
+  if (UseX0) {
+    MatrixFree(&gtm->X0);
+    GTMSPXfree(&gtm->X0s);
+  }
+  else {
+    MatrixFree(&gtm->X);
+    GTMSPXfree(&gtm->Xs);
+  }
+  return (0);
+}
+/*------------------------------------------------------------------------------*/
+/*
+  \fn MATRIX *GTMxMultiply(GTM *gtm, int UseX0, MATRIX *B, MATRIX *out)
+  \brief Computes X*B (or X0*B if UseX0) using whichever form of X is
+  available.
+*/
+MATRIX *GTMxMultiply(GTM *gtm, int UseX0, MATRIX *B, MATRIX *out)
+{
+  GTMSPX *Xs = gtm->Xs;
+  MATRIX *X = gtm->X;
+  if (UseX0) {
+    Xs = gtm->X0s;
+    X = gtm->X0;
+  }
+  if (Xs) return (GTMSPXmultiply(Xs, B, out));
+  return (MatrixMultiplyD(X, B, out));
+}
+/*------------------------------------------------------------------------------*/
+/*
+  \fn MATRIX *GTMxtx(GTM *gtm, int UseX0a, int UseX0b, MATRIX *out)
+  \brief Computes Xa'*Xb where Xa is X (or X0 if UseX0a) and Xb is X (or
+  X0 if UseX0b), eg, GTMxtx(gtm,0,0,NULL) is X'X and GTMxtx(gtm,1,0,NULL)
+  is X0'X.
+*/
+MATRIX *GTMxtx(GTM *gtm, int UseX0a, int UseX0b, MATRIX *out)
+{
+  MATRIX *Xt;
+  if (gtm->Xs) {
+    GTMSPX *A = gtm->Xs, *B = gtm->Xs;
+    if (UseX0a) A = gtm->X0s;
+    if (UseX0b) B = gtm->X0s;
+    return (GTMSPXtSPX(A, B, out));
+  }
+  if (UseX0a == UseX0b) {
+    if (UseX0a) return (MatrixMtM(gtm->X0, out));
+    return (MatrixMtM(gtm->X, out));
+  }
+  if (UseX0a) {
+    Xt = MatrixTranspose(gtm->X0, NULL);
+    out = MatrixMultiplyD(Xt, gtm->X, out);
+  }
+  else {
+    Xt = MatrixTranspose(gtm->X, NULL);
+    out = MatrixMultiplyD(Xt, gtm->X0, out);
+  }
+  MatrixFree(&Xt);
+  return (out);
+}
+/*------------------------------------------------------------------------------*/
+/*
+  \fn MATRIX *GTMxDense(GTM *gtm, int UseX0)
+  \brief Returns a dense copy of X (or X0 if UseX0). The caller must
+  free the result.
+*/
+MATRIX *GTMxDense(GTM *gtm, int UseX0)
+{
+  if (UseX0) {
+    if (gtm->X0s) return (GTMSPXtoMatrix(gtm->X0s, NULL));
+    return (MatrixCopy(gtm->X0, NULL));
+  }
+  if (gtm->Xs) return (GTMSPXtoMatrix(gtm->Xs, NULL));
+  return (MatrixCopy(gtm->X, NULL));
+}
+/*------------------------------------------------------------------------------*/
+/*
+  \fn int *GTMrowNthSeg(GTM *gtm)
+  \brief Returns an array with the nthseg of the gtmseg at each row of
+  X (ie, each voxel in the mask in GTMvol2mat() order), or -1 if the
+  voxel is not in any seg. The caller must free the result.
+*/
+int *GTMrowNthSeg(GTM *gtm)
+{
+  int *rownthseg, k, c, r, s, segid, nthseg;
+
+  rownthseg = (int *)calloc(MAX(gtm->nmask, 1), sizeof(int));
+  k = 0;
+  for (s = 0; s < gtm->yvol->depth; s++) {
+    for (c = 0; c < gtm->yvol->width; c++) {
+      for (r = 0; r < gtm->yvol->height; r++) {
+        if (gtm->mask && MRIgetVoxVal(gtm->mask, c, r, s, 0) < 0.5) continue;
+        segid = MRIgetVoxVal(gtm->gtmseg, c, r, s, 0);
+        rownthseg[k] = -1;
+        if (segid != 0) {
+          for (nthseg = 0; nthseg < gtm->nsegs; nthseg++)
+            if (segid == gtm->segidlist[nthseg]) break;
+          if (nthseg < gtm->nsegs) rownthseg[k] = nthseg;
+        }
+        k++;
+      }
+    }
+  }
+  return (rownthseg);
+}
+
 /*--------------------------------------------------------------------------*/
 /*
   \fn MRI *GTMsegSynth(GTM *gtm, int frame, MRI *synth)
@@ -2856,25 +3344,44 @@ int GTMttPercent(GTM *gtm)
   if (gtm->ttpct != NULL) MatrixFree(&gtm->ttpct);
   gtm->ttpct = MatrixAlloc(gtm->nsegs, nTT, MATRIX_REAL);
 
-  // Must be done in same order as GTMbuildX()
-  k = 0;
-  for (s = 0; s < gtm->yvol->depth; s++) {
-    for (c = 0; c < gtm->yvol->width; c++) {
-      for (r = 0; r < gtm->yvol->height; r++) {
-        if (gtm->mask && MRIgetVoxVal(gtm->mask, c, r, s, 0) < 0.5) continue;
-        segid = MRIgetVoxVal(gtm->gtmseg, c, r, s, 0);
-        k++;  // have to do this here
-        if (segid == 0) continue;
-        for (nthseg = 0; nthseg < gtm->nsegs; nthseg++)
-          if (segid == gtm->segidlist[nthseg]) break;
-        for (mthseg = 0; mthseg < gtm->nsegs; mthseg++) {
-          mthsegid = gtm->segidlist[mthseg];
-          tt = gtm->ctGTMSeg->entries[mthsegid]->TissueType;
-          // printf("k=%d, segid = %d, nthseg = %d, mthsegid = %d, mthseg = %d, tt=%d\n",
-          // k,segid,nthseg,mthsegid,mthseg,tt);
-          fflush(stdout);
-          gtm->ttpct->rptr[nthseg + 1][tt] +=  // not tt+1
-              (gtm->X->rptr[k][mthseg + 1] * gtm->beta->rptr[mthseg + 1][1]);
+  if (gtm->Xs) {
+    // Go through the non-zero entries of each column (mthseg) and
+    // accumulate into the seg of the voxel at that row (nthseg)
+    int *rownthseg = GTMrowNthSeg(gtm);
+    long n;
+    for (mthseg = 0; mthseg < gtm->nsegs; mthseg++) {
+      mthsegid = gtm->segidlist[mthseg];
+      tt = gtm->ctGTMSeg->entries[mthsegid]->TissueType;
+      for (n = gtm->Xs->colptr[mthseg]; n < gtm->Xs->colptr[mthseg + 1]; n++) {
+        nthseg = rownthseg[gtm->Xs->rowind[n]];
+        if (nthseg < 0) continue;
+        gtm->ttpct->rptr[nthseg + 1][tt] +=  // not tt+1
+            (gtm->Xs->val[n] * gtm->beta->rptr[mthseg + 1][1]);
+      }
+    }
+    free(rownthseg);
+  }
+  else {
+    // Must be done in same order as GTMbuildX()
+    k = 0;
+    for (s = 0; s < gtm->yvol->depth; s++) {
+      for (c = 0; c < gtm->yvol->width; c++) {
+        for (r = 0; r < gtm->yvol->height; r++) {
+          if (gtm->mask && MRIgetVoxVal(gtm->mask, c, r, s, 0) < 0.5) continue;
+          segid = MRIgetVoxVal(gtm->gtmseg, c, r, s, 0);
+          k++;  // have to do this here
+          if (segid == 0) continue;
+          for (nthseg = 0; nthseg < gtm->nsegs; nthseg++)
+            if (segid == gtm->segidlist[nthseg]) break;
+          for (mthseg = 0; mthseg < gtm->nsegs; mthseg++) {
+            mthsegid = gtm->segidlist[mthseg];
+            tt = gtm->ctGTMSeg->entries[mthsegid]->TissueType;
+            // printf("k=%d, segid = %d, nthseg = %d, mthsegid = %d, mthseg = %d, tt=%d\n",
+            // k,segid,nthseg,mthsegid,mthseg,tt);
+            fflush(stdout);
+            gtm->ttpct->rptr[nthseg + 1][tt] +=  // not tt+1
+                (gtm->X->rptr[k][mthseg + 1] * gtm->beta->rptr[mthseg + 1][1]);
+          }
         }
       }
     }
@@ -14732,7 +14732,7 @@ char *MRIsliceDirectionName(MRI *mri)
 
 /**
  * This is deprecated.  Please use MRIextractDistanceMap in fastmarching.h
- * instead
+ * instead, or MRIexactDistanceTransform for the exact (unmasked) transform
  **/
 MRI *MRIdistanceTransform(MRI *mri_src, MRI *mri_dist, int label, float max_dist, int mode, MRI *mri_mask)
 {
@@ -3722,6 +3722,266 @@ int MRIsegFrameAvg(MRI *seg, int segid, MRI *mri, double *favg)
   return (nvoxels);
 }
 
+// index of id in the sorted unique ids, or -1 if it is not one of them
+static int segUniqueIndex(int id, int minid, int maxid, const int *lut, const int *unique, int nunique)
+{
+  if (id < minid || id > maxid) return (-1);
+  if (lut) return (lut[id - minid]);
+  int const *p = (int const *)bsearch(&id, unique, nunique, sizeof(int), compare_ints);
+  return (p ? (int)(p - unique) : -1);
+}
+
+/*---------------------------------------------------------
+  MRIsegVoxelLists() - lists the voxels of each of the nsegs ids in
+  segidlist with two passes over seg. The voxels of segidlist[n] are
+  voxels[start[2n]] to voxels[start[2n+1]-1], as c + width*(r + height*s),
+  in the same c,r,s order the single-id functions above visit them.
+  Ids that are repeated in segidlist get the same list. The volume is
+  split into a fixed number of column blocks, so the lists do not depend
+  on the number of threads. start and voxels must be freed by the caller.
+  ---------------------------------------------------------*/
+static int MRIsegVoxelLists(MRI *seg, int nsegs, const int *segidlist, int **pstart, int **pvoxels)
+{
+  int n, k, b, nunique, minid, maxid, *unique, *lut = NULL, *seg2unique, *counts, *start, *voxels;
+  int const nblocks = MIN(seg->width, 256);
+  int const blockwidth = (seg->width + nblocks - 1) / nblocks;
+
+  // map each id to its index in the sorted list of unique ids
+  unique = (int *)calloc(MAX(nsegs, 1), sizeof(int));
+  seg2unique = (int *)calloc(MAX(nsegs, 1), sizeof(int));
+  memcpy(unique, segidlist, nsegs * sizeof(int));
+  qsort(unique, nsegs, sizeof(int), compare_ints);
+  nunique = 0;
+  for (n = 0; n < nsegs; n++)
+    if (nunique == 0 || unique[n] != unique[nunique - 1]) unique[nunique++] = unique[n];
+  for (n = 0; n < nsegs; n++)
+    seg2unique[n] = (int *)bsearch(&segidlist[n], unique, nunique, sizeof(int), compare_ints) - unique;
+  minid = nunique > 0 ? unique[0] : 0;
+  maxid = nunique > 0 ? unique[nunique - 1] : -1;
+  if ((long)maxid - minid < (1 << 20)) {
+    lut = (int *)malloc((maxid - minid + 1) * sizeof(int));
+    for (k = 0; k < maxid - minid + 1; k++) lut[k] = -1;
+    for (k = 0; k < nunique; k++) lut[unique[k] - minid] = k;
+  }
+  // pass 1: number of voxels of each id in each block
+  counts = (int *)calloc((size_t)nblocks * (nunique + 1), sizeof(int));
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 1)
+#endif
+  for (b = 0; b < nblocks; b++) {
+    ROMP_PFLB_begin
+    int c, r, s, id, k;
+    int *bcounts = &counts[(size_t)b * (nunique + 1)];
+    for (c = b * blockwidth; c < MIN(seg->width, (b + 1) * blockwidth); c++)
+      for (r = 0; r < seg->height; r++)
+        for (s = 0; s < seg->depth; s++) {
+          id = (int)MRIgetVoxVal(seg, c, r, s, 0);
+          k = segUniqueIndex(id, minid, maxid, lut, unique, nunique);
+          if (k >= 0) bcounts[k]++;
+        }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  // turn the counts into where each block writes the voxels of each id
+  start = (int *)calloc(nunique + 1, sizeof(int));
+  for (k = 0; k < nunique; k++) {
+    int total = 0;
+    for (b = 0; b < nblocks; b++) {
+      int const count = counts[(size_t)b * (nunique + 1) + k];
+      counts[(size_t)b * (nunique + 1) + k] = start[k] + total;
+      total += count;
+    }
+    start[k + 1] = start[k] + total;
+  }
+
+  // pass 2: fill in the voxels
+  voxels = (int *)malloc(MAX(start[nunique], 1) * sizeof(int));
+  if (!unique || !seg2unique || !counts || !start || !voxels)
+    ErrorExit(ERROR_NOMEMORY, "MRIsegVoxelLists: could not allocate lists for %d segmentations", nsegs);
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 1)
+#endif
+  for (b = 0; b < nblocks; b++) {
+    ROMP_PFLB_begin
+    int c, r, s, id, k;
+    int *bnext = &counts[(size_t)b * (nunique + 1)];
+    for (c = b * blockwidth; c < MIN(seg->width, (b + 1) * blockwidth); c++)
+      for (r = 0; r < seg->height; r++)
+        for (s = 0; s < seg->depth; s++) {
+          id = (int)MRIgetVoxVal(seg, c, r, s, 0);
+          k = segUniqueIndex(id, minid, maxid, lut, unique, nunique);
+          if (k >= 0) voxels[bnext[k]++] = c + seg->width * (r + seg->height * s);
+        }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  // index the lists by position in segidlist
+  *pstart = (int *)calloc(2 * MAX(nsegs, 1), sizeof(int));
+  for (n = 0; n < nsegs; n++) {
+    (*pstart)[2 * n] = start[seg2unique[n]];
+    (*pstart)[2 * n + 1] = start[seg2unique[n] + 1];
+  }
+  *pvoxels = voxels;
+
+  free(lut);
+  free(counts);
+  free(start);
+  free(seg2unique);
+  free(unique);
+  return (NO_ERROR);
+}
+
+/*------------------------------------------------------------*/
+/*!
+  \fn int MRIsegStatsMulti(MRI *seg, int nsegs, const int *segidlist,
+                      MRI *mri, int frame, int robust, float Pct,
+                      int *nvoxels, float *min, float *max, float *range,
+                      float *mean, float *std)
+  \brief Same as calling MRIsegStats() (or MRIsegStatsRobust() if
+         robust) for each of the nsegs ids in segidlist, but reads seg
+         twice in all rather than once per id. nvoxels[n] is the number
+         of voxels with segidlist[n]. The results are identical to those
+         of the single-id functions. mri may be NULL to only count voxels,
+         in which case the stats arrays may be NULL too.
+*/
+int MRIsegStatsMulti(MRI *seg,
+                     int nsegs,
+                     const int *segidlist,
+                     MRI *mri,
+                     int frame,
+                     int robust,
+                     float Pct,
+                     int *nvoxels,
+                     float *min,
+                     float *max,
+                     float *range,
+                     float *mean,
+                     float *std)
+{
+  int n, *start, *voxels;
+
+  MRIsegVoxelLists(seg, nsegs, segidlist, &start, &voxels);
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 1)
+#endif
+  for (n = 0; n < nsegs; n++) {
+    ROMP_PFLB_begin
+    int const *v = &voxels[start[2 * n]];
+    int const nv = start[2 * n + 1] - start[2 * n];
+    int k, m, c, r, s;
+    double val, sum, sum2;
+    float vmin, vmax, vmean;
+    float *vlist;
+
+    nvoxels[n] = nv;
+    if (mri == NULL) {
+      ROMP_PFLB_continue;
+    }
+    vmin = vmax = vmean = 0;
+    sum = sum2 = 0;
+    m = 0;
+    if (!robust) {
+      for (k = 0; k < nv; k++) {
+        c = v[k] % seg->width;
+        r = (v[k] / seg->width) % seg->height;
+        s = v[k] / (seg->width * seg->height);
+        val = MRIgetVoxVal(mri, c, r, s, frame);
+        m++;
+        if (m == 1) vmin = vmax = val;
+        if (vmin > val) vmin = val;
+        if (vmax < val) vmax = val;
+        sum += val;
+        sum2 += (val * val);
+      }
+    }
+    else if (nv > 0) {
+      // sort and trim Pct off each end, as MRIsegStatsRobust() does
+      vlist = (float *)calloc(sizeof(float), nv);
+      for (k = 0; k < nv; k++) {
+        c = v[k] % seg->width;
+        r = (v[k] / seg->width) % seg->height;
+        s = v[k] / (seg->width * seg->height);
+        vlist[k] = MRIgetVoxVal(mri, c, r, s, frame);
+      }
+      qsort((void *)vlist, nv, sizeof(float), compare_floats);
+      for (k = 0; k < nv; k++) {
+        if (k < Pct * nv / 100.0) continue;
+        if (k > (100 - Pct) * nv / 100.0) continue;
+        val = vlist[k];
+        if (m == 0) vmin = vmax = val;
+        if (vmin > val) vmin = val;
+        if (vmax < val) vmax = val;
+        sum += val;
+        sum2 += (val * val);
+        m = m + 1;
+      }
+      free(vlist);
+    }
+    if (m != 0) vmean = sum / m;
+    min[n] = vmin;
+    max[n] = vmax;
+    range[n] = vmax - vmin;
+    mean[n] = vmean;
+    if (m > 1)
+      std[n] = sqrt(((m) * (vmean) * (vmean)-2 * (vmean)*sum + sum2) / (m - 1));
+    else
+      std[n] = 0.0;
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  free(start);
+  free(voxels);
+  return (NO_ERROR);
+}
+
+/*---------------------------------------------------------
+  MRIsegFrameAvgMulti() - same as calling MRIsegFrameAvg() for each
+  of the nsegs ids in segidlist, but reads seg twice in all rather than
+  once per id, and mri once. favg[n] must be preallocated to the number
+  of frames, and nvoxels[n] gets the number of voxels with segidlist[n].
+  ---------------------------------------------------------*/
+int MRIsegFrameAvgMulti(MRI *seg, int nsegs, const int *segidlist, MRI *mri, int *nvoxels, double **favg)
+{
+  int n, *start, *voxels;
+
+  MRIsegVoxelLists(seg, nsegs, segidlist, &start, &voxels);
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 1)
+#endif
+  for (n = 0; n < nsegs; n++) {
+    ROMP_PFLB_begin
+    int const *v = &voxels[start[2 * n]];
+    int const nv = start[2 * n + 1] - start[2 * n];
+    int k, f, c, r, s;
+
+    for (f = 0; f < mri->nframes; f++) favg[n][f] = 0;
+    for (k = 0; k < nv; k++) {
+      c = v[k] % seg->width;
+      r = (v[k] / seg->width) % seg->height;
+      s = v[k] / (seg->width * seg->height);
+      for (f = 0; f < mri->nframes; f++) favg[n][f] += MRIgetVoxVal(mri, c, r, s, f);
+    }
+    if (nv != 0)
+      for (f = 0; f < mri->nframes; f++) favg[n][f] /= nv;
+    nvoxels[n] = nv;
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  free(start);
+  free(voxels);
+  return (NO_ERROR);
+}
+
 MRI *MRImask_with_T2_and_aparc_aseg(
     MRI *mri_src, MRI *mri_dst, MRI *mri_T2, MRI *mri_aparc_aseg, float T2_thresh, int mm_from_exterior)
 {
@@ -0,0 +1,356 @@
+/**
+ * @brief exact Euclidean distance transform of a label volume
+ *
+ * Separable lower-envelope-of-parabolas distance transform (Felzenszwalb
+ * and Huttenlocher; Maurer et al.). The squared distance is computed with
+ * one 1D pass along each axis; every line of a pass is independent, so the
+ * lines are done in parallel. Unlike the fast marching transform, the
+ * result is exact (no front propagation error) and honors anisotropic
+ * voxel sizes.
+ */
+/*
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diag.h"
+#include "error.h"
+#include "macros.h"
+#include "mri.h"
+#include "mri2.h"
+
+#include "romp_support.h"
+
+#define EDT_INF 1e20f
+
+/*
+  Squared distance transform of one line of n samples, spaced by h, in
+  place. f[k] is the squared distance (or EDT_INF) at sample k after the
+  previous passes, and idx[k] the linear index of the feature that gave
+  it. v, z and g are scratch of size n, n+1 and n. Values beyond maxsq
+  are set to EDT_INF, which is exact since the later passes only add
+  non-negative terms. Returns the number of finite values in the line.
+*/
+static int edt1d(float *f, int *idx, int n, double h, double maxsq, int *v, double *z, float *g, int *gidx)
+{
+  int q, k, nfinite;
+  double w = h * h, s, d;
+
+  nfinite = 0;
+  for (q = 0; q < n; q++)
+    if (f[q] < EDT_INF) nfinite++;
+  if (nfinite == 0) return (0);
+
+  // lower envelope of the parabolas w*(p-q)^2 + f[q] for finite f[q]
+  k = -1;
+  for (q = 0; q < n; q++) {
+    if (f[q] >= EDT_INF) continue;
+    if (k < 0) {
+      k = 0;
+      v[0] = q;
+      z[0] = -HUGE_VAL;
+      z[1] = +HUGE_VAL;
+      continue;
+    }
+    s = ((f[q] + w * q * q) - (f[v[k]] + w * v[k] * v[k])) / (2 * w * (q - v[k]));
+    while (s <= z[k]) {
+      k--;
+      s = ((f[q] + w * q * q) - (f[v[k]] + w * v[k] * v[k])) / (2 * w * (q - v[k]));
+    }
+    k++;
+    v[k] = q;
+    z[k] = s;
+    z[k + 1] = +HUGE_VAL;
+  }
+
+  // fill in from the envelope
+  k = 0;
+  for (q = 0; q < n; q++) {
+    while (z[k + 1] < q) k++;
+    d = w * (q - v[k]) * (q - v[k]) + f[v[k]];
+    if (maxsq > 0 && d > maxsq) {
+      g[q] = EDT_INF;
+      gidx[q] = -1;
+    }
+    else {
+      g[q] = d;
+      gidx[q] = idx[v[k]];
+    }
+  }
+  memcpy(f, g, n * sizeof(float));
+  memcpy(idx, gidx, n * sizeof(int));
+  return (nfinite);
+}
+
+/*
+  Squared distance (in mm^2) from each voxel to the nearest voxel where
+  feature[] is non-zero, and the linear index of that voxel (-1 if
+  none is within maxsq). dist and nearest must have width*height*depth
+  entries.
+*/
+static int edt3d(const unsigned char *feature, int width, int height, int depth,
+                 double xsize, double ysize, double zsize, double maxsq, float *dist, int *nearest)
+{
+  long nvox = (long)width * height * depth, n;
+  int maxdim, nthreads, pass;
+
+  for (n = 0; n < nvox; n++) {
+    if (feature[n]) {
+      dist[n] = 0;
+      nearest[n] = n;
+    }
+    else {
+      dist[n] = EDT_INF;
+      nearest[n] = -1;
+    }
+  }
+
+  maxdim = MAX(MAX(width, height), depth);
+  nthreads = omp_get_max_threads();
+  int *vbuf = (int *)calloc((long)nthreads * maxdim, sizeof(int));
+  double *zbuf = (double *)calloc((long)nthreads * (maxdim + 1), sizeof(double));
+  float *fbuf = (float *)calloc((long)nthreads * 2 * maxdim, sizeof(float));
+  int *ibuf = (int *)calloc((long)nthreads * 2 * maxdim, sizeof(int));
+
+  // pass 0 is along columns (x), 1 along rows (y), 2 along slices (z)
+  for (pass = 0; pass < 3; pass++) {
+    int len, nlines;
+    long stride;
+    double h;
+    if (pass == 0) {
+      len = width;
+      stride = 1;
+      h = xsize;
+      nlines = height * depth;
+    }
+    else if (pass == 1) {
+      len = height;
+      stride = width;
+      h = ysize;
+      nlines = width * depth;
+    }
+    else {
+      len = depth;
+      stride = (long)width * height;
+      h = zsize;
+      nlines = width * height;
+    }
+
+    int line;
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(assume_reproducible) schedule(static)
+#endif
+    for (line = 0; line < nlines; line++) {
+      ROMP_PFLB_begin
+      int tid = omp_get_thread_num(), k;
+      long start;
+      float *f = &fbuf[(long)tid * 2 * maxdim], *g = f + maxdim;
+      int *idx = &ibuf[(long)tid * 2 * maxdim], *gidx = idx + maxdim;
+      if (pass == 0)
+        start = (long)line * width;
+      else if (pass == 1)
+        start = (long)(line / width) * width * height + (line % width);
+      else
+        start = line;
+      for (k = 0; k < len; k++) {
+        f[k] = dist[start + k * stride];
+        idx[k] = nearest[start + k * stride];
+      }
+      if (edt1d(f, idx, len, h, maxsq, &vbuf[(long)tid * maxdim], &zbuf[(long)tid * (maxdim + 1)], g, gidx) == 0)
+        ROMP_PFLB_continue;
+      for (k = 0; k < len; k++) {
+        dist[start + k * stride] = f[k];
+        nearest[start + k * stride] = idx[k];
+      }
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+  }
+
+  free(vbuf);
+  free(zbuf);
+  free(fbuf);
+  free(ibuf);
+  return (0);
+}
+
+/*
+  Distance (in mm) from the center of voxel n to the nearest point of
+  voxel m treated as a box. This puts the zero level on the boundary
+  between the two classes, half a voxel from the boundary voxels, the
+  same convention used by the fast marching transform.
+*/
+static double edtBoxDist(long n, long m, int width, int height, double xsize, double ysize, double zsize)
+{
+  long wh = (long)width * height;
+  double dx, dy, dz;
+  dx = fabs((double)(n % width) - (m % width)) - 0.5;
+  dy = fabs((double)((n / width) % height) - ((m / width) % height)) - 0.5;
+  dz = fabs((double)(n / wh) - (m / wh)) - 0.5;
+  dx = MAX(dx, 0) * xsize;
+  dy = MAX(dy, 0) * ysize;
+  dz = MAX(dz, 0) * zsize;
+  return (sqrt(dx * dx + dy * dy + dz * dz));
+}
+
+/*!
+  \fn MRI *MRIexactDistanceTransform(MRI *mri_src, MRI *mri_dist, int label, float max_dist,
+                                     int mode, MRI *mri_mask, MRI **pmri_nearest)
+  \brief Exact Euclidean distance transform (in mm) of the voxels of
+  mri_src equal to label. mode is one of the DTRANS_MODE_* values:
+  SIGNED is positive outside and negative inside, UNSIGNED is positive
+  on both sides, OUTSIDE is zero inside and INSIDE is zero outside
+  (and positive inside). A voxel next to the boundary is 0.5 voxels
+  from it. max_dist is in voxels of the x axis (as in
+  MRIdistanceTransform()); distances beyond it are clamped to it, and
+  voxels farther than that from the boundary are not resolved (which is
+  what makes small max_dist fast). If max_dist <= 0, the distance is
+  not limited. If mri_mask is non-NULL, voxels where it is 0 are set
+  to max_dist. Unlike the fast marching transform, the mask is not a
+  barrier to the distance. If pmri_nearest is non-NULL, it is set to a
+  3-frame MRI_INT volume with the col, row, and slice of the nearest
+  voxel on the other side of the boundary (or -1 if none within
+  max_dist).
+*/
+MRI *MRIexactDistanceTransform(MRI *mri_src, MRI *mri_dist, int label, float max_dist,
+                               int mode, MRI *mri_mask, MRI **pmri_nearest)
+{
+  int width, height, depth, x, y, z, side, nsides;
+  long nvox, n;
+  double maxmm, maxsq, xsize, ysize, zsize;
+  unsigned char *inlabel, *feature;
+  float *dist;
+  int *nearest, *nearest_out = NULL;
+
+  width = mri_src->width;
+  height = mri_src->height;
+  depth = mri_src->depth;
+  nvox = (long)width * height * depth;
+  xsize = mri_src->xsize;
+  ysize = mri_src->ysize;
+  zsize = mri_src->zsize;
+
+  if (mode != DTRANS_MODE_SIGNED && mode != DTRANS_MODE_UNSIGNED && mode != DTRANS_MODE_OUTSIDE &&
+      mode != DTRANS_MODE_INSIDE)
+    ErrorReturn(NULL, (ERROR_BADPARM, "MRIexactDistanceTransform: unknown mode %d", mode));
+  if (mri_mask && MRIdimMismatch(mri_src, mri_mask, 0))
+    ErrorReturn(NULL, (ERROR_BADPARM, "MRIexactDistanceTransform: mask dimension mismatch"));
+
+  if (max_dist <= 0) {
+    maxmm = 2 * MAX(MAX(width, height), depth) * xsize;
+    maxsq = 0;  // no early-out
+  }
+  else {
+    maxmm = max_dist * xsize;
+    // allow for the half-voxel offset applied at the end
+    maxsq = (maxmm + MAX(MAX(xsize, ysize), zsize)) * (maxmm + MAX(MAX(xsize, ysize), zsize));
+  }
+
+  if (mri_dist == NULL) {
+    mri_dist = MRIalloc(width, height, depth, MRI_FLOAT);
+    if (mri_dist == NULL)
+      ErrorReturn(NULL, (ERROR_NOMEMORY, "MRIexactDistanceTransform: could not alloc output"));
+    MRIcopyHeader(mri_src, mri_dist);
+  }
+  else
+    MRIclear(mri_dist);
+
+  inlabel = (unsigned char *)calloc(nvox, sizeof(unsigned char));
+  feature = (unsigned char *)calloc(nvox, sizeof(unsigned char));
+  dist = (float *)calloc(nvox, sizeof(float));
+  nearest = (int *)calloc(nvox, sizeof(int));
+  if (pmri_nearest) {
+    nearest_out = (int *)calloc(nvox, sizeof(int));
+    for (n = 0; n < nvox; n++) nearest_out[n] = -1;
+  }
+  if (inlabel == NULL || feature == NULL || dist == NULL || nearest == NULL)
+    ErrorExit(ERROR_NOMEMORY, "MRIexactDistanceTransform: could not alloc %ld voxels", nvox);
+
+  for (z = 0; z < depth; z++)
+    for (y = 0; y < height; y++)
+      for (x = 0; x < width; x++)
+        inlabel[((long)z * height + y) * width + x] = (nint(MRIgetVoxVal(mri_src, x, y, z, 0)) == label);
+
+  // side 0 computes the distance outside the label (from the label
+  // voxels), side 1 the distance inside (from the non-label voxels)
+  nsides = 2;
+  for (side = 0; side < nsides; side++) {
+    double sgn = 1;
+    if (side == 0 && mode == DTRANS_MODE_INSIDE) continue;
+    if (side == 1 && mode == DTRANS_MODE_OUTSIDE) continue;
+    if (side == 1 && mode == DTRANS_MODE_SIGNED) sgn = -1;
+    for (n = 0; n < nvox; n++) feature[n] = (side == 0) ? inlabel[n] : !inlabel[n];
+    edt3d(feature, width, height, depth, xsize, ysize, zsize, maxsq, dist, nearest);
+
+    for (z = 0; z < depth; z++) {
+      for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+          double d;
+          n = ((long)z * height + y) * width + x;
+          if (feature[n]) continue;  // on the other side
+          if (nearest[n] < 0)
+            d = maxmm;
+          else
+            d = MIN(edtBoxDist(n, nearest[n], width, height, xsize, ysize, zsize), maxmm);
+          MRIsetVoxVal(mri_dist, x, y, z, 0, sgn * d);
+          if (nearest_out) nearest_out[n] = nearest[n];
+        }
+      }
+    }
+  }
+
+  if (mri_mask) {
+    for (z = 0; z < depth; z++)
+      for (y = 0; y < height; y++)
+        for (x = 0; x < width; x++)
+          if (nint(MRIgetVoxVal(mri_mask, x, y, z, 0)) == 0) {
+            MRIsetVoxVal(mri_dist, x, y, z, 0, maxmm);
+            if (nearest_out) nearest_out[((long)z * height + y) * width + x] = -1;
+          }
+  }
+
+  if (pmri_nearest) {
+    if (*pmri_nearest == NULL) {
+      *pmri_nearest = MRIallocSequence(width, height, depth, MRI_INT, 3);
+      MRIcopyHeader(mri_src, *pmri_nearest);
+    }
+    for (z = 0; z < depth; z++) {
+      for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+          int m = nearest_out[((long)z * height + y) * width + x];
+          if (m < 0) {
+            MRIsetVoxVal(*pmri_nearest, x, y, z, 0, -1);
+            MRIsetVoxVal(*pmri_nearest, x, y, z, 1, -1);
+            MRIsetVoxVal(*pmri_nearest, x, y, z, 2, -1);
+          }
+          else {
+            MRIsetVoxVal(*pmri_nearest, x, y, z, 0, m % width);
+            MRIsetVoxVal(*pmri_nearest, x, y, z, 1, (m / width) % height);
+            MRIsetVoxVal(*pmri_nearest, x, y, z, 2, m / ((long)width * height));
+          }
+        }
+      }
+    }
+    free(nearest_out);
+  }
+
+  free(inlabel);
+  free(feature);
+  free(dist);
+  free(nearest);
+  return (mri_dist);
+}
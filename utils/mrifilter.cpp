@@ -4150,6 +4150,96 @@ MRI *MRIxcorrWindow(MRI *mri_ref, MRI *mri_in, MRI *mri_dst, int window_size)
 
   return (mri_dst);
 }
+/*-----------------------------------------------------
+  MRIxcorr() - cross-correlates two MRIs (first frame, any
+  type) at every offset, as MRIxcorrWindow() does over the
+  whole volume: mri_dst(x0+dx, y0+dy, z0+dz) is the sum of
+  in(x,y,z)*ref(x+dx,y+dy,z+dz) with zeros outside the volume,
+  where (x0,y0,z0) = ((width-1)/2, (height-1)/2, (depth-1)/2).
+  mri_dst is the same size as mri_ref (float if allocated
+  here). Computed with the FFT on a volume zero-padded to
+  twice the size, so the cost is O(N log N), not O(N^2).
+------------------------------------------------------*/
+MRI *MRIxcorr(MRI *mri_ref, MRI *mri_in, MRI *mri_dst)
+{
+  int width, height, depth, nx, ny, nz, x0, y0, z0, z;
+  const FFT3D_PLAN *plan;
+  float *buf, *spec_ref, *spec_in;
+
+  width = mri_ref->width;
+  height = mri_ref->height;
+  depth = mri_ref->depth;
+  if (mri_in->width != width || mri_in->height != height || mri_in->depth != depth) {
+    printf("ERROR: MRIxcorr: dimension mismatch\n");
+    return (NULL);
+  }
+  if (mri_dst == NULL) {
+    mri_dst = MRIalloc(width, height, depth, MRI_FLOAT);
+    MRIcopyHeader(mri_ref, mri_dst);
+  }
+  else if (mri_dst->width != width || mri_dst->height != height || mri_dst->depth != depth) {
+    printf("ERROR: MRIxcorr: output dimension mismatch\n");
+    return (NULL);
+  }
+
+  nx = FFTgoodSize(2 * width - 1, 1);
+  ny = FFTgoodSize(2 * height - 1, 0);
+  nz = FFTgoodSize(2 * depth - 1, 0);
+  plan = FFT3Dplan(nx, ny, nz);
+  buf = (float *)calloc((size_t)nx * ny * nz, sizeof(float));
+  spec_ref = (float *)calloc((size_t)2 * plan->nxc * ny * nz, sizeof(float));
+  spec_in = (float *)calloc((size_t)2 * plan->nxc * ny * nz, sizeof(float));
+  if (buf == NULL || spec_ref == NULL || spec_in == NULL) {
+    printf("ERROR: MRIxcorr: could not alloc\n");
+    free(buf);
+    free(spec_ref);
+    free(spec_in);
+    return (NULL);
+  }
+
+  for (z = 0; z < depth; z++) {
+    int x, y;
+    for (y = 0; y < height; y++)
+      for (x = 0; x < width; x++) buf[x + (size_t)nx * (y + (size_t)ny * z)] = MRIgetVoxVal(mri_ref, x, y, z, 0);
+  }
+  FFT3Dforward(plan, buf, spec_ref);
+  for (z = 0; z < depth; z++) {
+    int x, y;
+    for (y = 0; y < height; y++)
+      for (x = 0; x < width; x++) buf[x + (size_t)nx * (y + (size_t)ny * z)] = MRIgetVoxVal(mri_in, x, y, z, 0);
+  }
+  FFT3Dforward(plan, buf, spec_in);
+
+  // REF * conj(IN) is the transform of sum_x in(x)*ref(x+d)
+  size_t k, nspec = (size_t)plan->nxc * ny * nz;
+  for (k = 0; k < nspec; k++) {
+    double rr = spec_ref[2 * k], ri = spec_ref[2 * k + 1];
+    double ir = spec_in[2 * k], ii = spec_in[2 * k + 1];
+    spec_ref[2 * k] = rr * ir + ri * ii;
+    spec_ref[2 * k + 1] = ri * ir - rr * ii;
+  }
+  FFT3Dbackward(plan, spec_ref, buf);
+
+  // negative offsets wrap around to the end of the padded volume
+  x0 = (width - 1) / 2;
+  y0 = (height - 1) / 2;
+  z0 = (depth - 1) / 2;
+  for (z = 0; z < depth; z++) {
+    int x, y, bx, by, bz = (z - z0 + nz) % nz;
+    for (y = 0; y < height; y++) {
+      by = (y - y0 + ny) % ny;
+      for (x = 0; x < width; x++) {
+        bx = (x - x0 + nx) % nx;
+        MRIsetVoxVal(mri_dst, x, y, z, 0, buf[bx + (size_t)nx * (by + (size_t)ny * bz)]);
+      }
+    }
+  }
+
+  free(buf);
+  free(spec_ref);
+  free(spec_in);
+  return (mri_dst);
+}
 /*-----------------------------------------------------
         Parameters:
 
@@ -6506,6 +6596,172 @@ MRI *MRI_fft_highpass(MRI *src, MRI *dst, int percent)
   MRIfree(&src_fft);
   return (dst);
 }
+/*---------------------------------------------------------------------
+  Gaussian smoothing through the FFT. MRIgaussianSmoothNI() applies the
+  full (untruncated) GaussianMatrix() along each axis with zeros outside
+  the volume, which costs O(len) per voxel and axis. For wide kernels
+  the same result is computed by zero-padding the volume by 7 sigma
+  (where the kernel is below float precision), multiplying the 3D
+  spectrum by the product of the 1D kernel spectra, and transforming
+  back, so the cost no longer depends on the kernel width. Used when
+  the widest std is at least MRI_FFT_SMOOTH_MIN_STD voxels, which can
+  be changed with FS_GAUSSIAN_SMOOTH_FFT_MIN_STD (a large value turns
+  it off). Only float targets are smoothed this way: the spatial path
+  rounds an integer target after each axis and after the final
+  scaling, and the FFT path cannot reproduce those roundings.
+  -------------------------------------------------------------------*/
+#define MRI_FFT_SMOOTH_MIN_STD 2.0  // in voxels
+
+static bool MRIgaussianSmoothUseFFT(MRI *src, MRI *targ, double cstd, double rstd, double sstd)
+{
+  static const double minstd = getenv("FS_GAUSSIAN_SMOOTH_FFT_MIN_STD") ?
+                               atof(getenv("FS_GAUSSIAN_SMOOTH_FFT_MIN_STD")) : MRI_FFT_SMOOTH_MIN_STD;
+  if (targ->type != MRI_FLOAT) return false;
+  double maxstd = MAX(cstd / src->xsize, MAX(rstd / src->ysize, sstd / src->zsize));
+  return maxstd > 0 && maxstd >= minstd;
+}
+
+/*
+  Kernel of one axis: the padded length, the spectrum of the kernel
+  (real, since the kernel is symmetric) and the sum of the center row
+  of the GaussianMatrix() that MRIgaussianSmoothNI() divides by.
+*/
+static double *MRIgaussianKernelSpectrum(int len, double std, int even, int *ppadlen, double *pscale)
+{
+  int padlen, halfwidth, d, k, c;
+  double var, norm, *kern, *spec;
+
+  if (std <= 0) {
+    padlen = FFTgoodSize(len, even);
+    spec = (double *)calloc(padlen, sizeof(double));
+    for (k = 0; k < padlen; k++) spec[k] = 1;
+    *ppadlen = padlen;
+    *pscale = 1;
+    return (spec);
+  }
+
+  var = std * std;
+  halfwidth = MIN(len - 1, (int)ceil(7 * std));
+  padlen = FFTgoodSize(len + halfwidth, even);
+
+  // normalized as in GaussianMatrix(len, std, 1, G)
+  norm = 0;
+  for (c = 0; c < len; c++) norm += exp(-(double)(c - len / 2) * (c - len / 2) / (2 * var));
+  kern = (double *)calloc(halfwidth + 1, sizeof(double));
+  for (d = 0; d <= halfwidth; d++) kern[d] = exp(-(double)d * d / (2 * var)) / norm;
+
+  *pscale = 1;
+  if (len > 1) {
+    *pscale = 0;
+    for (c = 0; c < len; c++) {
+      d = abs(c - (len / 2 - 1));
+      *pscale += exp(-(double)d * d / (2 * var)) / norm;
+    }
+  }
+
+  spec = (double *)calloc(padlen, sizeof(double));
+  for (k = 0; k < padlen; k++) {
+    spec[k] = kern[0];
+    for (d = 1; d <= halfwidth; d++) spec[k] += 2 * kern[d] * cos(2 * M_PI * (double)((long)k * d % padlen) / padlen);
+  }
+  free(kern);
+  *ppadlen = padlen;
+  return (spec);
+}
+
+/*
+  Smooths all the frames of vol in place. The stds are in mm.
+*/
+static int MRIgaussianSmoothFFT(MRI *vol, double cstd, double rstd, double sstd)
+{
+  int nx, ny, nz, f, z;
+  double *kx, *ky, *kz, cscale, rscale, sscale;
+  const FFT3D_PLAN *plan;
+  float *buf, *spec;
+
+  kx = MRIgaussianKernelSpectrum(vol->width, cstd / vol->xsize, 1, &nx, &cscale);
+  ky = MRIgaussianKernelSpectrum(vol->height, rstd / vol->ysize, 0, &ny, &rscale);
+  kz = MRIgaussianKernelSpectrum(vol->depth, sstd / vol->zsize, 0, &nz, &sscale);
+  plan = FFT3Dplan(nx, ny, nz);
+  if (Gdiag_no > 0)
+    printf("MRIgaussianSmoothFFT(): %dx%dx%d padded to %dx%dx%d, scale = %g\n",
+           vol->width, vol->height, vol->depth, nx, ny, nz, cscale * rscale * sscale);
+
+  // Fold the final division by the kernel sum into the spectrum
+  for (f = 0; f < plan->nxc; f++) kx[f] /= (cscale * rscale * sscale);
+
+  buf = (float *)calloc((size_t)nx * ny * nz, sizeof(float));
+  spec = (float *)calloc((size_t)2 * plan->nxc * ny * nz, sizeof(float));
+  if (buf == NULL || spec == NULL) {
+    printf("ERROR: MRIgaussianSmoothFFT: could not alloc\n");
+    free(buf);
+    free(spec);
+    free(kx);
+    free(ky);
+    free(kz);
+    return (1);
+  }
+
+  for (f = 0; f < vol->nframes; f++) {
+    memset(buf, 0, (size_t)nx * ny * nz * sizeof(float));
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+    for (z = 0; z < vol->depth; z++) {
+      ROMP_PFLB_begin
+      int c, r;
+      for (r = 0; r < vol->height; r++)
+        for (c = 0; c < vol->width; c++) buf[c + (size_t)nx * (r + (size_t)ny * z)] = MRIgetVoxVal(vol, c, r, z, f);
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+
+    FFT3Dforward(plan, buf, spec);
+
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+    for (z = 0; z < nz; z++) {
+      ROMP_PFLB_begin
+      int c, r;
+      for (r = 0; r < ny; r++) {
+        float *line = spec + 2 * (size_t)plan->nxc * (r + (size_t)ny * z);
+        for (c = 0; c < plan->nxc; c++) {
+          double g = kx[c] * ky[r] * kz[z];
+          line[2 * c] *= g;
+          line[2 * c + 1] *= g;
+        }
+      }
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+
+    FFT3Dbackward(plan, spec, buf);
+
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+    for (z = 0; z < vol->depth; z++) {
+      ROMP_PFLB_begin
+      int c, r;
+      for (r = 0; r < vol->height; r++)
+        for (c = 0; c < vol->width; c++) MRIsetVoxVal(vol, c, r, z, f, buf[c + (size_t)nx * (r + (size_t)ny * z)]);
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+  }
+
+  free(buf);
+  free(spec);
+  free(kx);
+  free(ky);
+  free(kz);
+  return (0);
+}
+
 /*---------------------------------------------------------------------
   MRIgaussianSmoothNI() - performs non-isotropic gaussian spatial
   smoothing.  The standard deviation of the gaussian is std.  The mean
@@ -6553,6 +6809,12 @@ MRI *MRIgaussianSmoothNI(MRI *src, double cstd, double rstd, double sstd, MRI *t
     printf("MRIgaussianSmoothNI(): %d avail.processors, using %d\n", omp_get_num_procs(), omp_get_max_threads());
 #endif
 
+  // Wide kernels are done in the frequency domain
+  if (MRIgaussianSmoothUseFFT(src, targ, cstd, rstd, sstd)) {
+    if (MRIgaussianSmoothFFT(targ, cstd, rstd, sstd)) return (NULL);
+    return (targ);
+  }
+
   /* -----------------Smooth the columns -----------------------------*/
   if (cstd > 0) {
     G = GaussianMatrix(src->width, cstd / src->xsize, 1, NULL);
@@ -50,6 +50,7 @@
 #include "analyze.h"
 #include "autoencoder.h"
 #include "bfileio.h"
+#include "bgzf.h"
 #include "chklc.h"
 #include "cma.h"
 #include "diag.h"
@@ -161,6 +162,7 @@ static void local_buffer_to_image(BUFTYPE *buf, MRI *mri, int slice, int frame);
 static MRI *sdtRead(const char *fname, int read_volume);
 static MRI *mghRead(const char *fname, int read_volume, int frame);
 static int mghWrite(MRI *mri, const char *fname, int frame);
+static int mghWriteBlocked(MRI *mri, const char *fname, int start_frame, int end_frame);
 static int mghAppend(MRI *mri, const char *fname, int frame);
 
 /********************************************/
@@ -172,6 +174,7 @@ extern const char *Progname;
 static char *command_line;
 static char *subject_name;
 static int gdf_crop_flag = FALSE;
+static int mgz_blocked_flag = -1;  // -1 = not set, use FS_MGZ_BLOCKED
 
 #define MAX_UNKNOWN_LABELS 100
 
@@ -450,6 +453,28 @@ void mriio_set_gdf_crop_flag(int new_gdf_crop_flag)
 
 } /* end mriio_set_gdf_crop_flag() */
 
+/*!
+  \fn void mriio_set_mgz_blocked(int new_mgz_blocked_flag)
+  \brief When set, .mgz files are written as independently compressed
+  blocks with a block index (see bgzf.h). Such files remain readable by
+  gunzip and older versions, but are compressed in parallel and allow
+  reading single frames without decompressing the frames before them.
+  If never called, the FS_MGZ_BLOCKED environment variable is used.
+*/
+void mriio_set_mgz_blocked(int new_mgz_blocked_flag)
+{
+  mgz_blocked_flag = new_mgz_blocked_flag;
+
+  return;
+
+} /* end mriio_set_mgz_blocked() */
+
+static int mriio_mgz_blocked(void)
+{
+  if (mgz_blocked_flag >= 0) return (mgz_blocked_flag);
+  return (getenv("FS_MGZ_BLOCKED") != NULL);
+}
+
 int MRIgetVolumeName(const char *string, char *name_only)
 {
   char *at, *pound;
@@ -10156,6 +10181,10 @@ static MRI *mghRead(const char *fname, int read_volume, int frame)
   int gzipped = 0;
   int nread;
   int tag;
+  int file_nframes;
+  BGZF_INDEX *bidx = NULL;
+  BUFTYPE *chunk = NULL;
+  long long data_offset, data_end = 0, chunk_start = 0, chunk_len = 0, chunk_slices = 0;
 
   ext = strrchr(fname, '.');
   int valid_ext = 0;
@@ -10250,11 +10279,24 @@ static MRI *mghRead(const char *fname, int read_volume, int frame)
       break;
   }
   bytes = width * height * bpv; /* bytes per slice */
+  file_nframes = nframes;
+  data_offset = znztell(fp);
+  if (gzipped) bidx = BGZFreadIndex(fname);
+
   if (!read_volume) {
     mri = MRIallocHeader(width, height, depth, type, nframes);
     mri->dof = dof;
     mri->nframes = nframes;
-    if (gzipped) {  // pipe cannot seek
+    if (bidx) {  // jump straight past the voxel data
+      znzclose(fp);
+      fp = BGZFopenAt(fname, bidx, data_offset + (long long)nframes * depth * bytes);
+      if (znz_isnull(fp)) {
+        BGZFfreeIndex(&bidx);
+        MRIfree(&mri);
+        ErrorReturn(NULL, (ERROR_BADFILE, "mghRead(%s): could not seek past voxel data", fname));
+      }
+    }
+    else if (gzipped) {  // pipe cannot seek
       long count, total_bytes;
       uchar buf[STRLEN];
 
@@ -10268,9 +10310,15 @@ static MRI *mghRead(const char *fname, int read_volume, int frame)
   else {
     if (frame >= 0) {
       start_frame = end_frame = frame;
-      if (gzipped) {  // pipe cannot seek
-        long count;
-        for (count = 0; count < (long)frame * width * height * depth * bpv; count++) znzgetc(fp);
+      if (bidx)
+        ;  // blocks are read directly at the frame offset below
+      else if (gzipped) {  // pipe cannot seek
+        long count, skip_bytes;
+        uchar skip_buf[STRLEN];
+
+        skip_bytes = (long)frame * width * height * depth * bpv;
+        for (count = 0; count < skip_bytes - STRLEN; count += STRLEN) znzread(skip_buf, STRLEN, 1, fp);
+        znzread(skip_buf, skip_bytes - count, 1, fp);
       }
       else
         znzseek(fp, (long)frame * width * height * depth * bpv, SEEK_CUR);
@@ -10289,9 +10337,33 @@ static MRI *mghRead(const char *fname, int read_volume, int frame)
     buf = (BUFTYPE *)calloc(bytes, sizeof(BUFTYPE));
     mri = MRIallocSequence(width, height, depth, type, nframes);
     mri->dof = dof;
+    if (bidx) {
+      // decompress several slices worth of blocks at a time, in parallel
+      chunk_slices = (long long)4 * omp_get_max_threads() * bidx->block_size / bytes;
+      if (chunk_slices < 1) chunk_slices = 1;
+      chunk = (BUFTYPE *)calloc(chunk_slices * bytes, sizeof(BUFTYPE));
+      data_end = data_offset + (long long)(end_frame + 1) * depth * bytes;
+    }
     for (frame = start_frame; frame <= end_frame; frame++) {
       for (z = 0; z < depth; z++) {
-        if ((int)znzread(buf, sizeof(char), bytes, fp) != bytes) {
+        if (bidx) {
+          long long offset = data_offset + ((long long)frame * depth + z) * bytes;
+          if (offset < chunk_start || offset + bytes > chunk_start + chunk_len) {
+            chunk_start = offset;
+            chunk_len = chunk_slices * bytes;
+            if (chunk_start + chunk_len > data_end) chunk_len = data_end - chunk_start;
+            if (BGZFreadRange(fname, bidx, chunk_start, chunk_len, chunk) != NO_ERROR) {
+              znzclose(fp);
+              free(buf);
+              free(chunk);
+              BGZFfreeIndex(&bidx);
+              MRIfree(&mri);
+              ErrorReturn(NULL, (ERROR_BADFILE, "mghRead(%s): could not read blocks at slice %d", fname, z));
+            }
+          }
+          memcpy(buf, chunk + (offset - chunk_start), bytes);
+        }
+        else if ((int)znzread(buf, sizeof(char), bytes, fp) != bytes) {
           // fclose(fp) ;
           znzclose(fp);
           free(buf);
@@ -10335,7 +10407,18 @@ static MRI *mghRead(const char *fname, int read_volume, int frame)
       }
     }
     if (buf) free(buf);
+    if (bidx) {  // continue with the trailer after the last frame in the file
+      free(chunk);
+      znzclose(fp);
+      fp = BGZFopenAt(fname, bidx, data_offset + (long long)file_nframes * depth * bytes);
+      if (znz_isnull(fp)) {
+        BGZFfreeIndex(&bidx);
+        MRIfree(&mri);
+        ErrorReturn(NULL, (ERROR_BADFILE, "mghRead(%s): could not seek past voxel data", fname));
+      }
+    }
   }
+  BGZFfreeIndex(&bidx);
 
   if (good_ras_flag > 0) {
     mri->xsize = xsize;
@@ -10488,11 +10571,191 @@ static MRI *mghRead(const char *fname, int read_volume, int frame)
   return (mri);
 }
 
+/*!
+  \fn static void mghWriteHeader(MRI *mri, znzFile fp)
+  \brief Writes the fixed-size header that precedes the voxel data.
+*/
+static void mghWriteHeader(MRI *mri, znzFile fp)
+{
+  int unused_space_size;
+  char buf[UNUSED_SPACE_SIZE + 1];
+
+  /* WARNING - adding or removing anything before nframes will
+     cause mghAppend to fail.
+  */
+  znzwriteInt(MGH_VERSION, fp);
+  znzwriteInt(mri->width, fp);
+  znzwriteInt(mri->height, fp);
+  znzwriteInt(mri->depth, fp);
+  znzwriteInt(mri->nframes, fp);
+  znzwriteInt(mri->type, fp);
+  znzwriteInt(mri->dof, fp);
+
+  unused_space_size = UNUSED_SPACE_SIZE - USED_SPACE_SIZE - sizeof(short);
+
+  /* write RAS and voxel size info */
+  znzwriteShort(mri->ras_good_flag ? 1 : -1, fp);
+  znzwriteFloat(mri->xsize, fp);
+  znzwriteFloat(mri->ysize, fp);
+  znzwriteFloat(mri->zsize, fp);
+
+  znzwriteFloat(mri->x_r, fp);
+  znzwriteFloat(mri->x_a, fp);
+  znzwriteFloat(mri->x_s, fp);
+
+  znzwriteFloat(mri->y_r, fp);
+  znzwriteFloat(mri->y_a, fp);
+  znzwriteFloat(mri->y_s, fp);
+
+  znzwriteFloat(mri->z_r, fp);
+  znzwriteFloat(mri->z_a, fp);
+  znzwriteFloat(mri->z_s, fp);
+
+  znzwriteFloat(mri->c_r, fp);
+  znzwriteFloat(mri->c_a, fp);
+  znzwriteFloat(mri->c_s, fp);
+
+  /* so stuff can be added to the header in the future */
+  memset(buf, 0, UNUSED_SPACE_SIZE * sizeof(char));
+  znzwrite(buf, sizeof(char), unused_space_size, fp);
+}
+
+/*!
+  \fn static void mghWriteTrailer(MRI *mri, znzFile fp)
+  \brief Writes the scan parameters and tags that follow the voxel data.
+*/
+static void mghWriteTrailer(MRI *mri, znzFile fp)
+{
+  int flen;
+
+  znzwriteFloat(mri->tr, fp);
+  znzwriteFloat(mri->flip_angle, fp);
+  znzwriteFloat(mri->te, fp);
+  znzwriteFloat(mri->ti, fp);
+  znzwriteFloat(mri->fov, fp);
+
+  // if mri->transform_fname has non-zero length
+  // I write a tag with strlength and write it
+  // I increase the tag_datasize with this amount
+  if ((flen = strlen(mri->transform_fname)) > 0) {
+    znzTAGwrite(fp, TAG_MGH_XFORM, mri->transform_fname, flen + 1);
+  }
+  // If we have any saved tag data, write it.
+  if (NULL != mri->tag_data) {
+    // Int is 32 bit on 32 bit and 64 bit os and thus it is safer
+    znzwriteInt(mri->tag_data_size, fp);
+    znzwrite(mri->tag_data, mri->tag_data_size, 1, fp);
+  }
+
+  if (mri->AutoAlign) znzWriteMatrix(fp, mri->AutoAlign);
+  if (mri->pedir)
+    znzTAGwrite(fp, TAG_PEDIR, mri->pedir, strlen(mri->pedir) + 1);
+  else
+    znzTAGwrite(fp, TAG_PEDIR, (void *)"UNKNOWN", strlen("UNKNOWN"));
+  znzTAGwrite(fp, TAG_FIELDSTRENGTH, (void *)(&mri->FieldStrength), sizeof(mri->FieldStrength));
+
+  znzTAGwriteMRIframes(fp, mri);
+
+  if (mri->ct) {
+    znzwriteInt(TAG_OLD_COLORTABLE, fp);
+    znzCTABwriteIntoBinary(mri->ct, fp);
+  }
+
+  // write other tags
+  for (int i = 0; i < mri->ncmds; i++) znzTAGwrite(fp, TAG_CMDLINE, mri->cmdlines[i], strlen(mri->cmdlines[i]) + 1);
+}
+
+/*!
+  \fn static int mghWriteBlocked(MRI *mri, const char *fname, int start_frame, int end_frame)
+  \brief Writes an mgz as a blocked gzip stream (see bgzf.h). The byte stream
+  is identical to the one written by mghWrite(); only the compression differs.
+*/
+static int mghWriteBlocked(MRI *mri, const char *fname, int start_frame, int end_frame)
+{
+  BGZF_WRITER *bw;
+  znzFile fp;
+  char *mbuf;
+  size_t mlen;
+  BUFTYPE *buf;
+  int frame, x, y, z, i, bpv, bytes, err;
+
+  switch (mri->type) {
+    case MRI_UCHAR:
+      bpv = sizeof(BUFTYPE);
+      break;
+    case MRI_SHORT:
+      bpv = sizeof(short);
+      break;
+    case MRI_INT:
+      bpv = sizeof(int);
+      break;
+    case MRI_FLOAT:
+      bpv = sizeof(float);
+      break;
+    default:
+      errno = 0;
+      ErrorReturn(ERROR_UNSUPPORTED, (ERROR_UNSUPPORTED, "mghWrite: unsupported type %d", mri->type));
+  }
+
+  bw = BGZFwriterOpen(fname, Z_DEFAULT_COMPRESSION);
+  if (bw == NULL) {
+    errno = 0;
+    ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "mghWrite(%s): could not open file", fname));
+  }
+
+  // the header is small, so serialize it in memory with the regular writer
+  fp = znzmemopen(&mbuf, &mlen);
+  mghWriteHeader(mri, fp);
+  znzclose(fp);
+  err = BGZFwrite(bw, mbuf, mlen);
+  free(mbuf);
+
+  bytes = mri->width * mri->height * bpv;
+  buf = (BUFTYPE *)calloc(bytes, sizeof(BUFTYPE));
+  for (frame = start_frame; frame <= end_frame && err == NO_ERROR; frame++) {
+    for (z = 0; z < mri->depth && err == NO_ERROR; z++) {
+      for (i = y = 0; y < mri->height; y++) {
+        switch (mri->type) {
+          case MRI_UCHAR:
+            memcpy(buf + i, &MRIseq_vox(mri, 0, y, z, frame), mri->width);
+            i += mri->width;
+            break;
+          case MRI_SHORT:
+            for (x = 0; x < mri->width; x++, i++) ((short *)buf)[i] = orderShortBytes(MRISseq_vox(mri, x, y, z, frame));
+            break;
+          case MRI_INT:
+            for (x = 0; x < mri->width; x++, i++) ((int *)buf)[i] = orderIntBytes(MRIIseq_vox(mri, x, y, z, frame));
+            break;
+          case MRI_FLOAT:
+            for (x = 0; x < mri->width; x++, i++) ((float *)buf)[i] = orderFloatBytes(MRIFseq_vox(mri, x, y, z, frame));
+            break;
+        }
+      }
+      err = BGZFwrite(bw, buf, bytes);
+      exec_progress_callback(z, mri->depth, frame - start_frame, end_frame - start_frame + 1);
+    }
+  }
+  free(buf);
+
+  if (err == NO_ERROR) {
+    fp = znzmemopen(&mbuf, &mlen);
+    mghWriteTrailer(mri, fp);
+    znzclose(fp);
+    err = BGZFwrite(bw, mbuf, mlen);
+    free(mbuf);
+  }
+
+  if (BGZFwriterClose(&bw) != NO_ERROR || err != NO_ERROR) {
+    errno = 0;
+    ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "mghWrite: could not write to %s", fname));
+  }
+  return (NO_ERROR);
+}
+
 static int mghWrite(MRI *mri, const char *fname, int frame)
 {
   znzFile fp;
-  int ival, start_frame, end_frame, x, y, z, width, height, depth, unused_space_size, flen;
-  char buf[UNUSED_SPACE_SIZE + 1];
+  int ival, start_frame, end_frame, x, y, z, width, height, depth;
   float fval;
   short sval;
   int gzipped = 0;
@@ -10519,6 +10782,7 @@ static int mghWrite(MRI *mri, const char *fname, int frame)
     }
   }
   if (valid_ext) {
+    if (gzipped && mriio_mgz_blocked()) return (mghWriteBlocked(mri, fname, start_frame, end_frame));
     fp = znzopen(fname, "wb", gzipped);
     if (znz_isnull(fp)) {
       errno = 0;
@@ -10534,48 +10798,10 @@ static int mghWrite(MRI *mri, const char *fname, int frame)
                  fname));
   }
 
-  /* WARNING - adding or removing anything before nframes will
-     cause mghAppend to fail.
-  */
   width = mri->width;
   height = mri->height;
   depth = mri->depth;
-  // printf("(w,h,d) = (%d,%d,%d)\n", width, height, depth);
-  znzwriteInt(MGH_VERSION, fp);
-  znzwriteInt(mri->width, fp);
-  znzwriteInt(mri->height, fp);
-  znzwriteInt(mri->depth, fp);
-  znzwriteInt(mri->nframes, fp);
-  znzwriteInt(mri->type, fp);
-  znzwriteInt(mri->dof, fp);
-
-  unused_space_size = UNUSED_SPACE_SIZE - USED_SPACE_SIZE - sizeof(short);
-
-  /* write RAS and voxel size info */
-  znzwriteShort(mri->ras_good_flag ? 1 : -1, fp);
-  znzwriteFloat(mri->xsize, fp);
-  znzwriteFloat(mri->ysize, fp);
-  znzwriteFloat(mri->zsize, fp);
-
-  znzwriteFloat(mri->x_r, fp);
-  znzwriteFloat(mri->x_a, fp);
-  znzwriteFloat(mri->x_s, fp);
-
-  znzwriteFloat(mri->y_r, fp);
-  znzwriteFloat(mri->y_a, fp);
-  znzwriteFloat(mri->y_s, fp);
-
-  znzwriteFloat(mri->z_r, fp);
-  znzwriteFloat(mri->z_a, fp);
-  znzwriteFloat(mri->z_s, fp);
-
-  znzwriteFloat(mri->c_r, fp);
-  znzwriteFloat(mri->c_a, fp);
-  znzwriteFloat(mri->c_s, fp);
-
-  /* so stuff can be added to the header in the future */
-  memset(buf, 0, UNUSED_SPACE_SIZE * sizeof(char));
-  znzwrite(buf, sizeof(char), unused_space_size, fp);
+  mghWriteHeader(mri, fp);
 
   for (frame = start_frame; frame <= end_frame; frame++) {
     for (z = 0; z < depth; z++) {
@@ -10621,46 +10847,145 @@ static int mghWrite(MRI *mri, const char *fname, int frame)
     }
   }
 
-  znzwriteFloat(mri->tr, fp);
-  znzwriteFloat(mri->flip_angle, fp);
-  znzwriteFloat(mri->te, fp);
-  znzwriteFloat(mri->ti, fp);
-  znzwriteFloat(mri->fov, fp);
+  mghWriteTrailer(mri, fp);
 
-  // if mri->transform_fname has non-zero length
-  // I write a tag with strlength and write it
-  // I increase the tag_datasize with this amount
-  if ((flen = strlen(mri->transform_fname)) > 0) {
-    znzTAGwrite(fp, TAG_MGH_XFORM, mri->transform_fname, flen + 1);
+  // fclose(fp) ;
+  znzclose(fp);
+
+  return (NO_ERROR);
+}
+
+/*!
+  \struct MRI_FRAME_WRITER
+  \brief State of an mgh/mgz that is being written one frame at a time.
+*/
+struct MRI_FRAME_WRITER {
+  znzFile fp;
+  MRI *hdr;  // geometry, type and number of frames of the whole file
+  int nwritten;
+  char fname[STRLEN];
+};
+
+/*!
+  \fn MRI_FRAME_WRITER *MRIframeWriterOpen(const MRI *tmpl, const char *fname, int nframes)
+  \brief Starts writing an mgh/mgz with nframes frames without ever holding
+  more than one frame in memory. The geometry, type and header come from
+  tmpl (whose own number of frames is ignored). The frames are then passed
+  one at a time to MRIframeWriterAppend(), and MRIframeWriterClose() writes
+  the trailer. mgz files are written as a single gzip stream.
+*/
+MRI_FRAME_WRITER *MRIframeWriterOpen(const MRI *tmpl, const char *fname, int nframes)
+{
+  MRI_FRAME_WRITER *fw;
+  const char *ext;
+  int gzipped = 0;
+
+  switch (tmpl->type) {
+    case MRI_UCHAR:
+    case MRI_SHORT:
+    case MRI_INT:
+    case MRI_FLOAT:
+      break;
+    default:
+      errno = 0;
+      ErrorReturn(NULL, (ERROR_UNSUPPORTED, "MRIframeWriterOpen: unsupported type %d", tmpl->type));
   }
-  // If we have any saved tag data, write it.
-  if (NULL != mri->tag_data) {
-    // Int is 32 bit on 32 bit and 64 bit os and thus it is safer
-    znzwriteInt(mri->tag_data_size, fp);
-    znzwrite(mri->tag_data, mri->tag_data_size, 1, fp);
+
+  ext = strrchr(fname, '.');
+  if (ext == NULL) {
+    errno = 0;
+    ErrorReturn(NULL, (ERROR_BADPARM, "MRIframeWriterOpen: %s needs to have an extension of .mgh or .mgz", fname));
+  }
+  ext++;
+  if (!stricmp(ext, "mgz") || strstr(fname, "mgh.gz"))
+    gzipped = 1;
+  else if (stricmp(ext, "mgh")) {
+    errno = 0;
+    ErrorReturn(NULL, (ERROR_BADPARM, "MRIframeWriterOpen: %s needs to have an extension of .mgh or .mgz", fname));
   }
 
-  if (mri->AutoAlign) znzWriteMatrix(fp, mri->AutoAlign);
-  if (mri->pedir)
-    znzTAGwrite(fp, TAG_PEDIR, mri->pedir, strlen(mri->pedir) + 1);
-  else
-    znzTAGwrite(fp, TAG_PEDIR, (void *)"UNKNOWN", strlen("UNKNOWN"));
-  znzTAGwrite(fp, TAG_FIELDSTRENGTH, (void *)(&mri->FieldStrength), sizeof(mri->FieldStrength));
+  fw = (MRI_FRAME_WRITER *)calloc(1, sizeof(MRI_FRAME_WRITER));
+  fw->fp = znzopen(fname, "wb", gzipped);
+  if (znz_isnull(fw->fp)) {
+    free(fw);
+    errno = 0;
+    ErrorReturn(NULL, (ERROR_BADPARM, "MRIframeWriterOpen(%s): could not open file", fname));
+  }
+  fw->hdr = MRIallocHeader(tmpl->width, tmpl->height, tmpl->depth, tmpl->type, nframes);
+  MRIcopyHeader(tmpl, fw->hdr);
+  strcpy(fw->fname, fname);
 
-  znzTAGwriteMRIframes(fp, mri);
+  mghWriteHeader(fw->hdr, fw->fp);
+  return (fw);
+}
 
-  if (mri->ct) {
-    znzwriteInt(TAG_OLD_COLORTABLE, fp);
-    znzCTABwriteIntoBinary(mri->ct, fp);
+/*!
+  \fn int MRIframeWriterAppend(MRI_FRAME_WRITER *fw, MRI *mri, int frame)
+  \brief Writes the given frame of mri as the next frame of the file. mri
+  must have the geometry and type the writer was opened with.
+*/
+int MRIframeWriterAppend(MRI_FRAME_WRITER *fw, MRI *mri, int frame)
+{
+  int x, y, z;
+
+  if (mri->width != fw->hdr->width || mri->height != fw->hdr->height || mri->depth != fw->hdr->depth ||
+      mri->type != fw->hdr->type) {
+    errno = 0;
+    ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "MRIframeWriterAppend(%s): volume does not match the file", fw->fname));
+  }
+  if (fw->nwritten >= fw->hdr->nframes) {
+    errno = 0;
+    ErrorReturn(ERROR_BADPARM,
+                (ERROR_BADPARM, "MRIframeWriterAppend(%s): all %d frames already written", fw->fname, fw->hdr->nframes));
   }
 
-  // write other tags
-  for (int i = 0; i < mri->ncmds; i++) znzTAGwrite(fp, TAG_CMDLINE, mri->cmdlines[i], strlen(mri->cmdlines[i]) + 1);
+  for (z = 0; z < mri->depth; z++) {
+    for (y = 0; y < mri->height; y++) {
+      switch (mri->type) {
+        case MRI_SHORT:
+          for (x = 0; x < mri->width; x++) znzwriteShort(MRISseq_vox(mri, x, y, z, frame), fw->fp);
+          break;
+        case MRI_INT:
+          for (x = 0; x < mri->width; x++) znzwriteInt(MRIIseq_vox(mri, x, y, z, frame), fw->fp);
+          break;
+        case MRI_FLOAT:
+          for (x = 0; x < mri->width; x++) znzwriteFloat(MRIFseq_vox(mri, x, y, z, frame), fw->fp);
+          break;
+        case MRI_UCHAR:
+          if ((int)znzwrite(&MRIseq_vox(mri, 0, y, z, frame), sizeof(BUFTYPE), mri->width, fw->fp) != mri->width) {
+            errno = 0;
+            ErrorReturn(ERROR_BADFILE,
+                        (ERROR_BADFILE, "MRIframeWriterAppend: could not write %d bytes to %s", mri->width, fw->fname));
+          }
+          break;
+      }
+    }
+  }
+  fw->nwritten++;
+  return (NO_ERROR);
+}
 
-  // fclose(fp) ;
-  znzclose(fp);
+/*!
+  \fn int MRIframeWriterClose(MRI_FRAME_WRITER **pfw)
+  \brief Writes the trailer and closes the file. It is an error to close
+  the writer before all the frames have been appended.
+*/
+int MRIframeWriterClose(MRI_FRAME_WRITER **pfw)
+{
+  MRI_FRAME_WRITER *fw = *pfw;
+  int err = NO_ERROR;
 
-  return (NO_ERROR);
+  if (fw->nwritten != fw->hdr->nframes) {
+    printf("ERROR: MRIframeWriterClose(%s): wrote %d of %d frames\n", fw->fname, fw->nwritten, fw->hdr->nframes);
+    err = ERROR_BADFILE;
+  }
+  else
+    mghWriteTrailer(fw->hdr, fw->fp);
+  znzclose(fw->fp);
+  MRIfree(&fw->hdr);
+  free(fw);
+  *pfw = NULL;
+  return (err);
 }
 
 /*!
@@ -1411,6 +1411,261 @@ MRI_SP *MRISPclone(MRI_SP *mrisp_src)
 
   return (mrisp_dst);
 }
+/*-----------------------------------------------------
+  Spherical harmonic blurring.
+
+  The rows of the parameterization are at phi = u*PI/U_DIM, which is
+  the Driscoll-Healy sampling: with U_DIM = 2B the quadrature below is
+  exact for functions of band limit B, so the transform is computed
+  with a DFT along each row and a Legendre projection per order m.
+  Blurring multiplies the degree l coefficients by the heat kernel
+  exp(-l(l+1)t), which for t = s^2/4 matches the exp(-d^2/s^2) kernel
+  of the spatial blur (s and d in radians).  The cost is independent
+  of sigma, and all the frames are transformed together.
+
+  Selected by setting FREESURFER_MRISPblur_sh.  It is only used for
+  kernels wide enough to suppress the degrees the grid cannot
+  resolve, smaller ones are still done spatially.
+------------------------------------------------------*/
+#define MRISP_SH_MIN_SIGMA 4.0   // in grid cells along u
+
+static bool MRISPuseSH(MRI_SP const *mrisp, double sigma_cells)
+{
+  // read on every call, as NO_SPHERE is, so both ways can be run side by side
+  return getenv("FREESURFER_MRISPblur_sh") != NULL && sigma_cells >= MRISP_SH_MIN_SIGMA && ISEVEN(U_DIM(mrisp)) && V_DIM(mrisp) >= U_DIM(mrisp);
+}
+
+typedef struct MRISP_SH_PLAN
+{
+  int nu, nv, lmax;
+  double *weights;  // quadrature weight of each row, including the 2*PI/nv of the row sum
+  double *cos_mv;   // cos(m*theta_v) at [v*(lmax+1) + m]
+  double *sin_mv;
+  struct MRISP_SH_PLAN *next;
+} MRISP_SH_PLAN;
+
+static MRISP_SH_PLAN *MRISPshPlans = NULL;
+
+static MRISP_SH_PLAN *MRISPshPlanBuild(int nu, int nv)
+{
+  MRISP_SH_PLAN *plan = (MRISP_SH_PLAN *)calloc(1, sizeof(MRISP_SH_PLAN));
+  if (!plan) ErrorExit(ERROR_NOMEMORY, "MRISPshPlanBuild(%d, %d): could not allocate plan", nu, nv);
+  plan->nu = nu;
+  plan->nv = nv;
+  plan->lmax = nu / 2 - 1;
+  plan->weights = (double *)malloc(nu * sizeof(double));
+  plan->cos_mv = (double *)malloc(nv * (plan->lmax + 1) * sizeof(double));
+  plan->sin_mv = (double *)malloc(nv * (plan->lmax + 1) * sizeof(double));
+  if (!plan->weights || !plan->cos_mv || !plan->sin_mv)
+    ErrorExit(ERROR_NOMEMORY, "MRISPshPlanBuild(%d, %d): could not allocate tables", nu, nv);
+
+  int u, v, k, m;
+  for (u = 0; u < nu; u++) {
+    double const phi = (double)u * PHI_MAX / nu;
+    double sum = 0.0;
+    for (k = 0; k < nu / 2; k++) sum += sin((2 * k + 1) * phi) / (2 * k + 1);
+    plan->weights[u] = (4.0 / nu) * sin(phi) * sum * (THETA_MAX / nv);
+  }
+  for (v = 0; v < nv; v++) {
+    double const theta = (double)v * THETA_MAX / nv;
+    for (m = 0; m <= plan->lmax; m++) {
+      plan->cos_mv[v * (plan->lmax + 1) + m] = cos(m * theta);
+      plan->sin_mv[v * (plan->lmax + 1) + m] = sin(m * theta);
+    }
+  }
+  return plan;
+}
+
+/* The cached plan for an nu x nv grid, built on first use. Plans are
+   never changed or freed once they are on the list, so the tables can
+   be read without holding the lock. As in fftPlan1D, the plan is built
+   outside the critical section and dropped if another thread added
+   one for the same grid first. */
+static MRISP_SH_PLAN const *MRISPshPlan(int nu, int nv)
+{
+  MRISP_SH_PLAN *plan, *p;
+
+#ifdef HAVE_OPENMP
+  #pragma omp critical(mrisp_sh_plan)
+#endif
+  {
+    for (plan = MRISPshPlans; plan && (plan->nu != nu || plan->nv != nv); plan = plan->next)
+      ;
+  }
+  if (plan) return plan;
+
+  plan = MRISPshPlanBuild(nu, nv);
+#ifdef HAVE_OPENMP
+  #pragma omp critical(mrisp_sh_plan)
+#endif
+  {
+    for (p = MRISPshPlans; p && (p->nu != nu || p->nv != nv); p = p->next)
+      ;
+    if (p == NULL) {
+      plan->next = MRISPshPlans;
+      MRISPshPlans = plan;
+      p = plan;
+    }
+  }
+  if (p != plan) {
+    // another thread got there first
+    free(plan->sin_mv);
+    free(plan->cos_mv);
+    free(plan->weights);
+    free(plan);
+  }
+  return p;
+}
+
+/* orthonormal associated Legendre functions of order m, degrees m..lmax,
+   with the Condon-Shortley phase, at x = cos(phi), s = sin(phi) */
+static void MRISPshLegendre(double *p, int m, int lmax, double x, double s)
+{
+  double pmm = sqrt(1.0 / (4.0 * M_PI));
+  int k, l;
+  for (k = 1; k <= m; k++) pmm *= -sqrt((2.0 * k + 1.0) / (2.0 * k)) * s;
+  p[m] = pmm;
+  if (m == lmax) return;
+  p[m + 1] = x * sqrt(2.0 * m + 3.0) * pmm;
+  for (l = m + 2; l <= lmax; l++) {
+    double const a = sqrt((4.0 * l * l - 1.0) / ((double)l * l - (double)m * m));
+    double const b = sqrt(((double)(l - 1) * (l - 1) - (double)m * m) / (4.0 * (l - 1) * (l - 1) - 1.0));
+    p[l] = a * (x * p[l - 1] - b * p[l - 2]);
+  }
+}
+
+/* blur the given frames of mrisp_src into mrisp_dst, which may be the same,
+   with the heat kernel matching a spatial kernel of sigma radians */
+static void MRISPblurSH(MRI_SP *mrisp_src, MRI_SP *mrisp_dst, double sigma, int const *frames, int nframes)
+{
+  int const nu = U_DIM(mrisp_src), nv = V_DIM(mrisp_src);
+  MRISP_SH_PLAN const *const plan = MRISPshPlan(nu, nv);
+  int const lmax = plan->lmax, nm = lmax + 1;
+  double const t = sigma * sigma / 4.0;
+
+  // re/im of the row DFTs, [(f*nu + u)*nm + m]
+  double *re = (double *)calloc((size_t)nframes * nu * nm, sizeof(double));
+  double *im = (double *)calloc((size_t)nframes * nu * nm, sizeof(double));
+  if (!re || !im) ErrorExit(ERROR_NOMEMORY, "MRISPblurSH: could not allocate %d frames", nframes);
+
+  int u;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+  for (u = 0; u < nu; u++) {
+    ROMP_PFLB_begin
+    int n, v, m;
+    for (n = 0; n < nframes; n++) {
+      double *const re_u = &re[((size_t)n * nu + u) * nm];
+      double *const im_u = &im[((size_t)n * nu + u) * nm];
+      for (v = 0; v < nv; v++) {
+        double const val = *IMAGEFseq_pix(mrisp_src->Ip, u, v, frames[n]);
+        double const *const c = &plan->cos_mv[v * nm];
+        double const *const s = &plan->sin_mv[v * nm];
+        for (m = 0; m < nm; m++) {
+          re_u[m] += val * c[m];
+          im_u[m] -= val * s[m];
+        }
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  // per order: project onto the Legendre functions, apply the heat kernel, and back
+  int m;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic)
+#endif
+  for (m = 0; m < nm; m++) {
+    ROMP_PFLB_begin
+    double *p = (double *)malloc((size_t)nu * nm * sizeof(double));
+    double *cre = (double *)malloc(nm * sizeof(double));
+    double *cim = (double *)malloc(nm * sizeof(double));
+    int uu, l, n;
+    for (uu = 0; uu < nu; uu++) {
+      double const phi = (double)uu * PHI_MAX / nu;
+      MRISPshLegendre(&p[uu * nm], m, lmax, cos(phi), sin(phi));
+    }
+    for (n = 0; n < nframes; n++) {
+      for (l = m; l <= lmax; l++) cre[l] = cim[l] = 0.0;
+      for (uu = 0; uu < nu; uu++) {
+        size_t const i = ((size_t)n * nu + uu) * nm + m;
+        double const wre = plan->weights[uu] * re[i], wim = plan->weights[uu] * im[i];
+        double const *const pu = &p[uu * nm];
+        for (l = m; l <= lmax; l++) {
+          cre[l] += wre * pu[l];
+          cim[l] += wim * pu[l];
+        }
+      }
+      for (l = m; l <= lmax; l++) {
+        double const k = exp(-l * (l + 1.0) * t);
+        cre[l] *= k;
+        cim[l] *= k;
+      }
+      for (uu = 0; uu < nu; uu++) {
+        size_t const i = ((size_t)n * nu + uu) * nm + m;
+        double const *const pu = &p[uu * nm];
+        double sre = 0.0, sim = 0.0;
+        for (l = m; l <= lmax; l++) {
+          sre += cre[l] * pu[l];
+          sim += cim[l] * pu[l];
+        }
+        re[i] = sre;
+        im[i] = sim;
+      }
+    }
+    free(cim);
+    free(cre);
+    free(p);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  // inverse row DFTs, the negative orders being the conjugates of the positive ones
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+  for (u = 0; u < nu; u++) {
+    ROMP_PFLB_begin
+    int n, v, mm;
+    for (n = 0; n < nframes; n++) {
+      double const *const re_u = &re[((size_t)n * nu + u) * nm];
+      double const *const im_u = &im[((size_t)n * nu + u) * nm];
+      for (v = 0; v < nv; v++) {
+        double const *const c = &plan->cos_mv[v * nm];
+        double const *const s = &plan->sin_mv[v * nm];
+        double val = re_u[0];
+        for (mm = 1; mm < nm; mm++) val += 2.0 * (re_u[mm] * c[mm] - im_u[mm] * s[mm]);
+        *IMAGEFseq_pix(mrisp_dst->Ip, u, v, frames[n]) = val;
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  free(im);
+  free(re);
+}
+
+/* MRISPblurSH on frame fno, or on all of them if fno < 0 */
+static MRI_SP *MRISPblurSHframe(MRI_SP *mrisp_src, MRI_SP *mrisp_dst, float sigma, double sigma_radians, int fno)
+{
+  if (!mrisp_dst) mrisp_dst = MRISPclone(mrisp_src);
+  mrisp_dst->sigma = sigma;
+
+  int nframes = fno < 0 ? mrisp_src->Ip->num_frame : 1, n;
+  int *frames = (int *)calloc(nframes, sizeof(int));
+  for (n = 0; n < nframes; n++) frames[n] = fno < 0 ? n : fno;
+  MRISPblurSH(mrisp_src, mrisp_dst, sigma_radians, frames, nframes);
+  free(frames);
+
+  return (mrisp_dst);
+}
+
 /*-----------------------------------------------------
         Parameters:
 
@@ -1430,6 +1685,9 @@ MRI_SP *MRISPconvolveGaussian(MRI_SP *mrisp_src, MRI_SP *mrisp_dst, float sigma,
   IMAGE *Ip_src, *Ip_dst;
   VECTOR *vec1, *vec2;
 
+  if (radius > 0 && MRISPuseSH(mrisp_src, sigma / radius * U_DIM(mrisp_src) / PHI_MAX))
+    return (MRISPblurSHframe(mrisp_src, mrisp_dst, sigma, sigma / radius, fno));
+
   vec1 = VectorAlloc(3, MATRIX_REAL);
   vec2 = VectorAlloc(3, MATRIX_REAL);
 
@@ -1572,6 +1830,8 @@ MRI_SP *MRISPblur(MRI_SP *mrisp_src, MRI_SP *mrisp_dst, float sigma, int fno) {
     if (!once) { once = true;
         do_old = getenv("FREESUREFER_MRISPblur_old");
     }
+    if (MRISPuseSH(mrisp_src, sigma))
+        return MRISPblurSHframe(mrisp_src, mrisp_dst, sigma, sigma * PHI_MAX / U_DIM(mrisp_src), fno);
     return 
         (do_old ? MRISPblur_old : MRISPblur_new)(mrisp_src, mrisp_dst, sigma, fno);
 }
@@ -2723,6 +2983,13 @@ MRI_SP *MRISPblurFrames(MRI_SP *mrisp_src, MRI_SP *mrisp_dst, float sigma, int *
   double k, *total, ktotal, sigma_sq_inv, udiff, vdiff, sin_sq_u, phi;
   IMAGE *Ip_src, *Ip_dst;
 
+  if (MRISPuseSH(mrisp_src, sigma)) {
+    if (!mrisp_dst) mrisp_dst = MRISPclone(mrisp_src);
+    mrisp_dst->sigma = sigma;
+    MRISPblurSH(mrisp_src, mrisp_dst, sigma * PHI_MAX / U_DIM(mrisp_src), frames, nframes);
+    return (mrisp_dst);
+  }
+
   total = (double *)malloc(nframes * sizeof(double));
 
   no_sphere = getenv("NO_SPHERE") != NULL;
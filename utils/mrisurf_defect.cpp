@@ -1445,7 +1445,7 @@ double mrisComputeDefectLogLikelihood(
     HISTOGRAM *h_dot,
     TOPOLOGY_PARMS *parms)
 {
-  static int first_time = 1;
+  static volatile bool first_time = true;
   double ll = 0.0;
 
   dp->tp.face_ll = 0.0f;
@@ -1454,13 +1454,17 @@ double mrisComputeDefectLogLikelihood(
   dp->tp.qcurv_ll = 0.0f;
   dp->tp.unmri_ll = 0.0f;
 
+  if (first_time)
+#ifdef HAVE_OPENMP
+  #pragma omp critical
+#endif
   if (first_time) {
     l_mri = parms->l_mri;
     l_unmri = parms->l_unmri;
     l_curv = parms->l_curv;
     l_qcurv = parms->l_qcurv;
 
-    first_time = 0;
+    first_time = false;
 
     /*      if (!FZERO(l_mri))
             fprintf(WHICH_OUTPUT,"l_mri = %2.2f ", l_mri) ;
@@ -1473,15 +1477,17 @@ double mrisComputeDefectLogLikelihood(
             fprintf(WHICH_OUTPUT,"\n") ;*/
   }
 
-  if (!FZERO(l_unmri) && (dp->mri_defect->width <= 5 || dp->mri_defect->height <= 5 || dp->mri_defect->depth <= 5)) {
-    l_unmri = 0;
+  // patches may be scored concurrently, so small defects turn the unmri term off locally
+  double unmri = parms->l_unmri;
+  if (!FZERO(unmri) && (dp->mri_defect->width <= 5 || dp->mri_defect->height <= 5 || dp->mri_defect->depth <= 5)) {
+    unmri = 0;
   }
 
   if (!FZERO(l_mri)) {
     ll += l_mri * mrisComputeDefectMRILogLikelihood(mris, mri, &dp->tp, h_white, h_gray, h_grad, mri_gray_white);
   }
-  if (!FZERO(l_unmri)) {
-    ll += l_unmri * mrisComputeDefectMRILogUnlikelihood(computeDefectContext, mris, dp, h_border);
+  if (!FZERO(unmri)) {
+    ll += unmri * mrisComputeDefectMRILogUnlikelihood(computeDefectContext, mris, dp, h_border);
   }
   if (!FZERO(l_qcurv)) {
     /*compute the second fundamental form */
@@ -1492,7 +1498,6 @@ double mrisComputeDefectLogLikelihood(
     ll += l_curv * mrisComputeDefectNormalDotLogLikelihood(mris, &dp->tp, h_dot);
   }
 
-  l_unmri = parms->l_unmri;
   if (mrisCheckDefectFaces(mris, dp) < 0) ll -= 10000000;
 
   return (ll);
@@ -1640,18 +1645,14 @@ double mrisComputeDefectMRILogUnlikelihood(
     DEFECT_PATCH * const dp_nonconst, 
     HISTOGRAM    * const h_border_nonconst) {
 
-    static int once;
-    static int suppress_usecomputeDefectContext = 0;
-    if (!once++) {
-        if (getenv("FREESURFER_SUPPRESS_using_computeDefectContext")) {
-            fprintf(stderr, "Suppressing using computeDefectContext\n");
-            suppress_usecomputeDefectContext = 1;
-        }
-    }
+    // the patches are scored concurrently, so the one-time setup is a function-local static
+    static const bool suppress_usecomputeDefectContext = [] {
+        bool const suppress = !!getenv("FREESURFER_SUPPRESS_using_computeDefectContext");
+        if (suppress) fprintf(stderr, "Suppressing using computeDefectContext\n");
+        return suppress;
+    }();
     if (suppress_usecomputeDefectContext) computeDefectContext = NULL;
     
-    int saved_noteVnoMovedInActiveRealmTreesCount = noteVnoMovedInActiveRealmTreesCount++;
-    
     //  TIMER_INTERVAL_BEGIN(A)
 
     double result = 
@@ -1663,10 +1664,6 @@ double mrisComputeDefectMRILogUnlikelihood(
 
     //  TIMER_INTERVAL_END(A)
 
-    if (0) 
-        printf("noteVnoMovedInActiveRealmTrees called:%d\n",
-            noteVnoMovedInActiveRealmTreesCount-saved_noteVnoMovedInActiveRealmTreesCount);
-
     return result;
 }
 
@@ -1709,25 +1706,29 @@ static void cachedOrComputeVertexPseudoNormal(
   float*               const norm,	    	    // output!
   DEFECT_PATCH const * const dp) {
     
-  static volatile bool once;
-  static bool use_cache, test_cache;
-  if (!once) 
-#ifdef HAVE_OPENMP
-  #pragma omp critical
-#endif
-  if (!once) {
-    use_cache  =  !getenv("FREESURFER_mrisComputeDefectMRILogUnlikelihood_ComputeVertexPseudoNormalCache_suppress");	
-    test_cache = !!getenv("FREESURFER_mrisComputeDefectMRILogUnlikelihood_ComputeVertexPseudoNormalCache_test");	
-    use_cache |= test_cache;
-    if (!use_cache)  
+  struct CacheOptions { bool use_cache, test_cache; };
+  static const CacheOptions options = [] {
+    CacheOptions o;
+    o.use_cache  =  !getenv("FREESURFER_mrisComputeDefectMRILogUnlikelihood_ComputeVertexPseudoNormalCache_suppress");	
+    o.test_cache = !!getenv("FREESURFER_mrisComputeDefectMRILogUnlikelihood_ComputeVertexPseudoNormalCache_test");	
+    o.use_cache |= o.test_cache;
+    if (!o.use_cache)  
       fprintf(stdout, "mrisComputeDefectMRILogUnlikelihood not using ComputeVertexPseudoNormalCache\n");
-    if (test_cache) 
+    if (o.test_cache) 
       fprintf(stdout, "mrisComputeDefectMRILogUnlikelihood testing ComputeVertexPseudoNormalCache\n");
-    once = true;
-  }
+    return o;
+  }();
+  bool const use_cache  = options.use_cache;
+  bool const test_cache = options.test_cache;
 
+  // the statistics are only kept, and shared between threads, when testing the cache
   static long count, limit = 1, hits, invalidates;
-  count++;
+  if (test_cache) {
+#ifdef HAVE_OPENMP
+    #pragma omp atomic
+#endif
+    count++;
+  }
   
   PerThreadVertexPseudoNormalCacheEntry* entry = NULL;
   
@@ -1762,7 +1763,12 @@ static void cachedOrComputeVertexPseudoNormal(
 
       valid = inited && (entry->vno == vno);
       if (valid) {  // use this entry, since is the right one
-	hits++; 
+	if (test_cache) {
+#ifdef HAVE_OPENMP
+	  #pragma omp atomic
+#endif
+	  hits++; 
+	}
 	break; 
       }
       
@@ -1770,7 +1776,12 @@ static void cachedOrComputeVertexPseudoNormal(
     }
     
     if (!valid) {	    	    	// either empty, or too many tries made
-      if (inited) invalidates++;  	// count evictions
+      if (inited && test_cache) {	// count evictions
+#ifdef HAVE_OPENMP
+	#pragma omp atomic
+#endif
+	invalidates++;
+      }
       entry->vno = vno;     	    	// use it
     }
   }
@@ -1800,6 +1811,9 @@ static void cachedOrComputeVertexPseudoNormal(
   }
   
   if (test_cache) {
+#ifdef HAVE_OPENMP
+    #pragma omp critical(cachedOrComputeVertexPseudoNormal_stats)
+#endif
     if (count >= limit) {
       if (limit < 100000) limit *= 2; else limit += 100000;
       fprintf(stdout, "cachedOrComputeVertexPseudoNormal count:%g hits:%g invalidates:%g\n", (float)count, (float)hits, (float)invalidates);
@@ -1819,6 +1833,9 @@ static void useComputeDefectContextRealmTree(
         fprintf(stderr, "%s:%d useComputeDefectContextRealmTree making realmTree\n",__FILE__,__LINE__);
 #endif
         computeDefectContext->realmTree = makeRealmTree(mris, getXYZ);
+#ifdef HAVE_OPENMP
+        #pragma omp atomic
+#endif
         mrisurf_orig_clock++;
         
         insertActiveRealmTree(mris, computeDefectContext->realmTree, getXYZ);
@@ -7435,7 +7452,9 @@ static double mrisDefectPatchFitness(
   VERTEX *v;
   DEFECT *defect = dp->defect;
 
-  defect->vertex_trans = vertex_trans;
+  // the defect is shared by the patches that are scored concurrently, which is why
+  // mrisComputeOptimalRetessellation sets this before scoring and it is only read here then
+  if (defect->vertex_trans != vertex_trans) defect->vertex_trans = vertex_trans;
   dp->verbose_mode = parms->verbose;
 
   /* set the arrays to NULL in dp->tp */
@@ -7504,6 +7523,340 @@ static double mrisDefectPatchFitness(
 }
 
 
+//==================================================================
+// Scoring the patches of the genetic search concurrently
+//
+// Almost all of the time of the genetic search is spent in mrisDefectPatchFitness, which retessellates
+// mris_corrected, scores the patch and then restores the surface.  The patches of a generation can therefore
+// be scored at the same time, provided each thread works on its own copy of what mrisDefectPatchFitness
+// modifies: the surface, the used flags of the edge table and the signed distance volume.
+//
+// A DefectView is such a copy.  mrisRecordVertexState/mrisRestoreVertexState show that only the defect and
+// convex hull vertices have their topology changed, so the view only duplicates their topology arrays
+// and shares those of all the other vertices with mris_corrected, which is not modified while a batch runs.
+//
+// mrisDefectPatchFitness also accumulates vertex statistics in the RP, and these depend on the order the
+// patches are scored in.  Each patch is therefore given its own RP, and the contributions are merged
+// into the real one by commitDefectPatchScore in the order the serial code scored them.
+//
+#define MIN_DEFECT_VERTICES_FOR_VIEWS 50
+
+typedef struct DefectView {
+  MRIS*                 mris;
+  EDGE_TABLE            etable;
+  MRI*                  mri_defect_sign;
+  ComputeDefectContext  computeDefectContext;
+} DefectView;
+
+typedef struct DefectPatchScorer {
+  // the arguments to mrisDefectPatchFitness that are the same for all the patches of a defect
+  ComputeDefectContext* computeDefectContext;
+  MRIS*           mris;
+  MRIS*           mris_corrected;
+  MRI*            mri;
+  int*            vertex_trans;
+  DVS*            dvs;
+  HISTOGRAM       *h_k1, *h_k2;
+  MRI*            mri_k1_k2;
+  HISTOGRAM       *h_white, *h_gray, *h_border, *h_grad;
+  MRI*            mri_gray_white;
+  HISTOGRAM*      h_dot;
+  TOPOLOGY_PARMS* parms;
+  EDGE_TABLE*     etable;
+  MRI*            mri_defect_sign;
+
+  int             nviews;       // 0 when the patches are scored one after the other on mris_corrected
+  DefectView*     views;
+
+  int             max_patches;  // the most patches in one call to scoreDefectPatches
+  RP*             deltas;       // the contribution of each of these patches to the vertex statistics
+} DefectPatchScorer;
+
+
+static MRIS* mrisCopyDefectView(MRIS const * const src, DVS const * const dvs)
+{
+  MRIS* const mris = MRISoverAlloc(src->max_vertices, src->max_faces, src->nvertices, src->nfaces);
+
+  mris->type                 = src->type;
+  mris->status               = src->status;
+  mris->origxyz_status       = src->origxyz_status;
+  mris->patch                = src->patch;
+  mris->hemisphere           = src->hemisphere;
+  mris->useRealRAS           = src->useRealRAS;
+  mris->radius               = src->radius;
+  mris->nsize                = src->nsize;
+  mris->max_nsize            = src->max_nsize;
+  mris->vtotalsMightBeTooBig = src->vtotalsMightBeTooBig;
+  mris->nsizeMaxClock        = src->nsizeMaxClock;
+  copyVolGeom(&src->vg, &mris->vg);
+
+  // the vertices, but not their dist and dist_orig which the retessellation does not use
+  //
+  memcpy(mris->vertices, src->vertices, src->nvertices*sizeof(VERTEX));
+  int vno;
+  for (vno = 0; vno < src->nvertices; vno++) {
+    VERTEX * const v = &mris->vertices[vno];
+    v->dist = v->dist_orig = NULL;
+    v->dist_capacity = v->dist_orig_capacity = 0;
+  }
+
+  // share the topology, except for the vertices that the retessellation changes
+  //
+  memcpy(mris->vertices_topology, src->vertices_topology, src->nvertices*sizeof(VERTEX_TOPOLOGY));
+  int i;
+  for (i = 0; i < dvs->nvertices; i++) {
+    int const vno = dvs->vs[i].vno;
+    if (vno < 0) continue;
+    VERTEX_TOPOLOGY       * const vt  = &mris->vertices_topology[vno];
+    VERTEX_TOPOLOGY const * const svt = &src ->vertices_topology[vno];
+    int const vsize = mrisVertexVSize(src, vno);
+    vt->v = NULL;
+    vt->f = NULL;
+    vt->n = NULL;
+    vt->e = NULL;
+    if (vsize > 0) {
+      vt->v = (int*)malloc(vsize*sizeof(int));
+      if (!vt->v) ErrorExit(ERROR_NOMEMORY, "mrisCopyDefectView: could not allocate %d vlist", vsize);
+      memcpy(vt->v, svt->v, vsize*sizeof(int));
+    }
+    if (svt->num > 0) {
+      vt->f = (int          *)malloc(svt->num*sizeof(int));
+      vt->n = (unsigned char*)malloc(svt->num*sizeof(unsigned char));
+      if (!vt->f || !vt->n) ErrorExit(ERROR_NOMEMORY, "mrisCopyDefectView: could not allocate %d face list", svt->num);
+      memcpy(vt->f, svt->f, svt->num*sizeof(int));
+      memcpy(vt->n, svt->n, svt->num*sizeof(unsigned char));
+    }
+  }
+
+  // all the faces, including the unused ones that the retessellation adds faces into,
+  // but without the matrices which it does not use
+  //
+  memcpy(mris->faces,                   src->faces,                   src->max_faces*sizeof(FACE));
+  memcpy(mris->faceNormCacheEntries,    src->faceNormCacheEntries,    src->max_faces*sizeof(FaceNormCacheEntry));
+  memcpy(mris->faceNormDeferredEntries, src->faceNormDeferredEntries, src->max_faces*sizeof(FaceNormDeferredEntry));
+  int fno;
+  for (fno = 0; fno < src->max_faces; fno++) {
+    FACE * const f = &mris->faces[fno];
+    f->norm = NULL;
+    for (i = 0; i < 3; i++) f->gradNorm[i] = NULL;
+  }
+
+  return mris;
+}
+
+
+static void mrisFreeDefectView(MRIS** pmris, DVS const * const dvs)
+{
+  MRIS* const mris = *pmris;
+
+  int i;
+  for (i = 0; i < dvs->nvertices; i++) {
+    int const vno = dvs->vs[i].vno;
+    if (vno < 0) continue;
+    VERTEX_TOPOLOGY * const vt = &mris->vertices_topology[vno];
+    freeAndNULL(vt->v);
+    freeAndNULL(vt->f);
+    freeAndNULL(vt->n);
+  }
+
+  // the remaining topology arrays belong to the surface the view was copied from
+  int vno;
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX_TOPOLOGY * const vt = &mris->vertices_topology[vno];
+    vt->v = NULL;
+    vt->f = NULL;
+    vt->n = NULL;
+    vt->e = NULL;
+  }
+
+  MRISfree(pmris);
+}
+
+
+static void constructDefectView(DefectView* view, DefectPatchScorer const * const scorer)
+{
+  view->mris = mrisCopyDefectView(scorer->mris_corrected, scorer->dvs);
+
+  view->etable = *scorer->etable;     // the overlap lists are only read
+  view->etable.edges = (EDGE *)malloc(scorer->etable->nedges*sizeof(EDGE));
+  if (!view->etable.edges) ErrorExit(ERROR_NOMEMORY, "constructDefectView: could not allocate %d edges", scorer->etable->nedges);
+  memcpy(view->etable.edges, scorer->etable->edges, scorer->etable->nedges*sizeof(EDGE));
+
+  view->mri_defect_sign = scorer->mri_defect_sign ? MRIcopy(scorer->mri_defect_sign, NULL) : NULL;
+
+  constructComputeDefectContext(&view->computeDefectContext);
+}
+
+
+static void destructDefectView(DefectView* view, DVS const * const dvs)
+{
+  if (!view->mris) return;
+
+  // no need to compute the deferred face normals of a surface that is about to be freed
+  view->computeDefectContext.mris_deferred_norms = NULL;
+  destructComputeDefectContext(&view->computeDefectContext);
+
+  if (view->mri_defect_sign) MRIfree(&view->mri_defect_sign);
+  freeAndNULL(view->etable.edges);
+  mrisFreeDefectView(&view->mris, dvs);
+}
+
+
+static void initDefectPatchScorer(DefectPatchScorer* scorer, int max_patches, bool use_views)
+{
+  DEFECT const * const defect = scorer->dvs->defect;
+
+  scorer->nviews = 0;
+  scorer->views  = NULL;
+  if (use_views && omp_get_max_threads() > 1 && defect->nvertices >= MIN_DEFECT_VERTICES_FOR_VIEWS) {
+    static const bool suppress = [] {
+      bool const suppress = !!getenv("FREESURFER_mrisComputeOptimalRetessellation_serial");
+      if (suppress) fprintf(stdout, "mrisComputeOptimalRetessellation scoring the patches serially\n");
+      return suppress;
+    }();
+    if (!suppress) {
+      scorer->nviews = omp_get_max_threads();
+      scorer->views  = (DefectView*)calloc(scorer->nviews, sizeof(DefectView));
+      if (!scorer->views) ErrorExit(ERROR_NOMEMORY, "initDefectPatchScorer: could not allocate %d views", scorer->nviews);
+    }
+  }
+
+  // the crossovers are scored in pairs with the mutations that may follow them
+  scorer->max_patches = MAX(max_patches, scorer->nviews + 1);
+  scorer->deltas = (RP*)calloc(scorer->max_patches, sizeof(RP));
+  if (!scorer->deltas) ErrorExit(ERROR_NOMEMORY, "initDefectPatchScorer: could not allocate %d patches", scorer->max_patches);
+  int i;
+  for (i = 0; i < scorer->max_patches; i++) {
+    scorer->deltas[i].nused          = (int  *)calloc(defect->nvertices, sizeof(int));
+    scorer->deltas[i].vertex_fitness = (float*)calloc(defect->nvertices, sizeof(float));
+    if (!scorer->deltas[i].nused || !scorer->deltas[i].vertex_fitness)
+      ErrorExit(ERROR_NOMEMORY, "initDefectPatchScorer: could not allocate statistics of %d vertices", defect->nvertices);
+  }
+}
+
+
+static void finiDefectPatchScorer(DefectPatchScorer* scorer)
+{
+  int i;
+  for (i = 0; i < scorer->nviews; i++) destructDefectView(&scorer->views[i], scorer->dvs);
+  freeAndNULL(scorer->views);
+  scorer->nviews = 0;
+
+  for (i = 0; i < scorer->max_patches; i++) {
+    freeAndNULL(scorer->deltas[i].nused);
+    freeAndNULL(scorer->deltas[i].vertex_fitness);
+  }
+  freeAndNULL(scorer->deltas);
+  scorer->max_patches = 0;
+}
+
+
+static void scoreDefectPatch(DefectPatchScorer* scorer, DefectView* view, DEFECT_PATCH* dp, RP* delta)
+{
+  ComputeDefectContext* computeDefectContext = scorer->computeDefectContext;
+  MRIS*                 mris_corrected       = scorer->mris_corrected;
+
+  EDGE_TABLE* const etable          = dp->etable;
+  MRI*        const mri_defect_sign = dp->mri_defect_sign;
+  if (view) {
+    computeDefectContext = &view->computeDefectContext;
+    mris_corrected       = view->mris;
+    dp->etable           = &view->etable;
+    dp->mri_defect_sign  = view->mri_defect_sign;
+  }
+
+  int const nvertices = scorer->dvs->defect->nvertices;
+  memset(delta->nused,          0, nvertices*sizeof(int));
+  memset(delta->vertex_fitness, 0, nvertices*sizeof(float));
+
+  mrisDefectPatchFitness(computeDefectContext,
+                         scorer->mris,
+                         mris_corrected,
+                         scorer->mri,
+                         dp,
+                         scorer->vertex_trans,
+                         scorer->dvs,
+                         delta,
+                         scorer->h_k1,
+                         scorer->h_k2,
+                         scorer->mri_k1_k2,
+                         scorer->h_white,
+                         scorer->h_gray,
+                         scorer->h_border,
+                         scorer->h_grad,
+                         scorer->mri_gray_white,
+                         scorer->h_dot,
+                         scorer->parms);
+
+  dp->etable          = etable;
+  dp->mri_defect_sign = mri_defect_sign;
+}
+
+
+/* score npatches patches, leaving each one's fitness in dps[i]->fitness
+   and its vertex statistics to be merged by commitDefectPatchScore(scorer, rp, i) */
+static void scoreDefectPatches(DefectPatchScorer* scorer, DEFECT_PATCH** dps, int npatches)
+{
+  if (npatches > scorer->max_patches)
+    ErrorExit(ERROR_BADPARM, "scoreDefectPatches: %d patches but only room for %d", npatches, scorer->max_patches);
+
+  // the first patch ever scored initializes various function statics, so do it alone
+  static bool warm = false;
+  int p = 0;
+  if (!scorer->nviews || !warm) {
+    int const nserial = scorer->nviews ? 1 : npatches;
+    for (; p < nserial && p < npatches; p++) scoreDefectPatch(scorer, NULL, dps[p], &scorer->deltas[p]);
+    warm = true;
+  }
+  if (p == npatches) return;
+
+  // bring the existing views up to date with the vertices deleted since the last batch
+  DEFECT const * const defect = scorer->dvs->defect;
+  int i;
+  for (i = 0; i < scorer->nviews; i++) {
+    DefectView* const view = &scorer->views[i];
+    if (!view->mris) continue;
+    memcpy(view->etable.edges, scorer->etable->edges, scorer->etable->nedges*sizeof(EDGE));
+    int n;
+    for (n = 0; n < defect->nvertices; n++) {
+      int const vno = scorer->vertex_trans[defect->vertices[n]];
+      if (vno < 0) continue;
+      view->mris->vertices[vno].ripflag = scorer->mris_corrected->vertices[vno].ripflag;
+    }
+  }
+
+  int const p0 = p;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 1)
+#endif
+  for (p = p0; p < npatches; p++) {
+    ROMP_PFLB_begin
+    DefectView* const view = &scorer->views[omp_get_thread_num()];
+    if (!view->mris) constructDefectView(view, scorer);
+    scoreDefectPatch(scorer, view, dps[p], &scorer->deltas[p]);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
+
+
+/* merge the vertex statistics of the i'th patch of the last batch into rp,
+   giving the same result as updateVertexStatistics would have */
+static void commitDefectPatchScore(DefectPatchScorer* scorer, RP* rp, int i)
+{
+  RP const * const delta = &scorer->deltas[i];
+  int const nvertices = scorer->dvs->defect->nvertices;
+  int n;
+  for (n = 0; n < nvertices; n++) {
+    if (!delta->nused[n]) continue;
+    float const new_fitness = delta->vertex_fitness[n] + (float)rp->nused[n] * rp->vertex_fitness[n];
+    rp->vertex_fitness[n] = new_fitness / ((float)rp->nused[n] + 1.0f);
+    rp->nused[n]++;
+  }
+}
+
+
 #define MAX_DEFECT_VERTICES 900000
 static long ncross = 0;
 static long nmut = 0;
@@ -12166,6 +12519,10 @@ static NOINLINE int mrisComputeOptimalRetessellation_wkr(MRI_SURFACE *mris,
   int ncross_overs, ntotalcross_overs, ntotalmutations, nmutations;
   int nintersections;
   static int first_time = 1;
+  DefectPatchScorer scorer;
+  DEFECT_PATCH **batch, *mutants = NULL;
+  int i0, nbatch, nspeculate, *crossover_p2 = NULL;
+  RANDOM_STATE **crossover_state = NULL;
 
   nbestpatch = number_of_patches = 0;
   ncross_overs = nmutations = 0;
@@ -12379,6 +12736,33 @@ static NOINLINE int mrisComputeOptimalRetessellation_wkr(MRI_SURFACE *mris,
 
     constructComputeDefectContext(&computeDefectContext);
 
+  /* score the patches of a generation concurrently, unless they are being written out as they are scored */
+  scorer.computeDefectContext = &computeDefectContext;
+  scorer.mris = mris;
+  scorer.mris_corrected = mris_corrected;
+  scorer.mri = mri;
+  scorer.vertex_trans = vertex_trans;
+  scorer.dvs = dvs;
+  scorer.h_k1 = h_k1;
+  scorer.h_k2 = h_k2;
+  scorer.mri_k1_k2 = mri_k1_k2;
+  scorer.h_white = h_white;
+  scorer.h_gray = h_gray;
+  scorer.h_border = h_border;
+  scorer.h_grad = h_grad;
+  scorer.mri_gray_white = mri_gray_white;
+  scorer.h_dot = h_dot;
+  scorer.parms = parms;
+  scorer.etable = &etable;
+  scorer.mri_defect_sign = mri_defect_sign;
+  defect->vertex_trans = vertex_trans;
+  initDefectPatchScorer(&scorer, max_patches, debug_patch_n < 0 && !parms->save_fname);
+
+  batch = (DEFECT_PATCH **)calloc(scorer.max_patches, sizeof(DEFECT_PATCH *));
+  if (!batch) ErrorExit(ERROR_NOMEMORY, "could not allocate %d patch pointers", scorer.max_patches);
+  nbatch = scorer.nviews ? max_patches : 1;
+  nspeculate = scorer.nviews ? MAX((scorer.nviews + 1) / 2, 1) : 1;
+
   /* generate initial population of patches */
   if (parms->initial_selection) {
     /* segment overlapping edges into clusters */
@@ -12389,159 +12773,152 @@ static NOINLINE int mrisComputeOptimalRetessellation_wkr(MRI_SURFACE *mris,
     /* generate initial population of patches */
     best_fitness = -1000000;
     best_i = 0;
-    for (i = 0; i < max_patches; i++) {
-      dp = &dps2[i];
-
-      if (parms->retessellation_mode) {
-        dp->retessellation_mode = USE_SOME_VERTICES;
-      }
-      else {
-        dp->retessellation_mode = USE_ALL_VERTICES;
-      }
+    for (i0 = 0; i0 < max_patches; i0 += nbatch) {
+      int const i1 = MIN(i0 + nbatch, max_patches);
+      for (i = i0; i < i1; i++) {
+        dp = &dps2[i];
 
-      dp->nedges = nedges;
-      dp->defect = defect;
-      dp->etable = &etable;
-      dp->ordering = (int *)calloc(nedges, sizeof(int));
-      if (!dp->ordering) ErrorExit(ERROR_NOMEMORY, "could not allocate %dth defect patch with %d indices", i, nedges);
-      for (j = 0; j < nedges; j++) {
-        dp->ordering[j] = j;
-      }
+        if (parms->retessellation_mode) {
+          dp->retessellation_mode = USE_SOME_VERTICES;
+        }
+        else {
+          dp->retessellation_mode = USE_ALL_VERTICES;
+        }
 
-      dp->mri_defect = mri_defect;
-      dp->mri_defect_white = mri_defect_white;
-      dp->mri_defect_gray = mri_defect_gray;
-      dp->mri_defect_sign = mri_defect_sign;
+        dp->nedges = nedges;
+        dp->defect = defect;
+        dp->etable = &etable;
+        dp->ordering = (int *)calloc(nedges, sizeof(int));
+        if (!dp->ordering) ErrorExit(ERROR_NOMEMORY, "could not allocate %dth defect patch with %d indices", i, nedges);
+        for (j = 0; j < nedges; j++) {
+          dp->ordering[j] = j;
+        }
 
-      dp->mri = mri;
+        dp->mri_defect = mri_defect;
+        dp->mri_defect_white = mri_defect_white;
+        dp->mri_defect_gray = mri_defect_gray;
+        dp->mri_defect_sign = mri_defect_sign;
 
-      dp = &dps1[i];
+        dp->mri = mri;
 
-      if (parms->retessellation_mode) {
-        dp->retessellation_mode = USE_SOME_VERTICES;
-      }
-      else {
-        dp->retessellation_mode = USE_ALL_VERTICES;
-      }
+        dp = &dps1[i];
 
-      dp->nedges = nedges;
-      dp->defect = defect;
-      dp->etable = &etable;
-      dp->ordering = (int *)calloc(nedges, sizeof(int));
-      if (!dp->ordering) ErrorExit(ERROR_NOMEMORY, "could not allocate %dth defect patch with %d indices", i, nedges);
-      for (j = 0; j < nedges; j++) {
-        dp->ordering[j] = j;  // nedges-j-1 ;
-      }
-      /* initial in same order -
-         will change later */
+        if (parms->retessellation_mode) {
+          dp->retessellation_mode = USE_SOME_VERTICES;
+        }
+        else {
+          dp->retessellation_mode = USE_ALL_VERTICES;
+        }
 
-      dp->mri_defect = mri_defect;
-      dp->mri_defect_white = mri_defect_white;
-      dp->mri_defect_gray = mri_defect_gray;
-      dp->mri_defect_sign = mri_defect_sign;
+        dp->nedges = nedges;
+        dp->defect = defect;
+        dp->etable = &etable;
+        dp->ordering = (int *)calloc(nedges, sizeof(int));
+        if (!dp->ordering) ErrorExit(ERROR_NOMEMORY, "could not allocate %dth defect patch with %d indices", i, nedges);
+        for (j = 0; j < nedges; j++) {
+          dp->ordering[j] = j;  // nedges-j-1 ;
+        }
+        /* initial in same order -
+           will change later */
 
-      dp->mri = mri;
+        dp->mri_defect = mri_defect;
+        dp->mri_defect_white = mri_defect_white;
+        dp->mri_defect_gray = mri_defect_gray;
+        dp->mri_defect_sign = mri_defect_sign;
 
-      /* generate ordering from edge segmentation */
-      generateOrdering(dp, segmentation, i);
+        dp->mri = mri;
 
-      fitness = mrisDefectPatchFitness(&computeDefectContext,
-                                       mris,
-                                       mris_corrected,
-                                       mri,
-                                       dp,
-                                       vertex_trans,
-                                       dvs,
-                                       &rp,
-                                       h_k1,
-                                       h_k2,
-                                       mri_k1_k2,
-                                       h_white,
-                                       h_gray,
-                                       h_border,
-                                       h_grad,
-                                       mri_gray_white,
-                                       h_dot,
-                                       parms);
+        /* generate ordering from edge segmentation */
+        generateOrdering(dp, segmentation, i);
 
-#if SAVE_FIT_VALS
-      fitness_values[number_of_patches] = fitness;
-      if (number_of_patches)
-        best_values[number_of_patches] = MAX(best_values[number_of_patches - 1], fitness);
-      else {
-        best_values[number_of_patches] = fitness;
+        batch[i - i0] = dp;
       }
-#endif
-      number_of_patches++;
+      scoreDefectPatches(&scorer, batch, i1 - i0);
 
-      if (parms->verbose == VERBOSE_MODE_LOW)
-        fprintf(WHICH_OUTPUT, "for the patch #%d, we have fitness = %f \n", i, fitness);
+      for (i = i0; i < i1; i++) {
+        dp = &dps1[i];
+        commitDefectPatchScore(&scorer, &rp, i - i0);
+        fitness = dp->fitness;
 
-      /* saving the initial selection */
-      if (parms->save_fname && (parms->defect_number < 0 || (parms->defect_number == defect->defect_number))) {
-        sprintf(fname, "%s/rh.defect_%d_select%d", parms->save_fname, defect->defect_number, i);
-        savePatch(mri, mris, mris_corrected, dvs, dp, fname, parms);
-        if (parms->movie) {
-          sprintf(fname, "%s/rh.defect_%d_movie_%d", parms->save_fname, defect->defect_number, nmovies++);
-          savePatch(mri, mris, mris_corrected, dvs, dp, fname, parms);
+#if SAVE_FIT_VALS
+        fitness_values[number_of_patches] = fitness;
+        if (number_of_patches)
+          best_values[number_of_patches] = MAX(best_values[number_of_patches - 1], fitness);
+        else {
+          best_values[number_of_patches] = fitness;
         }
-      }
+#endif
+        number_of_patches++;
 
-      if (!i)  // fisrt patch
-      {
-        memmove(rp.best_ordering, dp->ordering, nedges * sizeof(int));
-        memmove(rp.status, defect->status, defect->nvertices * sizeof(char));
-        dp->defect->initial_face_ll = dp->tp.face_ll;
-        dp->defect->initial_vertex_ll = dp->tp.vertex_ll;
-        dp->defect->initial_curv_ll = dp->tp.curv_ll;
-        dp->defect->initial_qcurv_ll = dp->tp.qcurv_ll;
-        dp->defect->initial_mri_ll = dp->tp.mri_ll;
-        dp->defect->initial_unmri_ll = dp->tp.unmri_ll;
+        if (parms->verbose == VERBOSE_MODE_LOW)
+          fprintf(WHICH_OUTPUT, "for the patch #%d, we have fitness = %f \n", i, fitness);
 
-        if (parms->verbose == VERBOSE_MODE_LOW) {
-          fprintf(WHICH_OUTPUT, "initial defect\n");
-          printDefectStatistics(dp);
-        }
-        best_fitness = fitness;
-        best_i = 0;
-        // saving first patch
+        /* saving the initial selection */
         if (parms->save_fname && (parms->defect_number < 0 || (parms->defect_number == defect->defect_number))) {
-          sprintf(fname, "%s/rh.defect_%d_best_%d", parms->save_fname, defect->defect_number, nbests++);
+          sprintf(fname, "%s/rh.defect_%d_select%d", parms->save_fname, defect->defect_number, i);
           savePatch(mri, mris, mris_corrected, dvs, dp, fname, parms);
+          if (parms->movie) {
+            sprintf(fname, "%s/rh.defect_%d_movie_%d", parms->save_fname, defect->defect_number, nmovies++);
+            savePatch(mri, mris, mris_corrected, dvs, dp, fname, parms);
+          }
         }
 
-        if (++nbest == debug_patch_n) {
-          goto debug_use_this_patch;
+        if (!i)  // fisrt patch
+        {
+          memmove(rp.best_ordering, dp->ordering, nedges * sizeof(int));
+          memmove(rp.status, defect->status, defect->nvertices * sizeof(char));
+          dp->defect->initial_face_ll = dp->tp.face_ll;
+          dp->defect->initial_vertex_ll = dp->tp.vertex_ll;
+          dp->defect->initial_curv_ll = dp->tp.curv_ll;
+          dp->defect->initial_qcurv_ll = dp->tp.qcurv_ll;
+          dp->defect->initial_mri_ll = dp->tp.mri_ll;
+          dp->defect->initial_unmri_ll = dp->tp.unmri_ll;
+
+          if (parms->verbose == VERBOSE_MODE_LOW) {
+            fprintf(WHICH_OUTPUT, "initial defect\n");
+            printDefectStatistics(dp);
+          }
+          best_fitness = fitness;
+          best_i = 0;
+          // saving first patch
+          if (parms->save_fname && (parms->defect_number < 0 || (parms->defect_number == defect->defect_number))) {
+            sprintf(fname, "%s/rh.defect_%d_best_%d", parms->save_fname, defect->defect_number, nbests++);
+            savePatch(mri, mris, mris_corrected, dvs, dp, fname, parms);
+          }
+
+          if (++nbest == debug_patch_n) {
+            goto debug_use_this_patch;
+          }
         }
-      }
 
-      if (fitness > best_fitness) {
-        best_fitness = fitness;
-        best_i = i;
-        if (parms->verbose > VERBOSE_MODE_DEFAULT)
-          fprintf(WHICH_OUTPUT, "new optimal fitness found at %d: %2.4f\n", i, fitness);
+        if (fitness > best_fitness) {
+          best_fitness = fitness;
+          best_i = i;
+          if (parms->verbose > VERBOSE_MODE_DEFAULT)
+            fprintf(WHICH_OUTPUT, "new optimal fitness found at %d: %2.4f\n", i, fitness);
 
-        nfinalvertices = nremovedvertices;
-        nbestpatch = number_of_patches;
+          nfinalvertices = nremovedvertices;
+          nbestpatch = number_of_patches;
 
-        rp.best_fitness = best_fitness;
-        /* save ordering*/
-        memmove(rp.best_ordering, dp->ordering, nedges * sizeof(int));
-        /* save current status of vertices */
-        memmove(rp.status, defect->status, defect->nvertices * sizeof(char));
+          rp.best_fitness = best_fitness;
+          /* save ordering*/
+          memmove(rp.best_ordering, dp->ordering, nedges * sizeof(int));
+          /* save current status of vertices */
+          memmove(rp.status, defect->status, defect->nvertices * sizeof(char));
 
-        if (parms->verbose == VERBOSE_MODE_LOW) {
-          printDefectStatistics(dp);
-        }
-        if (parms->save_fname && (parms->defect_number < 0 || (parms->defect_number == defect->defect_number))) {
-          sprintf(fname, "%s/rh.defect_%d_best_%d_%d", parms->save_fname, defect->defect_number, ngenerations, i);
-          savePatch(mri, mris, mris_corrected, dvs, dp, fname, parms);
-          sprintf(fname, "%s/rh.defect_%d_best_%d", parms->save_fname, defect->defect_number, nbests++);
-          savePatch(mri, mris, mris_corrected, dvs, dp, fname, parms);
-        }
+          if (parms->verbose == VERBOSE_MODE_LOW) {
+            printDefectStatistics(dp);
+          }
+          if (parms->save_fname && (parms->defect_number < 0 || (parms->defect_number == defect->defect_number))) {
+            sprintf(fname, "%s/rh.defect_%d_best_%d_%d", parms->save_fname, defect->defect_number, ngenerations, i);
+            savePatch(mri, mris, mris_corrected, dvs, dp, fname, parms);
+            sprintf(fname, "%s/rh.defect_%d_best_%d", parms->save_fname, defect->defect_number, nbests++);
+            savePatch(mri, mris, mris_corrected, dvs, dp, fname, parms);
+          }
 
-        if (++nbest == debug_patch_n) {
-          goto debug_use_this_patch;
+          if (++nbest == debug_patch_n) {
+            goto debug_use_this_patch;
+          }
         }
       }
     }
@@ -12553,190 +12930,184 @@ static NOINLINE int mrisComputeOptimalRetessellation_wkr(MRI_SURFACE *mris,
     /* generate initial population of patches */
     best_fitness = -1000000;
     best_i = 0;
-    for (i = 0; i < max_patches; i++) {
-      dp = &dps2[i];
+    for (i0 = 0; i0 < max_patches; i0 += nbatch) {
+      int const i1 = MIN(i0 + nbatch, max_patches);
+      for (i = i0; i < i1; i++) {
+        dp = &dps2[i];
 
-      if (parms->retessellation_mode) {
-        dp->retessellation_mode = USE_SOME_VERTICES;
-      }
-      else {
-        dp->retessellation_mode = USE_ALL_VERTICES;
-      }
+        if (parms->retessellation_mode) {
+          dp->retessellation_mode = USE_SOME_VERTICES;
+        }
+        else {
+          dp->retessellation_mode = USE_ALL_VERTICES;
+        }
 
-      dp->nedges = nedges;
-      dp->defect = defect;
-      dp->etable = &etable;
-      dp->ordering = (int *)calloc(nedges, sizeof(int));
-      if (!dp->ordering) ErrorExit(ERROR_NOMEMORY, "could not allocate %dth defect patch with %d indices", i, nedges);
-      for (j = 0; j < nedges; j++) {
-        dp->ordering[j] = j;
-      } /* initial in same order -
-                                               will change later */
+        dp->nedges = nedges;
+        dp->defect = defect;
+        dp->etable = &etable;
+        dp->ordering = (int *)calloc(nedges, sizeof(int));
+        if (!dp->ordering) ErrorExit(ERROR_NOMEMORY, "could not allocate %dth defect patch with %d indices", i, nedges);
+        for (j = 0; j < nedges; j++) {
+          dp->ordering[j] = j;
+        } /* initial in same order -
+                                                 will change later */
 
-      dp->mri_defect = mri_defect;
-      dp->mri_defect_white = mri_defect_white;
-      dp->mri_defect_gray = mri_defect_gray;
-      dp->mri_defect_sign = mri_defect_sign;
+        dp->mri_defect = mri_defect;
+        dp->mri_defect_white = mri_defect_white;
+        dp->mri_defect_gray = mri_defect_gray;
+        dp->mri_defect_sign = mri_defect_sign;
 
-      dp->mri = mri;
+        dp->mri = mri;
 
-      dp = &dps1[i];
+        dp = &dps1[i];
 
-      if (parms->retessellation_mode) {
-        dp->retessellation_mode = USE_SOME_VERTICES;
-      }
-      else {
-        dp->retessellation_mode = USE_ALL_VERTICES;
-      }
+        if (parms->retessellation_mode) {
+          dp->retessellation_mode = USE_SOME_VERTICES;
+        }
+        else {
+          dp->retessellation_mode = USE_ALL_VERTICES;
+        }
 
-      dp->nedges = nedges;
-      dp->defect = defect;
-      dp->etable = &etable;
-      dp->ordering = (int *)calloc(nedges, sizeof(int));
-      if (!dp->ordering) ErrorExit(ERROR_NOMEMORY, "could not allocate %dth defect patch with %d indices", i, nedges);
-      for (j = 0; j < nedges; j++) {
-        dp->ordering[j] = j;
-      } /* initial in same order -
-                                               will change later */
+        dp->nedges = nedges;
+        dp->defect = defect;
+        dp->etable = &etable;
+        dp->ordering = (int *)calloc(nedges, sizeof(int));
+        if (!dp->ordering) ErrorExit(ERROR_NOMEMORY, "could not allocate %dth defect patch with %d indices", i, nedges);
+        for (j = 0; j < nedges; j++) {
+          dp->ordering[j] = j;
+        } /* initial in same order -
+                                                 will change later */
 
-      dp->mri_defect = mri_defect;
-      dp->mri_defect_white = mri_defect_white;
-      dp->mri_defect_gray = mri_defect_gray;
-      dp->mri_defect_sign = mri_defect_sign;
+        dp->mri_defect = mri_defect;
+        dp->mri_defect_white = mri_defect_white;
+        dp->mri_defect_gray = mri_defect_gray;
+        dp->mri_defect_sign = mri_defect_sign;
 
-      dp->mri = mri;
+        dp->mri = mri;
 
-      if (i) /* first one is in same order as original edge table */
-      {
-        mrisMutateDefectPatch(dp, &etable, MUTATION_PCT_INIT);
+        if (i) /* first one is in same order as original edge table */
+        {
+          mrisMutateDefectPatch(dp, &etable, MUTATION_PCT_INIT);
+        }
+
+        batch[i - i0] = dp;
       }
+      scoreDefectPatches(&scorer, batch, i1 - i0);
+
+      for (i = i0; i < i1; i++) {
+        dp = &dps1[i];
+        commitDefectPatchScore(&scorer, &rp, i - i0);
+        fitness = dp->fitness;
 
-      fitness = mrisDefectPatchFitness(&computeDefectContext,
-                                       mris,
-                                       mris_corrected,
-                                       mri,
-                                       dp,
-                                       vertex_trans,
-                                       dvs,
-                                       &rp,
-                                       h_k1,
-                                       h_k2,
-                                       mri_k1_k2,
-                                       h_white,
-                                       h_gray,
-                                       h_border,
-                                       h_grad,
-                                       mri_gray_white,
-                                       h_dot,
-                                       parms);
 #if SAVE_FIT_VALS
-      fitness_values[number_of_patches] = fitness;
-      if (number_of_patches)
-        best_values[number_of_patches] = MAX(best_values[number_of_patches - 1], fitness);
-      else {
-        best_values[number_of_patches] = fitness;
-      }
+        fitness_values[number_of_patches] = fitness;
+        if (number_of_patches)
+          best_values[number_of_patches] = MAX(best_values[number_of_patches - 1], fitness);
+        else {
+          best_values[number_of_patches] = fitness;
+        }
 #endif
-      number_of_patches++;
-
-      if (i == 0 && Gdiag & 0x1000000) {
-        int i;
-        char fname[STRLEN];
-        int req = snprintf(fname, STRLEN, "%s_defect%d_%03d", mris->fname.data(), dno - 1, sno++); 
-	if( req >= STRLEN ) {
-	  std::cerr << __FUNCTION__ << ": Truncation on line " << __LINE__ << std::endl;
-	}
-        dp = &dps[best_i];
-        mrisRetessellateDefect(
-            mris, mris_corrected, dp->defect, vertex_trans, dp->etable->edges, dp->nedges, dp->ordering, dp->etable);
-        MRISsaveVertexPositions(mris_corrected, TMP_VERTICES);
-        MRISrestoreVertexPositions(mris_corrected, ORIGINAL_VERTICES);
-        fprintf(WHICH_OUTPUT, "writing surface snapshow to %s...\n", fname);
-        MRISwrite(mris_corrected, fname);
-        MRISrestoreVertexPositions(mris_corrected, TMP_VERTICES);
-        mrisRestoreVertexState(mris_corrected, dvs);
-        /* reset the edges to the unused state
-           (unless they were in the original tessellation */
-        for (i = 0; i < dp->nedges; i++)
-          if (dp->etable->edges[i].used == USED_IN_NEW_TESSELLATION) {
-            dp->etable->edges[i].used = NOT_USED;
-          }
-      }
+        number_of_patches++;
 
-      /* saving the initial selection */
-      if (parms->save_fname && (parms->defect_number < 0 || (parms->defect_number == defect->defect_number))) {
-        sprintf(fname, "%s/rh.defect_%d_select%d", parms->save_fname, defect->defect_number, i);
-        savePatch(mri, mris, mris_corrected, dvs, dp, fname, parms);
-        if (parms->movie) {
-          sprintf(fname, "%s/rh.defect_%d_movie_%d", parms->save_fname, defect->defect_number, nmovies++);
-          savePatch(mri, mris, mris_corrected, dvs, dp, fname, parms);
+        if (i == 0 && Gdiag & 0x1000000) {
+          int i;
+          char fname[STRLEN];
+          int req = snprintf(fname, STRLEN, "%s_defect%d_%03d", mris->fname.data(), dno - 1, sno++); 
+  	if( req >= STRLEN ) {
+  	  std::cerr << __FUNCTION__ << ": Truncation on line " << __LINE__ << std::endl;
+  	}
+          dp = &dps[best_i];
+          mrisRetessellateDefect(
+              mris, mris_corrected, dp->defect, vertex_trans, dp->etable->edges, dp->nedges, dp->ordering, dp->etable);
+          MRISsaveVertexPositions(mris_corrected, TMP_VERTICES);
+          MRISrestoreVertexPositions(mris_corrected, ORIGINAL_VERTICES);
+          fprintf(WHICH_OUTPUT, "writing surface snapshow to %s...\n", fname);
+          MRISwrite(mris_corrected, fname);
+          MRISrestoreVertexPositions(mris_corrected, TMP_VERTICES);
+          mrisRestoreVertexState(mris_corrected, dvs);
+          /* reset the edges to the unused state
+             (unless they were in the original tessellation */
+          for (i = 0; i < dp->nedges; i++)
+            if (dp->etable->edges[i].used == USED_IN_NEW_TESSELLATION) {
+              dp->etable->edges[i].used = NOT_USED;
+            }
         }
-      }
 
-      if (!i) {
-        memmove(rp.best_ordering, dp->ordering, nedges * sizeof(int));
-        memmove(rp.status, defect->status, defect->nvertices * sizeof(char));
-
-        dp->defect->initial_face_ll = dp->tp.face_ll;
-        dp->defect->initial_vertex_ll = dp->tp.vertex_ll;
-        dp->defect->initial_curv_ll = dp->tp.curv_ll;
-        dp->defect->initial_qcurv_ll = dp->tp.qcurv_ll;
-        dp->defect->initial_mri_ll = dp->tp.mri_ll;
-        dp->defect->initial_unmri_ll = dp->tp.unmri_ll;
-        if (parms->verbose == VERBOSE_MODE_LOW) {
-          fprintf(WHICH_OUTPUT,
-                  "defect %d: initial fitness = %2.4e, "
-                  "nvertices=%d, nedges=%d, max patches=%d\n",
-                  dno - 1,
-                  fitness,
-                  defect->nvertices,
-                  nedges,
-                  max_patches);
-          printDefectStatistics(dp);
-        }
-        best_fitness = fitness;
-        best_i = 0;
-
-        // saving first patch
+        /* saving the initial selection */
         if (parms->save_fname && (parms->defect_number < 0 || (parms->defect_number == defect->defect_number))) {
-          sprintf(fname, "%s/rh.defect_%d_best_%d", parms->save_fname, defect->defect_number, nbests++);
+          sprintf(fname, "%s/rh.defect_%d_select%d", parms->save_fname, defect->defect_number, i);
           savePatch(mri, mris, mris_corrected, dvs, dp, fname, parms);
+          if (parms->movie) {
+            sprintf(fname, "%s/rh.defect_%d_movie_%d", parms->save_fname, defect->defect_number, nmovies++);
+            savePatch(mri, mris, mris_corrected, dvs, dp, fname, parms);
+          }
         }
-        if (++nbest == debug_patch_n) {
-          goto debug_use_this_patch;
+
+        if (!i) {
+          memmove(rp.best_ordering, dp->ordering, nedges * sizeof(int));
+          memmove(rp.status, defect->status, defect->nvertices * sizeof(char));
+
+          dp->defect->initial_face_ll = dp->tp.face_ll;
+          dp->defect->initial_vertex_ll = dp->tp.vertex_ll;
+          dp->defect->initial_curv_ll = dp->tp.curv_ll;
+          dp->defect->initial_qcurv_ll = dp->tp.qcurv_ll;
+          dp->defect->initial_mri_ll = dp->tp.mri_ll;
+          dp->defect->initial_unmri_ll = dp->tp.unmri_ll;
+          if (parms->verbose == VERBOSE_MODE_LOW) {
+            fprintf(WHICH_OUTPUT,
+                    "defect %d: initial fitness = %2.4e, "
+                    "nvertices=%d, nedges=%d, max patches=%d\n",
+                    dno - 1,
+                    fitness,
+                    defect->nvertices,
+                    nedges,
+                    max_patches);
+            printDefectStatistics(dp);
+          }
+          best_fitness = fitness;
+          best_i = 0;
+
+          // saving first patch
+          if (parms->save_fname && (parms->defect_number < 0 || (parms->defect_number == defect->defect_number))) {
+            sprintf(fname, "%s/rh.defect_%d_best_%d", parms->save_fname, defect->defect_number, nbests++);
+            savePatch(mri, mris, mris_corrected, dvs, dp, fname, parms);
+          }
+          if (++nbest == debug_patch_n) {
+            goto debug_use_this_patch;
+          }
         }
-      }
 
-      if (fitness > best_fitness) {
-        best_fitness = fitness;
-        best_i = i;
-        if (parms->verbose > VERBOSE_MODE_DEFAULT)
-          fprintf(WHICH_OUTPUT,
-                  "new optimal fitness found at %d: "
-                  "%2.4f\n",
-                  i,
-                  fitness);
+        if (fitness > best_fitness) {
+          best_fitness = fitness;
+          best_i = i;
+          if (parms->verbose > VERBOSE_MODE_DEFAULT)
+            fprintf(WHICH_OUTPUT,
+                    "new optimal fitness found at %d: "
+                    "%2.4f\n",
+                    i,
+                    fitness);
 
-        nfinalvertices = nremovedvertices;
-        nbestpatch = number_of_patches;
+          nfinalvertices = nremovedvertices;
+          nbestpatch = number_of_patches;
 
-        rp.best_fitness = best_fitness;
-        /* save ordering*/
-        memmove(rp.best_ordering, dp->ordering, nedges * sizeof(int));
-        /* save current status of vertices */
-        memmove(rp.status, defect->status, defect->nvertices * sizeof(char));
+          rp.best_fitness = best_fitness;
+          /* save ordering*/
+          memmove(rp.best_ordering, dp->ordering, nedges * sizeof(int));
+          /* save current status of vertices */
+          memmove(rp.status, defect->status, defect->nvertices * sizeof(char));
 
-        if (parms->verbose == VERBOSE_MODE_LOW) {
-          printDefectStatistics(dp);
-        }
-        if (parms->save_fname && (parms->defect_number < 0 || (parms->defect_number == defect->defect_number))) {
-          sprintf(fname, "%s/rh.defect_%d_best_%d_%d", parms->save_fname, defect->defect_number, ngenerations, i);
-          savePatch(mri, mris, mris_corrected, dvs, dp, fname, parms);
-          sprintf(fname, "%s/rh.defect_%d_best_%d", parms->save_fname, defect->defect_number, nbests++);
-          savePatch(mri, mris, mris_corrected, dvs, dp, fname, parms);
-        }
-        if (++nbest == debug_patch_n) {
-          goto debug_use_this_patch;
+          if (parms->verbose == VERBOSE_MODE_LOW) {
+            printDefectStatistics(dp);
+          }
+          if (parms->save_fname && (parms->defect_number < 0 || (parms->defect_number == defect->defect_number))) {
+            sprintf(fname, "%s/rh.defect_%d_best_%d_%d", parms->save_fname, defect->defect_number, ngenerations, i);
+            savePatch(mri, mris, mris_corrected, dvs, dp, fname, parms);
+            sprintf(fname, "%s/rh.defect_%d_best_%d", parms->save_fname, defect->defect_number, nbests++);
+            savePatch(mri, mris, mris_corrected, dvs, dp, fname, parms);
+          }
+          if (++nbest == debug_patch_n) {
+            goto debug_use_this_patch;
+          }
         }
       }
     }
@@ -12789,6 +13160,18 @@ static NOINLINE int mrisComputeOptimalRetessellation_wkr(MRI_SURFACE *mris,
 
   last_fitness = best_fitness;
 
+  /* the crossovers scored together, and the mutations that might follow them */
+  crossover_p2 = (int *)calloc(nspeculate, sizeof(int));
+  crossover_state = (RANDOM_STATE **)calloc(nspeculate, sizeof(RANDOM_STATE *));
+  mutants = (DEFECT_PATCH *)calloc(nspeculate, sizeof(DEFECT_PATCH));
+  if (!crossover_p2 || !crossover_state || !mutants)
+    ErrorExit(ERROR_NOMEMORY, "could not allocate %d speculative crossovers", nspeculate);
+  for (i = 0; i < nspeculate; i++) {
+    mutants[i] = dps1[0];
+    mutants[i].ordering = (int *)calloc(nedges, sizeof(int));
+    if (!mutants[i].ordering) ErrorExit(ERROR_NOMEMORY, "could not allocate mutant patch with %d indices", nedges);
+  }
+
   ROMP_SCOPE_end
 
   ROMP_SCOPE_begin
@@ -12822,87 +13205,80 @@ static NOINLINE int mrisComputeOptimalRetessellation_wkr(MRI_SURFACE *mris,
     ROMP_SCOPE_begin
     
     /* now replace the worst ones with mutated copies of the best */
-    for (i = 0; i < nreplacements; i++) {
-      ntotalmutations++;
-
-      dp = &dps_next_generation[next_gen_index++];
-      mrisCopyDefectPatch(&dps[ranks[i]], dp);
-      mrisMutateDefectPatch(dp, &etable, MUTATION_PCT);
-      fitness = mrisDefectPatchFitness(&computeDefectContext,
-                                       mris,
-                                       mris_corrected,
-                                       mri,
-                                       dp,
-                                       vertex_trans,
-                                       dvs,
-                                       &rp,
-                                       h_k1,
-                                       h_k2,
-                                       mri_k1_k2,
-                                       h_white,
-                                       h_gray,
-                                       h_border,
-                                       h_grad,
-                                       mri_gray_white,
-                                       h_dot,
-                                       parms);
-#if SAVE_FIT_VALS
-      fitness_values[number_of_patches] = fitness;
-      if (number_of_patches)
-        best_values[number_of_patches] = MAX(best_values[number_of_patches - 1], fitness);
-      else {
-        best_values[number_of_patches] = fitness;
+    for (i0 = 0; i0 < nreplacements; i0 += nbatch) {
+      int const i1 = MIN(i0 + nbatch, nreplacements);
+      for (i = i0; i < i1; i++) {
+        dp = &dps_next_generation[next_gen_index + i - i0];
+        mrisCopyDefectPatch(&dps[ranks[i]], dp);
+        mrisMutateDefectPatch(dp, &etable, MUTATION_PCT);
+        batch[i - i0] = dp;
       }
+      scoreDefectPatches(&scorer, batch, i1 - i0);
+
+      for (i = i0; i < i1; i++) {
+        ntotalmutations++;
+
+        dp = &dps_next_generation[next_gen_index++];
+        commitDefectPatchScore(&scorer, &rp, i - i0);
+        fitness = dp->fitness;
+#if SAVE_FIT_VALS
+        fitness_values[number_of_patches] = fitness;
+        if (number_of_patches)
+          best_values[number_of_patches] = MAX(best_values[number_of_patches - 1], fitness);
+        else {
+          best_values[number_of_patches] = fitness;
+        }
 #endif
-      number_of_patches++;
+        number_of_patches++;
 
-      if (fitness > best_fitness) {
-        nmutations++;
-        nunchanged = 0;
-        best_fitness = fitness;
-        best_i = next_gen_index - 1;
+        if (fitness > best_fitness) {
+          nmutations++;
+          nunchanged = 0;
+          best_fitness = fitness;
+          best_i = next_gen_index - 1;
 
-        nfinalvertices = nremovedvertices;
-        nbestpatch = number_of_patches;
+          nfinalvertices = nremovedvertices;
+          nbestpatch = number_of_patches;
 
-        rp.best_fitness = best_fitness;
-        /* save ordering*/
-        memmove(rp.best_ordering, dp->ordering, nedges * sizeof(int));
-        /* save current status of vertices */
-        memmove(rp.status, defect->status, defect->nvertices * sizeof(char));
+          rp.best_fitness = best_fitness;
+          /* save ordering*/
+          memmove(rp.best_ordering, dp->ordering, nedges * sizeof(int));
+          /* save current status of vertices */
+          memmove(rp.status, defect->status, defect->nvertices * sizeof(char));
 
-        if (parms->verbose > VERBOSE_MODE_DEFAULT)
-          fprintf(WHICH_OUTPUT,
-                  "replacement %d MUTATION: new optimal "
-                  "fitness found at %d: %2.4e\n",
-                  i,
-                  best_i,
-                  fitness);
-        if (parms->verbose == VERBOSE_MODE_LOW) {
-          printDefectStatistics(dp);
-        }
-        if (parms->save_fname && (parms->defect_number < 0 || (parms->defect_number == defect->defect_number))) {
-          sprintf(fname,
-                  "%s/rh.defect_%d_surf_%d_%d",
-                  parms->save_fname,
-                  defect->defect_number,
-                  ngenerations - 1,
-                  ranks[i]);
-          savePatch(mri, mris, mris_corrected, dvs, &dps[ranks[i]], fname, parms);
-          sprintf(
-              fname, "%s/rh.defect_%d_best_%d_%dm", parms->save_fname, defect->defect_number, ngenerations, ranks[i]);
-          savePatch(mri, mris, mris_corrected, dvs, dp, fname, parms);
-          sprintf(fname, "%s/rh.defect_%d_best_%d", parms->save_fname, defect->defect_number, nbests++);
-          savePatch(mri, mris, mris_corrected, dvs, dp, fname, parms);
-          if (parms->movie) {
-            sprintf(fname, "%s/rh.defect_%d_movie_%d", parms->save_fname, defect->defect_number, nmovies++);
+          if (parms->verbose > VERBOSE_MODE_DEFAULT)
+            fprintf(WHICH_OUTPUT,
+                    "replacement %d MUTATION: new optimal "
+                    "fitness found at %d: %2.4e\n",
+                    i,
+                    best_i,
+                    fitness);
+          if (parms->verbose == VERBOSE_MODE_LOW) {
+            printDefectStatistics(dp);
+          }
+          if (parms->save_fname && (parms->defect_number < 0 || (parms->defect_number == defect->defect_number))) {
+            sprintf(fname,
+                    "%s/rh.defect_%d_surf_%d_%d",
+                    parms->save_fname,
+                    defect->defect_number,
+                    ngenerations - 1,
+                    ranks[i]);
+            savePatch(mri, mris, mris_corrected, dvs, &dps[ranks[i]], fname, parms);
+            sprintf(
+                fname, "%s/rh.defect_%d_best_%d_%dm", parms->save_fname, defect->defect_number, ngenerations, ranks[i]);
+            savePatch(mri, mris, mris_corrected, dvs, dp, fname, parms);
+            sprintf(fname, "%s/rh.defect_%d_best_%d", parms->save_fname, defect->defect_number, nbests++);
             savePatch(mri, mris, mris_corrected, dvs, dp, fname, parms);
+            if (parms->movie) {
+              sprintf(fname, "%s/rh.defect_%d_movie_%d", parms->save_fname, defect->defect_number, nmovies++);
+              savePatch(mri, mris, mris_corrected, dvs, dp, fname, parms);
+            }
+          }
+          nmut++;
+          if (++nbest == debug_patch_n) {
+            dps = dps_next_generation;
+            goto debug_use_this_patch;
           }
-        }
-        nmut++;
-        if (++nbest == debug_patch_n) {
-          dps = dps_next_generation;
-          goto debug_use_this_patch;
         }
       }
     }
@@ -12998,142 +13374,46 @@ static NOINLINE int mrisComputeOptimalRetessellation_wkr(MRI_SURFACE *mris,
     ROMP_SCOPE_end
     ROMP_SCOPE_begin
 
-    for (i = 0; i < ncrossovers; i++) {
-      int p1, p2;
-      ntotalcross_overs++;
-
-      p1 = selected[i];
-      do /* select second parent at random */
-      {
-        p2 = selected[(int)randomNumber(0, ncrossovers - .001)];
-      } while (p2 == p1);
+    for (i = 0; i < ncrossovers;) {
+      int const nwindow = MIN(nspeculate, ncrossovers - i);
+      int w, nbatched = 0;
 
       ROMP_SCOPE_begin
 
-      dp = &dps_next_generation[next_gen_index++];
-      mrisCrossoverDefectPatches(&dps[p1], &dps[p2], dp, &etable);
-      fitness = mrisDefectPatchFitness(&computeDefectContext,
-                                       mris,
-                                       mris_corrected,
-                                       mri,
-                                       dp,
-                                       vertex_trans,
-                                       dvs,
-                                       &rp,
-                                       h_k1,
-                                       h_k2,
-                                       mri_k1_k2,
-                                       h_white,
-                                       h_gray,
-                                       h_border,
-                                       h_grad,
-                                       mri_gray_white,
-                                       h_dot,
-                                       parms);
-#if SAVE_FIT_VALS
-      fitness_values[number_of_patches] = fitness;
-      if (number_of_patches)
-        best_values[number_of_patches] = MAX(best_values[number_of_patches - 1], fitness);
-      else {
-        best_values[number_of_patches] = fitness;
-      }
-#endif
-      number_of_patches++;
-
-      ROMP_SCOPE_end
-
-      if (fitness > best_fitness) {
-
-        ROMP_SCOPE_begin
-
-        ncross_overs++;
-        nunchanged = 0;
-        best_fitness = fitness;
-        best_i = next_gen_index - 1;
-
-        nfinalvertices = nremovedvertices;
-        nbestpatch = number_of_patches;
+      for (w = 0; w < nwindow; w++) {
+        int const p1 = selected[i + w];
+        int p2;
+        do /* select second parent at random */
+        {
+          p2 = selected[(int)randomNumber(0, ncrossovers - .001)];
+        } while (p2 == p1);
+        crossover_p2[w] = p2;
 
-        rp.best_fitness = best_fitness;
-        /* save ordering*/
-        memmove(rp.best_ordering, dp->ordering, nedges * sizeof(int));
-        /* save current status of vertices */
-        memmove(rp.status, defect->status, defect->nvertices * sizeof(char));
+        dp = &dps_next_generation[next_gen_index + w];
+        mrisCrossoverDefectPatches(&dps[p1], &dps[p2], dp, &etable);
+        batch[nbatched++] = dp;
 
-        if (parms->verbose > VERBOSE_MODE_DEFAULT)
-          fprintf(WHICH_OUTPUT,
-                  "CROSSOVER (%d x %d): new optimal fitness "
-                  "found at %d: %2.4e\n",
-                  dps[p1].rank,
-                  dps[p2].rank,
-                  best_i,
-                  fitness);
-        if (parms->verbose == VERBOSE_MODE_LOW) {
-          printDefectStatistics(dp);
-        }
-        if (parms->save_fname && (parms->defect_number < 0 || (parms->defect_number == defect->defect_number))) {
-          sprintf(fname,
-                  "%s/rh.defect_%d_surf_%d_%d",
-                  parms->save_fname,
-                  defect->defect_number,
-                  ngenerations - 1,
-                  dps[p1].rank);
-          savePatch(mri, mris, mris_corrected, dvs, &dps[p1], fname, parms);
-          sprintf(fname,
-                  "%s/rh.defect_%d_surf_%d_%d",
-                  parms->save_fname,
-                  defect->defect_number,
-                  ngenerations - 1,
-                  dps[p2].rank);
-          savePatch(mri, mris, mris_corrected, dvs, &dps[p2], fname, parms);
-          sprintf(fname,
-                  "%s/rh.defect_%d_best_%d_%dc%d_%d",
-                  parms->save_fname,
-                  defect->defect_number,
-                  ngenerations,
-                  best_i,
-                  dps[p1].rank,
-                  dps[p2].rank);
-          savePatch(mri, mris, mris_corrected, dvs, dp, fname, parms);
-          sprintf(fname, "%s/rh.defect_%d_best_%d", parms->save_fname, defect->defect_number, nbests++);
-          savePatch(mri, mris, mris_corrected, dvs, dp, fname, parms);
-          if (parms->movie) {
-            sprintf(fname, "%s/rh.defect_%d_movie_%d", parms->save_fname, defect->defect_number, nmovies++);
-            savePatch(mri, mris, mris_corrected, dvs, dp, fname, parms);
-          }
+        /* when several crossovers are scored at once, the mutation that follows a crossover
+           that is not an improvement is scored along with it, and the random numbers it drew
+           are given back if the crossover turns out to be an improvement after all */
+        if (nspeculate > 1) {
+          crossover_state[w] = getRandomState();
+          mrisCopyDefectPatch(dp, &mutants[w]);
+          mrisMutateDefectPatch(&mutants[w], &etable, MUTATION_PCT);
+          batch[nbatched++] = &mutants[w];
         }
+      }
+      scoreDefectPatches(&scorer, batch, nbatched);
 
-        ROMP_SCOPE_end
+      ROMP_SCOPE_end
 
-        ncross++;
-        if (++nbest == debug_patch_n) {
-          dps = dps_next_generation;
-          goto debug_use_this_patch;
-        }
-      }
-      else /* mutate it also */
-      {
-        ROMP_SCOPE_begin
+      for (w = 0; w < nwindow; w++) {
+        int const p1 = selected[i++], p2 = crossover_p2[w];
+        ntotalcross_overs++;
 
-        mrisMutateDefectPatch(dp, &etable, MUTATION_PCT);
-        fitness = mrisDefectPatchFitness(&computeDefectContext,
-                                         mris,
-                                         mris_corrected,
-                                         mri,
-                                         dp,
-                                         vertex_trans,
-                                         dvs,
-                                         &rp,
-                                         h_k1,
-                                         h_k2,
-                                         mri_k1_k2,
-                                         h_white,
-                                         h_gray,
-                                         h_border,
-                                         h_grad,
-                                         mri_gray_white,
-                                         h_dot,
-                                         parms);
+        dp = &dps_next_generation[next_gen_index++];
+        commitDefectPatchScore(&scorer, &rp, nspeculate > 1 ? 2 * w : 0);
+        fitness = dp->fitness;
 #if SAVE_FIT_VALS
         fitness_values[number_of_patches] = fitness;
         if (number_of_patches)
@@ -13143,10 +13423,12 @@ static NOINLINE int mrisComputeOptimalRetessellation_wkr(MRI_SURFACE *mris,
         }
 #endif
         number_of_patches++;
-        ntotalmutations++;
 
         if (fitness > best_fitness) {
-          nmutations++;
+
+          ROMP_SCOPE_begin
+
+          ncross_overs++;
           nunchanged = 0;
           best_fitness = fitness;
           best_i = next_gen_index - 1;
@@ -13162,8 +13444,8 @@ static NOINLINE int mrisComputeOptimalRetessellation_wkr(MRI_SURFACE *mris,
 
           if (parms->verbose > VERBOSE_MODE_DEFAULT)
             fprintf(WHICH_OUTPUT,
-                    "CROSSOVER (%d x %d) & MUTATION: "
-                    "new optimal fitness found at %d: %2.4e\n",
+                    "CROSSOVER (%d x %d): new optimal fitness "
+                    "found at %d: %2.4e\n",
                     dps[p1].rank,
                     dps[p2].rank,
                     best_i,
@@ -13187,7 +13469,7 @@ static NOINLINE int mrisComputeOptimalRetessellation_wkr(MRI_SURFACE *mris,
                     dps[p2].rank);
             savePatch(mri, mris, mris_corrected, dvs, &dps[p2], fname, parms);
             sprintf(fname,
-                    "%s/rh.defect_%d_best_%d_%dcm%d_%d",
+                    "%s/rh.defect_%d_best_%d_%dc%d_%d",
                     parms->save_fname,
                     defect->defect_number,
                     ngenerations,
@@ -13195,7 +13477,6 @@ static NOINLINE int mrisComputeOptimalRetessellation_wkr(MRI_SURFACE *mris,
                     dps[p1].rank,
                     dps[p2].rank);
             savePatch(mri, mris, mris_corrected, dvs, dp, fname, parms);
-
             sprintf(fname, "%s/rh.defect_%d_best_%d", parms->save_fname, defect->defect_number, nbests++);
             savePatch(mri, mris, mris_corrected, dvs, dp, fname, parms);
             if (parms->movie) {
@@ -13204,16 +13485,116 @@ static NOINLINE int mrisComputeOptimalRetessellation_wkr(MRI_SURFACE *mris,
             }
           }
 
+          ROMP_SCOPE_end
+
+          ncross++;
           if (++nbest == debug_patch_n) {
             dps = dps_next_generation;
             goto debug_use_this_patch;
           }
-          nmut++;
-          ncross++;
+
+          if (nspeculate > 1) {
+            /* the crossovers after this one were made from random numbers
+               that the serial search would have drawn differently */
+            setRandomState(crossover_state[w]);
+            break;
+          }
         }
+        else /* mutate it also */
+        {
+          if (nspeculate > 1) {
+            DEFECT_PATCH const crossover = *dp;
+            *dp = mutants[w];
+            mutants[w] = crossover;
+            commitDefectPatchScore(&scorer, &rp, 2 * w + 1);
+          }
+          else {
+            mrisMutateDefectPatch(dp, &etable, MUTATION_PCT);
+            scoreDefectPatches(&scorer, &dp, 1);
+            commitDefectPatchScore(&scorer, &rp, 0);
+          }
+          fitness = dp->fitness;
+#if SAVE_FIT_VALS
+          fitness_values[number_of_patches] = fitness;
+          if (number_of_patches)
+            best_values[number_of_patches] = MAX(best_values[number_of_patches - 1], fitness);
+          else {
+            best_values[number_of_patches] = fitness;
+          }
+#endif
+          number_of_patches++;
+          ntotalmutations++;
+
+          if (fitness > best_fitness) {
+            nmutations++;
+            nunchanged = 0;
+            best_fitness = fitness;
+            best_i = next_gen_index - 1;
+
+            nfinalvertices = nremovedvertices;
+            nbestpatch = number_of_patches;
+
+            rp.best_fitness = best_fitness;
+            /* save ordering*/
+            memmove(rp.best_ordering, dp->ordering, nedges * sizeof(int));
+            /* save current status of vertices */
+            memmove(rp.status, defect->status, defect->nvertices * sizeof(char));
+
+            if (parms->verbose > VERBOSE_MODE_DEFAULT)
+              fprintf(WHICH_OUTPUT,
+                      "CROSSOVER (%d x %d) & MUTATION: "
+                      "new optimal fitness found at %d: %2.4e\n",
+                      dps[p1].rank,
+                      dps[p2].rank,
+                      best_i,
+                      fitness);
+            if (parms->verbose == VERBOSE_MODE_LOW) {
+              printDefectStatistics(dp);
+            }
+            if (parms->save_fname && (parms->defect_number < 0 || (parms->defect_number == defect->defect_number))) {
+              sprintf(fname,
+                      "%s/rh.defect_%d_surf_%d_%d",
+                      parms->save_fname,
+                      defect->defect_number,
+                      ngenerations - 1,
+                      dps[p1].rank);
+              savePatch(mri, mris, mris_corrected, dvs, &dps[p1], fname, parms);
+              sprintf(fname,
+                      "%s/rh.defect_%d_surf_%d_%d",
+                      parms->save_fname,
+                      defect->defect_number,
+                      ngenerations - 1,
+                      dps[p2].rank);
+              savePatch(mri, mris, mris_corrected, dvs, &dps[p2], fname, parms);
+              sprintf(fname,
+                      "%s/rh.defect_%d_best_%d_%dcm%d_%d",
+                      parms->save_fname,
+                      defect->defect_number,
+                      ngenerations,
+                      best_i,
+                      dps[p1].rank,
+                      dps[p2].rank);
+              savePatch(mri, mris, mris_corrected, dvs, dp, fname, parms);
+
+              sprintf(fname, "%s/rh.defect_%d_best_%d", parms->save_fname, defect->defect_number, nbests++);
+              savePatch(mri, mris, mris_corrected, dvs, dp, fname, parms);
+              if (parms->movie) {
+                sprintf(fname, "%s/rh.defect_%d_movie_%d", parms->save_fname, defect->defect_number, nmovies++);
+                savePatch(mri, mris, mris_corrected, dvs, dp, fname, parms);
+              }
+            }
 
-        ROMP_SCOPE_end
+            if (++nbest == debug_patch_n) {
+              dps = dps_next_generation;
+              goto debug_use_this_patch;
+            }
+            nmut++;
+            ncross++;
+          }
+        }
       }
+
+      for (w = 0; w < nwindow; w++) freeRandomState(&crossover_state[w]);
     }
 
     ROMP_SCOPE_end
@@ -13492,6 +13873,7 @@ debug_use_this_patch:
   ROMP_SCOPE_begin
 
   /* free everything */
+  finiDefectPatchScorer(&scorer);
   destructComputeDefectContext(&computeDefectContext);
   mrisFreeDefectVertexState(dvs);
 
@@ -13499,6 +13881,15 @@ debug_use_this_patch:
     free(dps1[i].ordering);
     free(dps2[i].ordering);
   }
+  if (mutants) {
+    for (i = 0; i < nspeculate; i++) {
+      free(mutants[i].ordering);
+    }
+    free(mutants);
+  }
+  free(crossover_state);
+  free(crossover_p2);
+  free(batch);
 
   if (etable.use_overlap) {
     for (i = 0; i < nedges; i++) {
@@ -14185,16 +14576,14 @@ static int mrisRetessellateDefect(MRI_SURFACE *mris,
 
 static int intersectDefectEdges(MRI_SURFACE *mris, DEFECT *defect, EDGE *e, IntersectDefectEdgesContext* ctx, int *vertex_trans, int *v1, int *v2)
 {
-  static long stats_count    = 0;
-  static long stats_limit    = 1;
+  // diagnostics only; kept per thread since the patches may be scored concurrently
+  static thread_local long stats_count    = 0;
+  static thread_local long stats_limit    = 1;
   
-  static int once;
-  static bool asked_do_old_way,asked_do_new_way,asked_do_stats;
-  if (!once++) {
-    if (getenv("FREESURFER_intersectDefectEdges_old"))   asked_do_old_way = true;
-    if (getenv("FREESURFER_intersectDefectEdges_new"))   asked_do_new_way = true;
-    if (getenv("FREESURFER_intersectDefectEdges_stats")) asked_do_stats   = true;
-  }
+  // called while the patches are scored concurrently, so the environment is read by a function-local static
+  static const bool asked_do_old_way = !!getenv("FREESURFER_intersectDefectEdges_old");
+  static const bool asked_do_new_way = !!getenv("FREESURFER_intersectDefectEdges_new");
+  static const bool asked_do_stats   = !!getenv("FREESURFER_intersectDefectEdges_stats");
   bool do_old_way = asked_do_old_way;
   bool do_new_way = asked_do_new_way || !asked_do_old_way;
   
@@ -14243,7 +14632,7 @@ static int intersectDefectEdges(MRI_SURFACE *mris, DEFECT *defect, EDGE *e, Inte
   
   if (do_old_way) {
 
-    static long stats_tried = 0;
+    static thread_local long stats_tried = 0;
 
     ROMP_SCOPE_begin
     int i;
@@ -14317,14 +14706,14 @@ static int intersectDefectEdges(MRI_SURFACE *mris, DEFECT *defect, EDGE *e, Inte
   }
   
   if (do_new_way) {
-    static long stats_made;                 // the GreatArcSet
-    static long stats_reused;
-    static long stats_revised;
-    static long stats_numberOfGreatArcs;    // #entries in the GreatArcSet
+    static thread_local long stats_made;                 // the GreatArcSet
+    static thread_local long stats_reused;
+    static thread_local long stats_revised;
+    static thread_local long stats_numberOfGreatArcs;    // #entries in the GreatArcSet
     
-    static long stats_addedVertexs, stats_addedArcs, stats_movedArcs, stats_unmovedArcs;
-    static long stats_possible;
-    static long stats_tried;
+    static thread_local long stats_addedVertexs, stats_addedArcs, stats_movedArcs, stats_unmovedArcs;
+    static thread_local long stats_possible;
+    static thread_local long stats_tried;
     
     GreatArcSet* gas = ctx->greatArcSet;
     
@@ -14412,7 +14801,7 @@ static int intersectDefectEdges(MRI_SURFACE *mris, DEFECT *defect, EDGE *e, Inte
             ||  v2->cz != entry->cz2
                ) {                                       // true to tell GreatArcSet it has moved
 
-                static int show_moves_count, show_moves_limit = 1;
+                static thread_local int show_moves_count, show_moves_limit = 1;
                 if (show_moves_count++ == show_moves_limit) {
                     if (show_moves_limit < 20) show_moves_limit++;
                     else if (show_moves_limit < 1024) show_moves_limit *= 2;
@@ -3804,18 +3804,14 @@ int MRIStaubinSmooth(MRI_SURFACE *mris, int niters, double lambda, double mu, in
 /*-------------------------------------------------------------------
   MRISgaussianSmooth() - perform gaussian smoothing on a spherical
   surface. The gaussian is defined by stddev GStd and is truncated
-  at TruncFactor stddevs. Note: this will change the val2bak of all
-  the vertices. See also MRISspatialFilter() and MRISgaussianWeights().
+  at TruncFactor stddevs. The smoothing is built as a sparse operator
+  (see MRISsmoothOpGaussian(), which can cache it on disk) and applied
+  to all the frames at once. See also MRISspatialFilter() and
+  MRISgaussianWeights().
   -------------------------------------------------------------------*/
 MRI *MRISgaussianSmooth(MRIS *Surf, MRI *Src, double GStd, MRI *Targ, double TruncFactor)
 {
-  int vtxno1, vtxno2;
-  float val;
-  MRI *SrcTmp, *GSum, *GSum2, *nXNbrsMRI;
-  VERTEX *vtx1;
-  double Radius, Radius2, dmax, GVar2, f, d, costheta, theta, g, dotprod;
-  int n, err, nXNbrs, *XNbrVtxNo, frame;
-  double *XNbrDotProd, DotProdThresh;
+  MRIS_SMOOTH_OP *op;
   double InterVertexDistAvg, InterVertexDistStdDev;
   double VertexRadiusAvg, VertexRadiusStdDev;
 
@@ -3843,35 +3839,7 @@ MRI *MRISgaussianSmooth(MRIS *Surf, MRI *Src, double GStd, MRI *Targ, double Tru
     }
   }
 
-  /* Make a copy in case it's done in place */
-  SrcTmp = MRIcopy(Src, NULL);
-
-  /* This is for normalizing */
-  GSum = MRIallocSequence(Src->width, Src->height, Src->depth, MRI_FLOAT, 1);
-  if (GSum == NULL) {
-    printf("ERROR: MRISgaussianSmooth: could not alloc GSum\n");
-    return (NULL);
-  }
-
-  GSum2 = MRIallocSequence(Src->width, Src->height, Src->depth, MRI_FLOAT, 1);
-  if (GSum2 == NULL) {
-    printf("ERROR: MRISgaussianSmooth: could not alloc GSum2\n");
-    return (NULL);
-  }
-
   MRIScomputeMetricProperties(Surf);
-  nXNbrsMRI = MRIallocSequence(Src->width, Src->height, Src->depth, MRI_FLOAT, 1);
-
-  vtx1 = &Surf->vertices[0];
-  Radius2 = (vtx1->x * vtx1->x) + (vtx1->y * vtx1->y) + (vtx1->z * vtx1->z);
-  Radius = sqrt(Radius2);
-  dmax = TruncFactor * GStd;  // truncate after TruncFactor stddevs
-  GVar2 = 2 * (GStd * GStd);
-  f = pow(1 / (sqrt(2 * M_PI) * GStd), 2.0);  // squared for 2D
-  DotProdThresh = Radius2 * cos(dmax / Radius) * (1.0001);
-
-  printf(
-      "Radius = %g, gstd = %g, dmax = %g, GVar2 = %g, f = %g, dpt = %g\n", Radius, GStd, dmax, GVar2, f, DotProdThresh);
 
   InterVertexDistAvg = Surf->avg_vertex_dist;
   InterVertexDistStdDev = Surf->std_vertex_dist;
@@ -3880,98 +3848,11 @@ MRI *MRISgaussianSmooth(MRIS *Surf, MRI *Src, double GStd, MRI *Targ, double Tru
   printf("Total Area = %g \n", Surf->total_area);
   printf("Dist   = %g +/- %g\n", InterVertexDistAvg, InterVertexDistStdDev);
   printf("Radius = %g +/- %g\n", VertexRadiusAvg, VertexRadiusStdDev);
-
-  /* Initialize */
-  for (vtxno1 = 0; vtxno1 < Surf->nvertices; vtxno1++) {
-    MRIFseq_vox(GSum, vtxno1, 0, 0, 0) = 0;
-    MRIFseq_vox(GSum2, vtxno1, 0, 0, 0) = 0;
-    for (frame = 0; frame < Targ->nframes; frame++) {
-      MRIFseq_vox(Targ, vtxno1, 0, 0, frame) = 0;
-    }
-    Surf->vertices[vtxno1].val2bak = -1;
-  }
-
-  /* These are needed by MRISextendedNeighbors()*/
-  XNbrVtxNo = (int *)calloc(Surf->nvertices, sizeof(int));
-  XNbrDotProd = (double *)calloc(Surf->nvertices, sizeof(double));
-
   printf("nvertices = %d\n", Surf->nvertices);
-  for (vtxno1 = 0; vtxno1 < Surf->nvertices; vtxno1++) {
-    nXNbrs = 0;
-    err =
-        MRISextendedNeighbors(Surf, vtxno1, vtxno1, DotProdThresh, XNbrVtxNo, XNbrDotProd, &nXNbrs, Surf->nvertices, 1);
-    MRIFseq_vox(nXNbrsMRI, vtxno1, 0, 0, 0) = nXNbrs;
-
-    if (vtxno1 % 10000 == 0 && Gdiag_no > 0) {
-      printf("vtxno1 = %d, nXNbrs = %d\n", vtxno1, nXNbrs);
-      fflush(stdout);
-    }
-
-    for (n = 0; n < nXNbrs; n++) {
-      vtxno2 = XNbrVtxNo[n];
-      dotprod = XNbrDotProd[n];
-      costheta = dotprod / Radius2;
-
-      // cos theta might be slightly > 1 due to precision
-      if (costheta > +1.0) {
-        costheta = +1.0;
-      }
-      if (costheta < -1.0) {
-        costheta = -1.0;
-      }
-
-      // Compute the angle between the vertices
-      theta = acos(costheta);
-
-      /* Compute the distance bet vertices along the surface of the sphere */
-      d = Radius * theta;
-
-      /* Compute weighting factor for this distance */
-      g = f * exp(-(d * d) / (GVar2)); /* f not really nec */
-      // ga = g * Surf->vertices[vtxno2].area;
-
-      if (vtxno1 == 10000 && 1) {
-        printf("%d %d %g %g %g %g %g\n", vtxno1, vtxno2, dotprod, costheta, theta, d, g);
-        fflush(stdout);
-      }
-
-      // MRIFseq_vox(GSum,vtxno1,0,0,0)  += g;
-      // MRIFseq_vox(GSum2,vtxno1,0,0,0) += (g*g);
-
-      for (frame = 0; frame < Targ->nframes; frame++) {
-        val = g * MRIFseq_vox(SrcTmp, vtxno2, 0, 0, frame);
-        MRIFseq_vox(Targ, vtxno1, 0, 0, frame) += val;
-      }
-
-    } /* end loop over vertex2 */
-
-  } /* end loop over vertex1 */
-
-  /* Normalize */
-  if (0) {
-    for (vtxno1 = 0; vtxno1 < Surf->nvertices; vtxno1++) {
-      vtx1 = &Surf->vertices[vtxno1];
-      g = MRIFseq_vox(GSum, vtxno1, 0, 0, 0);
-      MRIFseq_vox(GSum2, vtxno1, 0, 0, 0) /= (g * g);
-
-      for (frame = 0; frame < Targ->nframes; frame++) {
-        val = MRIFseq_vox(Targ, vtxno1, 0, 0, frame);
-        MRIFseq_vox(Targ, vtxno1, 0, 0, frame) = val / g;
-      }
-    }
-  }
-
-  // MRIwrite(GSum,"gsum.mgh");
-  // MRIwrite(GSum2,"gsum2.mgh");
-  // MRIwrite(nXNbrsMRI,"nxnbrs.mgh");
-
-  MRIfree(&SrcTmp);
-  MRIfree(&GSum);
-  MRIfree(&GSum2);
-  MRIfree(&nXNbrsMRI);
 
-  free(XNbrVtxNo);
-  free(XNbrDotProd);
+  op = MRISsmoothOpGaussian(Surf, GStd, TruncFactor);
+  Targ = MRISsmoothOpApply(op, Src, 1, Targ);  // handles Src == Targ
+  MRISsmoothOpFree(&op);
 
   return (Targ);
 }
@@ -4804,11 +4685,13 @@ int MRISrigidBodyAlignGlobal(
   static bool 
     once,
     use_old,
-    use_new;
+    use_new,
+    use_sh;
 
   if (!once) { once = true;
     use_old = !!getenv("FREESURFER_MRISrigidBodyAlignGlobal_useOld");
     use_new = !!getenv("FREESURFER_MRISrigidBodyAlignGlobal_useNew") || !use_old ;
+    use_sh  = !!getenv("FREESURFER_MRISrigidBodyAlignGlobal_useSH");
   }
 
   double new_mina = 666.0, new_minb = 666.0, new_ming = 666.0, new_sse = 666.0;
@@ -4817,13 +4700,13 @@ int MRISrigidBodyAlignGlobal(
 
   if (use_new) {
   
-    printf("Starting new MRISrigidBodyAlignGlobal_findMinSSE()\n");
+    printf("Starting new MRISrigidBodyAlignGlobal_findMinSSE%s()\n", use_sh ? "_SH" : "");
     Timer new_timer;
     
     // This does not modify either mris or params until after the old code has executed
     //
     double ext_sse = (gMRISexternalSSE) ? (*gMRISexternalSSE)(mris, parms) : 0.0;
-    MRISrigidBodyAlignGlobal_findMinSSE(
+    (use_sh ? MRISrigidBodyAlignGlobal_findMinSSE_SH : MRISrigidBodyAlignGlobal_findMinSSE)(
         &new_mina, &new_minb, &new_ming, &new_sse,
         mris,
         parms,
@@ -3815,7 +3815,7 @@ static MRIS* MRISreadOverAlloc_new(const char *fname, double nVFMultiplier)
     }
   }
   
-  mrisCompleteTopology(mris);
+  mrisCompleteTopologyUsingCache(mris);
   
   mrisCheckVertexFaceTopology(mris);
 
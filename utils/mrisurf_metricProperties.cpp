@@ -4278,12 +4278,15 @@ static void MRISsetNeighborhoodSizeAndDistWkr(MRIS *mris, int nsize, bool always
 
     alwaysDoDist |= (mris->dist_alloced_flags & 1);
 
-    // rebuild all the neighbor caches
+    // rebuild all the neighbor caches, unless the topology cache has them
     //
-    int vno;
-    for (vno = 0; vno < mris->nvertices; vno++) {
-      int vlist[MAX_NEIGHBORS], hops[MAX_NEIGHBORS];
-      MRISfindNeighborsAtVertex(mris, vno, nsize, MAX_NEIGHBORS, vlist, hops);
+    if (!mrisNeighborhoodsFromTopologyCache(mris, nsize)) {
+      int vno;
+      for (vno = 0; vno < mris->nvertices; vno++) {
+        int vlist[MAX_NEIGHBORS], hops[MAX_NEIGHBORS];
+        MRISfindNeighborsAtVertex(mris, vno, nsize, MAX_NEIGHBORS, vlist, hops);
+      }
+      mrisSaveNeighborhoodsToTopologyCache(mris, nsize);
     }
     MRISresetNeighborhoodSize(mris, nsize);
 
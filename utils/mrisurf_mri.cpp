@@ -5354,6 +5354,421 @@ MRI *MRISsmoothMRI(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *BinMask, MRI *Ta
   MRIScrsLUTFree(crslut);
   return (Targ);
 }
+//=============================================================================
+// Surface smoothing operators
+//
+// Both the nearest-neighbor smoother (MRISsmoothMRIFast) and the gaussian
+// smoother (MRISgaussianSmooth) are linear, so each can be built once as a
+// sparse matrix over the vertices and then applied to all the frames of an
+// overlay together.  Each row lists the vertices that contribute to one
+// vertex, in the order the original loops visit them, so applying the
+// operator gives bitwise the same values.
+//
+// The gaussian operator needs an expensive walk of the distance neighborhood
+// of every vertex.  When FS_SURF_SMOOTH_CACHE names a directory it is kept
+// there, keyed by a hash of the surface, and reloaded by later runs.
+//
+struct MRIS_SMOOTH_OP {
+  int     nvertices;
+  long   *rowstart;   // nvertices+1 entries
+  int    *col;        // the vertices of each row, concatenated
+  double *w;          // weight of each entry, or NULL to average the row
+};
+
+#define MRIS_SMOOTH_OP_MAGIC   0x4d525350      // "MRSP"
+#define MRIS_SMOOTH_OP_VERSION 1
+#define MRIS_SMOOTH_OP_MAXBUF  (1 << 23)       // floats in each MRISsmoothOpApply() buffer
+
+void MRISsmoothOpFree(MRIS_SMOOTH_OP **pop)
+{
+  MRIS_SMOOTH_OP *op = *pop;
+  if (!op) return;
+  free(op->rowstart);
+  free(op->col);
+  free(op->w);
+  free(op);
+  *pop = NULL;
+}
+
+static MRIS_SMOOTH_OP *mrisSmoothOpAlloc(int nvertices, long nnz, bool weighted)
+{
+  MRIS_SMOOTH_OP *op = (MRIS_SMOOTH_OP *)calloc(1, sizeof(MRIS_SMOOTH_OP));
+  op->nvertices = nvertices;
+  op->rowstart = (long *)calloc(nvertices + 1, sizeof(long));
+  op->col = (int *)malloc(nnz * sizeof(int) + 1);
+  op->w = weighted ? (double *)malloc(nnz * sizeof(double) + 1) : NULL;
+  if (!op->rowstart || !op->col || (weighted && !op->w))
+    ErrorExit(ERROR_NOMEMORY, "mrisSmoothOpAlloc: could not allocate %ld entries", nnz);
+  return op;
+}
+
+/*!
+  \fn MRIS_SMOOTH_OP *MRISsmoothOpNearestNeighbor(MRIS *Surf, MRI *IncMask)
+  \brief One step of the nearest-neighbor smoothing of MRISsmoothMRIFast():
+  each vertex in the inclusive mask (a surface-shaped MRI, or NULL) becomes
+  the average of itself and its unripped neighbors in the mask.  Vertices
+  outside the mask have empty rows and become 0.
+*/
+MRIS_SMOOTH_OP *MRISsmoothOpNearestNeighbor(MRIS *Surf, MRI *IncMask)
+{
+  int const nvertices = Surf->nvertices;
+  int vno, n;
+  char *inmask = (char *)malloc(nvertices + 1);
+
+  for (vno = 0; vno < nvertices; vno++) {
+    if (IncMask) {
+      int const c = vno % IncMask->width, r = (vno / IncMask->width) % IncMask->height,
+                s = vno / (IncMask->width * IncMask->height);
+      inmask[vno] = !(MRIgetVoxVal(IncMask, c, r, s, 0) < 0.5);
+    }
+    else {
+      inmask[vno] = 1;
+    }
+  }
+
+  long nnz = 0;
+  for (vno = 0; vno < nvertices; vno++) {
+    if (inmask[vno]) nnz += 1 + Surf->vertices_topology[vno].vnum;
+  }
+  MRIS_SMOOTH_OP *op = mrisSmoothOpAlloc(nvertices, nnz, false);
+
+  nnz = 0;
+  for (vno = 0; vno < nvertices; vno++) {
+    op->rowstart[vno] = nnz;
+    if (!inmask[vno]) continue;
+    op->col[nnz++] = vno;
+    VERTEX_TOPOLOGY const *vt = &Surf->vertices_topology[vno];
+    for (n = 0; n < vt->vnum; n++) {
+      int const nbrvno = vt->v[n];
+      if (Surf->vertices[nbrvno].ripflag || !inmask[nbrvno]) continue;
+      op->col[nnz++] = nbrvno;
+    }
+  }
+  op->rowstart[nvertices] = nnz;
+
+  free(inmask);
+  return op;
+}
+
+// Same walk as MRISextendedNeighbors(DistType 1), but marking the vertices
+// in the caller's hit array rather than in val2bak, so rows can be found in
+// parallel.
+static void mrisExtendedNeighborsMarked(MRIS const *SphSurf,
+                                        int TargVtxNo,
+                                        int CurVtxNo,
+                                        double DotProdThresh,
+                                        int *hit,
+                                        int *XNbrVtxNo,
+                                        double *XNbrDotProd,
+                                        int *nXNbrs,
+                                        int nXNbrsMax,
+                                        bool *full)
+{
+  VERTEX const *vcur = &SphSurf->vertices[CurVtxNo];
+  if (*full || hit[CurVtxNo] == TargVtxNo || vcur->ripflag) return;
+
+  VERTEX const *vtarg = &SphSurf->vertices[TargVtxNo];
+  double DotProd = (vtarg->x * vcur->x) + (vtarg->y * vcur->y) + (vtarg->z * vcur->z);
+  DotProd = fabs(DotProd);
+  if (DotProd <= DotProdThresh) return;
+
+  if (*nXNbrs >= nXNbrsMax - 1) {
+    *full = true;
+    return;
+  }
+  XNbrVtxNo[*nXNbrs] = CurVtxNo;
+  XNbrDotProd[*nXNbrs] = DotProd;
+  (*nXNbrs)++;
+  hit[CurVtxNo] = TargVtxNo;
+
+  VERTEX_TOPOLOGY const *vt = &SphSurf->vertices_topology[CurVtxNo];
+  int n;
+  for (n = 0; n < vt->vnum; n++) {
+    mrisExtendedNeighborsMarked(
+        SphSurf, TargVtxNo, vt->v[n], DotProdThresh, hit, XNbrVtxNo, XNbrDotProd, nXNbrs, nXNbrsMax, full);
+  }
+}
+
+static unsigned long mrisSmoothOpGaussianHash(MRIS const *Surf, double GStd, double TruncFactor)
+{
+  unsigned long hash = fnv_init();
+  hash = fnv_add(hash, (unsigned char const *)&Surf->nvertices, sizeof(Surf->nvertices));
+  hash = fnv_add(hash, (unsigned char const *)&GStd, sizeof(GStd));
+  hash = fnv_add(hash, (unsigned char const *)&TruncFactor, sizeof(TruncFactor));
+  int vno;
+  for (vno = 0; vno < Surf->nvertices; vno++) {
+    VERTEX const *v = &Surf->vertices[vno];
+    VERTEX_TOPOLOGY const *vt = &Surf->vertices_topology[vno];
+    float const xyz[3] = {v->x, v->y, v->z};
+    int const flags[2] = {(int)v->ripflag, (int)vt->vnum};
+    hash = fnv_add(hash, (unsigned char const *)xyz, sizeof(xyz));
+    hash = fnv_add(hash, (unsigned char const *)flags, sizeof(flags));
+    hash = fnv_add(hash, (unsigned char const *)vt->v, vt->vnum * sizeof(int));
+  }
+  return hash;
+}
+
+static std::string mrisSmoothOpCacheFileName(unsigned long hash)
+{
+  char const *const dir = getenv("FS_SURF_SMOOTH_CACHE");
+  if (!dir || !dir[0]) return std::string();
+  char name[64];
+  snprintf(name, sizeof(name), "/gauss.%016lx.sop", hash);
+  return std::string(dir) + name;
+}
+
+static MRIS_SMOOTH_OP *mrisSmoothOpRead(std::string const &fname, int nvertices, unsigned long hash)
+{
+  FILE *fp = fopen(fname.c_str(), "rb");
+  if (!fp) return NULL;
+
+  int header[3];
+  unsigned long filehash;
+  long nnz;
+  MRIS_SMOOTH_OP *op = NULL;
+  bool ok = fread(header, sizeof(header), 1, fp) == 1 && fread(&filehash, sizeof(filehash), 1, fp) == 1 &&
+            fread(&nnz, sizeof(nnz), 1, fp) == 1 && header[0] == MRIS_SMOOTH_OP_MAGIC &&
+            header[1] == MRIS_SMOOTH_OP_VERSION && header[2] == nvertices && filehash == hash && nnz >= 0;
+  if (ok) {
+    op = mrisSmoothOpAlloc(nvertices, nnz, true);
+    ok = fread(op->rowstart, sizeof(long), nvertices + 1, fp) == (size_t)nvertices + 1 &&
+         fread(op->col, sizeof(int), nnz, fp) == (size_t)nnz && fread(op->w, sizeof(double), nnz, fp) == (size_t)nnz;
+  }
+  fclose(fp);
+
+  // the rows must tile the entries and only name existing vertices
+  int vno;
+  long k;
+  if (ok) ok = op->rowstart[0] == 0 && op->rowstart[nvertices] == nnz;
+  for (vno = 0; ok && vno < nvertices; vno++) ok = op->rowstart[vno] <= op->rowstart[vno + 1];
+  for (k = 0; ok && k < nnz; k++) ok = op->col[k] >= 0 && op->col[k] < nvertices;
+
+  if (!ok) {
+    MRISsmoothOpFree(&op);
+    return NULL;
+  }
+  return op;
+}
+
+static void mrisSmoothOpWrite(std::string const &fname, MRIS_SMOOTH_OP const *op, unsigned long hash)
+{
+  std::string const tmpname = fname + ".tmp" + std::to_string((long)getpid());
+  FILE *fp = fopen(tmpname.c_str(), "wb");
+  if (!fp) return;
+
+  int const header[3] = {MRIS_SMOOTH_OP_MAGIC, MRIS_SMOOTH_OP_VERSION, op->nvertices};
+  long const nnz = op->rowstart[op->nvertices];
+  bool ok = fwrite(header, sizeof(header), 1, fp) == 1 && fwrite(&hash, sizeof(hash), 1, fp) == 1 &&
+            fwrite(&nnz, sizeof(nnz), 1, fp) == 1 &&
+            fwrite(op->rowstart, sizeof(long), op->nvertices + 1, fp) == (size_t)op->nvertices + 1 &&
+            fwrite(op->col, sizeof(int), nnz, fp) == (size_t)nnz && fwrite(op->w, sizeof(double), nnz, fp) == (size_t)nnz;
+  ok = (fclose(fp) == 0) && ok;
+  if (!ok || rename(tmpname.c_str(), fname.c_str()) != 0) {
+    unlink(tmpname.c_str());
+  }
+}
+
+/*!
+  \fn MRIS_SMOOTH_OP *MRISsmoothOpGaussian(MRIS *Surf, double GStd, double TruncFactor)
+  \brief The (unnormalized) gaussian smoothing of MRISgaussianSmooth() on a
+  spherical surface, truncated at TruncFactor stddevs.  The rows are found
+  in parallel.  Reloaded from, or saved to, FS_SURF_SMOOTH_CACHE if that is
+  set.
+*/
+MRIS_SMOOTH_OP *MRISsmoothOpGaussian(MRIS *Surf, double GStd, double TruncFactor)
+{
+  int const nvertices = Surf->nvertices;
+  unsigned long const hash = mrisSmoothOpGaussianHash(Surf, GStd, TruncFactor);
+  std::string const cachename = mrisSmoothOpCacheFileName(hash);
+
+  if (!cachename.empty()) {
+    MRIS_SMOOTH_OP *op = mrisSmoothOpRead(cachename, nvertices, hash);
+    if (op) {
+      printf("Read gaussian smoothing operator from %s\n", cachename.c_str());
+      return op;
+    }
+  }
+
+  VERTEX const *vtx1 = &Surf->vertices[0];
+  double const Radius2 = (vtx1->x * vtx1->x) + (vtx1->y * vtx1->y) + (vtx1->z * vtx1->z);
+  double const Radius = sqrt(Radius2);
+  double const dmax = TruncFactor * GStd;  // truncate after TruncFactor stddevs
+  double const GVar2 = 2 * (GStd * GStd);
+  double const f = pow(1 / (sqrt(2 * M_PI) * GStd), 2.0);  // squared for 2D
+  double const DotProdThresh = Radius2 * cos(dmax / Radius) * (1.0001);
+
+  printf(
+      "Radius = %g, gstd = %g, dmax = %g, GVar2 = %g, f = %g, dpt = %g\n", Radius, GStd, dmax, GVar2, f, DotProdThresh);
+
+  // find the rows in parallel, each into its own arrays
+  int **rowcol = (int **)calloc(nvertices, sizeof(int *));
+  double **roww = (double **)calloc(nvertices, sizeof(double *));
+  int *rowlen = (int *)calloc(nvertices, sizeof(int));
+  int vtxno1;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel if_ROMP(assume_reproducible)
+#endif
+  {
+    int *hit = (int *)malloc(nvertices * sizeof(int));
+    int *XNbrVtxNo = (int *)malloc(nvertices * sizeof(int));
+    double *XNbrDotProd = (double *)malloc(nvertices * sizeof(double));
+    int n;
+    for (n = 0; n < nvertices; n++) hit[n] = -1;
+
+#ifdef HAVE_OPENMP
+    #pragma omp for schedule(dynamic, 256)
+#endif
+    for (vtxno1 = 0; vtxno1 < nvertices; vtxno1++) {
+      ROMP_PFLB_begin
+      int nXNbrs = 0;
+      bool full = false;
+      mrisExtendedNeighborsMarked(
+          Surf, vtxno1, vtxno1, DotProdThresh, hit, XNbrVtxNo, XNbrDotProd, &nXNbrs, nvertices, &full);
+
+      rowlen[vtxno1] = nXNbrs;
+      rowcol[vtxno1] = (int *)malloc(nXNbrs * sizeof(int) + 1);
+      roww[vtxno1] = (double *)malloc(nXNbrs * sizeof(double) + 1);
+      for (n = 0; n < nXNbrs; n++) {
+        double costheta = XNbrDotProd[n] / Radius2;
+
+        // cos theta might be slightly > 1 due to precision
+        if (costheta > +1.0) costheta = +1.0;
+        if (costheta < -1.0) costheta = -1.0;
+
+        // distance between the vertices along the surface of the sphere
+        double const d = Radius * acos(costheta);
+
+        rowcol[vtxno1][n] = XNbrVtxNo[n];
+        roww[vtxno1][n] = f * exp(-(d * d) / (GVar2)); /* f not really nec */
+      }
+      ROMP_PFLB_end
+    }
+
+    free(hit);
+    free(XNbrVtxNo);
+    free(XNbrDotProd);
+  }
+  ROMP_PF_end
+
+  long nnz = 0;
+  for (vtxno1 = 0; vtxno1 < nvertices; vtxno1++) nnz += rowlen[vtxno1];
+  MRIS_SMOOTH_OP *op = mrisSmoothOpAlloc(nvertices, nnz, true);
+  nnz = 0;
+  for (vtxno1 = 0; vtxno1 < nvertices; vtxno1++) {
+    op->rowstart[vtxno1] = nnz;
+    memcpy(&op->col[nnz], rowcol[vtxno1], rowlen[vtxno1] * sizeof(int));
+    memcpy(&op->w[nnz], roww[vtxno1], rowlen[vtxno1] * sizeof(double));
+    nnz += rowlen[vtxno1];
+    free(rowcol[vtxno1]);
+    free(roww[vtxno1]);
+  }
+  op->rowstart[nvertices] = nnz;
+  free(rowcol);
+  free(roww);
+  free(rowlen);
+
+  if (!cachename.empty()) {
+    mrisSmoothOpWrite(cachename, op, hash);
+  }
+  return op;
+}
+
+/*!
+  \fn MRI *MRISsmoothOpApply(MRIS_SMOOTH_OP const *op, MRI *Src, int niters, MRI *Targ)
+  \brief Applies op niters times to every frame of Src, a MRI_FLOAT overlay
+  with one column per vertex.  The frames are done in blocks of up to
+  MRIS_SMOOTH_OP_MAXBUF values, and the frames and blocks of vertices of
+  each are done in parallel.  Each value is computed exactly as the
+  original smoother does.  Can be done in place.  If Targ is NULL it is
+  allocated.
+*/
+MRI *MRISsmoothOpApply(MRIS_SMOOTH_OP const *op, MRI *Src, int niters, MRI *Targ)
+{
+  int const nvertices = op->nvertices;
+  int const nframes = Src->nframes;
+
+  if (Src->width != nvertices || Src->height != 1 || Src->depth != 1 || Src->type != MRI_FLOAT) {
+    printf("ERROR: MRISsmoothOpApply(): Src must be a MRI_FLOAT %d x 1 x 1 overlay\n", nvertices);
+    return (NULL);
+  }
+  if (Targ == NULL) {
+    Targ = MRIallocSequence(Src->width, Src->height, Src->depth, MRI_FLOAT, Src->nframes);
+    if (Targ == NULL) {
+      printf("ERROR: MRISsmoothOpApply(): could not alloc\n");
+      return (NULL);
+    }
+    MRIcopyHeader(Src, Targ);
+  }
+  if (MRIdimMismatch(Src, Targ, 1) || Targ->type != MRI_FLOAT) {
+    printf("ERROR: MRISsmoothOpApply(): output dimension or type mismatch\n");
+    return (NULL);
+  }
+
+  // the frames are done a block at a time, so the two buffers the
+  // iterations go back and forth between stay bounded however many frames
+  // there are
+  size_t const framesize = (size_t)nvertices;
+  int const nchunk = MAX(1, MIN(nframes, (int)(MRIS_SMOOTH_OP_MAXBUF / framesize)));
+  float *buf = (float *)malloc(2 * nchunk * framesize * sizeof(float) + 1);
+  if (!buf) ErrorExit(ERROR_NOMEMORY, "MRISsmoothOpApply: could not allocate %d frames", nchunk);
+  int frame0, frame, iter, task;
+  int const blocksize = 4096;
+  int const nblocks = (nvertices + blocksize - 1) / blocksize;
+
+  for (frame0 = 0; frame0 < nframes; frame0 += nchunk) {
+    int const nf = MIN(nchunk, nframes - frame0);
+    float *cur = buf, *nxt = buf + nchunk * framesize;
+    for (frame = 0; frame < nf; frame++) {
+      memcpy(&cur[frame * framesize], &MRIFseq_vox(Src, 0, 0, 0, frame0 + frame), framesize * sizeof(float));
+    }
+
+    for (iter = 0; iter < niters; iter++) {
+      ROMP_PF_begin
+#ifdef HAVE_OPENMP
+      #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 1)
+#endif
+      for (task = 0; task < nf * nblocks; task++) {
+        ROMP_PFLB_begin
+        float const *in = &cur[(task / nblocks) * framesize];
+        float *out = &nxt[(task / nblocks) * framesize];
+        int const vlo = (task % nblocks) * blocksize;
+        int const vhi = MIN(nvertices, vlo + blocksize);
+        int vno;
+        long k;
+        for (vno = vlo; vno < vhi; vno++) {
+          long const lo = op->rowstart[vno], hi = op->rowstart[vno + 1];
+          if (lo == hi) {
+            out[vno] = 0;
+          }
+          else if (op->w) {
+            float val = 0;
+            for (k = lo; k < hi; k++) val += (float)(op->w[k] * in[op->col[k]]);
+            out[vno] = val;
+          }
+          else {
+            float sum = in[op->col[lo]];
+            for (k = lo + 1; k < hi; k++) sum += in[op->col[k]];
+            out[vno] = sum / (int)(hi - lo);
+          }
+        }
+        ROMP_PFLB_end
+      }
+      ROMP_PF_end
+      float *tmp = cur;
+      cur = nxt;
+      nxt = tmp;
+    }
+
+    for (frame = 0; frame < nf; frame++) {
+      memcpy(&MRIFseq_vox(Targ, 0, 0, 0, frame0 + frame), &cur[frame * framesize], framesize * sizeof(float));
+    }
+  }
+  free(buf);
+  return (Targ);
+}
+
 /*-------------------------------------------------------------------
   MRISsmoothMRIFast() - faster version of MRISsmoothMRI(). Smooths
   values on the surface when the surface values are stored in an
@@ -5370,12 +5785,10 @@ MRI *MRISsmoothMRI(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *BinMask, MRI *Ta
   -------------------------------------------------------------------*/
 MRI *MRISsmoothMRIFast(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *IncMask, MRI *Targ)
 {
-  int nnbrs, nthstep, frame, vno, nthnbr, num, nvox, nbrvno, reshape;
+  int nvox, reshape;
   MRI *SrcTmp, *mritmp, *IncMaskTmp = NULL;
   int msecTime;
-  int *nNbrs, *nNbrs0, *rip, *rip0, nNbrsMax;
-  float **pF, **pF0, *tF, *tF0, sumF;
-  VERTEX *v, *vn;
+  MRIS_SMOOTH_OP *op;
 
   if (Gdiag_no > 0) printf("MRISsmoothMRIFast()\n");
 
@@ -5415,86 +5828,20 @@ MRI *MRISsmoothMRIFast(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *IncMask, MRI
     }
   }
 
-  // Alloc arrays. If there are ripped vertices, then only rip
-  // needs nvertices elements
-  nNbrsMax = 12;  // Should measure this, but overalloc does not hurt
-  pF = (float **)calloc(Surf->nvertices * nNbrsMax, sizeof(float *));
-  tF = (float *)calloc(Surf->nvertices, sizeof(float));
-  nNbrs = (int *)calloc(Surf->nvertices, sizeof(int));
-  rip = (int *)calloc(Surf->nvertices, sizeof(int));
-
-  pF0 = pF;
-  tF0 = tF;
-  rip0 = rip;
-  nNbrs0 = nNbrs;
-
   Timer mytimer;
 
-  // Loop through frames
-  for (frame = 0; frame < Src->nframes; frame++) {
-    // Set up pointers for this frame
-    pF = pF0;
-    rip = rip0;
-    nNbrs = nNbrs0;
-    for (vno = 0; vno < Surf->nvertices; vno++) {
-      v = &Surf->vertices[vno];
-      if (IncMaskTmp && MRIgetVoxVal(IncMaskTmp, vno, 0, 0, 0) < 0.5) {
-        // Mask is inclusive, so look for out of mask
-        // should exclude rips here too? Original does not.
-        rip[vno] = 1;
-        MRIFseq_vox(SrcTmp, vno, 0, 0, frame) = 0;
-        continue;
-      }
-      rip[vno] = 0;
-      *pF++ = (float *)(&(MRIFseq_vox(SrcTmp, vno, 0, 0, frame)));
-      nnbrs = Surf->vertices_topology[vno].vnum;
-      num = 1;
-      for (nthnbr = 0; nthnbr < nnbrs; nthnbr++) {
-        nbrvno = Surf->vertices_topology[vno].v[nthnbr];
-        vn = &Surf->vertices[nbrvno];
-        if (vn->ripflag) {
-          continue;
-        }
-        if (IncMaskTmp && MRIgetVoxVal(IncMaskTmp, nbrvno, 0, 0, 0) < 0.5) {
-          continue;
-        }
-        *pF++ = (float *)(&(MRIFseq_vox(SrcTmp, nbrvno, 0, 0, frame)));
-        num++;
-      }
-      *nNbrs++ = num;  // num takes into account all rips/masks
-    }
-
-    // Step through the iterations
-    for (nthstep = 0; nthstep < nSmoothSteps; nthstep++) {
-      // Init pointers for this iteration
-      pF = pF0;
-      rip = rip0;
-      tF = tF0;
-      nNbrs = nNbrs0;
-      // Loop through vertices, average nearest neighbors
-      for (vno = 0; vno < Surf->nvertices; vno++) {
-        if (*rip++) {
-          continue;
-        }
-        sumF = *(*pF++);
-        for (nthnbr = 0; nthnbr < (*nNbrs) - 1; nthnbr++) {
-          sumF += *(*pF++);
-        }
-        *tF++ = sumF / (*nNbrs);
-        nNbrs++;
-      }
-      // Load up for the next step
-      rip = rip0;
-      tF = tF0;
-      for (vno = 0; vno < Surf->nvertices; vno++) {
-        if (*rip++) {
-          continue;
-        }
-        MRIsetVoxVal(SrcTmp, vno, 0, 0, frame, *tF++);
-      }
-    }
-
-  } /* end loop over frame */
+  // Build the one-step averaging operator once (rips and mask folded in),
+  // then apply it to all the frames together
+  op = MRISsmoothOpNearestNeighbor(Surf, IncMaskTmp);
+  MRISsmoothOpApply(op, SrcTmp, nSmoothSteps, SrcTmp);
+  MRISsmoothOpFree(&op);
+  if (IncMaskTmp && nSmoothSteps < 1) {
+    // out-of-mask vertices are always zeroed, even with no smoothing
+    int frame, vno;
+    for (frame = 0; frame < SrcTmp->nframes; frame++)
+      for (vno = 0; vno < nvox; vno++)
+        if (MRIgetVoxVal(IncMaskTmp, vno, 0, 0, 0) < 0.5) MRIFseq_vox(SrcTmp, vno, 0, 0, frame) = 0;
+  }
 
   // Copy to the output
   if (reshape) {
@@ -5514,10 +5861,6 @@ MRI *MRISsmoothMRIFast(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *IncMask, MRI
 
   MRIfree(&SrcTmp);
   if (IncMaskTmp) MRIfree(&IncMaskTmp);
-  free(pF0);
-  free(tF0);
-  free(rip0);
-  free(nNbrs0);
 
   return (Targ);
 }
@@ -2516,19 +2516,26 @@ static void mrisDivideFace(MRIS *mris, int fno, int vno1, int vno2, int vnew_no)
 static void mrisCompleteTopology_old(MRI_SURFACE *mris);
 static void mrisCompleteTopology_new(MRI_SURFACE *mris);
 
+// Which of the two builds mrisCompleteTopology uses. They can order the
+// neighbours differently, so the topology cache records it too.
+//
+static bool mrisCompleteTopologyUseNew()
+{
+  static bool laterTime, use_new;
+  if (!laterTime) {
+    laterTime = true;
+    use_new = !!getenv("mrisCompleteTopology_new");
+  }
+  return use_new;
+}
+
 void mrisCompleteTopology(MRI_SURFACE *mris) {
   if (debugNonDeterminism) {
     fprintf(stdout, "%s:%d mrisCompleteTopology ",__FILE__,__LINE__);
     mris_print_hash(stdout, mris, "mris ", "\n");
   }
 
-  static bool laterTime, use_new;
-  if (!laterTime) {
-    laterTime = true;
-    use_new = !!getenv("mrisCompleteTopology_new");
-  }
-  
-  if (use_new) mrisCompleteTopology_new(mris);
+  if (mrisCompleteTopologyUseNew()) mrisCompleteTopology_new(mris);
   else         mrisCompleteTopology_old(mris);
 
   mrisCheckVertexFaceTopology(mris);
@@ -2656,6 +2663,343 @@ static void mrisCompleteTopology_old(MRI_SURFACE *mris) // was mrisFindNeighbors
 
 
 
+//=============================================================================
+// Topology cache
+//
+// When FS_SURF_TOPO_CACHE is set, MRISread keeps a binary sidecar next to the
+// surface (<surface>.topo) holding the immediate neighbours of every vertex and,
+// once some tool has built them, the 2- and 3-ring neighbourhoods as well.
+// The sidecar is keyed on a hash of the face list and on which build of
+// mrisCompleteTopology made the rings (see mrisCompleteTopology_new), and any
+// file that does not match the surface it is being applied to is ignored and
+// rewritten.
+//
+#define MRIS_TOPO_CACHE_MAGIC   0x4d525443      // "MRTC"
+#define MRIS_TOPO_CACHE_VERSION 1
+
+typedef struct MRIS_TOPO_CACHE {
+  int            nvertices;
+  int            nfaces;
+  int            nsize;     // number of rings stored for every vertex
+  unsigned long  hash;      // of the face list
+  int           *vnums;     // nsize entries per vertex: vnum, v2num, v3num
+  long          *offset;    // start of each vertex's list in ring[], nvertices+1 entries
+  int           *ring;      // the v[] list of each vertex, concatenated
+} MRIS_TOPO_CACHE;
+
+static bool mrisTopoCacheEnabled()
+{
+  static bool laterTime, enabled;
+  if (!laterTime) {
+    laterTime = true;
+    char const * const env = getenv("FS_SURF_TOPO_CACHE");
+    enabled = env && strcmp(env, "0");
+  }
+  return enabled;
+}
+
+static std::string mrisTopoCacheFileName(MRIS const *mris)
+{
+  char const * const fname = mris->fname;
+  if (!fname[0]) return std::string();
+  return std::string(fname) + ".topo";
+}
+
+static unsigned long mrisFaceListHash(MRIS const *mris)
+{
+  unsigned long hash = fnv_init();
+  hash = fnv_add(hash, (unsigned char const*)&mris->nvertices, sizeof(mris->nvertices));
+  hash = fnv_add(hash, (unsigned char const*)&mris->nfaces,    sizeof(mris->nfaces));
+  int fno;
+  for (fno = 0; fno < mris->nfaces; fno++) {
+    FACE const * const f = &mris->faces[fno];
+    int vs[VERTICES_PER_FACE];
+    int n;
+    for (n = 0; n < VERTICES_PER_FACE; n++) vs[n] = f->v[n];
+    hash = fnv_add(hash, (unsigned char const*)vs, sizeof(vs));
+  }
+  return hash;
+}
+
+static void mrisTopoCacheFree(MRIS_TOPO_CACHE *cache)
+{
+  free(cache->vnums);  cache->vnums  = NULL;
+  free(cache->offset); cache->offset = NULL;
+  free(cache->ring);   cache->ring   = NULL;
+}
+
+/*!
+  \fn static bool mrisTopoCacheRead(MRIS const *mris, MRIS_TOPO_CACHE *cache)
+  \brief Reads the sidecar of mris and checks that it belongs to its face
+  list. Returns false, with nothing allocated, if the file is missing,
+  truncated, inconsistent or for some other surface.
+*/
+static bool mrisTopoCacheRead(MRIS const *mris, MRIS_TOPO_CACHE *cache)
+{
+  memset(cache, 0, sizeof(*cache));
+
+  std::string const fname = mrisTopoCacheFileName(mris);
+  if (fname.empty()) return false;
+  FILE *fp = fopen(fname.c_str(), "rb");
+  if (!fp) return false;
+
+  int  header[6];
+  long nring = 0;
+  bool ok = fread(header, sizeof(header), 1, fp) == 1
+         && fread(&cache->hash, sizeof(cache->hash), 1, fp) == 1
+         && fread(&nring, sizeof(nring), 1, fp) == 1
+         && header[0] == MRIS_TOPO_CACHE_MAGIC
+         && header[1] == MRIS_TOPO_CACHE_VERSION
+         && header[2] == mris->nvertices
+         && header[3] == mris->nfaces
+         && header[4] >= 1 && header[4] <= 3
+         && header[5] == (int)mrisCompleteTopologyUseNew()
+         && nring >= 0;
+  if (ok) {
+    cache->nvertices = header[2];
+    cache->nfaces    = header[3];
+    cache->nsize     = header[4];
+    ok = (cache->hash == mrisFaceListHash(mris));
+  }
+  if (ok) {
+    size_t const nvnums = (size_t)cache->nvertices * cache->nsize;
+    cache->vnums  = (int *) malloc(nvnums * sizeof(int) + 1);
+    cache->offset = (long*) malloc((cache->nvertices + 1) * sizeof(long));
+    cache->ring   = (int *) malloc(nring * sizeof(int) + 1);
+    if (!cache->vnums || !cache->offset || !cache->ring)
+      ErrorExit(ERROR_NOMEMORY, "mrisTopoCacheRead(%s): could not allocate %ld neighbours", fname.c_str(), nring);
+    ok = fread(cache->vnums, sizeof(int), nvnums, fp) == nvnums
+      && fread(cache->ring,  sizeof(int), nring,  fp) == (size_t)nring;
+  }
+  fclose(fp);
+
+  // the ring counts must be nondecreasing, add up to nring, and only name existing vertices
+  //
+  if (ok) {
+    long total = 0;
+    int vno;
+    for (vno = 0; ok && vno < cache->nvertices; vno++) {
+      int const * const vnums = &cache->vnums[(size_t)vno * cache->nsize];
+      int prev = 0, r;
+      for (r = 0; r < cache->nsize; r++) {
+        if (vnums[r] < prev || vnums[r] > MAX_NEIGHBORS) ok = false;
+        prev = vnums[r];
+      }
+      cache->offset[vno] = total;
+      total += prev;
+    }
+    cache->offset[cache->nvertices] = total;
+    ok = ok && (total == nring);
+    long i;
+    for (i = 0; ok && i < nring; i++)
+      if (cache->ring[i] < 0 || cache->ring[i] >= cache->nvertices) ok = false;
+  }
+
+  if (!ok) {
+    if (Gdiag & DIAG_SHOW) fprintf(stdout, "ignoring topology cache %s\n", fname.c_str());
+    mrisTopoCacheFree(cache);
+  }
+  return ok;
+}
+
+/*!
+  \fn static void mrisTopoCacheWrite(MRIS const *mris, int nsize)
+  \brief Saves the first nsize neighbour rings of every vertex. The caller
+  guarantees that no vertex is ripped and every vertex has nsizeMax >= nsize.
+  The file is written under a temporary name and renamed into place, so that
+  concurrent readers never see a partial sidecar.
+*/
+static void mrisTopoCacheWrite(MRIS const *mris, int nsize)
+{
+  std::string const fname = mrisTopoCacheFileName(mris);
+  if (fname.empty()) return;
+
+  size_t const nvnums = (size_t)mris->nvertices * nsize;
+  int * const vnums = (int*)malloc(nvnums * sizeof(int) + 1);
+  if (!vnums) ErrorExit(ERROR_NOMEMORY, "mrisTopoCacheWrite(%s): could not allocate counts", fname.c_str());
+
+  long nring = 0;
+  int vno;
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
+    int * const p = &vnums[(size_t)vno * nsize];
+                    p[0] = vt->vnum;
+    if (nsize >= 2) p[1] = vt->v2num;
+    if (nsize >= 3) p[2] = vt->v3num;
+    nring += p[nsize-1];
+  }
+
+  std::string const tmpname = fname + "." + std::to_string((long)getpid()) + ".tmp";
+  FILE *fp = fopen(tmpname.c_str(), "wb");
+  if (!fp) {
+    if (Gdiag & DIAG_SHOW) fprintf(stdout, "could not write topology cache %s\n", fname.c_str());
+    free(vnums);
+    return;
+  }
+
+  int const header[6] = { MRIS_TOPO_CACHE_MAGIC, MRIS_TOPO_CACHE_VERSION, mris->nvertices, mris->nfaces, nsize,
+                          (int)mrisCompleteTopologyUseNew() };
+  unsigned long const hash = mrisFaceListHash(mris);
+  bool ok = fwrite(header, sizeof(header), 1, fp) == 1
+         && fwrite(&hash,  sizeof(hash),   1, fp) == 1
+         && fwrite(&nring, sizeof(nring),  1, fp) == 1
+         && fwrite(vnums,  sizeof(int), nvnums, fp) == nvnums;
+  for (vno = 0; ok && vno < mris->nvertices; vno++) {
+    size_t const count = vnums[(size_t)vno * nsize + nsize - 1];
+    ok = fwrite(mris->vertices_topology[vno].v, sizeof(int), count, fp) == count;
+  }
+  free(vnums);
+
+  if (fclose(fp) != 0) ok = false;
+  if (!ok || rename(tmpname.c_str(), fname.c_str()) != 0) {
+    if (Gdiag & DIAG_SHOW) fprintf(stdout, "could not write topology cache %s\n", fname.c_str());
+    unlink(tmpname.c_str());
+  }
+}
+
+static bool mrisHasRippedVertices(MRIS const *mris)
+{
+  int vno;
+  for (vno = 0; vno < mris->nvertices; vno++)
+    if (mris->vertices[vno].ripflag) return true;
+  return false;
+}
+
+
+/*!
+  \fn void mrisCompleteTopologyUsingCache(MRIS *mris)
+  \brief Same result as mrisCompleteTopology, for a surface just read from
+  mris->fname. When the topology cache is enabled, the immediate neighbours
+  come from a valid sidecar if there is one, otherwise they are computed and
+  the sidecar is (re)written.
+*/
+void mrisCompleteTopologyUsingCache(MRIS *mris)
+{
+  if (!mrisTopoCacheEnabled() || mrisHasRippedVertices(mris)) {
+    mrisCompleteTopology(mris);
+    return;
+  }
+
+  MRIS_TOPO_CACHE cache;
+  if (!mrisTopoCacheRead(mris, &cache)) {
+    mrisCompleteTopology(mris);
+    mrisTopoCacheWrite(mris, 1);
+    return;
+  }
+
+  int vno;
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX_TOPOLOGY * const vt = &mris->vertices_topology[vno];
+    int const vnum = cache.vnums[(size_t)vno * cache.nsize];
+    if (vt->v) free(vt->v);
+    vt->v = (int *)calloc(vnum, sizeof(int));
+    if (!vt->v) ErrorExit(ERROR_NOMEMORY, "mrisCompleteTopologyUsingCache: could not allocate nbr array");
+    memcpy(vt->v, &cache.ring[cache.offset[vno]], vnum*sizeof(int));
+    modVnum(mris,vno,vnum,true);
+    vt->v2num = vt->v3num = 0;
+    vt->vtotal = vt->vnum;
+    vt->nsizeMax = vt->nsizeCur = 1;
+  }
+  mrisTopoCacheFree(&cache);
+
+  int vtotal = 0;
+  for (vno = 0; vno < mris->nvertices; vno++) vtotal += mris->vertices_topology[vno].vtotal;
+  mris->avg_nbrs = (float)vtotal / (float)MAX(1, mris->nvertices);
+
+  mrisCheckVertexFaceTopology(mris);
+}
+
+
+// The rings the sidecar has for vno must start with the ones the vertex already has
+//
+static bool mrisTopoCacheMatchesVertex(MRIS const *mris, MRIS_TOPO_CACHE const *cache, int vno)
+{
+  VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
+  int const * const vnums = &cache->vnums[(size_t)vno * cache->nsize];
+  int const nsizeMax = vt->nsizeMax;
+
+  if (nsizeMax < 1 || nsizeMax > cache->nsize) return false;
+  if (vnums[0] != vt->vnum) return false;
+  if (nsizeMax >= 2 && vnums[1] != vt->v2num) return false;
+  if (nsizeMax >= 3 && vnums[2] != vt->v3num) return false;
+
+  int const count = vnums[nsizeMax-1];
+  return !memcmp(vt->v, &cache->ring[cache->offset[vno]], count*sizeof(int));
+}
+
+
+/*!
+  \fn bool mrisNeighborhoodsFromTopologyCache(MRIS *mris, int nsize)
+  \brief Extends every vertex's neighbour rings to nsize from the sidecar,
+  leaving each vertex exactly as MRISfindNeighborsAtVertex would. Returns
+  false, having changed nothing, when the cache is disabled, unusable, or
+  does not agree with the rings the vertices already have.
+*/
+bool mrisNeighborhoodsFromTopologyCache(MRIS *mris, int nsize)
+{
+  if (!mrisTopoCacheEnabled() || mrisHasRippedVertices(mris)) return false;
+
+  MRIS_TOPO_CACHE cache;
+  if (!mrisTopoCacheRead(mris, &cache)) return false;
+
+  bool ok = (cache.nsize >= nsize);
+  int vno;
+  for (vno = 0; ok && vno < mris->nvertices; vno++)
+    ok = mrisTopoCacheMatchesVertex(mris, &cache, vno);
+  if (!ok) {
+    mrisTopoCacheFree(&cache);
+    return false;
+  }
+
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX_TOPOLOGY * const vt = &mris->vertices_topology[vno];
+    int const * const vnums = &cache.vnums[(size_t)vno * cache.nsize];
+    if (vt->nsizeMax >= nsize) continue;
+
+    int const oldSize = vnums[vt->nsizeMax-1];
+    int const newSize = vnums[nsize-1];
+    resizeVertexV(mris, vno, newSize, oldSize);
+    memcpy(vt->v + oldSize, &cache.ring[cache.offset[vno] + oldSize], (newSize - oldSize)*sizeof(int));
+
+    if (nsize >= 2) vt->v2num = vnums[1];
+    if (nsize >= 3) vt->v3num = vnums[2];
+    vt->nsizeMax = nsize; vt->nsizeMaxClock = mris->nsizeMaxClock;
+    vt->vtotal = vt->nsizeCur ? vnums[vt->nsizeCur-1] : 0;
+  }
+  mrisTopoCacheFree(&cache);
+
+  return true;
+}
+
+
+/*!
+  \fn void mrisSaveNeighborhoodsToTopologyCache(MRIS const *mris, int nsize)
+  \brief Called after the neighbour rings have been built out to nsize.
+  Upgrades the sidecar written when mris was read, provided mris still has
+  the topology of that file. Surfaces that were edited or never read from
+  a file are left alone.
+*/
+void mrisSaveNeighborhoodsToTopologyCache(MRIS const *mris, int nsize)
+{
+  if (!mrisTopoCacheEnabled() || mrisHasRippedVertices(mris)) return;
+
+  MRIS_TOPO_CACHE cache;
+  if (!mrisTopoCacheRead(mris, &cache)) return;
+
+  bool ok = (cache.nsize < nsize);
+  int vno;
+  for (vno = 0; ok && vno < mris->nvertices; vno++) {
+    VERTEX_TOPOLOGY const * const vt = &mris->vertices_topology[vno];
+    ok = vt->nsizeMax >= nsize
+      && vt->vnum == cache.vnums[(size_t)vno * cache.nsize]
+      && !memcmp(vt->v, &cache.ring[cache.offset[vno]], vt->vnum*sizeof(int));
+  }
+  mrisTopoCacheFree(&cache);
+
+  if (ok) mrisTopoCacheWrite(mris, nsize);
+}
+
+
 void MRISsetRipInFacesWithRippedVertices(MRIS *mris)
 {
   int n, k;
@@ -1246,6 +1246,19 @@ int OpenSvdcmp(MATRIX *ioA, VECTOR *oW, MATRIX *oV)
   return errorCode;
 }
 
+// the state of OpenRan1, shared with OpenRan1SaveState and OpenRan1RestoreState
+static long &OpenRan1Seed()
+{
+  static long mSeed;
+  return mSeed;
+}
+
+static vnl_random &OpenRan1Generator()
+{
+  static vnl_random mVnlRandom(OpenRan1Seed());
+  return mVnlRandom;
+}
+
 /**
  * Generates a random number between 0 and 1.
  * The sequence of numbers generated
@@ -1262,12 +1275,12 @@ float OpenRan1(long *iSeed)
     exit(1);
   }
 #endif
-  
+
   static const double MIN = 0.0;
   static const double MAX = 1.0;
 
-  static long mSeed;
-  static vnl_random mVnlRandom(mSeed);
+  long &mSeed = OpenRan1Seed();
+  vnl_random &mVnlRandom = OpenRan1Generator();
 
   if (mSeed != *iSeed) {
     mSeed = *iSeed;
@@ -1279,6 +1292,36 @@ float OpenRan1(long *iSeed)
   return randomNumber;
 }
 
+/**
+ * Returns a copy of the state of the OpenRan1 generator, so that numbers
+ * drawn speculatively can be given back with OpenRan1RestoreState.
+ */
+struct OpenRan1State {
+  long seed;
+  vnl_random generator;
+};
+
+void *OpenRan1SaveState()
+{
+  OpenRan1State *state = new OpenRan1State;
+  state->seed = OpenRan1Seed();
+  state->generator = OpenRan1Generator();
+  return state;
+}
+
+void OpenRan1RestoreState(void const *iState)
+{
+  OpenRan1State const *state = (OpenRan1State const *)iState;
+  OpenRan1Seed() = state->seed;
+  OpenRan1Generator() = state->generator;
+}
+
+void OpenRan1FreeState(void **ioState)
+{
+  delete (OpenRan1State *)*ioState;
+  *ioState = NULL;
+}
+
 /**
  * Generates the second derivatives needed by splint.
  * @param iYStartDerivative The derivative at the beginning of the function.
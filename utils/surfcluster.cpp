@@ -47,41 +47,62 @@ static int sclustCompare(const void *a, const void *b);
    threshold criteria. The cluster does not exist as a list at this
    point. Rather, the clusters are mapped using using the undefval
    element of the MRI_SURF structure. If a vertex meets the cluster
-   criteria, then undefval is set to the cluster number.
+   criteria, then undefval is set to the cluster number. The
+   clusters are found all at once with union-find (see
+   CCOMPlabelGraph()) rather than grown from each seed, and are
+   numbered in the order of their lowest vertex, as if grown with
+   sclustGrowSurfCluster().
    ------------------------------------------------------------ */
 SCS *sclustMapSurfClusters(MRI_SURFACE *Surf, float thmin, float thmax, int thsign, 
 			   float minarea, int *nClusters, MATRIX *XFM, MRI *fwhmmap)
 {
   SCS *scs, *scs_sorted;
-  int vtx, vtx_inrange, vtx_clustno, CurrentClusterNo;
-  float vtx_val, ClusterArea;
-  int nVtxsInCluster;
-
-  /* initialized all cluster numbers to 0 */
-  for (vtx = 0; vtx < Surf->nvertices; vtx++) Surf->vertices[vtx].undefval = 0; /* overloads this elem of struct */
-
-  /* Go through each vertex looking for one that meets the threshold
-     criteria and has not been previously assigned to a cluster.
-     When found, grow it out. */
-  CurrentClusterNo = 1;
+  int vtx, c, CurrentClusterNo, *nnbrs, *newno;
+  const int **nbrs;
+  unsigned char *hit;
+  float *vtxarea;
+  double areascale = 1.0;
+  CCOMP *cc;
+
+  hit = (unsigned char *)calloc(Surf->nvertices, sizeof(unsigned char));
+  nnbrs = (int *)calloc(Surf->nvertices, sizeof(int));
+  nbrs = (const int **)calloc(Surf->nvertices, sizeof(int *));
+  cc = CCOMPalloc(Surf->nvertices);
   for (vtx = 0; vtx < Surf->nvertices; vtx++) {
-    vtx_val = Surf->vertices[vtx].val;
-    vtx_clustno = Surf->vertices[vtx].undefval;
-    vtx_inrange = clustValueInRange(vtx_val, thmin, thmax, thsign);
-
-    if (vtx_clustno == 0 && vtx_inrange) {
-      sclustGrowSurfCluster(CurrentClusterNo, vtx, Surf, thmin, thmax, thsign);
-      if (minarea > 0) {
-        /* If the cluster does not meet the area criteria, delete it */
-        ClusterArea = sclustSurfaceArea(CurrentClusterNo, Surf, &nVtxsInCluster);
-        if (ClusterArea < minarea) {
-          sclustZeroSurfaceClusterNo(CurrentClusterNo, Surf);
-          continue;
-        }
-      }
-      CurrentClusterNo++;
+    hit[vtx] = clustValueInRange(Surf->vertices[vtx].val, thmin, thmax, thsign);
+    nnbrs[vtx] = Surf->vertices_topology[vtx].vnum;
+    nbrs[vtx] = Surf->vertices_topology[vtx].v;
+  }
+  CCOMPlabelGraph(cc, hit, nnbrs, nbrs);
+
+  /* Drop the clusters that do not meet the area criteria (the area
+     is computed as in sclustSurfaceArea()), renumbering the rest */
+  newno = (int *)calloc(cc->nclusters + 1, sizeof(int));
+  if (minarea > 0) {
+    vtxarea = (float *)calloc(Surf->nvertices, sizeof(float));
+    for (vtx = 0; vtx < Surf->nvertices; vtx++) {
+      if (!Surf->group_avg_vtxarea_loaded)
+        vtxarea[vtx] = Surf->vertices[vtx].area;
+      else
+        vtxarea[vtx] = Surf->vertices[vtx].group_avg_area;
     }
+    CCOMPsummarize(cc, NULL, vtxarea);
+    free(vtxarea);
+    if (Surf->group_avg_surface_area > 0 && !Surf->group_avg_vtxarea_loaded)
+      areascale = Surf->group_avg_surface_area / Surf->total_area;
   }
+  CurrentClusterNo = 1;
+  for (c = 0; c < cc->nclusters; c++) {
+    if (minarea > 0 && cc->size[c] * areascale < minarea) continue;
+    newno[c + 1] = CurrentClusterNo++;
+  }
+  for (vtx = 0; vtx < Surf->nvertices; vtx++) Surf->vertices[vtx].undefval = newno[cc->clusterno[vtx]];
+
+  free(newno);
+  free(hit);
+  free(nnbrs);
+  free(nbrs);
+  CCOMPfree(&cc);
 
   *nClusters = CurrentClusterNo - 1;
   if (*nClusters == 0) return (NULL);
@@ -139,6 +160,65 @@ int sclustGrowSurfCluster(int ClusterNo, int SeedVtx, MRI_SURFACE *Surf, float t
   }
   return (0);
 }
+/*----------------------------------------------------------------
+  MRIStfce() - threshold-free cluster enhancement of a frame of a
+  surface overlay (see TFCEgraph()). The extent of a cluster is its
+  area, computed as in sclustSurfaceArea(). Vertices outside the
+  mask are 0. E = 1 and H = 2 are usual for surfaces.
+  ----------------------------------------------------------------*/
+MRI *MRIStfce(MRI_SURFACE *Surf, MRI *sig, int frame, MRI *mask, int thsign, double E, double H, MRI *tfce)
+{
+  int vtx, c, r, s, *nnbrs;
+  const int **nbrs;
+  float *val, *vtxarea, *out;
+  double areascale = 1.0;
+
+  if (sig->width * sig->height * sig->depth != Surf->nvertices) {
+    printf("ERROR: MRIStfce: dimension mismatch %d %d\n", sig->width * sig->height * sig->depth, Surf->nvertices);
+    return (NULL);
+  }
+  if (tfce == NULL) {
+    tfce = MRIallocSequence(sig->width, sig->height, sig->depth, MRI_FLOAT, 1);
+    MRIcopyHeader(sig, tfce);
+  }
+
+  if (Surf->group_avg_surface_area > 0 && !Surf->group_avg_vtxarea_loaded)
+    areascale = Surf->group_avg_surface_area / Surf->total_area;
+
+  val = (float *)calloc(Surf->nvertices, sizeof(float));
+  vtxarea = (float *)calloc(Surf->nvertices, sizeof(float));
+  out = (float *)calloc(Surf->nvertices, sizeof(float));
+  nnbrs = (int *)calloc(Surf->nvertices, sizeof(int));
+  nbrs = (const int **)calloc(Surf->nvertices, sizeof(int *));
+  vtx = 0;
+  for (s = 0; s < sig->depth; s++) {
+    for (r = 0; r < sig->height; r++) {
+      for (c = 0; c < sig->width; c++, vtx++) {
+        if (mask == NULL || MRIgetVoxVal(mask, c, r, s, 0) >= 0.5) val[vtx] = MRIgetVoxVal(sig, c, r, s, frame);
+        if (!Surf->group_avg_vtxarea_loaded)
+          vtxarea[vtx] = Surf->vertices[vtx].area * areascale;
+        else
+          vtxarea[vtx] = Surf->vertices[vtx].group_avg_area;
+        nnbrs[vtx] = Surf->vertices_topology[vtx].vnum;
+        nbrs[vtx] = Surf->vertices_topology[vtx].v;
+      }
+    }
+  }
+
+  TFCEgraph(val, vtxarea, Surf->nvertices, nnbrs, nbrs, E, H, thsign, out);
+
+  vtx = 0;
+  for (s = 0; s < sig->depth; s++)
+    for (r = 0; r < sig->height; r++)
+      for (c = 0; c < sig->width; c++, vtx++) MRIsetVoxVal(tfce, c, r, s, 0, out[vtx]);
+
+  free(val);
+  free(vtxarea);
+  free(out);
+  free(nnbrs);
+  free(nbrs);
+  return (tfce);
+}
 /*----------------------------------------------------------------
   sclustSurfaceArea() - computes the surface area (in mm^2) of a
   cluster. Note:   MRIScomputeMetricProperties() must have been
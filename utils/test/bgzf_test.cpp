@@ -0,0 +1,242 @@
+/**
+ * @brief checks reading single frames of a blocked mgz through its index
+ *
+ */
+/*
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "bgzf.h"
+#include "error.h"
+#include "machine.h"
+#include "mri.h"
+
+const char *Progname = "bgzf_test";
+
+using namespace std;
+
+#define NFRAMES 5
+
+// the voxel data of an mgh follow the 284 byte header
+#define MGH_DATA_OFFSET 284
+
+// the fields of the 64 byte tail member, counted from the end of the file
+#define TAIL_BLOCK_SIZE 38
+#define TAIL_NBLOCKS 34
+#define TAIL_INDEX_OFFSET 18
+
+/* Frames of about 1.5 blocks, so that most of them start inside a block */
+static MRI *makeVolume(void)
+{
+  MRI *mri = MRIallocSequence(37, 29, 23, MRI_FLOAT, NFRAMES);
+  unsigned int seed = 7;
+  int c, r, s, f;
+
+  for (f = 0; f < NFRAMES; f++)
+    for (s = 0; s < mri->depth; s++)
+      for (r = 0; r < mri->height; r++)
+        for (c = 0; c < mri->width; c++) {
+          seed = seed * 1103515245 + 12345;
+          MRIFseq_vox(mri, c, r, s, f) = (seed >> 20) % 50 + f * 1000 + s;
+        }
+  return (mri);
+}
+
+static int sameVolume(const char *name, MRI *mri, MRI *ref)
+{
+  int c, r, s, f;
+
+  if (mri == NULL) {
+    cerr << name << ": could not read" << endl;
+    return (1);
+  }
+  if (mri->nframes != ref->nframes) {
+    cerr << name << ": " << mri->nframes << " frames, expected " << ref->nframes << endl;
+    return (1);
+  }
+  for (f = 0; f < ref->nframes; f++)
+    for (s = 0; s < ref->depth; s++)
+      for (r = 0; r < ref->height; r++)
+        for (c = 0; c < ref->width; c++)
+          if (MRIFseq_vox(mri, c, r, s, f) != MRIFseq_vox(ref, c, r, s, f)) {
+            cerr << name << ": differs at " << c << " " << r << " " << s << " " << f << endl;
+            return (1);
+          }
+  return (0);
+}
+
+/* The voxel at position v of the data in the file, which runs over
+   columns, rows, slices and then frames */
+static float voxelAt(MRI *mri, long long v)
+{
+  long long const slicelen = (long long)mri->width * mri->height, framelen = slicelen * mri->depth;
+  return (MRIFseq_vox(mri, v % mri->width, (v % slicelen) / mri->width, (v % framelen) / slicelen, v / framelen));
+}
+
+/* Each frame, read on its own from the blocks that hold it, and a range
+   that runs across a frame boundary */
+static int checkFrames(const char *fname, MRI *ref)
+{
+  BGZF_INDEX *idx = BGZFreadIndex(fname);
+  long long const framelen = (long long)ref->width * ref->height * ref->depth;
+  vector<float> buf(2 * framelen);
+  int f, fails = 0;
+  long long i;
+
+  if (idx == NULL) {
+    cerr << fname << ": no block index" << endl;
+    return (1);
+  }
+  if (idx->nblocks < NFRAMES || idx->usize < MGH_DATA_OFFSET + NFRAMES * framelen * (long long)sizeof(float)) {
+    cerr << fname << ": " << idx->nblocks << " blocks of " << idx->usize << " bytes" << endl;
+    fails++;
+  }
+
+  for (f = NFRAMES - 1; f >= 0; f--) {
+    long long const offset = MGH_DATA_OFFSET + f * framelen * sizeof(float);
+    if (BGZFreadRange(fname, idx, offset, framelen * sizeof(float), &buf[0]) != NO_ERROR) {
+      cerr << "could not read frame " << f << endl;
+      fails++;
+      continue;
+    }
+    for (i = 0; i < framelen; i++)
+      if (orderFloatBytes(buf[i]) != voxelAt(ref, f * framelen + i)) {
+        cerr << "frame " << f << " differs at " << i << endl;
+        fails++;
+        break;
+      }
+  }
+
+  // the second half of frame 1 and the first half of frame 2
+  if (BGZFreadRange(fname, idx, MGH_DATA_OFFSET + (framelen + framelen / 2) * sizeof(float),
+                    framelen * sizeof(float), &buf[0]) != NO_ERROR) {
+    cerr << "could not read across frames 1 and 2" << endl;
+    fails++;
+  }
+  else {
+    for (i = 0; i < framelen; i++) {
+      if (orderFloatBytes(buf[i]) != voxelAt(ref, framelen + framelen / 2 + i)) {
+        cerr << "range across frames 1 and 2 differs at " << i << endl;
+        fails++;
+        break;
+      }
+    }
+  }
+
+  BGZFfreeIndex(&idx);
+  return (fails);
+}
+
+/* Overwrites the 4 or 8 byte little endian field at back bytes from the end */
+static int patchTail(const string &src, const string &dst, int back, int size, long long val)
+{
+  string cmd = "cp " + src + " " + dst;
+  unsigned char b[8];
+  FILE *fp;
+  int i;
+
+  if (system(cmd.c_str()) != 0) return (1);
+  for (i = 0; i < size; i++) b[i] = (val >> (8 * i)) & 0xff;
+  fp = fopen(dst.c_str(), "r+b");
+  if (!fp) return (1);
+  if (fseek(fp, -back, SEEK_END) != 0 || fwrite(b, 1, size, fp) != (size_t)size) {
+    fclose(fp);
+    return (1);
+  }
+  fclose(fp);
+  return (0);
+}
+
+/* A tail that does not agree with the file must be rejected, and the
+   file then still read as an ordinary mgz */
+static int checkBadTail(const string &fname, const string &bad, MRI *ref, int back, int size, long long val,
+                        const char *what)
+{
+  BGZF_INDEX *idx;
+  MRI *mri;
+  int fails = 0;
+
+  if (patchTail(fname, bad, back, size, val)) {
+    cerr << "could not patch " << what << endl;
+    return (1);
+  }
+  idx = BGZFreadIndex(bad.c_str());
+  if (idx) {
+    cerr << "index with " << what << " was accepted" << endl;
+    BGZFfreeIndex(&idx);
+    fails++;
+  }
+  mri = MRIread(bad.c_str());
+  fails += sameVolume(what, mri, ref);
+  if (mri) MRIfree(&mri);
+  return (fails);
+}
+
+int main(int argc, char *argv[])
+{
+  char dirtmpl[] = "/tmp/bgzf_test.XXXXXX";
+  int fails = 0;
+  MRI *ref, *mri;
+  BGZF_INDEX *idx;
+
+  if (!mkdtemp(dirtmpl)) {
+    cerr << "could not make a directory" << endl;
+    return (1);
+  }
+  string const blocked = string(dirtmpl) + "/blocked.mgz", plain = string(dirtmpl) + "/plain.mgz";
+  string const bad = string(dirtmpl) + "/bad.mgz";
+
+  ref = makeVolume();
+  mriio_set_mgz_blocked(1);
+  MRIwrite(ref, blocked.c_str());
+  mriio_set_mgz_blocked(0);
+  MRIwrite(ref, plain.c_str());
+
+  fails += checkFrames(blocked.c_str(), ref);
+
+  mri = MRIread(blocked.c_str());
+  fails += sameVolume("blocked", mri, ref);
+  if (mri) MRIfree(&mri);
+
+  idx = BGZFreadIndex(plain.c_str());
+  if (idx) {
+    cerr << "index found in an ordinary mgz" << endl;
+    BGZFfreeIndex(&idx);
+    fails++;
+  }
+
+  idx = BGZFreadIndex(blocked.c_str());
+  if (idx) {
+    fails += checkBadTail(blocked, bad, ref, TAIL_BLOCK_SIZE, 4, 0, "zero block size");
+    fails += checkBadTail(blocked, bad, ref, TAIL_BLOCK_SIZE, 4, idx->block_size / 2, "wrong block size");
+    fails += checkBadTail(blocked, bad, ref, TAIL_NBLOCKS, 8, idx->nblocks + 1, "too many blocks");
+    fails += checkBadTail(blocked, bad, ref, TAIL_NBLOCKS, 8, -1, "negative block count");
+    fails += checkBadTail(blocked, bad, ref, TAIL_INDEX_OFFSET, 8, idx->coffset[idx->nblocks] + 1000000,
+                          "index past the end");
+    fails += checkBadTail(blocked, bad, ref, TAIL_INDEX_OFFSET, 8, idx->coffset[1], "index inside the data");
+    BGZFfreeIndex(&idx);
+  }
+
+  string cmd = string("rm -rf ") + dirtmpl;
+  if (system(cmd.c_str()) != 0) cerr << "could not remove " << dirtmpl << endl;
+  MRIfree(&ref);
+
+  if (fails) return (1);
+  return (0);
+}
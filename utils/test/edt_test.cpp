@@ -0,0 +1,162 @@
+/**
+ * @brief checks MRIexactDistanceTransform() against a brute force search
+ *
+ */
+/*
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <iostream>
+#include <math.h>
+#include <stdlib.h>
+
+#include "macros.h"
+#include "mri.h"
+
+const char *Progname = "edt_test";
+
+using namespace std;
+
+#define LABEL 3
+
+/* A few overlapping balls of LABEL on a background of other labels,
+   with anisotropic voxels */
+static MRI *makeLabels(void)
+{
+  MRI *mri = MRIalloc(24, 20, 16, MRI_UCHAR);
+  float centers[4][4] = {{6, 5, 4, 3.5}, {15, 12, 9, 5}, {19, 4, 12, 2.5}, {8, 15, 11, 3}};
+  int x, y, z, n;
+
+  mri->xsize = 1.0;
+  mri->ysize = 1.3;
+  mri->zsize = 0.7;
+  for (z = 0; z < mri->depth; z++) {
+    for (y = 0; y < mri->height; y++) {
+      for (x = 0; x < mri->width; x++) {
+        int label = 1 + (x + y) % 2;
+        for (n = 0; n < 4; n++) {
+          double dx = x - centers[n][0], dy = y - centers[n][1], dz = z - centers[n][2];
+          if (dx * dx + dy * dy + dz * dz < centers[n][3] * centers[n][3]) label = LABEL;
+        }
+        MRIsetVoxVal(mri, x, y, z, 0, label);
+      }
+    }
+  }
+  return (mri);
+}
+
+static double centerDist(MRI *mri, int x, int y, int z, int x1, int y1, int z1)
+{
+  double dx = (x - x1) * mri->xsize, dy = (y - y1) * mri->ysize, dz = (z - z1) * mri->zsize;
+  return (sqrt(dx * dx + dy * dy + dz * dz));
+}
+
+static double boxDist(MRI *mri, int x, int y, int z, int x1, int y1, int z1)
+{
+  double dx = MAX(fabs((double)(x - x1)) - 0.5, 0) * mri->xsize;
+  double dy = MAX(fabs((double)(y - y1)) - 0.5, 0) * mri->ysize;
+  double dz = MAX(fabs((double)(z - z1)) - 0.5, 0) * mri->zsize;
+  return (sqrt(dx * dx + dy * dy + dz * dz));
+}
+
+/* The nearest voxel must be on the other side of the boundary and as
+   close (center to center) as any voxel there, and the distance must
+   be to the face of that voxel */
+static int checkSigned(MRI *mri, MRI *dist, MRI *nearest)
+{
+  int x, y, z, x1, y1, z1, xn, yn, zn, inside, fails = 0;
+  double dmin, d, expected;
+
+  for (z = 0; z < mri->depth; z++) {
+    for (y = 0; y < mri->height; y++) {
+      for (x = 0; x < mri->width; x++) {
+        inside = nint(MRIgetVoxVal(mri, x, y, z, 0)) == LABEL;
+        dmin = 1e10;
+        for (z1 = 0; z1 < mri->depth; z1++)
+          for (y1 = 0; y1 < mri->height; y1++)
+            for (x1 = 0; x1 < mri->width; x1++) {
+              if ((nint(MRIgetVoxVal(mri, x1, y1, z1, 0)) == LABEL) == inside) continue;
+              d = centerDist(mri, x, y, z, x1, y1, z1);
+              if (d < dmin) dmin = d;
+            }
+        xn = nint(MRIgetVoxVal(nearest, x, y, z, 0));
+        yn = nint(MRIgetVoxVal(nearest, x, y, z, 1));
+        zn = nint(MRIgetVoxVal(nearest, x, y, z, 2));
+        if (xn < 0 || (nint(MRIgetVoxVal(mri, xn, yn, zn, 0)) == LABEL) == inside ||
+            fabs(centerDist(mri, x, y, z, xn, yn, zn) - dmin) > 1e-4) {
+          if (fails++ < 10)
+            cerr << "voxel " << x << " " << y << " " << z << ": nearest " << xn << " " << yn << " " << zn
+                 << " is not the closest voxel across the boundary (" << dmin << " mm)" << endl;
+          continue;
+        }
+        expected = boxDist(mri, x, y, z, xn, yn, zn) * (inside ? -1 : 1);
+        if (fabs(MRIgetVoxVal(dist, x, y, z, 0) - expected) > 1e-4) {
+          if (fails++ < 10)
+            cerr << "voxel " << x << " " << y << " " << z << ": distance " << MRIgetVoxVal(dist, x, y, z, 0)
+                 << ", expected " << expected << endl;
+        }
+      }
+    }
+  }
+  return (fails);
+}
+
+/* Limiting the distance only clamps it */
+static int checkClamped(MRI *mri, MRI *dist, MRI *limited, float max_dist, int mode)
+{
+  int x, y, z, fails = 0;
+  double d, expected, maxmm = max_dist * mri->xsize;
+
+  for (z = 0; z < mri->depth; z++) {
+    for (y = 0; y < mri->height; y++) {
+      for (x = 0; x < mri->width; x++) {
+        d = MRIgetVoxVal(dist, x, y, z, 0);
+        if (mode == DTRANS_MODE_UNSIGNED)
+          expected = MIN(fabs(d), maxmm);
+        else if (mode == DTRANS_MODE_OUTSIDE)
+          expected = MIN(MAX(d, 0), maxmm);
+        else
+          expected = MIN(MAX(-d, 0), maxmm);
+        if (fabs(MRIgetVoxVal(limited, x, y, z, 0) - expected) > 1e-4) {
+          if (fails++ < 10)
+            cerr << "mode " << mode << " voxel " << x << " " << y << " " << z << ": distance "
+                 << MRIgetVoxVal(limited, x, y, z, 0) << ", expected " << expected << endl;
+        }
+      }
+    }
+  }
+  return (fails);
+}
+
+int main(int argc, char *argv[])
+{
+  int fails = 0, mode;
+  MRI *mri, *dist, *nearest = NULL, *limited;
+
+  mri = makeLabels();
+  dist = MRIexactDistanceTransform(mri, NULL, LABEL, -1, DTRANS_MODE_SIGNED, NULL, &nearest);
+  fails += checkSigned(mri, dist, nearest);
+
+  int modes[3] = {DTRANS_MODE_UNSIGNED, DTRANS_MODE_OUTSIDE, DTRANS_MODE_INSIDE};
+  for (mode = 0; mode < 3; mode++) {
+    limited = MRIexactDistanceTransform(mri, NULL, LABEL, 3, modes[mode], NULL, NULL);
+    fails += checkClamped(mri, dist, limited, 3, modes[mode]);
+    MRIfree(&limited);
+  }
+
+  MRIfree(&mri);
+  MRIfree(&dist);
+  MRIfree(&nearest);
+
+  if (fails) return (1);
+  return (0);
+}
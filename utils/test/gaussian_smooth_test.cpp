@@ -0,0 +1,258 @@
+/**
+ * @brief checks MRIgaussianSmoothNI() against smoothing each axis with GaussianMatrix(),
+ * and MRIxcorr() against summing over every offset
+ *
+ */
+/*
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <iostream>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "matrix.h"
+#include "mri.h"
+
+const char *Progname = "gaussian_smooth_test";
+
+using namespace std;
+
+/* Noise plus a few spikes, with anisotropic voxels so that the std in
+   voxels differs per axis */
+static MRI *makeVolume(int type)
+{
+  MRI *vol = MRIallocSequence(30, 24, 20, type, 2);
+  unsigned int seed = 17;
+  int col, row, slc, f;
+  vol->xsize = 1.0;
+  vol->ysize = 1.5;
+  vol->zsize = 1.25;
+  for (f = 0; f < vol->nframes; f++) {
+    for (slc = 0; slc < vol->depth; slc++) {
+      for (row = 0; row < vol->height; row++) {
+        for (col = 0; col < vol->width; col++) {
+          seed = seed * 1103515245 + 12345;
+          float val = (seed >> 16) % 100;
+          if ((seed >> 8) % 97 == 0) val = 250;
+          MRIsetVoxVal(vol, col, row, slc, f, val);
+        }
+      }
+    }
+  }
+  return (vol);
+}
+
+/* Smooths one axis of vol in place with GaussianMatrix() and returns
+   the center row sum that the result is scaled by */
+static double smoothAxis(MRI *vol, int axis, double std)
+{
+  int len = axis == 0 ? vol->width : axis == 1 ? vol->height : vol->depth;
+  int n[3], i, j, f, a1, a2;
+  double scale;
+  MATRIX *G, *v, *vg;
+
+  if (std <= 0) return (1);
+  G = GaussianMatrix(len, std, 1, NULL);
+  v = MatrixAlloc(len, 1, MATRIX_REAL);
+  vg = MatrixAlloc(len, 1, MATRIX_REAL);
+  for (f = 0; f < vol->nframes; f++) {
+    int d1 = axis == 0 ? vol->height : vol->width;
+    int d2 = axis == 2 ? vol->height : vol->depth;
+    for (a1 = 0; a1 < d1; a1++) {
+      for (a2 = 0; a2 < d2; a2++) {
+        for (i = 0; i < len; i++) {
+          n[axis] = i;
+          n[axis == 0 ? 1 : 0] = a1;
+          n[axis == 2 ? 1 : 2] = a2;
+          v->rptr[i + 1][1] = MRIgetVoxVal(vol, n[0], n[1], n[2], f);
+        }
+        MatrixMultiply(G, v, vg);
+        for (i = 0; i < len; i++) {
+          n[axis] = i;
+          n[axis == 0 ? 1 : 0] = a1;
+          n[axis == 2 ? 1 : 2] = a2;
+          MRIsetVoxVal(vol, n[0], n[1], n[2], f, vg->rptr[i + 1][1]);
+        }
+      }
+    }
+  }
+  scale = 1;
+  if (len > 1)
+    for (scale = 0, j = 0; j < len; j++) scale += G->rptr[len / 2][j + 1];
+  MatrixFree(&v);
+  MatrixFree(&vg);
+  MatrixFree(&G);
+  return (scale);
+}
+
+/* The spatial smoothing, storing (and so rounding) into the type of
+   targ after each step */
+static MRI *smoothSpatial(MRI *src, double cstd, double rstd, double sstd, MRI *targ)
+{
+  double scale;
+  int col, row, slc, f;
+
+  MRIcopy(src, targ);
+  scale = smoothAxis(targ, 0, cstd / src->xsize);
+  scale *= smoothAxis(targ, 1, rstd / src->ysize);
+  scale *= smoothAxis(targ, 2, sstd / src->zsize);
+  for (f = 0; f < targ->nframes; f++)
+    for (slc = 0; slc < targ->depth; slc++)
+      for (row = 0; row < targ->height; row++)
+        for (col = 0; col < targ->width; col++)
+          MRIsetVoxVal(targ, col, row, slc, f, MRIgetVoxVal(targ, col, row, slc, f) / scale);
+  return (targ);
+}
+
+static int compareSmooth(int type, double cstd, double rstd, double sstd, double tol)
+{
+  MRI *src, *targ, *ref;
+  double maxdiff = 0, diff;
+  int col, row, slc, f;
+
+  src = makeVolume(type);
+  targ = MRIallocSequence(src->width, src->height, src->depth, type, src->nframes);
+  ref = MRIallocSequence(src->width, src->height, src->depth, type, src->nframes);
+  MRIgaussianSmoothNI(src, cstd, rstd, sstd, targ);
+  smoothSpatial(src, cstd, rstd, sstd, ref);
+  for (f = 0; f < src->nframes; f++)
+    for (slc = 0; slc < src->depth; slc++)
+      for (row = 0; row < src->height; row++)
+        for (col = 0; col < src->width; col++) {
+          diff = fabs(MRIgetVoxVal(targ, col, row, slc, f) - MRIgetVoxVal(ref, col, row, slc, f));
+          if (diff > maxdiff) maxdiff = diff;
+        }
+  MRIfree(&src);
+  MRIfree(&targ);
+  MRIfree(&ref);
+  if (maxdiff > tol) {
+    cerr << "type " << type << " std " << cstd << " " << rstd << " " << sstd << ": max diff " << maxdiff
+         << ", expected at most " << tol << endl;
+    return (1);
+  }
+  return (0);
+}
+
+/* Noise plus a ramp, so that the correlation is not flat */
+static MRI *makeXcorrVolume(int width, int height, int depth, unsigned int seed)
+{
+  MRI *vol = MRIalloc(width, height, depth, MRI_FLOAT);
+  int col, row, slc;
+  for (slc = 0; slc < depth; slc++) {
+    for (row = 0; row < height; row++) {
+      for (col = 0; col < width; col++) {
+        seed = seed * 1103515245 + 12345;
+        MRIsetVoxVal(vol, col, row, slc, 0, (seed >> 16) % 100 / 10.0 - 5 + col - row + 0.5 * slc);
+      }
+    }
+  }
+  return (vol);
+}
+
+/* MRIxcorr() against summing in(x)*ref(x+d) over the volume for every
+   offset d, centered as in MRIxcorr() */
+static int compareXcorr(MRI *ref, MRI *in, MRI *xcorr, const char *name)
+{
+  int width = ref->width, height = ref->height, depth = ref->depth;
+  int x0 = (width - 1) / 2, y0 = (height - 1) / 2, z0 = (depth - 1) / 2;
+  int X, Y, Z, x, y, z, dx, dy, dz;
+  double sum, diff, maxdiff = 0, maxval = 0;
+
+  if (xcorr == NULL) {
+    cerr << name << ": no output" << endl;
+    return (1);
+  }
+  for (Z = 0; Z < depth; Z++)
+    for (Y = 0; Y < height; Y++)
+      for (X = 0; X < width; X++) {
+        dx = X - x0;
+        dy = Y - y0;
+        dz = Z - z0;
+        sum = 0;
+        for (z = MAX(0, -dz); z < MIN(depth, depth - dz); z++)
+          for (y = MAX(0, -dy); y < MIN(height, height - dy); y++)
+            for (x = MAX(0, -dx); x < MIN(width, width - dx); x++)
+              sum += MRIgetVoxVal(in, x, y, z, 0) * MRIgetVoxVal(ref, x + dx, y + dy, z + dz, 0);
+        diff = fabs(MRIgetVoxVal(xcorr, X, Y, Z, 0) - sum);
+        if (diff > maxdiff) maxdiff = diff;
+        if (fabs(sum) > maxval) maxval = fabs(sum);
+      }
+  if (maxdiff > 1e-5 * maxval) {
+    cerr << name << ": max diff " << maxdiff << " of " << maxval << endl;
+    return (1);
+  }
+  return (0);
+}
+
+static int checkXcorr(int width, int height, int depth)
+{
+  MRI *ref, *in, *xcorr;
+  int fails;
+  char name[100];
+
+  ref = makeXcorrVolume(width, height, depth, 29);
+  in = makeXcorrVolume(width, height, depth, 31);
+  xcorr = MRIxcorr(ref, in, NULL);
+  sprintf(name, "xcorr %dx%dx%d", width, height, depth);
+  fails = compareXcorr(ref, in, xcorr, name);
+  if (xcorr) MRIfree(&xcorr);
+  MRIfree(&ref);
+  MRIfree(&in);
+  return (fails);
+}
+
+/* Several threads asking for the same new FFT plan at once must all get
+   a working one */
+static int checkXcorrThreads(void)
+{
+  MRI *ref, *in, *xcorr[4];
+  int n, fails = 0;
+
+  ref = makeXcorrVolume(13, 10, 7, 37);
+  in = makeXcorrVolume(13, 10, 7, 41);
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for
+#endif
+  for (n = 0; n < 4; n++) xcorr[n] = MRIxcorr(ref, in, NULL);
+  for (n = 0; n < 4; n++) {
+    fails += compareXcorr(ref, in, xcorr[n], "xcorr from several threads");
+    if (xcorr[n]) MRIfree(&xcorr[n]);
+  }
+  MRIfree(&ref);
+  MRIfree(&in);
+  return (fails);
+}
+
+int main(int argc, char *argv[])
+{
+  int fails = 0;
+
+  // at the 2 voxel threshold (in x), and just below it
+  fails += compareSmooth(MRI_FLOAT, 2.0, 1.5, 1.25, 1e-4);
+  fails += compareSmooth(MRI_FLOAT, 1.99, 2.5, 1.0, 1e-4);
+  // wide kernels in every direction, and one axis left alone
+  fails += compareSmooth(MRI_FLOAT, 4.0, 6.0, 5.0, 1e-4);
+  fails += compareSmooth(MRI_FLOAT, 3.0, 0, 2.5, 1e-4);
+  // integer targets round after each axis whichever path is used
+  fails += compareSmooth(MRI_UCHAR, 2.0, 3.0, 2.5, 0);
+  fails += compareSmooth(MRI_SHORT, 4.0, 6.0, 5.0, 0);
+  // odd and even sizes, padded to lengths with factors of 2, 3 and 5
+  fails += checkXcorr(11, 9, 7);
+  fails += checkXcorr(8, 6, 5);
+  fails += checkXcorr(16, 1, 3);
+  fails += checkXcorrThreads();
+
+  if (fails) return (1);
+  return (0);
+}
@@ -0,0 +1,213 @@
+/**
+ * @brief checks that the mapped (.gcx) atlas reads back, and that a truncated one is rejected
+ *
+ */
+/*
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "gca.h"
+
+const char *Progname = "gca_mapped_test";
+
+using namespace std;
+
+/* A small two-input atlas with one to three classes per node, Gibbs
+   priors for some neighbors, and one or two labels per prior */
+static GCA *makeAtlas(void)
+{
+  GCA *gca = GCAalloc(2, 2, 4, 24, 20, 16, 0);
+  int x, y, z, n, i;
+
+  for (x = 0; x < gca->node_width; x++)
+    for (y = 0; y < gca->node_height; y++)
+      for (z = 0; z < gca->node_depth; z++) {
+        GCA_NODE *gcan = &gca->nodes[x][y][z];
+        gcan->nlabels = 1 + (x + 2 * y + z) % 3;
+        gcan->total_training = 10 + x;
+        for (n = 0; n < gcan->nlabels; n++) {
+          GC1D *gc = &gcan->gcs[n];
+          gcan->labels[n] = 2 + 3 * n + x % 2;
+          gc->means[0] = 100 + x + n;
+          gc->means[1] = 50 + y - n;
+          gc->covars[0] = 4 + z;
+          gc->covars[1] = 0.5;
+          gc->covars[2] = 9;
+          for (i = 0; i < GIBBS_NEIGHBORS; i++) {
+            gc->nlabels[i] = (i + n) % 2;
+            if (gc->nlabels[i] == 0) continue;
+            gc->labels[i] = (unsigned short *)calloc(1, sizeof(unsigned short));
+            gc->label_priors[i] = (float *)calloc(1, sizeof(float));
+            gc->labels[i][0] = gcan->labels[n];
+            gc->label_priors[i][0] = 0.25 * (i + 1);
+          }
+        }
+      }
+  for (x = 0; x < gca->prior_width; x++)
+    for (y = 0; y < gca->prior_height; y++)
+      for (z = 0; z < gca->prior_depth; z++) {
+        GCA_PRIOR *gcap = &gca->priors[x][y][z];
+        gcap->nlabels = 1 + (x + y + z) % 2;
+        gcap->total_training = 5;
+        for (n = 0; n < gcap->nlabels; n++) {
+          gcap->labels[n] = 2 + 3 * n;
+          gcap->priors[n] = 1.0 / gcap->nlabels;
+        }
+      }
+  return (gca);
+}
+
+static int sameAtlas(GCA *gca, GCA *ref)
+{
+  int x, y, z, n, i;
+
+  for (x = 0; x < ref->node_width; x++)
+    for (y = 0; y < ref->node_height; y++)
+      for (z = 0; z < ref->node_depth; z++) {
+        GCA_NODE *gcan = &gca->nodes[x][y][z], *refn = &ref->nodes[x][y][z];
+        if (gcan->nlabels != refn->nlabels) return (0);
+        for (n = 0; n < refn->nlabels; n++) {
+          GC1D *gc = &gcan->gcs[n], *refgc = &refn->gcs[n];
+          if (gcan->labels[n] != refn->labels[n] || gc->means[0] != refgc->means[0] ||
+              gc->means[1] != refgc->means[1] || gc->covars[0] != refgc->covars[0] ||
+              gc->covars[2] != refgc->covars[2])
+            return (0);
+          for (i = 0; i < GIBBS_NEIGHBORS; i++) {
+            if (gc->nlabels[i] != refgc->nlabels[i]) return (0);
+            if (gc->nlabels[i] && (gc->labels[i][0] != refgc->labels[i][0] ||
+                                   gc->label_priors[i][0] != refgc->label_priors[i][0]))
+              return (0);
+          }
+        }
+      }
+  for (x = 0; x < ref->prior_width; x++)
+    for (y = 0; y < ref->prior_height; y++)
+      for (z = 0; z < ref->prior_depth; z++) {
+        GCA_PRIOR *gcap = &gca->priors[x][y][z], *refp = &ref->priors[x][y][z];
+        if (gcap->nlabels != refp->nlabels) return (0);
+        for (n = 0; n < refp->nlabels; n++)
+          if (gcap->labels[n] != refp->labels[n] || gcap->priors[n] != refp->priors[n]) return (0);
+      }
+  return (1);
+}
+
+/* GCAreadMapped() of a damaged copy must fail, not crash */
+static int checkRejected(const string &cut, const char *what)
+{
+  GCA *gca = GCAreadMapped(cut.c_str());
+  if (gca) {
+    cerr << "atlas with " << what << " was read" << endl;
+    GCAfree(&gca);
+    return (1);
+  }
+  return (0);
+}
+
+/* Cut the file short anywhere from inside the header to its last byte */
+static int checkTruncated(const string &fname, const string &cut, off_t size)
+{
+  int k, fails = 0;
+  char what[100];
+
+  for (k = 0; k <= 32; k++) {
+    off_t const len = k < 32 ? 100 + (size - 100) * k / 32 : size - 1;
+    string cmd = "cp " + fname + " " + cut;
+    if (system(cmd.c_str()) != 0 || truncate(cut.c_str(), len) != 0) {
+      cerr << "could not truncate to " << len << endl;
+      fails++;
+      continue;
+    }
+    sprintf(what, "%lld of %lld bytes", (long long)len, (long long)size);
+    fails += checkRejected(cut, what);
+  }
+  return (fails);
+}
+
+/* Point one table of the header outside the file, or give it a bad count.
+   The counts and offsets are the long longs that follow the 128 byte
+   geometry and the TR/FA/TE arrays of MAX_GCA_INPUTS doubles */
+static int checkBadHeader(const string &fname, const string &cut, off_t size)
+{
+  long const counts = 128 + 3 * MAX_GCA_INPUTS * sizeof(double);
+  struct {
+    long pos;
+    long long val;
+    const char *what;
+  } const patches[] = {{counts + 8, -1, "a negative Gibbs count"},
+                       {counts + 16, 1LL << 40, "a huge prior label count"},
+                       {counts + 24, size - 8, "node labels past the end"},
+                       {counts + 40, 1LL << 40, "class labels past the end"},
+                       {counts + 64, -64, "a negative Gibbs offset"},
+                       {counts + 72, size - 2, "Gibbs labels past the end"},
+                       {counts + 96, size, "prior labels at the end"}};
+  int k, fails = 0;
+
+  for (k = 0; k < (int)(sizeof(patches) / sizeof(patches[0])); k++) {
+    string cmd = "cp " + fname + " " + cut;
+    FILE *fp = NULL;
+    if (system(cmd.c_str()) != 0 || (fp = fopen(cut.c_str(), "r+b")) == NULL || fseek(fp, patches[k].pos, SEEK_SET) ||
+        fwrite(&patches[k].val, sizeof(long long), 1, fp) != 1) {
+      cerr << "could not write " << patches[k].what << endl;
+      if (fp) fclose(fp);
+      fails++;
+      continue;
+    }
+    fclose(fp);
+    fails += checkRejected(cut, patches[k].what);
+  }
+  return (fails);
+}
+
+int main(int argc, char *argv[])
+{
+  char dirtmpl[] = "/tmp/gca_mapped_test.XXXXXX";
+  struct stat st;
+  GCA *ref, *gca;
+  int fails = 0;
+
+  if (!mkdtemp(dirtmpl)) {
+    cerr << "could not make a directory" << endl;
+    return (1);
+  }
+  string const fname = string(dirtmpl) + "/atlas.gcx", cut = string(dirtmpl) + "/cut.gcx";
+
+  ref = makeAtlas();
+  if (GCAwriteMapped(ref, fname.c_str()) != NO_ERROR || stat(fname.c_str(), &st) != 0) {
+    cerr << "could not write " << fname << endl;
+    return (1);
+  }
+
+  gca = GCAread(fname.c_str());
+  if (!gca || !sameAtlas(gca, ref)) {
+    cerr << "the mapped atlas does not read back" << endl;
+    fails++;
+  }
+  if (gca) GCAfree(&gca);
+
+  fails += checkTruncated(fname, cut, st.st_size);
+  fails += checkBadHeader(fname, cut, st.st_size);
+
+  string cmd = string("rm -rf ") + dirtmpl;
+  if (system(cmd.c_str()) != 0) cerr << "could not remove " << dirtmpl << endl;
+  GCAfree(&ref);
+
+  if (fails) return (1);
+  return (0);
+}
@@ -0,0 +1,230 @@
+/**
+ * @brief checks the fixed-point morph inverse and the inverse saved in the m3z
+ *
+ */
+/*
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "gcamorph.h"
+#include "machine.h"
+#include "mri.h"
+
+const char *Progname = "gcam_invert_test";
+
+using namespace std;
+
+#define NNODES 20
+#define SPACING 2
+#define INVERSE_TOL 0.01
+
+/* A smooth warp of a NNODES^3 node grid onto a 40^3 image */
+static GCA_MORPH *makeMorph(MRI **pmri)
+{
+  GCA_MORPH *gcam = GCAMalloc(NNODES, NNODES, NNODES);
+  MRI *mri = MRIallocHeader(NNODES * SPACING, NNODES * SPACING, NNODES * SPACING, MRI_FLOAT, 1);
+  int x, y, z;
+
+  gcam->spacing = SPACING;
+  getVolGeom(mri, &gcam->image);
+  getVolGeom(mri, &gcam->atlas);
+  for (x = 0; x < NNODES; x++)
+    for (y = 0; y < NNODES; y++)
+      for (z = 0; z < NNODES; z++) {
+        GCA_MORPH_NODE *gcamn = &gcam->nodes[x][y][z];
+        gcamn->origx = gcamn->xn = x * SPACING;
+        gcamn->origy = gcamn->yn = y * SPACING;
+        gcamn->origz = gcamn->zn = z * SPACING;
+        gcamn->x = x * SPACING + 0.5 + 1.5 * sin(M_PI * (y + z) / NNODES);
+        gcamn->y = y * SPACING + 0.5 + 1.2 * cos(M_PI * (x - z) / NNODES);
+        gcamn->z = z * SPACING + 0.5 + 1.0 * sin(2 * M_PI * x / NNODES);
+        gcamn->invalid = GCAM_VALID;
+      }
+  *pmri = mri;
+  return (gcam);
+}
+
+/* Where the morph maps the node coordinate p */
+static void nodePosition(GCA_MORPH *gcam, const double p[3], double F[3])
+{
+  int const lo[3] = {(int)floor(p[0]), (int)floor(p[1]), (int)floor(p[2])};
+  double const f[3] = {p[0] - lo[0], p[1] - lo[1], p[2] - lo[2]};
+  int i, j, k;
+
+  F[0] = F[1] = F[2] = 0;
+  for (i = 0; i < 2; i++)
+    for (j = 0; j < 2; j++)
+      for (k = 0; k < 2; k++) {
+        GCA_MORPH_NODE *gcamn = &gcam->nodes[lo[0] + i][lo[1] + j][lo[2] + k];
+        double const w = (i ? f[0] : 1 - f[0]) * (j ? f[1] : 1 - f[1]) * (k ? f[2] : 1 - f[2]);
+        F[0] += w * gcamn->x;
+        F[1] += w * gcamn->y;
+        F[2] += w * gcamn->z;
+      }
+}
+
+/* Every voxel well inside the morph must map back onto itself, and the
+   inverse must be close to the one splatting finds */
+static int checkFixedPoint(GCA_MORPH *gcam, MRI *mri)
+{
+  GCA_MORPH *splat;
+  MRI *mri_splat;
+  double rms = -1, F[3], d, sumdiff = 0, maxresidual = 0;
+  int x, y, z, ninside = 0, fails = 0;
+
+  if (GCAMinvertFixedPoint(gcam, mri, 20, INVERSE_TOL, &rms) != NO_ERROR || !gcam->mri_xind) {
+    cerr << "GCAMinvertFixedPoint failed" << endl;
+    return (1);
+  }
+  if (rms < 0 || rms > INVERSE_TOL) {
+    cerr << "rms residual " << rms << ", expected at most " << INVERSE_TOL << endl;
+    fails++;
+  }
+
+  splat = makeMorph(&mri_splat);
+  unsetenv("FREESURFER_GCAMinvert_fixedPoint");
+  GCAMinvert(splat, mri_splat);
+
+  for (x = 0; x < mri->width; x++)
+    for (y = 0; y < mri->height; y++)
+      for (z = 0; z < mri->depth; z++) {
+        double const p[3] = {MRIFvox(gcam->mri_xind, x, y, z), MRIFvox(gcam->mri_yind, x, y, z),
+                             MRIFvox(gcam->mri_zind, x, y, z)};
+        if (p[0] < 1 || p[1] < 1 || p[2] < 1 || p[0] > NNODES - 2 || p[1] > NNODES - 2 || p[2] > NNODES - 2)
+          continue;
+        ninside++;
+        nodePosition(gcam, p, F);
+        d = sqrt((F[0] - x) * (F[0] - x) + (F[1] - y) * (F[1] - y) + (F[2] - z) * (F[2] - z));
+        if (d > maxresidual) maxresidual = d;
+        sumdiff += fabs(p[0] - MRIFvox(splat->mri_xind, x, y, z)) + fabs(p[1] - MRIFvox(splat->mri_yind, x, y, z)) +
+                   fabs(p[2] - MRIFvox(splat->mri_zind, x, y, z));
+      }
+  if (ninside < mri->width * mri->height * mri->depth / 2) {
+    cerr << "only " << ninside << " voxels map inside the morph" << endl;
+    fails++;
+  }
+  if (maxresidual > INVERSE_TOL) {
+    cerr << "max residual " << maxresidual << ", expected at most " << INVERSE_TOL << endl;
+    fails++;
+  }
+  if (ninside > 0 && sumdiff / (3 * ninside) > 0.25) {
+    cerr << "mean difference from the splatted inverse " << sumdiff / (3 * ninside) << " nodes" << endl;
+    fails++;
+  }
+  GCAMfree(&splat);
+  MRIfree(&mri_splat);
+  return (fails);
+}
+
+static int sameInverse(const char *name, GCA_MORPH *gcam, GCA_MORPH *ref)
+{
+  MRI *ind[3] = {gcam->mri_xind, gcam->mri_yind, gcam->mri_zind};
+  MRI *refind[3] = {ref->mri_xind, ref->mri_yind, ref->mri_zind};
+  int x, y, z, n;
+
+  for (n = 0; n < 3; n++) {
+    if (!ind[n]) {
+      cerr << name << ": no inverse" << endl;
+      return (1);
+    }
+    for (x = 0; x < ref->image.width; x++)
+      for (y = 0; y < ref->image.height; y++)
+        for (z = 0; z < ref->image.depth; z++)
+          if (MRIFvox(ind[n], x, y, z) != MRIFvox(refind[n], x, y, z)) {
+            cerr << name << ": inverse differs at " << x << " " << y << " " << z << endl;
+            return (1);
+          }
+  }
+  return (0);
+}
+
+/* The inverse written with the morph is read back, and is dropped when
+   the nodes in the file no longer match it */
+static int checkSaved(GCA_MORPH *gcam)
+{
+  char dirtmpl[] = "/tmp/gcam_invert_test.XXXXXX";
+  GCA_MORPH *read;
+  FILE *fp;
+  float pos;
+  int fails = 0;
+
+  if (!mkdtemp(dirtmpl)) {
+    cerr << "could not make a directory" << endl;
+    return (1);
+  }
+  string m3z = string(dirtmpl) + "/inv.m3z", m3d = string(dirtmpl) + "/inv.m3d";
+
+  setenv("FREESURFER_GCAMwrite_inverse", "1", 1);
+  GCAMwrite(gcam, m3z.c_str());
+  GCAMwrite(gcam, m3d.c_str());
+  unsetenv("FREESURFER_GCAMwrite_inverse");
+
+  read = GCAMread(m3z.c_str());
+  if (!read)
+    fails++;
+  else {
+    fails += sameInverse("m3z", read, gcam);
+    GCAMfree(&read);
+  }
+  read = GCAMread(m3d.c_str());
+  if (!read)
+    fails++;
+  else {
+    fails += sameInverse("m3d", read, gcam);
+    GCAMfree(&read);
+  }
+
+  // move the first node in the uncompressed copy. it follows the 24 byte
+  // header and its 3 original coordinates, in big-endian order
+  fp = fopen(m3d.c_str(), "r+b");
+  if (!fp || fseek(fp, 36, SEEK_SET) != 0 || fread(&pos, sizeof(float), 1, fp) != 1) fails++;
+  pos = orderFloatBytes(orderFloatBytes(pos) + 0.5f);
+  if (!fp || fseek(fp, 36, SEEK_SET) != 0 || fwrite(&pos, sizeof(float), 1, fp) != 1) fails++;
+  if (fp) fclose(fp);
+  read = GCAMread(m3d.c_str());
+  if (!read)
+    fails++;
+  else {
+    if (read->mri_xind) {
+      cerr << "the saved inverse of a moved node was used" << endl;
+      fails++;
+    }
+    GCAMfree(&read);
+  }
+
+  string cmd = string("rm -rf ") + dirtmpl;
+  if (system(cmd.c_str()) != 0) cerr << "could not remove " << dirtmpl << endl;
+  return (fails);
+}
+
+int main(int argc, char *argv[])
+{
+  int fails = 0;
+  GCA_MORPH *gcam;
+  MRI *mri;
+
+  gcam = makeMorph(&mri);
+  fails += checkFixedPoint(gcam, mri);
+  fails += checkSaved(gcam);
+  GCAMfree(&gcam);
+  MRIfree(&mri);
+
+  if (fails) return (1);
+  return (0);
+}
@@ -0,0 +1,139 @@
+/**
+ * @brief checks the sparse GTM design matrix against the dense one
+ *
+ */
+/*
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <iostream>
+#include <math.h>
+#include <stdlib.h>
+
+#include "gtm.h"
+#include "mri.h"
+#include "mri2.h"
+
+const char *Progname = "gtm_sparse_test";
+
+using namespace std;
+
+/* 5 slab segs across an ellipsoid, so that the padded seg bounding boxes
+   overlap but do not cover the volume, and a dynamic input with noise */
+static void makeInputs(MRI **pseg, MRI **py, MRI **pmask)
+{
+  MRI *seg = MRIalloc(44, 40, 24, MRI_INT);
+  MRI *y = MRIallocSequence(44, 40, 24, MRI_FLOAT, 3);
+  MRI *mask = MRIalloc(44, 40, 24, MRI_UCHAR);
+  unsigned int rseed = 29;
+  int c, r, s, f, id;
+  double dc, dr, ds;
+
+  for (s = 0; s < seg->depth; s++) {
+    for (r = 0; r < seg->height; r++) {
+      for (c = 0; c < seg->width; c++) {
+        dc = (c - 21.5) / 18.0;
+        dr = (r - 19.5) / 16.0;
+        ds = (s - 11.5) / 9.0;
+        id = 0;
+        if (dc * dc + dr * dr + ds * ds < 1) id = 1 + MIN((c - 3) / 8, 4);
+        MRIsetVoxVal(seg, c, r, s, 0, id);
+        MRIsetVoxVal(mask, c, r, s, 0, dc * dc + dr * dr + ds * ds < 1.6);
+        for (f = 0; f < y->nframes; f++) {
+          rseed = rseed * 1103515245 + 12345;
+          MRIsetVoxVal(y, c, r, s, f, id * (10 + 5 * f) + ((rseed >> 16) % 100) / 25.0);
+        }
+      }
+    }
+  }
+  *pseg = seg;
+  *py = y;
+  *pmask = mask;
+}
+
+static GTM *solveGTM(MRI *seg, MRI *y, MRI *mask, int UseSparseX)
+{
+  GTM *gtm = GTMalloc();
+  gtm->UseSparseX = UseSparseX;
+  gtm->yvol = MRIcopy(y, NULL);
+  gtm->mask = MRIcopy(mask, NULL);
+  gtm->gtmseg = seg;
+  gtm->segidlist = MRIsegIdListNot0(seg, &gtm->nsegs, 0);
+  gtm->nframes = y->nframes;
+  gtm->cFWHM = 2.0;
+  gtm->rFWHM = 2.0;
+  gtm->sFWHM = 3.0;
+  gtm->Optimizing = 0;
+  GTMpsfStd(gtm);
+  GTMnPad(gtm);
+  GTMsetNMask(gtm);
+  GTMmatrixY(gtm);
+  if (GTMbuildX(gtm) || GTMsolve(gtm)) {
+    cerr << "could not solve the " << (UseSparseX ? "sparse" : "dense") << " GTM" << endl;
+    exit(1);
+  }
+  return (gtm);
+}
+
+static int compareMatrices(const char *name, MATRIX *m1, MATRIX *m2, double tol)
+{
+  int r, c;
+  double diff, maxdiff = 0, maxval = 0;
+
+  if (m1->rows != m2->rows || m1->cols != m2->cols) {
+    cerr << name << ": " << m1->rows << "x" << m1->cols << ", expected " << m2->rows << "x" << m2->cols << endl;
+    return (1);
+  }
+  for (r = 1; r <= m1->rows; r++) {
+    for (c = 1; c <= m1->cols; c++) {
+      diff = fabs(m1->rptr[r][c] - m2->rptr[r][c]);
+      if (diff > maxdiff) maxdiff = diff;
+      if (fabs(m2->rptr[r][c]) > maxval) maxval = fabs(m2->rptr[r][c]);
+    }
+  }
+  if (maxdiff > tol * maxval) {
+    cerr << name << ": max diff " << maxdiff << " (max value " << maxval << ")" << endl;
+    return (1);
+  }
+  return (0);
+}
+
+int main(int argc, char *argv[])
+{
+  int fails = 0;
+  MRI *seg, *y, *mask;
+  GTM *sparse, *dense;
+
+  makeInputs(&seg, &y, &mask);
+  sparse = solveGTM(seg, y, mask, 1);
+  dense = solveGTM(seg, y, mask, 0);
+
+  if (sparse->Xs == NULL || dense->X == NULL) {
+    cerr << "expected one sparse and one dense design matrix" << endl;
+    fails++;
+  }
+  fails += compareMatrices("XtX", sparse->XtX, dense->XtX, 1e-5);
+  fails += compareMatrices("beta", sparse->beta, dense->beta, 1e-4);
+  fails += compareMatrices("yhat", sparse->yhat, dense->yhat, 1e-4);
+  fails += compareMatrices("rvar", sparse->rvar, dense->rvar, 1e-3);
+
+  free(sparse->segidlist);
+  free(dense->segidlist);
+  GTMfree(&sparse);
+  GTMfree(&dense);
+  MRIfree(&seg);
+  MRIfree(&y);
+  MRIfree(&mask);
+
+  if (fails) return (1);
+  return (0);
+}
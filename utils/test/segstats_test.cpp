@@ -0,0 +1,145 @@
+/**
+ * @brief checks the one-pass segmentation stats against the per-id functions
+ *
+ */
+/*
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <iostream>
+#include <stdlib.h>
+
+#include "mri.h"
+#include "mri2.h"
+
+const char *Progname = "segstats_test";
+
+using namespace std;
+
+#define NFRAMES 3
+
+/* Blocky segmentation with ids from a sparse range, including an id
+   that is not in the list and a listed id with no voxels */
+static MRI *makeSeg(int *nsegs, int *segidlist)
+{
+  MRI *seg = MRIalloc(23, 17, 11, MRI_INT);
+  int ids[7] = {0, 2, 17, 41, 1000, 2035, 5001};
+  int c, r, s, n;
+
+  for (s = 0; s < seg->depth; s++)
+    for (r = 0; r < seg->height; r++)
+      for (c = 0; c < seg->width; c++) MRIsetVoxVal(seg, c, r, s, 0, ids[(c / 4 + 2 * (r / 5) + 3 * (s / 3)) % 7]);
+
+  // 5001 is left out of the list, 77 is listed but not there
+  for (n = 0; n < 6; n++) segidlist[n] = ids[n];
+  segidlist[6] = 77;
+  *nsegs = 7;
+  return (seg);
+}
+
+static MRI *makeInput(MRI *seg)
+{
+  MRI *mri = MRIallocSequence(seg->width, seg->height, seg->depth, MRI_FLOAT, NFRAMES);
+  unsigned int seed = 17;
+  int c, r, s, f;
+
+  for (f = 0; f < NFRAMES; f++)
+    for (s = 0; s < seg->depth; s++)
+      for (r = 0; r < seg->height; r++)
+        for (c = 0; c < seg->width; c++) {
+          seed = seed * 1103515245 + 12345;
+          MRIsetVoxVal(mri, c, r, s, f, ((seed >> 16) % 10000) / 37.0 - 100);
+        }
+  return (mri);
+}
+
+static int countVoxels(MRI *seg, int segid)
+{
+  int c, r, s, nvox = 0;
+  for (s = 0; s < seg->depth; s++)
+    for (r = 0; r < seg->height; r++)
+      for (c = 0; c < seg->width; c++)
+        if (MRIgetVoxVal(seg, c, r, s, 0) == segid) nvox++;
+  return (nvox);
+}
+
+static int checkStats(MRI *seg, MRI *mri, int nsegs, int *segidlist, int robust, float Pct)
+{
+  int nvox[7], n, fails = 0;
+  float min[7], max[7], range[7], mean[7], std[7];
+  float min1, max1, range1, mean1, std1;
+
+  MRIsegStatsMulti(seg, nsegs, segidlist, mri, 1, robust, Pct, nvox, min, max, range, mean, std);
+  for (n = 0; n < nsegs; n++) {
+    if (nvox[n] != countVoxels(seg, segidlist[n])) {
+      cerr << "id " << segidlist[n] << ": " << nvox[n] << " voxels, expected " << countVoxels(seg, segidlist[n])
+           << endl;
+      fails++;
+    }
+    if (nvox[n] == 0) continue;
+    if (robust)
+      MRIsegStatsRobust(seg, segidlist[n], mri, 1, &min1, &max1, &range1, &mean1, &std1, Pct);
+    else
+      MRIsegStats(seg, segidlist[n], mri, 1, &min1, &max1, &range1, &mean1, &std1);
+    if (min[n] != min1 || max[n] != max1 || range[n] != range1 || mean[n] != mean1 || std[n] != std1) {
+      cerr << "id " << segidlist[n] << (robust ? " robust" : "") << ": " << min[n] << " " << max[n] << " "
+           << range[n] << " " << mean[n] << " " << std[n] << ", expected " << min1 << " " << max1 << " " << range1
+           << " " << mean1 << " " << std1 << endl;
+      fails++;
+    }
+  }
+  return (fails);
+}
+
+static int checkFrameAvg(MRI *seg, MRI *mri, int nsegs, int *segidlist)
+{
+  int nvox[7], n, f, nvox1, fails = 0;
+  double favgbuf[7][NFRAMES], *favg[7], favg1[NFRAMES];
+
+  for (n = 0; n < nsegs; n++) favg[n] = favgbuf[n];
+  MRIsegFrameAvgMulti(seg, nsegs, segidlist, mri, nvox, favg);
+  for (n = 0; n < nsegs; n++) {
+    nvox1 = MRIsegFrameAvg(seg, segidlist[n], mri, favg1);
+    if (nvox[n] != nvox1) {
+      cerr << "id " << segidlist[n] << ": frame average of " << nvox[n] << " voxels, expected " << nvox1 << endl;
+      fails++;
+    }
+    for (f = 0; f < NFRAMES; f++) {
+      if (favg[n][f] != favg1[f]) {
+        cerr << "id " << segidlist[n] << " frame " << f << ": average " << favg[n][f] << ", expected " << favg1[f]
+             << endl;
+        fails++;
+      }
+    }
+  }
+  return (fails);
+}
+
+int main(int argc, char *argv[])
+{
+  int nsegs, segidlist[7], fails = 0;
+  MRI *seg, *mri;
+
+  seg = makeSeg(&nsegs, segidlist);
+  mri = makeInput(seg);
+
+  fails += checkStats(seg, mri, nsegs, segidlist, 0, 0);
+  fails += checkStats(seg, mri, nsegs, segidlist, 1, 2.0);
+  fails += checkStats(seg, mri, nsegs, segidlist, 1, 10.0);
+  fails += checkFrameAvg(seg, mri, nsegs, segidlist);
+
+  MRIfree(&seg);
+  MRIfree(&mri);
+
+  if (fails) return (1);
+  return (0);
+}
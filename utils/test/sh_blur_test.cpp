@@ -0,0 +1,145 @@
+/**
+ * @brief checks the spherical harmonic blur against the spatial MRISPblurFrames
+ *
+ */
+/*
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <iostream>
+#include <math.h>
+#include <stdlib.h>
+
+#include "mri.h"
+#include "mrisurf.h"
+
+const char *Progname = "sh_blur_test";
+
+using namespace std;
+
+#define NFRAMES 3
+
+/* Frame 0 is x on the unit sphere, a pure degree 1 function. Frames 1
+   and 2 are smooth fields of higher degree with a little noise */
+static MRI_SP *makeParameterization(void)
+{
+  MRI_SP *mrisp = MRISPalloc(0.25, NFRAMES);
+  unsigned int seed = 29;
+  int u, v;
+
+  for (u = 0; u < U_DIM(mrisp); u++) {
+    double const phi = (double)u * PHI_MAX / PHI_DIM(mrisp);
+    for (v = 0; v < V_DIM(mrisp); v++) {
+      double const theta = (double)v * THETA_MAX / THETA_DIM(mrisp);
+      double const x = sin(phi) * cos(theta), y = sin(phi) * sin(theta), z = cos(phi);
+      seed = seed * 1103515245 + 12345;
+      *IMAGEFseq_pix(mrisp->Ip, u, v, 0) = x;
+      *IMAGEFseq_pix(mrisp->Ip, u, v, 1) = 2 * x * y - z + 0.5 * (3 * z * z - 1) + ((seed >> 16) % 100) / 1000.0;
+      *IMAGEFseq_pix(mrisp->Ip, u, v, 2) = 10 * sin(3 * theta) * pow(sin(phi), 3) + 5 * z;
+    }
+  }
+  return (mrisp);
+}
+
+static double frameRange(MRI_SP *mrisp, int f)
+{
+  double min = *IMAGEFseq_pix(mrisp->Ip, 0, 0, f), max = min;
+  int u, v;
+  for (u = 0; u < U_DIM(mrisp); u++)
+    for (v = 0; v < V_DIM(mrisp); v++) {
+      double const val = *IMAGEFseq_pix(mrisp->Ip, u, v, f);
+      if (val < min) min = val;
+      if (val > max) max = val;
+    }
+  return (max - min);
+}
+
+/* Largest difference in frame f over the rows at least margin cells from
+   the poles, where the spatial kernel is cut short */
+static double maxDiff(MRI_SP *mrisp, MRI_SP *ref, int f, int margin)
+{
+  double maxdiff = 0;
+  int u, v;
+  for (u = margin; u < U_DIM(ref) - margin; u++)
+    for (v = 0; v < V_DIM(ref); v++) {
+      double const diff = fabs(*IMAGEFseq_pix(mrisp->Ip, u, v, f) - *IMAGEFseq_pix(ref->Ip, u, v, f));
+      if (diff > maxdiff) maxdiff = diff;
+    }
+  return (maxdiff);
+}
+
+static int checkSigma(MRI_SP *mrisp, float sigma)
+{
+  int frames[NFRAMES] = {0, 1, 2}, f, u, v, fails = 0;
+  MRI_SP *ref, *sh, *sh1;
+
+  unsetenv("FREESURFER_MRISPblur_sh");
+  ref = MRISPblurFrames(mrisp, NULL, sigma, frames, NFRAMES);
+  setenv("FREESURFER_MRISPblur_sh", "1", 1);
+  sh = MRISPblurFrames(mrisp, NULL, sigma, frames, NFRAMES);
+
+  // the spatial kernel is only close to the heat kernel, so allow a few
+  // percent of the range of each frame
+  for (f = 0; f < NFRAMES; f++) {
+    double const tol = 0.03 * frameRange(mrisp, f);
+    double const diff = maxDiff(sh, ref, f, 2 * (int)ceil(sigma));
+    if (diff > tol) {
+      cerr << "sigma " << sigma << " frame " << f << ": max diff " << diff << " from the spatial blur, expected at most "
+           << tol << endl;
+      fails++;
+    }
+  }
+
+  // a degree 1 function is only scaled by the heat kernel, everywhere
+  double const t = sigma * PHI_MAX / U_DIM(mrisp), k = exp(-2 * t * t / 4);
+  double maxerr = 0;
+  for (u = 0; u < U_DIM(mrisp); u++)
+    for (v = 0; v < V_DIM(mrisp); v++) {
+      double const err = fabs(*IMAGEFseq_pix(sh->Ip, u, v, 0) - k * *IMAGEFseq_pix(mrisp->Ip, u, v, 0));
+      if (err > maxerr) maxerr = err;
+    }
+  if (maxerr > 1e-5) {
+    cerr << "sigma " << sigma << ": degree 1 error " << maxerr << endl;
+    fails++;
+  }
+
+  // one frame at a time, and in place, must give the same
+  sh1 = MRISPclone(mrisp);
+  for (f = NFRAMES - 1; f >= 0; f--) MRISPblurFrames(sh1, sh1, sigma, &frames[f], 1);
+  for (f = 0; f < NFRAMES; f++) {
+    double const diff = maxDiff(sh1, sh, f, 0);
+    if (diff > 1e-5) {
+      cerr << "sigma " << sigma << " frame " << f << ": in place differs by " << diff << endl;
+      fails++;
+    }
+  }
+
+  unsetenv("FREESURFER_MRISPblur_sh");
+  MRISPfree(&sh1);
+  MRISPfree(&sh);
+  MRISPfree(&ref);
+  return (fails);
+}
+
+int main(int argc, char *argv[])
+{
+  MRI_SP *mrisp = makeParameterization();
+  int fails = 0;
+
+  fails += checkSigma(mrisp, 4);
+  fails += checkSigma(mrisp, 6);
+  fails += checkSigma(mrisp, 10);
+  MRISPfree(&mrisp);
+
+  if (fails) return (1);
+  return (0);
+}
@@ -0,0 +1,241 @@
+/**
+ * @brief checks the sparse surface smoothing operators against the step loops
+ *
+ */
+/*
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "icosahedron.h"
+#include "mri.h"
+#include "mrisurf.h"
+
+const char *Progname = "surf_smooth_test";
+
+using namespace std;
+
+/* An icosahedron of radius 100 with a few ripped vertices */
+static MRIS *makeSurface(void)
+{
+  MRIS *surf = ic2562_make_surface(0, 0);
+  int vno;
+  for (vno = 0; vno < surf->nvertices; vno++) {
+    VERTEX *v = &surf->vertices[vno];
+    double r = sqrt(v->x * v->x + v->y * v->y + v->z * v->z);
+    MRISsetXYZ(surf, vno, v->x * 100 / r, v->y * 100 / r, v->z * 100 / r);
+    if (vno % 97 == 5) v->ripflag = 1;
+  }
+  return (surf);
+}
+
+static MRI *makeOverlay(int nvertices, int nframes)
+{
+  MRI *mri = MRIallocSequence(nvertices, 1, 1, MRI_FLOAT, nframes);
+  unsigned int seed = 41;
+  int vno, f;
+  for (f = 0; f < nframes; f++) {
+    for (vno = 0; vno < nvertices; vno++) {
+      seed = seed * 1103515245 + 12345;
+      MRIFseq_vox(mri, vno, 0, 0, f) = ((seed >> 16) % 1000) / 10.0 - 50;
+    }
+  }
+  return (mri);
+}
+
+/* The gaussian smoothing loop that MRISgaussianSmooth() had before it
+   was built as an operator */
+static MRI *gaussianSmoothLoop(MRIS *surf, MRI *src, double gstd, double trunc)
+{
+  MRI *targ = MRIallocSequence(src->width, 1, 1, MRI_FLOAT, src->nframes);
+  VERTEX *v1 = &surf->vertices[0];
+  double Radius2 = v1->x * v1->x + v1->y * v1->y + v1->z * v1->z;
+  double Radius = sqrt(Radius2);
+  double GVar2 = 2 * gstd * gstd;
+  double f = pow(1 / (sqrt(2 * M_PI) * gstd), 2.0);
+  double DotProdThresh = Radius2 * cos(trunc * gstd / Radius) * (1.0001);
+  int *XNbrVtxNo = (int *)calloc(surf->nvertices, sizeof(int));
+  double *XNbrDotProd = (double *)calloc(surf->nvertices, sizeof(double));
+  int vno, n, nXNbrs, frame;
+
+  for (vno = 0; vno < surf->nvertices; vno++) surf->vertices[vno].val2bak = -1;
+  for (vno = 0; vno < surf->nvertices; vno++) {
+    nXNbrs = 0;
+    MRISextendedNeighbors(surf, vno, vno, DotProdThresh, XNbrVtxNo, XNbrDotProd, &nXNbrs, surf->nvertices, 1);
+    for (n = 0; n < nXNbrs; n++) {
+      double costheta = XNbrDotProd[n] / Radius2;
+      if (costheta > +1.0) costheta = +1.0;
+      if (costheta < -1.0) costheta = -1.0;
+      double d = Radius * acos(costheta);
+      double g = f * exp(-(d * d) / GVar2);
+      for (frame = 0; frame < targ->nframes; frame++) {
+        float val = g * MRIFseq_vox(src, XNbrVtxNo[n], 0, 0, frame);
+        MRIFseq_vox(targ, vno, 0, 0, frame) += val;
+      }
+    }
+  }
+  free(XNbrVtxNo);
+  free(XNbrDotProd);
+  return (targ);
+}
+
+static int compareOverlays(const char *name, MRI *mri, MRI *ref, double tol)
+{
+  double maxdiff = 0;
+  int vno, f;
+  if (mri == NULL) {
+    cerr << name << ": no output" << endl;
+    return (1);
+  }
+  for (f = 0; f < ref->nframes; f++) {
+    for (vno = 0; vno < ref->width; vno++) {
+      double diff = fabs(MRIFseq_vox(mri, vno, 0, 0, f) - MRIFseq_vox(ref, vno, 0, 0, f));
+      if (diff > maxdiff) maxdiff = diff;
+    }
+  }
+  if (maxdiff > tol) {
+    cerr << name << ": max diff " << maxdiff << ", expected at most " << tol << endl;
+    return (1);
+  }
+  return (0);
+}
+
+/* MRISsmoothMRI() with and without the fast (operator) smoother */
+static int checkNearestNeighbor(MRIS *surf, int nframes, int nsteps, bool masked)
+{
+  MRI *src = makeOverlay(surf->nvertices, nframes), *mask = NULL, *ref, *fast;
+  int vno, fails;
+  char name[100];
+
+  if (masked) {
+    mask = MRIalloc(surf->nvertices, 1, 1, MRI_INT);
+    for (vno = 0; vno < surf->nvertices; vno++) MRIsetVoxVal(mask, vno, 0, 0, 0, vno % 13 != 0);
+  }
+  setenv("USE_FAST_SURF_SMOOTHER", "0", 1);
+  ref = MRISsmoothMRI(surf, src, nsteps, mask, NULL);
+  setenv("USE_FAST_SURF_SMOOTHER", "1", 1);
+  fast = MRISsmoothMRI(surf, src, nsteps, mask, NULL);
+  sprintf(name, "nearest neighbor, %d vertices, %d frames, %d steps%s", surf->nvertices, nframes, nsteps,
+          masked ? ", masked" : "");
+  fails = compareOverlays(name, fast, ref, 0);
+  if (fast) MRIfree(&fast);
+
+  // and in place
+  fast = MRISsmoothMRI(surf, src, nsteps, mask, src);
+  sprintf(name, "nearest neighbor in place, %d vertices", surf->nvertices);
+  fails += compareOverlays(name, fast, ref, 0);
+
+  MRIfree(&src);
+  MRIfree(&ref);
+  if (mask) MRIfree(&mask);
+  return (fails);
+}
+
+/* Number of gaussian operators saved in dir */
+static int countCached(const string &dir, string *fname)
+{
+  DIR *dp = opendir(dir.c_str());
+  struct dirent *de;
+  int n = 0;
+  while (dp && (de = readdir(dp)) != NULL) {
+    string name = de->d_name;
+    if (name.size() > 4 && name.compare(name.size() - 4, 4, ".sop") == 0) {
+      *fname = dir + "/" + name;
+      n++;
+    }
+  }
+  if (dp) closedir(dp);
+  return (n);
+}
+
+/* MRISgaussianSmooth() against the old loop, built, then saved to and
+   re-read from FS_SURF_SMOOTH_CACHE, then rebuilt from a damaged file */
+static int checkGaussian(MRIS *surf)
+{
+  MRI *src = makeOverlay(surf->nvertices, 3), *ref, *mri;
+  double gstd = 8, trunc = 4;
+  int fails = 0;
+  char dirtmpl[] = "/tmp/surf_smooth_test.XXXXXX";
+  string fname;
+
+  ref = gaussianSmoothLoop(surf, src, gstd, trunc);
+
+  unsetenv("FS_SURF_SMOOTH_CACHE");
+  mri = MRISgaussianSmooth(surf, src, gstd, NULL, trunc);
+  fails += compareOverlays("gaussian", mri, ref, 0);
+  MRIfree(&mri);
+
+  if (!mkdtemp(dirtmpl)) {
+    cerr << "could not make a cache directory" << endl;
+    return (fails + 1);
+  }
+  setenv("FS_SURF_SMOOTH_CACHE", dirtmpl, 1);
+  mri = MRISgaussianSmooth(surf, src, gstd, NULL, trunc);
+  fails += compareOverlays("gaussian, written to the cache", mri, ref, 0);
+  MRIfree(&mri);
+  if (countCached(dirtmpl, &fname) != 1) {
+    cerr << "expected one operator in " << dirtmpl << endl;
+    fails++;
+  }
+
+  mri = MRISgaussianSmooth(surf, src, gstd, NULL, trunc);
+  fails += compareOverlays("gaussian, read from the cache", mri, ref, 0);
+  MRIfree(&mri);
+
+  // a truncated operator must be rebuilt, not used
+  if (truncate(fname.c_str(), 100) != 0) fails++;
+  mri = MRISgaussianSmooth(surf, src, gstd, NULL, trunc);
+  fails += compareOverlays("gaussian, from a truncated cache", mri, ref, 0);
+  MRIfree(&mri);
+
+  // and a different kernel must not pick up the saved one
+  MRI *ref2 = gaussianSmoothLoop(surf, src, gstd / 2, trunc);
+  mri = MRISgaussianSmooth(surf, src, gstd / 2, NULL, trunc);
+  fails += compareOverlays("gaussian, other kernel", mri, ref2, 0);
+  MRIfree(&mri);
+  MRIfree(&ref2);
+  if (countCached(dirtmpl, &fname) != 2) {
+    cerr << "expected two operators in " << dirtmpl << endl;
+    fails++;
+  }
+
+  unsetenv("FS_SURF_SMOOTH_CACHE");
+  string cmd = string("rm -rf ") + dirtmpl;
+  if (system(cmd.c_str()) != 0) cerr << "could not remove " << dirtmpl << endl;
+  MRIfree(&src);
+  MRIfree(&ref);
+  return (fails);
+}
+
+int main(int argc, char *argv[])
+{
+  int fails = 0;
+  MRIS *surf;
+
+  surf = makeSurface();
+  fails += checkNearestNeighbor(surf, 4, 5, false);
+  fails += checkNearestNeighbor(surf, 4, 5, true);
+  fails += checkGaussian(surf);
+  // enough frames that MRISsmoothOpApply() does them in two blocks
+  fails += checkNearestNeighbor(surf, 3300, 2, true);
+  MRISfree(&surf);
+
+  if (fails) return (1);
+  return (0);
+}
@@ -10,3 +10,13 @@ test_command topology_test
 test_command tiff_write_image
 test_command sc_test
 test_command sse_mathfun_test
+test_command volcluster_test
+test_command gaussian_smooth_test
+test_command gtm_sparse_test
+test_command edt_test
+test_command surf_smooth_test
+test_command segstats_test
+test_command gcam_invert_test
+test_command sh_blur_test
+test_command bgzf_test
+test_command gca_mapped_test
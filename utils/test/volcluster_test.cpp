@@ -0,0 +1,170 @@
+/**
+ * @brief checks clustGetComponents() against growing clusters from the hit map,
+ * and the TFCE p-values of a CSD
+ *
+ */
+/*
+ * Copyright © 2011 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <iostream>
+#include <math.h>
+#include <stdlib.h>
+
+#include "mri.h"
+#include "volcluster.h"
+
+const char *Progname = "volcluster_test";
+
+using namespace std;
+
+/* Values from a small set so that most clusters have ties at their
+   max, and the max member depends on the order of the members */
+static MRI *makeTieVolume(int sign)
+{
+  MRI *vol = MRIallocSequence(9, 7, 5, MRI_FLOAT, 1);
+  unsigned int seed = 53;
+  int col, row, slc;
+  for (slc = 0; slc < vol->depth; slc++) {
+    for (row = 0; row < vol->height; row++) {
+      for (col = 0; col < vol->width; col++) {
+        seed = seed * 1103515245 + 12345;
+        float val = (seed >> 16) % 4;
+        if (sign && (seed >> 8) % 2) val = -val;
+        MRIsetVoxVal(vol, col, row, slc, 0, val);
+      }
+    }
+  }
+  return (vol);
+}
+
+/* The clusters as clustGetClusters() used to find them: seeds from
+   clustInitHitMap() and members in the order clustGrow() adds them */
+static VOLCLUSTER **growClusters(MRI *vol, float thmin, int thsign, int AllowDiag, int *nclusters)
+{
+  int nhits, *hitcol, *hitrow, *hitslc, n;
+  VOLCLUSTER **vclist;
+  MRI *HitMap;
+
+  HitMap = clustInitHitMap(vol, 0, thmin, -1, thsign, &nhits, &hitcol, &hitrow, &hitslc, NULL, 0);
+  vclist = clustAllocClusterList(nhits);
+  *nclusters = 0;
+  for (n = 0; n < nhits; n++) {
+    if (MRIgetVoxVal(HitMap, hitcol[n], hitrow[n], hitslc[n], 0)) continue;
+    vclist[*nclusters] = clustGrow(hitcol[n], hitrow[n], hitslc[n], HitMap, AllowDiag);
+    clustMaxMember(vclist[*nclusters], vol, 0, thsign);
+    (*nclusters)++;
+  }
+  if (nhits > 0) {
+    free(hitcol);
+    free(hitrow);
+    free(hitslc);
+  }
+  MRIfree(&HitMap);
+  return (vclist);
+}
+
+static int compareClusters(MRI *vol, float thmin, int thsign, int AllowDiag)
+{
+  int nclusters, nref, nhits, c, n, fails = 0;
+  VOLCLUSTER **vclist, **vcref;
+
+  vcref = growClusters(vol, thmin, thsign, AllowDiag, &nref);
+  vclist = clustGetComponents(vol, 0, thmin, -1, thsign, NULL, 0, AllowDiag, &nhits, &nclusters);
+  if (nclusters != nref) {
+    cerr << "thsign " << thsign << " thmin " << thmin << " diag " << AllowDiag << ": " << nclusters
+         << " clusters, expected " << nref << endl;
+    return (1);
+  }
+  for (c = 0; c < nclusters; c++) {
+    if (vclist[c]->nmembers != vcref[c]->nmembers || vclist[c]->maxmember != vcref[c]->maxmember) {
+      cerr << "thsign " << thsign << " thmin " << thmin << " diag " << AllowDiag << ": cluster " << c << " has "
+           << vclist[c]->nmembers << " members, max " << vclist[c]->maxmember << ", expected " << vcref[c]->nmembers << ", max "
+           << vcref[c]->maxmember << endl;
+      fails++;
+      continue;
+    }
+    for (n = 0; n < vclist[c]->nmembers; n++) {
+      if (vclist[c]->col[n] != vcref[c]->col[n] || vclist[c]->row[n] != vcref[c]->row[n] ||
+          vclist[c]->slc[n] != vcref[c]->slc[n]) {
+        cerr << "thsign " << thsign << " thmin " << thmin << " diag " << AllowDiag << ": cluster " << c
+             << " member " << n << " out of order" << endl;
+        fails++;
+        break;
+      }
+    }
+  }
+  clustFreeClusterList(&vclist, nclusters);
+  clustFreeClusterList(&vcref, nref);
+  return (fails);
+}
+
+/* CSDpvalMaxTFCEMap() with the max TFCE of ten permutations alternating
+   in sign, so that abs counts both tails */
+static int checkTFCEpval(void)
+{
+  CSD *csd = CSDalloc();
+  MRI *tfce = MRIalloc(4, 1, 1, MRI_FLOAT), *vwsig;
+  double const vals[4] = {5.5, -3.5, 0, 9.5};
+  double const expected[4] = {-log10(0.5), log10(0.7), 0, 1};
+  double maxmaxsig;
+  int n, fails = 0;
+
+  csd->nreps = 10;
+  CSDallocData(csd);
+  for (n = 0; n < csd->nreps; n++) csd->MaxTFCE[n] = (n % 2 ? -1 : 1) * (n + 1);
+  csd->threshsign = 0;
+  for (n = 0; n < 4; n++) MRIsetVoxVal(tfce, n, 0, 0, 0, vals[n]);
+
+  if (CSDpvalMaxTFCEMap(tfce, csd, NULL, NULL, &maxmaxsig, 0) != NULL) {
+    cerr << "TFCE p-values from a CSD without tfce" << endl;
+    fails++;
+  }
+  csd->tfce = 1;
+  vwsig = CSDpvalMaxTFCEMap(tfce, csd, NULL, NULL, &maxmaxsig, 0);
+  for (n = 0; n < 4; n++) {
+    double const sig = MRIgetVoxVal(vwsig, n, 0, 0, 0);
+    if (fabs(sig - expected[n]) > 1e-6) {
+      cerr << "TFCE " << vals[n] << ": sig " << sig << ", expected " << expected[n] << endl;
+      fails++;
+    }
+  }
+  MRIfree(&vwsig);
+  MRIfree(&tfce);
+  CSDfreeData(csd);
+  free(csd);
+  return (fails);
+}
+
+int main(int argc, char *argv[])
+{
+  int fails = 0;
+  MRI *vol;
+
+  vol = makeTieVolume(0);
+  fails += compareClusters(vol, 0.5, 1, 0);
+  fails += compareClusters(vol, 0.5, 1, 1);
+  fails += compareClusters(vol, 2.5, 1, 0);
+  fails += compareClusters(vol, 2.5, 1, 1);
+  MRIfree(&vol);
+
+  vol = makeTieVolume(1);
+  fails += compareClusters(vol, 0.5, 0, 0);
+  fails += compareClusters(vol, 1.5, 0, 1);
+  fails += compareClusters(vol, 0.5, -1, 0);
+  MRIfree(&vol);
+
+  fails += checkTFCEpval();
+
+  if (fails) return (1);
+  return (0);
+}
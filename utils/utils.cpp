@@ -96,6 +96,46 @@ int setRandomSeed(long seed)
 long getRandomSeed(void) { return (idum); }
 long getRandomCalls(void) { return (nrgcalls); }
 
+/*------------------------------------------------------------------------
+  getRandomState() returns a snapshot of the randomNumber() stream and
+  setRandomState() rewinds the stream to it, so that code which draws
+  numbers ahead of time can give back the ones it did not use.
+  ------------------------------------------------------------------------*/
+struct RANDOM_STATE
+{
+  long idum, nrgcalls;
+  bool seedHasBeenSet;
+  void *ran1;
+};
+
+RANDOM_STATE *getRandomState(void)
+{
+  RANDOM_STATE *state = (RANDOM_STATE *)calloc(1, sizeof(RANDOM_STATE));
+  if (!state) ErrorExit(ERROR_NOMEMORY, "getRandomState: could not allocate state");
+  state->idum = idum;
+  state->nrgcalls = nrgcalls;
+  state->seedHasBeenSet = seedHasBeenSet;
+  state->ran1 = OpenRan1SaveState();
+  return (state);
+}
+
+void setRandomState(RANDOM_STATE const *state)
+{
+  idum = state->idum;
+  nrgcalls = state->nrgcalls;
+  seedHasBeenSet = state->seedHasBeenSet;
+  OpenRan1RestoreState(state->ran1);
+}
+
+void freeRandomState(RANDOM_STATE **pstate)
+{
+  RANDOM_STATE *state = *pstate;
+  if (!state) return;
+  *pstate = NULL;
+  OpenRan1FreeState(&state->ran1);
+  free(state);
+}
+
 double randomNumber(double low, double hi)
 {
   double val, range;
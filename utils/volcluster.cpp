@@ -27,6 +27,7 @@
 #include "resample.h"
 #include "transform.h"
 #include "utils.h"
+#include "romp_support.h"
 #define VOLCLUSTER_SRC
 #include "surfcluster.h"
 #include "volcluster.h"
@@ -768,6 +769,132 @@ LABEL *clustCluster2Label(
   return (label);
 }
 
+/*-------------------------------------------------------------------
+  clustGetComponents() - finds all the clusters of voxels that are in
+  the threshold range (and in binmask, if not NULL), with the same
+  contiguity as clustGrow(), without building a hit map MRI. The
+  clusters are ordered by their seed in the col/row/slc order of
+  clustInitHitMap(), and the members of each are listed in the order
+  that clustGrow() would add them, so maxmember (first member on ties)
+  and the order of clusters with equal keys are the same as growing
+  from the hit map. nhits is set to the number of voxels in the
+  threshold range.
+  -------------------------------------------------------------------*/
+VOLCLUSTER **clustGetComponents(MRI *vol,
+                                int frame,
+                                float thmin,
+                                float thmax,
+                                int thsign,
+                                MRI *binmask,
+                                int maskframe,
+                                int AllowDiag,
+                                int *nhits,
+                                int *nClusters)
+{
+  int col, row, slc, c, n, m, nvox, nclusters, nh, nmembers;
+  int nthmember, dcol, drow, dslc, c0, r0, s0, c2, r2, s2, n2;
+  unsigned char *hit;
+  int *members;
+  VOLCLUSTER **ClusterList, *vc;
+  float voxsizemm3;
+
+  *nClusters = 0;
+  nvox = vol->width * vol->height * vol->depth;
+  voxsizemm3 = vol->xsize * vol->ysize * vol->zsize;
+
+  /* Mark the voxels that are in the mask and in the threshold
+     range (same test as clustInitHitMap()) */
+  hit = (unsigned char *)calloc(nvox, sizeof(unsigned char));
+  if (hit == NULL) {
+    printf("ERROR: clustGetComponents: could not alloc %d\n", nvox);
+    return (NULL);
+  }
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+  for (slc = 0; slc < vol->depth; slc++) {
+    ROMP_PFLB_begin
+    int col, row, maskval;
+    for (row = 0; row < vol->height; row++) {
+      for (col = 0; col < vol->width; col++) {
+        if (binmask != NULL) {
+          maskval = MRIgetVoxVal(binmask, col, row, slc, maskframe);
+          if (maskval == 0) continue;
+        }
+        hit[col + vol->width * (row + vol->height * slc)] =
+            clustValueInRange(MRIgetVoxVal(vol, col, row, slc, frame), thmin, thmax, thsign);
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+  nh = 0;
+  for (n = 0; n < nvox; n++) nh += hit[n];
+  if (nhits) *nhits = nh;
+
+  /* Seeds are taken in the col/row/slc order of clustInitHitMap(), and
+     the members are added breadth-first with the neighbor order of
+     clustGrowOneVoxel() into one queue of voxel indices shared by all
+     the clusters, then copied into a cluster of the final size. hit[]
+     is cleared as voxels are added, so each cluster is only seeded
+     once. There cannot be more clusters than hits. */
+  members = (int *)calloc(nh + 1, sizeof(int));
+  ClusterList = clustAllocClusterList(nh + 1);
+  nclusters = 0;
+  for (col = 0; col < vol->width; col++) {
+    for (row = 0; row < vol->height; row++) {
+      for (slc = 0; slc < vol->depth; slc++) {
+        n = col + vol->width * (row + vol->height * slc);
+        if (!hit[n]) continue;
+        members[0] = n;
+        nmembers = 1;
+        hit[n] = 0;
+        for (nthmember = 0; nthmember < nmembers; nthmember++) {
+          m = members[nthmember];
+          c0 = m % vol->width;
+          r0 = (m / vol->width) % vol->height;
+          s0 = m / (vol->width * vol->height);
+          for (dcol = -1; dcol <= +1; dcol++) {
+            c2 = c0 + dcol;
+            if (c2 < 0 || c2 >= vol->width) continue;
+            for (drow = -1; drow <= +1; drow++) {
+              r2 = r0 + drow;
+              if (r2 < 0 || r2 >= vol->height) continue;
+              for (dslc = -1; dslc <= +1; dslc++) {
+                s2 = s0 + dslc;
+                if (s2 < 0 || s2 >= vol->depth) continue;
+                if (!AllowDiag && abs(dcol) + abs(drow) + abs(dslc) != 1) continue;
+                n2 = c2 + vol->width * (r2 + vol->height * s2);
+                if (!hit[n2]) continue;
+                members[nmembers++] = n2;
+                hit[n2] = 0;
+              }
+            }
+          }
+        }
+        vc = clustAllocCluster(nmembers);
+        vc->voxsize = voxsizemm3;
+        vc->nmembers = nmembers;
+        for (nthmember = 0; nthmember < nmembers; nthmember++) {
+          m = members[nthmember];
+          vc->col[nthmember] = m % vol->width;
+          vc->row[nthmember] = (m / vol->width) % vol->height;
+          vc->slc[nthmember] = m / (vol->width * vol->height);
+        }
+        ClusterList[nclusters++] = vc;
+      }
+    }
+  }
+  for (c = 0; c < nclusters; c++) clustMaxMember(ClusterList[c], vol, frame, thsign);
+
+  free(hit);
+  free(members);
+
+  *nClusters = nclusters;
+  return (ClusterList);
+}
+
 /*-------------------------------------------------------------*/
 VOLCLUSTER **clustGetClusters(MRI *vol,
                               int frame,
@@ -779,66 +906,37 @@ VOLCLUSTER **clustGetClusters(MRI *vol,
                               int *nClusters,
                               MATRIX *XFM)
 {
-  int nthhit, nclusters, nhits, *hitcol = NULL, *hitrow = NULL, *hitslc = NULL;
-  int col, row, slc, allowdiag = 0, nprunedclusters;
-  MRI *HitMap;
+  int n, nhits, nclusters, allowdiag = 0, nprunedclusters;
   VOLCLUSTER **ClusterList, **ClusterList2;
-  float voxsizemm3, distthresh = 0;
+  float voxsizemm3, clustersize, distthresh = 0;
 
   voxsizemm3 = vol->xsize * vol->ysize * vol->zsize;
 
-  /* Initialize the hit map - this is a map of voxels that have been
-     accounted for as either outside of a the threshold range or
-     belonging to a cluster. The initialization is for thresholding */
-  HitMap = clustInitHitMap(vol, frame, threshmin, threshmax, threshsign, &nhits, &hitcol, &hitrow, &hitslc, binmask, 0);
-  if (HitMap == NULL) {
-    // Nothing survived the first thresholding
+  /* Find the clusters of voxels that meet the threshold criteria */
+  ClusterList = clustGetComponents(vol, frame, threshmin, threshmax, threshsign, binmask, 0, allowdiag, &nhits, &nclusters);
+  if (ClusterList == NULL) {
     *nClusters = 0;
     return (NULL);
   }
   if (Gdiag_no > 0) printf("INFO: Found %d voxels in threhold range\n", nhits);
-
-  /* Allocate an array of clusters equal to the number of hits -- this
-     is the maximum number of clusters possible */
-  ClusterList = clustAllocClusterList(nhits);
-  if (ClusterList == NULL) {
-    printf("ERROR: could not alloc %d clusters\n", nhits);
-    return (NULL);
-  }
-
-  nclusters = 0;
-  for (nthhit = 0; nthhit < nhits; nthhit++) {
-    /* Determine whether this hit is still valid. It may
-       not be if it was assigned to the cluster of a
-       previous hit */
-    col = hitcol[nthhit];
-    row = hitrow[nthhit];
-    slc = hitslc[nthhit];
-    if (MRIgetVoxVal(HitMap, col, row, slc, 0)) continue;
-
-    /* Grow cluster using this hit as a seed */
-    ClusterList[nclusters] = clustGrow(col, row, slc, HitMap, allowdiag);
-    ClusterList[nclusters]->voxsize = voxsizemm3;
-
-    /* Determine the member with the maximum value */
-    clustMaxMember(ClusterList[nclusters], vol, frame, threshsign);
-
-    if (XFM) clustComputeTal(ClusterList[nclusters], XFM);
-
-    /* increment the number of clusters */
-    nclusters++;
-  }
-  free(hitcol);
-  free(hitrow);
-  free(hitslc);
-
   if (Gdiag_no > 0) printf("INFO: Found %d clusters that meet threshold criteria\n", nclusters);
 
-  /* Remove clusters that do not meet the minimum size requirement */
-  ClusterList2 = clustPruneBySize(ClusterList, nclusters, voxsizemm3, minclustsizemm3, &nprunedclusters);
-  clustFreeClusterList(&ClusterList, nclusters);
+  /* Remove clusters that do not meet the minimum size requirement.
+     Done in place rather than with clustPruneBySize() to avoid
+     copying the clusters that are kept. */
+  nprunedclusters = 0;
+  for (n = 0; n < nclusters; n++) {
+    clustersize = ClusterList[n]->nmembers * voxsizemm3;
+    if (clustersize >= minclustsizemm3)
+      ClusterList[nprunedclusters++] = ClusterList[n];
+    else
+      clustFreeCluster(&ClusterList[n]);
+  }
+  for (n = nprunedclusters; n < nclusters; n++) ClusterList[n] = NULL;
   nclusters = nprunedclusters;
-  ClusterList = ClusterList2;
+
+  if (XFM)
+    for (n = 0; n < nclusters; n++) clustComputeTal(ClusterList[n], XFM);
 
   if (Gdiag_no > 0) printf("INFO: Found %d clusters that meet size criteria\n", nclusters);
 
@@ -851,12 +949,8 @@ VOLCLUSTER **clustGetClusters(MRI *vol,
     ClusterList = ClusterList2;
   }
 
-  /* Sort Clusters by MaxValue */
-  ClusterList2 = clustSortClusterList(ClusterList2, nclusters, NULL);
-  clustFreeClusterList(&ClusterList, nclusters);
-  ClusterList = ClusterList2;
-
-  MRIfree(&HitMap);
+  /* Sort Clusters by MaxValue (in place) */
+  clustSortClusterList(ClusterList, nclusters, ClusterList);
 
   if (Gdiag_no > 0) printf("INFO: Found %d final clusters\n", nclusters);
   *nClusters = nclusters;
@@ -908,6 +1002,573 @@ int clustDumpSummary(FILE *fp, VOLCLUSTER **ClusterList, int nClusters)
   return (0);
 }
 
+/*-------------------------------------------------------------------
+  CCOMPalloc() - allocates the union-find forest and the cluster map
+  for nelements elements. The same structure can be relabeled any
+  number of times (eg, once per simulation iteration).
+  -------------------------------------------------------------------*/
+CCOMP *CCOMPalloc(int nelements)
+{
+  CCOMP *cc;
+
+  cc = (CCOMP *)calloc(1, sizeof(CCOMP));
+  cc->nelements = nelements;
+  cc->parent = (int *)calloc(nelements, sizeof(int));
+  cc->clusterno = (int *)calloc(nelements, sizeof(int));
+  if (cc->parent == NULL || cc->clusterno == NULL) {
+    printf("ERROR: CCOMPalloc: could not alloc %d\n", nelements);
+    CCOMPfree(&cc);
+    return (NULL);
+  }
+  return (cc);
+}
+
+/*-------------------------------------------------------------------*/
+int CCOMPfree(CCOMP **pcc)
+{
+  CCOMP *cc = *pcc;
+
+  if (cc == NULL) return (0);
+  free(cc->parent);
+  free(cc->clusterno);
+  free(cc->nmembers);
+  free(cc->size);
+  free(cc->weight);
+  free(cc->weightsize);
+  free(cc->maxval);
+  free(cc->maxelement);
+  free(cc);
+  *pcc = NULL;
+  return (0);
+}
+
+/*-------------------------------------------------------------------
+  ccompFind() - root of the set holding e, halving the path on the
+  way up. Only one thread may work on a given part of the forest.
+  -------------------------------------------------------------------*/
+static int ccompFind(int *parent, int e)
+{
+  while (parent[e] != e) {
+    parent[e] = parent[parent[e]];
+    e = parent[e];
+  }
+  return (e);
+}
+
+/*-------------------------------------------------------------------
+  ccompUnion() - joins the sets holding a and b. The smaller root is
+  kept, so the root of a set is always its smallest element no
+  matter in what order the pairs are joined.
+  -------------------------------------------------------------------*/
+static void ccompUnion(int *parent, int a, int b)
+{
+  a = ccompFind(parent, a);
+  b = ccompFind(parent, b);
+  if (a < b)
+    parent[b] = a;
+  else if (b < a)
+    parent[a] = b;
+}
+
+/*-------------------------------------------------------------------
+  ccompNumChunks() - number of independent pieces to split n items
+  into: one per thread, or just one when already running inside a
+  parallel region (eg, mri_glmfit simulations).
+  -------------------------------------------------------------------*/
+static int ccompNumChunks(int n)
+{
+  int nchunks = 1;
+#ifdef HAVE_OPENMP
+  if (!omp_in_parallel()) nchunks = omp_get_max_threads();
+#endif
+  if (nchunks > n) nchunks = n;
+  if (nchunks < 1) nchunks = 1;
+  return (nchunks);
+}
+
+/*-------------------------------------------------------------------
+  ccompNumber() - numbers the sets in the order of their smallest
+  element. The root is the smallest element of its set, so it has
+  been numbered by the time any other member is reached.
+  -------------------------------------------------------------------*/
+static int ccompNumber(CCOMP *cc, const unsigned char *hit)
+{
+  int e, r;
+
+  cc->nclusters = 0;
+  for (e = 0; e < cc->nelements; e++) {
+    if (!hit[e]) {
+      cc->clusterno[e] = 0;
+      continue;
+    }
+    r = ccompFind(cc->parent, e);
+    if (r == e)
+      cc->clusterno[e] = ++cc->nclusters;
+    else
+      cc->clusterno[e] = cc->clusterno[r];
+  }
+  return (cc->nclusters);
+}
+
+/*-------------------------------------------------------------------
+  ccompJoinSlice() - joins each hit voxel of slice slc to the hit
+  neighbors given by offsets k0..k1-1.
+  -------------------------------------------------------------------*/
+static void ccompJoinSlice(int *parent, const unsigned char *hit, int width, int height, int slc,
+                           const int *dc, const int *dr, const int *ds, int k0, int k1)
+{
+  int col, row, k, ncol, nrow, e;
+
+  for (row = 0; row < height; row++) {
+    for (col = 0; col < width; col++) {
+      e = col + width * (row + height * slc);
+      if (!hit[e]) continue;
+      for (k = k0; k < k1; k++) {
+        ncol = col + dc[k];
+        if (ncol < 0 || ncol >= width) continue;
+        nrow = row + dr[k];
+        if (nrow < 0 || nrow >= height) continue;
+        if (hit[ncol + width * (nrow + height * (slc + ds[k]))])
+          ccompUnion(parent, e, ncol + width * (nrow + height * (slc + ds[k])));
+      }
+    }
+  }
+}
+
+/*-------------------------------------------------------------------
+  CCOMPlabelGrid() - finds the connected components of the hit
+  voxels of a width x height x depth grid. Neighbors share a face,
+  or also an edge or corner if AllowDiag. The volume is cut into
+  slabs of slices that are joined in parallel; the pairs that
+  straddle two slabs are joined afterwards. Returns the number of
+  clusters, or -1 on error.
+  -------------------------------------------------------------------*/
+int CCOMPlabelGrid(CCOMP *cc, const unsigned char *hit, int width, int height, int depth, int AllowDiag)
+{
+  int dc[13], dr[13], ds[13], noffsets, ncross, col, row, slc, n, nchunks;
+
+  if (cc->nelements != width * height * depth) {
+    printf("ERROR: CCOMPlabelGrid: %d elements, but grid is %d x %d x %d\n", cc->nelements, width, height, depth);
+    return (-1);
+  }
+
+  /* The half of the neighborhood that comes before a voxel, so that
+     each pair is only visited once. The ones in the previous slice
+     come first. */
+  noffsets = 0;
+  ncross = 0;
+  for (slc = -1; slc <= 0; slc++) {
+    for (row = -1; row <= 1; row++) {
+      for (col = -1; col <= 1; col++) {
+        if (slc == 0 && (row > 0 || (row == 0 && col >= 0))) continue;
+        if (!AllowDiag && abs(col) + abs(row) + abs(slc) != 1) continue;
+        dc[noffsets] = col;
+        dr[noffsets] = row;
+        ds[noffsets] = slc;
+        noffsets++;
+        if (slc < 0) ncross++;
+      }
+    }
+  }
+
+  for (n = 0; n < cc->nelements; n++) cc->parent[n] = n;
+
+  nchunks = ccompNumChunks(depth);
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) schedule(static, 1)
+#endif
+  for (n = 0; n < nchunks; n++) {
+    ROMP_PFLB_begin
+    int s, s0 = (long)depth * n / nchunks, s1 = (long)depth * (n + 1) / nchunks;
+    for (s = s0; s < s1; s++)
+      ccompJoinSlice(cc->parent, hit, width, height, s, dc, dr, ds, (s == s0) ? ncross : 0, noffsets);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  for (n = 1; n < nchunks; n++)
+    ccompJoinSlice(cc->parent, hit, width, height, (long)depth * n / nchunks, dc, dr, ds, 0, ncross);
+
+  return (ccompNumber(cc, hit));
+}
+
+/*-------------------------------------------------------------------
+  CCOMPlabelGraph() - finds the connected components of the hit
+  elements of a graph, where nbrs[e] points to the nnbrs[e]
+  neighbors of element e (eg, the vertices_topology v and vnum of a
+  surface). The elements are cut into ranges that are joined in
+  parallel; the pairs that straddle two ranges are joined
+  afterwards. Returns the number of clusters.
+  -------------------------------------------------------------------*/
+int CCOMPlabelGraph(CCOMP *cc, const unsigned char *hit, const int *nnbrs, const int *const *nbrs)
+{
+  int n, nchunks, nelements = cc->nelements;
+
+  for (n = 0; n < nelements; n++) cc->parent[n] = n;
+
+  nchunks = ccompNumChunks(nelements);
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) schedule(static, 1)
+#endif
+  for (n = 0; n < nchunks; n++) {
+    ROMP_PFLB_begin
+    int e, k, nbr, e0 = (long)nelements * n / nchunks, e1 = (long)nelements * (n + 1) / nchunks;
+    for (e = e0; e < e1; e++) {
+      if (!hit[e]) continue;
+      for (k = 0; k < nnbrs[e]; k++) {
+        nbr = nbrs[e][k];
+        if (nbr >= e0 && nbr < e1 && hit[nbr]) ccompUnion(cc->parent, e, nbr);
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  if (nchunks > 1) {
+    int e, k, nbr, e0, e1;
+    for (n = 0; n < nchunks; n++) {
+      e0 = (long)nelements * n / nchunks;
+      e1 = (long)nelements * (n + 1) / nchunks;
+      for (e = e0; e < e1; e++) {
+        if (!hit[e]) continue;
+        for (k = 0; k < nnbrs[e]; k++) {
+          nbr = nbrs[e][k];
+          if ((nbr < e0 || nbr >= e1) && hit[nbr]) ccompUnion(cc->parent, e, nbr);
+        }
+      }
+    }
+  }
+
+  return (ccompNumber(cc, hit));
+}
+
+/*-------------------------------------------------------------------
+  CCOMPsummarize() - computes the member count, size, weights and
+  maximum of every cluster in one pass over the elements. val and
+  size are per element; if size is NULL each element counts as 1,
+  if val is NULL the weights and maxima are 0.
+  -------------------------------------------------------------------*/
+int CCOMPsummarize(CCOMP *cc, const float *val, const float *size)
+{
+  int e, c, nclusters = cc->nclusters;
+  float v;
+  double h;
+
+  if (cc->nalloc < nclusters) {
+    cc->nmembers = (int *)realloc(cc->nmembers, nclusters * sizeof(int));
+    cc->size = (double *)realloc(cc->size, nclusters * sizeof(double));
+    cc->weight = (double *)realloc(cc->weight, nclusters * sizeof(double));
+    cc->weightsize = (double *)realloc(cc->weightsize, nclusters * sizeof(double));
+    cc->maxval = (float *)realloc(cc->maxval, nclusters * sizeof(float));
+    cc->maxelement = (int *)realloc(cc->maxelement, nclusters * sizeof(int));
+    if (cc->nmembers == NULL || cc->size == NULL || cc->weight == NULL || cc->weightsize == NULL ||
+        cc->maxval == NULL || cc->maxelement == NULL) {
+      printf("ERROR: CCOMPsummarize: could not alloc %d clusters\n", nclusters);
+      cc->nalloc = 0;
+      return (1);
+    }
+    cc->nalloc = nclusters;
+  }
+  for (c = 0; c < nclusters; c++) {
+    cc->nmembers[c] = 0;
+    cc->size[c] = 0;
+    cc->weight[c] = 0;
+    cc->weightsize[c] = 0;
+    cc->maxval[c] = 0;
+    cc->maxelement[c] = -1;
+  }
+
+  for (e = 0; e < cc->nelements; e++) {
+    c = cc->clusterno[e] - 1;
+    if (c < 0) continue;
+    v = (val != NULL) ? val[e] : 0;
+    h = (size != NULL) ? size[e] : 1;
+    cc->nmembers[c]++;
+    cc->size[c] += h;
+    cc->weight[c] += v;
+    cc->weightsize[c] += v * h;
+    if (cc->maxelement[c] < 0 || fabs(v) > fabs(cc->maxval[c])) {
+      cc->maxval[c] = v;
+      cc->maxelement[c] = e;
+    }
+  }
+  return (0);
+}
+
+/*-------------------------------------------------------------------
+  Threshold-free cluster enhancement (Smith and Nichols, 2009):
+    tfce(v) = integral from 0 to val(v) of e(h)^E h^H dh
+  where e(h) is the extent of the cluster holding v when thresholded
+  at h. Rather than clustering at a list of thresholds, the elements
+  are added from the highest value down and their clusters merged
+  with union-find, so the integral is exact and all thresholds are
+  done in one sweep. Each set root keeps the extent of its set and the
+  height down to which its contribution has been added (hlast). The
+  contribution is added lazily, only when the set changes, to acc of
+  the root; the tfce of an element is the sum of acc along its path to
+  the root, so joining a set subtracts the acc of the new root.
+  -------------------------------------------------------------------*/
+typedef struct
+{
+  int *parent;
+  int *nmembers;
+  double *acc;
+  double *extent;
+  double *hlast;
+  unsigned char *added;
+  double E, H;
+} TFCE_SWEEP;
+
+typedef struct
+{
+  float val;
+  int e;
+} TFCE_ELEMENT;
+
+static int tfceCompare(const void *a, const void *b)
+{
+  const TFCE_ELEMENT *ea = (const TFCE_ELEMENT *)a, *eb = (const TFCE_ELEMENT *)b;
+  if (ea->val > eb->val) return (-1);
+  if (ea->val < eb->val) return (+1);
+  return (ea->e - eb->e);
+}
+
+/* pow() with the usual TFCE exponents done directly */
+static inline double tfcePow(double x, double p)
+{
+  if (p == 0.5) return (sqrt(x));
+  if (p == 1) return (x);
+  if (p == 2) return (x * x);
+  if (p == 3) return (x * x * x);
+  return (pow(x, p));
+}
+
+/* Adds the contribution of set r between h and its hlast */
+static void tfceFlush(TFCE_SWEEP *t, int r, double h)
+{
+  if (t->hlast[r] > h) {
+    t->acc[r] += tfcePow(t->extent[r], t->E) * (tfcePow(t->hlast[r], t->H + 1) - tfcePow(h, t->H + 1)) / (t->H + 1);
+    t->hlast[r] = h;
+  }
+}
+
+/* Root of e. The path is compressed with each acc replaced by the sum
+   along the path up to (not including) the root. */
+static int tfceFind(TFCE_SWEEP *t, int e)
+{
+  int r, x, next;
+  double sum, old;
+
+  r = e;
+  sum = 0;
+  while (t->parent[r] != r) {
+    sum += t->acc[r];
+    r = t->parent[r];
+  }
+  for (x = e; x != r; x = next) {
+    next = t->parent[x];
+    old = t->acc[x];
+    t->acc[x] = sum;
+    sum -= old;
+    t->parent[x] = r;
+  }
+  return (r);
+}
+
+/* Joins the sets of a and b at height h, the smaller under the larger */
+static void tfceJoin(TFCE_SWEEP *t, int a, int b, double h)
+{
+  int tmp;
+
+  a = tfceFind(t, a);
+  b = tfceFind(t, b);
+  if (a == b) return;
+  tfceFlush(t, a, h);
+  tfceFlush(t, b, h);
+  if (t->nmembers[a] < t->nmembers[b]) {
+    tmp = a;
+    a = b;
+    b = tmp;
+  }
+  t->parent[b] = a;
+  t->acc[b] -= t->acc[a];
+  t->extent[a] += t->extent[b];
+  t->nmembers[a] += t->nmembers[b];
+}
+
+/*-------------------------------------------------------------------
+  tfceSweep() - computes the tfce of the elements whose value (times
+  sign) is > 0 and adds sign*tfce to the output. Neighbors are the
+  grid neighbors if width > 0, otherwise those in nbrs.
+  -------------------------------------------------------------------*/
+static int tfceSweep(int nelements, const float *val, int sign, const float *size, int width, int height, int depth,
+                     int AllowDiag, const int *nnbrs, const int *const *nbrs, double E, double H, float *tfce)
+{
+  TFCE_SWEEP t;
+  TFCE_ELEMENT *list;
+  int n, nlist, e, k, col, row, slc, dc, dr, ds, nbr;
+  double h;
+
+  list = (TFCE_ELEMENT *)calloc(nelements, sizeof(TFCE_ELEMENT));
+  nlist = 0;
+  for (e = 0; e < nelements; e++) {
+    if (sign * val[e] <= 0) continue;
+    list[nlist].val = sign * val[e];
+    list[nlist].e = e;
+    nlist++;
+  }
+  if (nlist == 0) {
+    free(list);
+    return (0);
+  }
+  qsort(list, nlist, sizeof(TFCE_ELEMENT), tfceCompare);
+
+  t.E = E;
+  t.H = H;
+  t.parent = (int *)calloc(nelements, sizeof(int));
+  t.nmembers = (int *)calloc(nelements, sizeof(int));
+  t.acc = (double *)calloc(nelements, sizeof(double));
+  t.extent = (double *)calloc(nelements, sizeof(double));
+  t.hlast = (double *)calloc(nelements, sizeof(double));
+  t.added = (unsigned char *)calloc(nelements, sizeof(unsigned char));
+  if (t.parent == NULL || t.nmembers == NULL || t.acc == NULL || t.extent == NULL || t.hlast == NULL ||
+      t.added == NULL) {
+    printf("ERROR: tfceSweep: could not alloc %d\n", nelements);
+    free(list);
+    return (1);
+  }
+
+  for (n = 0; n < nlist; n++) {
+    e = list[n].e;
+    h = list[n].val;
+    t.parent[e] = e;
+    t.nmembers[e] = 1;
+    t.extent[e] = (size != NULL) ? size[e] : 1;
+    t.hlast[e] = h;
+    t.added[e] = 1;
+    if (width > 0) {
+      col = e % width;
+      row = (e / width) % height;
+      slc = e / (width * height);
+      for (ds = -1; ds <= 1; ds++) {
+        if (slc + ds < 0 || slc + ds >= depth) continue;
+        for (dr = -1; dr <= 1; dr++) {
+          if (row + dr < 0 || row + dr >= height) continue;
+          for (dc = -1; dc <= 1; dc++) {
+            if (col + dc < 0 || col + dc >= width) continue;
+            k = abs(dc) + abs(dr) + abs(ds);
+            if (k == 0 || (!AllowDiag && k != 1)) continue;
+            nbr = e + dc + width * (dr + height * ds);
+            if (t.added[nbr]) tfceJoin(&t, e, nbr, h);
+          }
+        }
+      }
+    }
+    else {
+      for (k = 0; k < nnbrs[e]; k++) {
+        nbr = nbrs[e][k];
+        if (t.added[nbr]) tfceJoin(&t, e, nbr, h);
+      }
+    }
+  }
+
+  // Integrate the sets that are left down to 0, then read out
+  for (n = 0; n < nlist; n++) {
+    e = list[n].e;
+    if (t.parent[e] == e) tfceFlush(&t, e, 0);
+  }
+  for (n = 0; n < nlist; n++) {
+    e = list[n].e;
+    k = tfceFind(&t, e);
+    h = t.acc[e];
+    if (k != e) h += t.acc[k];
+    tfce[e] += sign * h;
+  }
+
+  free(list);
+  free(t.parent);
+  free(t.nmembers);
+  free(t.acc);
+  free(t.extent);
+  free(t.hlast);
+  free(t.added);
+  return (0);
+}
+
+/*-------------------------------------------------------------------
+  TFCEgrid() - threshold-free cluster enhancement of the values of a
+  width x height x depth grid (index col + width*(row + height*slc)).
+  Neighbors share a face, or also an edge or corner if AllowDiag. If
+  size is NULL the extent is the number of voxels. thsign = +1 uses
+  the positive values, -1 the negative values (giving a negative
+  tfce), and 0 does each tail separately. E and H are the extent and
+  height exponents (0.5 and 2 are usual for volumes).
+  -------------------------------------------------------------------*/
+int TFCEgrid(const float *val, const float *size, int width, int height, int depth, int AllowDiag, double E,
+             double H, int thsign, float *tfce)
+{
+  int nelements = width * height * depth, err = 0;
+
+  memset(tfce, 0, nelements * sizeof(float));
+  if (thsign >= 0) err |= tfceSweep(nelements, val, +1, size, width, height, depth, AllowDiag, NULL, NULL, E, H, tfce);
+  if (thsign <= 0) err |= tfceSweep(nelements, val, -1, size, width, height, depth, AllowDiag, NULL, NULL, E, H, tfce);
+  return (err);
+}
+
+/*-------------------------------------------------------------------
+  TFCEgraph() - same as TFCEgrid() but the neighbors of element e are
+  the nnbrs[e] elements in nbrs[e] (eg, the vertices_topology v and
+  vnum of a surface), and size is usually the vertex area (E = 1 and
+  H = 2 are usual for surfaces).
+  -------------------------------------------------------------------*/
+int TFCEgraph(const float *val, const float *size, int nelements, const int *nnbrs, const int *const *nbrs, double E,
+              double H, int thsign, float *tfce)
+{
+  int err = 0;
+
+  memset(tfce, 0, nelements * sizeof(float));
+  if (thsign >= 0) err |= tfceSweep(nelements, val, +1, size, 0, 0, 0, 0, nnbrs, nbrs, E, H, tfce);
+  if (thsign <= 0) err |= tfceSweep(nelements, val, -1, size, 0, 0, 0, 0, nnbrs, nbrs, E, H, tfce);
+  return (err);
+}
+
+/*-------------------------------------------------------------------
+  MRItfce() - TFCE map of a frame of a volume, with the same (face)
+  contiguity as clustGetClusters(). Voxels outside the mask are 0.
+  The extent is in voxels.
+  -------------------------------------------------------------------*/
+MRI *MRItfce(MRI *vol, int frame, MRI *mask, int thsign, double E, double H, MRI *tfce)
+{
+  int c, r, s, n, nvox;
+  float *val, *out;
+
+  if (tfce == NULL) {
+    tfce = MRIallocSequence(vol->width, vol->height, vol->depth, MRI_FLOAT, 1);
+    MRIcopyHeader(vol, tfce);
+  }
+  nvox = vol->width * vol->height * vol->depth;
+  val = (float *)calloc(nvox, sizeof(float));
+  out = (float *)calloc(nvox, sizeof(float));
+  n = 0;
+  for (s = 0; s < vol->depth; s++)
+    for (r = 0; r < vol->height; r++)
+      for (c = 0; c < vol->width; c++, n++)
+        if (mask == NULL || MRIgetVoxVal(mask, c, r, s, 0) >= 0.5) val[n] = MRIgetVoxVal(vol, c, r, s, frame);
+
+  TFCEgrid(val, NULL, vol->width, vol->height, vol->depth, 0, E, H, thsign, out);
+
+  n = 0;
+  for (s = 0; s < vol->depth; s++)
+    for (r = 0; r < vol->height; r++)
+      for (c = 0; c < vol->width; c++, n++) MRIsetVoxVal(tfce, c, r, s, 0, out[n]);
+
+  free(val);
+  free(out);
+  return (tfce);
+}
+
 /*-------------------------------------------------------------*/
 
 /*----------------------------------------------------------------
@@ -1273,6 +1934,7 @@ CLUSTER_SIM_DATA *CSDalloc(void)
   csd->varfwhm = -1;
   csd->searchspace = -1;
   csd->nreps = -1;
+  csd->tfce = 0;
   // Always do this now (4/9/10)
   csd->FixGroupSubjectArea = 1;
   // if(getenv("FIX_VERTEX_AREA") == NULL) csd->FixGroupSubjectArea = 0;
@@ -1354,6 +2016,10 @@ CLUSTER_SIM_DATA *CSDread(char *csdfile)
       }
       else if (!strcmp(tag, "FixGroupSubjectArea"))
         fscanf(fp, "%d", &(csd->FixGroupSubjectArea));
+      else if (!strcmp(tag, "tfce")) {
+        fscanf(fp, "%lf %lf", &(csd->tfceE), &(csd->tfceH));
+        csd->tfce = 1;
+      }
       else
         fgets(tmpstr, 1000, fp);  // not an interesting line, so get past it
     }
@@ -1376,9 +2042,103 @@ CLUSTER_SIM_DATA *CSDread(char *csdfile)
       nthrep++;
     }
   }
+  if (csd->tfce && csd->nreps > 0) {
+    // The max TFCE is kept in a separate file next to the CSD
+    CSDtfceFileName(csdfile, tmpstr);
+    if (CSDreadTFCE(tmpstr, csd)) {
+      printf("WARNING: CSDread(): could not read the max TFCE of %s from %s\n", csdfile, tmpstr);
+    }
+  }
   return (csd);
 }
 
+/*--------------------------------------------------------------
+  CSDtfceFileName() - name of the file that holds the max TFCE of
+  each repetition of the CSD in csdfile: the CSD file name with
+  .csd replaced by .maxtfce.dat. The max TFCE is kept out of the
+  CSD file itself so that its columns stay the same for programs
+  that read them by position.
+  --------------------------------------------------------------*/
+int CSDtfceFileName(const char *csdfile, char *fname)
+{
+  int len = strlen(csdfile);
+  if (len > 4 && !strcmp(&csdfile[len - 4], ".csd")) len -= 4;
+  sprintf(fname, "%.*s.maxtfce.dat", len, csdfile);
+  return (0);
+}
+
+/*--------------------------------------------------------------
+  CSDwriteTFCE() - writes the max TFCE of each repetition of a CSD
+  with tfce set, one "LoopNo MaxTFCE" line per repetition.
+  --------------------------------------------------------------*/
+int CSDwriteTFCE(const char *fname, CSD *csd)
+{
+  FILE *fp;
+  int nthrep;
+
+  fp = fopen(fname, "w");
+  if (fp == NULL) {
+    printf("ERROR: CSDwriteTFCE(): could not open %s\n", fname);
+    return (1);
+  }
+  fprintf(fp, "# MaxTFCE 1\n");
+  fprintf(fp, "# contrast    %s\n", csd->contrast);
+  fprintf(fp, "# seed        %ld\n", csd->seed);
+  fprintf(fp, "# threshsign  %lf\n", csd->threshsign);
+  fprintf(fp, "# tfce        %lf %lf\n", csd->tfceE, csd->tfceH);
+  fprintf(fp, "# nrepetitions %d\n", csd->nreps);
+  fprintf(fp, "# LoopNo    MaxTFCE\n");
+  for (nthrep = 0; nthrep < csd->nreps; nthrep++) fprintf(fp, "%7d     %g\n", nthrep, csd->MaxTFCE[nthrep]);
+  fclose(fp);
+  return (0);
+}
+
+/*--------------------------------------------------------------
+  CSDreadTFCE() - reads the max TFCE written by CSDwriteTFCE() into
+  a CSD whose data are already allocated. Returns 1 if the file
+  cannot be read, its TFCE exponents differ from those of the CSD,
+  or it has fewer than csd->nreps repetitions.
+  --------------------------------------------------------------*/
+int CSDreadTFCE(const char *fname, CSD *csd)
+{
+  FILE *fp;
+  char tag[1000], tmpstr[1000];
+  int r, nthrep, loopno;
+  double E = -1, H = -1, d;
+
+  fp = fopen(fname, "r");
+  if (fp == NULL) {
+    printf("ERROR: CSDreadTFCE(): could not open %s\n", fname);
+    return (1);
+  }
+  nthrep = 0;
+  while (1) {
+    r = fscanf(fp, "%s", tag);
+    if (r == EOF) break;
+    if (!strcmp(tag, "#")) {
+      fscanf(fp, "%s", tag);
+      if (!strcmp(tag, "tfce"))
+        fscanf(fp, "%lf %lf", &E, &H);
+      else
+        fgets(tmpstr, 1000, fp);
+      continue;
+    }
+    if (sscanf(tag, "%d", &loopno) != 1 || fscanf(fp, "%lf", &d) != 1) break;
+    if (nthrep < csd->nreps) csd->MaxTFCE[nthrep] = d;
+    nthrep++;
+  }
+  fclose(fp);
+  if (fabs(E - csd->tfceE) > 1e-6 || fabs(H - csd->tfceH) > 1e-6) {
+    printf("ERROR: CSDreadTFCE(): %s has TFCE E=%g H=%g, expected E=%g H=%g\n", fname, E, H, csd->tfceE, csd->tfceH);
+    return (1);
+  }
+  if (nthrep < csd->nreps) {
+    printf("ERROR: CSDreadTFCE(): %s has %d repetitions, expected %d\n", fname, nthrep, csd->nreps);
+    return (1);
+  }
+  return (0);
+}
+
 /*--------------------------------------------------------------
   CSDreadMerge() - reads in a CSD file and merges it with
   another CSD. If the input csd is NULL, then it is the
@@ -1423,6 +2183,7 @@ int CSDallocData(CLUSTER_SIM_DATA *csd)
   csd->MaxClusterWeightArea = (double *)calloc(csd->nreps, sizeof(double));
   csd->MaxSig = (double *)calloc(csd->nreps, sizeof(double));
   csd->MaxStat = (double *)calloc(csd->nreps, sizeof(double));
+  csd->MaxTFCE = (double *)calloc(csd->nreps, sizeof(double));
   return (0);
 }
 
@@ -1460,6 +2221,10 @@ int CSDfreeData(CLUSTER_SIM_DATA *csd)
     free(csd->MaxStat);
     csd->MaxStat = NULL;
   }
+  if (csd->MaxTFCE) {
+    free(csd->MaxTFCE);
+    csd->MaxTFCE = NULL;
+  }
   if (csd->mcs_pdf) HISTOfree(&csd->mcs_pdf);
   if (csd->mcs_cdf) HISTOfree(&csd->mcs_cdf);
   if (csd->ms_pdf) HISTOfree(&csd->ms_pdf);
@@ -1494,6 +2259,9 @@ CSD *CSDcopy(CSD *csd, CSD *csdcopy)
   csdcopy->nullfwhm = csd->nullfwhm;
   csdcopy->varfwhm = csd->varfwhm;
   csdcopy->FixGroupSubjectArea = csd->FixGroupSubjectArea;
+  csdcopy->tfce = csd->tfce;
+  csdcopy->tfceE = csd->tfceE;
+  csdcopy->tfceH = csd->tfceH;
 
   csdcopy->nreps = csd->nreps;
   CSDallocData(csdcopy);
@@ -1506,6 +2274,7 @@ CSD *CSDcopy(CSD *csd, CSD *csdcopy)
     csdcopy->MaxClusterWeightArea[nthrep] = csd->MaxClusterWeightArea[nthrep];
     csdcopy->MaxSig[nthrep] = csd->MaxSig[nthrep];
     csdcopy->MaxStat[nthrep] = csd->MaxStat[nthrep];
+    csdcopy->MaxTFCE[nthrep] = csd->MaxTFCE[nthrep];
   }
   return (csdcopy);
 }
@@ -1574,6 +2343,11 @@ CSD *CSDmerge(CSD *csd1, CSD *csd2)
     printf("ERROR: CSDmerge: CSDs have same seed\n");
     return (NULL);
   }
+  if (csd1->tfce != csd2->tfce ||
+      (csd1->tfce && (csd1->tfceE != csd2->tfceE || csd1->tfceH != csd2->tfceH))) {
+    printf("ERROR: CSDmerge: CSDs have different TFCE settings\n");
+    return (NULL);
+  }
 
   csd = (CLUSTER_SIM_DATA *)calloc(sizeof(CLUSTER_SIM_DATA), 1);
   strcpy(csd->simtype, csd1->simtype);
@@ -1589,6 +2363,9 @@ CSD *CSDmerge(CSD *csd1, CSD *csd2)
   csd->seed = csd1->seed;
   csd->mergedflag = 1;
   csd->FixGroupSubjectArea = csd1->FixGroupSubjectArea;
+  csd->tfce = csd1->tfce;
+  csd->tfceE = csd1->tfceE;
+  csd->tfceH = csd1->tfceH;
 
   csd->nreps = csd1->nreps + csd2->nreps;
   CSDallocData(csd);
@@ -1602,6 +2379,7 @@ CSD *CSDmerge(CSD *csd1, CSD *csd2)
     csd->MaxClusterWeightArea[nthrep] = csd1->MaxClusterWeightArea[nthrep1];
     csd->MaxSig[nthrep] = csd1->MaxSig[nthrep1];
     csd->MaxStat[nthrep] = csd1->MaxStat[nthrep1];
+    csd->MaxTFCE[nthrep] = csd1->MaxTFCE[nthrep1];
     nthrep++;
   }
   for (nthrep2 = 0; nthrep2 < csd2->nreps; nthrep2++) {
@@ -1612,6 +2390,7 @@ CSD *CSDmerge(CSD *csd1, CSD *csd2)
     csd->MaxClusterWeightArea[nthrep] = csd2->MaxClusterWeightArea[nthrep1];
     csd->MaxSig[nthrep] = csd2->MaxSig[nthrep2];
     csd->MaxStat[nthrep] = csd2->MaxStat[nthrep2];
+    csd->MaxTFCE[nthrep] = csd2->MaxTFCE[nthrep2];
     nthrep++;
   }
 
@@ -1638,6 +2417,7 @@ int CSDprintHeader(FILE *fp, CLUSTER_SIM_DATA *csd)
   fprintf(fp, "# searchspace %lf\n", csd->searchspace);
   fprintf(fp, "# nullfwhm    %lf\n", csd->nullfwhm);
   fprintf(fp, "# varfwhm     %lf\n", csd->varfwhm);
+  if (csd->tfce) fprintf(fp, "# tfce        %lf %lf\n", csd->tfceE, csd->tfceH);
 
   // Both volume and surface will have nrepetitions, and it will
   // always be accurate.
@@ -1793,35 +2573,58 @@ double CSDpvalMaxSig(double val, CSD *csd)
   return (pval);
 }
 
+/*
+  --------------------------------------------------------------------------
+  CSDpvalMaxTFCE() - computes the emperical probability of getting a
+  MaxTFCE greater than the given value (taking into account the sign).
+  The CSD must have been simulated with tfce set.
+  --------------------------------------------------------------------------
+*/
+double CSDpvalMaxTFCE(double val, CSD *csd)
+{
+  int n, nover;
+  double pval;
+
+  nover = 0;  // number of times maxtfce exceeds the given value
+  for (n = 0; n < csd->nreps; n++) {
+    if (csd->threshsign == 0 && (fabs(csd->MaxTFCE[n]) > fabs(val)))
+      nover++;
+    else if (csd->threshsign > +0.5 && (csd->MaxTFCE[n] > val))
+      nover++;
+    else if (csd->threshsign < -0.5 && (csd->MaxTFCE[n] < val))
+      nover++;
+  }
+  pval = (double)nover / csd->nreps;
+  return (pval);
+}
+
 /*-------------------------------------------------------------------
-  CSDpvalMaxSigMap() - computes the voxel-wise sig value of each voxel
-  based on the CSD. The input and output are -log10(p)*sign, where
-  sign is the sign of the input value. Bonf is for an additional
-  Bonferroni correction (eg, 2 for across hemisphere or 3 for across
-  hemis and subcortical).
+  CSDpvalMaxMap() - voxel-wise -log10(p)*sign of each voxel of in,
+  where p comes from pvalfunc (CSDpvalMaxSig or CSDpvalMaxTFCE).
   ------------------------------------------------------------------*/
-MRI *CSDpvalMaxSigMap(MRI *sig, CSD *csd, MRI *mask, MRI *vwsig, double *maxmaxsig, int Bonf)
+static MRI *CSDpvalMaxMap(const char *name, double (*pvalfunc)(double, CSD *), MRI *in, CSD *csd, MRI *mask,
+                          MRI *vwsig, double *maxmaxsig, int Bonf)
 {
   int c, r, s, f, nhits, nvox;
   double m, val, voxsig, pval, maxvoxsig;
 
-  if (vwsig == NULL) vwsig = MRIclone(sig, NULL);
+  if (vwsig == NULL) vwsig = MRIclone(in, NULL);
 
   nvox = 0;
   nhits = 0;
   maxvoxsig = 0;
-  for (s = 0; s < sig->depth; s++) {
-    for (r = 0; r < sig->height; r++) {
-      for (c = 0; c < sig->width; c++) {
+  for (s = 0; s < in->depth; s++) {
+    for (r = 0; r < in->height; r++) {
+      for (c = 0; c < in->width; c++) {
         if (mask) {
           m = MRIgetVoxVal(mask, c, r, s, 0);
           if (m < 0.5) continue;
         }
         nvox++;
-        for (f = 0; f < sig->nframes; f++) {
-          val = MRIgetVoxVal(sig, c, r, s, f);
+        for (f = 0; f < in->nframes; f++) {
+          val = MRIgetVoxVal(in, c, r, s, f);
           if (fabs(val) > 0.0) {
-            pval = CSDpvalMaxSig(val, csd);
+            pval = pvalfunc(val, csd);
             if (Bonf > 0) pval = 1 - pow((1 - pval), Bonf);
             voxsig = -SIGN(val) * log10(pval);
           }
@@ -1839,11 +2642,37 @@ MRI *CSDpvalMaxSigMap(MRI *sig, CSD *csd, MRI *mask, MRI *vwsig, double *maxmaxs
       }
     }
   }
-  printf("CSDpvalMaxSigMap(): found %d/%d above 0, max=%g\n", nhits, nvox, maxvoxsig);
+  printf("%s(): found %d/%d above 0, max=%g\n", name, nhits, nvox, maxvoxsig);
   *maxmaxsig = maxvoxsig;
   return (vwsig);
 }
 
+/*-------------------------------------------------------------------
+  CSDpvalMaxSigMap() - computes the voxel-wise sig value of each voxel
+  based on the CSD. The input and output are -log10(p)*sign, where
+  sign is the sign of the input value. Bonf is for an additional
+  Bonferroni correction (eg, 2 for across hemisphere or 3 for across
+  hemis and subcortical).
+  ------------------------------------------------------------------*/
+MRI *CSDpvalMaxSigMap(MRI *sig, CSD *csd, MRI *mask, MRI *vwsig, double *maxmaxsig, int Bonf)
+{
+  return (CSDpvalMaxMap("CSDpvalMaxSigMap", CSDpvalMaxSig, sig, csd, mask, vwsig, maxmaxsig, Bonf));
+}
+
+/*-------------------------------------------------------------------
+  CSDpvalMaxTFCEMap() - same as CSDpvalMaxSigMap() but the input is
+  the TFCE of the sig (MRItfce() or MRIStfce() with the exponents of
+  the CSD), and the p is from the max TFCE of the simulation.
+  ------------------------------------------------------------------*/
+MRI *CSDpvalMaxTFCEMap(MRI *tfce, CSD *csd, MRI *mask, MRI *vwsig, double *maxmaxsig, int Bonf)
+{
+  if (!csd->tfce) {
+    printf("ERROR: CSDpvalMaxTFCEMap(): CSD was not simulated with TFCE\n");
+    return (NULL);
+  }
+  return (CSDpvalMaxMap("CSDpvalMaxTFCEMap", CSDpvalMaxTFCE, tfce, csd, mask, vwsig, maxmaxsig, Bonf));
+}
+
 /*-----------------------------------------------------------------------
   CSDcheckSimType() - checks simulation type string to make sure it
   is one that is recognized. Returns 0 if ok, 1 otherwise.
@@ -1994,5 +2823,11 @@ int CSDwrite(char *fname, CSD *csd)
     return (1);
   }
   CSDprint(fp, csd);
+  fclose(fp);
+  if (csd->tfce) {
+    char tfcefile[2000];
+    CSDtfceFileName(fname, tfcefile);
+    return (CSDwriteTFCE(tfcefile, csd));
+  }
   return (0);
 }